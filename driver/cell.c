@@ -10,10 +10,24 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <linux/anon_inodes.h>
 #include <linux/cpu.h>
+#include <linux/delay.h>
+#include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/kref.h>
 #include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/signal.h>
+#endif
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <asm/cacheflush.h>
 
 #include "cell.h"
@@ -28,11 +42,24 @@ struct cell *root_cell;
 static LIST_HEAD(cells);
 static cpumask_t offlined_cpus;
 
+static void cell_free_snapshot(struct cell *cell)
+{
+	unsigned int n;
+
+	for (n = 0; n < cell->num_snapshot_images; n++)
+		vfree(cell->snapshot_images[n].data);
+	kfree(cell->snapshot_images);
+
+	cell->snapshot_images = NULL;
+	cell->num_snapshot_images = 0;
+}
+
 void jailhouse_cell_kobj_release(struct kobject *kobj)
 {
 	struct cell *cell = container_of(kobj, struct cell, kobj);
 
 	jailhouse_pci_cell_cleanup(cell);
+	cell_free_snapshot(cell);
 	vfree(cell->memory_regions);
 	kfree(cell);
 }
@@ -61,6 +88,7 @@ retry:
 		return ERR_PTR(-ENOMEM);
 
 	INIT_LIST_HEAD(&cell->entry);
+	INIT_LIST_HEAD(&cell->steered_irqs);
 
 	cell->id = id;
 
@@ -102,6 +130,8 @@ static void cell_register(struct cell *cell)
 {
 	list_add_tail(&cell->entry, &cells);
 	jailhouse_sysfs_cell_register(cell);
+	if (cell != root_cell)
+		jailhouse_cell_console_register(cell);
 }
 
 static struct cell *find_cell(struct jailhouse_cell_id *cell_id)
@@ -116,8 +146,50 @@ static struct cell *find_cell(struct jailhouse_cell_id *cell_id)
 	return NULL;
 }
 
+/*
+ * Wake up sysfs readers polling the state of cells that changed it, e.g. due
+ * to an expired watchdog. Must be called with jailhouse_lock held.
+ */
+void jailhouse_cell_notify_state_changes(void)
+{
+	struct cell *cell;
+	int state;
+
+	list_for_each_entry(cell, &cells, entry) {
+		state = jailhouse_cell_state(cell->id);
+		if (state != cell->notified_state) {
+			cell->notified_state = state;
+			sysfs_notify(&cell->kobj, NULL, "state");
+		}
+	}
+}
+
+#ifdef CONFIG_PCI
+/*
+ * Return the non-root cell that is linked to the root cell via the ivshmem
+ * device with the given BDF. Must be called with jailhouse_lock held.
+ */
+struct cell *jailhouse_cell_find_ivshmem_peer(u16 bdf)
+{
+	struct cell *cell;
+	unsigned int n;
+
+	list_for_each_entry(cell, &cells, entry) {
+		if (cell == root_cell)
+			continue;
+		for (n = 0; n < cell->num_pci_devices; n++)
+			if (cell->pci_devices[n].type ==
+			    JAILHOUSE_PCI_TYPE_IVSHMEM &&
+			    cell->pci_devices[n].bdf == bdf)
+				return cell;
+	}
+	return NULL;
+}
+#endif /* CONFIG_PCI */
+
 static void cell_delete(struct cell *cell)
 {
+	jailhouse_cell_console_unregister(cell);
 	list_del(&cell->entry);
 	jailhouse_sysfs_cell_delete(cell);
 }
@@ -146,132 +218,149 @@ void jailhouse_cell_delete_root(void)
 	root_cell = NULL;
 }
 
-int jailhouse_cmd_cell_create(struct jailhouse_cell_create __user *arg)
+/*
+ * Cell management requests submitted with JAILHOUSE_CELL_ASYNC. The request
+ * data is copied from user space (and its image pages pinned) on submission,
+ * the request itself runs on cell_op_wq. Hypervisor calls remain serialized by
+ * jailhouse_lock.
+ */
+struct cell_op {
+	struct work_struct work;
+	struct kref refs;
+	wait_queue_head_t wait;
+	bool done;
+	int result;
+	int (*run)(void *data);
+	void (*release)(void *data);
+	void *data;
+};
+
+static struct workqueue_struct *cell_op_wq;
+
+static void cell_op_free(struct kref *refs)
 {
-	struct jailhouse_cell_create cell_params;
-	struct jailhouse_cell_desc *config;
-	struct jailhouse_cell_id cell_id;
-	void __user *user_config;
-	struct cell *cell;
-	unsigned int cpu;
-	int err = 0;
+	kfree(container_of(refs, struct cell_op, refs));
+}
 
-	if (copy_from_user(&cell_params, arg, sizeof(cell_params)))
-		return -EFAULT;
+static void cell_op_work(struct work_struct *work)
+{
+	struct cell_op *op = container_of(work, struct cell_op, work);
 
-	config = kmalloc(cell_params.config_size, GFP_USER | __GFP_NOWARN);
-	if (!config)
-		return -ENOMEM;
+	op->result = op->run(op->data);
+	op->release(op->data);
 
-	user_config = (void __user *)(unsigned long)cell_params.config_address;
-	if (copy_from_user(config, user_config, cell_params.config_size)) {
-		err = -EFAULT;
-		goto kfree_config_out;
-	}
+	smp_store_release(&op->done, true);
+	wake_up_interruptible(&op->wait);
 
-	if (cell_params.config_size < sizeof(*config) ||
-	    memcmp(config->signature, JAILHOUSE_CELL_DESC_SIGNATURE,
-		   sizeof(config->signature)) != 0) {
-		pr_err("jailhouse: Not a cell configuration\n");
-		err = -EINVAL;
-		goto kfree_config_out;
-	}
-	if (config->revision != JAILHOUSE_CONFIG_REVISION) {
-		pr_err("jailhouse: Configuration revision mismatch\n");
-		err = -EINVAL;
-		goto kfree_config_out;
-	}
+	kref_put(&op->refs, cell_op_free);
+}
 
-	config->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+static ssize_t cell_op_read(struct file *file, char __user *buf,
+			    size_t count, loff_t *ppos)
+{
+	struct cell_op *op = file->private_data;
+	__s32 result;
+	int err;
 
-	/* CONSOLE_ACTIVE implies CONSOLE_PERMITTED for non-root cells */
-	if (CELL_FLAGS_VIRTUAL_CONSOLE_ACTIVE(config->flags))
-		config->flags |= JAILHOUSE_CELL_VIRTUAL_CONSOLE_PERMITTED;
+	if (count < sizeof(result))
+		return -EINVAL;
 
-	if (mutex_lock_interruptible(&jailhouse_lock) != 0) {
-		err = -EINTR;
-		goto kfree_config_out;
+	if (!smp_load_acquire(&op->done)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		err = wait_event_interruptible(op->wait,
+					       smp_load_acquire(&op->done));
+		if (err)
+			return err;
 	}
 
-	if (!jailhouse_enabled) {
-		err = -EINVAL;
-		goto unlock_out;
-	}
+	result = op->result;
+	if (copy_to_user(buf, &result, sizeof(result)))
+		return -EFAULT;
 
-	cell_id.id = JAILHOUSE_CELL_ID_UNUSED;
-	memcpy(cell_id.name, config->name, sizeof(cell_id.name));
-	if (find_cell(&cell_id) != NULL) {
-		err = -EEXIST;
-		goto unlock_out;
-	}
+	return sizeof(result);
+}
 
-	cell = cell_create(config);
-	if (IS_ERR(cell)) {
-		err = PTR_ERR(cell);
-		goto unlock_out;
-	}
+static __poll_t cell_op_poll(struct file *file, struct poll_table_struct *wait)
+{
+	struct cell_op *op = file->private_data;
 
-	config->id = cell->id;
+	poll_wait(file, &op->wait, wait);
 
-	if (!cpumask_subset(&cell->cpus_assigned, &root_cell->cpus_assigned)) {
-		err = -EBUSY;
-		goto error_cell_delete;
-	}
+	return smp_load_acquire(&op->done) ? EPOLLIN | EPOLLRDNORM : 0;
+}
 
-	/* Off-line each CPU assigned to the new cell and remove it from the
-	 * root cell's set. */
-	for_each_cpu(cpu, &cell->cpus_assigned) {
-#ifdef CONFIG_X86
-		if (cpu == 0) {
-			/*
-			 * On x86, Linux only parks CPU 0 when offlining it and
-			 * expects to be able to get it back by sending an IPI.
-			 * This is not support by Jailhouse wich destroys the
-			 * CPU state across non-root assignments.
-			 */
-			pr_err("Cannot assign CPU 0 to other cells\n");
-			err = -EINVAL;
-			goto error_cpu_online;
-		}
-#endif
-		if (cpu_online(cpu)) {
-			err = cpu_down(cpu);
-			if (err)
-				goto error_cpu_online;
-			cpumask_set_cpu(cpu, &offlined_cpus);
-		}
-		cpumask_clear_cpu(cpu, &root_cell->cpus_assigned);
-	}
+static int cell_op_release(struct inode *inode, struct file *file)
+{
+	struct cell_op *op = file->private_data;
 
-	jailhouse_pci_do_all_devices(cell, JAILHOUSE_PCI_TYPE_DEVICE,
-	                             JAILHOUSE_PCI_ACTION_CLAIM);
+	kref_put(&op->refs, cell_op_free);
 
-	err = jailhouse_call_arg1(JAILHOUSE_HC_CELL_CREATE, __pa(config));
-	if (err < 0)
-		goto error_cpu_online;
+	return 0;
+}
 
-	cell_register(cell);
+static const struct file_operations cell_op_fops = {
+	.owner = THIS_MODULE,
+	.llseek = noop_llseek,
+	.read = cell_op_read,
+	.poll = cell_op_poll,
+	.release = cell_op_release,
+};
 
-	pr_info("Created Jailhouse cell \"%s\"\n", config->name);
+/*
+ * Queue a request and return the file descriptor that reports its
+ * completion. The request data is released in any case.
+ */
+static int cell_op_submit(int (*run)(void *data), void (*release)(void *data),
+			  void *data)
+{
+	struct cell_op *op;
+	int fd;
 
-unlock_out:
-	mutex_unlock(&jailhouse_lock);
+	op = kzalloc(sizeof(*op), GFP_KERNEL);
+	if (!op) {
+		release(data);
+		return -ENOMEM;
+	}
 
-kfree_config_out:
-	kfree(config);
+	INIT_WORK(&op->work, cell_op_work);
+	init_waitqueue_head(&op->wait);
+	op->run = run;
+	op->release = release;
+	op->data = data;
+	/* one reference for the file, one for the pending work */
+	kref_init(&op->refs);
+	kref_get(&op->refs);
+
+	fd = anon_inode_getfd("jailhouse-cell-op", &cell_op_fops, op,
+			      O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		release(data);
+		kfree(op);
+		return fd;
+	}
 
-	return err;
+	queue_work(cell_op_wq, &op->work);
 
-error_cpu_online:
-	for_each_cpu(cpu, &cell->cpus_assigned) {
-		if (!cpu_online(cpu) && cpu_up(cpu) == 0)
-			cpumask_clear_cpu(cpu, &offlined_cpus);
-		cpumask_set_cpu(cpu, &root_cell->cpus_assigned);
-	}
+	return fd;
+}
 
-error_cell_delete:
-	cell_delete(cell);
-	goto unlock_out;
+static void cell_op_kfree(void *data)
+{
+	kfree(data);
+}
+
+int jailhouse_cell_init(void)
+{
+	cell_op_wq = alloc_workqueue("jailhouse-cell-ops", WQ_UNBOUND, 0);
+
+	return cell_op_wq ? 0 : -ENOMEM;
+}
+
+/* Completes all queued requests, their file descriptors may still be open. */
+void jailhouse_cell_exit(void)
+{
+	destroy_workqueue(cell_op_wq);
 }
 
 static int cell_management_prologue(struct jailhouse_cell_id *cell_id,
@@ -292,166 +381,963 @@ static int cell_management_prologue(struct jailhouse_cell_id *cell_id,
 		mutex_unlock(&jailhouse_lock);
 		return -ENOENT;
 	}
+
+	/* images are being copied into the cell without holding the lock */
+	if ((*cell_ptr)->loading) {
+		mutex_unlock(&jailhouse_lock);
+		return -EBUSY;
+	}
 	return 0;
 }
 
-#define MEM_REQ_FLAGS	(JAILHOUSE_MEM_WRITE | JAILHOUSE_MEM_LOADABLE)
-
-static int load_image(struct cell *cell,
-		      struct jailhouse_preload_image __user *uimage)
+/*
+ * The hypervisor returns -EAGAIN while a cell that does not block the
+ * management CPU has not yet replied to the shutdown or CPU removal request.
+ * Sleep instead of spinning while waiting for the reply.
+ */
+static int cell_management_call(unsigned int call, unsigned int id)
 {
-	struct jailhouse_preload_image image;
-	const struct jailhouse_memory *mem;
-	unsigned int regions, page_offs;
-	u64 image_offset, phys_start;
-	void *image_mem;
-	int err = 0;
+	int err;
 
-	if (copy_from_user(&image, uimage, sizeof(image)))
-		return -EFAULT;
+	while ((err = jailhouse_call_arg1(call, id)) == -EAGAIN) {
+		if (signal_pending(current))
+			return -EINTR;
+		usleep_range(1000, 2000);
+	}
 
-	if (image.size == 0)
-		return 0;
+	return err;
+}
 
-	mem = cell->memory_regions;
-	for (regions = cell->num_memory_regions; regions > 0; regions--) {
-		image_offset = image.target_address - mem->virt_start;
-		if (image.target_address >= mem->virt_start &&
-		    image_offset < mem->size) {
-			if (image.size > mem->size - image_offset ||
-			    (mem->flags & MEM_REQ_FLAGS) != MEM_REQ_FLAGS)
-				return -EINVAL;
-			break;
-		}
-		mem++;
+/*
+ * Images larger than this are copied in chunks of this size, concurrently on
+ * multiple CPUs. Must be a multiple of PAGE_SIZE.
+ */
+#define LOAD_CHUNK_SIZE	(16 * 1024 * 1024)
+
+/*
+ * Preload image whose source pages are pinned on submission so that the copy
+ * does not depend on the caller's mm.
+ */
+struct load_image {
+	struct jailhouse_preload_image desc;
+	struct page **pages;
+	unsigned int num_pages;
+};
+
+struct load_request {
+	struct jailhouse_cell_load cell_load;
+	/* configuration of the cell to create, only for create-start */
+	struct jailhouse_cell_desc *config;
+	struct load_image images[];
+};
+
+struct load_chunk {
+	struct work_struct work;
+	void *dst;
+	struct page **pages;
+	unsigned long offset;
+	size_t size;
+};
+
+static void load_chunk_work(struct work_struct *work)
+{
+	struct load_chunk *chunk = container_of(work, struct load_chunk, work);
+	unsigned long offset = chunk->offset;
+	struct page **page = chunk->pages;
+	size_t copied = 0, len;
+	void *src;
+
+	while (copied < chunk->size) {
+		len = min_t(size_t, PAGE_SIZE - offset, chunk->size - copied);
+		src = kmap(*page);
+		memcpy(chunk->dst + copied, src + offset, len);
+		kunmap(*page);
+		copied += len;
+		offset = 0;
+		page++;
 	}
-	if (regions == 0)
-		return -EINVAL;
+}
 
-	phys_start = (mem->phys_start + image_offset) & PAGE_MASK;
-	page_offs = offset_in_page(image_offset);
-	image_mem = jailhouse_ioremap(phys_start, 0,
-				      PAGE_ALIGN(image.size + page_offs));
-	if (!image_mem) {
-		pr_err("jailhouse: Unable to map cell RAM at %08llx "
-		       "for image loading\n",
-		       (unsigned long long)(mem->phys_start + image_offset));
-		return -EBUSY;
+static int copy_image(void *dst, const struct load_image *image)
+{
+	unsigned long first_offset = offset_in_page(image->desc.source_address);
+	size_t size = image->desc.size;
+	struct load_chunk *chunks;
+	unsigned int num_chunks, n;
+	unsigned long pos;
+
+	num_chunks = DIV_ROUND_UP(size, LOAD_CHUNK_SIZE);
+	chunks = kcalloc(num_chunks, sizeof(*chunks), GFP_KERNEL);
+	if (!chunks)
+		return -ENOMEM;
+
+	for (n = 0; n < num_chunks; n++) {
+		pos = first_offset + (unsigned long)n * LOAD_CHUNK_SIZE;
+
+		chunks[n].dst = dst + (unsigned long)n * LOAD_CHUNK_SIZE;
+		chunks[n].pages = &image->pages[pos >> PAGE_SHIFT];
+		chunks[n].offset = offset_in_page(pos);
+		chunks[n].size = min_t(size_t, LOAD_CHUNK_SIZE,
+				       size - (size_t)n * LOAD_CHUNK_SIZE);
+		INIT_WORK(&chunks[n].work, load_chunk_work);
+		if (num_chunks > 1)
+			queue_work(system_unbound_wq, &chunks[n].work);
+		else
+			load_chunk_work(&chunks[n].work);
 	}
 
-	if (copy_from_user(image_mem + page_offs,
-			   (void __user *)(unsigned long)image.source_address,
-			   image.size))
-		err = -EFAULT;
-	/*
-	 * ARMv7 and ARMv8 require to clean D-cache and invalidate I-cache for
-	 * memory containing new instructions. On x86 this is a NOP.
-	 */
-	flush_icache_range((unsigned long)(image_mem + page_offs),
-			   (unsigned long)(image_mem + page_offs) + image.size);
-#ifdef CONFIG_ARM
-	/*
-	 * ARMv7 requires to flush the written code and data out of D-cache to
-	 * allow the guest starting off with caches disabled.
-	 */
-	__cpuc_flush_dcache_area(image_mem + page_offs, image.size);
-#endif
+	for (n = 0; n < num_chunks; n++)
+		flush_work(&chunks[n].work);
 
-	vunmap(image_mem);
+	kfree(chunks);
 
-	return err;
+	return 0;
 }
 
-int jailhouse_cmd_cell_load(struct jailhouse_cell_load __user *arg)
+static int pin_image(struct load_image *image)
 {
-	struct jailhouse_preload_image __user *image = arg->image;
-	struct jailhouse_cell_load cell_load;
-	struct cell *cell;
-	unsigned int n;
-	int err;
-
-	if (copy_from_user(&cell_load, arg, sizeof(cell_load)))
-		return -EFAULT;
+	unsigned long src = image->desc.source_address;
+	unsigned int num_pages;
+	int pinned;
 
-	err = cell_management_prologue(&cell_load.cell_id, &cell);
-	if (err)
-		return err;
+	if (image->desc.size == 0)
+		return 0;
 
-	err = jailhouse_call_arg1(JAILHOUSE_HC_CELL_SET_LOADABLE, cell->id);
-	if (err)
-		goto unlock_out;
+	num_pages = PAGE_ALIGN(offset_in_page(src) + image->desc.size) >>
+		PAGE_SHIFT;
+	image->pages = vmalloc(num_pages * sizeof(*image->pages));
+	if (!image->pages)
+		return -ENOMEM;
 
-	for (n = cell_load.num_preload_images; n > 0; n--, image++) {
-		err = load_image(cell, image);
-		if (err)
-			break;
+	pinned = get_user_pages_fast(src & PAGE_MASK, num_pages, 0,
+				     image->pages);
+	if (pinned == num_pages) {
+		image->num_pages = num_pages;
+		return 0;
 	}
 
-unlock_out:
-	mutex_unlock(&jailhouse_lock);
+	while (pinned > 0)
+		put_page(image->pages[--pinned]);
+	vfree(image->pages);
+	image->pages = NULL;
 
-	return err;
+	return pinned < 0 ? pinned : -EFAULT;
 }
 
-int jailhouse_cmd_cell_start(const char __user *arg)
+static void load_request_free(void *data)
 {
-	struct jailhouse_cell_id cell_id;
-	struct cell *cell;
-	int err;
-
-	if (copy_from_user(&cell_id, arg, sizeof(cell_id)))
-		return -EFAULT;
-
-	err = cell_management_prologue(&cell_id, &cell);
-	if (err)
-		return err;
-
-	err = jailhouse_call_arg1(JAILHOUSE_HC_CELL_START, cell->id);
-
-	mutex_unlock(&jailhouse_lock);
+	struct load_request *req = data;
+	struct load_image *image;
+	unsigned int n;
 
-	return err;
+	for (n = 0, image = req->images; n < req->cell_load.num_preload_images;
+	     n++, image++) {
+		while (image->num_pages > 0)
+			put_page(image->pages[--image->num_pages]);
+		vfree(image->pages);
+	}
+	kfree(req->config);
+	vfree(req);
 }
 
-static int cell_destroy(struct cell *cell)
+static struct load_request *
+load_request_create(const struct jailhouse_cell_load *cell_load,
+		    struct jailhouse_preload_image __user *uimage)
 {
-	unsigned int cpu;
+	struct load_request *req;
+	unsigned int n;
 	int err;
 
-	err = jailhouse_call_arg1(JAILHOUSE_HC_CELL_DESTROY, cell->id);
-	if (err)
-		return err;
+	if (cell_load->num_preload_images >
+	    (ULONG_MAX - sizeof(*req)) / sizeof(struct load_image))
+		return ERR_PTR(-EINVAL);
 
-	for_each_cpu(cpu, &cell->cpus_assigned) {
-		if (cpumask_test_cpu(cpu, &offlined_cpus)) {
-			if (cpu_up(cpu) != 0)
-				pr_err("Jailhouse: failed to bring CPU %d "
-				       "back online\n", cpu);
-			cpumask_clear_cpu(cpu, &offlined_cpus);
-		}
-		cpumask_set_cpu(cpu, &root_cell->cpus_assigned);
-	}
+	req = vzalloc(sizeof(*req) +
+		      cell_load->num_preload_images * sizeof(struct load_image));
+	if (!req)
+		return ERR_PTR(-ENOMEM);
 
-	jailhouse_pci_do_all_devices(cell, JAILHOUSE_PCI_TYPE_DEVICE,
-	                             JAILHOUSE_PCI_ACTION_RELEASE);
+	req->cell_load = *cell_load;
 
-	pr_info("Destroyed Jailhouse cell \"%s\"\n", cell->name);
+	for (n = 0; n < cell_load->num_preload_images; n++) {
+		if (copy_from_user(&req->images[n].desc, &uimage[n],
+				   sizeof(req->images[n].desc))) {
+			err = -EFAULT;
+			goto error_free;
+		}
+		err = pin_image(&req->images[n]);
+		if (err)
+			goto error_free;
+	}
 
-	cell_delete(cell);
+	return req;
 
-	return 0;
+error_free:
+	load_request_free(req);
+	return ERR_PTR(err);
 }
+/* Returns true if the cell lists the shared image region mem as well. */
+static bool cell_shares_image(const struct cell *cell,
+			      const struct jailhouse_memory *mem)
+{
+	const struct jailhouse_memory *cell_mem = cell->memory_regions;
+	unsigned int n;
+
+	for (n = 0; n < cell->num_memory_regions; n++, cell_mem++)
+		if (cell_mem->flags & JAILHOUSE_MEM_SHARED_IMAGE &&
+		    cell_mem->phys_start == mem->phys_start)
+			return true;
+	return false;
+}
+
+/*
+ * The hypervisor withholds a shared image region from the root cell while any
+ * other cell listing it is not loadable. Images for such a region are already
+ * in place and must not be written.
+ */
+static bool image_withheld(struct cell *cell, u64 target_address)
+{
+	const struct jailhouse_memory *mem = cell->memory_regions;
+	struct cell *other;
+	unsigned int n;
+
+	for (n = 0; n < cell->num_memory_regions; n++, mem++)
+		if (target_address >= mem->virt_start &&
+		    target_address - mem->virt_start < mem->size)
+			break;
+	if (n == cell->num_memory_regions ||
+	    !(mem->flags & JAILHOUSE_MEM_SHARED_IMAGE))
+		return false;
+
+	list_for_each_entry(other, &cells, entry)
+		if (other != cell && !other->loadable &&
+		    cell_shares_image(other, mem))
+			return true;
+	return false;
+}
+
+/*
+ * Creating or starting a cell withdraws its shared images from the root cell.
+ * This must not happen while another cell sharing them is being loaded.
+ */
+static bool shared_image_loading(struct cell *cell)
+{
+	const struct jailhouse_memory *mem = cell->memory_regions;
+	struct cell *other;
+	unsigned int n;
+
+	for (n = 0; n < cell->num_memory_regions; n++, mem++) {
+		if (!(mem->flags & JAILHOUSE_MEM_SHARED_IMAGE))
+			continue;
+		list_for_each_entry(other, &cells, entry)
+			if (other != cell && other->loading &&
+			    cell_shares_image(other, mem))
+				return true;
+	}
+	return false;
+}
+
+/*
+ * Loadable regions are mapped as a whole on first use and stay mapped until
+ * the cell is started or destroyed. This allows the kernel to use huge page
+ * mappings where the region alignment permits and avoids remapping for every
+ * image.
+ */
+static void *map_cell_image(struct cell *cell, u64 target_address, u64 size)
+{
+	const struct jailhouse_memory *mem;
+	unsigned int region, page_offs;
+	u64 image_offset;
+
+	mem = cell->memory_regions;
+	for (region = 0; region < cell->num_memory_regions; region++, mem++) {
+		image_offset = target_address - mem->virt_start;
+		if (target_address >= mem->virt_start &&
+		    image_offset < mem->size) {
+			if (size > mem->size - image_offset ||
+			    !(mem->flags & JAILHOUSE_MEM_LOADABLE) ||
+			    !(mem->flags & (JAILHOUSE_MEM_WRITE |
+					    JAILHOUSE_MEM_SHARED_IMAGE)))
+				return ERR_PTR(-EINVAL);
+			break;
+		}
+	}
+	if (region == cell->num_memory_regions)
+		return ERR_PTR(-EINVAL);
+
+	if (!cell->loadable_mem) {
+		cell->loadable_mem = kcalloc(cell->num_memory_regions,
+					     sizeof(*cell->loadable_mem),
+					     GFP_KERNEL);
+		if (!cell->loadable_mem)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	page_offs = offset_in_page(mem->phys_start);
+	if (!cell->loadable_mem[region]) {
+		cell->loadable_mem[region] =
+			jailhouse_ioremap(mem->phys_start & PAGE_MASK, 0,
+					  PAGE_ALIGN(mem->size + page_offs));
+		if (!cell->loadable_mem[region]) {
+			pr_err("jailhouse: Unable to map cell RAM at %08llx "
+			       "for image loading\n",
+			       (unsigned long long)mem->phys_start);
+			return ERR_PTR(-EBUSY);
+		}
+	}
+
+	return cell->loadable_mem[region] + page_offs + image_offset;
+}
+
+static void unmap_cell_image(void *image_mem, u64 size)
+{
+	/*
+	 * ARMv7 and ARMv8 require to clean D-cache and invalidate I-cache for
+	 * memory containing new instructions. On x86 this is a NOP.
+	 */
+	flush_icache_range((unsigned long)image_mem,
+			   (unsigned long)image_mem + size);
+#ifdef CONFIG_ARM
+	/*
+	 * ARMv7 requires to flush the written code and data out of D-cache to
+	 * allow the guest starting off with caches disabled.
+	 */
+	__cpuc_flush_dcache_area(image_mem, size);
+#endif
+}
+
+/*
+ * Must be called before the cell is started as the hypervisor then revokes the
+ * root cell's access to the loadable regions.
+ */
+static void cell_unmap_loadable(struct cell *cell)
+{
+	unsigned int n;
+
+	if (!cell->loadable_mem)
+		return;
+
+	for (n = 0; n < cell->num_memory_regions; n++)
+		if (cell->loadable_mem[n])
+			vunmap(cell->loadable_mem[n]);
+	kfree(cell->loadable_mem);
+	cell->loadable_mem = NULL;
+}
+
+static int load_image(struct cell *cell, const struct load_image *image,
+		      struct cell_snapshot_image *snapshot)
+{
+	void *image_mem;
+	int err;
+
+	if (image->desc.size == 0)
+		return 0;
+
+	image_mem = map_cell_image(cell, image->desc.target_address,
+				   image->desc.size);
+	if (IS_ERR(image_mem))
+		return PTR_ERR(image_mem);
+
+	err = copy_image(image_mem, image);
+
+	/*
+	 * Take the pristine copy from the cell RAM, so that overlapping images
+	 * are restored exactly as they were loaded.
+	 */
+	if (!err && snapshot) {
+		snapshot->data = vmalloc(image->desc.size);
+		if (snapshot->data) {
+			memcpy(snapshot->data, image_mem, image->desc.size);
+			snapshot->target_address = image->desc.target_address;
+			snapshot->size = image->desc.size;
+		} else {
+			err = -ENOMEM;
+		}
+	}
+
+	unmap_cell_image(image_mem, image->desc.size);
+
+	return err;
+}
+
+static int cell_load_op(void *data)
+{
+	struct load_request *req = data;
+	struct jailhouse_cell_load *cell_load = &req->cell_load;
+	struct cell_snapshot_image *snapshot = NULL;
+	const struct load_image *image = req->images;
+	struct cell *cell;
+	unsigned int n;
+	int err;
+
+	err = cell_management_prologue(&cell_load->cell_id, &cell);
+	if (err)
+		return err;
+
+	/*
+	 * New images invalidate an existing snapshot. A load without images
+	 * (shutdown) leaves it in place so that the cell can still be reset.
+	 */
+	if (cell_load->num_preload_images > 0 ||
+	    cell_load->flags & JAILHOUSE_CELL_LOAD_SNAPSHOT)
+		cell_free_snapshot(cell);
+
+	if (cell_load->flags & JAILHOUSE_CELL_LOAD_SNAPSHOT &&
+	    cell_load->num_preload_images > 0) {
+		snapshot = kcalloc(cell_load->num_preload_images,
+				   sizeof(*snapshot), GFP_KERNEL);
+		if (!snapshot) {
+			err = -ENOMEM;
+			goto unlock_out;
+		}
+		cell->snapshot_images = snapshot;
+	}
+
+	err = cell_management_call(JAILHOUSE_HC_CELL_SET_LOADABLE, cell->id);
+	if (err)
+		goto unlock_out;
+	cell->loadable = true;
+
+	for (n = 0; n < cell_load->num_preload_images; n++)
+		if (image_withheld(cell, req->images[n].desc.target_address)) {
+			err = -EBUSY;
+			goto unlock_out;
+		}
+
+	/*
+	 * Copy the images without holding jailhouse_lock so that other cells
+	 * can be managed meanwhile. Requests for this cell fail with -EBUSY.
+	 */
+	cell->loading = true;
+	mutex_unlock(&jailhouse_lock);
+
+	for (n = cell_load->num_preload_images; n > 0; n--, image++) {
+		err = load_image(cell, image, snapshot);
+		if (err)
+			break;
+		if (snapshot) {
+			cell->num_snapshot_images++;
+			snapshot++;
+		}
+	}
+
+	mutex_lock(&jailhouse_lock);
+	cell->loading = false;
+
+unlock_out:
+	if (err)
+		cell_free_snapshot(cell);
+
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_load(struct jailhouse_cell_load __user *arg)
+{
+	struct jailhouse_cell_load cell_load;
+	struct load_request *req;
+	int err;
+
+	if (copy_from_user(&cell_load, arg, sizeof(cell_load)))
+		return -EFAULT;
+
+	if (cell_load.cell_id.flags ||
+	    cell_load.flags & ~(JAILHOUSE_CELL_LOAD_SNAPSHOT |
+				JAILHOUSE_CELL_ASYNC))
+		return -EINVAL;
+
+	req = load_request_create(&cell_load, arg->image);
+	if (IS_ERR(req))
+		return PTR_ERR(req);
+
+	if (req->cell_load.flags & JAILHOUSE_CELL_ASYNC)
+		return cell_op_submit(cell_load_op, load_request_free, req);
+
+	err = cell_load_op(req);
+	load_request_free(req);
+
+	return err;
+}
+
+struct steered_irq {
+	struct list_head entry;
+	unsigned int irq;
+	cpumask_t affinity;
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+/* scratch mask of IRQ steering, protected by jailhouse_lock */
+static cpumask_t steering_mask;
+#endif
+
+/*
+ * Move the root cell's IRQs off the CPUs of a new cell before they are taken
+ * offline. Otherwise, the hotplug code migrates them while the CPUs go down,
+ * one by one. Per-CPU and kernel-managed IRQs are left to the hotplug code.
+ * This is best effort, IRQs that cannot be moved are migrated on offlining
+ * as before.
+ */
+static void cell_steer_irqs(struct cell *cell)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+	const struct cpumask *affinity;
+	struct steered_irq *steered;
+	struct irq_data *data;
+	unsigned int irq;
+
+	for (irq = 0; irq < nr_irqs; irq++) {
+		data = irq_get_irq_data(irq);
+		if (!data || irqd_is_per_cpu(data) ||
+		    irqd_affinity_is_managed(data))
+			continue;
+
+		affinity = irq_data_get_affinity_mask(data);
+		if (!cpumask_intersects(affinity, &cell->cpus_assigned))
+			continue;
+
+		steered = kmalloc(sizeof(*steered), GFP_KERNEL);
+		if (!steered)
+			return;
+		steered->irq = irq;
+		cpumask_copy(&steered->affinity, affinity);
+
+		/* keep the remaining CPUs, fall back to all root cell CPUs */
+		if (!cpumask_andnot(&steering_mask, affinity,
+				    &cell->cpus_assigned))
+			cpumask_andnot(&steering_mask, &root_cell->cpus_assigned,
+				       &cell->cpus_assigned);
+
+		if (irq_set_affinity(irq, &steering_mask) != 0) {
+			kfree(steered);
+			continue;
+		}
+		list_add_tail(&steered->entry, &cell->steered_irqs);
+	}
+#endif
+}
+
+/*
+ * Restore the affinities that cell_steer_irqs changed, after the cell's CPUs
+ * are back online.
+ */
+static void cell_restore_irqs(struct cell *cell)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+	struct steered_irq *steered, *tmp;
+
+	list_for_each_entry_safe(steered, tmp, &cell->steered_irqs, entry) {
+		/* the IRQ may have been released in the meantime */
+		if (irq_get_irq_data(steered->irq))
+			irq_set_affinity(steered->irq, &steered->affinity);
+		list_del(&steered->entry);
+		kfree(steered);
+	}
+#endif
+}
+
+/*
+ * Create a cell and, if load is given, preload its images and start it. The
+ * images are written while the root cell still owns the cell's memory, so
+ * that the hypervisor can create and start the cell in one step.
+ */
+static int cell_create_load(struct jailhouse_cell_desc *config,
+			    const struct load_request *load)
+{
+	struct jailhouse_cell_id cell_id;
+	struct cell *cell;
+	unsigned int cpu, n;
+	int err = 0;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	if (!jailhouse_enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	cell_id.id = JAILHOUSE_CELL_ID_UNUSED;
+	memcpy(cell_id.name, config->name, sizeof(cell_id.name));
+	if (find_cell(&cell_id) != NULL) {
+		err = -EEXIST;
+		goto unlock_out;
+	}
+
+	cell = cell_create(config);
+	if (IS_ERR(cell)) {
+		err = PTR_ERR(cell);
+		goto unlock_out;
+	}
+
+	config->id = cell->id;
+
+	if (!cpumask_subset(&cell->cpus_assigned, &root_cell->cpus_assigned) ||
+	    shared_image_loading(cell)) {
+		err = -EBUSY;
+		goto error_cell_delete;
+	}
+
+	cell_steer_irqs(cell);
+
+	/* Off-line each CPU assigned to the new cell and remove it from the
+	 * root cell's set. */
+	for_each_cpu(cpu, &cell->cpus_assigned) {
+#ifdef CONFIG_X86
+		if (cpu == 0) {
+			/*
+			 * On x86, Linux only parks CPU 0 when offlining it and
+			 * expects to be able to get it back by sending an IPI.
+			 * This is not support by Jailhouse wich destroys the
+			 * CPU state across non-root assignments.
+			 */
+			pr_err("Cannot assign CPU 0 to other cells\n");
+			err = -EINVAL;
+			goto error_cpu_online;
+		}
+#endif
+		if (cpu_online(cpu)) {
+			err = cpu_down(cpu);
+			if (err)
+				goto error_cpu_online;
+			cpumask_set_cpu(cpu, &offlined_cpus);
+		}
+		cpumask_clear_cpu(cpu, &root_cell->cpus_assigned);
+	}
+
+	jailhouse_pci_do_all_devices(cell, JAILHOUSE_PCI_TYPE_DEVICE,
+	                             JAILHOUSE_PCI_ACTION_CLAIM);
+
+	if (load) {
+		for (n = 0; n < load->cell_load.num_preload_images; n++) {
+			if (image_withheld(cell,
+					   load->images[n].desc.target_address)) {
+				err = -EBUSY;
+				break;
+			}
+			err = load_image(cell, &load->images[n], NULL);
+			if (err)
+				break;
+		}
+		cell_unmap_loadable(cell);
+		if (err)
+			goto error_cpu_online;
+	}
+
+	err = jailhouse_call_arg1(load ? JAILHOUSE_HC_CELL_CREATE_START :
+					 JAILHOUSE_HC_CELL_CREATE,
+				  __pa(config));
+	if (err < 0)
+		goto error_cpu_online;
+
+	cell_register(cell);
+
+	/* the notified CPU may have been handed over to the new cell */
+	jailhouse_console_notify_update();
+
+	pr_info("Created Jailhouse cell \"%s\"\n", config->name);
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+
+error_cpu_online:
+	for_each_cpu(cpu, &cell->cpus_assigned) {
+		if (!cpu_online(cpu) && cpu_up(cpu) == 0)
+			cpumask_clear_cpu(cpu, &offlined_cpus);
+		cpumask_set_cpu(cpu, &root_cell->cpus_assigned);
+	}
+	cell_restore_irqs(cell);
+
+error_cell_delete:
+	cell_delete(cell);
+	goto unlock_out;
+}
+
+static int cell_create_op(void *data)
+{
+	return cell_create_load(data, NULL);
+}
+
+static struct jailhouse_cell_desc *
+cell_config_copy(const struct jailhouse_cell_create *cell_params)
+{
+	struct jailhouse_cell_desc *config;
+	void __user *user_config;
+	int err = -EINVAL;
+
+	config = kmalloc(cell_params->config_size, GFP_USER | __GFP_NOWARN);
+	if (!config)
+		return ERR_PTR(-ENOMEM);
+
+	user_config = (void __user *)(unsigned long)cell_params->config_address;
+	if (copy_from_user(config, user_config, cell_params->config_size)) {
+		err = -EFAULT;
+		goto error_free;
+	}
 
-int jailhouse_cmd_cell_destroy(const char __user *arg)
+	if (cell_params->config_size < sizeof(*config) ||
+	    memcmp(config->signature, JAILHOUSE_CELL_DESC_SIGNATURE,
+		   sizeof(config->signature)) != 0) {
+		pr_err("jailhouse: Not a cell configuration\n");
+		goto error_free;
+	}
+	if (config->revision != JAILHOUSE_CONFIG_REVISION) {
+		pr_err("jailhouse: Configuration revision mismatch\n");
+		goto error_free;
+	}
+
+	config->name[JAILHOUSE_CELL_NAME_MAXLEN] = 0;
+
+	/* CONSOLE_ACTIVE implies CONSOLE_PERMITTED for non-root cells */
+	if (CELL_FLAGS_VIRTUAL_CONSOLE_ACTIVE(config->flags))
+		config->flags |= JAILHOUSE_CELL_VIRTUAL_CONSOLE_PERMITTED;
+
+	return config;
+
+error_free:
+	kfree(config);
+	return ERR_PTR(err);
+}
+
+int jailhouse_cmd_cell_create(struct jailhouse_cell_create __user *arg)
 {
-	struct jailhouse_cell_id cell_id;
-	struct cell *cell;
+	struct jailhouse_cell_create cell_params;
+	struct jailhouse_cell_desc *config;
+	int err;
+
+	if (copy_from_user(&cell_params, arg, sizeof(cell_params)))
+		return -EFAULT;
+
+	if (cell_params.flags & ~JAILHOUSE_CELL_ASYNC)
+		return -EINVAL;
+
+	config = cell_config_copy(&cell_params);
+	if (IS_ERR(config))
+		return PTR_ERR(config);
+
+	if (cell_params.flags & JAILHOUSE_CELL_ASYNC)
+		return cell_op_submit(cell_create_op, cell_op_kfree, config);
+
+	err = cell_create_op(config);
+	kfree(config);
+
+	return err;
+}
+
+static int cell_create_start_op(void *data)
+{
+	struct load_request *req = data;
+
+	return cell_create_load(req->config, req);
+}
+
+int
+jailhouse_cmd_cell_create_start(struct jailhouse_cell_create_start __user *arg)
+{
+	struct jailhouse_cell_create_start params;
+	struct jailhouse_cell_load cell_load = { };
+	struct jailhouse_cell_desc *config;
+	struct load_request *req;
 	int err;
 
-	if (copy_from_user(&cell_id, arg, sizeof(cell_id)))
+	if (copy_from_user(&params, arg, sizeof(params)))
 		return -EFAULT;
 
-	err = cell_management_prologue(&cell_id, &cell);
+	if (params.create.flags & ~JAILHOUSE_CELL_ASYNC)
+		return -EINVAL;
+
+	config = cell_config_copy(&params.create);
+	if (IS_ERR(config))
+		return PTR_ERR(config);
+
+	cell_load.num_preload_images = params.num_preload_images;
+	req = load_request_create(&cell_load, arg->image);
+	if (IS_ERR(req)) {
+		kfree(config);
+		return PTR_ERR(req);
+	}
+	req->config = config;
+
+	if (params.create.flags & JAILHOUSE_CELL_ASYNC)
+		return cell_op_submit(cell_create_start_op, load_request_free,
+				      req);
+
+	err = cell_create_start_op(req);
+	load_request_free(req);
+
+	return err;
+}
+
+/* Runs a request that only addresses a cell, synchronously or queued. */
+/* Commands whose argument starts with struct jailhouse_cell_id. */
+static int cell_command(const char __user *arg, size_t size,
+			int (*run)(void *data))
+{
+	struct jailhouse_cell_id *cell_id;
+	int err;
+
+	cell_id = memdup_user(arg, size);
+	if (IS_ERR(cell_id))
+		return PTR_ERR(cell_id);
+
+	if (cell_id->flags & ~JAILHOUSE_CELL_ASYNC) {
+		kfree(cell_id);
+		return -EINVAL;
+	}
+
+	if (cell_id->flags & JAILHOUSE_CELL_ASYNC)
+		return cell_op_submit(run, cell_op_kfree, cell_id);
+
+	err = run(cell_id);
+	kfree(cell_id);
+
+	return err;
+}
+
+static int cell_id_command(const char __user *arg, int (*run)(void *data))
+{
+	return cell_command(arg, sizeof(struct jailhouse_cell_id), run);
+}
+
+static int cell_start_op(void *data)
+{
+	struct cell *cell;
+	int err;
+
+	err = cell_management_prologue(data, &cell);
+	if (err)
+		return err;
+
+	if (shared_image_loading(cell)) {
+		err = -EBUSY;
+		goto unlock_out;
+	}
+
+	cell_unmap_loadable(cell);
+
+	err = cell_management_call(JAILHOUSE_HC_CELL_START, cell->id);
+	if (!err)
+		cell->loadable = false;
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_start(const char __user *arg)
+{
+	return cell_id_command(arg, cell_start_op);
+}
+
+/*
+ * Restarts a cell from the images stashed by a snapshot load. The cell keeps
+ * its configuration, memory mappings and devices, only the loaded RAM content
+ * is restored before the CPUs are reset.
+ */
+static int cell_reset_op(void *data)
+{
+	struct cell_snapshot_image *snapshot;
+	struct cell *cell;
+	void *image_mem;
+	unsigned int n;
+	int err;
+
+	err = cell_management_prologue(data, &cell);
+	if (err)
+		return err;
+
+	if (cell->num_snapshot_images == 0) {
+		err = -ENOENT;
+		goto unlock_out;
+	}
+
+	if (shared_image_loading(cell)) {
+		err = -EBUSY;
+		goto unlock_out;
+	}
+
+	err = cell_management_call(JAILHOUSE_HC_CELL_SET_LOADABLE, cell->id);
+	if (err)
+		goto unlock_out;
+	cell->loadable = true;
+
+	snapshot = cell->snapshot_images;
+	for (n = 0; n < cell->num_snapshot_images; n++, snapshot++) {
+		/* a shared image still in use by others is left as is */
+		if (image_withheld(cell, snapshot->target_address))
+			continue;
+		image_mem = map_cell_image(cell, snapshot->target_address,
+					   snapshot->size);
+		if (IS_ERR(image_mem)) {
+			err = PTR_ERR(image_mem);
+			cell_unmap_loadable(cell);
+			goto unlock_out;
+		}
+		memcpy(image_mem, snapshot->data, snapshot->size);
+		unmap_cell_image(image_mem, snapshot->size);
+	}
+
+	cell_unmap_loadable(cell);
+
+	err = cell_management_call(JAILHOUSE_HC_CELL_START, cell->id);
+	if (!err)
+		cell->loadable = false;
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_reset(const char __user *arg)
+{
+	return cell_id_command(arg, cell_reset_op);
+}
+
+static int cell_destroy(struct cell *cell)
+{
+	unsigned int cpu;
+	int err;
+
+	if (cell->loading)
+		return -EBUSY;
+
+	cell_unmap_loadable(cell);
+
+	err = cell_management_call(JAILHOUSE_HC_CELL_DESTROY, cell->id);
+	if (err)
+		return err;
+
+	for_each_cpu(cpu, &cell->cpus_assigned) {
+		if (cpumask_test_cpu(cpu, &offlined_cpus)) {
+			if (cpu_up(cpu) != 0)
+				pr_err("Jailhouse: failed to bring CPU %d "
+				       "back online\n", cpu);
+			cpumask_clear_cpu(cpu, &offlined_cpus);
+		}
+		cpumask_set_cpu(cpu, &root_cell->cpus_assigned);
+	}
+	cell_restore_irqs(cell);
+
+	jailhouse_pci_do_all_devices(cell, JAILHOUSE_PCI_TYPE_DEVICE,
+	                             JAILHOUSE_PCI_ACTION_RELEASE);
+
+	pr_info("Destroyed Jailhouse cell \"%s\"\n", cell->name);
+
+	cell_delete(cell);
+
+	return 0;
+}
+
+static int cell_destroy_op(void *data)
+{
+	struct cell *cell;
+	int err;
+
+	err = cell_management_prologue(data, &cell);
 	if (err)
 		return err;
 
@@ -462,6 +1348,161 @@ int jailhouse_cmd_cell_destroy(const char __user *arg)
 	return err;
 }
 
+int jailhouse_cmd_cell_destroy(const char __user *arg)
+{
+	return cell_id_command(arg, cell_destroy_op);
+}
+
+/*
+ * Moves memory between the cell and the root cell as the cell requested via
+ * its balloon. Whoever hands memory back to the cell has to stop using it
+ * first.
+ */
+static int cell_balloon_update_op(void *data)
+{
+	struct cell *cell;
+	int err;
+
+	err = cell_management_prologue(data, &cell);
+	if (err)
+		return err;
+
+	err = jailhouse_call_arg1(JAILHOUSE_HC_CELL_BALLOON_UPDATE, cell->id);
+
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_balloon_update(const char __user *arg)
+{
+	return cell_id_command(arg, cell_balloon_update_op);
+}
+
+/*
+ * Hands a CPU of the root cell over to a cell with
+ * JAILHOUSE_CELL_ELASTIC_CPUS. The CPU is taken offline first, the cell can
+ * then bring it up like a hot-plugged one.
+ */
+static int cell_cpu_add_op(void *data)
+{
+	struct jailhouse_cell_cpu *cell_cpu = data;
+	unsigned int cpu = cell_cpu->cpu;
+	struct cell *cell;
+	int err;
+
+	err = cell_management_prologue(&cell_cpu->cell_id, &cell);
+	if (err)
+		return err;
+
+	if (cpu >= nr_cpu_ids ||
+	    !cpumask_test_cpu(cpu, &root_cell->cpus_assigned)) {
+		err = -EBUSY;
+		goto unlock_out;
+	}
+
+#ifdef CONFIG_X86
+	/* see cell_create_load */
+	if (cpu == 0) {
+		pr_err("Cannot assign CPU 0 to other cells\n");
+		err = -EINVAL;
+		goto unlock_out;
+	}
+#endif
+
+	if (cpu_online(cpu)) {
+		err = cpu_down(cpu);
+		if (err)
+			goto unlock_out;
+		cpumask_set_cpu(cpu, &offlined_cpus);
+	}
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_CPU_ADD, cell->id, cpu);
+	if (err) {
+		if (cpumask_test_cpu(cpu, &offlined_cpus) && cpu_up(cpu) == 0)
+			cpumask_clear_cpu(cpu, &offlined_cpus);
+		goto unlock_out;
+	}
+
+	cpumask_clear_cpu(cpu, &root_cell->cpus_assigned);
+	cpumask_set_cpu(cpu, &cell->cpus_assigned);
+	jailhouse_sysfs_cpu_move(cpu, root_cell, cell);
+
+	/* the notified CPU may have been handed over to the cell */
+	jailhouse_console_notify_update();
+
+	pr_info("Moved CPU %u to Jailhouse cell \"%s\"\n", cpu, cell->name);
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_cpu_add(const char __user *arg)
+{
+	return cell_command(arg, sizeof(struct jailhouse_cell_cpu),
+			    cell_cpu_add_op);
+}
+
+/*
+ * Returns a CPU of a cell with JAILHOUSE_CELL_ELASTIC_CPUS to the root cell.
+ * The cell has to take the CPU offline before.
+ */
+static int cell_cpu_remove_op(void *data)
+{
+	struct jailhouse_cell_cpu *cell_cpu = data;
+	unsigned int cpu = cell_cpu->cpu;
+	struct cell *cell;
+	int err;
+
+	err = cell_management_prologue(&cell_cpu->cell_id, &cell);
+	if (err)
+		return err;
+
+	if (cpu >= nr_cpu_ids || !cpumask_test_cpu(cpu, &cell->cpus_assigned)) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	/* see cell_management_call */
+	while ((err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_CPU_REMOVE,
+					  cell->id, cpu)) == -EAGAIN) {
+		if (signal_pending(current)) {
+			err = -EINTR;
+			goto unlock_out;
+		}
+		usleep_range(1000, 2000);
+	}
+	if (err)
+		goto unlock_out;
+
+	cpumask_clear_cpu(cpu, &cell->cpus_assigned);
+	cpumask_set_cpu(cpu, &root_cell->cpus_assigned);
+	jailhouse_sysfs_cpu_move(cpu, cell, root_cell);
+
+	if (cpumask_test_cpu(cpu, &offlined_cpus)) {
+		if (cpu_up(cpu) != 0)
+			pr_err("Jailhouse: failed to bring CPU %d "
+			       "back online\n", cpu);
+		cpumask_clear_cpu(cpu, &offlined_cpus);
+	}
+
+	pr_info("Moved CPU %u from Jailhouse cell \"%s\" back\n", cpu,
+		cell->name);
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+int jailhouse_cmd_cell_cpu_remove(const char __user *arg)
+{
+	return cell_command(arg, sizeof(struct jailhouse_cell_cpu),
+			    cell_cpu_remove_op);
+}
+
 int jailhouse_cmd_cell_destroy_non_root(void)
 {
 	struct cell *cell, *tmp;
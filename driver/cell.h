@@ -16,12 +16,19 @@
 #include <linux/cpumask.h>
 #include <linux/list.h>
 #include <linux/kobject.h>
+#include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 
 #include "jailhouse.h"
 
 #include <jailhouse/cell-config.h>
 
+struct cell_snapshot_image {
+	u64 target_address;
+	u64 size;
+	void *data;
+};
+
 struct cell {
 	struct kobject kobj;
 	struct kobject stats_kobj;
@@ -32,14 +39,37 @@ struct cell {
 	cpumask_t cpus_assigned;
 	u32 num_memory_regions;
 	struct jailhouse_memory *memory_regions;
+	/* root mappings of loadable regions, indexed like memory_regions */
+	void **loadable_mem;
 #ifdef CONFIG_PCI
 	u32 num_pci_devices;
 	struct jailhouse_pci_device *pci_devices;
 #endif /* CONFIG_PCI */
+	unsigned int num_snapshot_images;
+	struct cell_snapshot_image *snapshot_images;
+	/* images are being copied, management requests are refused */
+	bool loading;
+	/* set loadable in the hypervisor, i.e. not holding shared images */
+	bool loadable;
+	/* per-cell console device, located at the cell's first CPU */
+	struct miscdevice console_dev;
+	char console_name[sizeof("jailhouse-console-") +
+			  JAILHOUSE_CELL_ID_NAMELEN];
+	unsigned int console_cpu;
+	bool console_registered;
+	/* hypervisor watchdog timeout, 0 if disabled */
+	unsigned long watchdog_timeout_us;
+	/* state at the last change notification of sysfs readers */
+	int notified_state;
+	/* root cell IRQs moved off the cell's CPUs, see cell_steer_irqs */
+	struct list_head steered_irqs;
 };
 
 extern struct cell *root_cell;
 
+int jailhouse_cell_init(void);
+void jailhouse_cell_exit(void);
+
 void jailhouse_cell_kobj_release(struct kobject *kobj);
 
 int jailhouse_cell_prepare_root(const struct jailhouse_cell_desc *cell_desc);
@@ -47,10 +77,22 @@ void jailhouse_cell_register_root(void);
 void jailhouse_cell_delete_root(void);
 
 int jailhouse_cmd_cell_create(struct jailhouse_cell_create __user *arg);
+int
+jailhouse_cmd_cell_create_start(struct jailhouse_cell_create_start __user *arg);
 int jailhouse_cmd_cell_load(struct jailhouse_cell_load __user *arg);
 int jailhouse_cmd_cell_start(const char __user *arg);
+int jailhouse_cmd_cell_reset(const char __user *arg);
 int jailhouse_cmd_cell_destroy(const char __user *arg);
+int jailhouse_cmd_cell_balloon_update(const char __user *arg);
+int jailhouse_cmd_cell_cpu_add(const char __user *arg);
+int jailhouse_cmd_cell_cpu_remove(const char __user *arg);
 
 int jailhouse_cmd_cell_destroy_non_root(void);
 
+void jailhouse_cell_notify_state_changes(void);
+
+#ifdef CONFIG_PCI
+struct cell *jailhouse_cell_find_ivshmem_peer(u16 bdf);
+#endif
+
 #endif /* !_JAILHOUSE_DRIVER_CELL_H */
@@ -0,0 +1,331 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Root-cell agent of the DMA copy service: non-root cells submit copy
+ * descriptors via an ivshmem link, and the agent executes them with a DMA
+ * engine of the root cell. The engine is subject to the IOMMU configuration
+ * of the root cell, and the agent only accepts ranges that the requesting
+ * cell shares with the root cell. See include/jailhouse/dma-copy.h for the
+ * protocol.
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/interrupt.h>
+#include <linux/io.h>
+#include <linux/pci.h>
+#include <linux/workqueue.h>
+
+#include "cell.h"
+#include "main.h"
+#include "pci.h"
+
+#include <jailhouse/dma-copy.h>
+
+#define DRIVER_NAME		"jailhouse-dma-copy"
+
+#define IVSHMEM_REG_DBELL	12
+#define IVSHMEM_REG_LSTATE	16
+
+#define IVSHMEM_CFG_SHMEM_PTR	0x40
+#define IVSHMEM_CFG_SHMEM_SZ	0x48
+
+#define DMA_COPY_TIMEOUT	msecs_to_jiffies(1000)
+
+struct dma_copy_agent {
+	struct pci_dev *pdev;
+	void __iomem *registers;
+	struct jailhouse_dma_copy_ring *ring;
+	u64 shmem_size;
+	struct dma_chan *chan;
+	struct delayed_work work;
+	struct completion done;
+};
+
+/*
+ * Translate a guest-physical range of the peer cell into a physical address.
+ * The range has to be covered by a single region that the peer shares with
+ * the root cell and that grants the requested access. jailhouse_lock is only
+ * tried so that removing the device while holding it cannot deadlock.
+ */
+static int dma_copy_translate(struct dma_copy_agent *agent, u64 addr, u64 len,
+			      u64 access, phys_addr_t *phys)
+{
+	u16 bdf = PCI_DEVID(agent->pdev->bus->number, agent->pdev->devfn);
+	const struct jailhouse_memory *mem;
+	struct cell *cell;
+	unsigned int n;
+	int err = -EINVAL;
+
+	if (!mutex_trylock(&jailhouse_lock))
+		return -EAGAIN;
+
+	cell = jailhouse_cell_find_ivshmem_peer(bdf);
+	for (n = 0; cell && n < cell->num_memory_regions; n++) {
+		mem = &cell->memory_regions[n];
+		if (!(mem->flags & JAILHOUSE_MEM_ROOTSHARED) ||
+		    (mem->flags & access) != access)
+			continue;
+		if (addr >= mem->virt_start && len <= mem->size &&
+		    addr - mem->virt_start <= mem->size - len) {
+			*phys = mem->phys_start + (addr - mem->virt_start);
+			err = 0;
+			break;
+		}
+	}
+
+	mutex_unlock(&jailhouse_lock);
+	return err;
+}
+
+static void dma_copy_callback(void *arg)
+{
+	struct dma_copy_agent *agent = arg;
+
+	complete(&agent->done);
+}
+
+static int dma_copy_execute(struct dma_copy_agent *agent,
+			    struct jailhouse_dma_copy_desc *desc)
+{
+	struct device *dma_dev = agent->chan->device->dev;
+	u64 src = READ_ONCE(desc->src), dst = READ_ONCE(desc->dst);
+	u64 len = READ_ONCE(desc->len);
+	struct dma_async_tx_descriptor *tx = NULL;
+	unsigned long flags = DMA_CTRL_ACK;
+	phys_addr_t src_phys, dst_phys;
+	dma_addr_t src_dma, dst_dma;
+	unsigned int max_chunk;
+	dma_cookie_t cookie;
+	size_t chunk;
+	u64 offs;
+	int err;
+
+	if (len == 0 || len > SIZE_MAX)
+		return -EINVAL;
+
+	err = dma_copy_translate(agent, src, len, JAILHOUSE_MEM_READ,
+				 &src_phys);
+	if (err)
+		return err;
+	err = dma_copy_translate(agent, dst, len, JAILHOUSE_MEM_WRITE,
+				 &dst_phys);
+	if (err)
+		return err;
+
+	src_dma = dma_map_resource(dma_dev, src_phys, len, DMA_TO_DEVICE, 0);
+	if (dma_mapping_error(dma_dev, src_dma))
+		return -ENOMEM;
+	dst_dma = dma_map_resource(dma_dev, dst_phys, len, DMA_FROM_DEVICE, 0);
+	if (dma_mapping_error(dma_dev, dst_dma)) {
+		err = -ENOMEM;
+		goto unmap_src;
+	}
+
+	/* split according to the segment limit of the engine */
+	max_chunk = dma_get_max_seg_size(dma_dev);
+	reinit_completion(&agent->done);
+	for (offs = 0; offs < len; offs += chunk) {
+		chunk = min_t(u64, len - offs, max_chunk);
+		if (offs + chunk == len)
+			flags |= DMA_PREP_INTERRUPT;
+		tx = dmaengine_prep_dma_memcpy(agent->chan, dst_dma + offs,
+					       src_dma + offs, chunk, flags);
+		if (!tx) {
+			err = -EIO;
+			break;
+		}
+		if (offs + chunk == len) {
+			tx->callback = dma_copy_callback;
+			tx->callback_param = agent;
+		}
+		cookie = dmaengine_submit(tx);
+		if (dma_submit_error(cookie)) {
+			err = -EIO;
+			break;
+		}
+	}
+	dma_async_issue_pending(agent->chan);
+
+	if (!err &&
+	    !wait_for_completion_timeout(&agent->done, DMA_COPY_TIMEOUT))
+		err = -ETIMEDOUT;
+	if (err)
+		dmaengine_terminate_sync(agent->chan);
+
+	dma_unmap_resource(dma_dev, dst_dma, len, DMA_FROM_DEVICE, 0);
+unmap_src:
+	dma_unmap_resource(dma_dev, src_dma, len, DMA_TO_DEVICE, 0);
+	return err;
+}
+
+static void dma_copy_work(struct work_struct *work)
+{
+	struct dma_copy_agent *agent =
+		container_of(to_delayed_work(work), struct dma_copy_agent,
+			     work);
+	struct jailhouse_dma_copy_ring *ring = agent->ring;
+	u32 num_descs = READ_ONCE(ring->num_descs);
+	struct jailhouse_dma_copy_desc *desc;
+	u32 complete = ring->complete;
+	bool completed = false;
+	int result;
+
+	if (num_descs == 0 || num_descs > JAILHOUSE_DMA_COPY_MAX_DESCS ||
+	    (num_descs & (num_descs - 1)) != 0 ||
+	    struct_size(ring, descs, num_descs) > agent->shmem_size)
+		return;
+
+	while (complete != READ_ONCE(ring->submit)) {
+		/* read the descriptor only after the index */
+		smp_rmb();
+		desc = &ring->descs[complete & (num_descs - 1)];
+
+		result = dma_copy_execute(agent, desc);
+		if (result == -EAGAIN) {
+			/* jailhouse_lock is busy, retry the descriptor later */
+			schedule_delayed_work(&agent->work, 1);
+			break;
+		}
+		WRITE_ONCE(desc->result, result);
+
+		/* publish the result before the index */
+		smp_wmb();
+		WRITE_ONCE(ring->complete, ++complete);
+		completed = true;
+
+		cond_resched();
+	}
+
+	if (completed)
+		writel(0, agent->registers + IVSHMEM_REG_DBELL);
+}
+
+static irqreturn_t dma_copy_irq(int irq, void *arg)
+{
+	struct dma_copy_agent *agent = arg;
+
+	schedule_delayed_work(&agent->work, 0);
+	return IRQ_HANDLED;
+}
+
+static int dma_copy_probe(struct pci_dev *pdev, const struct pci_device_id *id)
+{
+	struct dma_copy_agent *agent;
+	dma_cap_mask_t mask;
+	u32 lo, hi;
+	u64 shmem;
+	int err;
+
+	agent = devm_kzalloc(&pdev->dev, sizeof(*agent), GFP_KERNEL);
+	if (!agent)
+		return -ENOMEM;
+	agent->pdev = pdev;
+
+	err = pcim_enable_device(pdev);
+	if (err)
+		return err;
+
+	err = pcim_iomap_regions(pdev, BIT(0), DRIVER_NAME);
+	if (err)
+		return err;
+	agent->registers = pcim_iomap_table(pdev)[0];
+
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_PTR + 4, &hi);
+	shmem = ((u64)hi << 32) | lo;
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ, &lo);
+	pci_read_config_dword(pdev, IVSHMEM_CFG_SHMEM_SZ + 4, &hi);
+	agent->shmem_size = ((u64)hi << 32) | lo;
+
+	if (agent->shmem_size < sizeof(*agent->ring))
+		return -EINVAL;
+
+	agent->ring = devm_memremap(&pdev->dev, shmem, agent->shmem_size,
+				    MEMREMAP_WB);
+	if (IS_ERR(agent->ring))
+		return PTR_ERR(agent->ring);
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	agent->chan = dma_request_chan_by_mask(&mask);
+	if (IS_ERR(agent->chan)) {
+		dev_err(&pdev->dev, "no DMA engine with memcpy support\n");
+		return PTR_ERR(agent->chan);
+	}
+
+	INIT_DELAYED_WORK(&agent->work, dma_copy_work);
+	init_completion(&agent->done);
+
+	err = pci_alloc_irq_vectors(pdev, 1, 1, PCI_IRQ_MSIX);
+	if (err < 0)
+		goto release_chan;
+
+	err = request_irq(pci_irq_vector(pdev, 0), dma_copy_irq, 0,
+			  DRIVER_NAME, agent);
+	if (err)
+		goto free_vectors;
+
+	pci_set_master(pdev);
+	pci_set_drvdata(pdev, agent);
+
+	writel(JAILHOUSE_DMA_COPY_STATE_READY,
+	       agent->registers + IVSHMEM_REG_LSTATE);
+
+	/* pick up descriptors submitted before the agent was ready */
+	schedule_delayed_work(&agent->work, 0);
+
+	dev_info(&pdev->dev, "DMA copy agent using %s\n",
+		 dma_chan_name(agent->chan));
+	return 0;
+
+free_vectors:
+	pci_free_irq_vectors(pdev);
+release_chan:
+	dma_release_channel(agent->chan);
+	return err;
+}
+
+static void dma_copy_remove(struct pci_dev *pdev)
+{
+	struct dma_copy_agent *agent = pci_get_drvdata(pdev);
+
+	writel(JAILHOUSE_DMA_COPY_STATE_RESET,
+	       agent->registers + IVSHMEM_REG_LSTATE);
+	free_irq(pci_irq_vector(pdev, 0), agent);
+	pci_free_irq_vectors(pdev);
+	cancel_delayed_work_sync(&agent->work);
+	dma_release_channel(agent->chan);
+}
+
+static const struct pci_device_id dma_copy_ids[] = {
+	{
+		PCI_DEVICE(PCI_VENDOR_ID_REDHAT_QUMRANET, 0x1110),
+		.class = (PCI_CLASS_OTHERS << 16) |
+			JAILHOUSE_SHMEM_PROTO_DMA_COPY,
+		.class_mask = 0xffffff,
+	},
+	{ 0 }
+};
+
+static struct pci_driver dma_copy_driver = {
+	.name		= DRIVER_NAME,
+	.id_table	= dma_copy_ids,
+	.probe		= dma_copy_probe,
+	.remove		= dma_copy_remove,
+};
+
+int jailhouse_dma_copy_register(void)
+{
+	return pci_register_driver(&dma_copy_driver);
+}
+
+void jailhouse_dma_copy_unregister(void)
+{
+	pci_unregister_driver(&dma_copy_driver);
+}
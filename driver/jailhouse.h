@@ -44,10 +44,20 @@
 
 #define JAILHOUSE_CELL_ID_NAMELEN	31
 
+/*
+ * Queue a cell management request and return a file descriptor instead of
+ * waiting for its completion. The descriptor becomes readable when the request
+ * is done, read() then returns its result as __s32 (0 or negative error code).
+ * Accepted by JAILHOUSE_CELL_CREATE, JAILHOUSE_CELL_LOAD, JAILHOUSE_CELL_START,
+ * JAILHOUSE_CELL_DESTROY, JAILHOUSE_CELL_RESET, JAILHOUSE_CELL_CREATE_START and
+ * JAILHOUSE_CELL_BALLOON_UPDATE.
+ */
+#define JAILHOUSE_CELL_ASYNC		0x8000
+
 struct jailhouse_cell_create {
 	__u64 config_address;
 	__u32 config_size;
-	__u32 padding;
+	__u32 flags;
 };
 
 struct jailhouse_preload_image {
@@ -59,24 +69,73 @@ struct jailhouse_preload_image {
 
 struct jailhouse_cell_id {
 	__s32 id;
-	__u32 padding;
+	__u32 flags;
 	char name[JAILHOUSE_CELL_ID_NAMELEN + 1];
 };
 
+/* keep a copy of the loaded images for JAILHOUSE_CELL_RESET */
+#define JAILHOUSE_CELL_LOAD_SNAPSHOT	0x0001
+
 struct jailhouse_cell_load {
 	struct jailhouse_cell_id cell_id;
 	__u32 num_preload_images;
-	__u32 padding;
+	__u32 flags;
 	struct jailhouse_preload_image image[];
 };
 
 #define JAILHOUSE_CELL_ID_UNUSED	(-1)
 
+/*
+ * Create a cell, load the images into its memory before the root cell hands
+ * it over and start the cell with a single hypervisor call.
+ */
+struct jailhouse_cell_create_start {
+	struct jailhouse_cell_create create;
+	__u32 num_preload_images;
+	__u32 padding;
+	struct jailhouse_preload_image image[];
+};
+
+struct jailhouse_trace_read {
+	__u32 cpu;
+	/* in: sequence number of the next record to read, out: updated */
+	__u32 head;
+	/* in: capacity of the record buffer, out: number of records read */
+	__u32 num_records;
+	/* out: records that were overwritten before they could be read */
+	__u32 missed;
+	__u64 records_address;
+};
+
+/*
+ * CPU to move between the root cell and a cell with
+ * JAILHOUSE_CELL_ELASTIC_CPUS.
+ */
+struct jailhouse_cell_cpu {
+	struct jailhouse_cell_id cell_id;
+	__u32 cpu;
+	__u32 padding;
+};
+
+struct jailhouse_mem_pool_grow {
+	/* bytes to donate, rounded up to the chunk size of the driver */
+	__u64 size;
+};
+
 #define JAILHOUSE_ENABLE		_IOW(0, 0, void *)
 #define JAILHOUSE_DISABLE		_IO(0, 1)
 #define JAILHOUSE_CELL_CREATE		_IOW(0, 2, struct jailhouse_cell_create)
 #define JAILHOUSE_CELL_LOAD		_IOW(0, 3, struct jailhouse_cell_load)
 #define JAILHOUSE_CELL_START		_IOW(0, 4, struct jailhouse_cell_id)
 #define JAILHOUSE_CELL_DESTROY		_IOW(0, 5, struct jailhouse_cell_id)
+#define JAILHOUSE_TRACE_READ		_IOWR(0, 6, struct jailhouse_trace_read)
+#define JAILHOUSE_CELL_RESET		_IOW(0, 7, struct jailhouse_cell_id)
+#define JAILHOUSE_MEM_POOL_GROW		_IOW(0, 8, struct jailhouse_mem_pool_grow)
+#define JAILHOUSE_MEM_POOL_SHRINK	_IO(0, 9)
+#define JAILHOUSE_CELL_CREATE_START	_IOW(0, 10, \
+					     struct jailhouse_cell_create_start)
+#define JAILHOUSE_CELL_BALLOON_UPDATE	_IOW(0, 11, struct jailhouse_cell_id)
+#define JAILHOUSE_CELL_CPU_ADD		_IOW(0, 12, struct jailhouse_cell_cpu)
+#define JAILHOUSE_CELL_CPU_REMOVE	_IOW(0, 13, struct jailhouse_cell_cpu)
 
 #endif /* !_JAILHOUSE_DRIVER_H */
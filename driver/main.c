@@ -23,6 +23,7 @@
 #include <linux/firmware.h>
 #include <linux/mm.h>
 #include <linux/kallsyms.h>
+#include <linux/list.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
 #include <linux/sched/signal.h>
 #endif
@@ -33,6 +34,11 @@
 #include <linux/vmalloc.h>
 #include <linux/io.h>
 #include <linux/ioport.h>
+#include <linux/ktime.h>
+#include <linux/sizes.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <asm/barrier.h>
 #include <asm/smp.h>
 #include <asm/cacheflush.h>
@@ -41,6 +47,8 @@
 #include <asm/virt.h>
 #endif
 #ifdef CONFIG_X86
+#include <asm/irq.h>
+#include <asm/irq_vectors.h>
 #include <asm/msr.h>
 #endif
 
@@ -84,23 +92,60 @@ extern unsigned int __hyp_stub_vectors[];
 struct console_state {
 	unsigned int head;
 	unsigned int last_console_id;
+	/* cell of a per-cell console, NULL for the hypervisor console */
+	struct cell *cell;
 };
 
 DEFINE_MUTEX(jailhouse_lock);
 bool jailhouse_enabled;
 void *hypervisor_mem;
+u64 jailhouse_enable_ns[JAILHOUSE_ENABLE_PHASES];
 
 static struct device *jailhouse_dev;
+static unsigned long hv_core_size, hv_percpu_size;
 static unsigned long hv_core_and_percpu_size;
 static atomic_t call_done;
 static int error_code;
 static struct jailhouse_virt_console* volatile console_page;
 static bool console_available;
+static void *trace_buffers;
+static unsigned long trace_buffer_stride;
+static unsigned int trace_buffer_cpus;
+static void *cell_consoles;
+static unsigned long cell_console_stride;
+static unsigned long cpu_stats_offset;
+static unsigned long cpu_stats_stride;
+static struct jailhouse_status_page *status_page;
+
+/* Notify the driver after this many characters if no line was completed */
+#define CONSOLE_NOTIFY_THRESHOLD	256
+
+/* Readers wait here for new content of any console */
+static DECLARE_WAIT_QUEUE_HEAD(console_wait);
+static atomic_t console_events;
+/* the hypervisor interrupts us on new content, no polling needed */
+static bool console_notify_active;
+static void console_poll_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(console_poll_work, console_poll_work_fn);
+static void cell_state_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(cell_state_work, cell_state_work_fn);
 static struct resource *hypervisor_mem_res;
 
+/* root cell memory donated to the hypervisor's memory pool */
+struct mem_pool_chunk {
+	struct list_head entry;
+	struct page *pages;
+};
+
+#define MEM_POOL_CHUNK_ORDER	get_order(SZ_2M)
+#define MEM_POOL_CHUNK_SIZE	(PAGE_SIZE << MEM_POOL_CHUNK_ORDER)
+
+static LIST_HEAD(mem_pool_chunks);
+
 static typeof(ioremap_page_range) *ioremap_page_range_sym;
 #ifdef CONFIG_X86
 static typeof(lapic_timer_frequency) *lapic_timer_frequency_sym;
+static typeof(x86_platform_ipi_callback) *x86_platform_ipi_callback_sym;
 #endif
 #ifdef CONFIG_ARM
 static typeof(__boot_cpu_mode) *__boot_cpu_mode_sym;
@@ -259,37 +304,35 @@ static inline const char * jailhouse_get_fw_name(void)
 #endif
 }
 
-static int __jailhouse_console_dump_delta(struct jailhouse_virt_console
-						*console,
-					  char *dst, unsigned int head,
-					  unsigned int *miss)
+static int console_ring_dump_delta(const char *content, unsigned int size,
+				   unsigned int tail, char *dst,
+				   unsigned int head, unsigned int *miss)
 {
 	int ret;
-	unsigned int head_mod, tail_mod;
+	unsigned int head_mod;
 	unsigned int delta, missed = 0;
 
 	/* we might underflow here intentionally */
-	delta = console->tail - head;
+	delta = tail - head;
 
 	/* check if we have misses */
-	if (delta > sizeof(console->content)) {
-		missed = delta - sizeof(console->content);
-		head = console->tail - sizeof(console->content);
-		delta = sizeof(console->content);
+	if (delta > size) {
+		missed = delta - size;
+		head = tail - size;
+		delta = size;
 	}
 
-	head_mod = head % sizeof(console->content);
-	tail_mod = console->tail % sizeof(console->content);
+	head_mod = head % size;
 
-	if (head_mod + delta > sizeof(console->content)) {
-		ret = sizeof(console->content) - head_mod;
-		memcpy(dst, console->content + head_mod, ret);
+	if (head_mod + delta > size) {
+		ret = size - head_mod;
+		memcpy(dst, content + head_mod, ret);
 		delta -= ret;
-		memcpy(dst + ret, console->content, delta);
+		memcpy(dst + ret, content, delta);
 		ret += delta;
 	} else {
 		ret = delta;
-		memcpy(dst, console->content + head_mod, delta);
+		memcpy(dst, content + head_mod, delta);
 	}
 
 	if (miss)
@@ -298,6 +341,237 @@ static int __jailhouse_console_dump_delta(struct jailhouse_virt_console
 	return ret;
 }
 
+static int __jailhouse_console_dump_delta(struct jailhouse_virt_console
+						*console,
+					  char *dst, unsigned int head,
+					  unsigned int *miss)
+{
+	return console_ring_dump_delta(console->content,
+				       sizeof(console->content), console->tail,
+				       dst, head, miss);
+}
+
+/* Must be called with jailhouse_lock held. */
+static int cell_console_dump_delta(struct cell *cell, char *dst,
+				   unsigned int head, unsigned int *miss)
+{
+	struct jailhouse_cell_console *console;
+	unsigned int tail;
+	int ret;
+
+	/* the cell was destroyed */
+	if (!cell->console_registered)
+		return -ENODEV;
+
+	console = cell_consoles + cell->console_cpu * cell_console_stride;
+	do {
+		/* spin while hypervisor is writing to console */
+		while (READ_ONCE(console->busy))
+			cpu_relax();
+		tail = READ_ONCE(console->tail);
+		rmb();
+
+		if (tail == head)
+			return 0;
+		ret = console_ring_dump_delta(console->content,
+					      sizeof(console->content), tail,
+					      dst, head, miss);
+		rmb();
+	} while (READ_ONCE(console->tail) != tail || READ_ONCE(console->busy));
+
+	return ret;
+}
+
+/**
+ * Locate the statistics of a CPU, which are read-only accessible for the root
+ * cell.
+ * @param cpu		CPU the statistics belong to.
+ * @param phys		Receives the physical address of the statistics.
+ *
+ * Only valid while the hypervisor is enabled.
+ */
+const struct jailhouse_cpu_stats *jailhouse_cpu_stats(unsigned int cpu,
+						      phys_addr_t *phys)
+{
+	unsigned long offset = cpu_stats_offset + cpu * cpu_stats_stride;
+
+	if (phys)
+		*phys = hypervisor_mem_res->start + offset;
+	return hypervisor_mem + offset;
+}
+
+/**
+ * Read the state of a non-root cell without issuing a hypercall.
+ * @param id		ID of the cell.
+ *
+ * @return Cell state (JAILHOUSE_CELL_*) or negative error code, -ENOENT if
+ * the cell is not listed in the status page.
+ *
+ * Only valid while the hypervisor is enabled.
+ */
+int jailhouse_cell_state(unsigned int id)
+{
+	const struct jailhouse_cell_status *status;
+	const struct jailhouse_comm_region *comm_region;
+	unsigned int generation, n;
+	u64 comm_page;
+	int state;
+
+	do {
+		while ((generation = READ_ONCE(status_page->generation)) & 1)
+			cpu_relax();
+		rmb();
+
+		state = -ENOENT;
+		for (n = 0; n < READ_ONCE(status_page->num_cells) &&
+		     n < JAILHOUSE_STATUS_MAX_CELLS; n++) {
+			status = &status_page->cells[n];
+			if (READ_ONCE(status->id) != id)
+				continue;
+			comm_page = READ_ONCE(status->comm_page);
+			if (!comm_page)
+				break;
+			comm_region = hypervisor_mem + comm_page;
+			state = READ_ONCE(comm_region->cell_state);
+			break;
+		}
+		rmb();
+	} while (READ_ONCE(status_page->generation) != generation);
+
+	switch (state) {
+	case -ENOENT:
+	case JAILHOUSE_CELL_RUNNING:
+	case JAILHOUSE_CELL_RUNNING_LOCKED:
+	case JAILHOUSE_CELL_SHUT_DOWN:
+	case JAILHOUSE_CELL_FAILED:
+	case JAILHOUSE_CELL_FAILED_COMM_REV:
+		return state;
+	default:
+		return -EINVAL;
+	}
+}
+
+/**
+ * Read the number of pending balloon requests of a cell from the status page.
+ * @param id		ID of the cell.
+ *
+ * @return Number of balloon chunks to move or -ENOENT if the cell is not
+ * listed in the status page.
+ *
+ * Only valid while the hypervisor is enabled.
+ */
+int jailhouse_cell_balloon_pending(unsigned int id)
+{
+	unsigned int generation, n;
+	int pending;
+
+	do {
+		while ((generation = READ_ONCE(status_page->generation)) & 1)
+			cpu_relax();
+		rmb();
+
+		pending = -ENOENT;
+		for (n = 0; n < READ_ONCE(status_page->num_cells) &&
+		     n < JAILHOUSE_STATUS_MAX_CELLS; n++)
+			if (READ_ONCE(status_page->cells[n].id) == id) {
+				pending = READ_ONCE(
+					status_page->cells[n].balloon_pending);
+				break;
+			}
+		rmb();
+	} while (READ_ONCE(status_page->generation) != generation);
+
+	return pending;
+}
+
+static void console_wake_up(void)
+{
+	atomic_inc(&console_events);
+	wake_up_interruptible_all(&console_wait);
+}
+
+/* Periodically wakes up readers as long as the hypervisor cannot notify us */
+static void console_poll_work_fn(struct work_struct *work)
+{
+	console_wake_up();
+}
+
+/*
+ * The hypervisor reports cell failures on its console, so notifications may
+ * come along with state changes.
+ */
+static void cell_state_work_fn(struct work_struct *work)
+{
+	/* jailhouse_lock holders may wait for this work */
+	if (!mutex_trylock(&jailhouse_lock)) {
+		schedule_delayed_work(&cell_state_work, 1);
+		return;
+	}
+	if (jailhouse_enabled)
+		jailhouse_cell_notify_state_changes();
+	mutex_unlock(&jailhouse_lock);
+}
+
+#ifdef CONFIG_X86
+static void console_notify_handler(void)
+{
+	console_wake_up();
+	schedule_delayed_work(&cell_state_work, 0);
+}
+#endif
+
+/**
+ * Ask the hypervisor to interrupt the calling CPU on new console content.
+ *
+ * Has to be repeated when the CPU is handed over to a non-root cell, the
+ * hypervisor stops notifying it then. Must be called with jailhouse_lock held.
+ */
+void jailhouse_console_notify_update(void)
+{
+#ifdef CONFIG_X86
+	int err;
+
+	if (!console_available)
+		return;
+
+	/* The platform IPI is free unless a platform driver claimed it. */
+	if (*x86_platform_ipi_callback_sym != console_notify_handler &&
+	    cmpxchg(x86_platform_ipi_callback_sym, NULL,
+		    console_notify_handler) != NULL)
+		return;
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CONSOLE_NOTIFY,
+				  X86_PLATFORM_IPI_VECTOR,
+				  CONSOLE_NOTIFY_THRESHOLD);
+	if (err) {
+		*x86_platform_ipi_callback_sym = NULL;
+		console_notify_active = false;
+		return;
+	}
+	console_notify_active = true;
+#endif
+}
+
+static void console_notify_stop(void)
+{
+#ifdef CONFIG_X86
+	if (!console_notify_active)
+		return;
+
+	console_notify_active = false;
+	*x86_platform_ipi_callback_sym = NULL;
+	/* wait for handlers that may still run on other CPUs */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,20,0)
+	synchronize_sched();
+#else
+	synchronize_rcu();
+#endif
+	cancel_delayed_work_sync(&cell_state_work);
+#endif
+	/* let readers fall back to polling */
+	console_wake_up();
+}
+
 static void jailhouse_firmware_free(void)
 {
 	jailhouse_sysfs_core_exit(jailhouse_dev);
@@ -349,12 +623,15 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 	struct jailhouse_header *header;
 	unsigned long remap_addr = 0;
 	void __iomem *console = NULL, *clock_reg = NULL;
+	u64 phase_start, phase_ns[JAILHOUSE_ENABLE_PHASES];
 	unsigned long config_size;
 	unsigned int clock_gates;
 	const char *fw_name;
 	long max_cpus;
 	int err;
 
+	phase_start = ktime_get_ns();
+
 	fw_name = jailhouse_get_fw_name();
 	if (!fw_name) {
 		pr_err("jailhouse: Missing or unsupported HVM technology\n");
@@ -427,8 +704,9 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 	    hypervisor->size >= hv_mem->size)
 		goto error_release_fw;
 
-	hv_core_and_percpu_size = header->core_size +
-		max_cpus * header->percpu_size;
+	hv_core_size = header->core_size;
+	hv_percpu_size = header->percpu_size;
+	hv_core_and_percpu_size = hv_core_size + max_cpus * hv_percpu_size;
 	config_size = jailhouse_system_config_size(&config_header);
 	if (hv_core_and_percpu_size >= hv_mem->size ||
 	    config_size >= hv_mem->size - hv_core_and_percpu_size)
@@ -466,14 +744,31 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 	last_console.valid = false;
 
 	/* Copy hypervisor's binary image at beginning of the memory region
-	 * and clear the rest to zero. */
+	 * and clear the rest of the core and the per-CPU areas to zero. The
+	 * hypervisor scrubs its page pool lazily on allocation. */
 	memcpy(hypervisor_mem, hypervisor->data, hypervisor->size);
 	memset(hypervisor_mem + hypervisor->size, 0,
-	       hv_mem->size - hypervisor->size);
+	       hv_core_and_percpu_size - hypervisor->size);
 
 	header = (struct jailhouse_header *)hypervisor_mem;
 	header->max_cpus = max_cpus;
 
+	/* The header page is not accessible anymore once we are enabled. */
+	if (header->trace_buffer) {
+		trace_buffers = hypervisor_mem + header->core_size +
+			header->trace_buffer;
+		trace_buffer_stride = header->percpu_size;
+		trace_buffer_cpus = max_cpus;
+	} else {
+		trace_buffers = NULL;
+	}
+	cell_consoles = hypervisor_mem + header->core_size +
+		header->cell_console;
+	cell_console_stride = header->percpu_size;
+	cpu_stats_offset = header->core_size + header->cpu_stats;
+	cpu_stats_stride = header->percpu_size;
+	status_page = hypervisor_mem + header->status_page;
+
 #if defined(CONFIG_ARM) || defined(CONFIG_ARM64)
 	header->arm_linux_hyp_vectors = virt_to_phys(*__hyp_stub_vectors_sym);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4,12,0)
@@ -505,6 +800,9 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 		goto error_unmap;
 	}
 
+	phase_ns[JAILHOUSE_ENABLE_LOAD] = ktime_get_ns() - phase_start;
+	phase_start += phase_ns[JAILHOUSE_ENABLE_LOAD];
+
 	if (config->debug_console.clock_reg) {
 		clock_reg = ioremap(config->debug_console.clock_reg,
 				    sizeof(clock_gates));
@@ -559,6 +857,9 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 
 	error_code = 0;
 
+	phase_ns[JAILHOUSE_ENABLE_PREPARE] = ktime_get_ns() - phase_start;
+	phase_start += phase_ns[JAILHOUSE_ENABLE_PREPARE];
+
 	preempt_disable();
 
 	header->online_cpus = num_online_cpus();
@@ -570,6 +871,8 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 
 	preempt_enable();
 
+	phase_ns[JAILHOUSE_ENABLE_ENTER] = ktime_get_ns() - phase_start;
+
 	if (error_code) {
 		err = error_code;
 		goto error_free_cell;
@@ -583,8 +886,12 @@ static int jailhouse_cmd_enable(struct jailhouse_system __user *arg)
 	jailhouse_cell_register_root();
 	jailhouse_pci_virtual_root_devices_add(&config_header);
 
+	memcpy(jailhouse_enable_ns, phase_ns, sizeof(jailhouse_enable_ns));
 	jailhouse_enabled = true;
 
+	jailhouse_console_notify_update();
+	jailhouse_timebase_start();
+
 	mutex_unlock(&jailhouse_lock);
 
 	pr_info("The Jailhouse is opening.\n");
@@ -619,18 +926,27 @@ error_unlock:
 	return err;
 }
 
-static void leave_hypervisor(void *info)
+static void touch_hypervisor_pages(void *start, unsigned long size)
 {
 	void *page;
+
+	for (page = start; page < start + size; page += PAGE_SIZE)
+		readl((void __iomem *)page);
+}
+
+static void leave_hypervisor(void *info)
+{
 	int err;
 
 	/* Touch each hypervisor page we may need during the switch so that
 	 * the active mm definitely contains all mappings. At least x86 does
-	 * not support taking any faults while switching worlds. */
-	for (page = hypervisor_mem;
-	     page < hypervisor_mem + hv_core_and_percpu_size;
-	     page += PAGE_SIZE)
-		readl((void __iomem *)page);
+	 * not support taking any faults while switching worlds. Besides the
+	 * core, a CPU only uses its own per-CPU area, so the CPUs don't have
+	 * to walk the areas of all others. */
+	touch_hypervisor_pages(hypervisor_mem, hv_core_size);
+	touch_hypervisor_pages(hypervisor_mem + hv_core_size +
+			       smp_processor_id() * hv_percpu_size,
+			       hv_percpu_size);
 
 	/* either returns 0 or the same error code across all CPUs */
 	err = jailhouse_call(JAILHOUSE_HC_DISABLE);
@@ -645,6 +961,132 @@ static void leave_hypervisor(void *info)
 	atomic_inc(&call_done);
 }
 
+static void mem_pool_chunk_free(struct mem_pool_chunk *chunk)
+{
+	list_del(&chunk->entry);
+	__free_pages(chunk->pages, MEM_POOL_CHUNK_ORDER);
+	kfree(chunk);
+}
+
+static void jailhouse_mem_pool_release(void)
+{
+	struct mem_pool_chunk *chunk, *tmp;
+
+	list_for_each_entry_safe(chunk, tmp, &mem_pool_chunks, entry)
+		mem_pool_chunk_free(chunk);
+}
+
+static int jailhouse_cmd_mem_pool_grow(struct jailhouse_mem_pool_grow
+				       __user *arg)
+{
+	struct jailhouse_mem_pool_grow grow;
+	struct mem_pool_chunk *chunk, *tmp;
+	unsigned long chunks, donated = 0;
+	unsigned int rejected = 0;
+	LIST_HEAD(unusable);
+	int err = 0;
+
+	if (copy_from_user(&grow, arg, sizeof(grow)))
+		return -EFAULT;
+
+	chunks = DIV_ROUND_UP(grow.size, MEM_POOL_CHUNK_SIZE);
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	if (!jailhouse_enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	while (donated < chunks) {
+		chunk = kzalloc(sizeof(*chunk), GFP_KERNEL);
+		if (!chunk) {
+			err = -ENOMEM;
+			break;
+		}
+		chunk->pages = alloc_pages(GFP_KERNEL | __GFP_NOWARN,
+					   MEM_POOL_CHUNK_ORDER);
+		if (!chunk->pages) {
+			kfree(chunk);
+			err = -ENOMEM;
+			break;
+		}
+
+		err = jailhouse_call_arg2(JAILHOUSE_HC_MEM_POOL_DONATE,
+					  page_to_phys(chunk->pages),
+					  MEM_POOL_CHUNK_SIZE);
+		/*
+		 * The hypervisor can only map chunks in the vicinity of its
+		 * own memory. Hold back unusable ones until the end so that
+		 * they are not handed out again.
+		 */
+		if ((err == -ERANGE || err == -EBUSY) && rejected++ < chunks) {
+			list_add(&chunk->entry, &unusable);
+			continue;
+		}
+		if (err) {
+			__free_pages(chunk->pages, MEM_POOL_CHUNK_ORDER);
+			kfree(chunk);
+			break;
+		}
+
+		list_add(&chunk->entry, &mem_pool_chunks);
+		donated++;
+	}
+
+	list_for_each_entry_safe(chunk, tmp, &unusable, entry)
+		mem_pool_chunk_free(chunk);
+
+	if (donated > 0)
+		pr_info("jailhouse: donated %lu KiB to hypervisor memory "
+			"pool\n", donated * MEM_POOL_CHUNK_SIZE / 1024);
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
+static int jailhouse_cmd_mem_pool_shrink(void)
+{
+	struct mem_pool_chunk *chunk, *tmp;
+	unsigned long reclaimed = 0;
+	int err = 0;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	if (!jailhouse_enabled) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	list_for_each_entry_safe(chunk, tmp, &mem_pool_chunks, entry) {
+		err = jailhouse_call_arg1(JAILHOUSE_HC_MEM_POOL_RECLAIM,
+					  page_to_phys(chunk->pages));
+		/* chunks still in use stay with the hypervisor */
+		if (err == -EBUSY) {
+			err = 0;
+			continue;
+		}
+		if (err)
+			break;
+
+		mem_pool_chunk_free(chunk);
+		reclaimed++;
+	}
+
+	if (reclaimed > 0)
+		pr_info("jailhouse: reclaimed %lu KiB from hypervisor memory "
+			"pool\n", reclaimed * MEM_POOL_CHUNK_SIZE / 1024);
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	return err;
+}
+
 static int jailhouse_cmd_disable(void)
 {
 	int err;
@@ -662,6 +1104,7 @@ static int jailhouse_cmd_disable(void)
 		goto unlock_out;
 
 	jailhouse_pci_virtual_root_devices_remove();
+	jailhouse_timebase_stop();
 
 	error_code = 0;
 
@@ -698,9 +1141,11 @@ static int jailhouse_cmd_disable(void)
 	if (err)
 		goto unlock_out;
 
+	console_notify_stop();
 	update_last_console();
 
 	jailhouse_cell_delete_root();
+	jailhouse_mem_pool_release();
 	jailhouse_enabled = false;
 	module_put(THIS_MODULE);
 
@@ -712,6 +1157,97 @@ unlock_out:
 	return err;
 }
 
+static int jailhouse_cmd_trace_read(struct jailhouse_trace_read __user *arg)
+{
+	struct jailhouse_trace_record *records;
+	struct jailhouse_trace_buffer *trace;
+	struct jailhouse_trace_read trace_read;
+	unsigned int tail, num, n;
+	int lost, err = 0;
+
+	if (copy_from_user(&trace_read, arg, sizeof(trace_read)))
+		return -EFAULT;
+
+	num = min_t(unsigned int, trace_read.num_records,
+		    JAILHOUSE_TRACE_RECORDS);
+	records = kmalloc_array(num, sizeof(*records), GFP_KERNEL);
+	if (num && !records)
+		return -ENOMEM;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0) {
+		err = -EINTR;
+		goto free_out;
+	}
+
+	if (!jailhouse_enabled) {
+		err = -EAGAIN;
+		goto unlock_out;
+	}
+	if (!trace_buffers) {
+		err = -EOPNOTSUPP;
+		goto unlock_out;
+	}
+	if (trace_read.cpu >= trace_buffer_cpus) {
+		err = -ENODEV;
+		goto unlock_out;
+	}
+
+	trace = trace_buffers + trace_read.cpu * trace_buffer_stride;
+
+	trace_read.missed = 0;
+	tail = READ_ONCE(trace->tail);
+	/* order reading the tail before reading the records */
+	rmb();
+
+	/* we might underflow here intentionally */
+	if (tail - trace_read.head > JAILHOUSE_TRACE_RECORDS) {
+		trace_read.missed = tail - trace_read.head -
+			JAILHOUSE_TRACE_RECORDS;
+		trace_read.head = tail - JAILHOUSE_TRACE_RECORDS;
+	}
+
+	num = min(num, tail - trace_read.head);
+	for (n = 0; n < num; n++)
+		records[n] = trace->records[(trace_read.head + n) %
+					    JAILHOUSE_TRACE_RECORDS];
+
+	/*
+	 * The hypervisor may have overwritten the oldest records while we
+	 * were copying them, including the one it is currently writing.
+	 */
+	rmb();
+	lost = (int)(READ_ONCE(trace->tail) + 1 - JAILHOUSE_TRACE_RECORDS -
+		     trace_read.head);
+	if (lost > 0) {
+		if (lost > (int)num)
+			lost = num;
+		memmove(records, records + lost,
+			(num - lost) * sizeof(*records));
+		num -= lost;
+		trace_read.missed += lost;
+		trace_read.head += lost;
+	}
+
+unlock_out:
+	mutex_unlock(&jailhouse_lock);
+
+	if (err)
+		goto free_out;
+
+	trace_read.head += num;
+	trace_read.num_records = num;
+
+	if (copy_to_user((void __user *)(unsigned long)
+			 trace_read.records_address, records,
+			 num * sizeof(*records)) ||
+	    copy_to_user(arg, &trace_read, sizeof(trace_read)))
+		err = -EFAULT;
+
+free_out:
+	kfree(records);
+	return err;
+}
+
 static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
 			    unsigned long arg)
 {
@@ -739,6 +1275,34 @@ static long jailhouse_ioctl(struct file *file, unsigned int ioctl,
 	case JAILHOUSE_CELL_DESTROY:
 		err = jailhouse_cmd_cell_destroy((const char __user *)arg);
 		break;
+	case JAILHOUSE_CELL_RESET:
+		err = jailhouse_cmd_cell_reset((const char __user *)arg);
+		break;
+	case JAILHOUSE_CELL_CREATE_START:
+		err = jailhouse_cmd_cell_create_start(
+			(struct jailhouse_cell_create_start __user *)arg);
+		break;
+	case JAILHOUSE_TRACE_READ:
+		err = jailhouse_cmd_trace_read(
+			(struct jailhouse_trace_read __user *)arg);
+		break;
+	case JAILHOUSE_CELL_BALLOON_UPDATE:
+		err = jailhouse_cmd_cell_balloon_update(
+			(const char __user *)arg);
+		break;
+	case JAILHOUSE_CELL_CPU_ADD:
+		err = jailhouse_cmd_cell_cpu_add((const char __user *)arg);
+		break;
+	case JAILHOUSE_CELL_CPU_REMOVE:
+		err = jailhouse_cmd_cell_cpu_remove((const char __user *)arg);
+		break;
+	case JAILHOUSE_MEM_POOL_GROW:
+		err = jailhouse_cmd_mem_pool_grow(
+			(struct jailhouse_mem_pool_grow __user *)arg);
+		break;
+	case JAILHOUSE_MEM_POOL_SHRINK:
+		err = jailhouse_cmd_mem_pool_shrink();
+		break;
 	default:
 		err = -EINVAL;
 		break;
@@ -760,10 +1324,33 @@ static int jailhouse_console_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
+static int jailhouse_cell_console_open(struct inode *inode, struct file *file)
+{
+	struct cell *cell = container_of(file->private_data, struct cell,
+					 console_dev);
+	struct console_state *user;
+
+	user = kzalloc(sizeof(struct console_state), GFP_KERNEL);
+	if (!user)
+		return -ENOMEM;
+
+	/*
+	 * The misc core calls us under its lock, so the cell cannot be
+	 * unregistered and released before we hold a reference.
+	 */
+	kobject_get(&cell->kobj);
+	user->cell = cell;
+	file->private_data = user;
+
+	return 0;
+}
+
 static int jailhouse_console_release(struct inode *inode, struct file *file)
 {
 	struct console_state *user = file->private_data;
 
+	if (user->cell)
+		kobject_put(&user->cell->kobj);
 	kfree(user);
 
 	return 0;
@@ -773,23 +1360,31 @@ static ssize_t jailhouse_console_read(struct file *file, char __user *out,
 				      size_t size, loff_t *off)
 {
 	struct console_state *user = file->private_data;
+	size_t content_size = user->cell ? JAILHOUSE_CELL_CONSOLE_SIZE :
+		sizeof(console_page->content);
+	unsigned int miss, events;
 	char *content;
-	unsigned int miss;
+	long wait;
 	int ret;
 
-	content = kmalloc(sizeof(console_page->content), GFP_KERNEL);
+	content = kmalloc(content_size, GFP_KERNEL);
 	if (content == NULL)
 		return -ENOMEM;
 
 	/* wait for new data */
 	while (1) {
+		events = atomic_read(&console_events);
+
 		if (mutex_lock_interruptible(&jailhouse_lock) != 0) {
 			ret = -EINTR;
 			goto console_free_out;
 		}
 
-		if (last_console.id != user->last_console_id &&
-		    last_console.valid) {
+		if (user->cell) {
+			ret = cell_console_dump_delta(user->cell, content,
+						      user->head, &miss);
+		} else if (last_console.id != user->last_console_id &&
+			   last_console.valid) {
 			ret = __jailhouse_console_dump_delta(&last_console.page,
 							     content,
 							     user->head,
@@ -804,6 +1399,12 @@ static ssize_t jailhouse_console_read(struct file *file, char __user *out,
 
 		mutex_unlock(&jailhouse_lock);
 
+		/* end of file for consoles of destroyed cells */
+		if (ret == -ENODEV) {
+			ret = 0;
+			goto console_free_out;
+		}
+
 		if ((!ret || ret == -EAGAIN) && file->f_flags & O_NONBLOCK)
 			goto console_free_out;
 
@@ -817,8 +1418,11 @@ static ssize_t jailhouse_console_read(struct file *file, char __user *out,
 		else if (ret)
 			break;
 
-		schedule_timeout_uninterruptible(HZ / 10);
-		if (signal_pending(current)) {
+		wait = wait_event_interruptible_timeout(console_wait,
+				atomic_read(&console_events) != events,
+				READ_ONCE(console_notify_active) ?
+				MAX_SCHEDULE_TIMEOUT : HZ / 10);
+		if (wait < 0) {
 			ret = -EINTR;
 			goto console_free_out;
 		}
@@ -827,7 +1431,7 @@ static ssize_t jailhouse_console_read(struct file *file, char __user *out,
 	if (miss) {
 		/* If we missed anything, warn user. We will dump the actual
 		 * content in the next call. */
-		ret = snprintf(content, sizeof(console_page->content),
+		ret = snprintf(content, content_size,
 			       "<missed %u bytes of console log>\n",
 			       miss);
 		user->head += miss;
@@ -843,11 +1447,48 @@ static ssize_t jailhouse_console_read(struct file *file, char __user *out,
 		ret = -EFAULT;
 
 console_free_out:
-	set_current_state(TASK_RUNNING);
 	kfree(content);
 	return ret;
 }
 
+static bool console_data_pending(struct console_state *user)
+{
+	struct jailhouse_cell_console *console;
+
+	if (user->cell) {
+		/* end of file once the cell is gone */
+		if (!user->cell->console_registered)
+			return true;
+		console = cell_consoles +
+			user->cell->console_cpu * cell_console_stride;
+		return READ_ONCE(console->tail) != user->head;
+	}
+
+	if (last_console.valid && last_console.id != user->last_console_id)
+		return true;
+
+	return jailhouse_enabled && console_available &&
+		READ_ONCE(console_page->tail) != user->head;
+}
+
+static __poll_t jailhouse_console_poll(struct file *file,
+				       struct poll_table_struct *wait)
+{
+	struct console_state *user = file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &console_wait, wait);
+
+	mutex_lock(&jailhouse_lock);
+	if (console_data_pending(user))
+		mask = EPOLLIN | EPOLLRDNORM;
+	else if (!console_notify_active)
+		schedule_delayed_work(&console_poll_work, HZ / 10);
+	mutex_unlock(&jailhouse_lock);
+
+	return mask;
+}
+
 
 static const struct file_operations jailhouse_fops = {
 	.owner = THIS_MODULE,
@@ -857,6 +1498,7 @@ static const struct file_operations jailhouse_fops = {
 	.open = jailhouse_console_open,
 	.release = jailhouse_console_release,
 	.read = jailhouse_console_read,
+	.poll = jailhouse_console_poll,
 };
 
 static struct miscdevice jailhouse_misc_dev = {
@@ -865,6 +1507,52 @@ static struct miscdevice jailhouse_misc_dev = {
 	.fops = &jailhouse_fops,
 };
 
+static const struct file_operations jailhouse_cell_console_fops = {
+	.owner = THIS_MODULE,
+	.llseek = noop_llseek,
+	.open = jailhouse_cell_console_open,
+	.release = jailhouse_console_release,
+	.read = jailhouse_console_read,
+	.poll = jailhouse_console_poll,
+};
+
+/* Must be called with jailhouse_lock held. */
+void jailhouse_cell_console_register(struct cell *cell)
+{
+	char *c;
+	int err;
+
+	snprintf(cell->console_name, sizeof(cell->console_name),
+		 "jailhouse-console-%s", cell->name);
+	/* device names must not contain path separators */
+	for (c = cell->console_name; *c; c++)
+		if (*c == '/' || *c == ' ')
+			*c = '_';
+
+	cell->console_cpu = cpumask_first(&cell->cpus_assigned);
+	cell->console_dev.minor = MISC_DYNAMIC_MINOR;
+	cell->console_dev.name = cell->console_name;
+	cell->console_dev.fops = &jailhouse_cell_console_fops;
+
+	err = misc_register(&cell->console_dev);
+	if (err) {
+		pr_warn("jailhouse: failed to register console of cell "
+			"\"%s\"\n", cell->name);
+		return;
+	}
+	cell->console_registered = true;
+}
+
+/* Must be called with jailhouse_lock held. */
+void jailhouse_cell_console_unregister(struct cell *cell)
+{
+	if (!cell->console_registered)
+		return;
+
+	misc_deregister(&cell->console_dev);
+	cell->console_registered = false;
+}
+
 static int jailhouse_shutdown_notify(struct notifier_block *unused1,
 				     unsigned long unused2, void *unused3)
 {
@@ -898,6 +1586,7 @@ static int __init jailhouse_init(void)
 	RESOLVE_EXTERNAL_SYMBOL(ioremap_page_range);
 #ifdef CONFIG_X86
 	RESOLVE_EXTERNAL_SYMBOL(lapic_timer_frequency);
+	RESOLVE_EXTERNAL_SYMBOL(x86_platform_ipi_callback);
 #endif
 #ifdef CONFIG_ARM
 	RESOLVE_EXTERNAL_SYMBOL(__boot_cpu_mode);
@@ -910,10 +1599,14 @@ static int __init jailhouse_init(void)
 	if (IS_ERR(jailhouse_dev))
 		return PTR_ERR(jailhouse_dev);
 
-	err = jailhouse_sysfs_init(jailhouse_dev);
+	err = jailhouse_cell_init();
 	if (err)
 		goto unreg_dev;
 
+	err = jailhouse_sysfs_init(jailhouse_dev);
+	if (err)
+		goto exit_cell;
+
 	err = misc_register(&jailhouse_misc_dev);
 	if (err)
 		goto exit_sysfs;
@@ -933,6 +1626,9 @@ exit_misc:
 exit_sysfs:
 	jailhouse_sysfs_exit(jailhouse_dev);
 
+exit_cell:
+	jailhouse_cell_exit();
+
 unreg_dev:
 	root_device_unregister(jailhouse_dev);
 	return err;
@@ -942,6 +1638,8 @@ static void __exit jailhouse_exit(void)
 {
 	unregister_reboot_notifier(&jailhouse_shutdown_nb);
 	misc_deregister(&jailhouse_misc_dev);
+	jailhouse_cell_exit();
+	cancel_delayed_work_sync(&console_poll_work);
 	jailhouse_sysfs_exit(jailhouse_dev);
 	jailhouse_firmware_free();
 	jailhouse_pci_unregister();
@@ -14,16 +14,44 @@
 #define _JAILHOUSE_DRIVER_MAIN_H
 
 #include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/version.h>
 
 #include "cell.h"
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+#define __poll_t	unsigned int
+#define EPOLLIN		POLLIN
+#define EPOLLRDNORM	POLLRDNORM
+#endif
+
 extern struct mutex jailhouse_lock;
 extern bool jailhouse_enabled;
 extern void *hypervisor_mem;
 
+enum jailhouse_enable_phase {
+	JAILHOUSE_ENABLE_LOAD,
+	JAILHOUSE_ENABLE_PREPARE,
+	JAILHOUSE_ENABLE_ENTER,
+	JAILHOUSE_ENABLE_PHASES
+};
+
+/* durations of the last successful enable, in ns */
+extern u64 jailhouse_enable_ns[JAILHOUSE_ENABLE_PHASES];
+
 void *jailhouse_ioremap(phys_addr_t phys, unsigned long virt,
 			unsigned long size);
 int jailhouse_console_dump_delta(char *dst, unsigned int head,
 				 unsigned int *miss);
+void jailhouse_cell_console_register(struct cell *cell);
+void jailhouse_cell_console_unregister(struct cell *cell);
+void jailhouse_console_notify_update(void);
+const struct jailhouse_cpu_stats *jailhouse_cpu_stats(unsigned int cpu,
+						      phys_addr_t *phys);
+int jailhouse_cell_state(unsigned int id);
+int jailhouse_cell_balloon_pending(unsigned int id);
+void jailhouse_timebase_start(void);
+void jailhouse_timebase_stop(void);
+ssize_t jailhouse_timebase_show(char *buffer);
 
 #endif /* !_JAILHOUSE_DRIVER_MAIN_H */
@@ -163,13 +163,23 @@ static void jailhouse_pci_claim_release(const struct jailhouse_pci_device *dev,
 }
 
 /**
- * Register jailhouse as a PCI device driver so it can claim assigned devices.
+ * Register jailhouse as a PCI device driver so it can claim assigned devices,
+ * and register the agent of the DMA copy service.
  *
  * @return 0 on success, or error code
  */
 int jailhouse_pci_register(void)
 {
-	return pci_register_driver(&jailhouse_pci_stub_driver);
+	int err;
+
+	err = pci_register_driver(&jailhouse_pci_stub_driver);
+	if (err)
+		return err;
+
+	err = jailhouse_dma_copy_register();
+	if (err)
+		pci_unregister_driver(&jailhouse_pci_stub_driver);
+	return err;
 }
 
 /**
@@ -177,6 +187,7 @@ int jailhouse_pci_register(void)
  */
 void jailhouse_pci_unregister(void)
 {
+	jailhouse_dma_copy_unregister();
 	pci_unregister_driver(&jailhouse_pci_stub_driver);
 }
 
@@ -30,6 +30,20 @@ void jailhouse_pci_virtual_root_devices_remove(void);
 int jailhouse_pci_register(void);
 void jailhouse_pci_unregister(void);
 
+#ifdef CONFIG_DMA_ENGINE
+int jailhouse_dma_copy_register(void);
+void jailhouse_dma_copy_unregister(void);
+#else /* !CONFIG_DMA_ENGINE */
+static inline int jailhouse_dma_copy_register(void)
+{
+	return 0;
+}
+
+static inline void jailhouse_dma_copy_unregister(void)
+{
+}
+#endif /* !CONFIG_DMA_ENGINE */
+
 #else /* !CONFIG_PCI */
 
 static inline void
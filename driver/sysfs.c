@@ -19,7 +19,10 @@
 
 /* For compatibility with older kernel versions */
 #include <linux/version.h>
-#include <linux/gfp.h>
+#include <linux/mm.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/signal.h>
+#endif
 #include <linux/stat.h>
 #include <linux/slab.h>
 
@@ -74,26 +77,57 @@ struct jailhouse_cpu_stats_attr {
 	unsigned int code;
 };
 
+/*
+ * Statistic counters are read in full width from the statistics page of the
+ * CPU, CPU_GET_INFO truncates them to 31 bits.
+ */
+static long long cpu_stat_value(unsigned int cpu, unsigned int code)
+{
+	if (code >= JAILHOUSE_CPU_INFO_STAT_BASE &&
+	    code - JAILHOUSE_CPU_INFO_STAT_BASE < JAILHOUSE_NUM_CPU_STATS)
+		return jailhouse_cpu_stats(cpu, NULL)->stats
+			[code - JAILHOUSE_CPU_INFO_STAT_BASE];
+
+	return jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO, cpu, code);
+}
+
 static ssize_t cell_stats_show(struct kobject *kobj,
 			       struct kobj_attribute *attr,
 			       char *buffer)
 {
 	struct jailhouse_cpu_stats_attr *stats_attr =
 		container_of(attr, struct jailhouse_cpu_stats_attr, kattr);
-	unsigned int code = JAILHOUSE_CPU_INFO_STAT_BASE + stats_attr->code;
 	struct cell *cell = container_of(kobj, struct cell, stats_kobj);
-	unsigned long sum = 0;
+	unsigned long long sum = 0;
 	unsigned int cpu;
-	int value;
+	long long value;
 
 	for_each_cpu(cpu, &cell->cpus_assigned) {
-		value = jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO, cpu,
-					    code);
+		value = cpu_stat_value(cpu, stats_attr->code);
 		if (value > 0)
 			sum += value;
 	}
 
-	return sprintf(buffer, "%lu\n", sum);
+	return sprintf(buffer, "%llu\n", sum);
+}
+
+static ssize_t cell_stats_max_show(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   char *buffer)
+{
+	struct jailhouse_cpu_stats_attr *stats_attr =
+		container_of(attr, struct jailhouse_cpu_stats_attr, kattr);
+	struct cell *cell = container_of(kobj, struct cell, stats_kobj);
+	long long value, max = 0;
+	unsigned int cpu;
+
+	for_each_cpu(cpu, &cell->cpus_assigned) {
+		value = cpu_stat_value(cpu, stats_attr->code);
+		if (value > max)
+			max = value;
+	}
+
+	return sprintf(buffer, "%lld\n", max);
 }
 
 static ssize_t cpu_stats_show(struct kobject *kobj,
@@ -102,19 +136,18 @@ static ssize_t cpu_stats_show(struct kobject *kobj,
 {
 	struct jailhouse_cpu_stats_attr *stats_attr =
 		container_of(attr, struct jailhouse_cpu_stats_attr, kattr);
-	unsigned int code = JAILHOUSE_CPU_INFO_STAT_BASE + stats_attr->code;
 	struct cell_cpu *cell_cpu = container_of(kobj, struct cell_cpu, kobj);
-	int value;
+	long long value;
 
-	value = jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO, cell_cpu->cpu,
-				    code);
+	value = cpu_stat_value(cell_cpu->cpu, stats_attr->code);
 	if (value < 0)
 		value = 0;
 
-	return sprintf(buffer, "%d\n", value);
+	return sprintf(buffer, "%lld\n", value);
 }
 
-#define JAILHOUSE_CPU_STATS_ATTR(_name, _code) \
+/* per-CPU value of CPU_GET_INFO code _code, summed up over the cell's CPUs */
+#define JAILHOUSE_CPU_INFO_ATTR(_name, _code) \
 	static struct jailhouse_cpu_stats_attr _name##_cell_attr = { \
 		.kattr = __ATTR(_name, S_IRUGO, cell_stats_show, NULL), \
 		.code = _code, \
@@ -124,58 +157,257 @@ static ssize_t cpu_stats_show(struct kobject *kobj,
 		.code = _code, \
 	}
 
-JAILHOUSE_CPU_STATS_ATTR(vmexits_total, JAILHOUSE_CPU_STAT_VMEXITS_TOTAL);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_mmio, JAILHOUSE_CPU_STAT_VMEXITS_MMIO);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_management,
-			 JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_hypercall,
-			 JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL);
+#define JAILHOUSE_CPU_STATS_ATTR(_name, _code) \
+	JAILHOUSE_CPU_INFO_ATTR(_name, JAILHOUSE_CPU_INFO_STAT_BASE + (_code))
+
+/* per-CPU maximum, the cell entry reports the largest one of its CPUs */
+#define JAILHOUSE_CPU_STATS_MAX_ATTR(_name, _code) \
+	static struct jailhouse_cpu_stats_attr _name##_cell_attr = { \
+		.kattr = __ATTR(_name, S_IRUGO, cell_stats_max_show, NULL), \
+		.code = JAILHOUSE_CPU_INFO_STAT_BASE + (_code), \
+	}; \
+	static struct jailhouse_cpu_stats_attr _name##_cpu_attr = { \
+		.kattr = __ATTR(_name, S_IRUGO, cpu_stats_show, NULL), \
+		.code = JAILHOUSE_CPU_INFO_STAT_BASE + (_code), \
+	}
+
+#define JAILHOUSE_CPU_PMU_ATTR(_name, _code) \
+	JAILHOUSE_CPU_INFO_ATTR(_name, JAILHOUSE_CPU_INFO_PMU_BASE + (_code))
+
+static ssize_t cell_qos_show(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     char *buffer)
+{
+	struct jailhouse_cpu_stats_attr *stats_attr =
+		container_of(attr, struct jailhouse_cpu_stats_attr, kattr);
+	unsigned int code = JAILHOUSE_CPU_INFO_QOS_BASE + stats_attr->code;
+	struct cell *cell = container_of(kobj, struct cell, stats_kobj);
+	int value;
+
+	/* counters are per cell, any of its CPUs identifies it */
+	value = jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO,
+				    cpumask_first(&cell->cpus_assigned), code);
+	if (value < 0)
+		return value;
+
+	return sprintf(buffer, "%d\n", value);
+}
+
+#define JAILHOUSE_CELL_QOS_ATTR(_name, _code) \
+	static struct jailhouse_cpu_stats_attr _name##_cell_attr = { \
+		.kattr = __ATTR(_name, S_IRUGO, cell_qos_show, NULL), \
+		.code = _code, \
+	}
+
+/*
+ * Read the exit latency histogram of a CPU with a single hypercall. Buckets
+ * that cannot be read are reported as 0.
+ */
+static int cpu_latency_read(unsigned int cpu, unsigned int code,
+			    long values[JAILHOUSE_EXIT_LATENCY_BUCKETS])
+{
+	struct jailhouse_multicall *calls;
+	unsigned int bucket;
+	int err;
+
+	/* the batch must not cross a page boundary */
+	calls = (struct jailhouse_multicall *)get_zeroed_page(GFP_KERNEL);
+	if (!calls)
+		return -ENOMEM;
+
+	for (bucket = 0; bucket < JAILHOUSE_EXIT_LATENCY_BUCKETS; bucket++) {
+		calls[bucket].code = JAILHOUSE_HC_CPU_GET_INFO;
+		calls[bucket].arg1 = cpu;
+		calls[bucket].arg2 = code + bucket;
+	}
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_MULTICALL, __pa(calls),
+				  JAILHOUSE_EXIT_LATENCY_BUCKETS);
+	for (bucket = 0; bucket < JAILHOUSE_EXIT_LATENCY_BUCKETS; bucket++)
+		values[bucket] = err || calls[bucket].result < 0 ?
+			0 : calls[bucket].result;
+
+	free_page((unsigned long)calls);
+	return err;
+}
+
+static ssize_t cell_latency_show(struct kobject *kobj,
+				 struct kobj_attribute *attr,
+				 char *buffer)
+{
+	struct jailhouse_cpu_stats_attr *stats_attr =
+		container_of(attr, struct jailhouse_cpu_stats_attr, kattr);
+	unsigned int code = JAILHOUSE_CPU_INFO_EXIT_LATENCY_BASE +
+		stats_attr->code * JAILHOUSE_EXIT_LATENCY_BUCKETS;
+	struct cell *cell = container_of(kobj, struct cell, stats_kobj);
+	unsigned long sum[JAILHOUSE_EXIT_LATENCY_BUCKETS] = { 0 };
+	long values[JAILHOUSE_EXIT_LATENCY_BUCKETS];
+	unsigned int bucket, cpu;
+	ssize_t written = 0;
+	int err;
+
+	for_each_cpu(cpu, &cell->cpus_assigned) {
+		err = cpu_latency_read(cpu, code, values);
+		if (err == -ENOMEM)
+			return err;
+		for (bucket = 0; bucket < JAILHOUSE_EXIT_LATENCY_BUCKETS;
+		     bucket++)
+			sum[bucket] += values[bucket];
+	}
+
+	for (bucket = 0; bucket < JAILHOUSE_EXIT_LATENCY_BUCKETS; bucket++)
+		written += scnprintf(buffer + written, PAGE_SIZE - written,
+				     "%s%lu", bucket ? " " : "", sum[bucket]);
+	written += scnprintf(buffer + written, PAGE_SIZE - written, "\n");
+
+	return written;
+}
+
+static ssize_t cpu_latency_show(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				char *buffer)
+{
+	struct jailhouse_cpu_stats_attr *stats_attr =
+		container_of(attr, struct jailhouse_cpu_stats_attr, kattr);
+	unsigned int code = JAILHOUSE_CPU_INFO_EXIT_LATENCY_BASE +
+		stats_attr->code * JAILHOUSE_EXIT_LATENCY_BUCKETS;
+	struct cell_cpu *cell_cpu = container_of(kobj, struct cell_cpu, kobj);
+	long values[JAILHOUSE_EXIT_LATENCY_BUCKETS];
+	unsigned int bucket;
+	ssize_t written = 0;
+	int err;
+
+	err = cpu_latency_read(cell_cpu->cpu, code, values);
+	if (err == -ENOMEM)
+		return err;
+
+	for (bucket = 0; bucket < JAILHOUSE_EXIT_LATENCY_BUCKETS; bucket++)
+		written += scnprintf(buffer + written, PAGE_SIZE - written,
+				     "%s%ld", bucket ? " " : "", values[bucket]);
+	written += scnprintf(buffer + written, PAGE_SIZE - written, "\n");
+
+	return written;
+}
+
+/* VM exit counter plus its latency histogram as <name>_latency */
+#define JAILHOUSE_CPU_EXIT_STATS_ATTR(_name, _code) \
+	JAILHOUSE_CPU_STATS_ATTR(_name, _code); \
+	static struct jailhouse_cpu_stats_attr _name##_latency_cell_attr = { \
+		.kattr = __ATTR(_name##_latency, S_IRUGO, cell_latency_show, \
+				NULL), \
+		.code = _code, \
+	}; \
+	static struct jailhouse_cpu_stats_attr _name##_latency_cpu_attr = { \
+		.kattr = __ATTR(_name##_latency, S_IRUGO, cpu_latency_show, \
+				NULL), \
+		.code = _code, \
+	}
+
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_total, JAILHOUSE_CPU_STAT_VMEXITS_TOTAL);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_mmio, JAILHOUSE_CPU_STAT_VMEXITS_MMIO);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_management,
+			      JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_hypercall,
+			      JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL);
+JAILHOUSE_CPU_STATS_ATTR(mmio_cache_hits, JAILHOUSE_CPU_STAT_MMIO_CACHE_HITS);
+JAILHOUSE_CPU_STATS_ATTR(mmio_cache_misses,
+			 JAILHOUSE_CPU_STAT_MMIO_CACHE_MISSES);
+JAILHOUSE_CPU_STATS_ATTR(irqs_injected, JAILHOUSE_CPU_STAT_IRQS_INJECTED);
+JAILHOUSE_CPU_STATS_ATTR(ipis_sent, JAILHOUSE_CPU_STAT_IPIS_SENT);
+JAILHOUSE_CPU_STATS_ATTR(ipis_received, JAILHOUSE_CPU_STAT_IPIS_RECEIVED);
+JAILHOUSE_CPU_STATS_ATTR(pending_overflows,
+			 JAILHOUSE_CPU_STAT_PENDING_OVERFLOWS);
+JAILHOUSE_CPU_STATS_MAX_ATTR(max_exit_ticks,
+			     JAILHOUSE_CPU_STAT_MAX_EXIT_TICKS);
+JAILHOUSE_CPU_STATS_MAX_ATTR(stack_max_usage,
+			     JAILHOUSE_CPU_STAT_STACK_MAX_USAGE);
+JAILHOUSE_CPU_PMU_ATTR(pmu_kcycles, JAILHOUSE_PMU_KCYCLES);
+JAILHOUSE_CPU_PMU_ATTR(pmu_kinstructions, JAILHOUSE_PMU_KINSTRUCTIONS);
+JAILHOUSE_CPU_PMU_ATTR(pmu_llc_misses, JAILHOUSE_PMU_LLC_MISSES);
 #ifdef CONFIG_X86
-JAILHOUSE_CPU_STATS_ATTR(vmexits_pio, JAILHOUSE_CPU_STAT_VMEXITS_PIO);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_xapic, JAILHOUSE_CPU_STAT_VMEXITS_XAPIC);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_cr, JAILHOUSE_CPU_STAT_VMEXITS_CR);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_cpuid, JAILHOUSE_CPU_STAT_VMEXITS_CPUID);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_xsetbv, JAILHOUSE_CPU_STAT_VMEXITS_XSETBV);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_exception,
-			 JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_msr_other,
-			 JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_msr_x2apic_icr,
-			 JAILHOUSE_CPU_STAT_VMEXITS_MSR_X2APIC_ICR);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_pio, JAILHOUSE_CPU_STAT_VMEXITS_PIO);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_xapic, JAILHOUSE_CPU_STAT_VMEXITS_XAPIC);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_cr, JAILHOUSE_CPU_STAT_VMEXITS_CR);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_cpuid, JAILHOUSE_CPU_STAT_VMEXITS_CPUID);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_xsetbv,
+			      JAILHOUSE_CPU_STAT_VMEXITS_XSETBV);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_exception,
+			      JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_msr_other,
+			      JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_msr_x2apic_icr,
+			      JAILHOUSE_CPU_STAT_VMEXITS_MSR_X2APIC_ICR);
+JAILHOUSE_CELL_QOS_ATTR(qos_l3_occupancy_kb, JAILHOUSE_QOS_L3_OCCUPANCY);
+JAILHOUSE_CELL_QOS_ATTR(qos_mem_bw_total_kb, JAILHOUSE_QOS_MEM_BW_TOTAL);
+JAILHOUSE_CELL_QOS_ATTR(qos_mem_bw_local_kb, JAILHOUSE_QOS_MEM_BW_LOCAL);
 #elif defined(CONFIG_ARM) || defined(CONFIG_ARM64)
-JAILHOUSE_CPU_STATS_ATTR(vmexits_maintenance,
-			 JAILHOUSE_CPU_STAT_VMEXITS_MAINTENANCE);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_virt_irq, JAILHOUSE_CPU_STAT_VMEXITS_VIRQ);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_virt_sgi, JAILHOUSE_CPU_STAT_VMEXITS_VSGI);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_psci, JAILHOUSE_CPU_STAT_VMEXITS_PSCI);
-JAILHOUSE_CPU_STATS_ATTR(vmexits_smccc, JAILHOUSE_CPU_STAT_VMEXITS_SMCCC);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_maintenance,
+			      JAILHOUSE_CPU_STAT_VMEXITS_MAINTENANCE);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_virt_irq,
+			      JAILHOUSE_CPU_STAT_VMEXITS_VIRQ);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_virt_sgi,
+			      JAILHOUSE_CPU_STAT_VMEXITS_VSGI);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_psci, JAILHOUSE_CPU_STAT_VMEXITS_PSCI);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_smccc, JAILHOUSE_CPU_STAT_VMEXITS_SMCCC);
 #ifdef CONFIG_ARM
-JAILHOUSE_CPU_STATS_ATTR(vmexits_cp15, JAILHOUSE_CPU_STAT_VMEXITS_CP15);
+JAILHOUSE_CPU_EXIT_STATS_ATTR(vmexits_cp15, JAILHOUSE_CPU_STAT_VMEXITS_CP15);
 #endif
 #endif
 
 static struct attribute *cell_stats_attrs[] = {
 	&vmexits_total_cell_attr.kattr.attr,
+	&vmexits_total_latency_cell_attr.kattr.attr,
 	&vmexits_mmio_cell_attr.kattr.attr,
+	&vmexits_mmio_latency_cell_attr.kattr.attr,
 	&vmexits_management_cell_attr.kattr.attr,
+	&vmexits_management_latency_cell_attr.kattr.attr,
 	&vmexits_hypercall_cell_attr.kattr.attr,
+	&vmexits_hypercall_latency_cell_attr.kattr.attr,
+	&mmio_cache_hits_cell_attr.kattr.attr,
+	&mmio_cache_misses_cell_attr.kattr.attr,
+	&irqs_injected_cell_attr.kattr.attr,
+	&ipis_sent_cell_attr.kattr.attr,
+	&ipis_received_cell_attr.kattr.attr,
+	&pending_overflows_cell_attr.kattr.attr,
+	&max_exit_ticks_cell_attr.kattr.attr,
+	&stack_max_usage_cell_attr.kattr.attr,
+	&pmu_kcycles_cell_attr.kattr.attr,
+	&pmu_kinstructions_cell_attr.kattr.attr,
+	&pmu_llc_misses_cell_attr.kattr.attr,
 #ifdef CONFIG_X86
 	&vmexits_pio_cell_attr.kattr.attr,
+	&vmexits_pio_latency_cell_attr.kattr.attr,
 	&vmexits_xapic_cell_attr.kattr.attr,
+	&vmexits_xapic_latency_cell_attr.kattr.attr,
 	&vmexits_cr_cell_attr.kattr.attr,
+	&vmexits_cr_latency_cell_attr.kattr.attr,
 	&vmexits_cpuid_cell_attr.kattr.attr,
+	&vmexits_cpuid_latency_cell_attr.kattr.attr,
 	&vmexits_xsetbv_cell_attr.kattr.attr,
+	&vmexits_xsetbv_latency_cell_attr.kattr.attr,
 	&vmexits_exception_cell_attr.kattr.attr,
+	&vmexits_exception_latency_cell_attr.kattr.attr,
 	&vmexits_msr_other_cell_attr.kattr.attr,
+	&vmexits_msr_other_latency_cell_attr.kattr.attr,
 	&vmexits_msr_x2apic_icr_cell_attr.kattr.attr,
+	&vmexits_msr_x2apic_icr_latency_cell_attr.kattr.attr,
+	&qos_l3_occupancy_kb_cell_attr.kattr.attr,
+	&qos_mem_bw_total_kb_cell_attr.kattr.attr,
+	&qos_mem_bw_local_kb_cell_attr.kattr.attr,
 #elif defined(CONFIG_ARM) || defined(CONFIG_ARM64)
 	&vmexits_maintenance_cell_attr.kattr.attr,
+	&vmexits_maintenance_latency_cell_attr.kattr.attr,
 	&vmexits_virt_irq_cell_attr.kattr.attr,
+	&vmexits_virt_irq_latency_cell_attr.kattr.attr,
 	&vmexits_virt_sgi_cell_attr.kattr.attr,
+	&vmexits_virt_sgi_latency_cell_attr.kattr.attr,
 	&vmexits_psci_cell_attr.kattr.attr,
+	&vmexits_psci_latency_cell_attr.kattr.attr,
 	&vmexits_smccc_cell_attr.kattr.attr,
+	&vmexits_smccc_latency_cell_attr.kattr.attr,
 #ifdef CONFIG_ARM
 	&vmexits_cp15_cell_attr.kattr.attr,
+	&vmexits_cp15_latency_cell_attr.kattr.attr,
 #endif
 #endif
 	NULL
@@ -188,26 +420,55 @@ static struct kobj_type cell_stats_type = {
 
 static struct attribute *cpu_stats_attrs[] = {
 	&vmexits_total_cpu_attr.kattr.attr,
+	&vmexits_total_latency_cpu_attr.kattr.attr,
 	&vmexits_mmio_cpu_attr.kattr.attr,
+	&vmexits_mmio_latency_cpu_attr.kattr.attr,
 	&vmexits_management_cpu_attr.kattr.attr,
+	&vmexits_management_latency_cpu_attr.kattr.attr,
 	&vmexits_hypercall_cpu_attr.kattr.attr,
+	&vmexits_hypercall_latency_cpu_attr.kattr.attr,
+	&mmio_cache_hits_cpu_attr.kattr.attr,
+	&mmio_cache_misses_cpu_attr.kattr.attr,
+	&irqs_injected_cpu_attr.kattr.attr,
+	&ipis_sent_cpu_attr.kattr.attr,
+	&ipis_received_cpu_attr.kattr.attr,
+	&pending_overflows_cpu_attr.kattr.attr,
+	&max_exit_ticks_cpu_attr.kattr.attr,
+	&stack_max_usage_cpu_attr.kattr.attr,
+	&pmu_kcycles_cpu_attr.kattr.attr,
+	&pmu_kinstructions_cpu_attr.kattr.attr,
+	&pmu_llc_misses_cpu_attr.kattr.attr,
 #ifdef CONFIG_X86
 	&vmexits_pio_cpu_attr.kattr.attr,
+	&vmexits_pio_latency_cpu_attr.kattr.attr,
 	&vmexits_xapic_cpu_attr.kattr.attr,
+	&vmexits_xapic_latency_cpu_attr.kattr.attr,
 	&vmexits_cr_cpu_attr.kattr.attr,
+	&vmexits_cr_latency_cpu_attr.kattr.attr,
 	&vmexits_cpuid_cpu_attr.kattr.attr,
+	&vmexits_cpuid_latency_cpu_attr.kattr.attr,
 	&vmexits_xsetbv_cpu_attr.kattr.attr,
+	&vmexits_xsetbv_latency_cpu_attr.kattr.attr,
 	&vmexits_exception_cpu_attr.kattr.attr,
+	&vmexits_exception_latency_cpu_attr.kattr.attr,
 	&vmexits_msr_other_cpu_attr.kattr.attr,
+	&vmexits_msr_other_latency_cpu_attr.kattr.attr,
 	&vmexits_msr_x2apic_icr_cpu_attr.kattr.attr,
+	&vmexits_msr_x2apic_icr_latency_cpu_attr.kattr.attr,
 #elif defined(CONFIG_ARM) || defined(CONFIG_ARM64)
 	&vmexits_maintenance_cpu_attr.kattr.attr,
+	&vmexits_maintenance_latency_cpu_attr.kattr.attr,
 	&vmexits_virt_irq_cpu_attr.kattr.attr,
+	&vmexits_virt_irq_latency_cpu_attr.kattr.attr,
 	&vmexits_virt_sgi_cpu_attr.kattr.attr,
+	&vmexits_virt_sgi_latency_cpu_attr.kattr.attr,
 	&vmexits_psci_cpu_attr.kattr.attr,
+	&vmexits_psci_latency_cpu_attr.kattr.attr,
 	&vmexits_smccc_cpu_attr.kattr.attr,
+	&vmexits_smccc_latency_cpu_attr.kattr.attr,
 #ifdef CONFIG_ARM
 	&vmexits_cp15_cpu_attr.kattr.attr,
+	&vmexits_cp15_latency_cpu_attr.kattr.attr,
 #endif
 #endif
 	NULL
@@ -218,6 +479,172 @@ static struct kobj_type cell_cpu_type = {
 	.default_attrs = cpu_stats_attrs,
 };
 
+static ssize_t raw_fields_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buffer)
+{
+	struct jailhouse_cpu_stats_attr *stats_attr;
+	unsigned int offset, size, divisor, count, n;
+	struct attribute **cpu_attr;
+	ssize_t written = 0;
+
+	for (cpu_attr = cpu_stats_attrs; *cpu_attr; cpu_attr++) {
+		stats_attr = container_of(*cpu_attr,
+					  struct jailhouse_cpu_stats_attr,
+					  kattr.attr);
+		count = 1;
+		if (stats_attr->kattr.show == cpu_latency_show) {
+			offset = offsetof(struct jailhouse_cpu_stats,
+					  exit_latency[stats_attr->code]);
+			size = sizeof(__u32);
+			divisor = 1;
+			count = JAILHOUSE_EXIT_LATENCY_BUCKETS;
+		} else if (stats_attr->kattr.show != cpu_stats_show) {
+			continue;
+		} else if (stats_attr->code >= JAILHOUSE_CPU_INFO_PMU_BASE) {
+			n = stats_attr->code - JAILHOUSE_CPU_INFO_PMU_BASE;
+			offset = offsetof(struct jailhouse_cpu_stats,
+					  pmu_stats[n]);
+			size = sizeof(__u64);
+			/* raw events, the counter entries are scaled */
+			divisor = n == JAILHOUSE_PMU_LLC_MISSES ? 1 : 1000;
+		} else {
+			n = stats_attr->code - JAILHOUSE_CPU_INFO_STAT_BASE;
+			offset = offsetof(struct jailhouse_cpu_stats, stats[n]);
+			size = sizeof(__u64);
+			divisor = 1;
+		}
+		written += scnprintf(buffer + written, PAGE_SIZE - written,
+				     "%s %u %u %u %u\n", (*cpu_attr)->name,
+				     offset, size, divisor, count);
+	}
+
+	return written;
+}
+
+static struct kobj_attribute cell_stats_raw_fields_attr =
+	__ATTR_RO(raw_fields);
+
+/* One line per MMIO region: start, size, handler name and accesses. */
+static ssize_t mmio_regions_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buffer)
+{
+	struct cell *cell = container_of(kobj, struct cell, stats_kobj);
+	struct jailhouse_mmio_region_stats *region;
+	struct jailhouse_mmio_stats *stats;
+	ssize_t written = 0;
+	unsigned int n;
+	long total;
+
+	/* the hypervisor fills at most one page per call */
+	stats = (void *)__get_free_page(GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+
+	stats->first = 0;
+	do {
+		total = jailhouse_call_arg2(JAILHOUSE_HC_CELL_GET_MMIO_STATS,
+					    cell->id, __pa(stats));
+		if (total < 0) {
+			written = total;
+			break;
+		}
+		for (n = 0; n < stats->num_regions; n++) {
+			region = &stats->regions[n];
+			written += scnprintf(buffer + written,
+					     PAGE_SIZE - written,
+					     "0x%016llx 0x%llx %s %llu\n",
+					     region->start, region->size,
+					     region->name, region->accesses);
+		}
+		stats->first += stats->num_regions;
+	} while (stats->num_regions > 0 && stats->first < total);
+
+	free_page((unsigned long)stats);
+
+	return written;
+}
+
+static struct kobj_attribute cell_stats_mmio_regions_attr =
+	__ATTR_RO(mmio_regions);
+
+/*
+ * One struct jailhouse_cpu_stats per CPU of the cell, in ascending CPU order.
+ * Read from the statistics pages the hypervisor shares with the root cell.
+ */
+static ssize_t cell_stats_raw_read(struct file *filp, struct kobject *kobj,
+				   struct bin_attribute *attr, char *buffer,
+				   loff_t off, size_t count)
+{
+	struct cell *cell = container_of(kobj, struct cell, stats_kobj);
+	const size_t size = sizeof(struct jailhouse_cpu_stats);
+	size_t skip, chunk, copied = 0;
+	unsigned int cpu, n = 0;
+	loff_t pos;
+
+	for_each_cpu(cpu, &cell->cpus_assigned) {
+		pos = (loff_t)n++ * size;
+		if (pos + size <= off)
+			continue;
+		if (pos >= off + count)
+			break;
+
+		skip = off > pos ? off - pos : 0;
+		chunk = min(size - skip, count - copied);
+		memcpy(buffer + copied,
+		       (void *)jailhouse_cpu_stats(cpu, NULL) + skip, chunk);
+		copied += chunk;
+	}
+
+	return copied;
+}
+
+static struct bin_attribute cell_stats_raw_attr =
+	__BIN_ATTR(raw, S_IRUGO, cell_stats_raw_read, NULL, 0);
+
+static ssize_t cpu_stats_raw_read(struct file *filp, struct kobject *kobj,
+				  struct bin_attribute *attr, char *buffer,
+				  loff_t off, size_t count)
+{
+	struct cell_cpu *cell_cpu = container_of(kobj, struct cell_cpu, kobj);
+
+	/* sysfs limits the request to the attribute size */
+	memcpy(buffer, (void *)jailhouse_cpu_stats(cell_cpu->cpu, NULL) + off,
+	       count);
+
+	return count;
+}
+
+/* Maps the statistics page of the CPU read-only into the caller. */
+static int cpu_stats_raw_mmap(struct file *filp, struct kobject *kobj,
+			      struct bin_attribute *attr,
+			      struct vm_area_struct *vma)
+{
+	struct cell_cpu *cell_cpu = container_of(kobj, struct cell_cpu, kobj);
+	phys_addr_t phys;
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,3,0)
+	vma->vm_flags &= ~VM_MAYWRITE;
+#else
+	vm_flags_clear(vma, VM_MAYWRITE);
+#endif
+
+	jailhouse_cpu_stats(cell_cpu->cpu, &phys);
+
+	return remap_pfn_range(vma, vma->vm_start, phys >> PAGE_SHIFT,
+			       PAGE_SIZE, vma->vm_page_prot);
+}
+
+static struct bin_attribute cpu_stats_raw_attr = {
+	.attr = { .name = "raw", .mode = S_IRUGO },
+	.size = sizeof(struct jailhouse_cpu_stats),
+	.read = cpu_stats_raw_read,
+	.mmap = cpu_stats_raw_mmap,
+};
+
 static int print_cpumask(char *buf, size_t size, cpumask_t *mask, bool as_list)
 {
 	int written;
@@ -274,8 +701,14 @@ static ssize_t state_show(struct kobject *kobj, struct kobj_attribute *attr,
 			  char *buffer)
 {
 	struct cell *cell = container_of(kobj, struct cell, kobj);
+	int state = jailhouse_cell_state(cell->id);
+
+	/* fall back to the hypercall for cells missing in the status page */
+	if (state == -ENOENT)
+		state = jailhouse_call_arg1(JAILHOUSE_HC_CELL_GET_STATE,
+					    cell->id);
 
-	switch (jailhouse_call_arg1(JAILHOUSE_HC_CELL_GET_STATE, cell->id)) {
+	switch (state) {
 	case JAILHOUSE_CELL_RUNNING:
 		return sprintf(buffer, "running\n");
 	case JAILHOUSE_CELL_RUNNING_LOCKED:
@@ -323,6 +756,53 @@ static ssize_t cpus_failed_list_show(struct kobject *kobj,
 	return print_failed_cpus(buf, PAGE_SIZE, cell, true);
 }
 
+static ssize_t balloon_pending_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+	int pending = jailhouse_cell_balloon_pending(cell->id);
+
+	if (pending < 0)
+		return pending;
+	return sprintf(buf, "%d\n", pending);
+}
+
+static ssize_t watchdog_timeout_us_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+
+	return sprintf(buf, "%lu\n", cell->watchdog_timeout_us);
+}
+
+static ssize_t watchdog_timeout_us_store(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 const char *buf, size_t count)
+{
+	struct cell *cell = container_of(kobj, struct cell, kobj);
+	unsigned long timeout;
+	int err;
+
+	err = kstrtoul(buf, 0, &timeout);
+	if (err)
+		return err;
+	if (timeout > U32_MAX)
+		return -ERANGE;
+
+	/* cell destruction removes this attribute while holding the lock */
+	if (!mutex_trylock(&jailhouse_lock))
+		return restart_syscall();
+
+	err = jailhouse_call_arg2(JAILHOUSE_HC_CELL_WATCHDOG_SET, cell->id,
+				  timeout);
+	if (err == 0)
+		cell->watchdog_timeout_us = timeout;
+
+	mutex_unlock(&jailhouse_lock);
+
+	return err ? err : count;
+}
+
 static struct kobj_attribute cell_name_attr = __ATTR_RO(name);
 static struct kobj_attribute cell_state_attr = __ATTR_RO(state);
 static struct kobj_attribute cell_cpus_assigned_attr =
@@ -332,6 +812,11 @@ static struct kobj_attribute cell_cpus_assigned_list_attr =
 static struct kobj_attribute cell_cpus_failed_attr = __ATTR_RO(cpus_failed);
 static struct kobj_attribute cell_cpus_failed_list_attr =
 	__ATTR_RO(cpus_failed_list);
+static struct kobj_attribute cell_balloon_pending_attr =
+	__ATTR_RO(balloon_pending);
+static struct kobj_attribute cell_watchdog_timeout_us_attr =
+	__ATTR(watchdog_timeout_us, S_IRUGO | S_IWUSR,
+	       watchdog_timeout_us_show, watchdog_timeout_us_store);
 
 static struct attribute *cell_attrs[] = {
 	&cell_name_attr.attr,
@@ -340,6 +825,8 @@ static struct attribute *cell_attrs[] = {
 	&cell_cpus_assigned_list_attr.attr,
 	&cell_cpus_failed_attr.attr,
 	&cell_cpus_failed_list_attr.attr,
+	&cell_balloon_pending_attr.attr,
+	&cell_watchdog_timeout_us_attr.attr,
 	NULL,
 };
 
@@ -353,7 +840,7 @@ static struct cell_cpu *find_cell_cpu(struct cell *cell, unsigned int cpu)
 {
 	struct cell_cpu *cell_cpu;
 
-	list_for_each_entry(cell_cpu, &root_cell->cell_cpus, entry)
+	list_for_each_entry(cell_cpu, &cell->cell_cpus, entry)
 		if (cell_cpu->cpu == cpu)
 			return cell_cpu;
 
@@ -381,6 +868,20 @@ int jailhouse_sysfs_cell_create(struct cell *cell)
 		return err;
 	}
 
+	err = sysfs_create_file(&cell->stats_kobj,
+				&cell_stats_raw_fields_attr.attr);
+	if (!err)
+		err = sysfs_create_file(&cell->stats_kobj,
+					&cell_stats_mmio_regions_attr.attr);
+	if (!err)
+		err = sysfs_create_bin_file(&cell->stats_kobj,
+					    &cell_stats_raw_attr);
+	if (err) {
+		kobject_put(&cell->stats_kobj);
+		kobject_put(&cell->kobj);
+		return err;
+	}
+
 	INIT_LIST_HEAD(&cell->cell_cpus);
 
 	for_each_cpu(cpu, &cell->cpus_assigned) {
@@ -404,6 +905,13 @@ int jailhouse_sysfs_cell_create(struct cell *cell)
 				return err;
 			}
 			list_add_tail(&cell_cpu->entry, &cell->cell_cpus);
+
+			err = sysfs_create_bin_file(&cell_cpu->kobj,
+						    &cpu_stats_raw_attr);
+			if (err) {
+				jailhouse_sysfs_cell_delete(cell);
+				return err;
+			}
 		} else {
 			cell_cpu = find_cell_cpu(root_cell, cpu);
 			if (WARN_ON(cell_cpu == NULL))
@@ -454,6 +962,21 @@ void jailhouse_sysfs_cell_delete(struct cell *cell)
 	kobject_put(&cell->kobj);
 }
 
+void jailhouse_sysfs_cpu_move(unsigned int cpu, struct cell *from,
+			      struct cell *to)
+{
+	struct cell_cpu *cell_cpu = find_cell_cpu(from, cpu);
+
+	if (WARN_ON(cell_cpu == NULL))
+		return;
+
+	if (WARN_ON(kobject_move(&cell_cpu->kobj, &to->stats_kobj)))
+		return;
+
+	list_del(&cell_cpu->entry);
+	list_add_tail(&cell_cpu->entry, &to->cell_cpus);
+}
+
 static ssize_t console_show(struct device *dev, struct device_attribute *attr,
 			    char *buffer)
 {
@@ -510,6 +1033,20 @@ static ssize_t mem_pool_used_show(struct device *dev,
 	return info_show(dev, buffer, JAILHOUSE_INFO_MEM_POOL_USED);
 }
 
+static ssize_t mem_pool_free_extents_show(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buffer)
+{
+	return info_show(dev, buffer, JAILHOUSE_INFO_MEM_POOL_FREE_EXTENTS);
+}
+
+static ssize_t mem_pool_largest_free_show(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buffer)
+{
+	return info_show(dev, buffer, JAILHOUSE_INFO_MEM_POOL_LARGEST_FREE);
+}
+
 static ssize_t remap_pool_size_show(struct device *dev,
 				    struct device_attribute *attr,
 				    char *buffer)
@@ -524,28 +1061,195 @@ static ssize_t remap_pool_used_show(struct device *dev,
 	return info_show(dev, buffer, JAILHOUSE_INFO_REMAP_POOL_USED);
 }
 
+static ssize_t remap_pool_free_extents_show(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buffer)
+{
+	return info_show(dev, buffer, JAILHOUSE_INFO_REMAP_POOL_FREE_EXTENTS);
+}
+
+static ssize_t remap_pool_largest_free_show(struct device *dev,
+					    struct device_attribute *attr,
+					    char *buffer)
+{
+	return info_show(dev, buffer, JAILHOUSE_INFO_REMAP_POOL_LARGEST_FREE);
+}
+
+static ssize_t root_suspend_last_show(struct device *dev,
+				      struct device_attribute *attr,
+				      char *buffer)
+{
+	return info_show(dev, buffer, JAILHOUSE_INFO_ROOT_SUSPEND_LAST);
+}
+
+static ssize_t root_suspend_max_show(struct device *dev,
+				     struct device_attribute *attr,
+				     char *buffer)
+{
+	return info_show(dev, buffer, JAILHOUSE_INFO_ROOT_SUSPEND_MAX);
+}
+
+static ssize_t timebase_show(struct device *dev, struct device_attribute *attr,
+			     char *buffer)
+{
+	ssize_t len = 0;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	if (jailhouse_enabled)
+		len = jailhouse_timebase_show(buffer);
+
+	mutex_unlock(&jailhouse_lock);
+	return len;
+}
+
+static ssize_t setup_times_show(struct device *dev,
+				struct device_attribute *attr, char *buffer)
+{
+	static const char *const driver_phases[JAILHOUSE_ENABLE_PHASES] = {
+		"driver-load", "driver-prepare", "driver-enter",
+	};
+	static const char *const hv_phases[JAILHOUSE_NUM_SETUP_PHASES] = {
+		[JAILHOUSE_SETUP_EARLY] = "early",
+		[JAILHOUSE_SETUP_CPUS] = "cpus",
+		[JAILHOUSE_SETUP_UNITS] = "units",
+		[JAILHOUSE_SETUP_MEMORY] = "memory",
+		[JAILHOUSE_SETUP_COMMIT] = "commit",
+	};
+	unsigned int n, cpu;
+	ssize_t len = 0;
+	long val;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	if (!jailhouse_enabled)
+		goto unlock;
+
+	for (n = 0; n < JAILHOUSE_ENABLE_PHASES; n++)
+		len += scnprintf(buffer + len, PAGE_SIZE - len, "%s %llu ns\n",
+				 driver_phases[n], jailhouse_enable_ns[n]);
+
+	for (n = 0; n < JAILHOUSE_NUM_SETUP_PHASES; n++) {
+		val = jailhouse_call_arg1(JAILHOUSE_HC_HYPERVISOR_GET_INFO,
+					  JAILHOUSE_INFO_SETUP_TIME_BASE + n);
+		if (val < 0)
+			break;
+		len += scnprintf(buffer + len, PAGE_SIZE - len,
+				 "%s %ld ticks\n", hv_phases[n], val);
+	}
+
+	for (n = 0; ; n++) {
+		val = jailhouse_call_arg1(JAILHOUSE_HC_HYPERVISOR_GET_INFO,
+				JAILHOUSE_INFO_UNIT_SETUP_TIME_BASE + n);
+		if (val < 0)
+			break;
+		len += scnprintf(buffer + len, PAGE_SIZE - len,
+				 "unit%u %ld ticks\n", n, val);
+	}
+
+	for_each_possible_cpu(cpu) {
+		val = jailhouse_call_arg2(JAILHOUSE_HC_CPU_GET_INFO, cpu,
+					  JAILHOUSE_CPU_INFO_SETUP_TIME);
+		/* skip CPUs that were not online during setup */
+		if (val <= 0)
+			continue;
+		len += scnprintf(buffer + len, PAGE_SIZE - len,
+				 "cpu%u %ld ticks\n", cpu, val);
+	}
+
+unlock:
+	mutex_unlock(&jailhouse_lock);
+	return len;
+}
+
+/*
+ * The hypervisor memory is inaccessible while the hypervisor runs. Coverage
+ * builds then hand out page-wise snapshots via JAILHOUSE_HC_GCOV_READ.
+ */
+static ssize_t core_read_live(char *buf, loff_t off, size_t count, size_t size)
+{
+	size_t offs, chunk, copied = 0;
+	void *page;
+	long err = 0;
+
+	if (off >= size)
+		return 0;
+	count = min_t(size_t, count, size - off);
+
+	page = (void *)__get_free_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	while (copied < count) {
+		err = jailhouse_call_arg2(JAILHOUSE_HC_GCOV_READ,
+					  (off + copied) & PAGE_MASK,
+					  __pa(page));
+		if (err < 0)
+			break;
+
+		offs = (off + copied) & ~PAGE_MASK;
+		chunk = min_t(size_t, count - copied, PAGE_SIZE - offs);
+		memcpy(buf + copied, page + offs, chunk);
+		copied += chunk;
+	}
+
+	free_page((unsigned long)page);
+
+	return copied > 0 ? copied : err;
+}
+
 static ssize_t core_show(struct file *filp, struct kobject *kobj,
 			 struct bin_attribute *attr, char *buf, loff_t off,
 			 size_t count)
 {
-	return memory_read_from_buffer(buf, count, &off, hypervisor_mem,
-				       attr->size);
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&jailhouse_lock) != 0)
+		return -EINTR;
+
+	if (jailhouse_enabled)
+		ret = core_read_live(buf, off, count, attr->size);
+	else
+		ret = memory_read_from_buffer(buf, count, &off,
+					      hypervisor_mem, attr->size);
+
+	mutex_unlock(&jailhouse_lock);
+
+	return ret;
 }
 
 static DEVICE_ATTR_RO(console);
 static DEVICE_ATTR_RO(enabled);
 static DEVICE_ATTR_RO(mem_pool_size);
 static DEVICE_ATTR_RO(mem_pool_used);
+static DEVICE_ATTR_RO(mem_pool_free_extents);
+static DEVICE_ATTR_RO(mem_pool_largest_free);
 static DEVICE_ATTR_RO(remap_pool_size);
 static DEVICE_ATTR_RO(remap_pool_used);
+static DEVICE_ATTR_RO(remap_pool_free_extents);
+static DEVICE_ATTR_RO(remap_pool_largest_free);
+static DEVICE_ATTR_RO(root_suspend_last);
+static DEVICE_ATTR_RO(root_suspend_max);
+static DEVICE_ATTR_RO(setup_times);
+static DEVICE_ATTR_RO(timebase);
 
 static struct attribute *jailhouse_sysfs_entries[] = {
 	&dev_attr_console.attr,
 	&dev_attr_enabled.attr,
 	&dev_attr_mem_pool_size.attr,
 	&dev_attr_mem_pool_used.attr,
+	&dev_attr_mem_pool_free_extents.attr,
+	&dev_attr_mem_pool_largest_free.attr,
 	&dev_attr_remap_pool_size.attr,
 	&dev_attr_remap_pool_used.attr,
+	&dev_attr_remap_pool_free_extents.attr,
+	&dev_attr_remap_pool_largest_free.attr,
+	&dev_attr_root_suspend_last.attr,
+	&dev_attr_root_suspend_max.attr,
+	&dev_attr_setup_times.attr,
+	&dev_attr_timebase.attr,
 	NULL
 };
 
@@ -18,6 +18,8 @@
 int jailhouse_sysfs_cell_create(struct cell *cell);
 void jailhouse_sysfs_cell_register(struct cell *cell);
 void jailhouse_sysfs_cell_delete(struct cell *cell);
+void jailhouse_sysfs_cpu_move(unsigned int cpu, struct cell *from,
+			      struct cell *to);
 
 int jailhouse_sysfs_core_init(struct device *dev, size_t hypervisor_size);
 void jailhouse_sysfs_core_exit(struct device *dev);
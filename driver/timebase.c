@@ -0,0 +1,167 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Publishes the wall clock of the root cell as shared timebase so that other
+ * cells can derive synchronized time from their CPU counter. The root cell's
+ * clock is disciplined by NTP or PTP, the counter rate used for the
+ * conversion follows that discipline over the last update interval.
+ */
+
+#include <linux/clocksource.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/workqueue.h>
+
+#ifdef CONFIG_X86
+#include <asm/tsc.h>
+#else
+#include <asm/arch_timer.h>
+#endif
+
+#include "main.h"
+
+#include <jailhouse/hypercall.h>
+
+#define TIMEBASE_UPDATE_INTERVAL	HZ
+/* maximum counter interval that can be converted without overflow */
+#define TIMEBASE_MAX_SECONDS		10
+/* accepted deviation of the measured from the nominal rate, in ppm */
+#define TIMEBASE_MAX_PPM		1000
+
+static struct jailhouse_timebase *timebase;
+/* protects the published values against concurrent readers via sysfs */
+static DEFINE_SPINLOCK(timebase_lock);
+static u32 nominal_mult;
+static u64 last_cycles, last_ns;
+
+static void timebase_update_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(timebase_work, timebase_update_fn);
+
+static u64 timebase_read_counter(void)
+{
+#ifdef CONFIG_X86
+	return rdtsc_ordered();
+#else
+	/* the inmate library reads the physical counter as well */
+	isb();
+	return __arch_counter_get_cntpct();
+#endif
+}
+
+static u64 timebase_counter_rate(void)
+{
+#ifdef CONFIG_X86
+	return (u64)tsc_khz * 1000;
+#else
+	return arch_timer_get_rate();
+#endif
+}
+
+static void timebase_update_fn(struct work_struct *work)
+{
+	unsigned long flags;
+	u64 cycles, ns, mult;
+	int err;
+
+	local_irq_save(flags);
+	cycles = timebase_read_counter();
+	ns = ktime_get_real_ns();
+	local_irq_restore(flags);
+
+	/*
+	 * Derive the rate from the last interval so that frequency corrections
+	 * of the root cell's clock are passed on. Steps of the clock or
+	 * interrupted updates fall back to the nominal rate.
+	 */
+	mult = nominal_mult;
+	if (last_cycles != 0 && cycles > last_cycles && ns > last_ns &&
+	    ns - last_ns < TIMEBASE_MAX_SECONDS * NSEC_PER_SEC) {
+		mult = div64_u64((ns - last_ns) << timebase->shift,
+				 cycles - last_cycles);
+		if (abs((s64)(mult - nominal_mult)) >
+		    div_u64((u64)nominal_mult * TIMEBASE_MAX_PPM, 1000000))
+			mult = nominal_mult;
+	}
+	last_cycles = cycles;
+	last_ns = ns;
+
+	spin_lock(&timebase_lock);
+	timebase->mult = mult;
+	timebase->cycle_last = cycles;
+	timebase->base_ns = ns;
+	spin_unlock(&timebase_lock);
+
+	err = jailhouse_call_arg1(JAILHOUSE_HC_TIMEBASE_UPDATE,
+				  __pa(timebase));
+	if (err) {
+		pr_warn("jailhouse: timebase update failed (%d)\n", err);
+		return;
+	}
+
+	schedule_delayed_work(&timebase_work, TIMEBASE_UPDATE_INTERVAL);
+}
+
+/**
+ * Start publishing the timebase. Must be called with jailhouse_lock held
+ * after the hypervisor was enabled.
+ */
+void jailhouse_timebase_start(void)
+{
+	u64 rate = timebase_counter_rate();
+	u32 mult, shift;
+
+	if (rate == 0 || rate > U32_MAX)
+		return;
+
+	timebase = kzalloc(sizeof(*timebase), GFP_KERNEL);
+	if (!timebase)
+		return;
+
+	clocks_calc_mult_shift(&mult, &shift, rate, NSEC_PER_SEC,
+			       TIMEBASE_MAX_SECONDS);
+	nominal_mult = mult;
+	timebase->shift = shift;
+	last_cycles = 0;
+
+	schedule_delayed_work(&timebase_work, 0);
+}
+
+/**
+ * Print the timebase as "cycle_last base_ns mult shift", nothing if none was
+ * published yet. Must be called with jailhouse_lock held.
+ */
+ssize_t jailhouse_timebase_show(char *buffer)
+{
+	ssize_t len = 0;
+
+	if (!timebase)
+		return 0;
+
+	spin_lock(&timebase_lock);
+	if (timebase->base_ns)
+		len = sprintf(buffer, "%llu %llu %u %u\n", timebase->cycle_last,
+			      timebase->base_ns, timebase->mult,
+			      timebase->shift);
+	spin_unlock(&timebase_lock);
+
+	return len;
+}
+
+/**
+ * Stop publishing the timebase before the hypervisor is disabled. Must be
+ * called with jailhouse_lock held.
+ */
+void jailhouse_timebase_stop(void)
+{
+	if (!timebase)
+		return;
+
+	cancel_delayed_work_sync(&timebase_work);
+	kfree(timebase);
+	timebase = NULL;
+}
@@ -0,0 +1,158 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Last-level cache coloring. Physical memory is split into chunks that map to
+ * the same sets of the last-level cache, the color of a chunk repeats every
+ * cache way. A JAILHOUSE_MEM_COLORED region is backed only by the chunks of
+ * its colors within [phys_start, phys_start + size). Non-root cells see these
+ * chunks packed from virt_start on, the root cell keeps its 1:1 view and just
+ * loses or regains the selected colors of the range.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/unit.h>
+#include <asm/coloring.h>
+#include <asm/sysregs.h>
+
+#define CLIDR_CTYPE(clidr, level)	(((clidr) >> (((level) - 1) * 3)) & 0x7)
+#define  CLIDR_CTYPE_NONE		0
+#define  CLIDR_CTYPE_DATA		2
+#define CLIDR_MAX_LEVELS		7
+
+/* 32-bit CCSIDR format, FEAT_CCIDX is not supported */
+#define CCSIDR_LINE_SIZE(ccsidr)	(1UL << (((ccsidr) & 0x7) + 4))
+#define CCSIDR_NUM_SETS(ccsidr)		((((ccsidr) >> 13) & 0x7fff) + 1)
+
+#define COLORED_REGION_INVALID_FLAGS	(JAILHOUSE_MEM_IO | \
+					 JAILHOUSE_MEM_COMM_REGION | \
+					 JAILHOUSE_MEM_LOADABLE)
+
+/* bytes per color chunk, a power of two and at least PAGE_SIZE */
+static unsigned long color_size;
+static unsigned int num_colors;
+
+static u32 region_colors(const struct jailhouse_memory *mem)
+{
+	return mem->flags >> JAILHOUSE_MEM_COLORS_SHIFT;
+}
+
+static bool color_selected(u32 colors, unsigned long phys)
+{
+	return colors & (1U << ((phys / color_size) % num_colors));
+}
+
+/**
+ * Find the next physically contiguous run of a colored region.
+ * @param mem		Colored memory region.
+ * @param offset	Offset into the region to start the search at, replaced
+ * 			by the offset of the found run.
+ * @param size		Size of the found run.
+ *
+ * @return True if a run was found, false if the end of the region was reached.
+ */
+bool coloring_next_run(const struct jailhouse_memory *mem,
+		       unsigned long *offset, unsigned long *size)
+{
+	u32 colors = region_colors(mem);
+	unsigned long end = mem->phys_start + mem->size;
+	unsigned long phys = mem->phys_start + *offset;
+	unsigned long start;
+
+	while (phys < end && !color_selected(colors, phys))
+		phys = (phys & ~(color_size - 1)) + color_size;
+	if (phys >= end)
+		return false;
+
+	start = phys;
+	while (phys < end && color_selected(colors, phys))
+		phys = (phys & ~(color_size - 1)) + color_size;
+
+	*offset = start - mem->phys_start;
+	*size = MIN(phys, end) - start;
+	return true;
+}
+
+static bool colored_regions_overlap(const struct jailhouse_memory *mem1,
+				    const struct jailhouse_memory *mem2)
+{
+	return (region_colors(mem1) & region_colors(mem2)) &&
+		mem1->phys_start < mem2->phys_start + mem2->size &&
+		mem2->phys_start < mem1->phys_start + mem1->size;
+}
+
+static int coloring_cell_init(struct cell *cell)
+{
+	const struct jailhouse_memory *mem, *other_mem;
+	unsigned int n, m;
+	struct cell *other;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!(mem->flags & JAILHOUSE_MEM_COLORED))
+			continue;
+
+		if (num_colors == 0 ||
+		    mem->flags & COLORED_REGION_INVALID_FLAGS ||
+		    JAILHOUSE_MEMORY_IS_SUBPAGE(mem) ||
+		    region_colors(mem) == 0 ||
+		    (num_colors < JAILHOUSE_MAX_COLORS &&
+		     region_colors(mem) >> num_colors))
+			return trace_error(-EINVAL);
+
+		/* A color of a memory range can only have one owner. */
+		for_each_non_root_cell(other)
+			for_each_mem_region(other_mem, other->config, m)
+				if (other_mem->flags & JAILHOUSE_MEM_COLORED &&
+				    colored_regions_overlap(mem, other_mem))
+					return trace_error(-EBUSY);
+	}
+
+	return 0;
+}
+
+static void coloring_cell_exit(struct cell *cell)
+{
+}
+
+static int coloring_init(void)
+{
+	unsigned long clidr, csselr, ccsidr, way_size;
+	unsigned int level, llc = 0;
+
+	arm_read_sysreg(CLIDR_EL1, clidr);
+	for (level = 1; level <= CLIDR_MAX_LEVELS; level++) {
+		if (CLIDR_CTYPE(clidr, level) == CLIDR_CTYPE_NONE)
+			break;
+		if (CLIDR_CTYPE(clidr, level) >= CLIDR_CTYPE_DATA)
+			llc = level;
+	}
+	if (llc == 0)
+		return coloring_cell_init(&root_cell);
+
+	/* CSSELR belongs to the root cell, restore it afterwards. */
+	arm_read_sysreg(CSSELR_EL1, csselr);
+	arm_write_sysreg(CSSELR_EL1, (llc - 1) << 1);
+	isb();
+	arm_read_sysreg(CCSIDR_EL1, ccsidr);
+	arm_write_sysreg(CSSELR_EL1, csselr);
+	isb();
+
+	way_size = CCSIDR_LINE_SIZE(ccsidr) * CCSIDR_NUM_SETS(ccsidr);
+	color_size = MAX(PAGE_SIZE, way_size / JAILHOUSE_MAX_COLORS);
+	if (way_size / color_size > 1) {
+		num_colors = way_size / color_size;
+		printk("Cache coloring: L%d with %d colors of %ld KiB\n", llc,
+		       num_colors, color_size / 1024);
+	}
+
+	return coloring_cell_init(&root_cell);
+}
+
+DEFINE_UNIT_SHUTDOWN_STUB(coloring);
+DEFINE_UNIT_MMIO_COUNT_REGIONS_STUB(coloring);
+DEFINE_UNIT(coloring, "Cache coloring");
@@ -15,7 +15,12 @@
 #include <jailhouse/control.h>
 #include <jailhouse/printk.h>
 #include <asm/control.h>
+#include <asm/iommu.h>
+#include <asm/irqchip.h>
 #include <asm/psci.h>
+#include <asm/smccc.h>
+#include <asm/sysregs.h>
+#include <asm/traps.h>
 
 static void enter_cpu_off(struct public_per_cpu *cpu_public)
 {
@@ -23,6 +28,45 @@ static void enter_cpu_off(struct public_per_cpu *cpu_public)
 	cpu_public->wait_for_poweron = true;
 }
 
+void arm_cpu_set_idle_policy(void)
+{
+	unsigned long hcr;
+
+	arm_read_sysreg(HCR_EL2, hcr);
+	if (CELL_FLAGS_IDLE_POLICY(this_cell()->config->flags) ==
+	    JAILHOUSE_CELL_IDLE_PASSTHROUGH)
+		hcr &= ~HCR_TWI_BIT;
+	else
+		hcr |= HCR_TWI_BIT;
+	arm_write_sysreg(HCR_EL2, hcr);
+}
+
+/*
+ * Wait for an interrupt on behalf of the cell. Wake-ups that only concern the
+ * hypervisor, e.g. maintenance interrupts, are absorbed so that the cell is
+ * resumed only when a virtual interrupt is pending or an event arrived.
+ */
+void arm_cpu_idle(void)
+{
+	while (!irqchip_has_pending_irqs()) {
+		/* pending physical IRQs end WFI although they are masked */
+		asm volatile("wfi" : : : "memory");
+		if (irqchip_handle_irq())
+			break;
+	}
+}
+
+/* only trapped if the cell does not pass through WFI */
+enum trap_return arch_handle_wfi(struct trap_context *ctx)
+{
+	if (CELL_FLAGS_IDLE_POLICY(this_cell()->config->flags) ==
+	    JAILHOUSE_CELL_IDLE_TRAPPED)
+		arm_cpu_idle();
+
+	arch_skip_instruction(ctx);
+	return TRAP_HANDLED;
+}
+
 void arm_cpu_park(void)
 {
 	struct public_per_cpu *cpu_public = this_cpu_public();
@@ -46,6 +90,31 @@ void arm_cpu_kick(unsigned int cpu_id)
 	irqchip_send_sgi(&sgi);
 }
 
+void arch_queue_event(struct public_per_cpu *target_data)
+{
+	struct sgi *queued = &this_cpu_public()->queued_events;
+	unsigned int cpu_id = target_data->cpu_id;
+	u64 cluster = irqchip_get_cluster_target(cpu_id);
+
+	if (queued->targets && queued->cluster_id != cluster)
+		arch_flush_events();
+	queued->cluster_id = cluster;
+	queued->targets |= irqchip_get_cpu_target(cpu_id);
+}
+
+void arch_flush_events(void)
+{
+	struct sgi *queued = &this_cpu_public()->queued_events;
+
+	if (!queued->targets)
+		return;
+
+	queued->routing_mode = 0;
+	queued->id = SGI_EVENT;
+	irqchip_send_sgi(queued);
+	queued->targets = 0;
+}
+
 void arch_reset_cpu(unsigned int cpu_id)
 {
 	public_per_cpu(cpu_id)->reset = true;
@@ -60,7 +129,7 @@ void arch_park_cpu(unsigned int cpu_id)
 	resume_cpu(cpu_id);
 }
 
-static void check_events(struct public_per_cpu *cpu_public)
+static void __hot check_events(struct public_per_cpu *cpu_public)
 {
 	bool reset = false;
 
@@ -71,8 +140,11 @@ static void check_events(struct public_per_cpu *cpu_public)
 
 		spin_unlock(&cpu_public->control_lock);
 
-		while (cpu_public->suspend_cpu)
+		while (cpu_public->suspend_cpu) {
+			arm_cell_dcaches_flush_assist();
+			scrub_memory_assist();
 			cpu_relax();
+		}
 
 		spin_lock(&cpu_public->control_lock);
 	}
@@ -93,7 +165,9 @@ static void check_events(struct public_per_cpu *cpu_public)
 
 	if (cpu_public->flush_vcpu_caches) {
 		cpu_public->flush_vcpu_caches = false;
-		arm_paging_vcpu_flush_tlbs();
+		arm_paging_vcpu_flush_tlbs_range(
+				cpu_public->flush_vcpu_caches_start,
+				cpu_public->flush_vcpu_caches_end);
 	}
 
 	spin_unlock(&cpu_public->control_lock);
@@ -108,10 +182,12 @@ static void check_events(struct public_per_cpu *cpu_public)
 		arm_cpu_reset(cpu_public->cpu_on_entry);
 }
 
-void arch_handle_sgi(u32 irqn, unsigned int count_event)
+void __hot arch_handle_sgi(u32 irqn, unsigned int count_event)
 {
 	struct public_per_cpu *cpu_public = this_cpu_public();
 
+	cpu_public->stats[JAILHOUSE_CPU_STAT_IPIS_RECEIVED]++;
+
 	switch (irqn) {
 	case SGI_INJECT:
 		cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_VSGI] +=
@@ -132,7 +208,7 @@ void arch_handle_sgi(u32 irqn, unsigned int count_event)
  * Handle the maintenance interrupt, the rest is injected into the cell.
  * Return true when the IRQ has been handled by the hyp.
  */
-bool arch_handle_phys_irq(u32 irqn, unsigned int count_event)
+bool __hot arch_handle_phys_irq(u32 irqn, unsigned int count_event)
 {
 	struct public_per_cpu *cpu_public = this_cpu_public();
 
@@ -152,6 +228,12 @@ bool arch_handle_phys_irq(u32 irqn, unsigned int count_event)
 
 int arch_cell_create(struct cell *cell)
 {
+	int err;
+
+	err = smccc_cell_init(cell);
+	if (err)
+		return err;
+
 	return arm_paging_cell_init(cell);
 }
 
@@ -194,21 +276,84 @@ void arch_cell_destroy(struct cell *cell)
 	arm_paging_cell_destroy(cell);
 }
 
+void arch_cell_cpu_move(unsigned int cpu_id, struct cell *from,
+			struct cell *to)
+{
+	/* the CPU stays off until the new cell issues CPU_ON */
+	public_per_cpu(cpu_id)->cpu_on_entry = PSCI_INVALID_ADDRESS;
+
+	irqchip_cpu_move(cpu_id, from, to);
+}
+
 /* Note: only supports synchronous flushing as triggered by config_commit! */
-void arch_flush_cell_vcpu_caches(struct cell *cell)
+void arch_flush_cell_vcpu_caches(struct cell *cell, unsigned long start,
+				 unsigned long size)
 {
+	unsigned long end = start + size;
+	struct public_per_cpu *cpu_public;
 	unsigned int cpu;
 
-	for_each_cpu(cpu, cell->cpu_set)
-		if (cpu == this_cpu_id())
-			arm_paging_vcpu_flush_tlbs();
-		else
-			public_per_cpu(cpu)->flush_vcpu_caches = true;
+	if (size == 0)
+		return;
+	if (end < start)
+		end = ~0UL;
+
+	if (arm_paging_cell_flush_tlbs_range(cell, start, end))
+		return;
+
+	for_each_cpu(cpu, cell->cpu_set) {
+		if (cpu == this_cpu_id()) {
+			arm_paging_vcpu_flush_tlbs_range(start, end);
+			continue;
+		}
+
+		cpu_public = public_per_cpu(cpu);
+		spin_lock(&cpu_public->control_lock);
+		if (!cpu_public->flush_vcpu_caches) {
+			cpu_public->flush_vcpu_caches_start = start;
+			cpu_public->flush_vcpu_caches_end = end;
+			cpu_public->flush_vcpu_caches = true;
+		} else {
+			if (start < cpu_public->flush_vcpu_caches_start)
+				cpu_public->flush_vcpu_caches_start = start;
+			if (end > cpu_public->flush_vcpu_caches_end)
+				cpu_public->flush_vcpu_caches_end = end;
+		}
+		spin_unlock(&cpu_public->control_lock);
+	}
 }
 
 void arch_config_commit(struct cell *cell_added_removed)
 {
 	irqchip_config_commit(cell_added_removed);
+	iommu_config_commit(cell_added_removed);
+}
+
+/*
+ * Physical interrupts of the root cell, e.g. its timer ticks, lead to exits
+ * that drive the watchdog checks.
+ */
+int arch_watchdog_timer_set(u64 deadline)
+{
+	return 0;
+}
+
+unsigned long arch_timestamp_khz(void)
+{
+	unsigned long freq;
+
+	arm_read_sysreg(CNTFRQ_EL0, freq);
+	return freq / 1000;
+}
+
+long arch_cell_get_qos_info(struct cell *cell, unsigned int event)
+{
+	return -EINVAL;
+}
+
+long arch_iommu_update_irtes(unsigned long desc_addr, unsigned long count)
+{
+	return -ENOSYS;
 }
 
 void __attribute__((noreturn)) arch_panic_stop(void)
@@ -15,8 +15,20 @@
 #include <jailhouse/control.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/uart.h>
+#include <asm/irqchip.h>
 #include <asm/uart.h>
 
+bool arch_console_notify_valid(unsigned long irq)
+{
+	/* only SPIs of the root cell, they are routed by the root cell */
+	return irq >= 32 && irq < 1020 && irqchip_irq_in_cell(&root_cell, irq);
+}
+
+void arch_console_notify(unsigned int cpu_id, unsigned int irq)
+{
+	irqchip_set_pending(NULL, irq);
+}
+
 void arch_dbg_write_init(void)
 {
 	unsigned char con_type = system_config->debug_console.type;
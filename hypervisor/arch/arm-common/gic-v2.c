@@ -30,9 +30,33 @@ static u32 gicv2_read_lr(unsigned int i)
 
 static void gicv2_write_lr(unsigned int i, u32 value)
 {
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+
+	shadow->lr[i] = value;
+	if (value)
+		shadow->used |= 1ULL << i;
+	else
+		shadow->used &= ~(1ULL << i);
+
 	mmio_write32(gich_base + GICH_LR_BASE + i * 4, value);
 }
 
+/* Drop list registers the guest has completed from the shadow. */
+static u64 gicv2_sync_lr_shadow(void)
+{
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+	u64 elsr;
+
+	if (shadow->used) {
+		elsr = mmio_read32(gich_base + GICH_ELSR0);
+		if (gic_num_lr > 32)
+			elsr |= (u64)mmio_read32(gich_base + GICH_ELSR1) << 32;
+		shadow->used &= ~elsr;
+	}
+
+	return shadow->used;
+}
+
 /* Check that the targeted interface belongs to the cell */
 static bool gicv2_targets_in_cell(struct cell *cell, u8 targets)
 {
@@ -46,7 +70,7 @@ static bool gicv2_targets_in_cell(struct cell *cell, u8 targets)
 	return true;
 }
 
-static int gicv2_init(void)
+static int __init gicv2_init(void)
 {
 	/* Probe the GICD version */
 	if (GICD_PIDR2_ARCH(mmio_read32(gicd_base + GICDv2_PIDR2)) != 2)
@@ -95,7 +119,7 @@ static void gicv2_cpu_reset(struct per_cpu *cpu_data)
 	mmio_write32(gich_base + GICH_VMCR, 0);
 }
 
-static int gicv2_cpu_init(struct per_cpu *cpu_data)
+static int __init gicv2_cpu_init(struct per_cpu *cpu_data)
 {
 	unsigned int mnt_irq = system_config->platform_info.arm.maintenance_irq;
 	u32 vtr, vmcr;
@@ -267,17 +291,23 @@ static int gicv2_send_sgi(struct sgi *sgi)
 	return 0;
 }
 
+/* Priorities are programmed by the cell directly in the distributor. */
+static u8 gicv2_irq_priority(u16 irq_id)
+{
+	return mmio_read8(gicd_base + GICD_IPRIORITYR + irq_id);
+}
+
 static int gicv2_inject_irq(u16 irq_id, u16 sender)
 {
-	int i;
-	int first_free = -1;
-	u32 lr;
-	unsigned long elsr[2];
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+	u64 used = gicv2_sync_lr_shadow();
+	u8 prio = gicv2_irq_priority(irq_id);
+	u32 lr, victim_prio = prio >> 3;
+	int first_free = -1, victim = -1;
+	unsigned int i;
 
-	elsr[0] = mmio_read32(gich_base + GICH_ELSR0);
-	elsr[1] = mmio_read32(gich_base + GICH_ELSR1);
 	for (i = 0; i < gic_num_lr; i++) {
-		if (test_bit(i, elsr)) {
+		if (!(used & (1ULL << i))) {
 			/* Entry is available */
 			if (first_free == -1)
 				first_free = i;
@@ -285,17 +315,40 @@ static int gicv2_inject_irq(u16 irq_id, u16 sender)
 		}
 
 		/* Check that there is no overlapping */
-		lr = gicv2_read_lr(i);
-		if ((lr & GICH_LR_VIRT_ID_MASK) == irq_id)
+		if ((shadow->lr[i] & GICH_LR_VIRT_ID_MASK) == irq_id)
 			return -EEXIST;
+
+		/* Only entries not yet acknowledged can be preempted */
+		lr = shadow->lr[i];
+		if ((lr & (GICH_LR_PENDING_BIT | GICH_LR_ACTIVE_BIT)) ==
+		    GICH_LR_PENDING_BIT &&
+		    ((lr >> GICH_LR_PRIORITY_SHIFT) & 0x1f) > victim_prio) {
+			victim = i;
+			victim_prio = (lr >> GICH_LR_PRIORITY_SHIFT) & 0x1f;
+		}
 	}
 
-	if (first_free == -1)
-		return -EBUSY;
+	if (first_free == -1) {
+		if (victim == -1)
+			return -EBUSY;
+
+		/* The shadow may be stale, the guest could have taken it. */
+		lr = gicv2_read_lr(victim);
+		if ((lr & (GICH_LR_PENDING_BIT | GICH_LR_ACTIVE_BIT)) !=
+		    GICH_LR_PENDING_BIT) {
+			shadow->lr[victim] = lr;
+			return -EBUSY;
+		}
+		irqchip_requeue_irq(lr & GICH_LR_VIRT_ID_MASK,
+				    (lr >> GICH_LR_CPUID_SHIFT) & 0x7);
+		first_free = victim;
+	}
 
 	/* Inject group 0 interrupt (seen as IRQ by the guest) */
 	lr = irq_id;
 	lr |= GICH_LR_PENDING_BIT;
+	/* the list register only holds the upper 5 priority bits */
+	lr |= (u32)(prio >> 3) << GICH_LR_PRIORITY_SHIFT;
 
 	if (is_sgi(irq_id)) {
 		lr |= (sender & 0x7) << GICH_LR_CPUID_SHIFT;
@@ -321,28 +374,44 @@ static void gicv2_enable_maint_irq(bool enable)
 	mmio_write32(gich_base + GICH_HCR, hcr);
 }
 
+/*
+ * The shadow may still report an interrupt as pending that the guest already
+ * acknowledged. Only such candidates are confirmed against the hardware.
+ */
 static bool gicv2_has_pending_irqs(void)
 {
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+	u64 used = gicv2_sync_lr_shadow();
 	unsigned int n;
 
 	for (n = 0; n < gic_num_lr; n++)
-		if (gicv2_read_lr(n) & GICH_LR_PENDING_BIT)
-			return true;
+		if (used & (1ULL << n) &&
+		    shadow->lr[n] & GICH_LR_PENDING_BIT) {
+			shadow->lr[n] = gicv2_read_lr(n);
+			if (shadow->lr[n] & GICH_LR_PENDING_BIT)
+				return true;
+		}
 
 	return false;
 }
 
 static int gicv2_get_pending_irq(void)
 {
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+	u64 used = gicv2_sync_lr_shadow();
 	unsigned int n;
 	u64 lr;
 
 	for (n = 0; n < gic_num_lr; n++) {
+		if (!(used & (1ULL << n)) ||
+		    !(shadow->lr[n] & GICH_LR_PENDING_BIT))
+			continue;
 		lr = gicv2_read_lr(n);
 		if (lr & GICH_LR_PENDING_BIT) {
 			gicv2_write_lr(n, 0);
 			return lr & GICH_LR_VIRT_ID_MASK;
 		}
+		shadow->lr[n] = lr;
 	}
 
 	return -ENOENT;
@@ -490,6 +559,10 @@ static u64 gicv2_get_cluster_target(unsigned int cpu_id)
 	return 0;
 }
 
+#ifdef CONFIG_ARM_GICV2_ONLY
+IRQCHIP_DIRECT_OPS(gicv2);
+#endif
+
 const struct irqchip gicv2_irqchip = {
 	.init = gicv2_init,
 	.cpu_init = gicv2_cpu_init,
@@ -25,6 +25,12 @@
 #define GIC_V3_REDIST_SIZE	0x20000
 #define GIC_V4_REDIST_SIZE	0x40000
 
+#define GIC_V3_ITS_SIZE		0x20000
+#define GIC_V4_ITS_SIZE		0x40000
+
+/* Linux' default, the LPI configuration table is not consulted */
+#define LPI_PRIORITY		0xa0
+
 /*
  * This implementation assumes that the kernel driver already initialised most
  * of the GIC.
@@ -83,6 +89,14 @@ static u64 gicv3_read_lr(unsigned int reg)
 
 static void gicv3_write_lr(unsigned int reg, u64 val)
 {
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+
+	shadow->lr[reg] = val;
+	if (val)
+		shadow->used |= 1ULL << reg;
+	else
+		shadow->used &= ~(1ULL << reg);
+
 	switch (reg) {
 #define __WRITE_LR0_7(n)				\
 	case n:						\
@@ -115,7 +129,21 @@ static void gicv3_write_lr(unsigned int reg, u64 val)
 	}
 }
 
-static int gicv3_init(void)
+/* Drop list registers the guest has completed from the shadow. */
+static u64 gicv3_sync_lr_shadow(void)
+{
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+	u32 elsr;
+
+	if (shadow->used) {
+		arm_read_sysreg(ICH_ELSR_EL2, elsr);
+		shadow->used &= ~(u64)elsr;
+	}
+
+	return shadow->used;
+}
+
+static int __init gicv3_init(void)
 {
 	unsigned long redist_size = GIC_V3_REDIST_SIZE;
 	unsigned int gicr_size;
@@ -187,7 +215,7 @@ static void gicv3_cpu_reset(struct per_cpu *cpu_data)
 	arm_write_sysreg(ICH_VMCR_EL2, 0);
 }
 
-static int gicv3_cpu_init(struct per_cpu *cpu_data)
+static int __init gicv3_cpu_init(struct per_cpu *cpu_data)
 {
 	unsigned int mnt_irq = system_config->platform_info.arm.maintenance_irq;
 	unsigned long redist_addr = system_config->platform_info.arm.gicr_base;
@@ -235,6 +263,15 @@ static int gicv3_cpu_init(struct per_cpu *cpu_data)
 	if ((cpu_data->public.mpidr & MPIDR_AFF0_MASK) >= 16)
 		return trace_error(-EIO);
 
+	/*
+	 * The root cell already set up its LPIs, and the tables stay with it.
+	 * Make sure their IDs fit into 16 bits.
+	 */
+	if (mmio_read32(redist_base + GICR_CTLR) & GICR_CTLR_EnableLPIs &&
+	    (mmio_read64(redist_base + GICR_PROPBASER) &
+	     GICR_PROPBASER_IDbits) >= 16)
+		return trace_error(-EIO);
+
 	/* Ensure all IPIs and the maintenance PPI are enabled. */
 	mmio_write32(redist_base + GICR_SGI_BASE + GICR_ISENABLER,
 		     0x0000ffff | (1 << mnt_irq));
@@ -322,16 +359,55 @@ static void gicv3_adjust_irq_target(struct cell *cell, u16 irq_id)
 		mmio_write64(irouter, mpidr);
 }
 
+/*
+ * The RD_base page of a redistributor can be handed to the cell owning its
+ * CPU as long as it does not support LPIs, which are reserved to the root
+ * cell, and GICR_TYPER already reports the Last bit the cell has to see. The
+ * SGI_base page mixes SGIs and PPIs of the hypervisor with those of the cell
+ * and remains trapped.
+ */
+static bool gicv3_redist_passthrough(unsigned int cpu)
+{
+	u64 typer = mmio_read64(public_per_cpu(cpu)->gicr.base + GICR_TYPER);
+
+	return !(typer & GICR_TYPER_PLPIS) &&
+		!!(typer & GICR_TYPER_Last) == (cpu == last_gicr);
+}
+
+/* Mapping is best effort, accesses are emulated if it fails. */
+static void gicv3_redist_map(struct cell *cell, unsigned int cpu)
+{
+	unsigned long phys = public_per_cpu(cpu)->gicr.phys_addr;
+
+	if (!gicv3_redist_passthrough(cpu))
+		return;
+
+	paging_create(&cell->arch.mm, phys, PAGE_SIZE, phys,
+		      PTE_FLAG_VALID | PTE_ACCESS_FLAG | S2_PTE_ACCESS_RW |
+		      S2_PTE_FLAG_DEVICE, PAGING_COHERENT);
+}
+
+/*
+ * LPIs are owned by the root cell together with the ITS. It set up the LPI
+ * tables before the hypervisor was enabled, and they stay in place. Only the
+ * root cell can invalidate or trigger LPIs via the redistributors of its CPUs,
+ * other cells do not see LPI support at all.
+ */
 static enum mmio_result gicv3_handle_redist_access(void *arg,
 						   struct mmio_access *mmio)
 {
 	struct public_per_cpu *cpu_public = arg;
+	bool lpi_owner = this_cell() == &root_cell;
+	u32 ctlr;
 
 	switch (mmio->address) {
 	case GICR_TYPER:
 		mmio_perform_access(cpu_public->gicr.base, mmio);
 		if (cpu_public->cpu_id == last_gicr)
 				mmio->value |= GICR_TYPER_Last;
+		if (!lpi_owner)
+			mmio->value &= ~(GICR_TYPER_PLPIS |
+					 GICR_TYPER_DirectLPI);
 		return MMIO_HANDLED;
 	case GICR_IIDR:
 	case 0xffd0 ... 0xfffc: /* ID registers */
@@ -341,17 +417,53 @@ static enum mmio_result gicv3_handle_redist_access(void *arg,
 		 */
 		break;
 	case GICR_SYNCR:
-		mmio->value = 0;
-		return MMIO_HANDLED;
-	case GICR_CTLR:
-	case GICR_STATUSR:
-	case GICR_WAKER:
-	case GICR_SGI_BASE + GICR_ISENABLER:
+		if (!lpi_owner) {
+			mmio->value = 0;
+			return MMIO_HANDLED;
+		}
+		break;
+	case GICR_PROPBASER:
+	case GICR_PENDBASER:
+		/* read-only for the owner as the tables stay in place */
+		if (!lpi_owner || mmio->is_write)
+			return MMIO_HANDLED;
+		break;
+	case GICR_SETLPIR:
+	case GICR_CLRLPIR:
+	case GICR_INVLPIR:
+	case GICR_INVALLR:
+		if (!lpi_owner || this_cell() != cpu_public->cell)
+			return MMIO_HANDLED;
+		break;
 	case GICR_SGI_BASE + GICR_ICENABLER:
 	case GICR_SGI_BASE + GICR_ISPENDR:
 	case GICR_SGI_BASE + GICR_ICPENDR:
 	case GICR_SGI_BASE + GICR_ISACTIVER:
 	case GICR_SGI_BASE + GICR_ICACTIVER:
+		if (this_cell() != cpu_public->cell)
+			return MMIO_HANDLED;
+		/* leave SGIs and PPIs of the hypervisor alone */
+		if (mmio->is_write)
+			mmio->value &= this_cell()->arch.irq_bitmap[0];
+		break;
+	case GICR_CTLR:
+		if (this_cell() != cpu_public->cell)
+			return MMIO_HANDLED;
+		if (lpi_owner)
+			break;
+		/* keep the LPI state of the root cell, but hide it */
+		if (mmio->is_write) {
+			ctlr = mmio_read32(cpu_public->gicr.base + GICR_CTLR);
+			mmio->value &= ~GICR_CTLR_EnableLPIs;
+			mmio->value |= ctlr & GICR_CTLR_EnableLPIs;
+		}
+		mmio_perform_access(cpu_public->gicr.base, mmio);
+		if (!mmio->is_write)
+			mmio->value &= ~GICR_CTLR_EnableLPIs;
+		return MMIO_HANDLED;
+	case GICR_STATUSR:
+	case GICR_WAKER:
+	case GICR_SGI_BASE + GICR_ISENABLER:
 	case REG_RANGE(GICR_SGI_BASE + GICR_IPRIORITYR, 8, 4):
 	case REG_RANGE(GICR_SGI_BASE + GICR_ICFGR, 2, 4):
 		if (this_cell() != cpu_public->cell) {
@@ -371,7 +483,18 @@ static enum mmio_result gicv3_handle_redist_access(void *arg,
 
 static int gicv3_cell_init(struct cell *cell)
 {
-	unsigned int cpu;
+	unsigned long its_base = system_config->platform_info.arm.gits_base;
+	unsigned long its_size =
+		gic_version == 4 ? GIC_V4_ITS_SIZE : GIC_V3_ITS_SIZE;
+	const struct jailhouse_memory *mem;
+	unsigned int cpu, n;
+
+	/* the ITS and thus all LPIs belong to the root cell */
+	if (its_base && cell != &root_cell)
+		for_each_mem_region(mem, cell->config, n)
+			if (mem->phys_start < its_base + its_size &&
+			    mem->phys_start + mem->size > its_base)
+				return trace_error(-EINVAL);
 
 	/*
 	 * We register all regions so that the cell can iterate over the
@@ -383,12 +506,54 @@ static int gicv3_cell_init(struct cell *cell)
 		mmio_region_register(cell, public_per_cpu(cpu)->gicr.phys_addr,
 				     gic_version == 4 ? 0x40000 : 0x20000,
 				     gicv3_handle_redist_access,
-				     public_per_cpu(cpu));
+				     public_per_cpu(cpu), "gicr");
 	}
 
+	for_each_cpu(cpu, cell->cpu_set)
+		gicv3_redist_map(cell, cpu);
+
 	return 0;
 }
 
+static void gicv3_cpu_move(unsigned int cpu_id, struct cell *from,
+			   struct cell *to)
+{
+	unsigned long phys = public_per_cpu(cpu_id)->gicr.phys_addr;
+
+	if (!gicv3_redist_passthrough(cpu_id))
+		return;
+
+	/* the RD_base page moves along with the CPU */
+	paging_destroy(&from->arch.mm, phys, PAGE_SIZE, PAGING_COHERENT);
+	arch_flush_cell_vcpu_caches(from, phys, PAGE_SIZE);
+	gicv3_redist_map(to, cpu_id);
+}
+
+static void gicv3_config_commit(struct cell *cell_added_removed)
+{
+	unsigned long phys;
+	unsigned int cpu;
+
+	if (cell_added_removed == &root_cell)
+		return;
+
+	/*
+	 * Move the RD_base pages along with the CPUs. The pages of a destroyed
+	 * cell vanish with its page tables.
+	 */
+	for_each_cpu(cpu, cell_added_removed->cpu_set) {
+		if (public_per_cpu(cpu)->cell == &root_cell) {
+			gicv3_redist_map(&root_cell, cpu);
+			continue;
+		}
+
+		phys = public_per_cpu(cpu)->gicr.phys_addr;
+		paging_destroy(&root_cell.arch.mm, phys, PAGE_SIZE,
+			       PAGING_COHERENT);
+		arch_flush_cell_vcpu_caches(&root_cell, phys, PAGE_SIZE);
+	}
+}
+
 #define MPIDR_TO_SGIR_AFFINITY(cluster_id, level) \
 	(MPIDR_AFFINITY_LEVEL((cluster_id), (level)) \
 	<< ICC_SGIR_AFF## level ##_SHIFT)
@@ -511,16 +676,32 @@ static void gicv3_eoi_irq(u32 irq_id, bool deactivate)
 		arm_write_sysreg(ICC_DIR_EL1, irq_id);
 }
 
+/*
+ * Priorities are programmed by the cell directly, for SGIs and PPIs in the
+ * redistributor of the CPU. Those of LPIs are in a table in the memory of the
+ * root cell.
+ */
+static u8 gicv3_irq_priority(u16 irq_id)
+{
+	if (is_lpi(irq_id))
+		return LPI_PRIORITY;
+	if (irq_id < 32)
+		return mmio_read8(this_cpu_public()->gicr.base +
+				  GICR_SGI_BASE + GICR_IPRIORITYR + irq_id);
+	return mmio_read8(gicd_base + GICD_IPRIORITYR + irq_id);
+}
+
 static int gicv3_inject_irq(u16 irq_id, u16 sender)
 {
-	int i;
-	int free_lr = -1;
-	u32 elsr;
-	u64 lr;
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+	u64 used = gicv3_sync_lr_shadow();
+	u8 prio = gicv3_irq_priority(irq_id);
+	int free_lr = -1, victim = -1;
+	u64 lr, victim_prio = prio;
+	unsigned int i;
 
-	arm_read_sysreg(ICH_ELSR_EL2, elsr);
 	for (i = 0; i < gic_num_lr; i++) {
-		if ((elsr >> i) & 1) {
+		if (!(used & (1ULL << i))) {
 			/* Entry is invalid, candidate for injection */
 			if (free_lr == -1)
 				free_lr = i;
@@ -530,26 +711,44 @@ static int gicv3_inject_irq(u16 irq_id, u16 sender)
 		/*
 		 * Entry is in use, check that it doesn't match the one we want
 		 * to inject.
-		 */
-		lr = gicv3_read_lr(i);
-
-		/*
+		 *
 		 * A strict phys->virt id mapping is used for SPIs, so this test
 		 * should be sufficient.
 		 */
-		if ((u32)lr == irq_id)
+		if ((u32)shadow->lr[i] == irq_id)
 			return -EEXIST;
+
+		/* Only entries not yet acknowledged can be preempted */
+		lr = shadow->lr[i];
+		if ((lr & ICH_LR_PENDACTIVE) == ICH_LR_PENDING &&
+		    ((lr >> ICH_LR_PRIORITY_SHIFT) & 0xff) > victim_prio) {
+			victim = i;
+			victim_prio = (lr >> ICH_LR_PRIORITY_SHIFT) & 0xff;
+		}
 	}
 
-	if (free_lr == -1)
+	if (free_lr == -1) {
 		/* All list registers are in use */
-		return -EBUSY;
+		if (victim == -1)
+			return -EBUSY;
+
+		/* The shadow may be stale, the guest could have taken it. */
+		lr = gicv3_read_lr(victim);
+		if ((lr & ICH_LR_PENDACTIVE) != ICH_LR_PENDING) {
+			shadow->lr[victim] = lr;
+			return -EBUSY;
+		}
+		irqchip_requeue_irq((u32)lr, 0);
+		free_lr = victim;
+	}
 
 	lr = irq_id;
 	/* Only group 1 interrupts */
 	lr |= ICH_LR_GROUP_BIT;
 	lr |= ICH_LR_PENDING;
-	if (!is_sgi(irq_id)) {
+	lr |= (u64)prio << ICH_LR_PRIORITY_SHIFT;
+	/* LPIs have no active state the cell could deactivate */
+	if (!is_sgi(irq_id) && !is_lpi(irq_id)) {
 		lr |= ICH_LR_HW_BIT;
 		lr |= (u64)irq_id << ICH_LR_PHYS_ID_SHIFT;
 	}
@@ -572,28 +771,42 @@ static void gicv3_enable_maint_irq(bool enable)
 	arm_write_sysreg(ICH_HCR_EL2, hcr);
 }
 
+/*
+ * The shadow may still report an interrupt as pending that the guest already
+ * acknowledged. Only such candidates are confirmed against the hardware.
+ */
 static bool gicv3_has_pending_irqs(void)
 {
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+	u64 used = gicv3_sync_lr_shadow();
 	unsigned int n;
 
 	for (n = 0; n < gic_num_lr; n++)
-		if (gicv3_read_lr(n) & ICH_LR_PENDING)
-			return true;
+		if (used & (1ULL << n) && shadow->lr[n] & ICH_LR_PENDING) {
+			shadow->lr[n] = gicv3_read_lr(n);
+			if (shadow->lr[n] & ICH_LR_PENDING)
+				return true;
+		}
 
 	return false;
 }
 
 static int gicv3_get_pending_irq(void)
 {
+	struct lr_shadow *shadow = &this_cpu_public()->lr_shadow;
+	u64 used = gicv3_sync_lr_shadow();
 	unsigned int n;
 	u64 lr;
 
 	for (n = 0; n < gic_num_lr; n++) {
+		if (!(used & (1ULL << n)) || !(shadow->lr[n] & ICH_LR_PENDING))
+			continue;
 		lr = gicv3_read_lr(n);
 		if (lr & ICH_LR_PENDING) {
 			gicv3_write_lr(n, 0);
 			return (u32)lr;
 		}
+		shadow->lr[n] = lr;
 	}
 
 	return -ENOENT;
@@ -605,7 +818,12 @@ static void gicv3_inject_phys_irq(u16 irq_id)
 	unsigned int offset = (irq_id / 32) * 4;
 	unsigned int mask = 1 << (irq_id % 32);
 
-	if (!is_spi(irq_id)) {
+	if (is_lpi(irq_id)) {
+		/* LPIs can only be set pending without the ITS if supported */
+		gicr = this_cpu_public()->gicr.base;
+		if (mmio_read64(gicr + GICR_TYPER) & GICR_TYPER_DirectLPI)
+			mmio_write64(gicr + GICR_SETLPIR, irq_id);
+	} else if (!is_spi(irq_id)) {
 		/*
 		 * Hardware interrupts are physically active until they are
 		 * processed by the cell. Deactivate them first so that we can
@@ -636,8 +854,15 @@ static enum mmio_result gicv3_handle_irq_target(struct mmio_access *mmio,
 static enum mmio_result gicv3_handle_dist_access(struct mmio_access *mmio)
 {
 	switch (mmio->address) {
-	case GICD_CTLR:
 	case GICD_TYPER:
+		/* LPIs are reserved to the root cell, see gicv3_cell_init */
+		if (!mmio->is_write) {
+			mmio_perform_access(gicd_base, mmio);
+			if (this_cell() != &root_cell)
+				mmio->value &= ~GICD_TYPER_LPIS;
+		}
+		return MMIO_HANDLED;
+	case GICD_CTLR:
 	case GICD_IIDR:
 	case REG_RANGE(GICDv3_PIDR0, 4, 4):
 	case REG_RANGE(GICDv3_PIDR4, 4, 4):
@@ -662,12 +887,18 @@ static u64 gicv3_get_cluster_target(unsigned int cpu_id)
 	return public_per_cpu(cpu_id)->mpidr & MPIDR_CLUSTERID_MASK;
 }
 
+#ifdef CONFIG_ARM_GICV3_ONLY
+IRQCHIP_DIRECT_OPS(gicv3);
+#endif
+
 const struct irqchip gicv3_irqchip = {
 	.init = gicv3_init,
 	.cpu_init = gicv3_cpu_init,
 	.cpu_reset = gicv3_cpu_reset,
 	.cpu_shutdown = gicv3_cpu_shutdown,
 	.cell_init = gicv3_cell_init,
+	.config_commit = gicv3_config_commit,
+	.cpu_move = gicv3_cpu_move,
 	.adjust_irq_target = gicv3_adjust_irq_target,
 	.send_sgi = gicv3_send_sgi,
 	.inject_irq = gicv3_inject_irq,
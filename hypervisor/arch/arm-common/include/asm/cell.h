@@ -19,6 +19,9 @@ struct arch_cell {
 	struct paging_structures mm;
 
 	u32 irq_bitmap[1024/32];
+	/* irq_bitmap expanded to the fields of GICD_ICFGR and GICD_IPRIORITYR */
+	u32 irq_cfg_mask[1024/16];
+	u32 irq_prio_mask[1024/4];
 };
 
 #endif /* !_JAILHOUSE_ASM_CELL_H */
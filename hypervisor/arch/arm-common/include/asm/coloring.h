@@ -0,0 +1,20 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_COLORING_H
+#define _JAILHOUSE_ASM_COLORING_H
+
+#include <jailhouse/types.h>
+
+struct jailhouse_memory;
+
+bool coloring_next_run(const struct jailhouse_memory *mem,
+		       unsigned long *offset, unsigned long *size);
+
+#endif /* !_JAILHOUSE_ASM_COLORING_H */
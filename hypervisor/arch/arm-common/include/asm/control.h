@@ -30,13 +30,17 @@ void arch_shutdown_self(struct per_cpu *cpu_data);
 unsigned int arm_cpu_by_mpidr(struct cell *cell, unsigned long mpidr);
 
 void arm_cpu_reset(unsigned long pc);
+void arm_cpu_set_idle_policy(void);
+void arm_cpu_idle(void);
 void arm_cpu_park(void);
 void arm_cpu_kick(unsigned int cpu_id);
 
-static inline void arch_send_event(struct public_per_cpu *target_data)
-{
-	arm_cpu_kick(target_data->cpu_id);
-}
+/*
+ * Queue an event SGI for the target CPU, combining it with queued ones of the
+ * same cluster. arch_flush_events() sends what is left queued.
+ */
+void arch_queue_event(struct public_per_cpu *target_data);
+void arch_flush_events(void);
 
 #endif /* !__ASSEMBLY__ */
 
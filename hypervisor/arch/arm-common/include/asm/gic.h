@@ -40,6 +40,9 @@
 #define is_sgi(irqn)			((u32)(irqn) < 16)
 #define is_ppi(irqn)			((irqn) > 15 && (irqn) < 32)
 #define is_spi(irqn)			((irqn) > 31 && (irqn) < 1020)
+#define is_lpi(irqn)			((u32)(irqn) >= GIC_LPI_BASE)
+
+#define GIC_LPI_BASE			8192
 
 #define REG_RANGE(base, n, size)	(base)...((base) + (n - 1) * (size))
 
@@ -21,11 +21,19 @@
 #define GICDv3_PIDR2		0xffe8
 #define GICDv3_PIDR4		0xffd0
 
+#define GICD_TYPER_LPIS		(1 << 17)
+
 #define GICR_CTLR		0x0000
 #define GICR_IIDR		0x0004
 #define GICR_TYPER		0x0008
 #define GICR_STATUSR		0x0010
 #define GICR_WAKER		0x0014
+#define GICR_SETLPIR		0x0040
+#define GICR_CLRLPIR		0x0048
+#define GICR_PROPBASER		0x0070
+#define GICR_PENDBASER		0x0078
+#define GICR_INVLPIR		0x00a0
+#define GICR_INVALLR		0x00b0
 #define GICR_SYNCR		0x00c0
 #define GICR_PIDR2		0xffe8
 
@@ -39,7 +47,13 @@
 #define GICR_IPRIORITYR		GICD_IPRIORITYR
 #define GICR_ICFGR		GICD_ICFGR
 
+#define GICR_CTLR_EnableLPIs	(1 << 0)
+
+#define GICR_TYPER_PLPIS	(1 << 0)
+#define GICR_TYPER_DirectLPI	(1 << 3)
 #define GICR_TYPER_Last		(1 << 4)
+
+#define GICR_PROPBASER_IDbits	0x1f
 #define GICR_PIDR2_ARCH		GICD_PIDR2_ARCH
 
 #define ICC_IAR1_EL1		SYSREG_32(0, c12, c12, 0)
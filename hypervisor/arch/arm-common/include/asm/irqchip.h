@@ -13,7 +13,14 @@
 #ifndef _JAILHOUSE_ASM_IRQCHIP_H
 #define _JAILHOUSE_ASM_IRQCHIP_H
 
-#define MAX_PENDING_IRQS	256
+#define MAX_PENDING_IRQS	1024
+/* LPIs with 16-bit IDs, i.e. 8192 to 65535 */
+#define MAX_PENDING_LPIS	(0x10000 - 8192)
+/* SGI sender IDs that can be reported to the guest (3 bits on GICv2) */
+#define MAX_SGI_SENDERS		8
+
+/* GICv2 supports up to 64, GICv3 up to 16 list registers */
+#define MAX_LIST_REGS		64
 
 #include <jailhouse/cell.h>
 #include <jailhouse/mmio.h>
@@ -44,6 +51,9 @@ struct irqchip {
 	int	(*cpu_shutdown)(struct public_per_cpu *cpu_public);
 	int	(*cell_init)(struct cell *cell);
 	void	(*cell_exit)(struct cell *cell);
+	void	(*config_commit)(struct cell *cell_added_removed);
+	void	(*cpu_move)(unsigned int cpu_id, struct cell *from,
+			    struct cell *to);
 	void	(*adjust_irq_target)(struct cell *cell, u16 irq_id);
 
 	int	(*send_sgi)(struct sgi *sgi);
@@ -67,15 +77,72 @@ struct irqchip {
 	unsigned long gicd_size;
 };
 
+#if defined(CONFIG_ARM_GICV2_ONLY) && defined(CONFIG_ARM_GICV3_ONLY)
+#error CONFIG_ARM_GICV2_ONLY and CONFIG_ARM_GICV3_ONLY are exclusive
+#endif
+
+#if defined(CONFIG_ARM_GICV2_ONLY) || defined(CONFIG_ARM_GICV3_ONLY)
+/*
+ * The hypervisor is built for a single GIC version. Its hot operations are
+ * then called directly via the following aliases, see IRQCHIP_DIRECT_OPS,
+ * instead of via struct irqchip.
+ */
+#define IRQCHIP_DIRECT	1
+
+int irqchip_direct_send_sgi(struct sgi *sgi);
+u32 irqchip_direct_read_iar_irqn(void);
+void irqchip_direct_eoi_irq(u32 irqn, bool deactivate);
+int irqchip_direct_inject_irq(u16 irq_id, u16 sender);
+void irqchip_direct_enable_maint_irq(bool enable);
+bool irqchip_direct_has_pending_irqs(void);
+enum mmio_result irqchip_direct_handle_irq_route(struct mmio_access *mmio,
+						 unsigned int irq);
+enum mmio_result irqchip_direct_handle_irq_target(struct mmio_access *mmio,
+						  unsigned int irq);
+enum mmio_result irqchip_direct_handle_dist_access(struct mmio_access *mmio);
+
+#define IRQCHIP_DIRECT_OP(gic, op)					\
+	typeof(gic##_##op) irqchip_direct_##op				\
+		__attribute__((alias(#gic "_" #op)))
+
+/* To be used by the GIC driver selected via CONFIG_ARM_GICV*_ONLY. */
+#define IRQCHIP_DIRECT_OPS(gic)						\
+	IRQCHIP_DIRECT_OP(gic, send_sgi);				\
+	IRQCHIP_DIRECT_OP(gic, read_iar_irqn);				\
+	IRQCHIP_DIRECT_OP(gic, eoi_irq);				\
+	IRQCHIP_DIRECT_OP(gic, inject_irq);				\
+	IRQCHIP_DIRECT_OP(gic, enable_maint_irq);			\
+	IRQCHIP_DIRECT_OP(gic, has_pending_irqs);			\
+	IRQCHIP_DIRECT_OP(gic, handle_irq_route);			\
+	IRQCHIP_DIRECT_OP(gic, handle_irq_target);			\
+	IRQCHIP_DIRECT_OP(gic, handle_dist_access)
+#endif
+
+/*
+ * Software copy of the list registers, only accessed by the owning CPU. The
+ * interrupt ID of an occupied list register cannot change behind our back, its
+ * state can. Emptied registers are found via the ELSR register.
+ */
+struct lr_shadow {
+	/* last values written to the list registers */
+	u64 lr[MAX_LIST_REGS];
+	/* list registers not found empty on the last ELSR sync */
+	u64 used;
+};
+
+/*
+ * Pending interrupts that could not be injected into the list registers yet.
+ * Producers set bits atomically, only the owning CPU clears them. Repeated
+ * requests for the same interrupt coalesce like in the physical GIC.
+ */
 struct pending_irqs {
-	/* synchronizes parallel insertions of SGIs into the pending ring */
-	spinlock_t lock;
-	u16 irqs[MAX_PENDING_IRQS];
-	/* contains the calling CPU ID in case of a SGI */
-	u16 sender[MAX_PENDING_IRQS];
-	unsigned int head;
-	/* removal from the ring happens lockless, thus tail is volatile */
-	volatile unsigned int tail;
+	/* SGIs, bit (irq_id * MAX_SGI_SENDERS + sender) */
+	unsigned long sgis[16 * MAX_SGI_SENDERS / BITS_PER_LONG];
+	/* PPIs and SPIs by IRQ ID, the bits of SGIs are unused */
+	unsigned long irqs[MAX_PENDING_IRQS / BITS_PER_LONG];
+	/* LPIs by IRQ ID - GIC_LPI_BASE, only scanned if lpis_queued is set */
+	unsigned long lpis[MAX_PENDING_LPIS / BITS_PER_LONG];
+	volatile bool lpis_queued;
 };
 
 int irqchip_cpu_init(struct per_cpu *cpu_data);
@@ -88,14 +155,16 @@ void irqchip_cpu_shutdown(struct public_per_cpu *cpu_public);
 void irqchip_cell_reset(struct cell *cell);
 
 void irqchip_config_commit(struct cell *cell_added_removed);
+void irqchip_cpu_move(unsigned int cpu_id, struct cell *from, struct cell *to);
 
 int irqchip_send_sgi(struct sgi *sgi);
-void irqchip_handle_irq(void);
+bool irqchip_handle_irq(void);
 
 bool irqchip_has_pending_irqs(void);
 
 void irqchip_inject_pending(void);
 void irqchip_set_pending(struct public_per_cpu *cpu_public, u16 irq_id);
+void irqchip_requeue_irq(u16 irq_id, u16 sender);
 
 bool irqchip_irq_in_cell(struct cell *cell, unsigned int irq_id);
 
@@ -14,7 +14,7 @@
 #define _JAILHOUSE_ASM_IVSHMEM_H
 
 struct arch_pci_ivshmem {
-	u16 irq_id;
+	u16 irq_id[IVSHMEM_MAX_MSIX_VECTORS];
 };
 
 #endif /* !_JAILHOUSE_ASM_IVSHMEM_H */
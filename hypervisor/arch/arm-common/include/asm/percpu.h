@@ -31,8 +31,14 @@
 		} gicr;							\
 	};								\
 									\
-	struct pending_irqs pending_irqs;				\
+	/** Shadow of the GIC list registers, CPU-local. */		\
+	struct lr_shadow lr_shadow;					\
 									\
+	/** Event SGIs queued by this CPU, CPU-local. */		\
+	struct sgi queued_events;
+
+/* Written by other CPUs, see public_per_cpu. */
+#define ARCH_PUBLIC_PERCPU_CONTROL_FIELDS				\
 	/**								\
 	 * Lock protecting CPU state changes done for control tasks.	\
 	 *								\
@@ -42,6 +48,8 @@
 	 * @li public_per_cpu::cpu_suspended (except for spinning on it	\
 	 *                                    to become true)		\
 	 * @li public_per_cpu::flush_vcpu_caches			\
+	 * @li public_per_cpu::flush_vcpu_caches_start		\
+	 * @li public_per_cpu::flush_vcpu_caches_end			\
 	 * @li public_per_cpu::wait_for_poweron (except for CPU-local	\
 	 * 					 tests)			\
 	 * @li public_per_cpu::reset					\
@@ -49,12 +57,25 @@
 	 */								\
 	spinlock_t control_lock;					\
 									\
-	/** True if CPU is waiting for power-on. */			\
-	volatile bool wait_for_poweron;					\
 	/** Set to true for pending reset. */				\
 	bool reset;							\
 	/** Set to true for pending park. */				\
 	bool park;							\
+	/** Start of the guest-physical range to flush on		\
+	 *  public_per_cpu::flush_vcpu_caches. */			\
+	unsigned long flush_vcpu_caches_start;				\
+	/** End (exclusive) of the range to flush. */			\
+	unsigned long flush_vcpu_caches_end;				\
 									\
 	unsigned long cpu_on_entry;					\
-	unsigned long cpu_on_context;
+	unsigned long cpu_on_context;					\
+									\
+	/** Interrupts queued for injection by any CPU. Kept apart as	\
+	 *  SGIs between cell CPUs update it frequently. */		\
+	struct pending_irqs pending_irqs				\
+		__attribute__((aligned(CACHE_LINE_SIZE)));
+
+/* Written by the owning CPU and polled by others, see public_per_cpu. */
+#define ARCH_PUBLIC_PERCPU_STATE_FIELDS					\
+	/** True if CPU is waiting for power-on. */			\
+	volatile bool wait_for_poweron;
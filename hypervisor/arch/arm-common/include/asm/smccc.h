@@ -33,4 +33,7 @@
 
 #define SMCCC_IS_CONV_64(function_id)	!!(function_id & (1 << 30))
 
+struct cell;
+
+int smccc_cell_init(struct cell *cell);
 enum trap_return handle_smc(struct trap_context *ctx);
@@ -27,5 +27,6 @@ typedef enum trap_return (*trap_handler)(struct trap_context *ctx);
 void arch_skip_instruction(struct trap_context *ctx);
 
 enum trap_return arch_handle_dabt(struct trap_context *ctx);
+enum trap_return arch_handle_wfi(struct trap_context *ctx);
 
 #endif /* !_JAILHOUSE_ASM_TRAPS_H */
@@ -18,6 +18,7 @@
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <jailhouse/unit.h>
 #include <asm/control.h>
 #include <asm/gic.h>
@@ -41,6 +42,12 @@ static bool irqchip_is_init;
 
 static struct irqchip irqchip;
 
+#ifdef IRQCHIP_DIRECT
+#define irqchip_op(op)	irqchip_direct_##op
+#else
+#define irqchip_op(op)	irqchip.op
+#endif
+
 /*
  * Most of the GIC distributor writes only reconfigure the IRQs corresponding to
  * the bits of the written value, by using separate `set' and `clear' registers.
@@ -48,26 +55,14 @@ static struct irqchip irqchip;
  * to simply restrict the mmio->value with the cell configuration mask.
  * Others, such as the priority registers, will need to be read and written back
  * with a restricted value, by using the distributor lock.
+ *
+ * The access masks are precomputed per cell by update_access_masks().
  */
 static enum mmio_result
-restrict_bitmask_access(struct mmio_access *mmio, unsigned int reg_index,
-			unsigned int bits_per_irq, bool is_poke)
+restrict_bitmask_access(struct mmio_access *mmio, u32 access_mask,
+			bool is_poke)
 {
-	struct cell *cell = this_cell();
-	unsigned int irq;
-	unsigned long access_mask = 0;
-	/*
-	 * In order to avoid division, the number of bits per irq is limited
-	 * to powers of 2 for the moment.
-	 */
-	unsigned long irqs_per_reg = 32 >> ffsl(bits_per_irq);
-	unsigned long irq_bits = (1 << bits_per_irq) - 1;
-	/* First, extract the first interrupt affected by this access */
-	unsigned int first_irq = reg_index * irqs_per_reg;
-
-	for (irq = 0; irq < irqs_per_reg; irq++)
-		if (irqchip_irq_in_cell(cell, first_irq + irq))
-			access_mask |= irq_bits << (irq * bits_per_irq);
+	unsigned long access_val;
 
 	if (!mmio->is_write) {
 		/* Restrict the read value */
@@ -76,74 +71,151 @@ restrict_bitmask_access(struct mmio_access *mmio, unsigned int reg_index,
 		return MMIO_HANDLED;
 	}
 
-	if (!is_poke) {
-		/*
-		 * Modify the existing value of this register by first reading
-		 * it into mmio->value
-		 * Relies on a spinlock since we need two mmio accesses.
-		 */
-		unsigned long access_val = mmio->value;
+	/* Writes to registers the cell fully owns need no merging. */
+	if (is_poke || access_mask == ~0U) {
+		mmio->value &= access_mask;
+		if (mmio->value || !is_poke)
+			mmio_perform_access(gicd_base, mmio);
+		return MMIO_HANDLED;
+	}
+	if (access_mask == 0)
+		return MMIO_HANDLED;
 
-		spin_lock(&dist_lock);
+	/*
+	 * Modify the existing value of this register. Relies on a spinlock
+	 * since we need two mmio accesses.
+	 */
+	access_val = mmio->value & access_mask;
 
-		mmio->is_write = false;
-		mmio_perform_access(gicd_base, mmio);
-		mmio->is_write = true;
+	spin_lock(&dist_lock);
 
-		mmio->value &= ~access_mask;
-		mmio->value |= access_val & access_mask;
-		mmio_perform_access(gicd_base, mmio);
+	mmio->is_write = false;
+	mmio_perform_access(gicd_base, mmio);
+	mmio->is_write = true;
+
+	mmio->value = (mmio->value & ~access_mask) | access_val;
+	mmio_perform_access(gicd_base, mmio);
+
+	spin_unlock(&dist_lock);
+
+	return MMIO_HANDLED;
+}
 
-		spin_unlock(&dist_lock);
+/* Must be called whenever the irq_bitmap of a cell changed. */
+static void update_access_masks(struct cell *cell)
+{
+	unsigned int irq;
+	u32 *mask;
+
+	memset(cell->arch.irq_cfg_mask, 0, sizeof(cell->arch.irq_cfg_mask));
+	memset(cell->arch.irq_prio_mask, 0, sizeof(cell->arch.irq_prio_mask));
+
+	for (irq = 0; irq < sizeof(cell->arch.irq_bitmap) * 8; irq++) {
+		if (!irqchip_irq_in_cell(cell, irq))
+			continue;
+		mask = &cell->arch.irq_cfg_mask[irq / 16];
+		*mask |= 0x3 << ((irq % 16) * 2);
+		mask = &cell->arch.irq_prio_mask[irq / 4];
+		*mask |= 0xff << ((irq % 4) * 8);
+	}
+}
+
+static void queue_pending(struct pending_irqs *pending, u16 irq_id,
+			  u16 sender)
+{
+	if (is_sgi(irq_id)) {
+		set_bit(irq_id * MAX_SGI_SENDERS + sender % MAX_SGI_SENDERS,
+			pending->sgis);
+	} else if (is_lpi(irq_id)) {
+		set_bit(irq_id - GIC_LPI_BASE, pending->lpis);
+		/* see irqchip_inject_pending */
+		memory_barrier();
+		pending->lpis_queued = true;
 	} else {
-		mmio->value &= access_mask;
-		mmio_perform_access(gicd_base, mmio);
+		set_bit(irq_id, pending->irqs);
 	}
-	return MMIO_HANDLED;
+}
+
+static void send_inject_sgi(struct sgi *inject)
+{
+	/* Make the pending bits visible before sending SGI_INJECT. */
+	memory_barrier();
+
+	irqchip_send_sgi(inject);
+	inject->targets = 0;
 }
 
 void gic_handle_sgir_write(struct sgi *sgi)
 {
 	struct public_per_cpu *cpu_public = this_cpu_public();
+	struct sgi inject = {
+		.routing_mode = 0,
+		.id = SGI_INJECT,
+	};
 	unsigned int cpu, target;
 	u64 cluster;
 
-	if (sgi->routing_mode == 2)
+	if (sgi->routing_mode == 2) {
 		/* Route to the caller itself */
 		irqchip_set_pending(cpu_public, sgi->id);
-	else
-		for_each_cpu(cpu, this_cell()->cpu_set) {
-			if (sgi->routing_mode == 1) {
-				/* Route to all (cell) CPUs but the caller. */
-				if (cpu == cpu_public->cpu_id)
-					continue;
-			} else {
-				target = irqchip_get_cpu_target(cpu);
-				cluster = irqchip_get_cluster_target(cpu);
+		return;
+	}
 
-				/* Route to target CPUs in cell */
-				if ((sgi->cluster_id != cluster) ||
-				    !(sgi->targets & target))
-					continue;
-			}
+	/*
+	 * Only CPUs of the caller's cell are considered, so the target list is
+	 * validated by construction. Remote targets get the SGI queued and are
+	 * then kicked by a single SGI_INJECT per cluster instead of one per
+	 * CPU.
+	 */
+	for_each_cpu(cpu, this_cell()->cpu_set) {
+		target = irqchip_get_cpu_target(cpu);
+		cluster = irqchip_get_cluster_target(cpu);
+
+		if (sgi->routing_mode == 1) {
+			/* Route to all (cell) CPUs but the caller. */
+			if (cpu == cpu_public->cpu_id)
+				continue;
+		} else {
+			/* Route to target CPUs in cell */
+			if ((sgi->cluster_id != cluster) ||
+			    !(sgi->targets & target))
+				continue;
+		}
 
-			irqchip_set_pending(public_per_cpu(cpu), sgi->id);
+		if (cpu == cpu_public->cpu_id) {
+			irqchip_set_pending(cpu_public, sgi->id);
+			continue;
 		}
+
+		trace_event(JAILHOUSE_TRACE_IRQ_PENDING, cpu, sgi->id);
+		queue_pending(&public_per_cpu(cpu)->pending_irqs, sgi->id,
+			      cpu_public->cpu_id);
+
+		if (inject.targets && inject.cluster_id != cluster)
+			send_inject_sgi(&inject);
+		inject.cluster_id = cluster;
+		inject.targets |= target;
+	}
+
+	if (inject.targets)
+		send_inject_sgi(&inject);
 }
 
 static enum mmio_result gic_handle_dist_access(void *arg,
 					       struct mmio_access *mmio)
 {
 	unsigned long reg = mmio->address;
+	struct cell *cell = this_cell();
 	enum mmio_result ret;
 
 	switch (reg) {
 	case REG_RANGE(GICD_IROUTER, 1024, 8):
-		ret = irqchip.handle_irq_route(mmio, (reg - GICD_IROUTER) / 8);
+		ret = irqchip_op(handle_irq_route)(mmio,
+						   (reg - GICD_IROUTER) / 8);
 		break;
 
 	case REG_RANGE(GICD_ITARGETSR, 1024, 1):
-		ret = irqchip.handle_irq_target(mmio, reg - GICD_ITARGETSR);
+		ret = irqchip_op(handle_irq_target)(mmio, reg - GICD_ITARGETSR);
 		break;
 
 	case REG_RANGE(GICD_ICENABLER, 32, 4):
@@ -152,38 +224,47 @@ static enum mmio_result gic_handle_dist_access(void *arg,
 	case REG_RANGE(GICD_ISPENDR, 32, 4):
 	case REG_RANGE(GICD_ICACTIVER, 32, 4):
 	case REG_RANGE(GICD_ISACTIVER, 32, 4):
-		ret = restrict_bitmask_access(mmio, (reg & 0x7f) / 4, 1, true);
+		ret = restrict_bitmask_access(mmio,
+				cell->arch.irq_bitmap[(reg & 0x7f) / 4], true);
 		break;
 
 	case REG_RANGE(GICD_IGROUPR, 32, 4):
-		ret = restrict_bitmask_access(mmio, (reg & 0x7f) / 4, 1, false);
+		ret = restrict_bitmask_access(mmio,
+				cell->arch.irq_bitmap[(reg & 0x7f) / 4], false);
 		break;
 
 	case REG_RANGE(GICD_ICFGR, 64, 4):
-		ret = restrict_bitmask_access(mmio, (reg & 0xff) / 4, 2, false);
+		ret = restrict_bitmask_access(mmio,
+				cell->arch.irq_cfg_mask[(reg & 0xff) / 4],
+				false);
 		break;
 
 	case REG_RANGE(GICD_IPRIORITYR, 255, 4):
-		ret = restrict_bitmask_access(mmio, (reg & 0x3ff) / 4, 8,
-					      false);
+		ret = restrict_bitmask_access(mmio,
+				cell->arch.irq_prio_mask[(reg & 0x3ff) / 4],
+				false);
 		break;
 
 	default:
-		ret = irqchip.handle_dist_access(mmio);
+		ret = irqchip_op(handle_dist_access)(mmio);
 	}
 
 	return ret;
 }
 
-void irqchip_handle_irq(void)
+/*
+ * Returns true if an interrupt was forwarded to the cell or an SGI was
+ * received, i.e. if the cell may have something to do now.
+ */
+bool __hot irqchip_handle_irq(void)
 {
 	unsigned int count_event = 1;
-	bool handled = false;
+	bool handled = false, for_cell = false;
 	u32 irq_id;
 
 	while (1) {
 		/* Read IAR1: set 'active' state */
-		irq_id = irqchip.read_iar_irqn();
+		irq_id = irqchip_op(read_iar_irqn)();
 
 		if (irq_id == 0x3ff) /* Spurious IRQ */
 			break;
@@ -192,8 +273,20 @@ void irqchip_handle_irq(void)
 		if (is_sgi(irq_id)) {
 			arch_handle_sgi(irq_id, count_event);
 			handled = true;
+			for_cell = true;
+		} else if (is_lpi(irq_id) && this_cell() != &root_cell) {
+			/*
+			 * The ITS belongs to the root cell. An LPI still
+			 * targeting a CPU that moved to another cell is handed
+			 * over to the root cell.
+			 */
+			irqchip_set_pending(
+				public_per_cpu(first_cpu(root_cell.cpu_set)),
+				irq_id);
+			handled = true;
 		} else {
 			handled = arch_handle_phys_irq(irq_id, count_event);
+			for_cell |= !handled;
 		}
 		count_event = 0;
 
@@ -203,8 +296,20 @@ void irqchip_handle_irq(void)
 		 * This allows to not be re-interrupted by a level-triggered
 		 * interrupt that needs handling in the guest (e.g. timer)
 		 */
-		irqchip.eoi_irq(irq_id, handled);
+		irqchip_op(eoi_irq)(irq_id, handled);
+
+		/*
+		 * A PPI forwarded to the cell, usually its timer, is
+		 * deactivated by the cell via the HW bit of the list register.
+		 * Return to the cell right away instead of polling IAR once
+		 * more for a spurious ID: any other pending interrupt simply
+		 * traps again.
+		 */
+		if (!handled && is_ppi(irq_id))
+			break;
 	}
+
+	return for_cell;
 }
 
 bool irqchip_irq_in_cell(struct cell *cell, unsigned int irq_id)
@@ -217,17 +322,19 @@ bool irqchip_irq_in_cell(struct cell *cell, unsigned int irq_id)
 
 bool irqchip_has_pending_irqs(void)
 {
-	return irqchip.has_pending_irqs();
+	return irqchip_op(has_pending_irqs)();
 }
 
-void irqchip_set_pending(struct public_per_cpu *cpu_public, u16 irq_id)
+void __hot irqchip_set_pending(struct public_per_cpu *cpu_public, u16 irq_id)
 {
 	struct pending_irqs *pending = &cpu_public->pending_irqs;
 	bool local_injection = (this_cpu_public() == cpu_public);
 	const u16 sender = this_cpu_id();
-	unsigned int new_tail;
 	struct sgi sgi;
 
+	trace_event(JAILHOUSE_TRACE_IRQ_PENDING,
+		    cpu_public ? cpu_public->cpu_id : -1, irq_id);
+
 	if (!cpu_public) {
 		/* Injection via GICD */
 		mmio_write32(gicd_base + GICD_ISPENDR + (irq_id / 32) * 4,
@@ -235,26 +342,20 @@ void irqchip_set_pending(struct public_per_cpu *cpu_public, u16 irq_id)
 		return;
 	}
 
-	if (local_injection && irqchip.inject_irq(irq_id, sender) != -EBUSY)
-		return;
-
-	spin_lock(&pending->lock);
-
-	new_tail = (pending->tail + 1) % MAX_PENDING_IRQS;
-
-	/* Queue space available? */
-	if (new_tail != pending->head) {
-		pending->irqs[pending->tail] = irq_id;
-		pending->sender[pending->tail] = sender;
-		pending->tail = new_tail;
-		/*
-		 * Make the change to pending_irqs.tail visible before the
-		 * caller sends SGI_INJECT.
-		 */
-		memory_barrier();
+	if (local_injection) {
+		if (irqchip_op(inject_irq)(irq_id, sender) != -EBUSY) {
+			cpu_public->stats[JAILHOUSE_CPU_STAT_IRQS_INJECTED]++;
+			return;
+		}
+		cpu_public->stats[JAILHOUSE_CPU_STAT_PENDING_OVERFLOWS]++;
 	}
 
-	spin_unlock(&pending->lock);
+	queue_pending(pending, irq_id, sender);
+
+	/*
+	 * Make the pending bit visible before the caller sends SGI_INJECT.
+	 */
+	memory_barrier();
 
 	/*
 	 * The list registers are full, trigger maintenance interrupt if we are
@@ -262,7 +363,7 @@ void irqchip_set_pending(struct public_per_cpu *cpu_public, u16 irq_id)
 	 * CPU.
 	 */
 	if (local_injection) {
-		irqchip.enable_maint_irq(true);
+		irqchip_op(enable_maint_irq)(true);
 	} else {
 		sgi.targets = irqchip_get_cpu_target(cpu_public->cpu_id);
 		sgi.cluster_id =
@@ -274,37 +375,110 @@ void irqchip_set_pending(struct public_per_cpu *cpu_public, u16 irq_id)
 	}
 }
 
-void irqchip_inject_pending(void)
+/*
+ * Called by the GIC drivers when an interrupt waiting in a list register was
+ * preempted by one of higher priority. It goes back to the software queue.
+ */
+void irqchip_requeue_irq(u16 irq_id, u16 sender)
+{
+	queue_pending(&this_cpu_public()->pending_irqs, irq_id, sender);
+	irqchip_op(enable_maint_irq)(true);
+}
+
+/*
+ * Moves the bits of a pending bitmap into the list registers. An interrupt
+ * that finds them full stays pending, but the scan goes on as a later one may
+ * still preempt an entry of lower priority. Returns false if bits are left,
+ * including those of preempted interrupts.
+ */
+static bool inject_pending_bitmap(volatile unsigned long *bitmap,
+				  unsigned int bits, bool sgis, u16 irq_base)
 {
-	struct pending_irqs *pending = &this_cpu_public()->pending_irqs;
+	u64 *stats = this_cpu_public()->stats;
+	unsigned long word, left = 0;
+	unsigned int n, bit;
 	u16 irq_id, sender;
 
-	while (pending->head != pending->tail) {
-		irq_id = pending->irqs[pending->head];
-		sender = pending->sender[pending->head];
+	for (n = 0; n < bits / BITS_PER_LONG; n++) {
+		word = bitmap[n];
+		while (word != 0) {
+			bit = ffsl(word);
+			word &= ~(1UL << bit);
+			bit += n * BITS_PER_LONG;
+			if (sgis) {
+				irq_id = bit / MAX_SGI_SENDERS;
+				sender = bit % MAX_SGI_SENDERS;
+			} else {
+				irq_id = irq_base + bit;
+				sender = 0;
+			}
 
-		if (irqchip.inject_irq(irq_id, sender) == -EBUSY) {
 			/*
-			 * The list registers are full, trigger maintenance
-			 * interrupt and leave.
+			 * Clear before injecting so that a concurrent
+			 * set_pending of the same IRQ is not lost.
 			 */
-			irqchip.enable_maint_irq(true);
-			return;
+			clear_bit(bit, bitmap);
+			if (irqchip_op(inject_irq)(irq_id, sender) == -EBUSY) {
+				set_bit(bit, bitmap);
+				stats[JAILHOUSE_CPU_STAT_PENDING_OVERFLOWS]++;
+				continue;
+			}
+			stats[JAILHOUSE_CPU_STAT_IRQS_INJECTED]++;
 		}
+	}
+
+	for (n = 0; n < bits / BITS_PER_LONG; n++)
+		left |= bitmap[n];
+
+	return left == 0;
+}
+
+void __hot irqchip_inject_pending(void)
+{
+	struct pending_irqs *pending = &this_cpu_public()->pending_irqs;
+	bool sgis_done, irqs_done, lpis_done = true;
+
+	/* scan all, an SPI may well have a higher priority than an SGI */
+	sgis_done = inject_pending_bitmap(pending->sgis, 16 * MAX_SGI_SENDERS,
+					  true, 0);
+	irqs_done = inject_pending_bitmap(pending->irqs, MAX_PENDING_IRQS,
+					  false, 0);
+
+	/*
+	 * The LPI bitmap is too large to be scanned on every call. Producers
+	 * set lpis_queued after the bit, so clearing it before the scan does
+	 * not lose any LPI.
+	 */
+	if (pending->lpis_queued) {
+		pending->lpis_queued = false;
+		memory_barrier();
+		lpis_done = inject_pending_bitmap(pending->lpis,
+						  MAX_PENDING_LPIS, false,
+						  GIC_LPI_BASE);
+		if (!lpis_done)
+			pending->lpis_queued = true;
+	}
 
-		pending->head = (pending->head + 1) % MAX_PENDING_IRQS;
+	if (!sgis_done || !irqs_done || !lpis_done) {
+		/*
+		 * The list registers are full, trigger maintenance
+		 * interrupt and leave.
+		 */
+		irqchip_op(enable_maint_irq)(true);
+		return;
 	}
 
 	/*
 	 * The software interrupt queue is empty - turn off the maintenance
 	 * interrupt.
 	 */
-	irqchip.enable_maint_irq(false);
+	irqchip_op(enable_maint_irq)(false);
 }
 
 int irqchip_send_sgi(struct sgi *sgi)
 {
-	return irqchip.send_sgi(sgi);
+	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_IPIS_SENT]++;
+	return irqchip_op(send_sgi)(sgi);
 }
 
 int irqchip_cpu_init(struct per_cpu *cpu_data)
@@ -314,12 +488,16 @@ int irqchip_cpu_init(struct per_cpu *cpu_data)
 	/* Only execute once, on master CPU */
 	if (!irqchip_is_init) {
 		switch (system_config->platform_info.arm.gic_version) {
+#ifndef CONFIG_ARM_GICV3_ONLY
 		case 2:
 			irqchip = gicv2_irqchip;
 			break;
+#endif
+#ifndef CONFIG_ARM_GICV2_ONLY
 		case 3:
 			irqchip = gicv3_irqchip;
 			break;
+#endif
 		default:
 			return trace_error(-EINVAL);
 		}
@@ -352,8 +530,8 @@ u64 irqchip_get_cluster_target(unsigned int cpu_id)
 
 void irqchip_cpu_reset(struct per_cpu *cpu_data)
 {
-	cpu_data->public.pending_irqs.head = 0;
-	cpu_data->public.pending_irqs.tail = 0;
+	memset(&cpu_data->public.pending_irqs, 0,
+	       sizeof(cpu_data->public.pending_irqs));
 
 	irqchip.cpu_reset(cpu_data);
 }
@@ -361,6 +539,7 @@ void irqchip_cpu_reset(struct per_cpu *cpu_data)
 void irqchip_cpu_shutdown(struct public_per_cpu *cpu_public)
 {
 	struct pending_irqs *pending = &cpu_public->pending_irqs;
+	unsigned int n;
 	int irq_id;
 
 	/*
@@ -384,13 +563,16 @@ void irqchip_cpu_shutdown(struct public_per_cpu *cpu_public)
 	} while (irq_id >= 0);
 
 	/* Migrate interrupts queued in software. */
-	while (pending->head != pending->tail) {
-		irq_id = pending->irqs[pending->head];
-
-		irqchip.inject_phys_irq(irq_id);
-
-		pending->head = (pending->head + 1) % MAX_PENDING_IRQS;
-	}
+	for (n = 0; n < 16 * MAX_SGI_SENDERS; n++)
+		if (test_bit(n, pending->sgis))
+			irqchip.inject_phys_irq(n / MAX_SGI_SENDERS);
+	for (n = 16; n < MAX_PENDING_IRQS; n++)
+		if (test_bit(n, pending->irqs))
+			irqchip.inject_phys_irq(n);
+	if (pending->lpis_queued)
+		for (n = 0; n < MAX_PENDING_LPIS; n++)
+			if (test_bit(n, pending->lpis))
+				irqchip.inject_phys_irq(GIC_LPI_BASE + n);
 }
 
 static int irqchip_cell_init(struct cell *cell)
@@ -416,13 +598,15 @@ static int irqchip_cell_init(struct cell *cell)
 	 */
 	cell->arch.irq_bitmap[0] = ~((1 << SGI_INJECT) | (1 << SGI_EVENT) |
 				     (1 << mnt_irq));
+	update_access_masks(cell);
 
 	err = irqchip.cell_init(cell);
 	if (err)
 		return err;
 
 	mmio_region_register(cell, system_config->platform_info.arm.gicd_base,
-			     irqchip.gicd_size, gic_handle_dist_access, NULL);
+			     irqchip.gicd_size, gic_handle_dist_access, NULL,
+			     "gicd");
 
 	if (cell == &root_cell)
 		return 0;
@@ -434,6 +618,7 @@ static int irqchip_cell_init(struct cell *cell)
 			root_cell.arch.irq_bitmap[chip->pin_base / 32 + pos] &=
 				~chip->pin_bitmap[pos];
 	}
+	update_access_masks(&root_cell);
 
 	return 0;
 }
@@ -481,6 +666,7 @@ static void irqchip_cell_exit(struct cell *cell)
 			root_cell.arch.irq_bitmap[chip->pin_base / 32 + pos] &=
 				chip->pin_bitmap[pos];
 	}
+	update_access_masks(&root_cell);
 
 	if (irqchip.cell_exit)
 		irqchip.cell_exit(cell);
@@ -493,6 +679,9 @@ void irqchip_config_commit(struct cell *cell_added_removed)
 	if (!cell_added_removed)
 		return;
 
+	if (irqchip.config_commit)
+		irqchip.config_commit(cell_added_removed);
+
 	for (n = 32; n < sizeof(cell_added_removed->arch.irq_bitmap) * 8; n++) {
 		if (irqchip_irq_in_cell(cell_added_removed, n))
 			irqchip.adjust_irq_target(cell_added_removed, n);
@@ -501,6 +690,12 @@ void irqchip_config_commit(struct cell *cell_added_removed)
 	}
 }
 
+void irqchip_cpu_move(unsigned int cpu_id, struct cell *from, struct cell *to)
+{
+	if (irqchip.cpu_move)
+		irqchip.cpu_move(cpu_id, from, to);
+}
+
 static unsigned int irqchip_mmio_count_regions(struct cell *cell)
 {
 	unsigned int regions = 1; /* GICD */
@@ -512,7 +707,7 @@ static unsigned int irqchip_mmio_count_regions(struct cell *cell)
 	return regions;
 }
 
-static int irqchip_init(void)
+static int __init irqchip_init(void)
 {
 	/* Setup the SPI bitmap */
 	return irqchip_cell_init(&root_cell);
@@ -13,30 +13,28 @@
 #include <jailhouse/ivshmem.h>
 #include <asm/irqchip.h>
 
-void arch_ivshmem_trigger_interrupt(struct ivshmem_endpoint *ive)
+void arch_ivshmem_trigger_interrupt(struct ivshmem_endpoint *ive,
+				    unsigned int vector)
 {
-	unsigned int irq_id = ive->arch.irq_id;
+	unsigned int irq_id = ive->arch.irq_id[vector];
 
 	if (irq_id)
 		irqchip_set_pending(NULL, irq_id);
 }
 
-int arch_ivshmem_update_msix(struct pci_device *device)
+int arch_ivshmem_update_msix(struct pci_device *device, unsigned int vector)
 {
 	struct ivshmem_endpoint *ive = device->ivshmem_endpoint;
 	unsigned int irq_id = 0;
 
-	if (device->info->num_msix_vectors == 0)
-		return 0;
-
-	if (!ivshmem_is_msix_masked(ive)) {
+	if (!ivshmem_is_msix_masked(ive, vector)) {
 		/* FIXME: validate MSI-X target address */
-		irq_id = device->msix_vectors[0].data;
+		irq_id = device->msix_vectors[vector].data;
 		if (irq_id < 32 || !irqchip_irq_in_cell(device->cell, irq_id))
 			return -EPERM;
 	}
 
-	ive->arch.irq_id = irq_id;
+	ive->arch.irq_id[vector] = irq_id;
 
 	return 0;
 }
@@ -49,6 +47,6 @@ void arch_ivshmem_update_intx(struct ivshmem_endpoint *ive)
 	if (device->info->num_msix_vectors != 0)
 		return;
 
-	ive->arch.irq_id = (ive->intx_ctrl_reg & IVSHMEM_INTX_ENABLE) ?
+	ive->arch.irq_id[0] = (ive->intx_ctrl_reg & IVSHMEM_INTX_ENABLE) ?
 		(32 + device->cell->config->vpci_irq_base + pin - 1) : 0;
 }
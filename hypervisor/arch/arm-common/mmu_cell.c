@@ -14,88 +14,367 @@
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
 #include <asm/sysregs.h>
+#include <asm/coloring.h>
 #include <asm/control.h>
 
+static pt_entry_t
+arm_paging_get_terminal(const struct paging_structures *pg_structs,
+			unsigned long virt, const struct paging **terminal)
+{
+	const struct paging *paging = pg_structs->root_paging;
+	page_table_t page_table = pg_structs->root_table;
+	pt_entry_t pte;
+
+	while (1) {
+		pte = paging->get_entry(page_table, virt);
+		if (!paging->entry_valid(pte, PAGE_PRESENT_FLAGS))
+			return NULL;
+		if (paging->get_phys(pte, virt) != INVALID_PHYS_ADDR) {
+			*terminal = paging;
+			return pte;
+		}
+		page_table = paging_phys2hvirt(paging->get_next_pt(pte));
+		paging++;
+	}
+}
+
+/*
+ * Clear the contiguous hint of the groups containing the first and the last
+ * page of a range that is about to be modified. Groups fully inside the range
+ * are rewritten or removed as a whole.
+ */
+static void
+arm_paging_clear_cont_hints(const struct paging_structures *pg_structs,
+			    unsigned long virt, unsigned long size)
+{
+	unsigned long addrs[2] = { virt, virt + size - PAGE_SIZE };
+	const struct paging *paging;
+	pt_entry_t pte, first;
+	unsigned int n, i;
+
+	for (i = 0; i < ARRAY_SIZE(addrs); i++) {
+		pte = arm_paging_get_terminal(pg_structs, addrs[i], &paging);
+		if (!pte || !(*pte & PTE_CONTIGUOUS))
+			continue;
+
+		first = pte - ((addrs[i] / paging->page_size) %
+			       PTE_CONT_ENTRIES);
+		for (n = 0; n < PTE_CONT_ENTRIES; n++)
+			first[n] &= ~PTE_CONTIGUOUS;
+		arch_paging_flush_cpu_caches(first,
+					     PTE_CONT_ENTRIES * sizeof(u64));
+	}
+}
+
+static bool arm_paging_cont_group_valid(const struct paging *paging,
+					pt_entry_t first, unsigned long virt,
+					unsigned long phys)
+{
+	unsigned long flags = paging->get_flags(first);
+	unsigned int n;
+
+	for (n = 1; n < PTE_CONT_ENTRIES; n++) {
+		virt += paging->page_size;
+		phys += paging->page_size;
+		if (!paging->entry_valid(&first[n], PAGE_PRESENT_FLAGS) ||
+		    paging->get_phys(&first[n], virt) != phys ||
+		    paging->get_flags(&first[n]) != flags)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Mark groups of PTE_CONT_ENTRIES terminal entries with the contiguous hint
+ * where they map an aligned, physically contiguous block with identical
+ * attributes. This lets the TLB hold 64K or 32M with a single entry. 1G
+ * blocks are left alone.
+ */
+static void
+arm_paging_set_cont_hints(const struct paging_structures *pg_structs,
+			  unsigned long virt, unsigned long size)
+{
+	unsigned long end = virt + size, group_size, phys;
+	const struct paging *paging;
+	pt_entry_t pte;
+	unsigned int n;
+
+	while (virt < end) {
+		pte = arm_paging_get_terminal(pg_structs, virt, &paging);
+		if (!pte) {
+			virt += PAGE_SIZE;
+			continue;
+		}
+		if (paging->page_size > 2 * 1024 * 1024) {
+			virt = (virt & ~(paging->page_size - 1)) +
+				paging->page_size;
+			continue;
+		}
+
+		group_size = paging->page_size * PTE_CONT_ENTRIES;
+		phys = paging->get_phys(pte, virt);
+		if ((virt & (group_size - 1)) == 0 &&
+		    (phys & (group_size - 1)) == 0 &&
+		    end - virt >= group_size &&
+		    arm_paging_cont_group_valid(paging, pte, virt, phys)) {
+			for (n = 0; n < PTE_CONT_ENTRIES; n++)
+				pte[n] |= PTE_CONTIGUOUS;
+			arch_paging_flush_cpu_caches(pte, PTE_CONT_ENTRIES *
+							  sizeof(u64));
+			virt += group_size;
+		} else {
+			virt = (virt & ~(paging->page_size - 1)) +
+				paging->page_size;
+		}
+	}
+}
+
+/*
+ * Non-root cells see the runs of a colored region packed from virt_start on,
+ * the root cell keeps its 1:1 mapping with holes.
+ */
+static int arm_colored_region_update(struct cell *cell,
+				     const struct jailhouse_memory *mem,
+				     u32 flags, bool map)
+{
+	unsigned long offset = 0, virt = mem->virt_start, size;
+	int err;
+
+	while (coloring_next_run(mem, &offset, &size)) {
+		if (cell == &root_cell)
+			virt = mem->virt_start + offset;
+
+		arm_paging_clear_cont_hints(&cell->arch.mm, virt, size);
+		if (map) {
+			err = paging_create(&cell->arch.mm,
+					    mem->phys_start + offset, size,
+					    virt, flags, PAGING_COHERENT);
+			if (err)
+				return err;
+			arm_paging_set_cont_hints(&cell->arch.mm, virt, size);
+		} else {
+			err = paging_destroy(&cell->arch.mm, virt, size,
+					     PAGING_COHERENT);
+			if (err)
+				return err;
+		}
+
+		offset += size;
+		virt += size;
+	}
+	return 0;
+}
+
 int arch_map_memory_region(struct cell *cell,
 			   const struct jailhouse_memory *mem)
 {
 	u64 phys_start = mem->phys_start;
 	u32 flags = PTE_FLAG_VALID | PTE_ACCESS_FLAG;
+	int err;
 
 	if (mem->flags & JAILHOUSE_MEM_READ)
 		flags |= S2_PTE_ACCESS_RO;
 	if (mem->flags & JAILHOUSE_MEM_WRITE)
 		flags |= S2_PTE_ACCESS_WO;
-	if (mem->flags & JAILHOUSE_MEM_IO)
-		flags |= S2_PTE_FLAG_DEVICE;
-	else
+	/*
+	 * Stage 2 can only restrict the cell's own attributes. WC maps to
+	 * normal non-cacheable memory.
+	 */
+	switch (mem->flags & JAILHOUSE_MEM_TYPE_MASK) {
+	case JAILHOUSE_MEM_TYPE_WB:
 		flags |= S2_PTE_FLAG_NORMAL;
-	if (mem->flags & JAILHOUSE_MEM_COMM_REGION)
+		break;
+	case JAILHOUSE_MEM_TYPE_WC:
+		flags |= S2_PTE_FLAG_NC;
+		break;
+	case JAILHOUSE_MEM_TYPE_UC:
+		flags |= S2_PTE_FLAG_DEVICE;
+		break;
+	default:
+		if (mem->flags & JAILHOUSE_MEM_IO)
+			flags |= S2_PTE_FLAG_DEVICE;
+		else
+			flags |= S2_PTE_FLAG_NORMAL;
+		break;
+	}
+	if (mem->flags & JAILHOUSE_MEM_TIMEBASE) {
+		phys_start = paging_hvirt2phys(&timebase_page);
+		flags &= ~S2_PTE_ACCESS_WO;
+	} else if (mem->flags & JAILHOUSE_MEM_COMM_REGION) {
 		phys_start = paging_hvirt2phys(&cell->comm_page);
+	}
 	/*
 	if (!(mem->flags & JAILHOUSE_MEM_EXECUTE))
 		flags |= S2_PAGE_ACCESS_XN;
 	*/
 
-	return paging_create(&cell->arch.mm, phys_start, mem->size,
-			     mem->virt_start, flags, PAGING_COHERENT);
+	if (mem->flags & JAILHOUSE_MEM_COLORED)
+		return arm_colored_region_update(cell, mem, flags, true);
+
+	arm_paging_clear_cont_hints(&cell->arch.mm, mem->virt_start,
+				    mem->size);
+
+	err = paging_create(&cell->arch.mm, phys_start, mem->size,
+			    mem->virt_start, flags, PAGING_COHERENT);
+	if (err)
+		return err;
+
+	arm_paging_set_cont_hints(&cell->arch.mm, mem->virt_start, mem->size);
+	return 0;
 }
 
 int arch_unmap_memory_region(struct cell *cell,
 			     const struct jailhouse_memory *mem)
 {
+	if (mem->flags & JAILHOUSE_MEM_COLORED)
+		return arm_colored_region_update(cell, mem, 0, false);
+
+	arm_paging_clear_cont_hints(&cell->arch.mm, mem->virt_start,
+				    mem->size);
+
 	return paging_destroy(&cell->arch.mm, mem->virt_start, mem->size,
 			      PAGING_COHERENT);
 }
 
+const struct paging_structures *arch_paging_cell_structs(struct cell *cell)
+{
+	return &cell->arch.mm;
+}
+
 unsigned long arch_paging_gphys2phys(unsigned long gphys, unsigned long flags)
 {
 	/* Translate IPA->PA */
 	return paging_virt2phys(&this_cell()->arch.mm, gphys, flags);
 }
 
-void arm_cell_dcaches_flush(struct cell *cell, enum dcache_flush flush)
+/* Other colors of a colored region are not ours to touch. */
+bool arch_mem_region_next_run(const struct jailhouse_memory *mem,
+			      unsigned long *offset, unsigned long *size)
 {
-	unsigned long region_addr, region_size, size;
-	struct jailhouse_memory const *mem;
-	unsigned int n;
+	if (mem->flags & JAILHOUSE_MEM_COLORED)
+		return coloring_next_run(mem, offset, size);
 
-	for_each_mem_region(mem, cell->config, n) {
-		if (mem->flags & (JAILHOUSE_MEM_IO | JAILHOUSE_MEM_COMM_REGION))
-			continue;
+	*size = mem->size - *offset;
+	return true;
+}
 
-		region_addr = mem->phys_start;
-		region_size = mem->size;
+/*
+ * Cell memory is flushed in chunks of the temporary mapping size. The CPUs
+ * that are suspended while the flush is in progress - the cell's CPUs and
+ * those of the root cell during cell management - claim chunks from this
+ * job as well, see arm_cell_dcaches_flush_assist.
+ */
+static DEFINE_SPINLOCK(dcache_flush_lock);
+static struct {
+	struct cell *cell;
+	enum dcache_flush flush;
+	unsigned int region;
+	unsigned long offset;
+	unsigned int helpers;
+} dcache_flush_job;
 
-		while (region_size > 0) {
-			size = MIN(region_size,
-				   NUM_TEMPORARY_PAGES * PAGE_SIZE);
+/* Must be called with dcache_flush_lock held. */
+static bool dcache_flush_claim_chunk(unsigned long *addr, unsigned long *size)
+{
+	struct cell *cell = dcache_flush_job.cell;
+	const struct jailhouse_memory *mem;
+	unsigned long run_size;
 
-			/* cannot fail, mapping area is preallocated */
-			paging_create(&this_cpu_data()->pg_structs, region_addr,
-				      size, TEMPORARY_MAPPING_BASE,
-				      PAGE_DEFAULT_FLAGS, PAGING_NON_COHERENT);
+	if (!cell)
+		return false;
 
-			arm_dcaches_flush((void *)TEMPORARY_MAPPING_BASE, size,
-					  flush);
+	while (dcache_flush_job.region < cell->config->num_memory_regions) {
+		mem = &jailhouse_cell_mem_regions(cell->config)
+			[dcache_flush_job.region];
 
-			region_addr += size;
-			region_size -= size;
+		/* only flush memory that changes its owner */
+		if (!(mem->flags & (JAILHOUSE_MEM_IO |
+				    JAILHOUSE_MEM_COMM_REGION |
+				    JAILHOUSE_MEM_ROOTSHARED)) &&
+		    dcache_flush_job.offset < mem->size &&
+		    arch_mem_region_next_run(mem, &dcache_flush_job.offset,
+					     &run_size)) {
+			*addr = mem->phys_start + dcache_flush_job.offset;
+			*size = MIN(run_size, NUM_TEMPORARY_PAGES * PAGE_SIZE);
+			dcache_flush_job.offset += *size;
+			return true;
 		}
+
+		dcache_flush_job.region++;
+		dcache_flush_job.offset = 0;
 	}
+	return false;
+}
+
+static void dcache_flush_chunks(enum dcache_flush flush)
+{
+	unsigned long addr, size;
+
+	while (dcache_flush_claim_chunk(&addr, &size)) {
+		spin_unlock(&dcache_flush_lock);
+
+		/* cannot fail, mapping area is preallocated */
+		arm_dcaches_flush(paging_map_temporary(addr, PAGES(size),
+						       PAGE_DEFAULT_FLAGS),
+				  size, flush);
+
+		spin_lock(&dcache_flush_lock);
+	}
+}
+
+void arm_cell_dcaches_flush(struct cell *cell, enum dcache_flush flush)
+{
+	spin_lock(&dcache_flush_lock);
+
+	dcache_flush_job.flush = flush;
+	dcache_flush_job.region = 0;
+	dcache_flush_job.offset = 0;
+	dcache_flush_job.cell = cell;
+
+	dcache_flush_chunks(flush);
+
+	/* no more chunks left, wait for the helpers to finish theirs */
+	dcache_flush_job.cell = NULL;
+	spin_unlock(&dcache_flush_lock);
+
+	while (dcache_flush_job.helpers > 0)
+		cpu_relax();
 
 	/* ensure completion of the flush */
 	dmb(ish);
 }
 
+/**
+ * Help with a pending cell cache flush.
+ *
+ * Called by CPUs while they are waiting in suspended state.
+ */
+void arm_cell_dcaches_flush_assist(void)
+{
+	if (!dcache_flush_job.cell)
+		return;
+
+	spin_lock(&dcache_flush_lock);
+	if (dcache_flush_job.cell) {
+		dcache_flush_job.helpers++;
+		dcache_flush_chunks(dcache_flush_job.flush);
+		dcache_flush_job.helpers--;
+	}
+	spin_unlock(&dcache_flush_lock);
+}
+
 int arm_paging_cell_init(struct cell *cell)
 {
 	if (cell->config->id > 0xff)
 		return trace_error(-E2BIG);
 
 	cell->arch.mm.root_paging = cell_paging;
+	cell->arch.mm.pt_pool = numa_cell_pool(cell);
+	/* see cell_map_lazy */
+	cell->arch.mm.no_merge =
+		!!(cell->config->flags & JAILHOUSE_CELL_LAZY_MEMORY);
 	cell->arch.mm.root_table =
-		page_alloc_aligned(&mem_pool, CELL_ROOT_PT_PAGES);
+		page_alloc_aligned(cell->arch.mm.pt_pool, CELL_ROOT_PT_PAGES);
 
 	if (!cell->arch.mm.root_table)
 		return -ENOMEM;
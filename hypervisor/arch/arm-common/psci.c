@@ -33,6 +33,13 @@ static long psci_emulate_cpu_on(struct trap_context *ctx)
 
 	target_data = public_per_cpu(cpu);
 
+	/*
+	 * Report a running target without taking its lock. If it is just
+	 * turning itself off, this is equivalent to an earlier CPU_ON.
+	 */
+	if (!target_data->wait_for_poweron)
+		return PSCI_ALREADY_ON;
+
 	spin_lock(&target_data->control_lock);
 
 	if (target_data->wait_for_poweron) {
@@ -96,11 +103,13 @@ long psci_dispatch(struct trap_context *ctx)
 
 	case PSCI_CPU_SUSPEND_32:
 	case PSCI_CPU_SUSPEND_64:
-		if (!irqchip_has_pending_irqs()) {
-			asm volatile("wfi" : : : "memory");
-			irqchip_handle_irq();
-		}
-		return 0;
+		/*
+		 * Standby and power-down states are both emulated by waiting
+		 * for an interrupt. An early return from a power-down state is
+		 * permitted, the caller then resumes after the call.
+		 */
+		arm_cpu_idle();
+		return PSCI_SUCCESS;
 
 	case PSCI_CPU_OFF:
 	case PSCI_CPU_OFF_V0_1_UBOOT:
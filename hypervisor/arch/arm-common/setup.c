@@ -13,6 +13,7 @@
 #include <jailhouse/control.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/processor.h>
+#include <asm/control.h>
 #include <asm/setup.h>
 
 static u32 __attribute__((aligned(PAGE_SIZE))) parking_code[PAGE_SIZE / 4] = {
@@ -41,6 +42,7 @@ int arm_cpu_init(struct per_cpu *cpu_data)
 	cpu_data->public.mpidr = phys_processor_id();
 
 	arm_paging_vcpu_init(&root_cell.arch.mm);
+	arm_cpu_set_idle_policy();
 
 	return irqchip_cpu_init(cpu_data);
 }
@@ -11,10 +11,48 @@
  */
 
 #include <jailhouse/control.h>
+#include <jailhouse/printk.h>
 #include <asm/psci.h>
+#include <asm/smc.h>
 #include <asm/traps.h>
 #include <asm/smccc.h>
 
+/* first function ID after PSCI in the standard service block */
+#define PSCI_FUNCTION_END	0x20
+
+int smccc_cell_init(struct cell *cell)
+{
+	const struct jailhouse_smc_range *range =
+		jailhouse_cell_smc_ranges(cell->config);
+	unsigned int n;
+	u32 end;
+
+	for (n = 0; n < cell->config->num_smc_ranges; n++, range++) {
+		end = range->start + range->length - 1;
+		if (range->length == 0 || end < range->start ||
+		    (range->start >> 16) != (end >> 16) ||
+		    SMCCC_GET_OWNER(range->start) == ARM_SMCCC_OWNER_ARCH ||
+		    (SMCCC_GET_OWNER(range->start) ==
+		     ARM_SMCCC_OWNER_STANDARD &&
+		     (range->start & 0xffff) < PSCI_FUNCTION_END))
+			return trace_error(-EINVAL);
+	}
+	return 0;
+}
+
+static bool smc_forward_permitted(u32 function_id)
+{
+	const struct jailhouse_cell_desc *config = this_cell()->config;
+	const struct jailhouse_smc_range *range =
+		jailhouse_cell_smc_ranges(config);
+	unsigned int n;
+
+	for (n = 0; n < config->num_smc_ranges; n++, range++)
+		if (function_id - range->start < range->length)
+			return true;
+	return false;
+}
+
 static long handle_arch(struct trap_context *ctx)
 {
 	u32 function_id = ctx->regs[0];
@@ -33,7 +71,19 @@ static long handle_arch(struct trap_context *ctx)
 enum trap_return handle_smc(struct trap_context *ctx)
 {
 	unsigned long *regs = ctx->regs;
-	u32 *stats = this_cpu_public()->stats;
+	u64 *stats = this_cpu_public()->stats;
+
+	/*
+	 * Permitted calls go straight to the firmware. Arch calls and PSCI
+	 * cannot be permitted, see smccc_cell_init.
+	 */
+	if (this_cell()->config->num_smc_ranges > 0 &&
+	    smc_forward_permitted(regs[0])) {
+		stats[JAILHOUSE_CPU_STAT_VMEXITS_SMCCC]++;
+		smc_forward(regs);
+		arch_skip_instruction(ctx);
+		return TRAP_HANDLED;
+	}
 
 	switch (SMCCC_GET_OWNER(regs[0])) {
 	case ARM_SMCCC_OWNER_ARCH:
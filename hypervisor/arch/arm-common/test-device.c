@@ -0,0 +1,20 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <jailhouse/control.h>
+#include <asm/irqchip.h>
+
+int arch_testdev_inject_irq(unsigned int irq)
+{
+	if (!irqchip_irq_in_cell(this_cell(), irq))
+		return -EPERM;
+
+	irqchip_set_pending(this_cpu_public(), irq);
+	return 0;
+}
@@ -16,6 +16,7 @@
 #include <jailhouse/printk.h>
 #include <jailhouse/string.h>
 #include <asm/control.h>
+#include <asm/iommu.h>
 #include <asm/irqchip.h>
 #include <asm/psci.h>
 #include <asm/sysregs.h>
@@ -84,6 +85,9 @@ void arm_cpu_reset(unsigned long pc)
 	arm_write_sysreg(TPIDRURO, 0);
 	arm_write_sysreg(TPIDRPRW, 0);
 
+	/* drop set/way tracking state of the previous guest */
+	arm_write_sysreg(HSTR, 0);
+
 	arm_write_banked_reg(SPSR_hyp, RESET_PSR);
 	arm_write_banked_reg(ELR_hyp, pc);
 
@@ -91,10 +95,24 @@ void arm_cpu_reset(unsigned long pc)
 	this_cpu_data()->guest_regs.usr[1] = this_cpu_public()->cpu_on_context;
 
 	arm_paging_vcpu_init(&this_cell()->arch.mm);
+	arm_cpu_set_idle_policy();
 
 	irqchip_cpu_reset(this_cpu_data());
 }
 
+/* No SMMU support on ARMv7. */
+void iommu_config_commit(struct cell *cell_added_removed)
+{
+}
+
+void arch_scrub_memory(void *addr, unsigned long size)
+{
+	memset(addr, 0, size);
+
+	/* the cell's caches are invalidated afterwards, push the zeros out */
+	arm_dcaches_flush(addr, size, DCACHE_CLEAN);
+}
+
 #ifdef CONFIG_CRASH_CELL_ON_PANIC
 void arch_panic_park(void)
 {
@@ -77,6 +77,13 @@
 #define PTE_FLAG_TERMINAL	(0x1 << 1)
 #define PTE_FLAG_VALID		(0x1 << 0)
 
+/*
+ * Upper attribute, not passed via the core's flags but set directly on groups
+ * of PTE_CONT_ENTRIES aligned entries, see arm_paging_set_cont_hints.
+ */
+#define PTE_CONTIGUOUS		(1ULL << 52)
+#define PTE_CONT_ENTRIES	16
+
 /* These bits differ in stage 1 and 2 translations */
 #define S1_PTE_NG		(0x1 << 11)
 #define S1_PTE_ACCESS_RW	(0x0 << 7)
@@ -143,6 +150,7 @@
 /* Stage 2 memory attributes (MemAttr[3:0]) */
 #define S2_MEMATTR_OWBIWB	0xf
 #define S2_MEMATTR_DEV		0x1
+#define S2_MEMATTR_NC		0x5
 
 #define S1_PTE_FLAG_NORMAL	PTE_MEMATTR(HMAIR_IDX_WBRAWA)
 #define S1_PTE_FLAG_DEVICE	PTE_MEMATTR(HMAIR_IDX_DEV)
@@ -150,6 +158,7 @@
 
 #define S2_PTE_FLAG_NORMAL	PTE_MEMATTR(S2_MEMATTR_OWBIWB)
 #define S2_PTE_FLAG_DEVICE	PTE_MEMATTR(S2_MEMATTR_DEV)
+#define S2_PTE_FLAG_NC		PTE_MEMATTR(S2_MEMATTR_NC)
 
 #define S1_DEFAULT_FLAGS	(PTE_FLAG_VALID | PTE_ACCESS_FLAG	\
 				| S1_PTE_FLAG_NORMAL | PTE_INNER_SHAREABLE\
@@ -200,6 +209,30 @@ static inline void arm_paging_vcpu_flush_tlbs(void)
 	arm_write_sysreg(TLBIALL, 0);
 }
 
+static inline void arm_paging_vcpu_flush_tlbs_range(unsigned long start,
+						    unsigned long end)
+{
+	/*
+	 * Stage-1 entries need to be dropped for the whole VMID anyway, and
+	 * TLBIALL covers stage 2 as well, so IPA-based invalidation would not
+	 * save anything here.
+	 */
+	arm_paging_vcpu_flush_tlbs();
+}
+
+struct cell;
+
+/*
+ * TLBIALL only acts on the local CPU, so each CPU of the cell has to flush
+ * itself.
+ */
+static inline bool arm_paging_cell_flush_tlbs_range(struct cell *cell,
+						    unsigned long start,
+						    unsigned long end)
+{
+	return false;
+}
+
 /* return the bits supported for the physical address range for this
  * machine; in arch_paging_init this value will be kept in
  * cpu_parange for later reference */
@@ -59,6 +59,20 @@ static inline void memory_load_barrier(void)
 {
 }
 
+/**
+ * Read the physical count of the generic timer.
+ *
+ * @return Current counter value.
+ */
+static inline u64 read_timestamp(void)
+{
+	u64 val;
+
+	isb();
+	arm_read_sysreg(CNTPCT_EL0, val);
+	return val;
+}
+
 static inline bool is_el2(void)
 {
 	u32 psr;
@@ -0,0 +1,40 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_SMC_H
+#define _JAILHOUSE_ASM_SMC_H
+
+/**
+ * Issue an SMC with the arguments r0..r7 taken from @p regs and store the
+ * results r0..r3 back. r4..r7 are preserved by the SMC calling convention.
+ */
+static inline void smc_forward(unsigned long *regs)
+{
+	register unsigned long r0 asm("r0") = regs[0];
+	register unsigned long r1 asm("r1") = regs[1];
+	register unsigned long r2 asm("r2") = regs[2];
+	register unsigned long r3 asm("r3") = regs[3];
+	register unsigned long r4 asm("r4") = regs[4];
+	register unsigned long r5 asm("r5") = regs[5];
+	register unsigned long r6 asm("r6") = regs[6];
+	register unsigned long r7 asm("r7") = regs[7];
+
+	asm volatile(".arch_extension sec\n\t"
+		     "smc #0"
+		: "+r" (r0), "+r" (r1), "+r" (r2), "+r" (r3)
+		: "r" (r4), "r" (r5), "r" (r6), "r" (r7)
+		: "memory");
+
+	regs[0] = r0;
+	regs[1] = r1;
+	regs[2] = r2;
+	regs[3] = r3;
+}
+
+#endif /* !_JAILHOUSE_ASM_SMC_H */
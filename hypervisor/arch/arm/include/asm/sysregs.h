@@ -101,6 +101,7 @@
 #define CPACR_EL1	SYSREG_32(0, c1, c0, 2)
 #define CONTEXTIDR_EL1	SYSREG_32(0, c13, c0, 1)
 #define CSSIDR_EL1	SYSREG_32(1, c0, c0, 0)
+#define CCSIDR_EL1	CSSIDR_EL1
 #define CLIDR_EL1	SYSREG_32(1, c0, c0, 1)
 #define CSSELR_EL1	SYSREG_32(2, c0, c0, 0)
 #define SCTLR_EL2	SYSREG_32(4, c1, c0, 0)
@@ -178,7 +179,10 @@
 #define DACR		SYSREG_32(0, c3, c0, 0)
 #define VBAR		SYSREG_32(0, c12, c0, 0)
 #define HCR		SYSREG_32(4, c1, c1, 0)
+#define HCR_EL2		HCR
 #define HCR2		SYSREG_32(4, c1, c1, 4)
+#define HSTR		SYSREG_32(4, c1, c1, 3)
+#define  HSTR_T1_BIT	(1 << 1)
 #define  HCR_TRVM_BIT	(1 << 30)
 #define  HCR_TVM_BIT	(1 << 26)
 #define  HCR_HDC_BIT	(1 << 29)
@@ -10,6 +10,7 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <jailhouse/control.h>
 #include <jailhouse/mmio.h>
 #include <jailhouse/pci.h>
 #include <jailhouse/printk.h>
@@ -62,7 +63,7 @@ static void arch_inject_dabt(struct trap_context *ctx, unsigned long addr)
 	arm_write_sysreg(DFAR, addr);
 }
 
-enum trap_return arch_handle_dabt(struct trap_context *ctx)
+enum trap_return __hot arch_handle_dabt(struct trap_context *ctx)
 {
 	enum mmio_result mmio_result;
 	struct mmio_access mmio;
@@ -87,6 +88,13 @@ enum trap_return arch_handle_dabt(struct trap_context *ctx)
 
 	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_VMEXITS_MMIO]++;
 
+	/*
+	 * First access to lazily mapped RAM, also during a stage-1 page
+	 * walk. Let the guest retry.
+	 */
+	if (cell_map_lazy(mmio.address))
+		return TRAP_HANDLED;
+
 	/*
 	 * Invalid instruction syndrome means multiple access or writeback, there
 	 * is nothing we can do.
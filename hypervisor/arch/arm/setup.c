@@ -38,7 +38,7 @@ static int arch_check_features(void)
 	return 0;
 }
 
-int arch_init_early(void)
+int __init arch_init_early(void)
 {
 	int err;
 
@@ -49,7 +49,7 @@ int arch_init_early(void)
 	return arm_init_early();
 }
 
-int arch_cpu_init(struct per_cpu *cpu_data)
+int __init arch_cpu_init(struct per_cpu *cpu_data)
 {
 	int err;
 
@@ -123,6 +123,7 @@ void arch_shutdown_self(struct per_cpu *cpu_data)
 
 	/* Free the guest */
 	arm_write_sysreg(HCR, 0);
+	arm_write_sysreg(HSTR, 0);
 	arm_write_sysreg(VTCR_EL2, 0);
 
 	/* Remove stage-2 mappings */
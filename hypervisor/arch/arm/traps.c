@@ -15,7 +15,10 @@
  */
 
 #include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/trace.h>
+#include <jailhouse/uart.h>
 #include <asm/control.h>
 #include <asm/gic.h>
 #include <asm/psci.h>
@@ -277,22 +280,33 @@ static enum trap_return arch_handle_hvc(struct trap_context *ctx)
 	return TRAP_HANDLED;
 }
 
+static void arm_write_sctlr(u32 val)
+{
+	u32 old_sctlr, hstr;
+
+	arm_read_sysreg(SCTLR_EL1, old_sctlr);
+
+	arm_write_sysreg(SCTLR_EL1, val);
+
+	/* Check if caches were turned on or off. */
+	if (SCTLR_C_AND_M_SET(val) != SCTLR_C_AND_M_SET(old_sctlr)) {
+		/* Flush dcaches again if they were enabled before. */
+		if (SCTLR_C_AND_M_SET(old_sctlr))
+			arm_cell_dcaches_flush(this_cell(),
+					       DCACHE_CLEAN_AND_INVALIDATE);
+		/* Stop tracking the cache state. */
+		arm_read_sysreg(HSTR, hstr);
+		arm_write_sysreg(HSTR, hstr & ~HSTR_T1_BIT);
+	}
+}
+
 static enum trap_return arch_handle_cp15_32(struct trap_context *ctx)
 {
 	u32 hsr = ctx->hsr;
 	u32 rt = (hsr >> 5) & 0xf;
 	u32 read = hsr & 1;
-	u32 hcr, old_sctlr;
 	unsigned long val;
-
-#define CP15_32_PERFORM_WRITE(crn, opc1, crm, opc2) ({			\
-	bool match = false;						\
-	if (HSR_MATCH_MCR_MRC(hsr, crn, opc1, crm, opc2)) {		\
-		arm_write_sysreg_32(opc1, c##crn, c##crm, opc2, val);	\
-		match = true;						\
-	}								\
-	match;								\
-})
+	u32 hstr;
 
 	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_VMEXITS_CP15]++;
 
@@ -305,6 +319,22 @@ static enum trap_return arch_handle_cp15_32(struct trap_context *ctx)
 		if (read)
 			arm_read_sysreg(ACTLR_EL1, val);
 	}
+	/*
+	 * Trapped if HSTR.T1 is set. Unlike HCR.TVM, this leaves the
+	 * translation table, fault and context ID registers alone that guests
+	 * write on every context switch.
+	 */
+	else if (HSR_MATCH_MCR_MRC(hsr, 1, 0, 0, 0)) { /* SCTLR */
+		if (read)
+			arm_read_sysreg(SCTLR_EL1, val);
+		else
+			arm_write_sctlr(val);
+	} else if (HSR_MATCH_MCR_MRC(hsr, 1, 0, 0, 2)) { /* CPACR */
+		if (read)
+			arm_read_sysreg(CPACR_EL1, val);
+		else
+			arm_write_sysreg(CPACR_EL1, val);
+	}
 	/* all other regs are write-only / only trapped on writes */
 	else if (read) {
 		return TRAP_UNHANDLED;
@@ -313,42 +343,18 @@ static enum trap_return arch_handle_cp15_32(struct trap_context *ctx)
 	else if (HSR_MATCH_MCR_MRC(hsr, 7, 0, 6, 2) ||  /* DCISW */
 		   HSR_MATCH_MCR_MRC(hsr, 7, 0, 10, 2) || /* DCCSW */
 		   HSR_MATCH_MCR_MRC(hsr, 7, 0, 14, 2)) { /* DCCISW */
-		arm_read_sysreg(HCR, hcr);
-		if (!(hcr & HCR_TVM_BIT)) {
+		/*
+		 * Set/way operations cannot be confined to the cell, so the
+		 * first one cleans all of its memory by VA. Further ones are
+		 * dropped until the cell turns its caches on or off.
+		 */
+		arm_read_sysreg(HSTR, hstr);
+		if (!(hstr & HSTR_T1_BIT)) {
 			arm_cell_dcaches_flush(this_cell(),
 					       DCACHE_CLEAN_AND_INVALIDATE);
-			arm_write_sysreg(HCR, hcr | HCR_TVM_BIT);
+			arm_write_sysreg(HSTR, hstr | HSTR_T1_BIT);
 		}
-	}
-	/* trapped if HCR.TVM is set */
-	else if (HSR_MATCH_MCR_MRC(hsr, 1, 0, 0, 0)) { /* SCTLR */
-		arm_read_sysreg(SCTLR_EL1, old_sctlr);
-
-		arm_write_sysreg(SCTLR_EL1, val);
-
-		/* Check if caches were turned on or off. */
-		if (SCTLR_C_AND_M_SET(val) != SCTLR_C_AND_M_SET(old_sctlr)) {
-			/* Flush dcaches again if they were enabled before. */
-			if (SCTLR_C_AND_M_SET(old_sctlr))
-				arm_cell_dcaches_flush(this_cell(),
-						DCACHE_CLEAN_AND_INVALIDATE);
-			/* Stop tracking VM control regs. */
-			arm_read_sysreg(HCR, hcr);
-			arm_write_sysreg(HCR, hcr & ~HCR_TVM_BIT);
-		}
-	} else if (!(CP15_32_PERFORM_WRITE(2, 0, 0, 0) ||   /* TTBR0 */
-		     CP15_32_PERFORM_WRITE(2, 0, 0, 1) ||   /* TTBR1 */
-		     CP15_32_PERFORM_WRITE(2, 0, 0, 2) ||   /* TTBCR */
-		     CP15_32_PERFORM_WRITE(3, 0, 0, 0) ||   /* DACR */
-		     CP15_32_PERFORM_WRITE(5, 0, 0, 0) ||   /* DFSR */
-		     CP15_32_PERFORM_WRITE(5, 0, 0, 1) ||   /* IFSR */
-		     CP15_32_PERFORM_WRITE(6, 0, 0, 0) ||   /* DFAR */
-		     CP15_32_PERFORM_WRITE(6, 0, 0, 2) ||   /* IFAR */
-		     CP15_32_PERFORM_WRITE(5, 0, 1, 0) ||   /* ADFSR */
-		     CP15_32_PERFORM_WRITE(5, 0, 1, 1) ||   /* AIDSR */
-		     CP15_32_PERFORM_WRITE(10, 0, 2, 0) ||  /* PRRR / MAIR0 */
-		     CP15_32_PERFORM_WRITE(10, 0, 2, 1) ||  /* NMRR / MAIR1 */
-		     CP15_32_PERFORM_WRITE(13, 0, 0, 1))) { /* CONTEXTIDR */
+	} else {
 		return TRAP_UNHANDLED;
 	}
 
@@ -368,15 +374,6 @@ static enum trap_return arch_handle_cp15_64(struct trap_context *ctx)
 	u32 read = hsr & 1;
 	unsigned long lo, hi;
 
-#define CP15_64_PERFORM_WRITE(opc1, crm) ({		\
-	bool match = false;				\
-	if (HSR_MATCH_MCRR_MRRC(hsr, opc1, crm)) {	\
-		arm_write_sysreg_64(opc1, c##crm, ((u64)hi << 32) | lo); \
-		match = true;				\
-	}						\
-	match;						\
-})
-
 	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_VMEXITS_CP15]++;
 
 	/* all regs are write-only / only trapped on writes */
@@ -387,15 +384,9 @@ static enum trap_return arch_handle_cp15_64(struct trap_context *ctx)
 	access_cell_reg(ctx, rt2, &hi, true);
 
 	/* trapped by HCR.IMO/FMO */
-	if (HSR_MATCH_MCRR_MRRC(ctx->hsr, 0, 12)) { /* ICC_SGI1R */
-		if (!gicv3_handle_sgir_write(((u64)hi << 32) | lo))
-			return TRAP_UNHANDLED;
-	} else {
-		/* trapped if HCR.TVM is set */
-		if (!(CP15_64_PERFORM_WRITE(0, 2) ||	/* TTBR0 */
-		    CP15_64_PERFORM_WRITE(1, 2)))	/* TTBR1 */
-			return TRAP_UNHANDLED;
-	}
+	if (!HSR_MATCH_MCRR_MRRC(ctx->hsr, 0, 12) || /* ICC_SGI1R */
+	    !gicv3_handle_sgir_write(((u64)hi << 32) | lo))
+		return TRAP_UNHANDLED;
 
 	arch_skip_instruction(ctx);
 
@@ -409,6 +400,10 @@ static enum trap_return handle_iabt(struct trap_context *ctx)
 	arm_read_sysreg(HPFAR, hpfar);
 	arm_read_sysreg(HDFAR, hdfar);
 
+	/* first fetch from lazily mapped RAM, let the guest retry */
+	if (cell_map_lazy((hpfar << 8) | (hdfar & 0xfff)))
+		return TRAP_HANDLED;
+
 	panic_printk("FATAL: instruction abort at 0x%lx\n",
 		     (hpfar << 8) | (hdfar & 0xfff));
 	return TRAP_FORBIDDEN;
@@ -416,6 +411,7 @@ static enum trap_return handle_iabt(struct trap_context *ctx)
 
 static const trap_handler trap_handlers[0x40] =
 {
+	[HSR_EC_WFI]		= arch_handle_wfi,
 	[HSR_EC_CP15_32]	= arch_handle_cp15_32,
 	[HSR_EC_CP15_64]	= arch_handle_cp15_64,
 	[HSR_EC_HVC]		= arch_handle_hvc,
@@ -424,7 +420,17 @@ static const trap_handler trap_handlers[0x40] =
 	[HSR_EC_DABT]		= arch_handle_dabt,
 };
 
-static void arch_handle_trap(union registers *guest_regs)
+/* Exit latency histograms of trapped exception classes, default: total only */
+static const u8 trap_latency_stats[0x40] =
+{
+	[HSR_EC_CP15_32]	= JAILHOUSE_CPU_STAT_VMEXITS_CP15,
+	[HSR_EC_CP15_64]	= JAILHOUSE_CPU_STAT_VMEXITS_CP15,
+	[HSR_EC_HVC]		= JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL,
+	[HSR_EC_SMC]		= JAILHOUSE_CPU_STAT_VMEXITS_SMCCC,
+	[HSR_EC_DABT]		= JAILHOUSE_CPU_STAT_VMEXITS_MMIO,
+};
+
+static unsigned int __hot arch_handle_trap(union registers *guest_regs)
 {
 	struct trap_context ctx;
 	u32 exception_class;
@@ -434,13 +440,17 @@ static void arch_handle_trap(union registers *guest_regs)
 	exception_class = HSR_EC(ctx.hsr);
 	ctx.regs = guest_regs->usr;
 
+	/* MMIO exits commit posted writes as needed when dispatching */
+	if (exception_class != HSR_EC_DABT)
+		mmio_flush_posted_writes();
+
 	/*
 	 * On some implementations, instructions that fail their condition check
 	 * can trap.
 	 */
 	if (arch_failed_condition(&ctx)) {
 		arch_skip_instruction(&ctx);
-		return;
+		return JAILHOUSE_CPU_STAT_VMEXITS_TOTAL;
 	}
 
 	if (trap_handlers[exception_class])
@@ -456,6 +466,8 @@ static void arch_handle_trap(union registers *guest_regs)
 		dump_guest_regs(&ctx);
 		panic_park();
 	}
+
+	return trap_latency_stats[exception_class];
 }
 
 static void arch_dump_exit(union registers *regs, const char *reason)
@@ -485,16 +497,23 @@ static void arch_dump_abt(bool is_data)
 	panic_printk("Physical address: 0x%08x HSR: 0x%08x\n", hxfar, hsr);
 }
 
-union registers* arch_handle_exit(union registers *regs)
+__hot union registers* arch_handle_exit(union registers *regs)
 {
+	unsigned int stat = JAILHOUSE_CPU_STAT_VMEXITS_TOTAL;
+	u64 start = read_timestamp();
+
+	cpu_record_exit_start(this_cpu_public(), start);
+	trace_event(JAILHOUSE_TRACE_VMEXIT, regs->exit_reason, 0);
 	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
 
 	switch (regs->exit_reason) {
 	case EXIT_REASON_IRQ:
+		mmio_flush_posted_writes();
 		irqchip_handle_irq();
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_VIRQ;
 		break;
 	case EXIT_REASON_TRAP:
-		arch_handle_trap(regs);
+		stat = arch_handle_trap(regs);
 		break;
 
 	case EXIT_REASON_UNDEF:
@@ -519,5 +538,13 @@ union registers* arch_handle_exit(union registers *regs)
 		panic_stop();
 	}
 
+	cpu_account_exit_latency(this_cpu_public(), stat, start);
+
+	/* root cell CPUs pass hypervisor output on and check watchdogs */
+	if (this_cell() == &root_cell) {
+		uart_drain();
+		watchdog_check();
+	}
+
 	return regs;
 }
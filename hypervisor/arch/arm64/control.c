@@ -74,10 +74,30 @@ void arm_cpu_reset(unsigned long pc)
 	this_cpu_data()->guest_regs.usr[1] = this_cpu_public()->cpu_on_context;
 
 	arm_paging_vcpu_init(&this_cell()->arch.mm);
+	arm_cpu_set_idle_policy();
 
 	irqchip_cpu_reset(this_cpu_data());
 }
 
+void arch_scrub_memory(void *addr, unsigned long size)
+{
+	unsigned long dczid, block, pos;
+
+	arm_read_sysreg(DCZID_EL0, dczid);
+	if (dczid & DCZID_DZP_BIT) {
+		memset(addr, 0, size);
+	} else {
+		/* zero whole blocks without fetching them into the caches */
+		block = 4UL << (dczid & DCZID_BS_MASK);
+		for (pos = (unsigned long)addr;
+		     pos < (unsigned long)addr + size; pos += block)
+			asm volatile("dc zva, %0" : : "r" (pos) : "memory");
+	}
+
+	/* the cell's caches are invalidated afterwards, push the zeros out */
+	arm_dcaches_flush(addr, size, DCACHE_CLEAN);
+}
+
 #ifdef CONFIG_CRASH_CELL_ON_PANIC
 void arch_panic_park(void)
 {
@@ -61,6 +61,13 @@
 #define PTE_FLAG_TERMINAL	(0x1 << 1)
 #define PTE_FLAG_VALID		(0x1 << 0)
 
+/*
+ * Upper attribute, not passed via the core's flags but set directly on groups
+ * of PTE_CONT_ENTRIES aligned entries, see arm_paging_set_cont_hints.
+ */
+#define PTE_CONTIGUOUS		(1ULL << 52)
+#define PTE_CONT_ENTRIES	16
+
 /* These bits differ in stage 1 and 2 translations */
 #define S1_PTE_NG		(0x1 << 11)
 #define S1_PTE_ACCESS_RW	(0x0 << 7)
@@ -140,6 +147,7 @@
 /* Stage 2 memory attributes (MemAttr[3:0]) */
 #define S2_MEMATTR_OWBIWB	0xf
 #define S2_MEMATTR_DEV		0x1
+#define S2_MEMATTR_NC		0x5
 
 #define S1_PTE_FLAG_NORMAL	PTE_MEMATTR(MAIR_IDX_WBRAWA)
 #define S1_PTE_FLAG_DEVICE	PTE_MEMATTR(MAIR_IDX_DEV)
@@ -147,6 +155,7 @@
 
 #define S2_PTE_FLAG_NORMAL	PTE_MEMATTR(S2_MEMATTR_OWBIWB)
 #define S2_PTE_FLAG_DEVICE	PTE_MEMATTR(S2_MEMATTR_DEV)
+#define S2_PTE_FLAG_NC		PTE_MEMATTR(S2_MEMATTR_NC)
 
 #define S1_DEFAULT_FLAGS	(PTE_FLAG_VALID | PTE_ACCESS_FLAG	\
 				| S1_PTE_FLAG_NORMAL | PTE_INNER_SHAREABLE\
@@ -229,6 +238,38 @@ static inline void arm_paging_vcpu_flush_tlbs(void)
 	asm volatile("tlbi vmalls12e1is");
 }
 
+/* Above this number of pages, flushing the whole VMID is cheaper. */
+#define ARM_TLBI_RANGE_MAX_PAGES	512
+
+static inline void arm_paging_vcpu_flush_tlbs_range(unsigned long start,
+						    unsigned long end)
+{
+	unsigned long ipa;
+
+	if (end - start > ARM_TLBI_RANGE_MAX_PAGES * PAGE_SIZE) {
+		arm_paging_vcpu_flush_tlbs();
+		return;
+	}
+
+	/*
+	 * Invalidate stage-2 entries of the range for the current VMID, then
+	 * the stage-1 entries as they may hold combined translations of it.
+	 */
+	asm volatile("dsb ishst" : : : "memory");
+	for (ipa = start & PAGE_MASK; ipa < end; ipa += PAGE_SIZE)
+		asm volatile("tlbi ipas2e1is, %0" : : "r" (ipa >> 12));
+	asm volatile(
+		"dsb ish\n\t"
+		"tlbi vmalle1is\n\t"
+		"dsb ish\n\t"
+		: : : "memory");
+}
+
+struct cell;
+
+bool arm_paging_cell_flush_tlbs_range(struct cell *cell, unsigned long start,
+				      unsigned long end);
+
 /* Only executed on hypervisor paging struct changes */
 static inline void arch_paging_flush_page_tlbs(unsigned long page_addr)
 {
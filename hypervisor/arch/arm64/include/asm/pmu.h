@@ -0,0 +1,16 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_PMU_H
+#define _JAILHOUSE_ASM_PMU_H
+
+void pmu_cpu_init(void);
+void pmu_cpu_exit(void);
+
+#endif /* !_JAILHOUSE_ASM_PMU_H */
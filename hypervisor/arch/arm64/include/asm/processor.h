@@ -53,6 +53,20 @@ static inline void memory_load_barrier(void)
 {
 }
 
+/**
+ * Read the physical count of the generic timer.
+ *
+ * @return Current counter value.
+ */
+static inline u64 read_timestamp(void)
+{
+	u64 val;
+
+	isb();
+	asm volatile("mrs %0, cntpct_el0" : "=r" (val));
+	return val;
+}
+
 #endif /* !__ASSEMBLY__ */
 
 #endif /* !_JAILHOUSE_ASM_PROCESSOR_H */
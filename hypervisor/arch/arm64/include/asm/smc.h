@@ -0,0 +1,44 @@
+/*
+ * Jailhouse AArch64 support
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_SMC_H
+#define _JAILHOUSE_ASM_SMC_H
+
+/**
+ * Issue an SMC with the arguments x0..x7 taken from @p regs and store the
+ * results x0..x7 back. Firmware implementing SMCCC v1.0 may clobber x8..x17.
+ */
+static inline void smc_forward(unsigned long *regs)
+{
+	register unsigned long x0 asm("x0") = regs[0];
+	register unsigned long x1 asm("x1") = regs[1];
+	register unsigned long x2 asm("x2") = regs[2];
+	register unsigned long x3 asm("x3") = regs[3];
+	register unsigned long x4 asm("x4") = regs[4];
+	register unsigned long x5 asm("x5") = regs[5];
+	register unsigned long x6 asm("x6") = regs[6];
+	register unsigned long x7 asm("x7") = regs[7];
+
+	asm volatile("smc #0"
+		: "+r" (x0), "+r" (x1), "+r" (x2), "+r" (x3),
+		  "+r" (x4), "+r" (x5), "+r" (x6), "+r" (x7)
+		: : "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15",
+		    "x16", "x17", "memory");
+
+	regs[0] = x0;
+	regs[1] = x1;
+	regs[2] = x2;
+	regs[3] = x3;
+	regs[4] = x4;
+	regs[5] = x5;
+	regs[6] = x6;
+	regs[7] = x7;
+}
+
+#endif /* !_JAILHOUSE_ASM_SMC_H */
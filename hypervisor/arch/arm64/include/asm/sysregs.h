@@ -19,6 +19,7 @@
 #define PSR_MODE_EL1h	0x5
 #define PSR_MODE_EL2t	0x8
 #define PSR_MODE_EL2h	0x9
+#define PSR_AARCH32	(1 << 4)
 
 #define PSR_F_BIT	(1 << 6)
 #define PSR_I_BIT	(1 << 7)
@@ -68,6 +69,9 @@
 #define SCTLR_EL2_RES1	((3 << 4) | (1 << 11) | (1 << 16) | (1 << 18)	\
 			| (3 << 22) | (3 << 28))
 
+#define DCZID_BS_MASK	0xf
+#define DCZID_DZP_BIT	(1 << 4)
+
 #define HCR_MIOCNCE_BIT	(1u << 38)
 #define HCR_ID_BIT	(1u << 33)
 #define HCR_CD_BIT	(1u << 32)
@@ -155,6 +159,9 @@
 	 (((op0) << 20) | ((op2) << 17) | ((op1) << 14) |	\
 	  ((crn) << 10) | ((crm) << 1)))
 
+#define PAR_F_BIT	0x1
+#define PAR_PA_MASK	BIT_MASK(47, 12)
+
 /* exception level in SPSR_ELx */
 #define SPSR_EL(spsr)		(((spsr) & 0xc) >> 2)
 
@@ -14,8 +14,10 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <jailhouse/control.h>
 #include <jailhouse/entry.h>
 #include <jailhouse/mmio.h>
+#include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
 #include <asm/bitops.h>
 #include <jailhouse/percpu.h>
@@ -30,7 +32,203 @@ static void arch_inject_dabt(struct trap_context *ctx, unsigned long addr)
 	while (1);
 }
 
-enum trap_return arch_handle_dabt(struct trap_context *ctx)
+/* Load/store of general-purpose registers without instruction syndrome */
+struct ldst_instruction {
+	bool is_write;
+	/* width of the sign extension target in bits, 0 if none */
+	unsigned int sign_extend;
+	/* bytes per register */
+	unsigned int size;
+	unsigned int num_regs;
+	unsigned int rt[2];
+	unsigned int rn;
+	/* offset of the access from the base register before writeback */
+	long offset;
+	/* value added to the base register, 0 if no writeback */
+	long writeback;
+};
+
+static unsigned long guest_sp(struct trap_context *ctx)
+{
+	unsigned long sp;
+
+	if ((ctx->spsr & PSR_MODE_MASK) == PSR_MODE_EL1h)
+		arm_read_sysreg(SP_EL1, sp);
+	else
+		arm_read_sysreg(SP_EL0, sp);
+	return sp;
+}
+
+static void guest_set_sp(struct trap_context *ctx, unsigned long sp)
+{
+	if ((ctx->spsr & PSR_MODE_MASK) == PSR_MODE_EL1h)
+		arm_write_sysreg(SP_EL1, sp);
+	else
+		arm_write_sysreg(SP_EL0, sp);
+}
+
+/* Read the instruction at the guest PC, 0 on failure. */
+static u32 fetch_instruction(void)
+{
+	unsigned long pc, par, saved_par;
+	const u32 *inst;
+
+	arm_read_sysreg(ELR_EL2, pc);
+
+	/* translate via the cell's stage 1, PAR_EL1 belongs to the cell */
+	arm_read_sysreg(PAR_EL1, saved_par);
+	asm volatile("at s1e1r, %0" : : "r" (pc));
+	isb();
+	arm_read_sysreg(PAR_EL1, par);
+	arm_write_sysreg(PAR_EL1, saved_par);
+	if (par & PAR_F_BIT)
+		return 0;
+
+	inst = paging_get_guest_pages(NULL, (par & PAR_PA_MASK), 1,
+				      PAGE_READONLY_FLAGS);
+	if (!inst)
+		return 0;
+	return inst[(pc & ~PAGE_MASK) / sizeof(u32)];
+}
+
+/*
+ * Decode the A64 load/store forms that the instruction syndrome does not
+ * describe: register pairs (LDP, STP, LDPSW, LDNP, STNP) and single registers
+ * with pre- or post-index writeback. Accesses to SIMD&FP registers are not
+ * supported.
+ */
+static bool decode_ldst(u32 inst, struct ldst_instruction *ldst)
+{
+	unsigned int opc = inst >> 30, index;
+	long imm;
+
+	ldst->rt[0] = inst & 0x1f;
+	ldst->rn = (inst >> 5) & 0x1f;
+	ldst->sign_extend = 0;
+	ldst->writeback = 0;
+
+	if ((inst & 0x3e000000) == 0x28000000) {
+		/* load/store register pair */
+		index = (inst >> 23) & 0x3;
+		ldst->is_write = !(inst & (1 << 22));
+		if (opc == 3 || (opc == 1 && (ldst->is_write || index == 0)))
+			return false;
+		ldst->size = opc == 2 ? 8 : 4;
+		if (opc == 1)
+			ldst->sign_extend = 64;
+		ldst->num_regs = 2;
+		ldst->rt[1] = (inst >> 10) & 0x1f;
+		if (!ldst->is_write && ldst->rt[0] == ldst->rt[1])
+			return false;
+		imm = sign_extend((inst >> 15) & 0x7f, 7) * ldst->size;
+		/* index 1: post-index, 2: signed offset, 3: pre-index */
+		ldst->offset = index == 1 ? 0 : imm;
+		if (index == 1 || index == 3)
+			ldst->writeback = imm;
+	} else if ((inst & 0x3f200400) == 0x38000400) {
+		/* load/store register, immediate pre- or post-indexed */
+		ldst->size = 1 << opc;
+		switch ((inst >> 22) & 0x3) {
+		case 0:
+			ldst->is_write = true;
+			break;
+		case 1:
+			ldst->is_write = false;
+			break;
+		case 2:
+			if (opc == 3)
+				return false;
+			ldst->is_write = false;
+			ldst->sign_extend = 64;
+			break;
+		default:
+			if (opc >= 2)
+				return false;
+			ldst->is_write = false;
+			ldst->sign_extend = 32;
+			break;
+		}
+		ldst->num_regs = 1;
+		imm = sign_extend((inst >> 12) & 0x1ff, 9);
+		ldst->offset = (inst & (1 << 11)) ? imm : 0;
+		ldst->writeback = imm;
+	} else {
+		return false;
+	}
+
+	/* loads into the base register with writeback are unpredictable */
+	if (ldst->writeback && ldst->rn != 31 && !ldst->is_write &&
+	    (ldst->rt[0] == ldst->rn ||
+	     (ldst->num_regs == 2 && ldst->rt[1] == ldst->rn)))
+		return false;
+
+	return true;
+}
+
+/*
+ * Emulate an access that came without instruction syndrome by decoding the
+ * instruction. All registers are accessed at consecutive addresses from the
+ * IPA page of the fault, so the access must not cross a page.
+ */
+static enum mmio_result handle_ldst(struct trap_context *ctx,
+				    unsigned long hpfar, unsigned long hdfar)
+{
+	unsigned long base, addr, value[2];
+	struct ldst_instruction ldst;
+	enum mmio_result result;
+	struct mmio_access mmio;
+	unsigned int n, rt;
+
+	if (ctx->spsr & PSR_AARCH32 || !decode_ldst(fetch_instruction(), &ldst))
+		return MMIO_UNHANDLED;
+
+	base = ldst.rn == 31 ? guest_sp(ctx) : ctx->regs[ldst.rn];
+	addr = base + ldst.offset;
+	if ((addr & PAGE_MASK) !=
+	    ((addr + ldst.size * ldst.num_regs - 1) & PAGE_MASK) ||
+	    (hdfar & PAGE_MASK) != (addr & PAGE_MASK))
+		return MMIO_UNHANDLED;
+
+	mmio.address = (hpfar << 8) | (addr & ~PAGE_MASK);
+	mmio.size = ldst.size;
+	mmio.is_write = ldst.is_write;
+
+	for (n = 0; n < ldst.num_regs; n++, mmio.address += ldst.size) {
+		rt = ldst.rt[n];
+		if (ldst.is_write)
+			mmio.value = rt == 31 ? 0 : ctx->regs[rt];
+		else
+			mmio.value = 0;
+
+		result = mmio_handle_access(&mmio);
+		if (result != MMIO_HANDLED)
+			return result;
+		value[n] = mmio.value;
+	}
+
+	/* update registers only once all accesses succeeded */
+	for (n = 0; n < ldst.num_regs && !ldst.is_write; n++) {
+		rt = ldst.rt[n];
+		if (rt == 31)
+			continue;
+		if (ldst.sign_extend)
+			value[n] = sign_extend(value[n], 8 * ldst.size);
+		if (ldst.sign_extend == 32)
+			value[n] &= 0xffffffffUL;
+		ctx->regs[rt] = value[n];
+	}
+
+	if (ldst.writeback) {
+		if (ldst.rn == 31)
+			guest_set_sp(ctx, base + ldst.writeback);
+		else
+			ctx->regs[ldst.rn] = base + ldst.writeback;
+	}
+
+	return MMIO_HANDLED;
+}
+
+enum trap_return __hot arch_handle_dabt(struct trap_context *ctx)
 {
 	enum mmio_result mmio_result;
 	struct mmio_access mmio;
@@ -56,11 +254,11 @@ enum trap_return arch_handle_dabt(struct trap_context *ctx)
 	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_VMEXITS_MMIO]++;
 
 	/*
-	 * Invalid instruction syndrome means multiple access or writeback,
-	 * there is nothing we can do.
+	 * First access to lazily mapped RAM, also during a stage-1 page
+	 * walk. Let the guest retry.
 	 */
-	if (!isv)
-		goto error_unhandled;
+	if (cell_map_lazy(mmio.address))
+		return TRAP_HANDLED;
 
 	/* Re-inject abort during page walk, cache maintenance or external */
 	if (s1ptw || ea || cm) {
@@ -68,6 +266,20 @@ enum trap_return arch_handle_dabt(struct trap_context *ctx)
 		return TRAP_HANDLED;
 	}
 
+	/*
+	 * Invalid instruction syndrome means multiple access or writeback,
+	 * the instruction has to be decoded then.
+	 */
+	if (!isv) {
+		mmio_result = handle_ldst(ctx, hpfar, hdfar);
+		if (mmio_result == MMIO_ERROR)
+			return TRAP_FORBIDDEN;
+		if (mmio_result == MMIO_UNHANDLED)
+			goto error_unhandled;
+		arch_skip_instruction(ctx);
+		return TRAP_HANDLED;
+	}
+
 	if (is_write) {
 		/* Load the value to write from the src register */
 		mmio.value = (srt == 31) ? 0 : ctx->regs[srt];
@@ -13,6 +13,7 @@
 #include <jailhouse/control.h>
 #include <jailhouse/percpu.h>
 #include <asm/paging.h>
+#include <asm/sysregs.h>
 
 /**
  * Return the physical address bits.
@@ -56,3 +57,42 @@ unsigned int get_cpu_parange(void)
 		return 0;
 	}
 }
+
+/**
+ * Invalidate TLB entries of a cell on all its CPUs from the calling CPU.
+ * @param cell		Cell to flush.
+ * @param start		Start of the guest-physical range.
+ * @param end		End of the guest-physical range.
+ *
+ * The inner-shareable TLBI operations are broadcast but act on the VMID in
+ * VTTBR_EL2. The calling CPU therefore switches to the cell's VMID while
+ * issuing them, so that no other cell loses its TLB entries and the CPUs of
+ * the cell do not have to flush themselves.
+ *
+ * @return Always true, the flush is complete on return.
+ */
+bool arm_paging_cell_flush_tlbs_range(struct cell *cell, unsigned long start,
+				      unsigned long end)
+{
+	u64 vttbr, cell_vttbr;
+
+	cell_vttbr = (u64)cell->config->id << VTTBR_VMID_SHIFT;
+	cell_vttbr |= paging_hvirt2phys(cell->arch.mm.root_table) & TTBR_MASK;
+
+	arm_read_sysreg(VTTBR_EL2, vttbr);
+	if (vttbr != cell_vttbr) {
+		arm_write_sysreg(VTTBR_EL2, cell_vttbr);
+		isb();
+	}
+
+	arm_paging_vcpu_flush_tlbs_range(start, end);
+	/* there is no ERET for the remote CPUs, wait for completion here */
+	dsb(ish);
+
+	if (vttbr != cell_vttbr) {
+		arm_write_sysreg(VTTBR_EL2, vttbr);
+		isb();
+	}
+
+	return true;
+}
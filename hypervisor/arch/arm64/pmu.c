@@ -0,0 +1,128 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * The top three PMUv3 event counters are reserved for the hypervisor via
+ * MDCR_EL2.HPMN, counting cycles, retired instructions and last-level cache
+ * misses at EL1 and EL0. Cells only see and control the remaining counters.
+ * The reservation is done per CPU, so CPUs with different numbers of counters
+ * are supported.
+ */
+
+#include <jailhouse/pmu.h>
+#include <asm/pmu.h>
+#include <asm/sysregs.h>
+
+#define ID_AA64DFR0_PMUVER(dfr0)	(((dfr0) >> 8) & 0xf)
+#define  ID_AA64DFR0_PMUVER_IMPDEF	0xf
+
+#define PMCR_N(pmcr)			(((pmcr) >> 11) & 0x1f)
+
+#define MDCR_HPMN_MASK			BIT_MASK(4, 0)
+#define MDCR_HPME			(1 << 7)
+
+#define PMU_EVENT_CPU_CYCLES		0x11
+#define PMU_EVENT_INST_RETIRED		0x08
+#define PMU_EVENT_L2D_CACHE_REFILL	0x17
+#define PMU_EVENT_LL_CACHE_MISS_RD	0x37
+
+/* PMCEID1_EL0 covers the common events 0x20..0x3f */
+#define PMCEID1_LL_CACHE_MISS_RD	(1 << (PMU_EVENT_LL_CACHE_MISS_RD - 0x20))
+
+static const unsigned int counter_of[JAILHOUSE_NUM_PMU_COUNTERS] = {
+	[JAILHOUSE_PMU_KCYCLES] = 0,
+	[JAILHOUSE_PMU_KINSTRUCTIONS] = 1,
+	[JAILHOUSE_PMU_LLC_MISSES] = 2,
+};
+
+void pmu_cpu_init(void)
+{
+#ifdef CONFIG_PMU_STATS
+	unsigned long dfr0, pmcr, pmceid1, mdcr, pmselr;
+	unsigned int n, first, events[JAILHOUSE_NUM_PMU_COUNTERS];
+
+	arm_read_sysreg(ID_AA64DFR0_EL1, dfr0);
+	if (ID_AA64DFR0_PMUVER(dfr0) == 0 ||
+	    ID_AA64DFR0_PMUVER(dfr0) == ID_AA64DFR0_PMUVER_IMPDEF)
+		return;
+
+	arm_read_sysreg(PMCR_EL0, pmcr);
+	if (PMCR_N(pmcr) < JAILHOUSE_NUM_PMU_COUNTERS)
+		return;
+	first = PMCR_N(pmcr) - JAILHOUSE_NUM_PMU_COUNTERS;
+
+	arm_read_sysreg(PMCEID1_EL0, pmceid1);
+	events[JAILHOUSE_PMU_KCYCLES] = PMU_EVENT_CPU_CYCLES;
+	events[JAILHOUSE_PMU_KINSTRUCTIONS] = PMU_EVENT_INST_RETIRED;
+	events[JAILHOUSE_PMU_LLC_MISSES] =
+		(pmceid1 & PMCEID1_LL_CACHE_MISS_RD) ?
+		PMU_EVENT_LL_CACHE_MISS_RD : PMU_EVENT_L2D_CACHE_REFILL;
+
+	arm_read_sysreg(MDCR_EL2, mdcr);
+	mdcr = (mdcr & ~MDCR_HPMN_MASK) | first | MDCR_HPME;
+	arm_write_sysreg(MDCR_EL2, mdcr);
+
+	/*
+	 * Count at EL1 and EL0 only (P, U and NSH clear). PMSELR_EL0 belongs
+	 * to the cell.
+	 */
+	arm_read_sysreg(PMSELR_EL0, pmselr);
+	for (n = 0; n < JAILHOUSE_NUM_PMU_COUNTERS; n++) {
+		arm_write_sysreg(PMSELR_EL0, first + counter_of[n]);
+		isb();
+		arm_write_sysreg(PMXEVTYPER_EL0, events[n]);
+		arm_write_sysreg(PMCNTENSET_EL0, 1UL << (first + counter_of[n]));
+	}
+	arm_write_sysreg(PMSELR_EL0, pmselr);
+	isb();
+#endif
+}
+
+void pmu_cpu_exit(void)
+{
+	unsigned long mdcr, pmcr;
+	unsigned int first;
+
+	arm_read_sysreg(MDCR_EL2, mdcr);
+	if (!(mdcr & MDCR_HPME))
+		return;
+
+	first = mdcr & MDCR_HPMN_MASK;
+	arm_write_sysreg(PMCNTENCLR_EL0,
+			 BIT_MASK(first + JAILHOUSE_NUM_PMU_COUNTERS - 1,
+				  first));
+
+	/* hand all counters back */
+	arm_read_sysreg(PMCR_EL0, pmcr);
+	mdcr = (mdcr & ~(MDCR_HPMN_MASK | MDCR_HPME)) | PMCR_N(pmcr);
+	arm_write_sysreg(MDCR_EL2, mdcr);
+	isb();
+}
+
+u64 arch_pmu_read(u64 *values)
+{
+	unsigned long mdcr, pmselr, value;
+	unsigned int n, first;
+
+	arm_read_sysreg(MDCR_EL2, mdcr);
+	if (!(mdcr & MDCR_HPME))
+		return 0;
+
+	first = mdcr & MDCR_HPMN_MASK;
+	arm_read_sysreg(PMSELR_EL0, pmselr);
+	for (n = 0; n < JAILHOUSE_NUM_PMU_COUNTERS; n++) {
+		arm_write_sysreg(PMSELR_EL0, first + counter_of[n]);
+		isb();
+		arm_read_sysreg(PMXEVCNTR_EL0, value);
+		values[n] = value;
+	}
+	arm_write_sysreg(PMSELR_EL0, pmselr);
+	isb();
+
+	/* event counters are 32 bits wide */
+	return BIT_MASK(31, 0);
+}
@@ -18,11 +18,12 @@
 #include <asm/control.h>
 #include <asm/entry.h>
 #include <asm/irqchip.h>
+#include <asm/pmu.h>
 #include <asm/setup.h>
 
 extern u8 __trampoline_start[];
 
-int arch_init_early(void)
+int __init arch_init_early(void)
 {
 	unsigned long trampoline_page = paging_hvirt2phys(&__trampoline_start);
 	int err;
@@ -42,7 +43,7 @@ int arch_init_early(void)
 	return arm_init_early();
 }
 
-int arch_cpu_init(struct per_cpu *cpu_data)
+int __init arch_cpu_init(struct per_cpu *cpu_data)
 {
 	unsigned long hcr = HCR_VM_BIT | HCR_IMO_BIT | HCR_FMO_BIT
 				| HCR_TSC_BIT | HCR_TAC_BIT | HCR_RW_BIT;
@@ -60,6 +61,8 @@ int arch_cpu_init(struct per_cpu *cpu_data)
 	/* Setup guest traps */
 	arm_write_sysreg(HCR_EL2, hcr);
 
+	pmu_cpu_init();
+
 	return arm_cpu_init(cpu_data);
 }
 
@@ -91,6 +94,7 @@ void arch_shutdown_self(struct per_cpu *cpu_data)
 		(void (*)(struct per_cpu *))paging_hvirt2phys(shutdown_el2);
 
 	irqchip_cpu_shutdown(&cpu_data->public);
+	pmu_cpu_exit();
 
 	/* Free the guest */
 	arm_write_sysreg(HCR_EL2, HCR_RW_BIT);
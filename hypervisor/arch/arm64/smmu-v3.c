@@ -0,0 +1,446 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * ARM SMMUv3 support. Stage 1 is always bypassed, stage 2 walks the same page
+ * tables the CPUs use for the owning cell, tagged with the cell ID as VMID.
+ * Stream IDs listed in the root cell config are routed to the root cell at
+ * startup and move to a non-root cell while it owns them. Unknown stream IDs
+ * hit invalid STEs and are aborted.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/string.h>
+#include <jailhouse/unit.h>
+#include <asm/iommu.h>
+
+#define SMMU_IDR0			0x00
+#define  SMMU_IDR0_ST_LEVEL_2LVL	(1 << 27)
+#define  SMMU_IDR0_COHACC		(1 << 4)
+#define  SMMU_IDR0_TTF_AARCH64		(1 << 3)
+#define  SMMU_IDR0_S2P			(1 << 0)
+#define SMMU_IDR1			0x04
+#define  SMMU_IDR1_CMDQS_SHIFT		21
+#define  SMMU_IDR1_CMDQS		BIT_MASK(25, 21)
+#define  SMMU_IDR1_SIDSIZE		BIT_MASK(5, 0)
+#define SMMU_IDR5			0x14
+#define  SMMU_IDR5_OAS			BIT_MASK(2, 0)
+#define SMMU_CR0			0x20
+#define  SMMU_CR0_SMMUEN		(1 << 0)
+#define  SMMU_CR0_CMDQEN		(1 << 3)
+#define SMMU_CR0ACK			0x24
+#define SMMU_CR1			0x28
+#define  SMMU_CR1_WB_ISH		((3 << 10) | (1 << 8) | (1 << 6) | \
+					 (3 << 4) | (1 << 2) | (1 << 0))
+#define SMMU_GERROR			0x60
+#define SMMU_GERRORN			0x64
+#define  SMMU_GERROR_CMDQ_ERR		(1 << 0)
+#define SMMU_STRTAB_BASE		0x80
+#define SMMU_STRTAB_BASE_CFG		0x88
+#define  SMMU_STRTAB_FMT_2LVL		(1 << 16)
+#define  SMMU_STRTAB_SPLIT_SHIFT	6
+#define SMMU_CMDQ_BASE			0x90
+#define SMMU_CMDQ_PROD			0x98
+#define SMMU_CMDQ_CONS			0x9c
+
+#define SMMU_BASE_RA			(1UL << 62)
+
+#define SMMU_CMD_CFGI_STE		0x03
+#define SMMU_CMD_TLBI_S12_VMALL		0x28
+#define SMMU_CMD_SYNC			0x46
+
+#define SMMU_CMDQ_MAX_LOG2SIZE		8
+#define SMMU_CMD_DWORDS			2
+
+#define SMMU_STE_DWORDS			8
+#define SMMU_STE_V			(1UL << 0)
+#define SMMU_STE_CFG_S2_TRANS		(6UL << 1)
+#define SMMU_STE_SHCFG_INCOMING		(1UL << 44)
+#define SMMU_STE_S2VMID			BIT_MASK(15, 0)
+#define SMMU_STE_S2VTCR_SHIFT		32
+#define SMMU_STE_S2AA64			(1UL << 51)
+#define SMMU_STE_S2R			(1UL << 58)
+
+#define SMMU_STRTAB_SPLIT		8
+#define SMMU_L1_MAX_SID_BITS		16
+#define SMMU_LINEAR_MAX_SID_BITS	8
+#define SMMU_L2_PAGES			((SMMU_STE_DWORDS * 8) << \
+					 SMMU_STRTAB_SPLIT >> PAGE_SHIFT)
+
+struct smmu_v3 {
+	void *base;
+	bool coherent;
+	bool two_level;
+	unsigned int sid_bits;
+	u64 *strtab;
+	u64 *cmdq;
+	unsigned int cmdq_log2size;
+	u32 cmdq_prod;
+};
+
+static struct smmu_v3 smmu_units[JAILHOUSE_MAX_IOMMU_UNITS];
+static unsigned int num_smmu_units;
+static bool smmu_enabled;
+
+#define for_each_smmu(smmu, n)						\
+	for ((smmu) = smmu_units, (n) = 0; (n) < num_smmu_units;	\
+	     (smmu)++, (n)++)
+
+static void smmu_flush(struct smmu_v3 *smmu, void *addr, unsigned long size)
+{
+	if (!smmu->coherent)
+		arch_paging_flush_cpu_caches(addr, size);
+}
+
+static void smmu_write_cr0(struct smmu_v3 *smmu, u32 val)
+{
+	mmio_write32(smmu->base + SMMU_CR0, val);
+	while (mmio_read32(smmu->base + SMMU_CR0ACK) != val)
+		cpu_relax();
+}
+
+static bool smmu_cmdq_error(struct smmu_v3 *smmu)
+{
+	return (mmio_read32(smmu->base + SMMU_GERROR) ^
+		mmio_read32(smmu->base + SMMU_GERRORN)) & SMMU_GERROR_CMDQ_ERR;
+}
+
+static void smmu_write_cmd(struct smmu_v3 *smmu, u64 dw0, u64 dw1)
+{
+	u32 size = 1 << smmu->cmdq_log2size;
+	u64 *cmd;
+
+	/* wait while the queue is full: same index, different wrap bit */
+	while ((smmu->cmdq_prod ^ mmio_read32(smmu->base + SMMU_CMDQ_CONS)) ==
+	       size)
+		cpu_relax();
+
+	cmd = &smmu->cmdq[(smmu->cmdq_prod & (size - 1)) * SMMU_CMD_DWORDS];
+	cmd[0] = dw0;
+	cmd[1] = dw1;
+	smmu_flush(smmu, cmd, SMMU_CMD_DWORDS * sizeof(u64));
+
+	smmu->cmdq_prod = (smmu->cmdq_prod + 1) & ((size << 1) - 1);
+
+	/* make the command visible before publishing it */
+	dsb(st);
+	mmio_write32(smmu->base + SMMU_CMDQ_PROD, smmu->cmdq_prod);
+}
+
+static int smmu_sync(struct smmu_v3 *smmu)
+{
+	u32 mask = (2 << smmu->cmdq_log2size) - 1;
+
+	smmu_write_cmd(smmu, SMMU_CMD_SYNC, 0);
+
+	while ((mmio_read32(smmu->base + SMMU_CMDQ_CONS) & mask) !=
+	       smmu->cmdq_prod) {
+		if (smmu_cmdq_error(smmu)) {
+			printk("SMMUv3: command queue error, CONS %x\n",
+			       mmio_read32(smmu->base + SMMU_CMDQ_CONS));
+			return trace_error(-EIO);
+		}
+		cpu_relax();
+	}
+	return 0;
+}
+
+static u64 *smmu_get_ste(struct smmu_v3 *smmu, u32 sid, bool alloc)
+{
+	u64 *l1_desc, *l2_table;
+
+	if (sid >= (1UL << smmu->sid_bits))
+		return NULL;
+
+	if (!smmu->two_level)
+		return &smmu->strtab[sid * SMMU_STE_DWORDS];
+
+	l1_desc = &smmu->strtab[sid >> SMMU_STRTAB_SPLIT];
+	if (*l1_desc) {
+		l2_table = paging_phys2hvirt(*l1_desc & BIT_MASK(51, 6));
+	} else {
+		if (!alloc)
+			return NULL;
+
+		l2_table = page_alloc_aligned(&mem_pool, SMMU_L2_PAGES);
+		if (!l2_table)
+			return NULL;
+		smmu_flush(smmu, l2_table, SMMU_L2_PAGES * PAGE_SIZE);
+
+		/* the STE invalidation issued by the caller covers this */
+		*l1_desc = paging_hvirt2phys(l2_table) |
+			(SMMU_STRTAB_SPLIT + 1);
+		smmu_flush(smmu, l1_desc, sizeof(*l1_desc));
+	}
+
+	return &l2_table[(sid & ((1 << SMMU_STRTAB_SPLIT) - 1)) *
+			 SMMU_STE_DWORDS];
+}
+
+static int smmu_invalidate_ste(struct smmu_v3 *smmu, u32 sid)
+{
+	smmu_write_cmd(smmu, SMMU_CMD_CFGI_STE | ((u64)sid << 32), 1);
+	return smmu_sync(smmu);
+}
+
+static int smmu_write_ste(struct smmu_v3 *smmu, u32 sid, struct cell *cell)
+{
+	u64 *ste;
+	int err;
+
+	if (sid >= (1UL << smmu->sid_bits))
+		return trace_error(-ERANGE);
+
+	ste = smmu_get_ste(smmu, sid, true);
+	if (!ste)
+		return -ENOMEM;
+
+	/*
+	 * The SMMU may fetch the STE at any time. Invalidate it before
+	 * updating the upper words and validate it only when they are in
+	 * place.
+	 */
+	if (ste[0] & SMMU_STE_V) {
+		ste[0] = 0;
+		smmu_flush(smmu, ste, sizeof(*ste));
+		err = smmu_invalidate_ste(smmu, sid);
+		if (err)
+			return err;
+	}
+
+	ste[1] = SMMU_STE_SHCFG_INCOMING;
+	ste[2] = cell->config->id |
+		((VTCR_CELL & BIT_MASK(18, 0)) << SMMU_STE_S2VTCR_SHIFT) |
+		SMMU_STE_S2AA64 | SMMU_STE_S2R;
+	ste[3] = paging_hvirt2phys(cell->arch.mm.root_table) & BIT_MASK(51, 4);
+	ste[4] = ste[5] = ste[6] = ste[7] = 0;
+	smmu_flush(smmu, ste, SMMU_STE_DWORDS * sizeof(u64));
+	dsb(st);
+
+	ste[0] = SMMU_STE_V | SMMU_STE_CFG_S2_TRANS;
+	smmu_flush(smmu, ste, sizeof(*ste));
+
+	return smmu_invalidate_ste(smmu, sid);
+}
+
+static bool smmu_ste_owned_by(struct smmu_v3 *smmu, u32 sid,
+			      struct cell *cell)
+{
+	u64 *ste = smmu_get_ste(smmu, sid, false);
+
+	return ste && (ste[0] & SMMU_STE_V) &&
+		(ste[2] & SMMU_STE_S2VMID) == cell->config->id;
+}
+
+static bool cell_has_stream_id(struct cell *cell, u32 sid)
+{
+	const u32 *sids = jailhouse_cell_stream_ids(cell->config);
+	unsigned int n;
+
+	for (n = 0; n < cell->config->num_stream_ids; n++)
+		if (sids[n] == sid)
+			return true;
+	return false;
+}
+
+static int smmu_assign_stream_ids(struct cell *cell)
+{
+	const u32 *sids = jailhouse_cell_stream_ids(cell->config);
+	struct smmu_v3 *smmu;
+	unsigned int n, u;
+	int err;
+
+	for (n = 0; n < cell->config->num_stream_ids; n++)
+		for_each_smmu(smmu, u) {
+			err = smmu_write_ste(smmu, sids[n], cell);
+			if (err)
+				return err;
+		}
+	return 0;
+}
+
+static int smmu_init_unit(struct smmu_v3 *smmu,
+			  const struct jailhouse_iommu *iommu)
+{
+	unsigned int log2size, pages;
+	u32 idr0, idr1, idr5;
+
+	smmu->base = paging_map_device(iommu->base, iommu->size);
+	if (!smmu->base)
+		return -ENOMEM;
+
+	idr0 = mmio_read32(smmu->base + SMMU_IDR0);
+	idr1 = mmio_read32(smmu->base + SMMU_IDR1);
+	idr5 = mmio_read32(smmu->base + SMMU_IDR5);
+
+	if (!(idr0 & SMMU_IDR0_S2P) || !(idr0 & SMMU_IDR0_TTF_AARCH64) ||
+	    (idr5 & SMMU_IDR5_OAS) < TCR_PS_CELL)
+		return trace_error(-EIO);
+
+	if (mmio_read32(smmu->base + SMMU_CR0) & SMMU_CR0_SMMUEN)
+		return trace_error(-EBUSY);
+
+	smmu->coherent = !!(idr0 & SMMU_IDR0_COHACC);
+	smmu->two_level = !!(idr0 & SMMU_IDR0_ST_LEVEL_2LVL);
+
+	/* disable queues and translation before reprogramming the tables */
+	smmu_write_cr0(smmu, 0);
+	mmio_write32(smmu->base + SMMU_CR1, SMMU_CR1_WB_ISH);
+
+	log2size = MIN((idr1 & SMMU_IDR1_CMDQS) >> SMMU_IDR1_CMDQS_SHIFT,
+		       SMMU_CMDQ_MAX_LOG2SIZE);
+	smmu->cmdq_log2size = log2size;
+	smmu->cmdq = page_alloc(&mem_pool, 1);
+	if (!smmu->cmdq)
+		return -ENOMEM;
+	smmu_flush(smmu, smmu->cmdq, PAGE_SIZE);
+	smmu->cmdq_prod = 0;
+
+	mmio_write64(smmu->base + SMMU_CMDQ_BASE, SMMU_BASE_RA |
+		     (paging_hvirt2phys(smmu->cmdq) & BIT_MASK(51, 5)) |
+		     log2size);
+	mmio_write32(smmu->base + SMMU_CMDQ_PROD, 0);
+	mmio_write32(smmu->base + SMMU_CMDQ_CONS, 0);
+
+	if (smmu->two_level) {
+		smmu->sid_bits = MIN(idr1 & SMMU_IDR1_SIDSIZE,
+				     SMMU_L1_MAX_SID_BITS);
+		if (smmu->sid_bits < SMMU_STRTAB_SPLIT)
+			smmu->two_level = false;
+	}
+	if (smmu->two_level) {
+		pages = PAGES(sizeof(u64) <<
+			      (smmu->sid_bits - SMMU_STRTAB_SPLIT));
+		mmio_write32(smmu->base + SMMU_STRTAB_BASE_CFG,
+			     SMMU_STRTAB_FMT_2LVL |
+			     (SMMU_STRTAB_SPLIT << SMMU_STRTAB_SPLIT_SHIFT) |
+			     smmu->sid_bits);
+	} else {
+		smmu->sid_bits = MIN(idr1 & SMMU_IDR1_SIDSIZE,
+				     SMMU_LINEAR_MAX_SID_BITS);
+		pages = PAGES((SMMU_STE_DWORDS * sizeof(u64)) <<
+			      smmu->sid_bits);
+		mmio_write32(smmu->base + SMMU_STRTAB_BASE_CFG,
+			     smmu->sid_bits);
+	}
+
+	/* the table base must be aligned to the table size */
+	smmu->strtab = page_alloc_aligned(&mem_pool, pages);
+	if (!smmu->strtab)
+		return -ENOMEM;
+	smmu_flush(smmu, smmu->strtab, pages * PAGE_SIZE);
+
+	mmio_write64(smmu->base + SMMU_STRTAB_BASE, SMMU_BASE_RA |
+		     (paging_hvirt2phys(smmu->strtab) & BIT_MASK(51, 6)));
+
+	/*
+	 * Only the command queue is enabled for now. Translation is switched
+	 * on with the first config commit, i.e. once the root cell memory is
+	 * mapped.
+	 */
+	smmu_write_cr0(smmu, SMMU_CR0_CMDQEN);
+	return 0;
+}
+
+static int smmu_cell_init(struct cell *cell)
+{
+	const u32 *sids = jailhouse_cell_stream_ids(cell->config);
+	struct cell *other;
+	unsigned int n;
+
+	if (num_smmu_units == 0 || cell == &root_cell)
+		return 0;
+
+	for (n = 0; n < cell->config->num_stream_ids; n++) {
+		if (!cell_has_stream_id(&root_cell, sids[n]))
+			return trace_error(-EINVAL);
+		for_each_non_root_cell(other)
+			if (cell_has_stream_id(other, sids[n]))
+				return trace_error(-EBUSY);
+	}
+
+	return smmu_assign_stream_ids(cell);
+}
+
+static void smmu_cell_exit(struct cell *cell)
+{
+	const u32 *sids = jailhouse_cell_stream_ids(cell->config);
+	struct smmu_v3 *smmu;
+	unsigned int n, u;
+
+	if (num_smmu_units == 0 || cell == &root_cell)
+		return;
+
+	for (n = 0; n < cell->config->num_stream_ids; n++)
+		for_each_smmu(smmu, u)
+			if (smmu_ste_owned_by(smmu, sids[n], cell))
+				smmu_write_ste(smmu, sids[n], &root_cell);
+}
+
+void iommu_config_commit(struct cell *cell_added_removed)
+{
+	struct smmu_v3 *smmu;
+	unsigned int n;
+
+	for_each_smmu(smmu, n) {
+		smmu_write_cmd(smmu, SMMU_CMD_TLBI_S12_VMALL |
+			       ((u64)root_cell.config->id << 32), 0);
+		if (cell_added_removed && cell_added_removed != &root_cell)
+			smmu_write_cmd(smmu, SMMU_CMD_TLBI_S12_VMALL |
+				((u64)cell_added_removed->config->id << 32),
+				0);
+		smmu_sync(smmu);
+
+		if (!smmu_enabled)
+			smmu_write_cr0(smmu, SMMU_CR0_CMDQEN | SMMU_CR0_SMMUEN);
+	}
+	smmu_enabled = true;
+}
+
+static int __init smmu_init(void)
+{
+	const struct jailhouse_iommu *iommu =
+		system_config->platform_info.arm.iommu_units;
+	struct smmu_v3 *smmu = smmu_units;
+	unsigned int n;
+	int err;
+
+	for (n = 0; n < JAILHOUSE_MAX_IOMMU_UNITS; n++, iommu++) {
+		if (iommu->type != JAILHOUSE_IOMMU_SMMUV3)
+			continue;
+
+		err = smmu_init_unit(smmu, iommu);
+		if (err)
+			return err;
+		smmu++;
+		num_smmu_units++;
+	}
+
+	if (num_smmu_units == 0)
+		return 0;
+
+	printk("SMMUv3: %d unit(s), stage-2 tables shared with the CPUs\n",
+	       num_smmu_units);
+
+	return smmu_assign_stream_ids(&root_cell);
+}
+
+static void smmu_shutdown(void)
+{
+	struct smmu_v3 *smmu;
+	unsigned int n;
+
+	/* hand DMA back to the global bypass configuration */
+	for_each_smmu(smmu, n)
+		smmu_write_cr0(smmu, 0);
+}
+
+DEFINE_UNIT_MMIO_COUNT_REGIONS_STUB(smmu);
+DEFINE_UNIT(smmu, "SMMUv3");
@@ -12,7 +12,11 @@
  */
 
 #include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/pmu.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/trace.h>
+#include <jailhouse/uart.h>
 #include <asm/control.h>
 #include <asm/entry.h>
 #include <asm/gic.h>
@@ -76,6 +80,10 @@ static enum trap_return handle_iabt(struct trap_context *ctx)
 	arm_read_sysreg(HPFAR_EL2, hpfar);
 	arm_read_sysreg(FAR_EL2, hdfar);
 
+	/* first fetch from lazily mapped RAM, let the guest retry */
+	if (cell_map_lazy((hpfar << 8) | (hdfar & 0xfff)))
+		return TRAP_HANDLED;
+
 	panic_printk("FATAL: instruction abort at 0x%lx\n",
 		     (hpfar << 8) | (hdfar & 0xfff));
 	return TRAP_FORBIDDEN;
@@ -152,6 +160,7 @@ static void fill_trap_context(struct trap_context *ctx, union registers *regs)
 
 static const trap_handler trap_handlers[0x40] =
 {
+	[ESR_EC_WFx]		= arch_handle_wfi,
 	[ESR_EC_HVC64]		= handle_hvc,
 	[ESR_EC_SMC64]		= handle_smc,
 	[ESR_EC_SYS64]		= handle_sysreg,
@@ -159,7 +168,16 @@ static const trap_handler trap_handlers[0x40] =
 	[ESR_EC_DABT_LOW]	= arch_handle_dabt,
 };
 
-static void arch_handle_trap(union registers *guest_regs)
+/* Exit latency histograms of trapped exception classes, default: total only */
+static const u8 trap_latency_stats[0x40] =
+{
+	[ESR_EC_HVC64]		= JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL,
+	[ESR_EC_SMC64]		= JAILHOUSE_CPU_STAT_VMEXITS_SMCCC,
+	[ESR_EC_SYS64]		= JAILHOUSE_CPU_STAT_VMEXITS_VSGI,
+	[ESR_EC_DABT_LOW]	= JAILHOUSE_CPU_STAT_VMEXITS_MMIO,
+};
+
+static unsigned int __hot arch_handle_trap(union registers *guest_regs)
 {
 	struct trap_context ctx;
 	trap_handler handler;
@@ -167,6 +185,10 @@ static void arch_handle_trap(union registers *guest_regs)
 
 	fill_trap_context(&ctx, guest_regs);
 
+	/* MMIO exits commit posted writes as needed when dispatching */
+	if (ESR_EC(ctx.esr) != ESR_EC_DABT_LOW)
+		mmio_flush_posted_writes();
+
 	handler = trap_handlers[ESR_EC(ctx.esr)];
 	if (handler)
 		ret = handler(&ctx);
@@ -180,6 +202,8 @@ static void arch_handle_trap(union registers *guest_regs)
 		dump_regs(&ctx);
 		panic_park();
 	}
+
+	return trap_latency_stats[ESR_EC(ctx.esr)];
 }
 
 static void arch_dump_exit(union registers *regs, const char *reason)
@@ -192,17 +216,106 @@ static void arch_dump_exit(union registers *regs, const char *reason)
 	dump_hyp_stack(&ctx);
 }
 
-union registers *arch_handle_exit(union registers *regs)
+/* Hypercalls that only use x0..x2 and never reset or park the caller */
+static bool is_fast_hypercall(unsigned long code)
+{
+	switch (code) {
+	case JAILHOUSE_HC_HYPERVISOR_GET_INFO:
+	case JAILHOUSE_HC_CELL_GET_STATE:
+	case JAILHOUSE_HC_CPU_GET_INFO:
+	case JAILHOUSE_HC_CPU_GET_STATS:
+	case JAILHOUSE_HC_CELL_GET_MMIO_STATS:
+	case JAILHOUSE_HC_DEBUG_CONSOLE_PUTC:
+	case JAILHOUSE_HC_DEBUG_CONSOLE_FLUSH:
+	case JAILHOUSE_HC_DEBUG_CONSOLE_PUTS:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Called by the trap vector with only x0..x18, x29 and x30 saved in @regs,
+ * the slots of x19..x28 are not filled. Handles hypercalls and ICC_SGI1R
+ * writes that do not need those registers and returns true, the vector then
+ * restores the saved registers and returns to the guest. Returns false
+ * without side effects for all other exits, the vector completes @regs and
+ * passes them to arch_handle_exit.
+ */
+bool arch_handle_fast_exit(union registers *regs)
+{
+	struct public_per_cpu *cpu_public = this_cpu_public();
+	u64 start = read_timestamp();
+	unsigned int stat, rt = 0;
+	unsigned long code = 0;
+	u64 esr, pc;
+
+	arm_read_sysreg(ESR_EL2, esr);
+	switch (ESR_EC(esr)) {
+	case ESR_EC_HVC64:
+		code = regs->usr[0];
+		if (ESR_ISS(esr) != JAILHOUSE_HVC_CODE ||
+		    !is_fast_hypercall(code))
+			return false;
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL;
+		break;
+	case ESR_EC_SYS64:
+		rt = (esr >> 5) & 0x1f;
+		if (esr & 1 || !ESR_MATCH_MCR_MRC(esr, 3, 0, 12, 11, 5) ||
+		    (rt >= 19 && rt <= 28))
+			return false;
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_VSGI;
+		break;
+	default:
+		return false;
+	}
+
+	mmio_flush_posted_writes();
+
+	if (stat == JAILHOUSE_CPU_STAT_VMEXITS_VSGI) {
+		/* without GICv3, the full path reports the unhandled trap */
+		if (!gicv3_handle_sgir_write(rt == 31 ? 0 : regs->usr[rt]))
+			return false;
+		arm_read_sysreg(ELR_EL2, pc);
+		arm_write_sysreg(ELR_EL2, pc + (ESR_IL(esr) ? 4 : 2));
+	}
+
+	trace_event(JAILHOUSE_TRACE_VMEXIT, EXIT_REASON_EL1_ABORT, 0);
+	pmu_sample();
+	cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
+
+	if (stat == JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL)
+		regs->usr[0] = hypercall(code, regs->usr[1], regs->usr[2]);
+
+	cpu_account_exit_latency(cpu_public, stat, start);
+
+	if (this_cell() == &root_cell) {
+		uart_drain();
+		watchdog_check();
+	}
+
+	return true;
+}
+
+__hot union registers *arch_handle_exit(union registers *regs)
 {
+	unsigned int stat = JAILHOUSE_CPU_STAT_VMEXITS_TOTAL;
+	u64 start = read_timestamp();
+
+	cpu_record_exit_start(this_cpu_public(), start);
+	trace_event(JAILHOUSE_TRACE_VMEXIT, regs->exit_reason, 0);
+	pmu_sample();
 	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
 
 	switch (regs->exit_reason) {
 	case EXIT_REASON_EL1_IRQ:
+		mmio_flush_posted_writes();
 		irqchip_handle_irq();
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_VIRQ;
 		break;
 
 	case EXIT_REASON_EL1_ABORT:
-		arch_handle_trap(regs);
+		stat = arch_handle_trap(regs);
 		break;
 
 	case EXIT_REASON_EL2_ABORT:
@@ -215,5 +328,13 @@ union registers *arch_handle_exit(union registers *regs)
 		panic_stop();
 	}
 
+	cpu_account_exit_latency(this_cpu_public(), stat, start);
+
+	/* root cell CPUs pass hypervisor output on and check watchdogs */
+	if (this_cell() == &root_cell) {
+		uart_drain();
+		watchdog_check();
+	}
+
 	vmreturn(regs);
 }
@@ -25,7 +25,9 @@
 #include <jailhouse/unit.h>
 #include <asm/amd_iommu.h>
 #include <asm/apic.h>
+#include <asm/ioapic.h>
 #include <asm/iommu.h>
+#include <asm/spinlock.h>
 
 #define CAPS_IOMMU_HEADER_REG		0x00
 #define  CAPS_IOMMU_EFR_SUP		(1 << 27)
@@ -84,6 +86,22 @@ struct dev_table_entry {
 #define DTE_IR				(1UL << 61)
 #define DTE_IW				(1UL << 62)
 
+/* Interrupt remapping, third quadword of the DTE */
+#define DTE_INT_VALID			(1UL << 0)
+#define DTE_INT_TAB_LEN_MASK		BIT_MASK(4, 1)
+#define DTE_INT_TAB_LEN_SHIFT		1
+#define DTE_INT_TAB_ROOT_MASK		BIT_MASK(51, 6)
+#define DTE_INT_CTL_REMAPPED		(2UL << 60)
+
+/* 32-bit IRTE format, guest virtual APIC mode is not used */
+#define IRTE_REMAP_EN			(1U << 0)
+#define IRTE_INT_TYPE_SHIFT		2
+#define IRTE_DEST_LOGICAL		(1U << 6)
+#define IRTE_DEST_SHIFT			8
+#define IRTE_VECTOR_SHIFT		16
+
+#define IRT_MAX_LEN_LOG2		11
+
 #define DEV_TABLE_SEG_MAX		8
 #define DEV_TABLE_SIZE			0x200000
 
@@ -107,6 +125,8 @@ union buf_entry {
 # define CMD_INV_IOMMU_PAGES_SIZE	(1 << 0)
 # define CMD_INV_IOMMU_PAGES_PDE	(1 << 1)
 
+#define CMD_INV_IRT			0x05
+
 #define EVENT_TYPE_ILL_DEV_TAB_ENTRY	0x01
 #define EVENT_TYPE_PAGE_TAB_HW_ERR	0x04
 #define EVENT_TYPE_ILL_CMD_ERR		0x05
@@ -140,6 +160,8 @@ static struct amd_iommu {
 	void *devtable_segments[DEV_TABLE_SEG_MAX];
 	u8 dev_tbl_seg_sup;
 	u32 cmd_tail_ptr;
+	/* Last known head, only refreshed when the buffer appears full. */
+	u32 cmd_head_ptr;
 	bool he_supported;
 } iommu_units[JAILHOUSE_MAX_IOMMU_UNITS];
 
@@ -149,11 +171,28 @@ static struct amd_iommu {
 
 static unsigned int iommu_units_count;
 
+/*
+ * Serializes command submission. Interrupt remapping updates are issued by
+ * running cells, concurrently to cell management.
+ */
+static DEFINE_SPINLOCK(cmd_buf_lock);
+
+/*
+ * Page-aligned range of root cell DMA mappings changed since the last
+ * config commit. Empty if root_inv_start >= root_inv_end.
+ */
+static unsigned long root_inv_start = ~0UL, root_inv_end;
+
 bool iommu_cell_emulates_ir(struct cell *cell)
 {
 	return false;
 }
 
+long iommu_update_root_irtes(unsigned long desc_addr, unsigned long count)
+{
+	return -ENOSYS;
+}
+
 static int amd_iommu_cell_init(struct cell *cell)
 {
 	// HACK for QEMU
@@ -171,12 +210,21 @@ static void amd_iommu_completion_wait(struct amd_iommu *iommu);
 static void amd_iommu_submit_command(struct amd_iommu *iommu,
 				     union buf_entry *cmd, bool draining)
 {
-	u32 head, next_tail, bytes_free;
+	u32 next_tail, bytes_free;
 	unsigned char *cur_ptr;
 
-	head = mmio_read64(iommu->mmio_base + AMD_CMD_BUF_HEAD_REG);
+	/*
+	 * Commands are only queued here, the tail register is written by
+	 * amd_iommu_completion_wait. The cached head lags behind the hardware,
+	 * so only consult the register when running out of space.
+	 */
 	next_tail = (iommu->cmd_tail_ptr + sizeof(*cmd)) % CMD_BUF_SIZE;
-	bytes_free = (head - next_tail) % CMD_BUF_SIZE;
+	bytes_free = (iommu->cmd_head_ptr - next_tail) % CMD_BUF_SIZE;
+	if (bytes_free < (2 * sizeof(*cmd)) && !draining) {
+		iommu->cmd_head_ptr =
+			mmio_read64(iommu->mmio_base + AMD_CMD_BUF_HEAD_REG);
+		bytes_free = (iommu->cmd_head_ptr - next_tail) % CMD_BUF_SIZE;
+	}
 
 	/* Leave space for COMPLETION_WAIT that drains the buffer. */
 	if (bytes_free < (2 * sizeof(*cmd)) && !draining)
@@ -193,6 +241,17 @@ static void amd_iommu_submit_command(struct amd_iommu *iommu,
 		(iommu->cmd_tail_ptr + sizeof(*cmd)) % CMD_BUF_SIZE;
 }
 
+static void amd_iommu_root_inv_range_add(const struct jailhouse_memory *mem)
+{
+	unsigned long end = PAGE_ALIGN(mem->virt_start + mem->size);
+	unsigned long start = mem->virt_start & PAGE_MASK;
+
+	if (start < root_inv_start)
+		root_inv_start = start;
+	if (end > root_inv_end)
+		root_inv_end = end;
+}
+
 u64 amd_iommu_get_memory_region_flags(const struct jailhouse_memory *mem)
 {
 	unsigned long flags = AMD_IOMMU_PTE_P;
@@ -218,6 +277,10 @@ int iommu_map_memory_region(struct cell *cell,
 	if (mem->virt_start & BIT_MASK(63, 48))
 		return trace_error(-E2BIG);
 
+	/* IOMMU and NPT share page tables, track any root cell change. */
+	if (cell == &root_cell)
+		amd_iommu_root_inv_range_add(mem);
+
 	/* vcpu_map_memory_region already did the actual work. */
 	return 0;
 }
@@ -225,10 +288,23 @@ int iommu_map_memory_region(struct cell *cell,
 int iommu_unmap_memory_region(struct cell *cell,
 			      const struct jailhouse_memory *mem)
 {
+	if (cell == &root_cell)
+		amd_iommu_root_inv_range_add(mem);
+
 	/* vcpu_map_memory_region already did the actual work. */
 	return 0;
 }
 
+static void amd_iommu_inv_irt(struct amd_iommu *iommu, u16 device_id)
+{
+	union buf_entry invalidate_irt = {{ 0 }};
+
+	invalidate_irt.raw32[0] = device_id;
+	invalidate_irt.type = CMD_INV_IRT;
+
+	amd_iommu_submit_command(iommu, &invalidate_irt, false);
+}
+
 static void amd_iommu_inv_dte(struct amd_iommu *iommu, u16 device_id)
 {
 	union buf_entry invalidate_dte = {{ 0 }};
@@ -236,7 +312,10 @@ static void amd_iommu_inv_dte(struct amd_iommu *iommu, u16 device_id)
 	invalidate_dte.raw32[0] = device_id;
 	invalidate_dte.type = CMD_INV_DEVTAB_ENTRY;
 
+	spin_lock(&cmd_buf_lock);
 	amd_iommu_submit_command(iommu, &invalidate_dte, false);
+	amd_iommu_inv_irt(iommu, device_id);
+	spin_unlock(&cmd_buf_lock);
 }
 
 static struct dev_table_entry *get_dev_table_entry(struct amd_iommu *iommu,
@@ -303,11 +382,94 @@ static struct dev_table_entry *get_dev_table_entry(struct amd_iommu *iommu,
 	return &devtable_seg[bdf & ~seg_mask];
 }
 
+static u32 *amd_iommu_get_irt(const struct dev_table_entry *dte,
+			      unsigned int *entries)
+{
+	u64 int_info = dte->raw64[2];
+
+	if (!(int_info & DTE_INT_CTL_REMAPPED))
+		return NULL;
+
+	*entries = 1 << ((int_info & DTE_INT_TAB_LEN_MASK) >>
+			 DTE_INT_TAB_LEN_SHIFT);
+	return paging_phys2hvirt(int_info & DTE_INT_TAB_ROOT_MASK);
+}
+
+/*
+ * Attach an interrupt remapping table with at least the given number of
+ * entries to the DTE, all entries blocking. A table that was already attached
+ * is reused if large enough, so that devices keep theirs across owner
+ * changes.
+ */
+static int amd_iommu_init_irt(struct dev_table_entry *dte,
+			      unsigned int entries)
+{
+	unsigned int len_log2 = 0, old_entries;
+	u32 *irt;
+
+	while ((1U << len_log2) < entries)
+		len_log2++;
+	if (len_log2 > IRT_MAX_LEN_LOG2)
+		return trace_error(-ERANGE);
+
+	irt = amd_iommu_get_irt(dte, &old_entries);
+	if (irt && old_entries >= entries) {
+		memset(irt, 0, old_entries * sizeof(*irt));
+		arch_paging_flush_cpu_caches(irt, old_entries * sizeof(*irt));
+		return 0;
+	}
+	if (irt)
+		page_free(&mem_pool, irt, PAGES(old_entries * sizeof(*irt)));
+
+	irt = page_alloc(&mem_pool, PAGES(sizeof(*irt) << len_log2));
+	if (!irt)
+		return -ENOMEM;
+	arch_paging_flush_cpu_caches(irt, sizeof(*irt) << len_log2);
+
+	dte->raw64[2] = paging_hvirt2phys(irt) | DTE_INT_CTL_REMAPPED |
+		((u64)len_log2 << DTE_INT_TAB_LEN_SHIFT) | DTE_INT_VALID;
+
+	return 0;
+}
+
+static int amd_iommu_init_ioapics(void)
+{
+	const struct jailhouse_irqchip *irqchip =
+		jailhouse_cell_irqchips(root_cell.config);
+	struct dev_table_entry *dte;
+	struct amd_iommu *iommu;
+	unsigned int n;
+	int err;
+
+	/* The IRQ chip ID encodes IOMMU index and device ID of the IOAPIC. */
+	for (n = 0; n < root_cell.config->num_irqchips; n++, irqchip++) {
+		if ((irqchip->id >> 16) >= iommu_units_count)
+			return trace_error(-ERANGE);
+		iommu = &iommu_units[irqchip->id >> 16];
+
+		dte = get_dev_table_entry(iommu, (u16)irqchip->id, true);
+		if (!dte)
+			return -ENOMEM;
+
+		err = amd_iommu_init_irt(dte, IOAPIC_MAX_PINS);
+		if (err)
+			return err;
+
+		arch_paging_flush_cpu_caches(dte, sizeof(*dte));
+		amd_iommu_inv_dte(iommu, (u16)irqchip->id);
+	}
+
+	return 0;
+}
+
 int iommu_add_pci_device(struct cell *cell, struct pci_device *device)
 {
+	const struct jailhouse_pci_device *info = device->info;
 	struct dev_table_entry *dte = NULL;
 	struct amd_iommu *iommu;
+	u64 int_info;
 	u16 bdf;
+	int err;
 
 	// HACK for QEMU
 	if (iommu_units_count == 0)
@@ -326,7 +488,15 @@ int iommu_add_pci_device(struct cell *cell, struct pci_device *device)
 	if (!dte)
 		return -ENOMEM;
 
+	/* Keep a previously attached interrupt remapping table. */
+	int_info = dte->raw64[2];
 	memset(dte, 0, sizeof(*dte));
+	dte->raw64[2] = int_info;
+
+	err = amd_iommu_init_irt(dte, MAX(MAX(info->num_msi_vectors,
+					      info->num_msix_vectors), 1));
+	if (err)
+		return err;
 
 	/* DomainID */
 	dte->raw64[1] = cell->config->id & 0xffff;
@@ -336,8 +506,6 @@ int iommu_add_pci_device(struct cell *cell, struct pci_device *device)
 		paging_hvirt2phys(cell->arch.svm.npt_iommu_structs.root_table) |
 		DTE_PAGING_MODE_4_LEVEL | DTE_TRANSLATION_VALID | DTE_VALID;
 
-	/* TODO: Interrupt remapping. For now, just forward them unmapped. */
-
 	/* Flush caches, just to be sure. */
 	arch_paging_flush_cpu_caches(dte, sizeof(*dte));
 
@@ -350,6 +518,8 @@ void iommu_remove_pci_device(struct pci_device *device)
 {
 	struct dev_table_entry *dte = NULL;
 	struct amd_iommu *iommu;
+	unsigned int entries;
+	u32 *irt;
 	u16 bdf;
 
 	// HACK for QEMU
@@ -372,6 +542,13 @@ void iommu_remove_pci_device(struct pci_device *device)
 	 */
 	dte->raw64[0] = DTE_VALID | DTE_TRANSLATION_VALID;
 
+	/* Block interrupts as well, the table is kept for the next owner. */
+	irt = amd_iommu_get_irt(dte, &entries);
+	if (irt) {
+		memset(irt, 0, entries * sizeof(*irt));
+		arch_paging_flush_cpu_caches(irt, entries * sizeof(*irt));
+	}
+
 	/* Flush caches, just to be sure. */
 	arch_paging_flush_cpu_caches(dte, sizeof(*dte));
 
@@ -389,23 +566,44 @@ static void wait_for_zero(volatile u64 *sem, unsigned long mask)
 }
 
 static void amd_iommu_invalidate_pages(struct amd_iommu *iommu,
-				       u16 domain_id)
+				       u16 domain_id, unsigned long start,
+				       unsigned long end)
 {
 	union buf_entry invalidate_pages = {{ 0 }};
+	unsigned long address = start;
+	unsigned int msb;
 
 	/*
-	 * Flush everything, including PDEs, in whole address range, i.e.
-	 * 0x7ffffffffffff000 with S bit (see Sect. 2.2.3).
+	 * Always flush PDEs as well. A single page is addressed directly.
+	 * Larger ranges use the S bit: the lowest clear address bit above the
+	 * page offset encodes the naturally aligned size to invalidate (see
+	 * Sect. 2.2.3). That size is chosen as the smallest one covering
+	 * [start, end). If none exists, flush the whole address range, i.e.
+	 * 0x7ffffffffffff000 with S bit.
 	 */
 	invalidate_pages.raw32[1] = domain_id;
-	invalidate_pages.raw32[2] = 0xfffff000 | CMD_INV_IOMMU_PAGES_SIZE |
-		CMD_INV_IOMMU_PAGES_PDE;
-	invalidate_pages.raw32[3] = 0x7fffffff;
 	invalidate_pages.type = CMD_INV_IOMMU_PAGES;
 
+	if (end - start > PAGE_SIZE) {
+		msb = BITS_PER_LONG - 1 - __builtin_clzl(start ^ (end - 1));
+		if (msb >= 63)
+			address = BIT_MASK(62, 12);
+		else
+			address = (start | ((1UL << msb) - 1)) & PAGE_MASK;
+		address |= CMD_INV_IOMMU_PAGES_SIZE;
+	}
+	invalidate_pages.raw32[2] = (u32)address | CMD_INV_IOMMU_PAGES_PDE;
+	invalidate_pages.raw32[3] = address >> 32;
+
 	amd_iommu_submit_command(iommu, &invalidate_pages, false);
 }
 
+static void amd_iommu_invalidate_domain(struct amd_iommu *iommu,
+					u16 domain_id)
+{
+	amd_iommu_invalidate_pages(iommu, domain_id, 0, ~0UL);
+}
+
 static void amd_iommu_completion_wait(struct amd_iommu *iommu)
 {
 	long addr = paging_hvirt2phys(&per_cpu(this_cpu_id())->amd_iommu_sem);
@@ -423,6 +621,9 @@ static void amd_iommu_completion_wait(struct amd_iommu *iommu)
 		     iommu->cmd_tail_ptr);
 
 	wait_for_zero(&this_cpu_data()->amd_iommu_sem, -1);
+
+	/* The IOMMU has consumed everything up to the wait command. */
+	iommu->cmd_head_ptr = iommu->cmd_tail_ptr;
 }
 
 static void amd_iommu_init_fault_nmi(void)
@@ -474,27 +675,39 @@ static void amd_iommu_init_fault_nmi(void)
 
 void iommu_config_commit(struct cell *cell_added_removed)
 {
+	unsigned long start = root_inv_start, end = root_inv_end;
 	struct amd_iommu *iommu;
 
 	// HACK for QEMU
 	if (iommu_units_count == 0)
 		return;
 
+	root_inv_start = ~0UL;
+	root_inv_end = 0;
+
 	/* Ensure we'll get NMI on completion, or if anything goes wrong. */
 	if (cell_added_removed)
 		amd_iommu_init_fault_nmi();
 
+	/*
+	 * Queue all flushes, including DTE invalidations of devices that
+	 * changed owner, and execute them with a single COMPLETION_WAIT per
+	 * IOMMU. The root cell only needs the range of its mappings that
+	 * actually changed flushed.
+	 */
+	spin_lock(&cmd_buf_lock);
 	for_each_iommu(iommu) {
-		/* Flush caches */
-		if (cell_added_removed) {
-			amd_iommu_invalidate_pages(iommu,
+		if (cell_added_removed)
+			amd_iommu_invalidate_domain(iommu,
 					cell_added_removed->config->id & 0xffff);
+		if (start < end)
 			amd_iommu_invalidate_pages(iommu,
-					root_cell.config->id & 0xffff);
-		}
+					root_cell.config->id & 0xffff,
+					start, end);
 		/* Execute all commands in the buffer */
 		amd_iommu_completion_wait(iommu);
 	}
+	spin_unlock(&cmd_buf_lock);
 }
 
 struct apic_irq_message iommu_get_remapped_root_int(unsigned int iommu,
@@ -508,11 +721,93 @@ struct apic_irq_message iommu_get_remapped_root_int(unsigned int iommu,
 	return dummy;
 }
 
+/*
+ * Each device has its own remapping table, indexed by the MSI vector number
+ * or the IOAPIC pin, respectively.
+ */
 int iommu_map_interrupt(struct cell *cell, u16 device_id, unsigned int vector,
 			struct apic_irq_message irq_msg)
 {
-	/* TODO: Implement */
-	return -ENOSYS;
+	struct dev_table_entry *dte = NULL;
+	struct amd_iommu *iommu;
+	unsigned int entries;
+	u32 *irt = NULL;
+	u32 irte = 0;
+
+	// HACK for QEMU
+	if (iommu_units_count == 0)
+		return -ENOSYS;
+
+	for_each_iommu(iommu) {
+		dte = get_dev_table_entry(iommu, device_id, false);
+		if (dte) {
+			irt = amd_iommu_get_irt(dte, &entries);
+			if (irt)
+				break;
+		}
+	}
+	if (!irt)
+		return -ENOENT;
+	if (vector >= entries)
+		return -ERANGE;
+
+	if (irq_msg.valid) {
+		/*
+		 * If redirection hint is cleared, physical destination mode
+		 * is used effectively, see VT-d.
+		 */
+		irq_msg.dest_logical = irq_msg.dest_logical &&
+			irq_msg.redir_hint;
+
+		if (irq_msg.delivery_mode != APIC_MSG_DLVR_FIXED &&
+		    irq_msg.delivery_mode != APIC_MSG_DLVR_LOWPRI)
+			return -EINVAL;
+		/* The 32-bit IRTE can only address 8-bit APIC IDs. */
+		if (using_x2apic &&
+		    (irq_msg.dest_logical || irq_msg.destination > 0xff))
+			return -ERANGE;
+		if (!apic_filter_irq_dest(cell, &irq_msg))
+			return -EPERM;
+
+		irte = IRTE_REMAP_EN |
+			(irq_msg.delivery_mode << IRTE_INT_TYPE_SHIFT) |
+			(irq_msg.dest_logical ? IRTE_DEST_LOGICAL : 0) |
+			((irq_msg.destination & 0xff) << IRTE_DEST_SHIFT) |
+			(irq_msg.vector << IRTE_VECTOR_SHIFT);
+	}
+
+	if (irt[vector] != irte) {
+		irt[vector] = irte;
+		arch_paging_flush_cpu_caches(&irt[vector], sizeof(irte));
+
+		spin_lock(&cmd_buf_lock);
+		amd_iommu_inv_irt(iommu, device_id);
+		amd_iommu_completion_wait(iommu);
+		spin_unlock(&cmd_buf_lock);
+	}
+
+	return vector;
+}
+
+union x86_msi_vector iommu_get_remapped_msi(unsigned int remap_index)
+{
+	/* The table offset is taken from data[10:0]. */
+	union x86_msi_vector msi = {
+		.raw.address = (u64)MSI_ADDRESS_VALUE << 20,
+		.raw.data = remap_index,
+	};
+
+	return msi;
+}
+
+void iommu_remap_ioapic_entry(union ioapic_redir_entry *entry,
+			      unsigned int remap_index)
+{
+	entry->native.vector = remap_index;
+	entry->native.delivery_mode = 0;
+	entry->native.dest_logical = 0;
+	entry->native.edid = 0;
+	entry->native.destination = 0;
 }
 
 static void amd_iommu_print_event(struct amd_iommu *iommu,
@@ -750,6 +1045,7 @@ static int amd_iommu_init_buffers(struct amd_iommu *entry,
 		     ((u64)CMD_BUF_LEN_EXPONENT << BUF_LEN_EXPONENT_SHIFT));
 
 	entry->cmd_tail_ptr = 0;
+	entry->cmd_head_ptr = 0;
 
 	/* Allocate and configure event log */
 	entry->evt_log_base = page_alloc(&mem_pool, PAGES(EVT_LOG_SIZE));
@@ -773,7 +1069,7 @@ static void amd_iommu_enable_command_processing(struct amd_iommu *iommu)
 	mmio_write64(iommu->mmio_base + AMD_CONTROL_REG, ctrl_reg);
 }
 
-static int amd_iommu_init(void)
+static int __init amd_iommu_init(void)
 {
 	struct jailhouse_iommu *iommu;
 	struct amd_iommu *entry;
@@ -813,6 +1109,12 @@ static int amd_iommu_init(void)
 		iommu_units_count++;
 	}
 
+	if (iommu_units_count > 0) {
+		err = amd_iommu_init_ioapics();
+		if (err)
+			return err;
+	}
+
 	return amd_iommu_cell_init(&root_cell);
 }
 
@@ -67,9 +67,6 @@ static struct {
 	void (*send_ipi)(u32 apic_id, u32 icr_lo);
 } apic_ops;
 
-void arch_send_event(struct public_per_cpu *target_data)
-	__attribute__((alias("apic_send_nmi_ipi")));
-
 static u32 read_xapic(unsigned int reg)
 {
 	return mmio_read32(xapic_page + XAPIC_REG(reg));
@@ -130,7 +127,7 @@ unsigned long phys_processor_id(void)
 	return apic_ops.read_id();
 }
 
-int apic_cpu_init(struct per_cpu *cpu_data)
+int __init apic_cpu_init(struct per_cpu *cpu_data)
 {
 	unsigned int xlc = MAX((apic_ext_features() >> 16) & 0xff,
 			       APIC_REG_XLVT3 - APIC_REG_XLVT0 + 1);
@@ -171,7 +168,7 @@ int apic_cpu_init(struct per_cpu *cpu_data)
 	return 0;
 }
 
-int apic_init(void)
+int __init apic_init(void)
 {
 	unsigned long apicbase = read_msr(MSR_IA32_APICBASE);
 	u8 apic_mode = system_config->platform_info.x86.apic_mode;
@@ -200,7 +197,6 @@ int apic_init(void)
 		apic_reserved_bits[APIC_REG_LDR] = 0; /* separately filtered */
 		apic_reserved_bits[APIC_REG_DFR] = 0; /* separately filtered */
 		apic_reserved_bits[APIC_REG_ICR_HI] = 0x00ffffff;
-		apic_reserved_bits[APIC_REG_SELF_IPI] = -1; /* not available */
 	} else
 		return trace_error(-EIO);
 
@@ -211,6 +207,7 @@ int apic_init(void)
 
 void apic_send_nmi_ipi(struct public_per_cpu *target_data)
 {
+	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_IPIS_SENT]++;
 	apic_ops.send_ipi(target_data->apic_id,
 			  APIC_ICR_DLVR_NMI |
 			  APIC_ICR_DEST_PHYSICAL |
@@ -219,6 +216,47 @@ void apic_send_nmi_ipi(struct public_per_cpu *target_data)
 			  APIC_ICR_SH_NONE);
 }
 
+/*
+ * In x2APIC mode, the logical ID of a CPU is fixed by its APIC ID: the cluster
+ * of 16 IDs in the upper half, one bit per cluster member in the lower half.
+ * Events to CPUs of the same cluster are therefore combined into a single
+ * logical NMI. In xAPIC mode, logical IDs are up to the root cell, so events
+ * are sent right away.
+ */
+void arch_queue_event(struct public_per_cpu *target_data)
+{
+	u32 *queued = &this_cpu_data()->queued_events;
+	u32 apic_id = target_data->apic_id;
+	u32 dest;
+
+	if (!using_x2apic) {
+		apic_send_nmi_ipi(target_data);
+		return;
+	}
+
+	dest = (apic_id >> 4) << 16 | 1 << (apic_id & 0xf);
+	if (*queued && (*queued >> 16) != (dest >> 16))
+		arch_flush_events();
+	*queued |= dest;
+}
+
+void arch_flush_events(void)
+{
+	u32 *queued = &this_cpu_data()->queued_events;
+
+	if (!*queued)
+		return;
+
+	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_IPIS_SENT]++;
+	apic_ops.send_ipi(*queued,
+			  APIC_ICR_DLVR_NMI |
+			  APIC_ICR_DEST_LOGICAL |
+			  APIC_ICR_LV_ASSERT |
+			  APIC_ICR_TM_EDGE |
+			  APIC_ICR_SH_NONE);
+	*queued = 0;
+}
+
 /**
  * Return whether an interrupt's destination CPU is within a given cell. Also
  * return a filtered destination mask.
@@ -267,6 +305,7 @@ void apic_send_irq(struct apic_irq_message irq_msg)
 		if (irq_msg.dest_logical && irq_msg.destination != 0)
 			irq_msg.destination = 1UL << ffsl(irq_msg.destination);
 	}
+	this_cpu_public()->stats[JAILHOUSE_CPU_STAT_IRQS_INJECTED]++;
 	apic_ops.send_ipi(irq_msg.destination,
 			  irq_msg.vector | delivery_mode |
 			  (irq_msg.dest_logical ? APIC_ICR_DEST_LOGICAL : 0) |
@@ -275,7 +314,7 @@ void apic_send_irq(struct apic_irq_message irq_msg)
 			  APIC_ICR_SH_NONE);
 }
 
-void apic_irq_handler(void)
+void __hot apic_irq_handler(void)
 {
 	struct per_cpu *cpu_data = this_cpu_data();
 
@@ -343,6 +382,11 @@ void apic_clear(void)
 	apic_ops.write(APIC_REG_SVR, 0xff);
 }
 
+void apic_set_lvtpc_nmi(void)
+{
+	apic_ops.write(APIC_REG_LVTPC, APIC_LVT_DLVR_NMI);
+}
+
 static bool apic_valid_ipi_mode(u32 lo_val)
 {
 	switch (lo_val & APIC_ICR_DLVR_MASK) {
@@ -361,6 +405,7 @@ static bool apic_valid_ipi_mode(u32 lo_val)
 	switch (lo_val & APIC_ICR_SH_MASK) {
 	case APIC_ICR_SH_NONE:
 	case APIC_ICR_SH_SELF:
+	case APIC_ICR_SH_ALLOTHER:
 		break;
 	default:
 		panic_printk("FATAL: Unsupported shorthand, ICR.lo=%x\n",
@@ -370,6 +415,13 @@ static bool apic_valid_ipi_mode(u32 lo_val)
 	return true;
 }
 
+static void apic_send_self_ipi(u32 vector)
+{
+	apic_ops.write(APIC_REG_ICR, (vector & APIC_ICR_VECTOR_MASK) |
+				     APIC_ICR_DLVR_FIXED | APIC_ICR_TM_EDGE |
+				     APIC_ICR_SH_SELF);
+}
+
 static void apic_send_ipi(unsigned int target_cpu_id, u32 orig_icr_hi,
 			  u32 icr_lo)
 {
@@ -396,6 +448,7 @@ static void apic_send_ipi(unsigned int target_cpu_id, u32 orig_icr_hi,
 				   icr_lo & APIC_ICR_VECTOR_MASK);
 		break;
 	default:
+		this_cpu_public()->stats[JAILHOUSE_CPU_STAT_IPIS_SENT]++;
 		apic_ops.send_ipi(public_per_cpu(target_cpu_id)->apic_id,
 				  icr_lo);
 	}
@@ -410,6 +463,19 @@ static void apic_send_logical_dest_ipi(u32 lo_val, u32 hi_val)
 	unsigned int apic_id;
 
 	if (using_x2apic) {
+		/*
+		 * x2APIC logical IDs follow from the APIC IDs. So a fixed IPI
+		 * whose destination is fully owned by the cell can be sent as
+		 * is, reaching the whole cluster with a single ICR write.
+		 */
+		if ((lo_val & APIC_ICR_DLVR_MASK) == APIC_ICR_DLVR_FIXED &&
+		    dest & X2APIC_DEST_LOGICAL_ID_MASK &&
+		    x2apic_filter_logical_dest(this_cell(), dest) == dest) {
+			this_cpu_public()->stats[JAILHOUSE_CPU_STAT_IPIS_SENT]++;
+			apic_ops.send_ipi(dest, lo_val | APIC_ICR_DEST_LOGICAL);
+			return;
+		}
+
 		cluster_id = (dest & X2APIC_DEST_CLUSTER_ID_MASK) >>
 			X2APIC_DEST_CLUSTER_ID_SHIFT;
 		dest &= X2APIC_DEST_LOGICAL_ID_MASK;
@@ -437,18 +503,24 @@ static void apic_send_logical_dest_ipi(u32 lo_val, u32 hi_val)
  *
  * @return True if request was successfully validated and executed.
  */
-static bool apic_handle_icr_write(u32 lo_val, u32 hi_val)
+static bool __hot apic_handle_icr_write(u32 lo_val, u32 hi_val)
 {
 	unsigned int target_cpu_id;
 
 	if (!apic_valid_ipi_mode(lo_val))
 		return false;
 
+	if ((lo_val & APIC_ICR_SH_MASK) == APIC_ICR_SH_ALLOTHER) {
+		/* e.g. INIT/SIPI to start all APs of the cell in parallel */
+		lo_val &= ~(APIC_ICR_SH_MASK | APIC_ICR_DEST_LOGICAL);
+		for_each_cpu_except(target_cpu_id, this_cell()->cpu_set,
+				    this_cpu_id())
+			apic_send_ipi(target_cpu_id, hi_val, lo_val);
+		return true;
+	}
+
 	if ((lo_val & APIC_ICR_SH_MASK) == APIC_ICR_SH_SELF) {
-		apic_ops.write(APIC_REG_ICR, (lo_val & APIC_ICR_VECTOR_MASK) |
-					     APIC_ICR_DLVR_FIXED |
-					     APIC_ICR_TM_EDGE |
-					     APIC_ICR_SH_SELF);
+		apic_send_self_ipi(lo_val);
 		return true;
 	}
 
@@ -504,6 +576,10 @@ unsigned int apic_mmio_access(const struct guest_paging_structures *pg_structs,
 	inst = x86_mmio_parse(pg_structs, is_write);
 	if (inst.inst_len == 0)
 		return 0;
+	if (inst.string_op) {
+		panic_printk("FATAL: Unsupported APIC string access\n");
+		return 0;
+	}
 	if (inst.access_size != 4) {
 		panic_printk("FATAL: Unsupported APIC access width %d\n",
 			     inst.access_size);
@@ -543,10 +619,10 @@ unsigned int apic_mmio_access(const struct guest_paging_structures *pg_structs,
 	return inst.inst_len;
 }
 
-bool x2apic_handle_write(void)
+bool __hot x2apic_handle_write(void)
 {
 	union registers *guest_regs = &this_cpu_data()->guest_regs;
-	u32 *stats = this_cpu_public()->stats;
+	u64 *stats = this_cpu_public()->stats;
 	u32 reg = guest_regs->rcx - MSR_X2APIC_BASE;
 	u32 val = guest_regs->rax;
 
@@ -561,8 +637,7 @@ bool x2apic_handle_write(void)
 	stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER]++;
 
 	if (reg == APIC_REG_SELF_IPI)
-		/* TODO: emulate */
-		printk("Unhandled x2APIC self IPI write\n");
+		apic_send_self_ipi(val);
 	else if (reg >= APIC_REG_LVTCMCI && reg <= APIC_REG_LVTERR &&
 		 apic_invalid_lvt_delivery_mode(reg, val))
 		return false;
@@ -571,12 +646,33 @@ bool x2apic_handle_write(void)
 	return true;
 }
 
+/**
+ * Get the MSRs that only act on the own CPU's APIC.
+ * @param msrs		Set to the MSR list.
+ *
+ * They are accessed without VM exit even by cells with an MSR whitelist.
+ *
+ * @return Number of MSRs in the list.
+ */
+unsigned int apic_get_local_msrs(const u32 **msrs)
+{
+	static const u32 local_msrs[] = {
+		MSR_IA32_TSC_DEADLINE,
+		MSR_X2APIC_BASE + APIC_REG_EOI,
+		MSR_X2APIC_BASE + APIC_REG_SELF_IPI,
+	};
+
+	*msrs = local_msrs;
+	/* x2APIC registers are emulated on top of xAPIC */
+	return using_x2apic ? ARRAY_SIZE(local_msrs) : 1;
+}
+
 /* must only be called for readable registers */
-void x2apic_handle_read(void)
+void __hot x2apic_handle_read(void)
 {
 	union registers *guest_regs = &this_cpu_data()->guest_regs;
 	u32 reg = guest_regs->rcx - MSR_X2APIC_BASE;
-	u32 *stats = this_cpu_public()->stats;
+	u64 *stats = this_cpu_public()->stats;
 
 	if (reg == APIC_REG_ID)
 		guest_regs->rax = apic_ops.read_id();
@@ -12,6 +12,7 @@
 
 #include <jailhouse/control.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/string.h>
 #include <jailhouse/unit.h>
 #include <jailhouse/utils.h>
 #include <asm/cat.h>
@@ -20,17 +21,70 @@
 
 #define CAT_ROOT_COS	0
 
+#define MAX_L2_DOMAINS	128
+
 static unsigned int cbm_max, freed_mask;
 static int cos_max = -1;
 static u64 orig_root_mask;
+static bool l3_cat, cdp;
+
+/*
+ * L2 masks are scoped per L2 domain (module), i.e. the COS0 mask of the root
+ * cell can differ between modules. It excludes the masks of non-root cells
+ * running in the same module.
+ */
+static bool l2_cat;
+static unsigned int l2_cbm_max, l2_domain_shift;
+static u64 l2_root_base_mask;
+static u64 l2_root_mask[MAX_L2_DOMAINS];
+
+/* Memory bandwidth allocation, throttling delay in percent per COS */
+static bool mba;
+static unsigned int mba_max_delay, mba_granularity;
+
+/*
+ * Cache and memory bandwidth monitoring, one RMID per cell. The hardware
+ * events are numbered like JAILHOUSE_QOS_* plus 1. Bandwidth counters are
+ * narrow and wrap quickly, so they are accumulated on each read.
+ */
+static unsigned int qm_events, rmid_max, qm_upscale;
+static u64 mbm_ctr_mask;
+static DEFINE_SPINLOCK(qm_lock);
+
+static unsigned int l2_domain(unsigned int cpu)
+{
+	return public_per_cpu(cpu)->apic_id >> l2_domain_shift;
+}
 
 void cat_update(void)
 {
 	struct cell *cell = this_cell();
 
 	write_msr(MSR_IA32_PQR_ASSOC,
-		  (u64)cell->arch.cos << PQR_ASSOC_COS_SHIFT);
-	write_msr(MSR_IA32_L3_MASK_0 + cell->arch.cos, cell->arch.cat_mask);
+		  ((u64)cell->arch.cos << PQR_ASSOC_COS_SHIFT) |
+		  cell->arch.rmid);
+
+	if (mba)
+		write_msr(MSR_IA32_MBA_THRTL_0 + cell->arch.cos,
+			  cell->arch.mba_delay);
+
+	if (l2_cat)
+		write_msr(MSR_IA32_L2_MASK_0 + cell->arch.cos,
+			  cell->arch.l2_mask ? cell->arch.l2_mask :
+			  l2_root_mask[l2_domain(this_cpu_id())]);
+
+	if (!l3_cat)
+		return;
+	if (cdp) {
+		/* with CDP, each COS has a data and a code mask */
+		write_msr(MSR_IA32_L3_MASK_0 + cell->arch.cos * 2,
+			  cell->arch.cat_mask);
+		write_msr(MSR_IA32_L3_MASK_0 + cell->arch.cos * 2 + 1,
+			  cell->arch.cat_code_mask);
+	} else {
+		write_msr(MSR_IA32_L3_MASK_0 + cell->arch.cos,
+			  cell->arch.cat_mask);
+	}
 }
 
 /* root cell has to be stopped */
@@ -38,6 +92,10 @@ static void cat_update_cell(struct cell *cell)
 {
 	unsigned int cpu;
 
+	/* The root cell uses a unified mask, also when it is resized. */
+	if (cell == &root_cell)
+		root_cell.arch.cat_code_mask = root_cell.arch.cat_mask;
+
 	for_each_cpu(cpu, cell->cpu_set)
 		if (cpu == this_cpu_id())
 			cat_update();
@@ -45,6 +103,107 @@ static void cat_update_cell(struct cell *cell)
 			public_per_cpu(cpu)->update_cat = true;
 }
 
+static bool cell_uses_l2_domain(struct cell *cell, unsigned int domain,
+				struct cell *except)
+{
+	unsigned int cpu;
+
+	for_each_cpu(cpu, cell->cpu_set)
+		if (l2_domain(cpu) == domain &&
+		    (!except || !cell_owns_cpu(except, cpu)))
+			return true;
+	return false;
+}
+
+/*
+ * Recompute the root cell's L2 mask for each domain, taking the exclusive
+ * masks of all non-root cells into account, plus an added cell that is not
+ * yet listed or minus a removed one. Fails if a domain that still hosts
+ * root cell CPUs would end up with an empty or non-contiguous mask.
+ */
+static bool update_root_l2_masks(struct cell *added, struct cell *removed)
+{
+	/* too large for the stack, cell management is serialized anyway */
+	static u64 masks[MAX_L2_DOMAINS];
+	unsigned int domain;
+	struct cell *cell;
+	u64 mask;
+
+	for (domain = 0; domain < MAX_L2_DOMAINS; domain++) {
+		mask = l2_root_base_mask;
+		for_each_non_root_cell(cell)
+			if (cell != removed &&
+			    cell_uses_l2_domain(cell, domain, NULL))
+				mask &= ~cell->arch.l2_exclusive_mask;
+		if (added && cell_uses_l2_domain(added, domain, NULL))
+			mask &= ~added->arch.l2_exclusive_mask;
+
+		if (cell_uses_l2_domain(&root_cell, domain, added) &&
+		    (mask == 0 ||
+		     ((mask >> ffsl(mask)) & ((mask >> ffsl(mask)) + 1))))
+			return false;
+
+		masks[domain] = mask ? mask : l2_root_base_mask;
+	}
+
+	memcpy(l2_root_mask, masks, sizeof(l2_root_mask));
+	return true;
+}
+
+static int l2_cell_init(struct cell *cell, const struct jailhouse_cache *cache)
+{
+	struct cell *other;
+	unsigned int cpu;
+
+	if (!l2_cat || cell->arch.l2_mask || cache->size == 0 ||
+	    (cache->start + cache->size) > l2_cbm_max)
+		return trace_error(-EINVAL);
+
+	cell->arch.l2_mask = BIT_MASK(cache->start + cache->size - 1,
+				      cache->start);
+
+	if (cell == &root_cell) {
+		l2_root_base_mask = cell->arch.l2_mask;
+		cell->arch.l2_mask = 0;
+		return 0;
+	}
+
+	if (!(cache->flags & JAILHOUSE_CACHE_ROOTSHARED))
+		cell->arch.l2_exclusive_mask = cell->arch.l2_mask;
+
+	/* Cells may only share a module if their masks are disjoint. */
+	for_each_non_root_cell(other)
+		for_each_cpu(cpu, cell->cpu_set)
+			if (cell_uses_l2_domain(other, l2_domain(cpu), NULL) &&
+			    (other->arch.l2_exclusive_mask |
+			     cell->arch.l2_exclusive_mask) &
+			    other->arch.l2_mask & cell->arch.l2_mask)
+				return trace_error(-EBUSY);
+
+	return 0;
+}
+
+static int mba_cell_init(struct cell *cell, const struct jailhouse_cache *cache)
+{
+	unsigned int bandwidth;
+
+	if (!mba || cache->start != 0 || cache->size == 0 ||
+	    cache->size > 100)
+		return trace_error(-EINVAL);
+
+	/* round up to the next supported bandwidth step */
+	bandwidth = (cache->size + mba_granularity - 1) / mba_granularity *
+		mba_granularity;
+	cell->arch.mba_delay = bandwidth < 100 ? 100 - bandwidth : 0;
+	if (cell->arch.mba_delay > mba_max_delay)
+		return trace_error(-EINVAL);
+
+	printk("CAT: Limiting memory bandwidth of cell %s to %d%%\n",
+	       cell->config->name, 100 - cell->arch.mba_delay);
+
+	return 0;
+}
+
 static u32 get_free_cos(void)
 {
 	struct cell *cell;
@@ -135,11 +294,105 @@ static bool shrink_root_cell_mask(u64 cell_mask)
 	return true;
 }
 
+static u32 get_free_rmid(void)
+{
+	struct cell *cell;
+	u32 rmid = 0;
+
+retry:
+	for_each_cell(cell)
+		if (cell->arch.rmid == rmid) {
+			rmid++;
+			goto retry;
+		}
+
+	return rmid;
+}
+
+static int qm_read(u32 rmid, unsigned int event, u64 *value)
+{
+	u64 ctr;
+
+	write_msr(MSR_IA32_QM_EVTSEL,
+		  ((u64)rmid << QM_EVTSEL_RMID_SHIFT) | (event + 1));
+	ctr = read_msr(MSR_IA32_QM_CTR);
+	if (ctr & (QM_CTR_ERROR | QM_CTR_UNAVAILABLE))
+		return -EIO;
+
+	*value = ctr;
+	return 0;
+}
+
+long cat_get_qos_info(struct cell *cell, unsigned int event)
+{
+	unsigned int n;
+	u64 ctr;
+	int err;
+
+	if (!(qm_events & (1 << event)) ||
+	    (cell != &root_cell && cell->arch.rmid == 0))
+		return -EINVAL;
+
+	spin_lock(&qm_lock);
+
+	err = qm_read(cell->arch.rmid, event, &ctr);
+	if (err) {
+		spin_unlock(&qm_lock);
+		return err;
+	}
+
+	if (event != JAILHOUSE_QOS_L3_OCCUPANCY) {
+		n = event - JAILHOUSE_QOS_MEM_BW_TOTAL;
+		cell->arch.mbm_bytes[n] += ((ctr - cell->arch.mbm_last[n]) &
+					    mbm_ctr_mask) * qm_upscale;
+		cell->arch.mbm_last[n] = ctr;
+		ctr = cell->arch.mbm_bytes[n] / 1024;
+	} else {
+		ctr = ctr * qm_upscale / 1024;
+	}
+
+	spin_unlock(&qm_lock);
+
+	return ctr & BIT_MASK(30, 0);
+}
+
+static void qm_cell_init(struct cell *cell)
+{
+	unsigned int n;
+
+	cell->arch.rmid = 0;
+	if (qm_events == 0 || cell == &root_cell)
+		return;
+
+	cell->arch.rmid = get_free_rmid();
+	if (cell->arch.rmid > rmid_max) {
+		printk("CAT: No RMID left, not monitoring cell %s\n",
+		       cell->config->name);
+		cell->arch.rmid = 0;
+		return;
+	}
+
+	/* the RMID may have been used before, start from its current state */
+	for (n = 0; n < ARRAY_SIZE(cell->arch.mbm_last); n++) {
+		cell->arch.mbm_bytes[n] = 0;
+		if (qm_read(cell->arch.rmid, JAILHOUSE_QOS_MEM_BW_TOTAL + n,
+			    &cell->arch.mbm_last[n]))
+			cell->arch.mbm_last[n] = 0;
+	}
+}
+
 static int cat_cell_init(struct cell *cell)
 {
 	const struct jailhouse_cache *cache;
+	u64 mask, exclusive_mask = 0;
+	unsigned int n;
+	int err;
 
 	cell->arch.cos = CAT_ROOT_COS;
+	cell->arch.l2_mask = cell->arch.l2_exclusive_mask = 0;
+	cell->arch.mba_delay = 0;
+
+	qm_cell_init(cell);
 
 	if (cos_max < 0)
 		return 0;
@@ -151,21 +404,75 @@ static int cat_cell_init(struct cell *cell)
 				return trace_error(-EBUSY);
 		}
 
+		/*
+		 * Either a single unified L3 region or, with CDP, one code and
+		 * one data region. The root cell is always unified. An L2
+		 * region can be added on top.
+		 */
+		cell->arch.cat_mask = cell->arch.cat_code_mask = 0;
 		cache = jailhouse_cell_cache_regions(cell->config);
+		for (n = 0; n < cell->config->num_cache_regions; n++, cache++) {
+			if (cache->type == JAILHOUSE_CACHE_L2) {
+				err = l2_cell_init(cell, cache);
+				if (err)
+					return err;
+				continue;
+			}
+			if (cache->type == JAILHOUSE_CACHE_MEM_BW) {
+				err = mba_cell_init(cell, cache);
+				if (err)
+					return err;
+				continue;
+			}
+
+			if (!l3_cat || (cache->type & ~JAILHOUSE_CACHE_L3) ||
+			    !(cache->type & JAILHOUSE_CACHE_L3) ||
+			    cache->size == 0 ||
+			    (cache->start + cache->size) > cbm_max)
+				return trace_error(-EINVAL);
 
-		if (cell->config->num_cache_regions != 1 ||
-		    cache->type != JAILHOUSE_CACHE_L3 ||
-		    cache->size == 0 || (cache->start + cache->size) > cbm_max)
+			if (cache->type != JAILHOUSE_CACHE_L3 &&
+			    (!cdp || cell == &root_cell))
+				return trace_error(-EINVAL);
+
+			mask = BIT_MASK(cache->start + cache->size - 1,
+					cache->start);
+
+			if (cache->type & JAILHOUSE_CACHE_L3_DATA) {
+				if (cell->arch.cat_mask)
+					return trace_error(-EINVAL);
+				cell->arch.cat_mask = mask;
+			}
+			if (cache->type & JAILHOUSE_CACHE_L3_CODE) {
+				if (cell->arch.cat_code_mask)
+					return trace_error(-EINVAL);
+				cell->arch.cat_code_mask = mask;
+			}
+
+			if (!(cache->flags & JAILHOUSE_CACHE_ROOTSHARED))
+				exclusive_mask |= mask;
+		}
+		/* Without an own L3 region, the L3 mask of the root is used. */
+		if (!cell->arch.cat_mask && !cell->arch.cat_code_mask)
+			cell->arch.cat_mask = cell->arch.cat_code_mask =
+				(cell == &root_cell) ? BIT_MASK(cbm_max, 0) :
+				root_cell.arch.cat_mask;
+		if (!cell->arch.cat_mask || !cell->arch.cat_code_mask)
 			return trace_error(-EINVAL);
 
-		cell->arch.cat_mask =
-			BIT_MASK(cache->start + cache->size - 1, cache->start);
+		if (l2_cat && !update_root_l2_masks(cell, NULL))
+			return trace_error(-EINVAL);
 
 		if (cell != &root_cell &&
-		    !(cache->flags & JAILHOUSE_CACHE_ROOTSHARED) &&
-		    (root_cell.arch.cat_mask & cell->arch.cat_mask) != 0)
-			if (!shrink_root_cell_mask(cell->arch.cat_mask))
+		    (root_cell.arch.cat_mask & exclusive_mask) != 0)
+			if (!shrink_root_cell_mask(exclusive_mask)) {
+				if (l2_cat)
+					update_root_l2_masks(NULL, NULL);
 				return trace_error(-EINVAL);
+			}
+
+		if (cell != &root_cell && cell->arch.l2_exclusive_mask)
+			cat_update_cell(&root_cell);
 
 		cat_update_cell(cell);
 	} else {
@@ -176,16 +483,30 @@ static int cat_cell_init(struct cell *cell)
 		 */
 		cell->arch.cat_mask = (cell == &root_cell) ?
 			BIT_MASK(cbm_max, 0) : root_cell.arch.cat_mask;
+		cell->arch.cat_code_mask = cell->arch.cat_mask;
 	}
 
-	printk("CAT: Using COS %d with bitmask %08llx for cell %s\n",
-	       cell->arch.cos, cell->arch.cat_mask, cell->config->name);
+	if (cdp)
+		printk("CAT: Using COS %d with data bitmask %08llx and code "
+		       "bitmask %08llx for cell %s\n", cell->arch.cos,
+		       cell->arch.cat_mask, cell->arch.cat_code_mask,
+		       cell->config->name);
+	else
+		printk("CAT: Using COS %d with bitmask %08llx for cell %s\n",
+		       cell->arch.cos, cell->arch.cat_mask,
+		       cell->config->name);
+	if (cell->arch.l2_mask)
+		printk("CAT: Using L2 bitmask %08llx for cell %s\n",
+		       cell->arch.l2_mask, cell->config->name);
 
 	return 0;
 }
 
 static void cat_cell_exit(struct cell *cell)
 {
+	/* An own RMID is released by the CPUs' reset into the root cell. */
+	cell->arch.rmid = 0;
+
 	/*
 	 * Only release the mask of cells with an own partition.
 	 * cos is also CAT_ROOT_COS if CAT is unsupported.
@@ -193,11 +514,18 @@ static void cat_cell_exit(struct cell *cell)
 	if (cell->arch.cos == CAT_ROOT_COS)
 		return;
 
+	if (cell->arch.l2_exclusive_mask) {
+		/* can't fail, the domains only get more room */
+		update_root_l2_masks(NULL, cell);
+		cat_update_cell(&root_cell);
+	}
+
 	/*
 	 * Queue bits of released mask for returning to root that were in the
 	 * original root mask as well.
 	 */
-	freed_mask |= cell->arch.cat_mask & orig_root_mask;
+	freed_mask |= (cell->arch.cat_mask | cell->arch.cat_code_mask) &
+		orig_root_mask;
 
 	if (merge_freed_mask_to_root()) {
 		printk("CAT: Extended root cell bitmask to %08llx\n",
@@ -206,18 +534,122 @@ static void cat_cell_exit(struct cell *cell)
 	}
 }
 
+static void l2_cat_init(void)
+{
+	unsigned int n, eax, sharing, cpu;
+	int l2_cos_max;
+
+	/* Find the L2 in the deterministic cache parameters. */
+	for (n = 0; ; n++) {
+		eax = cpuid_eax(4, n);
+		if ((eax & CPUID_CACHE_TYPE_MASK) == 0)
+			return;
+		if ((eax & CPUID_CACHE_LEVEL_MASK) >> CPUID_CACHE_LEVEL_SHIFT
+		    == 2)
+			break;
+	}
+
+	/* CPUs sharing the L2 only differ in the lower APIC ID bits. */
+	sharing = ((eax & CPUID_CACHE_SHARING_MASK) >>
+		   CPUID_CACHE_SHARING_SHIFT) + 1;
+	while ((1U << l2_domain_shift) < sharing)
+		l2_domain_shift++;
+
+	for_each_cpu(cpu, root_cell.cpu_set)
+		if (l2_domain(cpu) >= MAX_L2_DOMAINS) {
+			printk("CAT: Too many L2 domains, not partitioning "
+			       "L2\n");
+			return;
+		}
+
+	l2_cbm_max = cpuid_eax(0x10, CAT_RESID_L2) & CAT_CBM_LEN_MASK;
+	l2_cos_max = cpuid_edx(0x10, CAT_RESID_L2) & CAT_COS_MAX_MASK;
+	cos_max = (cos_max < 0) ? l2_cos_max : MIN(cos_max, l2_cos_max);
+
+	l2_root_base_mask = BIT_MASK(l2_cbm_max, 0);
+	l2_cat = true;
+
+	printk("CAT: L2 partitioning, %d CPUs per domain\n", sharing);
+}
+
+static void mba_init(void)
+{
+	int mba_cos_max;
+
+	/* Only the linear throttling scale maps to percentages. */
+	if (!(cpuid_ecx(0x10, CAT_RESID_MBA) & MBA_LINEAR))
+		return;
+
+	mba_max_delay = (cpuid_eax(0x10, CAT_RESID_MBA) &
+			 MBA_MAX_DELAY_MASK) + 1;
+	mba_granularity = 100 - mba_max_delay;
+	if (mba_max_delay >= 100 || mba_granularity == 0)
+		return;
+
+	mba_cos_max = cpuid_edx(0x10, CAT_RESID_MBA) & CAT_COS_MAX_MASK;
+	cos_max = (cos_max < 0) ? mba_cos_max : MIN(cos_max, mba_cos_max);
+	mba = true;
+
+	printk("CAT: Memory bandwidth allocation in %d%% steps\n",
+	       mba_granularity);
+}
+
+static void qm_init(void)
+{
+	unsigned int width;
+
+	if (!(cpuid_edx(0xf, 0) & CMT_L3_SUPPORT))
+		return;
+
+	/* L3 occupancy and total/local bandwidth map to EDX bits 0..2 */
+	qm_events = cpuid_edx(0xf, 1) & BIT_MASK(JAILHOUSE_NUM_QOS_EVENTS - 1,
+						 0);
+	rmid_max = MIN(cpuid_ecx(0xf, 1), PQR_ASSOC_RMID_MASK);
+	qm_upscale = cpuid_ebx(0xf, 1);
+	width = (cpuid_eax(0xf, 1) & CMT_CTR_WIDTH_MASK) + CMT_CTR_WIDTH_BASE;
+	mbm_ctr_mask = BIT_MASK(width - 1, 0);
+
+	if (qm_events)
+		printk("CAT: Cache monitoring with %d RMIDs\n", rmid_max + 1);
+}
+
 static int cat_init(void)
 {
 	int err;
 
+	if (cpuid_ebx(7, 0) & X86_FEATURE_CMT)
+		qm_init();
+
 	if (cpuid_ebx(7, 0) & X86_FEATURE_CAT &&
 	    cpuid_ebx(0x10, 0) & (1 << CAT_RESID_L3)) {
+		l3_cat = true;
 		cbm_max = cpuid_eax(0x10, CAT_RESID_L3) & CAT_CBM_LEN_MASK;
 		cos_max = cpuid_edx(0x10, CAT_RESID_L3) & CAT_COS_MAX_MASK;
+
+		/*
+		 * CDP is used if Linux enabled it (resctrl mounted with
+		 * "-o cdp"). It halves the number of available COS.
+		 */
+		if (cpuid_ecx(0x10, CAT_RESID_L3) & CAT_CDP_SUPPORT &&
+		    read_msr(MSR_IA32_L3_QOS_CFG) & L3_QOS_CFG_CDP_ENABLE) {
+			cdp = true;
+			cos_max = (cos_max + 1) / 2 - 1;
+			printk("CAT: Code/data prioritization enabled\n");
+		}
 	}
 
+	if (cpuid_ebx(7, 0) & X86_FEATURE_CAT &&
+	    cpuid_ebx(0x10, 0) & (1 << CAT_RESID_L2))
+		l2_cat_init();
+
+	if (cpuid_ebx(7, 0) & X86_FEATURE_CAT &&
+	    cpuid_ebx(0x10, 0) & (1 << CAT_RESID_MBA))
+		mba_init();
+
 	err = cat_cell_init(&root_cell);
 	orig_root_mask = root_cell.arch.cat_mask;
+	if (l2_cat)
+		update_root_l2_masks(NULL, NULL);
 
 	return err;
 }
@@ -16,6 +16,7 @@
 #include <asm/apic.h>
 #include <asm/cat.h>
 #include <asm/control.h>
+#include <asm/iommu.h>
 #include <asm/ioapic.h>
 #include <asm/iommu.h>
 #include <asm/vcpu.h>
@@ -46,6 +47,10 @@ int arch_map_memory_region(struct cell *cell,
 {
 	int err;
 
+	/* cache coloring is only supported on ARM */
+	if (mem->flags & JAILHOUSE_MEM_COLORED)
+		return trace_error(-EINVAL);
+
 	err = vcpu_map_memory_region(cell, mem);
 	if (err)
 		return err;
@@ -68,20 +73,64 @@ int arch_unmap_memory_region(struct cell *cell,
 	return vcpu_unmap_memory_region(cell, mem);
 }
 
-void arch_flush_cell_vcpu_caches(struct cell *cell)
+bool arch_mem_region_next_run(const struct jailhouse_memory *mem,
+			      unsigned long *offset, unsigned long *size)
+{
+	/* regions are always contiguous, see arch_map_memory_region */
+	*size = mem->size - *offset;
+	return true;
+}
+
+void arch_scrub_memory(void *addr, unsigned long size)
+{
+	unsigned long *pos = addr, *end = addr + size;
+
+	/* non-temporal stores, so that the scrub does not thrash the caches */
+	while (pos < end) {
+		asm volatile("movnti %1,%0" : "=m" (*pos) : "r" (0UL));
+		pos++;
+	}
+	asm volatile("sfence" : : : "memory");
+}
+
+void arch_flush_cell_vcpu_caches(struct cell *cell, unsigned long start,
+				 unsigned long size)
 {
+	struct public_per_cpu *target_data;
+	bool target_suspended;
 	unsigned int cpu;
 
-	for_each_cpu(cpu, cell->cpu_set)
+	/*
+	 * Neither INVEPT nor the NPT TLB control provide invalidation by
+	 * guest-physical address, so any non-empty range flushes the cell's
+	 * whole context.
+	 */
+	if (size == 0)
+		return;
+
+	for_each_cpu(cpu, cell->cpu_set) {
 		if (cpu == this_cpu_id()) {
 			vcpu_tlb_flush();
-		} else {
-			public_per_cpu(cpu)->flush_vcpu_caches = true;
-			/* make sure the value is written before we kick
-			 * the remote core */
-			memory_barrier();
-			apic_send_nmi_ipi(public_per_cpu(cpu));
+			continue;
 		}
+
+		target_data = public_per_cpu(cpu);
+
+		spin_lock(&target_data->control_lock);
+		target_data->flush_vcpu_caches = true;
+		target_suspended = target_data->cpu_suspended;
+		spin_unlock(&target_data->control_lock);
+
+		/*
+		 * A suspended CPU picks up the request in x86_check_events
+		 * before it returns to the guest. Kicking it anyway would only
+		 * leave an NMI pending that costs it another VM exit right
+		 * after its resumption.
+		 */
+		if (!target_suspended)
+			arch_queue_event(target_data);
+	}
+	arch_flush_events();
 }
 
 void arch_cell_destroy(struct cell *cell)
@@ -98,21 +147,39 @@ void arch_cell_reset(struct cell *cell)
 		system_config->platform_info.x86.pm_timer_address;
 	comm_region->pci_mmconfig_base =
 		system_config->platform_info.pci_mmconfig_base;
+	comm_region->pci_mmconfig_end_bus =
+		system_config->platform_info.pci_mmconfig_end_bus;
 	/* comm_region, and hence num_cpus, is zero-initialised */
 	for_each_cpu(cpu, cell->cpu_set)
 		comm_region->num_cpus++;
 	comm_region->tsc_khz = system_config->platform_info.x86.tsc_khz;
 	comm_region->apic_khz = system_config->platform_info.x86.apic_khz;
+	/* see x86_send_init_sipi */
+	comm_region->flags |= JAILHOUSE_COMM_FLAG_SYNC_INIT;
 
 	ioapic_cell_reset(cell);
 }
 
+void arch_cell_cpu_move(unsigned int cpu_id, struct cell *from,
+			struct cell *to)
+{
+	/*
+	 * Nothing to do: the CPU loads the VMCS/VMCB settings, COS and RMID of
+	 * its new cell when it receives its SIPI.
+	 */
+}
+
 void arch_config_commit(struct cell *cell_added_removed)
 {
 	iommu_config_commit(cell_added_removed);
 	ioapic_config_commit(cell_added_removed);
 }
 
+unsigned long arch_timestamp_khz(void)
+{
+	return system_config->platform_info.x86.tsc_khz;
+}
+
 void arch_prepare_shutdown(void)
 {
 	ioapic_prepare_handover();
@@ -182,7 +249,23 @@ void __attribute__((weak)) cat_update(void)
 {
 }
 
-void x86_check_events(void)
+long __attribute__((weak)) cat_get_qos_info(struct cell *cell,
+					    unsigned int event)
+{
+	return -EINVAL;
+}
+
+long arch_cell_get_qos_info(struct cell *cell, unsigned int event)
+{
+	return cat_get_qos_info(cell, event);
+}
+
+long arch_iommu_update_irtes(unsigned long desc_addr, unsigned long count)
+{
+	return iommu_update_root_irtes(desc_addr, count);
+}
+
+void __hot x86_check_events(void)
 {
 	struct public_per_cpu *cpu_public = this_cpu_public();
 	int sipi_vector = -1;
@@ -194,8 +277,10 @@ void x86_check_events(void)
 
 		spin_unlock(&cpu_public->control_lock);
 
-		while (cpu_public->suspend_cpu)
+		while (cpu_public->suspend_cpu) {
+			scrub_memory_assist();
 			cpu_relax();
+		}
 
 		spin_lock(&cpu_public->control_lock);
 	}
@@ -232,10 +317,19 @@ void x86_check_events(void)
 		printk("CPU %d received SIPI, vector %x\n", this_cpu_id(),
 		       sipi_vector);
 		apic_clear();
+		/* start with the COS and RMID of the cell we now belong to */
+		cat_update();
 		vcpu_reset(sipi_vector);
 	}
 
-	iommu_check_pending_faults();
+	/*
+	 * IOMMU faults are reported via NMI. Skip polling the units when there
+	 * was none, e.g. while spinning on INIT delivery or after #DB/#AC.
+	 */
+	if (this_cpu_data()->check_iommu_faults) {
+		this_cpu_data()->check_iommu_faults = false;
+		iommu_check_pending_faults();
+	}
 }
 
 void __attribute__((noreturn))
@@ -15,6 +15,7 @@
 #include <jailhouse/control.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/uart.h>
+#include <asm/apic.h>
 #include <asm/efifb.h>
 #include <asm/io.h>
 
@@ -28,6 +29,23 @@ static u32 reg_in_pio(struct uart_chip *chip, unsigned int reg)
 	return inb((u16)(unsigned long long)chip->virt_base + reg);
 }
 
+bool arch_console_notify_valid(unsigned long irq)
+{
+	return irq >= 32 && irq <= 255;
+}
+
+void arch_console_notify(unsigned int cpu_id, unsigned int irq)
+{
+	struct apic_irq_message irq_msg = {
+		.vector = irq,
+		.delivery_mode = APIC_MSG_DLVR_FIXED,
+		.destination = public_per_cpu(cpu_id)->apic_id,
+		.valid = 1,
+	};
+
+	apic_send_irq(irq_msg);
+}
+
 void arch_dbg_write_init(void)
 {
 	u32 dbg_type = system_config->debug_console.type;
@@ -32,43 +32,81 @@ asm(
 
 extern const u8 font8x16[];
 
+#define EFIFB_MAX_COLS		(EFIFB_MAX_WIDTH / EFIFB_FONT_WIDTH)
+#define EFIFB_MAX_LINES		(EFIFB_MAX_HEIGHT / EFIFB_FONT_HEIGHT)
+
 static unsigned int efifb_width, efifb_height;
-static char efifb_buffer[EFIFB_MAX_HEIGHT][EFIFB_MAX_WIDTH];
+/* Text to be displayed and text actually drawn, to repaint only changes. */
+static char efifb_buffer[EFIFB_MAX_LINES][EFIFB_MAX_COLS];
+static char efifb_screen[EFIFB_MAX_LINES][EFIFB_MAX_COLS];
+/* Lines not drawn yet have unknown content on the screen. */
+static bool efifb_line_drawn[EFIFB_MAX_LINES];
 static u32 row_line;
 
-static void efifb_write_char(unsigned int line, unsigned int row, char c)
+/*
+ * Draws the pixel row y of a character with four 64-bit stores, the
+ * framebuffer being uncached.
+ */
+static void efifb_draw_glyph_row(u64 *dst, char c, unsigned int y)
 {
-	unsigned int x, y, font_line, color, offs;
+	unsigned int x, font_line;
+	u32 pixels[EFIFB_FONT_WIDTH];
+
+	font_line = font8x16[(u8)c * EFIFB_FONT_HEIGHT + y];
+
+	for (x = 0; x < EFIFB_FONT_WIDTH; x++)
+		if (font_line & (1 << (EFIFB_FONT_WIDTH - x)))
+			pixels[x] = EFIFB_FG_COLOR;
+		else
+			pixels[x] = EFIFB_BG_COLOR;
+
+	for (x = 0; x < EFIFB_FONT_WIDTH; x += 2)
+		*dst++ = pixels[x] | (u64)pixels[x + 1] << 32;
+}
+
+/*
+ * Repaints the columns of a line that differ from the screen, pixel row by
+ * pixel row so that the framebuffer is written sequentially.
+ */
+static void efifb_update_line(unsigned int line)
+{
+	u32 *fb = (u32 *)hypervisor_header.debug_console_base;
+	const char *text = efifb_buffer[line];
+	char *shown = efifb_screen[line];
+	unsigned int first = 0, last = efifb_width - 1;
+	unsigned int col, y;
+	u32 *dst;
+
+	if (efifb_line_drawn[line]) {
+		while (first < efifb_width && text[first] == shown[first])
+			first++;
+		if (first == efifb_width)
+			return;
+		while (text[last] == shown[last])
+			last--;
+	}
 
 	for (y = 0; y < EFIFB_FONT_HEIGHT; y++) {
-		font_line = font8x16[c * EFIFB_FONT_HEIGHT + y];
-
-		for (x = 0; x < EFIFB_FONT_WIDTH; x++) {
-			if (font_line & (1 << (EFIFB_FONT_WIDTH - x)))
-				color = EFIFB_FG_COLOR;
-			else
-				color = EFIFB_BG_COLOR;
-			offs = (row * EFIFB_FONT_WIDTH) + x +
-				(line * EFIFB_FONT_HEIGHT + y) * EFIFB_LINE_LEN;
-			((u32 *)hypervisor_header.debug_console_base)[offs] =
-				color;
+		dst = fb + (line * EFIFB_FONT_HEIGHT + y) * EFIFB_LINE_LEN +
+			first * EFIFB_FONT_WIDTH;
+		for (col = first; col <= last; col++) {
+			efifb_draw_glyph_row((u64 *)dst, text[col], y);
+			dst += EFIFB_FONT_WIDTH;
 		}
 	}
 
-	efifb_buffer[line][row] = c;
+	memcpy(&shown[first], &text[first], last - first + 1);
+	efifb_line_drawn[line] = true;
 }
 
 static void efifb_scroll(void)
 {
-	unsigned int row, line;
-
-	for (line = 0; line < (efifb_height - 1); line++)
-		for (row = 0; row < efifb_width; row++)
-			efifb_write_char(line, row,
-					 efifb_buffer[line + 1][row]);
+	unsigned int line;
 
-	for (row = 0; row < efifb_width; row++)
-		efifb_write_char(efifb_height - 1, row, ' ');
+	for (line = 0; line < efifb_height - 1; line++)
+		memcpy(efifb_buffer[line], efifb_buffer[line + 1],
+		       efifb_width);
+	memset(efifb_buffer[efifb_height - 1], ' ', efifb_width);
 }
 
 void efifb_write(const char *msg)
@@ -81,6 +119,7 @@ void efifb_write(const char *msg)
 	 */
 	u16 row  = (u16)(row_line >> 16);
 	u16 line = (u16)row_line;
+	u16 first_dirty = line;
 
 	while (*msg != 0) {
 		if (panic_in_progress && panic_cpu != phys_processor_id())
@@ -88,19 +127,25 @@ void efifb_write(const char *msg)
 
 		if (row == efifb_width || *msg == '\n') {
 			row = 0;
-			if (line == efifb_height - 1)
+			if (line == efifb_height - 1) {
 				efifb_scroll();
-			else
+				first_dirty = 0;
+			} else {
 				line++;
+			}
 		}
 
 		if (*msg != '\n' && *msg != '\r') {
-			efifb_write_char(line, row, *msg);
+			efifb_buffer[line][row] = *msg;
 			row++;
 		}
 		msg++;
 	}
 
+	/* Scrolled lines are only repainted once per message. */
+	for (; first_dirty <= line; first_dirty++)
+		efifb_update_line(first_dirty);
+
 	row_line = ((u32)row << 16) | (u32)line;
 }
 
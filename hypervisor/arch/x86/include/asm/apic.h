@@ -155,6 +155,7 @@ int apic_init(void);
 int apic_cpu_init(struct per_cpu *cpu_data);
 
 void apic_clear(void);
+void apic_set_lvtpc_nmi(void);
 
 void apic_send_nmi_ipi(struct public_per_cpu *target_data);
 bool apic_filter_irq_dest(struct cell *cell, struct apic_irq_message *irq_msg);
@@ -168,6 +169,8 @@ unsigned int apic_mmio_access(const struct guest_paging_structures *pg_structs,
 bool x2apic_handle_write(void);
 void x2apic_handle_read(void);
 
+unsigned int apic_get_local_msrs(const u32 **msrs);
+
 u32 x2apic_filter_logical_dest(struct cell *cell, u32 destination);
 
 /** @} */
@@ -10,4 +10,7 @@
  * the COPYING file in the top-level directory.
  */
 
+struct cell;
+
 void cat_update(void);
+long cat_get_qos_info(struct cell *cell, unsigned int event);
@@ -21,6 +21,16 @@
 
 struct cell_ioapic;
 
+#define X86_CPUID_CACHE_SIZE	6
+
+/** CPUID leaf result prepared for a cell. */
+struct cpuid_cache_entry {
+	/** Leaf number (EAX input). */
+	u32 function;
+	/** Result in EAX, EBX, ECX, EDX order. */
+	u32 regs[4];
+};
+
 /** x86-specific cell states. */
 struct arch_cell {
 	/** Buffer for the EPT/NPT root-level page table. */
@@ -30,12 +40,16 @@ struct arch_cell {
 		struct {
 			/** PIO access bitmap. */
 			u8 *io_bitmap;
+			/** MSR access bitmap. */
+			u8 *msr_bitmap;
 			/** Paging structures used for cell CPUs. */
 			struct paging_structures ept_structs;
 		} vmx; /**< Intel VMX-specific fields. */
 		struct {
 			/** I/O Permissions Map. */
 			u8 *iopm;
+			/** MSR Permissions Map. */
+			u8 *msrpm;
 			/** Paging structures used for cell CPUs and IOMMU. */
 			struct paging_structures npt_iommu_structs;
 		} svm; /**< AMD SVM-specific fields. */
@@ -51,6 +65,9 @@ struct arch_cell {
 		} vtd; /**< Intel VT-d specific fields. */
 	};
 
+	/** CPUID results served without executing CPUID. */
+	struct cpuid_cache_entry cpuid_cache[X86_CPUID_CACHE_SIZE];
+
 	/** Shadow value of PCI config space address port register. */
 	u32 pci_addr_port_val;
 
@@ -61,8 +78,22 @@ struct arch_cell {
 
 	/** Class Of Service for cache allocation (Intel only). */
 	u32 cos;
-	/** Allocated L3 cache region (Intel only). */
+	/** Allocated L3 cache region, data only if CDP is on (Intel only). */
 	u64 cat_mask;
+	/** Allocated L3 code cache region if CDP is on (Intel only). */
+	u64 cat_code_mask;
+	/** Own L2 cache region, 0 to follow the root cell (Intel only). */
+	u64 l2_mask;
+	/** Part of l2_mask not shared with the root cell (Intel only). */
+	u64 l2_exclusive_mask;
+	/** Memory bandwidth throttling delay in percent (Intel only). */
+	u32 mba_delay;
+	/** Resource Monitoring ID, 0 is used by the root cell (Intel only). */
+	u32 rmid;
+	/** Last raw total and local bandwidth counters (Intel only). */
+	u64 mbm_last[2];
+	/** Accumulated total and local memory traffic (Intel only). */
+	u64 mbm_bytes[2];
 };
 
 #endif /* !_JAILHOUSE_ASM_CELL_H */
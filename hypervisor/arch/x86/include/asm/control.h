@@ -24,4 +24,9 @@ void x86_check_events(void);
 void __attribute__((noreturn))
 x86_exception_handler(struct exception_frame *frame);
 
-void arch_send_event(struct public_per_cpu *target_data);
+/*
+ * Queue an event NMI for the target CPU, combining it with queued ones where
+ * possible. arch_flush_events() sends what is left queued.
+ */
+void arch_queue_event(struct public_per_cpu *target_data);
+void arch_flush_events(void);
@@ -67,6 +67,13 @@ struct phys_ioapic {
 	spinlock_t lock;
 	/** Shadow state of redirection entries as seen by the cells. */
 	union ioapic_redir_entry shadow_redir_table[IOAPIC_MAX_PINS];
+	/** Redirection entries as last written to the hardware. */
+	union ioapic_redir_entry phys_redir_table[IOAPIC_MAX_PINS];
+	/**
+	 * Bitmap of pins whose interrupt mapping matches the shadow entry,
+	 * irrespective of its mask.
+	 */
+	u32 pin_mapped[(IOAPIC_MAX_PINS + 31) / 32];
 };
 
 /**
@@ -41,6 +41,13 @@ int iommu_map_interrupt(struct cell *cell,
 			unsigned int vector,
 			struct apic_irq_message irq_msg);
 
+union ioapic_redir_entry;
+
+/* Vendor-specific formats of interrupts that hit a remapping table entry */
+union x86_msi_vector iommu_get_remapped_msi(unsigned int remap_index);
+void iommu_remap_ioapic_entry(union ioapic_redir_entry *entry,
+			      unsigned int remap_index);
+
 void iommu_config_commit(struct cell *cell_added_removed);
 
 void iommu_prepare_shutdown(void);
@@ -50,4 +57,6 @@ void iommu_check_pending_faults(void);
 
 bool iommu_cell_emulates_ir(struct cell *cell);
 
+long iommu_update_root_irtes(unsigned long desc_addr, unsigned long count);
+
 #endif
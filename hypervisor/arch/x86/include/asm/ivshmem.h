@@ -16,7 +16,7 @@
 #include <asm/apic.h>
 
 struct arch_pci_ivshmem {
-	struct apic_irq_message irq_msg;
+	struct apic_irq_message irq_msg[IVSHMEM_MAX_MSIX_VECTORS];
 };
 
 #endif /* !_JAILHOUSE_ASM_IVSHMEM_H */
@@ -18,6 +18,18 @@
  * @{
  */
 
+/** String instruction moving data between memory and MMIO (movs). */
+#define MMIO_STRING_MOVS		1
+/** String instruction storing the accumulator to MMIO (stos). */
+#define MMIO_STRING_STOS		2
+
+/**
+ * Maximum number of string instruction iterations emulated per exit. Longer
+ * repetitions are continued by the guest re-executing the instruction, so
+ * that pending events are handled in between.
+ */
+#define MMIO_STRING_BATCH		16
+
 /** Information about MMIO instruction performing an access. */
 struct mmio_instruction {
 	/** Length of the MMIO access instruction, 0 for invalid or unsupported
@@ -25,11 +37,47 @@ struct mmio_instruction {
 	unsigned int inst_len;
 	/** Size of the access. */
 	unsigned int access_size;
-	/** Number of the register that should receive the input. */
+	/** Number of the register that should receive the input or, for
+	 * writes without immediate, provides the output. */
 	unsigned int in_reg_num;
 	/** Output value, already copied either from a register or
          * from an immediate value */
 	unsigned long out_val;
+	/** String instruction type (MMIO_STRING_*), 0 for plain moves. */
+	unsigned int string_op;
+	/** True if the string instruction has a REP prefix. */
+	bool rep;
+	/** Address size of the string instruction in bytes. */
+	unsigned int address_size;
+};
+
+/** Number of entries in the per-CPU MMIO instruction decode cache. */
+#define MMIO_DECODE_CACHE_SIZE		8
+
+/** Cached decoding result of an MMIO instruction. */
+struct mmio_decode_cache_entry {
+	/** Guest instruction pointer, 0 for unused entries. */
+	unsigned long pc;
+	/** Guest paging mode the instruction was fetched with. */
+	const struct paging *root_paging;
+	/** Guest-physical address of the guest's root page table. */
+	unsigned long root_table_gphys;
+	/** Code segment attributes the instruction was decoded with. */
+	u16 cs_attr;
+	/** True if the instruction performs a write access. */
+	bool is_write;
+	/** True if mmio_instruction::out_val holds an immediate value. */
+	bool has_immediate;
+	/** Decoded instruction. */
+	struct mmio_instruction inst;
+};
+
+/** Per-CPU cache of decoded MMIO instructions. */
+struct mmio_decode_cache {
+	/** Index of the entry to be replaced next. */
+	unsigned int next;
+	/** Cached instructions. */
+	struct mmio_decode_cache_entry entries[MMIO_DECODE_CACHE_SIZE];
 };
 
 /**
@@ -37,10 +85,23 @@ struct mmio_instruction {
  * @param pg_structs	Currently active guest (cell) paging structures.
  * @param is_write	True if write access, false for read.
  *
+ * If the cell has JAILHOUSE_CELL_MMIO_DECODE_CACHE set, the instruction is
+ * looked up in a per-CPU cache first, keyed by guest paging mode, root page
+ * table, instruction pointer and code segment attributes. A hit avoids both
+ * fetching the instruction via the guest page tables and decoding it.
+ *
  * @return MMIO instruction information. mmio_instruction::inst_len is 0 on
  * 	   invalid or unsupported access.
  */
 struct mmio_instruction
 x86_mmio_parse(const struct guest_paging_structures *pg_structs, bool is_write);
 
+/**
+ * Invalidate all cached MMIO instructions of the current CPU.
+ *
+ * Must be called whenever guest mappings may have changed in a way that is
+ * not covered by the cache key, i.e. on TLB flushes and CPU resets.
+ */
+void x86_mmio_decode_cache_flush(void);
+
 /** @} */
@@ -33,6 +33,7 @@
  */
 
 int x86_pci_config_handler(u16 port, bool dir_in, unsigned int size);
+int x86_pci_config_dword_handler(u16 port, bool dir_in);
 
 struct apic_irq_message
 x86_pci_translate_msi(struct pci_device *device, unsigned int vector,
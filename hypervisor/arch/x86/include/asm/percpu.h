@@ -22,8 +22,10 @@
 
 #define ARCH_PUBLIC_PERCPU_FIELDS					\
 	/** Physical APIC ID. */					\
-	u32 apic_id;							\
-									\
+	u32 apic_id;
+
+/* Written by other CPUs, see public_per_cpu. */
+#define ARCH_PUBLIC_PERCPU_CONTROL_FIELDS				\
 	/**								\
 	 * Lock protecting CPU state changes done for control tasks.	\
 	 *								\
@@ -40,8 +42,6 @@
 	 */								\
 	spinlock_t control_lock;					\
 									\
-	/** True if CPU is waiting for SIPI. */				\
-	volatile bool wait_for_sipi;					\
 	/** Set to true for pending an INIT signal. */			\
 	volatile bool init_signaled;					\
 	/** Pending SIPI vector; -1 if none is pending. */		\
@@ -50,27 +50,12 @@
 	 *  only). */							\
 	bool update_cat;
 
+/* Written by the owning CPU and polled by others, see public_per_cpu. */
+#define ARCH_PUBLIC_PERCPU_STATE_FIELDS					\
+	/** True if CPU is waiting for SIPI. */				\
+	volatile bool wait_for_sipi;
+
 #define ARCH_PERCPU_FIELDS						\
-	/** Linux stack pointer, used for handover to hypervisor. */	\
-	unsigned long linux_sp;						\
-									\
-	/** Linux states, used for handover to/from hypervisor. @{ */	\
-	struct desc_table_reg linux_gdtr;				\
-	struct desc_table_reg linux_idtr;				\
-	unsigned long linux_reg[NUM_ENTRY_REGS];			\
-	unsigned long linux_ip;						\
-	unsigned long linux_cr0;					\
-	unsigned long linux_cr3;					\
-	unsigned long linux_cr4;					\
-	struct segment linux_cs;					\
-	struct segment linux_ds;					\
-	struct segment linux_es;					\
-	struct segment linux_fs;					\
-	struct segment linux_gs;					\
-	struct segment linux_tss;					\
-	unsigned long linux_efer;					\
-	/** @} */							\
-									\
 	/** Shadow states. @{ */					\
 	unsigned long pat;						\
 	unsigned long mtrr_def_type;					\
@@ -79,9 +64,16 @@
 	/** Cached PDPTEs, used by VMX for PAE guest paging mode. */	\
 	unsigned long pdpte[4];						\
 									\
+	/** Recently decoded MMIO instructions. */			\
+	struct mmio_decode_cache mmio_decode_cache;			\
+									\
+	/** Last device looked up via the PCI config ports. */		\
+	struct pci_device *pci_cfg_device;				\
+									\
 	/* IOMMU request completion flags */				\
 	union {								\
-		volatile u32 vtd_iq_completed;				\
+		/* one per unit, requests may be pending in parallel */ \
+		volatile u32 vtd_iq_completed[JAILHOUSE_MAX_IOMMU_UNITS];\
 		volatile u64 amd_iommu_sem;				\
 	};								\
 									\
@@ -97,21 +89,52 @@
 	/** Number of iterations to clear pending APIC IRQs. */		\
 	unsigned int num_clear_apic_irqs;				\
 									\
+	/** Set by NMIs, which may signal IOMMU faults. */		\
+	bool check_iommu_faults;					\
+									\
+	/** Logical x2APIC destination of queued events, 0 if none. */	\
+	u32 queued_events;						\
+									\
+	/*								\
+	 * Pages touched by the CPU on every VM exit, allocated from	\
+	 * the pool of its NUMA node.					\
+	 */								\
 	union {								\
 		struct {						\
 			/** VMXON region, required by VMX. */		\
-			struct vmcs vmxon_region			\
-				__attribute__((aligned(PAGE_SIZE)));	\
+			struct vmcs *vmxon_region;			\
 			/** VMCS of this CPU, required by VMX. */	\
-			struct vmcs vmcs				\
-				__attribute__((aligned(PAGE_SIZE)));	\
-		};							\
-		struct {						\
-			/** VMCB block, required by SVM. */		\
-			struct vmcb vmcb				\
-				__attribute__((aligned(PAGE_SIZE)));	\
-			/** SVM Host save area; opaque to us. */	\
-			u8 host_state[PAGE_SIZE]			\
-				__attribute__((aligned(PAGE_SIZE)));	\
+			struct vmcs *vmcs;				\
 		};							\
-	};
+		/** SVM Host save area; opaque to us. */		\
+		u8 *host_state;						\
+	};								\
+									\
+	/*								\
+	 * Only used on handover, kept behind the fields accessed on	\
+	 * VM exits so that these occupy as few cache lines as		\
+	 * possible.							\
+	 */								\
+									\
+	/** Linux stack pointer, used for handover to hypervisor. */	\
+	unsigned long linux_sp;						\
+									\
+	/** Linux states, used for handover to/from hypervisor. @{ */	\
+	struct desc_table_reg linux_gdtr;				\
+	struct desc_table_reg linux_idtr;				\
+	unsigned long linux_reg[NUM_ENTRY_REGS];			\
+	unsigned long linux_ip;						\
+	unsigned long linux_cr0;					\
+	unsigned long linux_cr3;					\
+	unsigned long linux_cr4;					\
+	struct segment linux_cs;					\
+	struct segment linux_ds;					\
+	struct segment linux_es;					\
+	struct segment linux_fs;					\
+	struct segment linux_gs;					\
+	struct segment linux_tss;					\
+	unsigned long linux_efer;					\
+	/** @} */							\
+									\
+	/** VMCB block, required by SVM. */				\
+	struct vmcb vmcb __attribute__((aligned(PAGE_SIZE)));
@@ -0,0 +1,26 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_ASM_PMU_H
+#define _JAILHOUSE_ASM_PMU_H
+
+#include <jailhouse/types.h>
+
+void pmu_init(void);
+unsigned int pmu_get_reserved_msrs(const u32 **msrs);
+bool pmu_is_reserved_msr(u32 msr);
+
+bool pmu_get_global_ctrl(u64 *host_ctrl, u64 *guest_ctrl);
+
+void pmu_cpu_init(void);
+void pmu_cpu_exit(void);
+
+void pmu_nmi_handler(const unsigned long *frame);
+
+#endif /* !_JAILHOUSE_ASM_PMU_H */
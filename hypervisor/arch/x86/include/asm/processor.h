@@ -23,13 +23,25 @@
 #include <jailhouse/types.h>
 
 /* leaf 0x01, ECX */
+#define X86_FEATURE_MWAIT				(1 << 3)
 #define X86_FEATURE_VMX					(1 << 5)
+#define X86_FEATURE_EIST				(1 << 7)
 #define X86_FEATURE_XSAVE				(1 << 26)
 #define X86_FEATURE_OSXSAVE				(1 << 27)
 #define X86_FEATURE_HYPERVISOR				(1 << 31)
 
+/* leaf 0x05, ECX */
+#define X86_FEATURE_MWAIT_EXT				(1 << 0)
+#define X86_FEATURE_MWAIT_IRQ_BREAK			(1 << 1)
+
+/* leaf 0x06, EAX */
+#define X86_FEATURE_HWP					(1 << 7)
+#define X86_FEATURE_HWP_ACT_WINDOW			(1 << 9)
+#define X86_FEATURE_HWP_EPP				(1 << 10)
+
 /* leaf 0x07, subleaf 0, EBX */
 #define X86_FEATURE_INVPCID				(1 << 10)
+#define X86_FEATURE_CMT					(1 << 12)
 #define X86_FEATURE_CAT					(1 << 15)
 
 /* leaf 0x0d, subleaf 1, EAX */
@@ -44,10 +56,12 @@
 
 /* leaf 0x8000000a, EDX */
 #define X86_FEATURE_NP					(1 << 0)
+#define X86_FEATURE_NRIPS				(1 << 3)
 #define X86_FEATURE_FLUSH_BY_ASID			(1 << 6)
 #define X86_FEATURE_DECODE_ASSISTS			(1 << 7)
 #define X86_FEATURE_AVIC				(1 << 13)
 
+#define X86_RFLAGS_DF					(1 << 10)
 #define X86_RFLAGS_VM					(1 << 17)
 
 #define X86_CR0_PE					(1UL << 0)
@@ -72,12 +86,21 @@
 
 #define MSR_IA32_APICBASE				0x0000001b
 #define MSR_IA32_FEATURE_CONTROL			0x0000003a
+#define MSR_IA32_PMC0					0x000000c1
+#define MSR_PLATFORM_INFO				0x000000ce
+#define MSR_IA32_PERFEVTSEL0				0x00000186
+#define MSR_IA32_PERF_CTL				0x00000199
 #define MSR_IA32_PAT					0x00000277
 #define MSR_IA32_MTRR_DEF_TYPE				0x000002ff
 #define MSR_IA32_SYSENTER_CS				0x00000174
 #define MSR_IA32_SYSENTER_ESP				0x00000175
 #define MSR_IA32_SYSENTER_EIP				0x00000176
+#define MSR_IA32_FIXED_CTR0				0x00000309
+#define MSR_IA32_FIXED_CTR_CTRL				0x0000038d
+#define MSR_IA32_PERF_GLOBAL_STATUS			0x0000038e
 #define MSR_IA32_PERF_GLOBAL_CTRL			0x0000038f
+#define MSR_IA32_PERF_GLOBAL_OVF_CTRL			0x00000390
+#define MSR_IA32_A_PMC0					0x000004c1
 #define MSR_IA32_VMX_BASIC				0x00000480
 #define MSR_IA32_VMX_PINBASED_CTLS			0x00000481
 #define MSR_IA32_VMX_PROCBASED_CTLS			0x00000482
@@ -91,11 +114,20 @@
 #define MSR_IA32_VMX_PROCBASED_CTLS2			0x0000048b
 #define MSR_IA32_VMX_EPT_VPID_CAP			0x0000048c
 #define MSR_IA32_VMX_TRUE_PROCBASED_CTLS		0x0000048e
+#define MSR_IA32_TSC_DEADLINE				0x000006e0
+#define MSR_IA32_PM_ENABLE				0x00000770
+#define MSR_IA32_HWP_CAPABILITIES			0x00000771
+#define MSR_IA32_HWP_REQUEST				0x00000774
 #define MSR_X2APIC_BASE					0x00000800
 #define MSR_X2APIC_ICR					0x00000830
 #define MSR_X2APIC_END					0x0000083f
+#define MSR_IA32_L3_QOS_CFG				0x00000c81
+#define MSR_IA32_QM_EVTSEL				0x00000c8d
+#define MSR_IA32_QM_CTR					0x00000c8e
 #define MSR_IA32_PQR_ASSOC				0x00000c8f
 #define MSR_IA32_L3_MASK_0				0x00000c90
+#define MSR_IA32_L2_MASK_0				0x00000d10
+#define MSR_IA32_MBA_THRTL_0				0x00000d50
 #define MSR_EFER					0xc0000080
 #define MSR_STAR					0xc0000081
 #define MSR_LSTAR					0xc0000082
@@ -114,16 +146,52 @@
 
 #define MTRR_ENABLE					(1UL << 11)
 
+#define PLATFORM_INFO_MAX_NON_TURBO(val)		(((val) >> 8) & 0xff)
+#define PERF_CTL_TARGET_SHIFT				8
+#define PERF_CTL_TARGET_MASK				BIT_MASK(15, 0)
+#define PERF_CTL_TURBO_DISENGAGE			(1UL << 32)
+#define PM_ENABLE_HWP					(1 << 0)
+#define HWP_CAP_GUARANTEED(val)				(((val) >> 8) & 0xff)
+#define HWP_REQ_MAX_SHIFT				8
+#define HWP_REQ_PERF_MASK				BIT_MASK(23, 0)
+#define HWP_REQ_EPP_MASK				BIT_MASK(31, 24)
+#define HWP_REQ_ACT_WINDOW_MASK				BIT_MASK(41, 32)
+
 #define EFER_LME					0x00000100
 #define EFER_LMA					0x00000400
 #define EFER_NXE					0x00000800
 
 #define PQR_ASSOC_COS_SHIFT				32
+#define PQR_ASSOC_RMID_MASK				BIT_MASK(9, 0)
+
+#define QM_EVTSEL_RMID_SHIFT				32
+#define QM_CTR_ERROR					(1UL << 63)
+#define QM_CTR_UNAVAILABLE				(1UL << 62)
+
+/* leaf 0x0f, subleaf 0, EDX and subleaf 1, EAX/EDX */
+#define CMT_L3_SUPPORT					(1 << 1)
+#define CMT_CTR_WIDTH_MASK				BIT_MASK(7, 0)
+#define CMT_CTR_WIDTH_BASE				24
+#define CMT_EVENT_L3_OCCUPANCY				(1 << 0)
 
 #define CAT_RESID_L3					1
+#define CAT_RESID_L2					2
+#define CAT_RESID_MBA					3
 
 #define CAT_CBM_LEN_MASK				BIT_MASK(4, 0)
 #define CAT_COS_MAX_MASK				BIT_MASK(15, 0)
+#define CAT_CDP_SUPPORT					(1 << 2)
+
+#define L3_QOS_CFG_CDP_ENABLE				(1 << 0)
+
+#define MBA_MAX_DELAY_MASK				BIT_MASK(11, 0)
+#define MBA_LINEAR					(1 << 2)
+
+#define CPUID_CACHE_TYPE_MASK				BIT_MASK(4, 0)
+#define CPUID_CACHE_LEVEL_MASK				BIT_MASK(7, 5)
+#define CPUID_CACHE_LEVEL_SHIFT				5
+#define CPUID_CACHE_SHARING_MASK			BIT_MASK(25, 14)
+#define CPUID_CACHE_SHARING_SHIFT			14
 
 #define GDT_DESC_NULL					0
 #define GDT_DESC_CODE					1
@@ -142,10 +210,17 @@
 #define X86_INST_LEN_HYPERCALL				3
 #define X86_INST_LEN_MOV_TO_CR				3
 #define X86_INST_LEN_XSETBV				3
+#define X86_INST_LEN_HLT				1
+#define X86_INST_LEN_MWAIT				3
+
+/* MWAIT extension: wake up on interrupts even if they are masked */
+#define MWAIT_ECX_IRQ_BREAK				(1 << 0)
 
 #define X86_REX_CODE					4
 
+#define X86_PREFIX_OP_SZ				0x66
 #define X86_PREFIX_ADDR_SZ				0x67
+#define X86_PREFIX_REP					0xf3
 
 #define X86_OP_MOVZX_OPC1				0x0f
 #define X86_OP_MOVZX_OPC2_B				0xb6
@@ -157,6 +232,10 @@
 #define X86_OP_MOV_IMMEDIATE_TO_MEM			0xc7
 #define X86_OP_MOV_MEM_TO_AX    			0xa1
 #define X86_OP_MOV_AX_TO_MEM				0xa3
+#define X86_OP_MOVSB					0xa4
+#define X86_OP_MOVS					0xa5
+#define X86_OP_STOSB					0xaa
+#define X86_OP_STOS					0xab
 
 #define DB_VECTOR					1
 #define NMI_VECTOR					2
@@ -230,6 +309,16 @@ static inline void memory_load_barrier(void)
 	asm volatile("lfence" : : : "memory");
 }
 
+static inline void monitor(const volatile void *addr)
+{
+	asm volatile("monitor" : : "a" (addr), "c" (0), "d" (0) : "memory");
+}
+
+static inline void mwait(unsigned int hint, unsigned int extensions)
+{
+	asm volatile("mwait" : : "a" (hint), "c" (extensions) : "memory");
+}
+
 static inline void cpuid(unsigned int *eax, unsigned int *ebx,
 			 unsigned int *ecx, unsigned int *edx)
 {
@@ -256,6 +345,19 @@ CPUID_REG(ebx)
 CPUID_REG(ecx)
 CPUID_REG(edx)
 
+/**
+ * Read the free-running timestamp counter of the current CPU.
+ *
+ * @return Current TSC value.
+ */
+static inline u64 read_timestamp(void)
+{
+	u32 lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (u64)hi << 32 | lo;
+}
+
 static inline unsigned long read_cr0(void)
 {
 	unsigned long cr0;
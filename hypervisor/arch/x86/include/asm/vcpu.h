@@ -67,7 +67,7 @@ void vcpu_handle_exit(struct per_cpu *cpu_data);
 
 void vcpu_park(void);
 
-void vcpu_nmi_handler(void);
+void vcpu_nmi_handler(const unsigned long *frame);
 
 void vcpu_tlb_flush(void);
 
@@ -120,6 +120,12 @@ bool vcpu_handle_msr_write(void);
 
 void vcpu_handle_cpuid(void);
 
+/**
+ * Idle the CPU after a trapped HLT or MWAIT of the cell, according to its
+ * idle policy. The caller skips the instruction.
+ */
+void vcpu_handle_idle(void);
+
 void vcpu_reset(unsigned int sipi_vector);
 void vcpu_vendor_reset(unsigned int sipi_vector);
 
@@ -208,6 +208,8 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define GUEST_ACTIVITY_ACTIVE			0
 #define GUEST_ACTIVITY_HLT			1
 
+#define GUEST_INTR_STATE_STI			(1UL << 0)
+
 #define VMX_MSR_BMP_0000_READ			0
 #define VMX_MSR_BMP_C000_READ			1
 #define VMX_MSR_BMP_0000_WRITE			2
@@ -216,6 +218,8 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define PIN_BASED_NMI_EXITING			(1UL << 3)
 #define PIN_BASED_VMX_PREEMPTION_TIMER		(1UL << 6)
 
+#define CPU_BASED_HLT_EXITING			(1UL << 7)
+#define CPU_BASED_MWAIT_EXITING			(1UL << 10)
 #define CPU_BASED_CR3_LOAD_EXITING		(1UL << 15)
 #define CPU_BASED_CR3_STORE_EXITING		(1UL << 16)
 #define CPU_BASED_USE_IO_BITMAPS		(1UL << 25)
@@ -225,20 +229,24 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES	(1UL << 0)
 #define SECONDARY_EXEC_ENABLE_EPT		(1UL << 1)
 #define SECONDARY_EXEC_RDTSCP			(1UL << 3)
+#define SECONDARY_EXEC_ENABLE_VPID		(1UL << 5)
 #define SECONDARY_EXEC_UNRESTRICTED_GUEST	(1UL << 7)
 #define SECONDARY_EXEC_INVPCID			(1UL << 12)
 #define SECONDARY_EXEC_XSAVES			(1UL << 20)
 
 #define VM_EXIT_HOST_ADDR_SPACE_SIZE		(1UL << 9)
+#define VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL	(1UL << 12)
 #define VM_EXIT_SAVE_IA32_PAT			(1UL << 18)
 #define VM_EXIT_LOAD_IA32_PAT			(1UL << 19)
 #define VM_EXIT_SAVE_IA32_EFER			(1UL << 20)
 #define VM_EXIT_LOAD_IA32_EFER			(1UL << 21)
 
 #define VM_ENTRY_IA32E_MODE			(1UL << 9)
+#define VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL	(1UL << 13)
 #define VM_ENTRY_LOAD_IA32_PAT			(1UL << 14)
 #define VM_ENTRY_LOAD_IA32_EFER			(1UL << 15)
 
+#define VMX_MISC_PREEMPTION_TIMER_RATE		BIT_MASK(4, 0)
 #define VMX_MISC_ACTIVITY_HLT			(1UL << 6)
 
 #define INTR_INFO_INTR_TYPE_MASK		BIT_MASK(10, 8)
@@ -301,7 +309,13 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define EPT_FLAG_READ				0x001
 #define EPT_FLAG_WRITE				0x002
 #define EPT_FLAG_EXECUTE			0x004
+#define EPT_FLAG_UC_TYPE			0x000
+#define EPT_FLAG_WC_TYPE			0x008
 #define EPT_FLAG_WB_TYPE			0x030
+#define EPT_FLAG_TYPE_MASK			0x038
+#define EPT_FLAG_IGNORE_PAT			0x040
+/* ignored by EPT, enforces snooping when VT-d shares the tables */
+#define EPT_FLAG_VTD_SNOOP			0x800
 
 #define EPT_TYPE_UNCACHEABLE			0
 #define EPT_TYPE_WRITEBACK			6
@@ -314,12 +328,18 @@ enum vmx_state { VMXOFF = 0, VMXON, VMCS_READY };
 #define EPT_INVEPT				(1UL << 20)
 #define EPT_INVEPT_SINGLE			(1UL << 25)
 #define EPT_INVEPT_GLOBAL			(1UL << 26)
+#define EPT_INVVPID				(1UL << 32)
+#define EPT_INVVPID_SINGLE			(1UL << 41)
+#define EPT_INVVPID_ALL				(1UL << 42)
 #define EPT_MANDATORY_FEATURES			(EPT_PAGE_WALK_4 | EPTP_WB | \
 						 EPT_INVEPT)
 
 #define VMX_INVEPT_SINGLE			1
 #define VMX_INVEPT_GLOBAL			2
 
+#define VMX_INVVPID_SINGLE			1
+#define VMX_INVVPID_ALL				2
+
 #define APIC_ACCESS_OFFSET_MASK			0x00000fff
 #define APIC_ACCESS_TYPE_MASK			0x0000f000
 #define APIC_ACCESS_TYPE_LINEAR_READ		0x00000000
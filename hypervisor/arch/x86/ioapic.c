@@ -13,6 +13,7 @@
 #include <jailhouse/control.h>
 #include <jailhouse/mmio.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/slab.h>
 #include <jailhouse/string.h>
 #include <jailhouse/unit.h>
 #include <asm/apic.h>
@@ -31,6 +32,9 @@
 # define IOPAPIC_VER_MRE(ver)	(((ver) & BIT_MASK(23, 16)) >> 16)
 #define IOAPIC_REDIR_TBL_START	0x10
 # define IOAPIC_REDIR_MASK	(1 << 16)
+/* mask, delivery status and remote IRR do not affect the mapping */
+# define IOAPIC_REDIR_MAPPING_IGNORED	(IOAPIC_REDIR_MASK | (1 << 14) | \
+					 (1 << 12))
 
 enum ioapic_handover {PINS_ACTIVE, PINS_MASKED};
 
@@ -77,6 +81,23 @@ static void ioapic_reg_write(struct phys_ioapic *ioapic, unsigned int reg,
 	spin_unlock(&ioapic->lock);
 }
 
+/*
+ * Update a redirection register half. Writes that would not change the
+ * physical state are skipped, saving the indirect register access.
+ */
+static void ioapic_redir_write(struct phys_ioapic *ioapic, unsigned int reg,
+			       u32 value)
+{
+	unsigned int index = reg - IOAPIC_REDIR_TBL_START;
+	union ioapic_redir_entry *phys_entry =
+		&ioapic->phys_redir_table[index / 2];
+
+	if (phys_entry->raw[index % 2] == value)
+		return;
+	phys_entry->raw[index % 2] = value;
+	ioapic_reg_write(ioapic, reg, value);
+}
+
 static struct apic_irq_message
 ioapic_translate_redir_entry(struct cell_ioapic *ioapic, unsigned int pin,
 			     union ioapic_redir_entry entry)
@@ -112,11 +133,15 @@ static int ioapic_virt_redir_write(struct cell_ioapic *ioapic,
 {
 	unsigned int pin = (reg - IOAPIC_REDIR_TBL_START) / 2;
 	struct phys_ioapic *phys_ioapic = ioapic->phys_ioapic;
+	unsigned long *pin_mapped = (unsigned long *)phys_ioapic->pin_mapped;
+	u32 ignored = (reg & 1) ? 0 : IOAPIC_REDIR_MAPPING_IGNORED;
+	union ioapic_redir_entry entry, phys_entry;
 	struct apic_irq_message irq_msg;
-	union ioapic_redir_entry entry;
 	int result;
 
 	entry = phys_ioapic->shadow_redir_table[pin];
+	if ((entry.raw[reg & 1] ^ value) & ~ignored)
+		clear_bit(pin, pin_mapped);
 	entry.raw[reg & 1] = value;
 	phys_ioapic->shadow_redir_table[pin] = entry;
 
@@ -124,10 +149,24 @@ static int ioapic_virt_redir_write(struct cell_ioapic *ioapic,
 	if (entry.native.mask) {
 		/*
 		 * The mask is part of the lower 32 bits. Apply it when that
-		 * register half is written.
+		 * register half is written. Keep the rest of the physical
+		 * entry so that unmasking an unmodified entry, e.g. after
+		 * handling a level-triggered interrupt, only needs to clear
+		 * the mask again.
 		 */
-		if ((reg & 1) == 0)
-			ioapic_reg_write(phys_ioapic, reg, IOAPIC_REDIR_MASK);
+		if ((reg & 1) == 0) {
+			phys_entry = phys_ioapic->phys_redir_table[pin];
+			ioapic_redir_write(phys_ioapic, reg,
+					   phys_entry.raw[0] |
+					   IOAPIC_REDIR_MASK);
+		}
+		return 0;
+	}
+
+	if (test_bit(pin, pin_mapped)) {
+		phys_entry = phys_ioapic->phys_redir_table[pin];
+		ioapic_redir_write(phys_ioapic, reg & ~1,
+				   phys_entry.raw[0] & ~IOAPIC_REDIR_MASK);
 		return 0;
 	}
 
@@ -137,26 +176,23 @@ static int ioapic_virt_redir_write(struct cell_ioapic *ioapic,
 				     irq_msg);
 	// HACK for QEMU
 	if (result == -ENOSYS) {
-		/* see regular update below, lazy version */
-		ioapic_reg_write(phys_ioapic, reg | 1, entry.raw[1]);
-		ioapic_reg_write(phys_ioapic, reg, entry.raw[reg & 1]);
+		ioapic_redir_write(phys_ioapic, reg | 1, entry.raw[1]);
+		ioapic_redir_write(phys_ioapic, reg & ~1, entry.raw[0]);
 		return 0;
 	}
 	if (result < 0)
 		return result;
 
-	entry.remap.zero = 0;
-	entry.remap.int_index15 = result >> 15;
-	entry.remap.remapped = 1;
-	entry.remap.int_index = result;
+	iommu_remap_ioapic_entry(&entry, result);
 
 	/*
 	 * Upper 32 bits weren't written physically if the entry was masked so
-	 * far. Write them unconditionally when setting the lower bits.
+	 * far. Write both halves, upper one first, redundant writes are
+	 * filtered.
 	 */
-	if ((reg & 1) == 0)
-		ioapic_reg_write(phys_ioapic, reg | 1, entry.raw[1]);
-	ioapic_reg_write(phys_ioapic, reg, entry.raw[reg & 1]);
+	ioapic_redir_write(phys_ioapic, reg | 1, entry.raw[1]);
+	ioapic_redir_write(phys_ioapic, reg & ~1, entry.raw[0]);
+	set_bit(pin, pin_mapped);
 
 	return 0;
 }
@@ -175,11 +211,14 @@ static void ioapic_mask_cell_pins(struct cell_ioapic *ioapic,
 
 		reg = IOAPIC_REDIR_TBL_START + pin * 2;
 
-		entry.raw[0] = ioapic_reg_read(phys_ioapic, reg);
+		/* The next owner has to establish its own mapping. */
+		clear_bit(pin, (unsigned long *)phys_ioapic->pin_mapped);
+
+		entry = phys_ioapic->phys_redir_table[pin];
 		if (entry.remap.mask)
 			continue;
 
-		ioapic_reg_write(phys_ioapic, reg, IOAPIC_REDIR_MASK);
+		ioapic_redir_write(phys_ioapic, reg, IOAPIC_REDIR_MASK);
 
 		if (handover == PINS_MASKED) {
 			phys_ioapic->shadow_redir_table[pin].native.mask = 1;
@@ -243,6 +282,8 @@ int ioapic_get_or_add_phys(const struct jailhouse_irqchip *irqchip,
 		phys_ioapic->shadow_redir_table[index / 2].raw[index % 2] =
 			ioapic_reg_read(phys_ioapic,
 					IOAPIC_REDIR_TBL_START + index);
+	memcpy(phys_ioapic->phys_redir_table, phys_ioapic->shadow_redir_table,
+	       sizeof(phys_ioapic->phys_redir_table));
 
 done:
 	*phys_ioapic_ptr = phys_ioapic;
@@ -350,7 +391,8 @@ static int ioapic_cell_init(struct cell *cell)
 	if (cell->config->num_irqchips > IOAPIC_MAX_CHIPS)
 		return trace_error(-ERANGE);
 
-	cell->arch.ioapics = page_alloc(&mem_pool, 1);
+	cell->arch.ioapics = slab_alloc(cell->config->num_irqchips *
+					sizeof(struct cell_ioapic));
 	if (!cell->arch.ioapics)
 		return -ENOMEM;
 
@@ -373,7 +415,7 @@ static int ioapic_cell_init(struct cell *cell)
 		cell->arch.num_ioapics++;
 
 		mmio_region_register(cell, irqchip->address, PAGE_SIZE,
-				     ioapic_access_handler, ioapic);
+				     ioapic_access_handler, ioapic, "ioapic");
 
 		if (cell == &root_cell)
 			continue;
@@ -383,9 +425,12 @@ static int ioapic_cell_init(struct cell *cell)
 		if (!root_ioapic)
 			continue;
 
-		for (pos = 0; pos < ARRAY_SIZE(irqchip->pin_bitmap); pos++)
+		for (pos = 0; pos < ARRAY_SIZE(irqchip->pin_bitmap); pos++) {
 			root_ioapic->pin_bitmap[pos] &=
 				~irqchip->pin_bitmap[pos];
+			phys_ioapic->pin_mapped[pos] &=
+				~irqchip->pin_bitmap[pos];
+		}
 	}
 
 	return 0;
@@ -421,19 +466,22 @@ static void ioapic_cell_exit(struct cell *cell)
 				root_ioapic->info->pin_bitmap[pos];
 	}
 
-	page_free(&mem_pool, cell->arch.ioapics, 1);
+	slab_free(cell->arch.ioapics,
+		  cell->config->num_irqchips * sizeof(struct cell_ioapic));
 }
 
 void ioapic_config_commit(struct cell *cell_added_removed)
 {
 	union ioapic_redir_entry entry;
 	struct cell_ioapic *ioapic;
+	unsigned long *pin_mapped;
 	unsigned int pin, reg, n;
 
 	if (!cell_added_removed)
 		return;
 
-	for_each_cell_ioapic(ioapic, &root_cell, n)
+	for_each_cell_ioapic(ioapic, &root_cell, n) {
+		pin_mapped = (unsigned long *)ioapic->phys_ioapic->pin_mapped;
 		for (pin = 0; pin < ioapic->phys_ioapic->pins; pin++) {
 			if (!test_bit(pin, (unsigned long *)ioapic->pin_bitmap))
 				continue;
@@ -442,9 +490,11 @@ void ioapic_config_commit(struct cell *cell_added_removed)
 			reg = IOAPIC_REDIR_TBL_START + pin * 2;
 
 			/*
-			 * Writing the lower half will unmask the pin and
-			 * update the upper one as well.
+			 * The CPU set of the root cell changed, so revalidate
+			 * the mapping. Writing the lower half will unmask the
+			 * pin and update the upper one as well.
 			 */
+			clear_bit(pin, pin_mapped);
 			if (ioapic_virt_redir_write(ioapic, reg,
 						    entry.raw[0]) < 0) {
 				panic_printk("FATAL: Unsupported IOAPIC "
@@ -452,6 +502,7 @@ void ioapic_config_commit(struct cell *cell_added_removed)
 				panic_stop();
 			}
 		}
+	}
 }
 
 static int ioapic_init(void)
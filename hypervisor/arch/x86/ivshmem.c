@@ -16,10 +16,11 @@
 #include <jailhouse/printk.h>
 #include <asm/pci.h>
 
-void arch_ivshmem_trigger_interrupt(struct ivshmem_endpoint *ive)
+void arch_ivshmem_trigger_interrupt(struct ivshmem_endpoint *ive,
+				    unsigned int vector)
 {
 	/* Get a copy of the struct before using it. */
-	struct apic_irq_message irq_msg = ive->arch.irq_msg;
+	struct apic_irq_message irq_msg = ive->arch.irq_msg[vector];
 
 	/* The read barrier makes sure the copy is consistent. */
 	memory_load_barrier();
@@ -27,24 +28,24 @@ void arch_ivshmem_trigger_interrupt(struct ivshmem_endpoint *ive)
 		apic_send_irq(irq_msg);
 }
 
-int arch_ivshmem_update_msix(struct pci_device *device)
+int arch_ivshmem_update_msix(struct pci_device *device, unsigned int vector)
 {
 	struct ivshmem_endpoint *ive = device->ivshmem_endpoint;
-	union x86_msi_vector msi = {
-		.raw.address = device->msix_vectors[0].address,
-		.raw.data = device->msix_vectors[0].data,
-	};
 	struct apic_irq_message irq_msg;
+	union x86_msi_vector msi;
 
 	/* before doing anything mark the cached irq_msg as invalid,
 	 * on success it will be valid on return. */
-	ive->arch.irq_msg.valid = 0;
+	ive->arch.irq_msg[vector].valid = 0;
 	memory_barrier();
 
-	if (ivshmem_is_msix_masked(ive))
+	if (ivshmem_is_msix_masked(ive, vector))
 		return 0;
 
-	irq_msg = x86_pci_translate_msi(device, 0, 0, msi);
+	msi.raw.address = device->msix_vectors[vector].address;
+	msi.raw.data = device->msix_vectors[vector].data;
+
+	irq_msg = x86_pci_translate_msi(device, vector, 0, msi);
 	if (!irq_msg.valid)
 		return 0;
 
@@ -58,9 +59,9 @@ int arch_ivshmem_update_msix(struct pci_device *device)
 	/* now copy the whole struct into our cache and mark the cache
 	 * valid at the end */
 	irq_msg.valid = 0;
-	ive->arch.irq_msg = irq_msg;
+	ive->arch.irq_msg[vector] = irq_msg;
 	memory_barrier();
-	ive->arch.irq_msg.valid = 1;
+	ive->arch.irq_msg[vector].valid = 1;
 
 	return 0;
 }
@@ -15,6 +15,7 @@
 #include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/string.h>
 #include <asm/vcpu.h>
 
 #define X86_MAX_INST_LEN	15
@@ -79,21 +80,20 @@ static unsigned int get_address_width(bool has_addrsz_prefix)
 		(!!(cs_attr & VCPU_CS_DB) ^ has_addrsz_prefix) ? 4 : 2;
 }
 
-struct mmio_instruction
-x86_mmio_parse(const struct guest_paging_structures *pg_structs, bool is_write)
+static struct mmio_instruction
+decode_instruction(const struct guest_paging_structures *pg_structs, u64 pc,
+		   bool is_write, bool *has_immediate)
 {
 	struct parse_context ctx = { .remaining = X86_MAX_INST_LEN,
 				     .count = 1 };
-	union registers *guest_regs = &this_cpu_data()->guest_regs;
 	struct mmio_instruction inst = { .inst_len = 0 };
-	u64 pc = vcpu_vendor_get_rip();
 	unsigned int n, skip_len = 0;
-	bool has_immediate = false;
 	union opcode op[4] = { };
 	bool does_write = false;
 	bool has_rex_w = false;
 	bool has_rex_r = false;
 	bool has_addrsz_prefix = false;
+	bool has_opsz_prefix = false;
 
 	if (!ctx_update(&ctx, &pc, 0, pg_structs))
 		goto error_noinst;
@@ -118,6 +118,16 @@ restart:
 			goto error_noinst;
 		has_addrsz_prefix = true;
 		goto restart;
+	case X86_PREFIX_OP_SZ:
+		if (!ctx_update(&ctx, &pc, 1, pg_structs))
+			goto error_noinst;
+		has_opsz_prefix = true;
+		goto restart;
+	case X86_PREFIX_REP:
+		if (!ctx_update(&ctx, &pc, 1, pg_structs))
+			goto error_noinst;
+		inst.rep = true;
+		goto restart;
 	case X86_OP_MOVZX_OPC1:
 		if (!ctx_update(&ctx, &pc, 1, pg_structs))
 			goto error_noinst;
@@ -145,7 +155,7 @@ restart:
 		break;
 	case X86_OP_MOV_IMMEDIATE_TO_MEM:
 		inst.access_size = has_rex_w ? 8 : 4;
-		has_immediate = true;
+		*has_immediate = true;
 		does_write = true;
 		break;
 	case X86_OP_MOV_MEM_TO_AX:
@@ -156,9 +166,20 @@ restart:
 	case X86_OP_MOV_AX_TO_MEM:
 		inst.inst_len += get_address_width(has_addrsz_prefix);
 		inst.access_size = has_rex_w ? 8 : 4;
-		inst.out_val = guest_regs->by_index[15];
+		inst.in_reg_num = 15;
 		does_write = true;
 		goto final;
+	case X86_OP_MOVSB:
+	case X86_OP_MOVS:
+		inst.string_op = MMIO_STRING_MOVS;
+		/* the access causing the exit may hit either operand */
+		does_write = is_write;
+		goto string;
+	case X86_OP_STOSB:
+	case X86_OP_STOS:
+		inst.string_op = MMIO_STRING_STOS;
+		does_write = true;
+		goto string;
 	default:
 		goto error_unsupported;
 	}
@@ -202,7 +223,7 @@ restart:
 	else
 		inst.in_reg_num = 15 - op[2].modrm.reg;
 
-	if (has_immediate) {
+	if (*has_immediate) {
 		/* walk any not yet retrieved SIB or displacement bytes */
 		if (!ctx_update(&ctx, &pc, skip_len, pg_structs))
 			goto error_noinst;
@@ -219,11 +240,22 @@ restart:
 			inst.out_val = (s64)(s32)inst.out_val;
 	} else {
 		inst.inst_len += skip_len;
-		if (does_write)
-			inst.out_val = guest_regs->by_index[inst.in_reg_num];
 	}
+	goto final;
+
+string:
+	/* the low opcode bit selects between byte and full-size access */
+	if (!(op[0].raw & 1))
+		inst.access_size = 1;
+	else
+		inst.access_size = has_rex_w ? 8 : (has_opsz_prefix ? 2 : 4);
+	inst.address_size = get_address_width(has_addrsz_prefix);
+	/* stos stores from the accumulator */
+	inst.in_reg_num = 15;
 
 final:
+	if ((inst.rep || has_opsz_prefix) && !inst.string_op)
+		goto error_unsupported;
 	if (does_write != is_write)
 		goto error_inconsitent;
 
@@ -248,3 +280,75 @@ error:
 	inst.inst_len = 0;
 	return inst;
 }
+
+static struct mmio_decode_cache_entry *
+decode_cache_lookup(struct mmio_decode_cache *cache,
+		    const struct guest_paging_structures *pg_structs, u64 pc,
+		    u16 cs_attr, bool is_write)
+{
+	struct mmio_decode_cache_entry *entry;
+	unsigned int n;
+
+	for (n = 0; n < MMIO_DECODE_CACHE_SIZE; n++) {
+		entry = &cache->entries[n];
+		if (entry->pc == pc &&
+		    entry->root_table_gphys == pg_structs->root_table_gphys &&
+		    entry->root_paging == pg_structs->root_paging &&
+		    entry->cs_attr == cs_attr && entry->is_write == is_write)
+			return entry;
+	}
+	return NULL;
+}
+
+struct mmio_instruction
+x86_mmio_parse(const struct guest_paging_structures *pg_structs, bool is_write)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+	struct mmio_decode_cache *cache = &cpu_data->mmio_decode_cache;
+	bool use_cache = cpu_data->public.cell->config->flags &
+		JAILHOUSE_CELL_MMIO_DECODE_CACHE;
+	struct mmio_decode_cache_entry *entry = NULL;
+	struct mmio_instruction inst;
+	u64 pc = vcpu_vendor_get_rip();
+	bool has_immediate = false;
+	u16 cs_attr = 0;
+
+	if (use_cache) {
+		cs_attr = vcpu_vendor_get_cs_attr();
+		entry = decode_cache_lookup(cache, pg_structs, pc, cs_attr,
+					    is_write);
+	}
+
+	if (entry) {
+		inst = entry->inst;
+		has_immediate = entry->has_immediate;
+	} else {
+		inst = decode_instruction(pg_structs, pc, is_write,
+					  &has_immediate);
+		if (!inst.inst_len)
+			return inst;
+
+		if (use_cache) {
+			entry = &cache->entries[cache->next];
+			entry->pc = pc;
+			entry->root_paging = pg_structs->root_paging;
+			entry->root_table_gphys = pg_structs->root_table_gphys;
+			entry->cs_attr = cs_attr;
+			entry->is_write = is_write;
+			entry->has_immediate = has_immediate;
+			entry->inst = inst;
+			cache->next = (cache->next + 1) % MMIO_DECODE_CACHE_SIZE;
+		}
+	}
+
+	if (is_write && !has_immediate)
+		inst.out_val = cpu_data->guest_regs.by_index[inst.in_reg_num];
+
+	return inst;
+}
+
+void x86_mmio_decode_cache_flush(void)
+{
+	memset(&this_cpu_data()->mmio_decode_cache, 0,
+	       sizeof(struct mmio_decode_cache));
+}
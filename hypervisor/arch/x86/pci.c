@@ -22,7 +22,11 @@
 #include <asm/pci.h>
 #include <asm/processor.h>
 
-/** Protects the root bridge's PIO interface to the PCI config space. */
+/**
+ * Protects the root bridge's PIO interface to the PCI config space. It is only
+ * used if MMCONFIG is unavailable or does not cover the bus, see
+ * pci_read_config.
+ */
 static DEFINE_SPINLOCK(pci_lock);
 
 u32 arch_pci_read_config(u16 bdf, u16 address, unsigned int size)
@@ -111,8 +115,7 @@ static int data_port_in_handler(struct pci_device *device, u16 address,
 
 	if (pci_cfg_read_moderate(device, address,
 				  size, &reg_data) == PCI_ACCESS_PERFORM)
-		reg_data = arch_pci_read_config(device->info->bdf, address,
-						size);
+		reg_data = pci_read_config(device->info->bdf, address, size);
 
 	set_guest_rax_reg(reg_data, size);
 
@@ -139,8 +142,78 @@ static int data_port_out_handler(struct pci_device *device, u16 address,
 	if (access == PCI_ACCESS_REJECT)
 		return -1;
 	if (access == PCI_ACCESS_PERFORM)
-		arch_pci_write_config(device->info->bdf, address, reg_data,
-				      size);
+		pci_write_config(device->info->bdf, address, reg_data, size);
+	return 1;
+}
+
+/**
+ * Look up the device addressed via the config ports, caching the result per
+ * CPU. The set of devices listed in a cell's config does not change during
+ * the cell's lifetime, only their assignment does. The cache is therefore
+ * only reset when the CPU is reset.
+ * @param cell		Cell the current CPU belongs to.
+ * @param bdf		Bus, device and function of the addressed device.
+ *
+ * @return Pointer to assigned device or NULL.
+ *
+ * @private
+ */
+static struct pci_device *get_addressed_device(struct cell *cell, u16 bdf)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+	struct pci_device *device = cpu_data->pci_cfg_device;
+
+	if (!device || device->info->bdf != bdf) {
+		device = pci_get_assigned_device(cell, bdf);
+		if (!device)
+			return NULL;
+		cpu_data->pci_cfg_device = device;
+	}
+
+	return device->cell ? device : NULL;
+}
+
+/**
+ * Fast path for 32-bit accesses to PCI config space via the config ports.
+ * @param port		I/O port number of this access.
+ * @param dir_in	True for input, false for output.
+ *
+ * Only handles dword accesses to PCI_REG_ADDR_PORT and to the aligned
+ * PCI_REG_DATA_PORT. Anything else is left to x86_pci_config_handler().
+ *
+ * @return 1 if handled successfully, 0 if unhandled, -1 on access error.
+ */
+int x86_pci_config_dword_handler(u16 port, bool dir_in)
+{
+	union registers *guest_regs = &this_cpu_data()->guest_regs;
+	struct cell *cell = this_cell();
+	u32 addr_port_val = cell->arch.pci_addr_port_val;
+	struct pci_device *device;
+	u16 address;
+
+	if (port == PCI_REG_ADDR_PORT) {
+		/* 32-bit input clears the upper half of RAX */
+		if (dir_in)
+			guest_regs->rax = addr_port_val;
+		else
+			cell->arch.pci_addr_port_val = guest_regs->rax;
+		return 1;
+	}
+
+	if (port != PCI_REG_DATA_PORT)
+		return 0;
+
+	device = get_addressed_device(cell,
+				      addr_port_val >> PCI_ADDR_BDF_SHIFT);
+	address = addr_port_val & PCI_ADDR_REGNUM_MASK;
+
+	if (dir_in)
+		return data_port_in_handler(device, address, 4);
+	if (data_port_out_handler(device, address, 4) < 0) {
+		panic_printk("FATAL: Invalid PCI config write, port: %x, "
+			     "size 4, address port: %x\n", port, addr_port_val);
+		return -1;
+	}
 	return 1;
 }
 
@@ -185,7 +258,7 @@ int x86_pci_config_handler(u16 port, bool dir_in, unsigned int size)
 		addr_port_val = cell->arch.pci_addr_port_val;
 
 		bdf = addr_port_val >> PCI_ADDR_BDF_SHIFT;
-		device = pci_get_assigned_device(cell, bdf);
+		device = get_addressed_device(cell, bdf);
 
 		address = (addr_port_val & PCI_ADDR_REGNUM_MASK) +
 			port - PCI_REG_DATA_PORT;
@@ -317,19 +390,6 @@ void arch_pci_suppress_msi(struct pci_device *device,
 	}
 }
 
-static u64 pci_get_x86_msi_remap_address(unsigned int index)
-{
-	union x86_msi_vector msi = {
-		.remap.int_index15 = index >> 15,
-		.remap.shv = 1,
-		.remap.remapped = 1,
-		.remap.int_index = index,
-		.remap.address = MSI_ADDRESS_VALUE,
-	};
-
-	return msi.raw.address;
-}
-
 int arch_pci_update_msi(struct pci_device *device,
 			const struct jailhouse_pci_capability *cap)
 {
@@ -358,14 +418,14 @@ int arch_pci_update_msi(struct pci_device *device,
 	}
 
 	/* set result to the base index again */
-	result -= vectors - 1;
+	msi = iommu_get_remapped_msi(result - (vectors - 1));
 
-	pci_write_config(bdf, cap->start + (info->msi_64bits ? 12 : 8), 0, 2);
+	pci_write_config(bdf, cap->start + (info->msi_64bits ? 12 : 8),
+			 msi.raw.data, 2);
 
 	if (info->msi_64bits)
-		pci_write_config(bdf, cap->start + 8, 0, 4);
-	pci_write_config(bdf, cap->start + 4,
-			 (u32)pci_get_x86_msi_remap_address(result), 4);
+		pci_write_config(bdf, cap->start + 8, msi.raw.address >> 32, 4);
+	pci_write_config(bdf, cap->start + 4, (u32)msi.raw.address, 4);
 
 	return 0;
 }
@@ -397,9 +457,9 @@ int arch_pci_update_msix_vector(struct pci_device *device, unsigned int index)
 	if (result < 0)
 		return result;
 
-	mmio_write64(&device->msix_table[index].address,
-		     pci_get_x86_msi_remap_address(result));
-	mmio_write32(&device->msix_table[index].data, 0);
+	msi = iommu_get_remapped_msi(result);
+	mmio_write64(&device->msix_table[index].address, msi.raw.address);
+	mmio_write32(&device->msix_table[index].data, msi.raw.data);
 
 	return 0;
 }
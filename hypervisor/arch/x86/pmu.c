@@ -0,0 +1,238 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Intel architectural PMU counters reserved for the hypervisor: fixed
+ * counter 0 (instructions retired), fixed counter 1 (unhalted core cycles)
+ * and the last general-purpose counter (LLC misses). Cells cannot enable
+ * counters anyway because IA32_PERF_GLOBAL_CTRL is owned by the hypervisor,
+ * writes to the reserved counters and their controls are dropped as well.
+ *
+ * With CONFIG_PROFILE_SAMPLING, one more general-purpose counter is reserved
+ * for sampling the hypervisor: it counts unhalted core cycles in host mode
+ * only, because IA32_PERF_GLOBAL_CTRL is switched on VM entry and exit, and
+ * raises an NMI on overflow. The NMI handler records the interrupted RIP in
+ * the trace buffer and re-arms the counter.
+ */
+
+#include <jailhouse/pmu.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/trace.h>
+#include <asm/apic.h>
+#include <asm/pmu.h>
+#include <asm/processor.h>
+#include <asm/vmx.h>
+
+/* leaf 0x0a, EAX, EBX and EDX */
+#define PMU_VERSION_MASK		BIT_MASK(7, 0)
+#define PMU_NUM_GP_SHIFT		8
+#define PMU_NUM_GP_MASK			BIT_MASK(15, 8)
+#define PMU_GP_WIDTH_SHIFT		16
+#define PMU_GP_WIDTH_MASK		BIT_MASK(23, 16)
+#define PMU_NO_LLC_MISSES		(1 << 4)
+#define PMU_NUM_FIXED_MASK		BIT_MASK(4, 0)
+#define PMU_FIXED_WIDTH_SHIFT		5
+#define PMU_FIXED_WIDTH_MASK		BIT_MASK(12, 5)
+
+#define PERFEVTSEL_LLC_MISSES		0x412e
+#define PERFEVTSEL_UNHALTED_CYCLES	0x003c
+#define PERFEVTSEL_USR			(1 << 16)
+#define PERFEVTSEL_OS			(1 << 17)
+#define PERFEVTSEL_INT			(1 << 20)
+#define PERFEVTSEL_EN			(1 << 22)
+
+/* count in all rings for fixed counters 0 and 1 */
+#define FIXED_CTR_CTRL_ENABLE		0x33
+#define GLOBAL_CTRL_FIXED_SHIFT		32
+
+#define RDPMC_FIXED			(1 << 30)
+
+/* host-mode cycles between two samples */
+#define SAMPLE_PERIOD			1000000
+
+/* position of the interrupted RIP in the NMI frame, see entry.S */
+#define NMI_FRAME_RIP			9
+
+static bool pmu_available;
+static unsigned int gp_counter;
+static u64 counter_mask;
+static bool sampling_available;
+static unsigned int sample_counter;
+static u32 reserved_msrs[9];
+static unsigned int num_reserved_msrs;
+
+static inline u64 rdpmc(u32 counter)
+{
+	u32 lo, hi;
+
+	asm volatile("rdpmc" : "=a" (lo), "=d" (hi) : "c" (counter));
+	return (u64)lo | (((u64)hi) << 32);
+}
+
+#if defined(CONFIG_PMU_STATS) || defined(CONFIG_PROFILE_SAMPLING)
+static void reserve_gp_counter(unsigned int counter)
+{
+	reserved_msrs[num_reserved_msrs++] = MSR_IA32_PERFEVTSEL0 + counter;
+	reserved_msrs[num_reserved_msrs++] = MSR_IA32_PMC0 + counter;
+	reserved_msrs[num_reserved_msrs++] = MSR_IA32_A_PMC0 + counter;
+}
+#endif
+
+void pmu_init(void)
+{
+#if defined(CONFIG_PMU_STATS) || defined(CONFIG_PROFILE_SAMPLING)
+	u32 eax = cpuid_eax(0x0a, 0), edx = cpuid_edx(0x0a, 0);
+	unsigned int num_gp, width;
+
+	/* version 2 introduced fixed counters and global control */
+	if ((eax & PMU_VERSION_MASK) < 2)
+		return;
+
+	num_gp = (eax & PMU_NUM_GP_MASK) >> PMU_NUM_GP_SHIFT;
+	width = MIN((eax & PMU_GP_WIDTH_MASK) >> PMU_GP_WIDTH_SHIFT,
+		    (edx & PMU_FIXED_WIDTH_MASK) >> PMU_FIXED_WIDTH_SHIFT);
+	if (num_gp == 0 || width == 0)
+		return;
+#endif
+
+#ifdef CONFIG_PMU_STATS
+	if ((edx & PMU_NUM_FIXED_MASK) >= 2 &&
+	    !(cpuid_ebx(0x0a, 0) & PMU_NO_LLC_MISSES)) {
+		gp_counter = --num_gp;
+		counter_mask = BIT_MASK(width - 1, 0);
+
+		reserved_msrs[num_reserved_msrs++] = MSR_IA32_FIXED_CTR0;
+		reserved_msrs[num_reserved_msrs++] = MSR_IA32_FIXED_CTR0 + 1;
+		reserved_msrs[num_reserved_msrs++] = MSR_IA32_FIXED_CTR_CTRL;
+		reserve_gp_counter(gp_counter);
+		pmu_available = true;
+
+		printk("PMU: Reserving fixed counters 0-1 and counter %d\n",
+		       gp_counter);
+	}
+#endif
+
+#ifdef CONFIG_PROFILE_SAMPLING
+	/* the counter must only run in host mode */
+	if (num_gp > 0 &&
+	    (read_msr(MSR_IA32_VMX_EXIT_CTLS) >> 32) &
+	     VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL &&
+	    (read_msr(MSR_IA32_VMX_ENTRY_CTLS) >> 32) &
+	     VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL) {
+		sample_counter = --num_gp;
+		reserve_gp_counter(sample_counter);
+		sampling_available = true;
+
+		printk("PMU: Sampling hypervisor with counter %d\n",
+		       sample_counter);
+	}
+#endif
+}
+
+unsigned int pmu_get_reserved_msrs(const u32 **msrs)
+{
+	*msrs = reserved_msrs;
+	return num_reserved_msrs;
+}
+
+bool pmu_is_reserved_msr(u32 msr)
+{
+	unsigned int n;
+
+	for (n = 0; n < num_reserved_msrs; n++)
+		if (reserved_msrs[n] == msr)
+			return true;
+	return false;
+}
+
+static u64 guest_global_ctrl(void)
+{
+	if (!pmu_available)
+		return 0;
+	return (3UL << GLOBAL_CTRL_FIXED_SHIFT) | (1UL << gp_counter);
+}
+
+bool pmu_get_global_ctrl(u64 *host_ctrl, u64 *guest_ctrl)
+{
+	if (!sampling_available)
+		return false;
+
+	*guest_ctrl = guest_global_ctrl();
+	*host_ctrl = *guest_ctrl | (1UL << sample_counter);
+	return true;
+}
+
+void pmu_cpu_init(void)
+{
+	if (!pmu_available && !sampling_available)
+		return;
+
+	if (pmu_available) {
+		write_msr(MSR_IA32_FIXED_CTR_CTRL, FIXED_CTR_CTRL_ENABLE);
+		write_msr(MSR_IA32_PERFEVTSEL0 + gp_counter,
+			  PERFEVTSEL_LLC_MISSES | PERFEVTSEL_USR |
+			  PERFEVTSEL_OS | PERFEVTSEL_EN);
+	}
+
+	/*
+	 * The sampling counter is enabled by the first VM exit, see
+	 * pmu_get_global_ctrl. Linux programs the LVT entry for NMI delivery
+	 * as well, so there is no need to restore it on exit.
+	 */
+	if (sampling_available) {
+		write_msr(MSR_IA32_PMC0 + sample_counter, -SAMPLE_PERIOD);
+		write_msr(MSR_IA32_PERFEVTSEL0 + sample_counter,
+			  PERFEVTSEL_UNHALTED_CYCLES | PERFEVTSEL_USR |
+			  PERFEVTSEL_OS | PERFEVTSEL_INT | PERFEVTSEL_EN);
+		apic_set_lvtpc_nmi();
+	}
+
+	write_msr(MSR_IA32_PERF_GLOBAL_CTRL, guest_global_ctrl());
+}
+
+void pmu_cpu_exit(void)
+{
+	if (!pmu_available && !sampling_available)
+		return;
+
+	write_msr(MSR_IA32_PERF_GLOBAL_CTRL, 0);
+
+	if (pmu_available) {
+		write_msr(MSR_IA32_FIXED_CTR_CTRL, 0);
+		write_msr(MSR_IA32_PERFEVTSEL0 + gp_counter, 0);
+	}
+	if (sampling_available) {
+		write_msr(MSR_IA32_PERFEVTSEL0 + sample_counter, 0);
+		write_msr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 1UL << sample_counter);
+	}
+}
+
+void pmu_nmi_handler(const unsigned long *frame)
+{
+	if (!sampling_available ||
+	    !(read_msr(MSR_IA32_PERF_GLOBAL_STATUS) & (1UL << sample_counter)))
+		return;
+
+	trace_sample(frame[NMI_FRAME_RIP]);
+
+	write_msr(MSR_IA32_PMC0 + sample_counter, -SAMPLE_PERIOD);
+	write_msr(MSR_IA32_PERF_GLOBAL_OVF_CTRL, 1UL << sample_counter);
+	/* delivering the NMI masked the LVT entry */
+	apic_set_lvtpc_nmi();
+}
+
+u64 arch_pmu_read(u64 *values)
+{
+	if (!pmu_available)
+		return 0;
+
+	values[JAILHOUSE_PMU_KCYCLES] = rdpmc(RDPMC_FIXED | 1);
+	values[JAILHOUSE_PMU_KINSTRUCTIONS] = rdpmc(RDPMC_FIXED | 0);
+	values[JAILHOUSE_PMU_LLC_MISSES] = rdpmc(gp_counter);
+
+	return counter_mask;
+}
@@ -47,7 +47,7 @@ static void set_idt_int_gate(unsigned int vector, unsigned long entry)
 	idt[vector * 4 + 2] = entry >> 32;
 }
 
-int arch_init_early(void)
+int __init arch_init_early(void)
 {
 	unsigned long entry;
 	unsigned int vector;
@@ -114,7 +114,7 @@ static void set_cs(u16 cs)
 		: : "m" (cs) : "rax");
 }
 
-int arch_cpu_init(struct per_cpu *cpu_data)
+int __init arch_cpu_init(struct per_cpu *cpu_data)
 {
 	struct desc_table_reg dtr;
 	int err, n;
@@ -18,16 +18,20 @@
 #include <jailhouse/cell.h>
 #include <jailhouse/cell-config.h>
 #include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/processor.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
+#include <jailhouse/uart.h>
 #include <jailhouse/utils.h>
 #include <asm/amd_iommu.h>
 #include <asm/apic.h>
 #include <asm/control.h>
 #include <asm/iommu.h>
 #include <asm/paging.h>
+#include <asm/pci.h>
 #include <jailhouse/percpu.h>
 #include <asm/processor.h>
 #include <asm/svm.h>
@@ -42,17 +46,22 @@
 
 /* IOPM size: two 4-K pages + 3 bits */
 #define IOPM_PAGES			3
+#define MSRPM_PAGES			2
 
 #define NPT_IOMMU_PAGE_DIR_LEVELS	4
 
-static bool has_avic, has_assists, has_flush_by_asid;
+static bool has_avic, has_assists, has_flush_by_asid, has_nrips;
 
 static const struct segment invalid_seg;
 
 static struct paging npt_iommu_paging[NPT_IOMMU_PAGE_DIR_LEVELS];
 
-/* bit cleared: direct access allowed */
-// TODO: convert to whitelist
+/*
+ * bit cleared: direct access allowed
+ *
+ * Default for cells without MSR whitelist. The intercepts set here are also
+ * enforced for cells with whitelist.
+ */
 static u8 __attribute__((aligned(PAGE_SIZE))) msrpm[][0x2000/4] = {
 	[ SVM_MSRPM_0000 ] = {
 		[      0/4 ...  0x017/4 ] = 0,
@@ -111,8 +120,22 @@ static int svm_check_features(void)
 	if ((cpuid_edx(0x8000000A, 0) & X86_FEATURE_DECODE_ASSISTS))
 		has_assists = true;
 
-	/* AVIC support */
-	/* FIXME: Jailhouse support is incomplete so far
+	/* Next RIP saved on instruction intercepts */
+	if (cpuid_edx(0x8000000A, 0) & X86_FEATURE_NRIPS)
+		has_nrips = true;
+
+	/*
+	 * AVIC support
+	 *
+	 * AVIC accelerates a virtual APIC backed by a per-vCPU page, with
+	 * interrupts injected via the backing page and doorbells. Cells run
+	 * on their physical APICs instead: xAPIC reads are passed through,
+	 * and only writes trap. Device interrupts and IPIs are delivered
+	 * without VM exits on the receiving side. Switching to AVIC would
+	 * require virtualizing all interrupt sources of a cell, including
+	 * passthrough devices. So it stays disabled, and the emulation paths
+	 * of svm_handle_apic_access() and x2apic_handle_write() remain the
+	 * only ones.
 	if (cpuid_edx(0x8000000A, 0) & X86_FEATURE_AVIC)
 		has_avic = true; */
 
@@ -143,8 +166,20 @@ static void set_svm_segment_from_segment(struct svm_segment *svm_segment,
 static void svm_set_cell_config(struct cell *cell, struct vmcb *vmcb)
 {
 	vmcb->iopm_base_pa = paging_hvirt2phys(cell->arch.svm.iopm);
+	vmcb->msrpm_base_pa = paging_hvirt2phys(cell->arch.svm.msrpm);
 	vmcb->n_cr3 =
 		paging_hvirt2phys(cell->arch.svm.npt_iommu_structs.root_table);
+
+	if (CELL_FLAGS_IDLE_POLICY(cell->config->flags) ==
+	    JAILHOUSE_CELL_IDLE_PASSTHROUGH) {
+		vmcb->general1_intercepts &= ~GENERAL1_INTERCEPT_HLT;
+		vmcb->general2_intercepts &= ~GENERAL2_INTERCEPT_MWAIT;
+	} else {
+		vmcb->general1_intercepts |= GENERAL1_INTERCEPT_HLT;
+		vmcb->general2_intercepts |= GENERAL2_INTERCEPT_MWAIT;
+	}
+
+	vmcb->clean_bits &= ~(CLEAN_BITS_I | CLEAN_BITS_IOPM | CLEAN_BITS_NP);
 }
 
 static void vmcb_setup(struct per_cpu *cpu_data)
@@ -217,8 +252,6 @@ static void vmcb_setup(struct per_cpu *cpu_data)
 	 */
 	vmcb->exception_intercepts |= (1 << DB_VECTOR) | (1 << AC_VECTOR);
 
-	vmcb->msrpm_base_pa = paging_hvirt2phys(msrpm);
-
 	vmcb->np_enable = 1;
 	/* No more than one guest owns the CPU */
 	vmcb->guest_asid = 1;
@@ -277,7 +310,7 @@ static unsigned long npt_iommu_get_phys_l2(pt_entry_t pte, unsigned long virt)
 	return (*pte & BIT_MASK(51, 21)) | (virt & BIT_MASK(20, 0));
 }
 
-int vcpu_vendor_early_init(void)
+int __init vcpu_vendor_early_init(void)
 {
 	unsigned long vm_cr;
 	int err;
@@ -323,6 +356,66 @@ int vcpu_vendor_early_init(void)
 	return vcpu_cell_init(&root_cell);
 }
 
+static u8 *msrpm_byte(u8 *msrpm_base, u32 msr)
+{
+	unsigned int part;
+
+	if (msr <= 0x1fff)
+		part = SVM_MSRPM_0000;
+	else if (msr >= 0xc0000000 && msr <= 0xc0001fff)
+		part = SVM_MSRPM_C000;
+	else if (msr >= 0xc0010000 && msr <= 0xc0011fff)
+		part = SVM_MSRPM_C001;
+	else
+		return NULL;
+
+	return msrpm_base + part * sizeof(msrpm[0]) + (msr & 0x1fff) / 4;
+}
+
+static int svm_cell_init_msrpm(struct cell *cell)
+{
+	const struct jailhouse_msr_range *range =
+		jailhouse_cell_msr_ranges(cell->config);
+	u8 *cell_msrpm = cell->arch.svm.msrpm;
+	const u32 *msrs;
+	unsigned int n;
+	u32 msr, last;
+
+	if (cell->config->num_msr_ranges == 0) {
+		memcpy(cell_msrpm, msrpm, sizeof(msrpm));
+		return 0;
+	}
+
+	memset(cell_msrpm, -1, sizeof(msrpm));
+
+	for (n = 0; n < cell->config->num_msr_ranges; n++, range++) {
+		last = range->start + range->size - 1;
+		/* ranges must not cross the MSR blocks the map covers */
+		if (range->size == 0 || last < range->start ||
+		    !msrpm_byte(cell_msrpm, range->start) ||
+		    (range->start ^ last) & ~0x1fff)
+			return trace_error(-EINVAL);
+
+		for (msr = range->start; msr <= last; msr++) {
+			if (range->flags & JAILHOUSE_MSR_READ)
+				*msrpm_byte(cell_msrpm, msr) &=
+					~(1 << ((msr % 4) * 2));
+			if (range->flags & JAILHOUSE_MSR_WRITE)
+				*msrpm_byte(cell_msrpm, msr) &=
+					~(2 << ((msr % 4) * 2));
+		}
+	}
+
+	for (n = apic_get_local_msrs(&msrs); n > 0; n--, msrs++)
+		*msrpm_byte(cell_msrpm, *msrs) &= ~(3 << ((*msrs % 4) * 2));
+
+	/* keep the interceptions the hypervisor depends on */
+	for (n = 0; n < sizeof(msrpm); n++)
+		cell_msrpm[n] |= ((u8 *)msrpm)[n];
+
+	return 0;
+}
+
 int vcpu_vendor_cell_init(struct cell *cell)
 {
 	int err = -ENOMEM;
@@ -333,10 +426,22 @@ int vcpu_vendor_cell_init(struct cell *cell)
 	if (!cell->arch.svm.iopm)
 		return err;
 
+	cell->arch.svm.msrpm = page_alloc(&mem_pool, MSRPM_PAGES);
+	if (!cell->arch.svm.msrpm)
+		goto err_free_iopm;
+
+	err = svm_cell_init_msrpm(cell);
+	if (err)
+		goto err_free_msrpm;
+
 	/* build root NPT of cell */
 	cell->arch.svm.npt_iommu_structs.root_paging = npt_iommu_paging;
 	cell->arch.svm.npt_iommu_structs.root_table =
 		(page_table_t)cell->arch.root_table_page;
+	cell->arch.svm.npt_iommu_structs.pt_pool = numa_cell_pool(cell);
+	/* see cell_map_lazy */
+	cell->arch.svm.npt_iommu_structs.no_merge =
+		!!(cell->config->flags & JAILHOUSE_CELL_LAZY_MEMORY);
 
 	if (!has_avic) {
 		/*
@@ -354,10 +459,12 @@ int vcpu_vendor_cell_init(struct cell *cell)
 				    flags, PAGING_NON_COHERENT);
 	}
 	if (err)
-		goto err_free_iopm;
+		goto err_free_msrpm;
 
 	return 0;
 
+err_free_msrpm:
+	page_free(&mem_pool, cell->arch.svm.msrpm, MSRPM_PAGES);
 err_free_iopm:
 	page_free(&mem_pool, cell->arch.svm.iopm, 3);
 
@@ -376,8 +483,25 @@ int vcpu_map_memory_region(struct cell *cell,
 		flags |= PAGE_FLAG_RW;
 	if (!(mem->flags & JAILHOUSE_MEM_EXECUTE))
 		flags |= PAGE_FLAG_NOEXECUTE;
-	if (mem->flags & JAILHOUSE_MEM_COMM_REGION)
+	/*
+	 * Select the entry of the host PAT, see PAT_HOST_VALUE. NPT has no
+	 * equivalent of ignoring the guest PAT, so the more restrictive of both
+	 * types applies. WB is therefore the same as the default.
+	 */
+	switch (mem->flags & JAILHOUSE_MEM_TYPE_MASK) {
+	case JAILHOUSE_MEM_TYPE_WC:
+		flags |= PAGE_FLAG_FRAMEBUFFER;
+		break;
+	case JAILHOUSE_MEM_TYPE_UC:
+		flags |= PAGE_FLAG_FRAMEBUFFER | PAGE_FLAG_DEVICE;
+		break;
+	}
+	if (mem->flags & JAILHOUSE_MEM_TIMEBASE) {
+		phys_start = paging_hvirt2phys(&timebase_page);
+		flags &= ~PAGE_FLAG_RW;
+	} else if (mem->flags & JAILHOUSE_MEM_COMM_REGION) {
 		phys_start = paging_hvirt2phys(&cell->comm_page);
+	}
 
 	flags |= amd_iommu_get_memory_region_flags(mem);
 
@@ -397,10 +521,16 @@ int vcpu_unmap_memory_region(struct cell *cell,
 			      mem->virt_start, mem->size, PAGING_COHERENT);
 }
 
+const struct paging_structures *arch_paging_cell_structs(struct cell *cell)
+{
+	return &cell->arch.svm.npt_iommu_structs;
+}
+
 void vcpu_vendor_cell_exit(struct cell *cell)
 {
 	paging_destroy(&cell->arch.svm.npt_iommu_structs, XAPIC_BASE,
 		       PAGE_SIZE, PAGING_NON_COHERENT);
+	page_free(&mem_pool, cell->arch.svm.msrpm, MSRPM_PAGES);
 	page_free(&mem_pool, cell->arch.svm.iopm, 3);
 }
 
@@ -417,6 +547,11 @@ int vcpu_init(struct per_cpu *cpu_data)
 	if (efer & EFER_SVME)
 		return trace_error(-EBUSY);
 
+	cpu_data->host_state =
+		page_alloc(numa_local_pool(cpu_data->public.cpu_id), 1);
+	if (!cpu_data->host_state)
+		return -ENOMEM;
+
 	efer |= EFER_SVME;
 	write_msr(MSR_EFER, efer);
 
@@ -440,8 +575,7 @@ int vcpu_init(struct per_cpu *cpu_data)
 	write_cr0(X86_CR0_HOST_STATE);
 	write_cr4(X86_CR4_HOST_STATE);
 
-	write_msr(MSR_VM_HSAVE_PA,
-		  paging_hvirt2phys(per_cpu(this_cpu_id())->host_state));
+	write_msr(MSR_VM_HSAVE_PA, paging_hvirt2phys(cpu_data->host_state));
 
 	return 0;
 }
@@ -627,8 +761,13 @@ void vcpu_vendor_reset(unsigned int sipi_vector)
 
 	vmcb->eventinj = 0;
 
-	/* Almost all of the guest state changed */
-	vmcb->clean_bits = 0;
+	/*
+	 * Control registers, segments, descriptor tables and DR7 changed.
+	 * ASID, TPR, CR2, LBR and AVIC state stay untouched, and
+	 * svm_set_cell_config() invalidates what depends on the cell.
+	 */
+	vmcb->clean_bits &= ~(CLEAN_BITS_CRX | CLEAN_BITS_SEG | CLEAN_BITS_DT |
+			      CLEAN_BITS_DRX);
 
 	svm_set_cell_config(cpu_data->public.cell, vmcb);
 
@@ -640,7 +779,19 @@ void vcpu_vendor_reset(unsigned int sipi_vector)
 
 void vcpu_skip_emulated_instruction(unsigned int inst_len)
 {
-	this_cpu_data()->vmcb.rip += inst_len;
+	struct vmcb *vmcb = &this_cpu_data()->vmcb;
+
+	/*
+	 * Instruction intercepts report the address of the next instruction,
+	 * also covering prefixes the callers' length estimates ignore. Other
+	 * exits, nested page faults in particular, leave it zero.
+	 */
+	if (has_nrips && vmcb->nextrip) {
+		vmcb->rip = vmcb->nextrip;
+		vmcb->nextrip = 0;
+	} else {
+		vmcb->rip += inst_len;
+	}
 }
 
 static void update_efer(struct vmcb *vmcb)
@@ -884,10 +1035,32 @@ unsigned long vcpu_vendor_get_guest_cr4(void)
 	return this_cpu_data()->vmcb.cr4;
 }
 
-void vcpu_handle_exit(struct per_cpu *cpu_data)
+/*
+ * Fast path for 32-bit non-string accesses to the PCI config ports. Returns
+ * 1 if handled, 0 if the generic path has to take over, -1 on access error.
+ */
+static int svm_handle_pci_config_dword(struct vmcb *vmcb)
+{
+	u64 exitinfo = vmcb->exitinfo1;
+	int result;
+
+	/* SZ32 set, STR, REP, SZ8 and SZ16 cleared (see APM, 15.10.2) */
+	if ((exitinfo & 0x7c) != 0x40)
+		return 0;
+
+	result = x86_pci_config_dword_handler((exitinfo >> 16) & 0xFFFF,
+					      !!(exitinfo & 0x1));
+	if (result == 1)
+		vcpu_skip_emulated_instruction(vmcb->exitinfo2 - vmcb->rip);
+	return result;
+}
+
+void __hot vcpu_handle_exit(struct per_cpu *cpu_data)
 {
 	struct public_per_cpu *cpu_public = &cpu_data->public;
 	struct vmcb *vmcb = &cpu_data->vmcb;
+	unsigned int stat = JAILHOUSE_CPU_STAT_VMEXITS_TOTAL;
+	u64 start = read_timestamp();
 	bool res = false;
 
 	vmcb->gs.base = read_msr(MSR_GS_BASE);
@@ -895,36 +1068,62 @@ void vcpu_handle_exit(struct per_cpu *cpu_data)
 	/* Restore GS value expected by per_cpu data accessors */
 	write_msr(MSR_GS_BASE, (unsigned long)cpu_data);
 
+	cpu_record_exit_start(cpu_public, start);
+	trace_event(JAILHOUSE_TRACE_VMEXIT, vmcb->exitcode, 0);
 	cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
 	/*
 	 * All guest state is marked unmodified; individual handlers must clear
-	 * the bits as needed.
+	 * the bits as needed. RIP, RSP, RFLAGS, RAX, the interrupt shadow,
+	 * event injection and TLB control are never cached by the CPU and
+	 * can be written without touching the clean bits.
 	 */
 	vmcb->clean_bits = 0xffffffff;
 
+	/* MMIO exits commit posted writes as needed when dispatching */
+	if (vmcb->exitcode != VMEXIT_NPF)
+		mmio_flush_posted_writes();
+
 	switch (vmcb->exitcode) {
 	case VMEXIT_INVALID:
 		panic_printk("FATAL: VM-Entry failure, error %lld\n",
 			     vmcb->exitcode);
 		break;
 	case VMEXIT_NMI:
-		cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT]++;
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT;
+		cpu_public->stats[stat]++;
+		cpu_public->stats[JAILHOUSE_CPU_STAT_IPIS_RECEIVED]++;
 		/* Temporarily enable GIF to consume pending NMI */
 		asm volatile("stgi; clgi" : : : "memory");
 		x86_check_events();
 		goto vmentry;
 	case VMEXIT_VMMCALL:
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL;
 		vcpu_handle_hypercall();
 		goto vmentry;
 	case VMEXIT_CR0_SEL_WRITE:
-		cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_CR]++;
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_CR;
+		cpu_public->stats[stat]++;
 		if (svm_handle_cr(cpu_data))
 			goto vmentry;
 		break;
 	case VMEXIT_CPUID:
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_CPUID;
 		vcpu_handle_cpuid();
 		goto vmentry;
+	case VMEXIT_HLT:
+	case VMEXIT_MWAIT:
+		vcpu_skip_emulated_instruction(vmcb->exitcode == VMEXIT_HLT ?
+					       X86_INST_LEN_HLT :
+					       X86_INST_LEN_MWAIT);
+		/* do not hold back interrupts enabled by an STI before HLT */
+		vmcb->interrupt_shadow = 0;
+		vcpu_handle_idle();
+		goto vmentry;
 	case VMEXIT_MSR:
+		if (cpu_data->guest_regs.rcx == MSR_X2APIC_BASE + APIC_REG_ICR)
+			stat = JAILHOUSE_CPU_STAT_VMEXITS_MSR_X2APIC_ICR;
+		else
+			stat = JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER;
 		if (!vmcb->exitinfo1)
 			res = vcpu_handle_msr_read();
 		else
@@ -937,24 +1136,35 @@ void vcpu_handle_exit(struct per_cpu *cpu_data)
 		     vmcb->exitinfo2 >= XAPIC_BASE &&
 		     vmcb->exitinfo2 < XAPIC_BASE + PAGE_SIZE) {
 			/* APIC access in non-AVIC mode */
-			cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_XAPIC]++;
+			stat = JAILHOUSE_CPU_STAT_VMEXITS_XAPIC;
+			cpu_public->stats[stat]++;
+			mmio_flush_posted_writes();
 			if (svm_handle_apic_access(vmcb))
 				goto vmentry;
 		} else {
 			/* General MMIO (IOAPIC, PCI etc) */
-			cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_MMIO]++;
+			stat = JAILHOUSE_CPU_STAT_VMEXITS_MMIO;
+			cpu_public->stats[stat]++;
 			if (vcpu_handle_mmio_access())
 				goto vmentry;
 		}
 		break;
 	case VMEXIT_IOIO:
-		cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_PIO]++;
-		if (vcpu_handle_io_access())
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_PIO;
+		cpu_public->stats[stat]++;
+		switch (svm_handle_pci_config_dword(vmcb)) {
+		case 1:
 			goto vmentry;
+		case 0:
+			if (vcpu_handle_io_access())
+				goto vmentry;
+			break;
+		}
 		break;
 	case VMEXIT_EXCEPTION_DB:
 	case VMEXIT_EXCEPTION_AC:
-		cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION]++;
+		stat = JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION;
+		cpu_public->stats[stat]++;
 		/* Reinject exception, including error code if needed. */
 		vmcb->eventinj = (vmcb->exitcode - VMEXIT_EXCEPTION_DE) |
 			SVM_EVENTINJ_EXCEPTION | SVM_EVENTINJ_VALID;
@@ -974,9 +1184,23 @@ void vcpu_handle_exit(struct per_cpu *cpu_data)
 	panic_park();
 
 vmentry:
+	cpu_account_exit_latency(cpu_public, stat, start);
+
+	/* root cell CPUs pass hypervisor output on and check watchdogs */
+	if (cpu_public->cell == &root_cell) {
+		uart_drain();
+		watchdog_check();
+	}
+
 	write_msr(MSR_GS_BASE, vmcb->gs.base);
 }
 
+/* There is no timer that could interrupt root cell CPUs reliably. */
+int arch_watchdog_timer_set(u64 deadline)
+{
+	return -ENOSYS;
+}
+
 void vcpu_park(void)
 {
 #ifdef CONFIG_CRASH_CELL_ON_PANIC
@@ -993,14 +1217,17 @@ void vcpu_park(void)
 	vcpu_tlb_flush();
 }
 
-void vcpu_nmi_handler(void)
+void vcpu_nmi_handler(const unsigned long *frame)
 {
+	this_cpu_data()->check_iommu_faults = true;
 }
 
 void vcpu_tlb_flush(void)
 {
 	struct vmcb *vmcb = &this_cpu_data()->vmcb;
 
+	x86_mmio_decode_cache_flush();
+
 	if (has_flush_by_asid)
 		vmcb->tlb_control = SVM_TLB_FLUSH_GUEST;
 	else
@@ -1013,19 +1240,23 @@ const u8 *vcpu_get_inst_bytes(const struct guest_paging_structures *pg_structs,
 	struct vmcb *vmcb = &this_cpu_data()->vmcb;
 	unsigned long start;
 
-	if (has_assists) {
+	/*
+	 * On nested page faults, decode assists provide the bytes fetched
+	 * from the faulting instruction, sparing the guest page walk. The
+	 * fetch can come up short, e.g. across an unmapped page boundary,
+	 * so continue with the guest mapping where the bytes end.
+	 */
+	if (has_assists && vmcb->exitcode == VMEXIT_NPF) {
 		if (!*size)
 			return NULL;
-		start = vmcb->rip - pc;
+		start = pc - vmcb->rip;
 		if (start < vmcb->bytes_fetched) {
-			*size = vmcb->bytes_fetched - start;
+			if (*size > vmcb->bytes_fetched - start)
+				*size = vmcb->bytes_fetched - start;
 			return &vmcb->guest_bytes[start];
-		} else {
-			return NULL;
 		}
-	} else {
-		return vcpu_map_inst(pg_structs, pc, size);
 	}
+	return vcpu_map_inst(pg_structs, pc, size);
 }
 
 void vcpu_vendor_get_cell_io_bitmap(struct cell *cell,
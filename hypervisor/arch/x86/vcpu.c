@@ -33,7 +33,49 @@ static u8 __attribute__((aligned(PAGE_SIZE))) parking_code[PAGE_SIZE] = {
 	0xfc  /*    jmp 1b */
 };
 
-int vcpu_early_init(void)
+static bool hwp_enabled(void)
+{
+	return (cpuid_eax(0x06, 0) & X86_FEATURE_HWP) &&
+		(read_msr(MSR_IA32_PM_ENABLE) & PM_ENABLE_HWP);
+}
+
+/* only defined request bits may be written, others raise #GP */
+static unsigned long pstate_request_mask(unsigned int msr)
+{
+	u32 hwp_features = cpuid_eax(0x06, 0);
+	unsigned long mask;
+
+	if (msr == MSR_IA32_PERF_CTL)
+		return PERF_CTL_TARGET_MASK | PERF_CTL_TURBO_DISENGAGE;
+
+	mask = HWP_REQ_PERF_MASK;
+	if (hwp_features & X86_FEATURE_HWP_EPP)
+		mask |= HWP_REQ_EPP_MASK;
+	if (hwp_features & X86_FEATURE_HWP_ACT_WINDOW)
+		mask |= HWP_REQ_ACT_WINDOW_MASK;
+	return mask;
+}
+
+static void vcpu_set_frequency_policy(void)
+{
+	unsigned long perf;
+
+	if (!(this_cell()->config->flags & JAILHOUSE_CELL_FIXED_FREQUENCY))
+		return;
+
+	if (hwp_enabled()) {
+		/* minimum = maximum = guaranteed, leaves out turbo as well */
+		perf = HWP_CAP_GUARANTEED(read_msr(MSR_IA32_HWP_CAPABILITIES));
+		write_msr(MSR_IA32_HWP_REQUEST,
+			  perf | (perf << HWP_REQ_MAX_SHIFT));
+	} else {
+		perf = PLATFORM_INFO_MAX_NON_TURBO(read_msr(MSR_PLATFORM_INFO));
+		write_msr(MSR_IA32_PERF_CTL, (perf << PERF_CTL_TARGET_SHIFT) |
+			  PERF_CTL_TURBO_DISENGAGE);
+	}
+}
+
+int __init vcpu_early_init(void)
 {
 	int err;
 
@@ -76,6 +118,54 @@ out_err:
 	return NULL;
 }
 
+/*
+ * Leaves that neither depend on the index nor differ between CPUs, apart from
+ * the initial APIC ID that is patched in on each exit.
+ */
+static const u32 cached_cpuid_functions[X86_CPUID_CACHE_SIZE] = {
+	0x00000000, 0x00000001, 0x80000000, 0x80000001, 0x80000007, 0x80000008,
+};
+
+static void cell_cpuid(struct cell *cell, u32 function, u32 index, u32 *regs)
+{
+	const struct jailhouse_cpuid_leaf *leaf =
+		jailhouse_cell_cpuid_leaves(cell->config);
+	unsigned int n;
+
+	regs[0] = function;
+	regs[1] = 0;
+	regs[2] = index;
+	regs[3] = 0;
+	cpuid(&regs[0], &regs[1], &regs[2], &regs[3]);
+
+	if (cell != &root_cell) {
+		if (function == 0x01) {
+			regs[2] &= ~X86_FEATURE_VMX;
+			regs[2] |= X86_FEATURE_HYPERVISOR;
+		} else if (function == 0x80000001) {
+			regs[2] &= ~X86_FEATURE_SVM;
+		}
+	}
+
+	for (n = 0; n < cell->config->num_cpuid_leaves; n++, leaf++) {
+		if (leaf->function != function ||
+		    (leaf->flags & JAILHOUSE_CPUID_INDEXED &&
+		     leaf->index != index))
+			continue;
+		if (leaf->flags & JAILHOUSE_CPUID_CLEAR) {
+			regs[0] &= ~leaf->eax;
+			regs[1] &= ~leaf->ebx;
+			regs[2] &= ~leaf->ecx;
+			regs[3] &= ~leaf->edx;
+		} else {
+			regs[0] = leaf->eax;
+			regs[1] = leaf->ebx;
+			regs[2] = leaf->ecx;
+			regs[3] = leaf->edx;
+		}
+	}
+}
+
 int vcpu_cell_init(struct cell *cell)
 {
 	const u8 *pio_bitmap = jailhouse_cell_pio_bitmap(cell->config);
@@ -86,6 +176,25 @@ int vcpu_cell_init(struct cell *cell)
 	int err;
 	u8 *b;
 
+	/* trapped idle requires MWAIT that wakes up on masked interrupts */
+	if (CELL_FLAGS_IDLE_POLICY(cell->config->flags) ==
+	    JAILHOUSE_CELL_IDLE_TRAPPED &&
+	    (!(cpuid_ecx(0x01, 0) & X86_FEATURE_MWAIT) ||
+	     (cpuid_ecx(0x05, 0) &
+	      (X86_FEATURE_MWAIT_EXT | X86_FEATURE_MWAIT_IRQ_BREAK)) !=
+	     (X86_FEATURE_MWAIT_EXT | X86_FEATURE_MWAIT_IRQ_BREAK)))
+		return trace_error(-EINVAL);
+
+	if (cell->config->flags & JAILHOUSE_CELL_FIXED_FREQUENCY &&
+	    !(cpuid_ecx(0x01, 0) & X86_FEATURE_EIST))
+		return trace_error(-EINVAL);
+
+	for (n = 0; n < X86_CPUID_CACHE_SIZE; n++) {
+		cell->arch.cpuid_cache[n].function = cached_cpuid_functions[n];
+		cell_cpuid(cell, cached_cpuid_functions[n], 0,
+			   cell->arch.cpuid_cache[n].regs);
+	}
+
 	err = vcpu_vendor_cell_init(cell);
 	if (err)
 		return err;
@@ -194,7 +303,7 @@ void vcpu_handle_hypercall(void)
 	}
 }
 
-bool vcpu_handle_io_access(void)
+bool __hot vcpu_handle_io_access(void)
 {
 	struct vcpu_io_intercept io;
 	int result = 0;
@@ -223,7 +332,131 @@ invalid_access:
 	return false;
 }
 
-bool vcpu_handle_mmio_access(void)
+/*
+ * Number of string elements starting at addr that are within its page, 0 if
+ * the first one crosses the page boundary.
+ */
+static unsigned int string_page_elements(unsigned long addr,
+					 unsigned int size, bool backward)
+{
+	unsigned long offs = addr & PAGE_OFFS_MASK;
+
+	if (offs + size > PAGE_SIZE)
+		return 0;
+	return backward ? offs / size + 1 : (PAGE_SIZE - offs) / size;
+}
+
+static void string_reg_advance(unsigned long *reg, long delta,
+			       unsigned int address_size)
+{
+	unsigned long val = *reg + delta;
+
+	/* 32-bit results are zero-extended, 16-bit ones merged */
+	if (address_size == 8)
+		*reg = val;
+	else if (address_size == 4)
+		*reg = (u32)val;
+	else
+		*reg = (*reg & ~0xffffUL) | (val & 0xffff);
+}
+
+/*
+ * Emulates up to MMIO_STRING_BATCH iterations of a movs or stos instruction
+ * that accesses MMIO, each checked by mmio_handle_access(). The iterations
+ * are limited to the page of the intercepted access and, for movs, to the
+ * page of the other operand which has to be guest RAM. Segment bases are
+ * assumed to be 0, i.e. a flat address space.
+ */
+static enum mmio_result
+handle_string_access(const struct guest_paging_structures *pg_structs,
+		     const struct mmio_instruction *inst,
+		     const struct vcpu_mmio_intercept *intercept)
+{
+	union registers *guest_regs = &this_cpu_data()->guest_regs;
+	unsigned long addr_mask = BYTE_MASK(inst->address_size);
+	bool backward = vcpu_vendor_get_rflags() & X86_RFLAGS_DF;
+	bool movs = inst->string_op == MMIO_STRING_MOVS;
+	unsigned int size = inst->access_size;
+	long step = backward ? -(long)size : (long)size;
+	struct mmio_access mmio = {
+		.address = intercept->phys_addr,
+		.size = size,
+		.is_write = intercept->is_write,
+	};
+	unsigned long values[MMIO_STRING_BATCH];
+	unsigned long count, ram_addr = 0;
+	enum mmio_result result;
+	unsigned int n, batch;
+	u8 *ram;
+
+	count = inst->rep ? guest_regs->rcx & addr_mask : 1;
+	batch = MIN(count, MMIO_STRING_BATCH);
+	batch = MIN(batch,
+		    MAX(string_page_elements(mmio.address, size, backward), 1));
+
+	if (movs) {
+		ram_addr = (mmio.is_write ? guest_regs->rsi : guest_regs->rdi) &
+			addr_mask;
+		n = string_page_elements(ram_addr, size, backward);
+		if (n == 0)
+			return MMIO_ERROR;
+		batch = MIN(batch, n);
+	}
+
+	/*
+	 * Guest RAM is accessed via a temporary mapping which MMIO handlers
+	 * may reuse, so stage the data of the batch in between.
+	 */
+	if (movs && mmio.is_write) {
+		ram = paging_get_guest_pages(pg_structs, ram_addr & PAGE_MASK,
+					     1, PAGE_READONLY_FLAGS);
+		if (!ram)
+			return MMIO_ERROR;
+		ram += ram_addr & PAGE_OFFS_MASK;
+		for (n = 0; n < batch; n++) {
+			values[n] = 0;
+			memcpy(&values[n], ram + n * step, size);
+		}
+	}
+
+	for (n = 0; n < batch; n++) {
+		if (mmio.is_write)
+			mmio.value = movs ? values[n] : guest_regs->rax;
+		result = mmio_handle_access(&mmio);
+		if (result != MMIO_HANDLED)
+			return result;
+		values[n] = mmio.value;
+		mmio.address += step;
+	}
+
+	if (movs && !mmio.is_write) {
+		ram = paging_get_guest_pages(pg_structs, ram_addr & PAGE_MASK,
+					     1, PAGE_DEFAULT_FLAGS);
+		if (!ram)
+			return MMIO_ERROR;
+		ram += ram_addr & PAGE_OFFS_MASK;
+		for (n = 0; n < batch; n++)
+			memcpy(ram + n * step, &values[n], size);
+	}
+
+	if (movs)
+		string_reg_advance(&guest_regs->rsi, batch * step,
+				   inst->address_size);
+	string_reg_advance(&guest_regs->rdi, batch * step, inst->address_size);
+
+	/* let the guest re-execute the instruction for the remaining count */
+	if (inst->rep) {
+		string_reg_advance(&guest_regs->rcx, -(long)batch,
+				   inst->address_size);
+		if (batch < count)
+			return MMIO_HANDLED;
+	}
+	vcpu_skip_emulated_instruction(inst->inst_len);
+
+	return MMIO_HANDLED;
+}
+
+bool __hot vcpu_handle_mmio_access(void)
 {
 	union registers *guest_regs = &this_cpu_data()->guest_regs;
 	enum mmio_result result = MMIO_UNHANDLED;
@@ -234,12 +467,24 @@ bool vcpu_handle_mmio_access(void)
 
 	vcpu_vendor_get_mmio_intercept(&intercept);
 
+	/* first access to lazily mapped RAM, let the guest retry */
+	if (cell_map_lazy(intercept.phys_addr))
+		return true;
+
 	vcpu_get_guest_paging_structs(&pg_structs);
 
 	inst = x86_mmio_parse(&pg_structs, intercept.is_write);
 	if (!inst.inst_len)
 		goto invalid_access;
 
+	if (inst.string_op) {
+		mmio.size = inst.access_size;
+		result = handle_string_access(&pg_structs, &inst, &intercept);
+		if (result == MMIO_HANDLED)
+			return true;
+		goto invalid_access;
+	}
+
 	mmio.is_write = intercept.is_write;
 	if (mmio.is_write)
 		mmio.value = inst.out_val;
@@ -265,7 +510,7 @@ invalid_access:
 	return false;
 }
 
-bool vcpu_handle_msr_read(void)
+bool __hot vcpu_handle_msr_read(void)
 {
 	struct per_cpu *cpu_data = this_cpu_data();
 
@@ -292,7 +537,7 @@ bool vcpu_handle_msr_read(void)
 	return true;
 }
 
-bool vcpu_handle_msr_write(void)
+bool __hot vcpu_handle_msr_write(void)
 {
 	struct per_cpu *cpu_data = this_cpu_data();
 	unsigned int bit_pos, pa;
@@ -332,6 +577,16 @@ bool vcpu_handle_msr_write(void)
 		vcpu_vendor_set_guest_pat((val & MTRR_ENABLE) ?
 					  cpu_data->pat : 0);
 		break;
+	case MSR_IA32_PERF_CTL:
+	case MSR_IA32_HWP_REQUEST:
+		cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER]++;
+		/* the hypervisor owns the P-state of fixed-frequency cells */
+		if (this_cell()->config->flags & JAILHOUSE_CELL_FIXED_FREQUENCY)
+			break;
+		write_msr(cpu_data->guest_regs.rcx,
+			  get_wrmsr_value(&cpu_data->guest_regs) &
+			  pstate_request_mask(cpu_data->guest_regs.rcx));
+		break;
 	default:
 		panic_printk("FATAL: Unhandled MSR write: %lx\n",
 			     cpu_data->guest_regs.rcx);
@@ -346,7 +601,10 @@ void vcpu_handle_cpuid(void)
 {
 	static const char signature[12] = "Jailhouse";
 	union registers *guest_regs = &this_cpu_data()->guest_regs;
+	struct cpuid_cache_entry *entry = this_cell()->arch.cpuid_cache;
 	u32 function = guest_regs->rax;
+	u32 regs[4];
+	unsigned int n;
 
 	this_cpu_data()->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_CPUID]++;
 
@@ -364,33 +622,55 @@ void vcpu_handle_cpuid(void)
 		guest_regs->rdx = 0;
 		break;
 	default:
-		/* clear upper 32 bits of the involved registers */
-		guest_regs->rax &= 0xffffffff;
-		guest_regs->rbx &= 0xffffffff;
-		guest_regs->rcx &= 0xffffffff;
-		guest_regs->rdx &= 0xffffffff;
-
-		cpuid((u32 *)&guest_regs->rax, (u32 *)&guest_regs->rbx,
-		      (u32 *)&guest_regs->rcx, (u32 *)&guest_regs->rdx);
+		for (n = 0; n < X86_CPUID_CACHE_SIZE; n++, entry++)
+			if (entry->function == function)
+				break;
+		if (n < X86_CPUID_CACHE_SIZE)
+			memcpy(regs, entry->regs, sizeof(regs));
+		else
+			cell_cpuid(this_cell(), function, guest_regs->rcx, regs);
+
 		if (function == 0x01) {
-			if (this_cell() != &root_cell) {
-				guest_regs->rcx &= ~X86_FEATURE_VMX;
-				guest_regs->rcx |= X86_FEATURE_HYPERVISOR;
-			}
+			regs[1] &= 0x00ffffff;
+			regs[1] |= (this_cpu_public()->apic_id & 0xff) << 24;
 
-			guest_regs->rcx &= ~X86_FEATURE_OSXSAVE;
+			regs[2] &= ~X86_FEATURE_OSXSAVE;
 			if (vcpu_vendor_get_guest_cr4() & X86_CR4_OSXSAVE)
-				guest_regs->rcx |= X86_FEATURE_OSXSAVE;
-		} else if (function == 0x80000001) {
-			if (this_cell() != &root_cell)
-				guest_regs->rcx &= ~X86_FEATURE_SVM;
+				regs[2] |= X86_FEATURE_OSXSAVE;
 		}
+
+		/* also clears the upper 32 bits of the involved registers */
+		guest_regs->rax = regs[0];
+		guest_regs->rbx = regs[1];
+		guest_regs->rcx = regs[2];
+		guest_regs->rdx = regs[3];
 		break;
 	}
 
 	vcpu_skip_emulated_instruction(X86_INST_LEN_CPUID);
 }
 
+void vcpu_handle_idle(void)
+{
+	struct public_per_cpu *cpu_public = this_cpu_public();
+	u32 flags = this_cell()->config->flags;
+
+	if (CELL_FLAGS_IDLE_POLICY(flags) != JAILHOUSE_CELL_IDLE_TRAPPED)
+		return;
+
+	/*
+	 * Management requests are posted under control_lock before the NMI is
+	 * sent. Monitoring the lock closes the window between checking for
+	 * them and entering MWAIT. Interrupts for the cell end MWAIT although
+	 * they are masked in the hypervisor.
+	 */
+	monitor(&cpu_public->control_lock);
+	if (cpu_public->suspend_cpu || cpu_public->init_signaled ||
+	    cpu_public->sipi_vector >= 0 || cpu_public->flush_vcpu_caches)
+		return;
+	mwait(CELL_FLAGS_IDLE_MAX_CSTATE(flags), MWAIT_ECX_IRQ_BREAK);
+}
+
 void vcpu_reset(unsigned int sipi_vector)
 {
 	struct per_cpu *cpu_data = this_cpu_data();
@@ -399,6 +679,10 @@ void vcpu_reset(unsigned int sipi_vector)
 
 	memset(&cpu_data->guest_regs, 0, sizeof(cpu_data->guest_regs));
 
+	x86_mmio_decode_cache_flush();
+	cpu_data->pci_cfg_device = NULL;
+	vcpu_set_frequency_policy();
+
 	if (sipi_vector == APIC_BSP_PSEUDO_SIPI) {
 		cpu_data->pat = PAT_RESET_VALUE;
 		cpu_data->mtrr_def_type &= ~MTRR_ENABLE;
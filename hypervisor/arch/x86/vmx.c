@@ -19,9 +19,15 @@
 #include <jailhouse/string.h>
 #include <jailhouse/control.h>
 #include <jailhouse/hypercall.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/pmu.h>
+#include <jailhouse/trace.h>
+#include <jailhouse/uart.h>
 #include <asm/apic.h>
 #include <asm/control.h>
 #include <asm/iommu.h>
+#include <asm/pci.h>
+#include <asm/pmu.h>
 #include <asm/vcpu.h>
 #include <asm/vmx.h>
 
@@ -29,13 +35,18 @@
 #define CR4_IDX			1
 
 #define PIO_BITMAP_PAGES	2
+#define MSR_BITMAP_PAGES	1
 
 static const struct segment invalid_seg = {
 	.access_rights = 0x10000
 };
 
-/* bit cleared: direct access allowed */
-// TODO: convert to whitelist
+/*
+ * bit cleared: direct access allowed
+ *
+ * Default for cells without MSR whitelist. The intercepts set here are also
+ * enforced for cells with whitelist.
+ */
 static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
 	[ VMX_MSR_BMP_0000_READ ] = {
 		[      0/8 ...  0x26f/8 ] = 0,
@@ -59,13 +70,17 @@ static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
 	[ VMX_MSR_BMP_0000_WRITE ] = {
 		[      0/8 ...   0x17/8 ] = 0,
 		[   0x18/8 ...   0x1f/8 ] = 0x08, /* 0x01b */
-		[   0x20/8 ...  0x1ff/8 ] = 0,
+		[   0x20/8 ...  0x197/8 ] = 0,
+		[  0x198/8 ...  0x19f/8 ] = 0x02, /* 0x199 */
+		[  0x1a0/8 ...  0x1ff/8 ] = 0,
 		[  0x200/8 ...  0x277/8 ] = 0xff, /* 0x200 - 0x277 */
 		[  0x278/8 ...  0x2f7/8 ] = 0,
 		[  0x2f8/8 ...  0x2ff/8 ] = 0x80, /* 0x2ff */
 		[  0x300/8 ...  0x387/8 ] = 0,
 		[  0x388/8 ...  0x38f/8 ] = 0x80, /* 0x38f */
-		[  0x390/8 ...  0x7ff/8 ] = 0,
+		[  0x390/8 ...  0x76f/8 ] = 0,
+		[  0x770/8 ...  0x777/8 ] = 0x10, /* 0x774 */
+		[  0x778/8 ...  0x7ff/8 ] = 0,
 		[  0x808/8 ...  0x80f/8 ] = 0x89, /* 0x808, 0x80b, 0x80f */
 		[  0x810/8 ...  0x827/8 ] = 0,
 		[  0x828/8 ...  0x82f/8 ] = 0x81, /* 0x828, 0x82f */
@@ -83,6 +98,8 @@ static u8 __attribute__((aligned(PAGE_SIZE))) msr_bitmap[][0x2000/8] = {
 static u8 __attribute__((aligned(PAGE_SIZE))) apic_access_page[PAGE_SIZE];
 static struct paging ept_paging[EPT_PAGE_DIR_LEVELS];
 static u32 secondary_exec_addon;
+/* the preemption timer counts down at the TSC rate divided by 2^rate */
+static unsigned int preemption_timer_rate;
 static unsigned long cr_maybe1[2], cr_required1[2];
 
 static bool vmxon(void)
@@ -90,7 +107,7 @@ static bool vmxon(void)
 	unsigned long vmxon_addr;
 	u8 ok;
 
-	vmxon_addr = paging_hvirt2phys(&per_cpu(this_cpu_id())->vmxon_region);
+	vmxon_addr = paging_hvirt2phys(this_cpu_data()->vmxon_region);
 	asm volatile(
 		"vmxon (%1)\n\t"
 		"seta %0"
@@ -105,7 +122,7 @@ static bool vmcs_clear(void)
 	unsigned long vmcs_addr;
 	u8 ok;
 
-	vmcs_addr = paging_hvirt2phys(&per_cpu(this_cpu_id())->vmcs);
+	vmcs_addr = paging_hvirt2phys(this_cpu_data()->vmcs);
 	asm volatile(
 		"vmclear (%1)\n\t"
 		"seta %0"
@@ -120,7 +137,7 @@ static bool vmcs_load(void)
 	unsigned long vmcs_addr;
 	u8 ok;
 
-	vmcs_addr = paging_hvirt2phys(&per_cpu(this_cpu_id())->vmcs);
+	vmcs_addr = paging_hvirt2phys(this_cpu_data()->vmcs);
 	asm volatile(
 		"vmptrld (%1)\n\t"
 		"seta %0"
@@ -193,7 +210,7 @@ static int vmx_check_features(void)
 {
 	unsigned long vmx_proc_ctrl, vmx_proc_ctrl2, ept_cap;
 	unsigned long vmx_pin_ctrl, vmx_basic, maybe1, required1;
-	unsigned long vmx_entry_ctrl, vmx_exit_ctrl;
+	unsigned long vmx_entry_ctrl, vmx_exit_ctrl, vmx_misc;
 
 	if (!(cpuid_ecx(1, 0) & X86_FEATURE_VMX))
 		return trace_error(-ENODEV);
@@ -247,6 +264,15 @@ static int vmx_check_features(void)
 	if ((vmx_proc_ctrl2 & secondary_exec_addon) != secondary_exec_addon)
 		return trace_error(-EIO);
 
+	/*
+	 * Tag guest TLB entries with VPIDs if available so that they survive
+	 * VM exits and entries.
+	 */
+	if (vmx_proc_ctrl2 & SECONDARY_EXEC_ENABLE_VPID &&
+	    ept_cap & EPT_INVVPID &&
+	    ept_cap & (EPT_INVVPID_SINGLE | EPT_INVVPID_ALL))
+		secondary_exec_addon |= SECONDARY_EXEC_ENABLE_VPID;
+
 	/* require PAT and EFER save/restore */
 	vmx_entry_ctrl = read_msr(MSR_IA32_VMX_ENTRY_CTLS) >> 32;
 	vmx_exit_ctrl = read_msr(MSR_IA32_VMX_EXIT_CTLS) >> 32;
@@ -259,8 +285,10 @@ static int vmx_check_features(void)
 		return trace_error(-EIO);
 
 	/* require activity state HLT */
-	if (!(read_msr(MSR_IA32_VMX_MISC) & VMX_MISC_ACTIVITY_HLT))
+	vmx_misc = read_msr(MSR_IA32_VMX_MISC);
+	if (!(vmx_misc & VMX_MISC_ACTIVITY_HLT))
 		return trace_error(-EIO);
+	preemption_timer_rate = vmx_misc & VMX_MISC_PREEMPTION_TIMER_RATE;
 
 	/*
 	 * Retrieve/validate restrictions on CR0
@@ -294,8 +322,9 @@ static void ept_set_next_pt(pt_entry_t pte, unsigned long next_pt)
 		EPT_FLAG_EXECUTE;
 }
 
-int vcpu_vendor_early_init(void)
+int __init vcpu_vendor_early_init(void)
 {
+	const u32 *msrs;
 	unsigned int n;
 	int err;
 
@@ -314,6 +343,14 @@ int vcpu_vendor_early_init(void)
 
 	parking_pt.root_paging = ept_paging;
 
+	/*
+	 * The cells own their physical APICs, so there is no virtual APIC
+	 * state that APICv could maintain. In x2APIC mode, EOI, TPR and all
+	 * other registers are accessed directly by the guest, only ICR writes
+	 * trap for IPI destination filtering. In xAPIC mode, the whole
+	 * register page has to be intercepted because it also contains the
+	 * ICR.
+	 */
 	if (using_x2apic) {
 		/* allow direct x2APIC access except for ICR writes */
 		memset(&msr_bitmap[VMX_MSR_BMP_0000_READ][MSR_X2APIC_BASE/8],
@@ -323,6 +360,12 @@ int vcpu_vendor_early_init(void)
 		msr_bitmap[VMX_MSR_BMP_0000_WRITE][MSR_X2APIC_ICR/8] = 0x01;
 	}
 
+	/* drop writes to the PMU counters the hypervisor samples */
+	pmu_init();
+	for (n = pmu_get_reserved_msrs(&msrs); n > 0; n--, msrs++)
+		msr_bitmap[VMX_MSR_BMP_0000_WRITE][*msrs / 8] |=
+			1 << (*msrs % 8);
+
 	return vcpu_cell_init(&root_cell);
 }
 
@@ -332,6 +375,66 @@ unsigned long arch_paging_gphys2phys(unsigned long gphys, unsigned long flags)
 				flags);
 }
 
+static u8 *msr_bitmap_byte(u8 *bitmap, u32 msr, bool write)
+{
+	unsigned int part;
+
+	if (msr <= 0x1fff)
+		part = write ? VMX_MSR_BMP_0000_WRITE : VMX_MSR_BMP_0000_READ;
+	else if (msr >= 0xc0000000 && msr <= 0xc0001fff)
+		part = write ? VMX_MSR_BMP_C000_WRITE : VMX_MSR_BMP_C000_READ;
+	else
+		return NULL;
+
+	return bitmap + part * sizeof(msr_bitmap[0]) + (msr & 0x1fff) / 8;
+}
+
+static int vmx_cell_init_msr_bitmap(struct cell *cell)
+{
+	const struct jailhouse_msr_range *range =
+		jailhouse_cell_msr_ranges(cell->config);
+	u8 *bitmap = cell->arch.vmx.msr_bitmap;
+	const u32 *msrs;
+	unsigned int n;
+	u32 msr, last;
+
+	if (cell->config->num_msr_ranges == 0) {
+		memcpy(bitmap, msr_bitmap, sizeof(msr_bitmap));
+		return 0;
+	}
+
+	memset(bitmap, -1, sizeof(msr_bitmap));
+
+	for (n = 0; n < cell->config->num_msr_ranges; n++, range++) {
+		last = range->start + range->size - 1;
+		/* ranges must not cross the MSR blocks the bitmap covers */
+		if (range->size == 0 || last < range->start ||
+		    !msr_bitmap_byte(bitmap, range->start, false) ||
+		    (range->start ^ last) & ~0x1fff)
+			return trace_error(-EINVAL);
+
+		for (msr = range->start; msr <= last; msr++) {
+			if (range->flags & JAILHOUSE_MSR_READ)
+				*msr_bitmap_byte(bitmap, msr, false) &=
+					~(1 << (msr % 8));
+			if (range->flags & JAILHOUSE_MSR_WRITE)
+				*msr_bitmap_byte(bitmap, msr, true) &=
+					~(1 << (msr % 8));
+		}
+	}
+
+	for (n = apic_get_local_msrs(&msrs); n > 0; n--, msrs++) {
+		*msr_bitmap_byte(bitmap, *msrs, false) &= ~(1 << (*msrs % 8));
+		*msr_bitmap_byte(bitmap, *msrs, true) &= ~(1 << (*msrs % 8));
+	}
+
+	/* keep the interceptions the hypervisor depends on */
+	for (n = 0; n < sizeof(msr_bitmap); n++)
+		bitmap[n] |= ((u8 *)msr_bitmap)[n];
+
+	return 0;
+}
+
 int vcpu_vendor_cell_init(struct cell *cell)
 {
 	int err;
@@ -341,10 +444,24 @@ int vcpu_vendor_cell_init(struct cell *cell)
 	if (!cell->arch.vmx.io_bitmap)
 		return -ENOMEM;
 
+	cell->arch.vmx.msr_bitmap = page_alloc(&mem_pool, MSR_BITMAP_PAGES);
+	if (!cell->arch.vmx.msr_bitmap) {
+		err = -ENOMEM;
+		goto err_free_io_bitmap;
+	}
+
+	err = vmx_cell_init_msr_bitmap(cell);
+	if (err)
+		goto err_free_msr_bitmap;
+
 	/* build root EPT of cell */
 	cell->arch.vmx.ept_structs.root_paging = ept_paging;
 	cell->arch.vmx.ept_structs.root_table =
 		(page_table_t)cell->arch.root_table_page;
+	cell->arch.vmx.ept_structs.pt_pool = numa_cell_pool(cell);
+	/* see cell_map_lazy */
+	cell->arch.vmx.ept_structs.no_merge =
+		!!(cell->config->flags & JAILHOUSE_CELL_LAZY_MEMORY);
 
 	/* Map the special APIC access page into the guest's physical address
 	 * space at the default address (XAPIC_BASE) */
@@ -354,10 +471,12 @@ int vcpu_vendor_cell_init(struct cell *cell)
 			    EPT_FLAG_READ | EPT_FLAG_WRITE | EPT_FLAG_WB_TYPE,
 			    PAGING_NON_COHERENT);
 	if (err)
-		goto err_free_io_bitmap;
+		goto err_free_msr_bitmap;
 
 	return 0;
 
+err_free_msr_bitmap:
+	page_free(&mem_pool, cell->arch.vmx.msr_bitmap, MSR_BITMAP_PAGES);
 err_free_io_bitmap:
 	page_free(&mem_pool, cell->arch.vmx.io_bitmap, 2);
 
@@ -368,7 +487,7 @@ int vcpu_map_memory_region(struct cell *cell,
 			   const struct jailhouse_memory *mem)
 {
 	u64 phys_start = mem->phys_start;
-	u32 flags = EPT_FLAG_WB_TYPE;
+	u32 flags = EPT_FLAG_WB_TYPE | EPT_FLAG_VTD_SNOOP;
 
 	if (mem->flags & JAILHOUSE_MEM_READ)
 		flags |= EPT_FLAG_READ;
@@ -376,8 +495,25 @@ int vcpu_map_memory_region(struct cell *cell,
 		flags |= EPT_FLAG_WRITE;
 	if (mem->flags & JAILHOUSE_MEM_EXECUTE)
 		flags |= EPT_FLAG_EXECUTE;
-	if (mem->flags & JAILHOUSE_MEM_COMM_REGION)
+	/* WB and WC are forced, UC dominates any guest PAT type anyway */
+	switch (mem->flags & JAILHOUSE_MEM_TYPE_MASK) {
+	case JAILHOUSE_MEM_TYPE_WB:
+		flags |= EPT_FLAG_IGNORE_PAT;
+		break;
+	case JAILHOUSE_MEM_TYPE_WC:
+		flags = (flags & ~EPT_FLAG_TYPE_MASK) | EPT_FLAG_WC_TYPE |
+			EPT_FLAG_IGNORE_PAT;
+		break;
+	case JAILHOUSE_MEM_TYPE_UC:
+		flags = (flags & ~EPT_FLAG_TYPE_MASK) | EPT_FLAG_UC_TYPE;
+		break;
+	}
+	if (mem->flags & JAILHOUSE_MEM_TIMEBASE) {
+		phys_start = paging_hvirt2phys(&timebase_page);
+		flags &= ~EPT_FLAG_WRITE;
+	} else if (mem->flags & JAILHOUSE_MEM_COMM_REGION) {
 		phys_start = paging_hvirt2phys(&cell->comm_page);
+	}
 
 	return paging_create(&cell->arch.vmx.ept_structs, phys_start, mem->size,
 			     mem->virt_start, flags, PAGING_NON_COHERENT);
@@ -390,10 +526,16 @@ int vcpu_unmap_memory_region(struct cell *cell,
 			      mem->size, PAGING_NON_COHERENT);
 }
 
+const struct paging_structures *arch_paging_cell_structs(struct cell *cell)
+{
+	return &cell->arch.vmx.ept_structs;
+}
+
 void vcpu_vendor_cell_exit(struct cell *cell)
 {
 	paging_destroy(&cell->arch.vmx.ept_structs, XAPIC_BASE, PAGE_SIZE,
 		       PAGING_NON_COHERENT);
+	page_free(&mem_pool, cell->arch.vmx.msr_bitmap, MSR_BITMAP_PAGES);
 	page_free(&mem_pool, cell->arch.vmx.io_bitmap, 2);
 }
 
@@ -407,6 +549,8 @@ void vcpu_tlb_flush(void)
 	u64 type;
 	u8 ok;
 
+	x86_mmio_decode_cache_flush();
+
 	descriptor.reserved = 0;
 	if (ept_cap & EPT_INVEPT_SINGLE) {
 		type = VMX_INVEPT_SINGLE;
@@ -429,6 +573,42 @@ void vcpu_tlb_flush(void)
 	}
 }
 
+/*
+ * Invalidate the guest-virtual mappings tagged with the VPID of this CPU. The
+ * CPU serves only one vCPU at a time, but a reset vCPU must not see the TLB
+ * entries of its previous incarnation, global ones in particular.
+ */
+static void vmx_invvpid(void)
+{
+	unsigned long ept_cap = read_msr(MSR_IA32_VMX_EPT_VPID_CAP);
+	struct {
+		u64 vpid;
+		u64 linear_addr;
+	} descriptor;
+	u64 type;
+	u8 ok;
+
+	if (!(secondary_exec_addon & SECONDARY_EXEC_ENABLE_VPID))
+		return;
+
+	descriptor.vpid = vmcs_read16(VIRTUAL_PROCESSOR_ID);
+	descriptor.linear_addr = 0;
+	type = (ept_cap & EPT_INVVPID_SINGLE) ?
+		VMX_INVVPID_SINGLE : VMX_INVVPID_ALL;
+	asm volatile(
+		"invvpid (%1),%2\n\t"
+		"seta %0\n\t"
+		: "=qm" (ok)
+		: "r" (&descriptor), "r" (type)
+		: "memory", "cc");
+
+	if (!ok) {
+		panic_printk("FATAL: invvpid failed, error %d\n",
+			     vmcs_read32(VM_INSTRUCTION_ERROR));
+		panic_stop();
+	}
+}
+
 static bool vmx_set_guest_cr(unsigned int cr_idx, unsigned long val)
 {
 	bool ok = true;
@@ -456,9 +636,21 @@ unsigned long vcpu_vendor_get_guest_cr4(void)
 static bool vmx_set_cell_config(void)
 {
 	struct cell *cell = this_cell();
+	u32 val, idle_exiting = CPU_BASED_HLT_EXITING | CPU_BASED_MWAIT_EXITING;
 	u8 *io_bitmap;
 	bool ok = true;
 
+	val = vmcs_read32(CPU_BASED_VM_EXEC_CONTROL);
+	if (CELL_FLAGS_IDLE_POLICY(cell->config->flags) ==
+	    JAILHOUSE_CELL_IDLE_PASSTHROUGH)
+		val &= ~idle_exiting;
+	else
+		val |= idle_exiting;
+	ok &= vmcs_write32(CPU_BASED_VM_EXEC_CONTROL, val);
+
+	ok &= vmcs_write64(MSR_BITMAP,
+			   paging_hvirt2phys(cell->arch.vmx.msr_bitmap));
+
 	io_bitmap = cell->arch.vmx.io_bitmap;
 	ok &= vmcs_write64(IO_BITMAP_A, paging_hvirt2phys(io_bitmap));
 	ok &= vmcs_write64(IO_BITMAP_B,
@@ -487,7 +679,9 @@ static bool vmx_set_guest_segment(const struct segment *seg,
 static bool vmcs_setup(void)
 {
 	struct per_cpu *cpu_data = this_cpu_data();
+	u64 host_perf_ctrl, guest_perf_ctrl;
 	struct desc_table_reg dtr;
+	bool switch_perf_ctrl;
 	unsigned long val;
 	bool ok = true;
 
@@ -569,6 +763,13 @@ static bool vmcs_setup(void)
 	ok &= vmcs_write64(VMCS_LINK_POINTER, -1UL);
 	ok &= vmcs_write32(VM_ENTRY_INTR_INFO_FIELD, 0);
 
+	/*
+	 * External interrupts are not intercepted: the physical APIC belongs
+	 * to the cell, and interrupt remapping steers device MSIs to the
+	 * cell's CPUs. They are thus delivered directly to the guest, without
+	 * a VM exit and without posted-interrupt descriptors. Only NMIs,
+	 * which the hypervisor uses for its own signaling, cause exits.
+	 */
 	val = read_msr(MSR_IA32_VMX_PINBASED_CTLS);
 	val |= PIN_BASED_NMI_EXITING;
 	ok &= vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, val);
@@ -581,7 +782,6 @@ static bool vmcs_setup(void)
 	val &= ~(CPU_BASED_CR3_LOAD_EXITING | CPU_BASED_CR3_STORE_EXITING);
 	ok &= vmcs_write32(CPU_BASED_VM_EXEC_CONTROL, val);
 
-	ok &= vmcs_write64(MSR_BITMAP, paging_hvirt2phys(msr_bitmap));
 
 	val = read_msr(MSR_IA32_VMX_PROCBASED_CTLS2);
 	val |= SECONDARY_EXEC_VIRTUALIZE_APIC_ACCESSES |
@@ -592,16 +792,31 @@ static bool vmcs_setup(void)
 	ok &= vmcs_write64(APIC_ACCESS_ADDR,
 			   paging_hvirt2phys(apic_access_page));
 
+	/* VPID 0 is reserved for the hypervisor */
+	if (secondary_exec_addon & SECONDARY_EXEC_ENABLE_VPID)
+		ok &= vmcs_write16(VIRTUAL_PROCESSOR_ID, this_cpu_id() + 1);
+
 	ok &= vmx_set_cell_config();
 
 	/* see vmx_handle_exception_nmi for the interception reason */
 	ok &= vmcs_write32(EXCEPTION_BITMAP,
 			   (1 << DB_VECTOR) | (1 << AC_VECTOR));
 
+	/* keep the PMU sampling counter running in host mode only */
+	switch_perf_ctrl = pmu_get_global_ctrl(&host_perf_ctrl,
+					       &guest_perf_ctrl);
+	if (switch_perf_ctrl) {
+		ok &= vmcs_write64(HOST_IA32_PERF_GLOBAL_CTRL, host_perf_ctrl);
+		ok &= vmcs_write64(GUEST_IA32_PERF_GLOBAL_CTRL,
+				   guest_perf_ctrl);
+	}
+
 	val = read_msr(MSR_IA32_VMX_EXIT_CTLS);
 	val |= VM_EXIT_HOST_ADDR_SPACE_SIZE |
 		VM_EXIT_SAVE_IA32_PAT | VM_EXIT_LOAD_IA32_PAT |
 		VM_EXIT_SAVE_IA32_EFER | VM_EXIT_LOAD_IA32_EFER;
+	if (switch_perf_ctrl)
+		val |= VM_EXIT_LOAD_IA32_PERF_GLOBAL_CTRL;
 	ok &= vmcs_write32(VM_EXIT_CONTROLS, val);
 
 	ok &= vmcs_write32(VM_EXIT_MSR_STORE_COUNT, 0);
@@ -611,6 +826,8 @@ static bool vmcs_setup(void)
 	val = read_msr(MSR_IA32_VMX_ENTRY_CTLS);
 	val |= VM_ENTRY_IA32E_MODE | VM_ENTRY_LOAD_IA32_PAT |
 		VM_ENTRY_LOAD_IA32_EFER;
+	if (switch_perf_ctrl)
+		val |= VM_ENTRY_LOAD_IA32_PERF_GLOBAL_CTRL;
 	ok &= vmcs_write32(VM_ENTRY_CONTROLS, val);
 
 	ok &= vmcs_write64(CR4_GUEST_HOST_MASK, 0);
@@ -622,13 +839,15 @@ static bool vmcs_setup(void)
 
 int vcpu_init(struct per_cpu *cpu_data)
 {
+	struct page_pool *pool = numa_local_pool(cpu_data->public.cpu_id);
 	unsigned long feature_ctrl, mask;
 	u32 revision_id;
 	int err;
 
-	/* make sure all perf counters are off */
+	/* make sure all perf counters are off, except for our own ones */
 	if ((cpuid_eax(0x0a, 0) & 0xff) > 0)
 		write_msr(MSR_IA32_PERF_GLOBAL_CTRL, 0);
+	pmu_cpu_init();
 
 	if (cpu_data->linux_cr4 & X86_CR4_VMXE)
 		return trace_error(-EBUSY);
@@ -637,11 +856,16 @@ int vcpu_init(struct per_cpu *cpu_data)
 	if (err)
 		return err;
 
+	cpu_data->vmxon_region = page_alloc(pool, 1);
+	cpu_data->vmcs = page_alloc(pool, 1);
+	if (!cpu_data->vmxon_region || !cpu_data->vmcs)
+		return -ENOMEM;
+
 	revision_id = (u32)read_msr(MSR_IA32_VMX_BASIC);
-	cpu_data->vmxon_region.revision_id = revision_id;
-	cpu_data->vmxon_region.shadow_indicator = 0;
-	cpu_data->vmcs.revision_id = revision_id;
-	cpu_data->vmcs.shadow_indicator = 0;
+	cpu_data->vmxon_region->revision_id = revision_id;
+	cpu_data->vmxon_region->shadow_indicator = 0;
+	cpu_data->vmcs->revision_id = revision_id;
+	cpu_data->vmcs->shadow_indicator = 0;
 
 	/* Note: We assume that TXT is off */
 	feature_ctrl = read_msr(MSR_IA32_FEATURE_CONTROL);
@@ -702,6 +926,8 @@ void vcpu_exit(struct per_cpu *cpu_data)
 	 * the VMCS (a compiler barrier would be sufficient, in fact). */
 	memory_barrier();
 
+	pmu_cpu_exit();
+
 	vmcs_clear();
 	asm volatile("vmxoff" : : : "cc");
 	cpu_data->linux_cr4 &= ~X86_CR4_VMXE;
@@ -888,6 +1114,8 @@ void vcpu_vendor_reset(unsigned int sipi_vector)
 		panic_printk("FATAL: CPU reset failed\n");
 		panic_stop();
 	}
+
+	vmx_invvpid();
 }
 
 static void vmx_preemption_timer_set_enable(bool enable)
@@ -901,10 +1129,39 @@ static void vmx_preemption_timer_set_enable(bool enable)
 	vmcs_write32(PIN_BASED_VM_EXEC_CONTROL, pin_based_ctrl);
 }
 
-void vcpu_nmi_handler(void)
+void vcpu_nmi_handler(const unsigned long *frame)
 {
-	if (this_cpu_data()->vmx_state == VMCS_READY)
+	pmu_nmi_handler(frame);
+
+	this_cpu_data()->check_iommu_faults = true;
+
+	/*
+	 * Sampling NMIs may have been merged with an IPI, so enable the timer
+	 * unconditionally. Let it expire immediately, it may have been armed
+	 * for the watchdog.
+	 */
+	if (this_cpu_data()->vmx_state == VMCS_READY) {
+		vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, 0);
 		vmx_preemption_timer_set_enable(true);
+	}
+}
+
+int arch_watchdog_timer_set(u64 deadline)
+{
+	u64 now, ticks = 0;
+
+	/* a stale expiry only leads to a spurious event check */
+	if (deadline == 0)
+		return 0;
+
+	now = read_timestamp();
+	if (deadline > now)
+		ticks = MIN((deadline - now) >> preemption_timer_rate,
+			    0xffffffffULL);
+	vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, ticks);
+	vmx_preemption_timer_set_enable(true);
+
+	return 0;
 }
 
 void vcpu_park(void)
@@ -939,6 +1196,7 @@ static void vmx_handle_exception_nmi(void)
 
 	if ((intr_info & INTR_INFO_INTR_TYPE_MASK) == INTR_TYPE_NMI_INTR) {
 		cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT]++;
+		cpu_public->stats[JAILHOUSE_CPU_STAT_IPIS_RECEIVED]++;
 		asm volatile("int %0" : : "i" (NMI_VECTOR));
 	} else {
 		cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION]++;
@@ -1157,78 +1415,234 @@ void vcpu_vendor_get_mmio_intercept(struct vcpu_mmio_intercept *mmio)
 	mmio->is_write = !!(exitq & 0x2);
 }
 
-void vcpu_handle_exit(struct per_cpu *cpu_data)
+static unsigned int vmx_exit_latency_stat(struct per_cpu *cpu_data,
+					  u32 reason)
 {
-	u32 reason = vmcs_read32(VM_EXIT_REASON);
-	u32 *stats = cpu_data->public.stats;
-
-	stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
-
 	switch (reason) {
 	case EXIT_REASON_EXCEPTION_NMI:
-		vmx_handle_exception_nmi();
-		return;
+		if ((vmcs_read32(VM_EXIT_INTR_INFO) & INTR_INFO_INTR_TYPE_MASK)
+		    == INTR_TYPE_NMI_INTR)
+			return JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT;
+		return JAILHOUSE_CPU_STAT_VMEXITS_EXCEPTION;
 	case EXIT_REASON_PREEMPTION_TIMER:
-		stats[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT]++;
-		vmx_check_events();
-		return;
+		return JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT;
 	case EXIT_REASON_CPUID:
-		vcpu_handle_cpuid();
-		return;
+		return JAILHOUSE_CPU_STAT_VMEXITS_CPUID;
 	case EXIT_REASON_VMCALL:
-		vcpu_handle_hypercall();
-		return;
+		return JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL;
 	case EXIT_REASON_CR_ACCESS:
-		stats[JAILHOUSE_CPU_STAT_VMEXITS_CR]++;
-		if (vmx_handle_cr())
-			return;
-		break;
+		return JAILHOUSE_CPU_STAT_VMEXITS_CR;
 	case EXIT_REASON_MSR_READ:
-		stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER]++;
-		if (vcpu_handle_msr_read())
-			return;
-		break;
 	case EXIT_REASON_MSR_WRITE:
-		if (cpu_data->guest_regs.rcx == MSR_IA32_PERF_GLOBAL_CTRL) {
-			/* ignore writes */
-			stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER]++;
-			vcpu_skip_emulated_instruction(X86_INST_LEN_WRMSR);
-			return;
-		} else if (vcpu_handle_msr_write())
-			return;
-		break;
+		if (cpu_data->guest_regs.rcx == MSR_X2APIC_BASE + APIC_REG_ICR)
+			return JAILHOUSE_CPU_STAT_VMEXITS_MSR_X2APIC_ICR;
+		return JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER;
 	case EXIT_REASON_APIC_ACCESS:
-		stats[JAILHOUSE_CPU_STAT_VMEXITS_XAPIC]++;
-		if (vmx_handle_apic_access())
-			return;
-		break;
+		return JAILHOUSE_CPU_STAT_VMEXITS_XAPIC;
 	case EXIT_REASON_XSETBV:
-		stats[JAILHOUSE_CPU_STAT_VMEXITS_XSETBV]++;
-		if (vmx_handle_xsetbv())
-			return;
-		break;
+		return JAILHOUSE_CPU_STAT_VMEXITS_XSETBV;
 	case EXIT_REASON_IO_INSTRUCTION:
-		stats[JAILHOUSE_CPU_STAT_VMEXITS_PIO]++;
-		if (vcpu_handle_io_access())
-			return;
-		break;
+		return JAILHOUSE_CPU_STAT_VMEXITS_PIO;
 	case EXIT_REASON_EPT_VIOLATION:
-		stats[JAILHOUSE_CPU_STAT_VMEXITS_MMIO]++;
-		if (vcpu_handle_mmio_access())
-			return;
+		return JAILHOUSE_CPU_STAT_VMEXITS_MMIO;
+	default:
+		return JAILHOUSE_CPU_STAT_VMEXITS_TOTAL;
+	}
+}
+
+/*
+ * Exit handlers return true if the exit was handled and the guest can be
+ * resumed. They only read the VMCS fields they need.
+ */
+typedef bool (*vmx_exit_handler)(struct per_cpu *cpu_data);
+
+static bool vmx_exit_exception_nmi(struct per_cpu *cpu_data)
+{
+	vmx_handle_exception_nmi();
+	return true;
+}
+
+static bool vmx_exit_preemption_timer(struct per_cpu *cpu_data)
+{
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT]++;
+	vmx_check_events();
+	return true;
+}
+
+static bool vmx_exit_cpuid(struct per_cpu *cpu_data)
+{
+	vcpu_handle_cpuid();
+	return true;
+}
+
+static bool vmx_exit_vmcall(struct per_cpu *cpu_data)
+{
+	vcpu_handle_hypercall();
+	return true;
+}
+
+static bool vmx_exit_cr_access(struct per_cpu *cpu_data)
+{
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_CR]++;
+	return vmx_handle_cr();
+}
+
+static bool vmx_exit_msr_read(struct per_cpu *cpu_data)
+{
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER]++;
+	return vcpu_handle_msr_read();
+}
+
+static bool vmx_exit_msr_write(struct per_cpu *cpu_data)
+{
+	switch (cpu_data->guest_regs.rcx) {
+	case MSR_X2APIC_ICR:
+		/* fast path for IPIs, the most frequent MSR write exit */
+		if (!x2apic_handle_write())
+			return false;
+		break;
+	case MSR_IA32_PERF_GLOBAL_CTRL:
+		/* ignore writes */
+		cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER]++;
 		break;
 	default:
+		if (!pmu_is_reserved_msr(cpu_data->guest_regs.rcx))
+			return vcpu_handle_msr_write();
+		/* ignore writes to the hypervisor's counters as well */
+		cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_MSR_OTHER]++;
+		break;
+	}
+	vcpu_skip_emulated_instruction(X86_INST_LEN_WRMSR);
+	return true;
+}
+
+static bool vmx_exit_apic_access(struct per_cpu *cpu_data)
+{
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_XAPIC]++;
+	return vmx_handle_apic_access();
+}
+
+static bool vmx_exit_xsetbv(struct per_cpu *cpu_data)
+{
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_XSETBV]++;
+	return vmx_handle_xsetbv();
+}
+
+static bool vmx_exit_io_instruction(struct per_cpu *cpu_data)
+{
+	u64 exitq = vmcs_read64(EXIT_QUALIFICATION);
+	u16 port = (exitq >> 16) & 0xFFFF;
+	unsigned int size = (exitq & 0x3) + 1;
+	bool dir_in = !!(exitq & 0x8);
+	int result = 0;
+
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_PIO]++;
+
+	/*
+	 * Fast path for non-string accesses to the PCI config ports, with
+	 * aligned dword accesses skipping the generic decoding. The
+	 * instruction length is only needed on success.
+	 */
+	if (!(exitq & 0x30) &&
+	    port >= PCI_REG_ADDR_PORT && port < PCI_REG_DATA_PORT + 4) {
+		if (size == 4)
+			result = x86_pci_config_dword_handler(port, dir_in);
+		if (result == 0)
+			result = x86_pci_config_handler(port, dir_in, size);
+		if (result == 1) {
+			vcpu_skip_emulated_instruction(
+				vmcs_read32(VM_EXIT_INSTRUCTION_LEN));
+			return true;
+		} else if (result < 0) {
+			return false;
+		}
+	}
+
+	return vcpu_handle_io_access();
+}
+
+static bool vmx_exit_ept_violation(struct per_cpu *cpu_data)
+{
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_MMIO]++;
+	return vcpu_handle_mmio_access();
+}
+
+/* only intercepted if the cell does not pass through idle instructions */
+static bool vmx_exit_idle(struct per_cpu *cpu_data)
+{
+	vcpu_skip_emulated_instruction(vmcs_read32(VM_EXIT_INSTRUCTION_LEN));
+	/* do not hold back interrupts enabled by an STI right before HLT */
+	vmcs_write32(GUEST_INTERRUPTIBILITY_INFO,
+		     vmcs_read32(GUEST_INTERRUPTIBILITY_INFO) &
+		     ~GUEST_INTR_STATE_STI);
+	vcpu_handle_idle();
+	return true;
+}
+
+static const vmx_exit_handler vmx_exit_handlers[] = {
+	[EXIT_REASON_EXCEPTION_NMI]	= vmx_exit_exception_nmi,
+	[EXIT_REASON_CPUID]		= vmx_exit_cpuid,
+	[EXIT_REASON_HLT]		= vmx_exit_idle,
+	[EXIT_REASON_VMCALL]		= vmx_exit_vmcall,
+	[EXIT_REASON_CR_ACCESS]		= vmx_exit_cr_access,
+	[EXIT_REASON_IO_INSTRUCTION]	= vmx_exit_io_instruction,
+	[EXIT_REASON_MSR_READ]		= vmx_exit_msr_read,
+	[EXIT_REASON_MSR_WRITE]		= vmx_exit_msr_write,
+	[EXIT_REASON_MWAIT_INSTRUCTION]	= vmx_exit_idle,
+	[EXIT_REASON_APIC_ACCESS]	= vmx_exit_apic_access,
+	[EXIT_REASON_EPT_VIOLATION]	= vmx_exit_ept_violation,
+	[EXIT_REASON_PREEMPTION_TIMER]	= vmx_exit_preemption_timer,
+	[EXIT_REASON_XSETBV]		= vmx_exit_xsetbv,
+};
+
+static void __hot vmx_handle_exit(struct per_cpu *cpu_data, u32 reason)
+{
+	vmx_exit_handler handler = NULL;
+
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL]++;
+
+	/* MMIO exits commit posted writes as needed when dispatching */
+	if (reason != EXIT_REASON_EPT_VIOLATION)
+		mmio_flush_posted_writes();
+
+	/* failed VM entries have bit 31 set and always miss the table */
+	if (reason < ARRAY_SIZE(vmx_exit_handlers))
+		handler = vmx_exit_handlers[reason];
+
+	if (handler) {
+		if (handler(cpu_data))
+			return;
+	} else {
 		panic_printk("FATAL: %s, reason %d\n",
 			     (reason & EXIT_REASONS_FAILED_VMENTRY) ?
 			     "VM-Entry failure" : "Unhandled VM-Exit",
 			     (u16)reason);
 		dump_vm_exit_details(reason);
-		break;
 	}
 	dump_guest_regs(&cpu_data->guest_regs);
 	panic_park();
 }
 
+void __hot vcpu_handle_exit(struct per_cpu *cpu_data)
+{
+	u64 start = read_timestamp();
+	u32 reason = vmcs_read32(VM_EXIT_REASON);
+
+	cpu_record_exit_start(&cpu_data->public, start);
+	trace_event(JAILHOUSE_TRACE_VMEXIT, reason, 0);
+	pmu_sample();
+	vmx_handle_exit(cpu_data, reason);
+	cpu_account_exit_latency(&cpu_data->public,
+				 vmx_exit_latency_stat(cpu_data, reason),
+				 start);
+
+	/* root cell CPUs pass hypervisor output on and check watchdogs */
+	if (cpu_data->public.cell == &root_cell) {
+		uart_drain();
+		watchdog_check();
+	}
+}
+
 void vmx_entry_failure(void)
 {
 	panic_printk("FATAL: vmresume failed, error %d\n",
@@ -58,11 +58,15 @@ struct vtd_entry {
 # define VTD_CAP_SLLPS2M		(1UL << 34)
 # define VTD_CAP_SLLPS1G		(1UL << 35)
 # define VTD_CAP_FRO_MASK		BIT_MASK(33, 24)
+# define VTD_CAP_PSI			(1UL << 39)
 # define VTD_CAP_NFR_MASK		BIT_MASK(47, 40)
+# define VTD_CAP_MAMV_MASK		BIT_MASK(53, 48)
 #define VTD_ECAP_REG			0x10
+# define VTD_ECAP_C			(1UL << 0)
 # define VTD_ECAP_QI			(1UL << 1)
 # define VTD_ECAP_IR			(1UL << 3)
 # define VTD_ECAP_EIM			(1UL << 4)
+# define VTD_ECAP_SC			(1UL << 7)
 #define VTD_GCMD_REG			0x18
 # define VTD_GCMD_SIRTP			(1UL << 24)
 # define VTD_GCMD_IRE			(1UL << 25)
@@ -107,9 +111,11 @@ struct vtd_entry {
 #define VTD_REQ_INV_IOTLB		0x02
 # define VTD_INV_IOTLB_GLOBAL		(1UL << 4)
 # define VTD_INV_IOTLB_DOMAIN		(2UL << 4)
+# define VTD_INV_IOTLB_PAGE		(3UL << 4)
 # define VTD_INV_IOTLB_DW		(1UL << 6)
 # define VTD_INV_IOTLB_DR		(1UL << 7)
 # define VTD_INV_IOTLB_DOMAIN_SHIFT	16
+# define VTD_INV_IOTLB_AM_MASK		BIT_MASK(5, 0)
 
 #define VTD_REQ_INV_INT			0x04
 # define VTD_INV_INT_GLOBAL		(0UL << 4)
@@ -179,12 +185,17 @@ struct vtd_emulation {
 	u32 fault_event_regs[4];
 };
 
-static const struct vtd_entry inv_global_context = {
-	.lo_word = VTD_REQ_INV_CONTEXT | VTD_INV_CONTEXT_GLOBAL,
-};
-static const struct vtd_entry inv_global_iotlb = {
-	.lo_word = VTD_REQ_INV_IOTLB | VTD_INV_IOTLB_GLOBAL |
-		VTD_INV_IOTLB_DW | VTD_INV_IOTLB_DR,
+static const struct vtd_entry inv_global_flush[] = {
+	{
+		.lo_word = VTD_REQ_INV_CONTEXT | VTD_INV_CONTEXT_GLOBAL,
+	},
+	{
+		.lo_word = VTD_REQ_INV_IOTLB | VTD_INV_IOTLB_GLOBAL |
+			VTD_INV_IOTLB_DW | VTD_INV_IOTLB_DR,
+	},
+	{
+		.lo_word = VTD_REQ_INV_INT | VTD_INV_INT_GLOBAL,
+	},
 };
 static const struct vtd_entry inv_global_int = {
 	.lo_word = VTD_REQ_INV_INT | VTD_INV_INT_GLOBAL,
@@ -201,7 +212,21 @@ static void *unit_inv_queue;
 static unsigned int dmar_units;
 static unsigned int dmar_pt_levels;
 static unsigned int dmar_num_did = ~0U;
-static DEFINE_SPINLOCK(inv_queue_lock);
+static bool dmar_psi = true;
+static unsigned int dmar_psi_mamv = ~0U;
+/*
+ * If set, context entries reference the EPT hierarchy of the cell instead of
+ * separate VT-d page tables. Regions without JAILHOUSE_MEM_DMA are then
+ * reachable by the cell's own devices. Isolation between cells is unaffected.
+ */
+static bool dmar_share_ept;
+/*
+ * Root cell I/O address range whose mappings were modified since the last
+ * config commit. Empty if root_inv_start >= root_inv_end.
+ */
+static unsigned long root_inv_start = ~0UL, root_inv_end;
+/* Serializes the use of each unit's invalidation queue */
+static spinlock_t inv_queue_lock[JAILHOUSE_MAX_IOMMU_UNITS];
 static struct vtd_emulation root_cell_units[JAILHOUSE_MAX_IOMMU_UNITS];
 static bool dmar_units_initialized;
 
@@ -221,56 +246,133 @@ static unsigned int inv_queue_write(void *inv_queue, unsigned int index,
 	return (index + 1) % (PAGE_SIZE / sizeof(*entry));
 }
 
-static void vtd_submit_iq_request(void *reg_base, void *inv_queue,
-				  const struct vtd_entry *inv_request)
+/*
+ * Queues the given requests, followed by a single wait descriptor, and starts
+ * their processing by the unit. The queue stays locked until
+ * vtd_wait_iq_request() observed the completion.
+ */
+static void vtd_queue_iq_request(unsigned int unit_no, void *inv_queue,
+				 const struct vtd_entry *inv_requests,
+				 unsigned int num_requests)
 {
+	void *reg_base = dmar_reg_base + unit_no * DMAR_MMIO_SIZE;
 	struct vtd_entry inv_wait = {
 		.lo_word = VTD_REQ_INV_WAIT | VTD_INV_WAIT_SW |
 			VTD_INV_WAIT_FN | (1UL << VTD_INV_WAIT_SDATA_SHIFT),
 		.hi_word = paging_hvirt2phys(
-				&per_cpu(this_cpu_id())->vtd_iq_completed),
+			&per_cpu(this_cpu_id())->vtd_iq_completed[unit_no]),
 	};
-	unsigned int index;
+	unsigned int index, n;
 
-	this_cpu_data()->vtd_iq_completed = 0;
+	this_cpu_data()->vtd_iq_completed[unit_no] = 0;
 
-	spin_lock(&inv_queue_lock);
+	spin_lock(&inv_queue_lock[unit_no]);
 
 	index = mmio_read64_field(reg_base + VTD_IQT_REG, VTD_IQT_QT_MASK);
 
-	if (inv_request)
-		index = inv_queue_write(inv_queue, index, *inv_request);
+	for (n = 0; n < num_requests; n++)
+		index = inv_queue_write(inv_queue, index, inv_requests[n]);
 	index = inv_queue_write(inv_queue, index, inv_wait);
 
 	mmio_write64_field(reg_base + VTD_IQT_REG, VTD_IQT_QT_MASK, index);
+}
 
-	while (!this_cpu_data()->vtd_iq_completed)
+static void vtd_wait_iq_request(unsigned int unit_no)
+{
+	while (!this_cpu_data()->vtd_iq_completed[unit_no])
 		cpu_relax();
 
-	spin_unlock(&inv_queue_lock);
+	spin_unlock(&inv_queue_lock[unit_no]);
+}
+
+static void vtd_submit_iq_request(unsigned int unit_no, void *inv_queue,
+				  const struct vtd_entry *inv_requests,
+				  unsigned int num_requests)
+{
+	vtd_queue_iq_request(unit_no, inv_queue, inv_requests, num_requests);
+	vtd_wait_iq_request(unit_no);
+}
+
+/*
+ * Submits the requests to all units before waiting for the first one so that
+ * the units process them in parallel. Queue locks are always taken in
+ * ascending unit order, thus concurrent callers cannot deadlock.
+ */
+static void vtd_submit_iq_request_all(const struct vtd_entry *inv_requests,
+				      unsigned int num_requests)
+{
+	unsigned int n;
+
+	for (n = 0; n < dmar_units; n++)
+		vtd_queue_iq_request(n, unit_inv_queue + n * PAGE_SIZE,
+				     inv_requests, num_requests);
+	for (n = 0; n < dmar_units; n++)
+		vtd_wait_iq_request(n);
 }
 
 static void vtd_flush_domain_caches(unsigned int did)
 {
-	const struct vtd_entry inv_context = {
-		.lo_word = VTD_REQ_INV_CONTEXT | VTD_INV_CONTEXT_DOMAIN |
-			(did << VTD_INV_CONTEXT_DOMAIN_SHIFT),
+	const struct vtd_entry inv_requests[] = {
+		{
+			.lo_word = VTD_REQ_INV_CONTEXT |
+				VTD_INV_CONTEXT_DOMAIN |
+				(did << VTD_INV_CONTEXT_DOMAIN_SHIFT),
+		},
+		{
+			.lo_word = VTD_REQ_INV_IOTLB | VTD_INV_IOTLB_DOMAIN |
+				VTD_INV_IOTLB_DW | VTD_INV_IOTLB_DR |
+				(did << VTD_INV_IOTLB_DOMAIN_SHIFT),
+		},
 	};
-	const struct vtd_entry inv_iotlb = {
-		.lo_word = VTD_REQ_INV_IOTLB | VTD_INV_IOTLB_DOMAIN |
-			VTD_INV_IOTLB_DW | VTD_INV_IOTLB_DR |
-			(did << VTD_INV_IOTLB_DOMAIN_SHIFT),
+
+	vtd_submit_iq_request_all(inv_requests, ARRAY_SIZE(inv_requests));
+}
+
+/*
+ * Invalidates the IOTLB entries of the root cell that cover the modified
+ * range. Uses a single page-selective request if the range can be expressed
+ * by an address mask supported by all units, a domain-selective one
+ * otherwise.
+ */
+static void vtd_flush_root_iotlb_range(void)
+{
+	unsigned long start = root_inv_start, end = root_inv_end;
+	unsigned int did = root_cell.config->id;
+	struct vtd_entry inv_iotlb = {
+		.lo_word = VTD_REQ_INV_IOTLB | VTD_INV_IOTLB_DW |
+			VTD_INV_IOTLB_DR | (did << VTD_INV_IOTLB_DOMAIN_SHIFT),
 	};
-	void *inv_queue = unit_inv_queue;
-	void *reg_base = dmar_reg_base;
-	unsigned int n;
+	unsigned int am = 0;
+
+	if (start >= end)
+		return;
+
+	root_inv_start = ~0UL;
+	root_inv_end = 0;
+
+	while (am <= dmar_psi_mamv && am < BITS_PER_LONG - PAGE_SHIFT &&
+	       (start & ~((PAGE_SIZE << am) - 1)) + (PAGE_SIZE << am) < end)
+		am++;
 
-	for (n = 0; n < dmar_units; n++) {
-		vtd_submit_iq_request(reg_base, inv_queue, &inv_context);
-		vtd_submit_iq_request(reg_base, inv_queue, &inv_iotlb);
-		reg_base += DMAR_MMIO_SIZE;
-		inv_queue += PAGE_SIZE;
+	if (dmar_psi && am <= dmar_psi_mamv) {
+		inv_iotlb.lo_word |= VTD_INV_IOTLB_PAGE;
+		inv_iotlb.hi_word = (start & ~((PAGE_SIZE << am) - 1)) | am;
+	} else {
+		inv_iotlb.lo_word |= VTD_INV_IOTLB_DOMAIN;
 	}
+
+	vtd_submit_iq_request_all(&inv_iotlb, 1);
+}
+
+static void vtd_root_inv_range_add(const struct jailhouse_memory *mem)
+{
+	unsigned long end = PAGE_ALIGN(mem->virt_start + mem->size);
+	unsigned long start = mem->virt_start & PAGE_MASK;
+
+	if (start < root_inv_start)
+		root_inv_start = start;
+	if (end > root_inv_end)
+		root_inv_end = end;
 }
 
 static void vtd_update_gcmd_reg(void *reg_base, u32 mask, unsigned int set)
@@ -385,7 +487,26 @@ void iommu_check_pending_faults(void)
 		}
 }
 
-static int vtd_emulate_inv_int(unsigned int unit_no, unsigned int index)
+/*
+ * IRTE updates collected while emulating a single interrupt cache
+ * invalidation request of the root cell. Their hardware invalidation is
+ * deferred so that a global request results in a single one.
+ */
+struct vtd_irte_batch {
+	unsigned int dirty;
+	unsigned int index;
+	u16 device_id;
+	int base_index;
+};
+
+static int vtd_map_interrupt(struct cell *cell, u16 device_id,
+			     unsigned int vector,
+			     struct apic_irq_message irq_msg,
+			     struct vtd_irte_batch *batch);
+static void vtd_flush_irte_batch(struct vtd_irte_batch *batch);
+
+static int vtd_emulate_inv_int(unsigned int unit_no, unsigned int index,
+			       struct vtd_irte_batch *batch)
 {
 	struct vtd_irte_usage *irte_usage;
 	struct apic_irq_message irq_msg;
@@ -399,20 +520,23 @@ static int vtd_emulate_inv_int(unsigned int unit_no, unsigned int index)
 
 	device = pci_get_assigned_device(&root_cell, irte_usage->device_id);
 	if (device && device->info->type == JAILHOUSE_PCI_TYPE_IVSHMEM)
-		return arch_ivshmem_update_msix(device);
+		return ivshmem_update_msix(device);
 
 	irq_msg = iommu_get_remapped_root_int(unit_no, irte_usage->device_id,
 					      irte_usage->vector, index);
-	return iommu_map_interrupt(&root_cell, irte_usage->device_id,
-				   irte_usage->vector, irq_msg);
+	return vtd_map_interrupt(&root_cell, irte_usage->device_id,
+				 irte_usage->vector, irq_msg, batch);
 }
 
 static int vtd_emulate_qi_request(unsigned int unit_no,
 				  struct vtd_entry inv_desc)
 {
+	struct vtd_irte_batch batch = {
+		.base_index = -ENOENT,
+	};
 	unsigned int start, count, n;
 	void *status_page;
-	int result;
+	int result = 0;
 
 	switch (inv_desc.lo_word & VTD_REQ_INV_MASK) {
 	case VTD_REQ_INV_INT:
@@ -427,11 +551,12 @@ static int vtd_emulate_qi_request(unsigned int unit_no,
 			count = root_cell_units[unit_no].irt_entries;
 		}
 		for (n = start; n < start + count; n++) {
-			result = vtd_emulate_inv_int(unit_no, n);
+			result = vtd_emulate_inv_int(unit_no, n, &batch);
 			if (result < 0)
-				return result;
+				break;
 		}
-		return 0;
+		vtd_flush_irte_batch(&batch);
+		return result < 0 ? result : 0;
 	case VTD_REQ_INV_WAIT:
 		if (inv_desc.lo_word & VTD_INV_WAIT_IF ||
 		    !(inv_desc.lo_word & VTD_INV_WAIT_SW))
@@ -508,7 +633,8 @@ invalid_iq_entry:
 	return -1;
 }
 
-static void vtd_init_unit(void *reg_base, void *inv_queue)
+static void vtd_init_unit(unsigned int unit_no, void *reg_base,
+			  void *inv_queue)
 {
 	void *fault_reg_base;
 	unsigned int nfr, n;
@@ -546,24 +672,36 @@ static void vtd_init_unit(void *reg_base, void *inv_queue)
 	mmio_write64(reg_base + VTD_IQA_REG, paging_hvirt2phys(inv_queue));
 	vtd_update_gcmd_reg(reg_base, VTD_GCMD_QIE, 1);
 
-	vtd_submit_iq_request(reg_base, inv_queue, &inv_global_context);
-	vtd_submit_iq_request(reg_base, inv_queue, &inv_global_iotlb);
-	vtd_submit_iq_request(reg_base, inv_queue, &inv_global_int);
+	vtd_submit_iq_request(unit_no, inv_queue, inv_global_flush,
+			      ARRAY_SIZE(inv_global_flush));
 
 	vtd_update_gcmd_reg(reg_base, VTD_GCMD_TE, 1);
 	vtd_update_gcmd_reg(reg_base, VTD_GCMD_IRE, 1);
 }
 
-static void vtd_update_irte(unsigned int index, union vtd_irte content)
+static void vtd_invalidate_irte(unsigned int index)
 {
 	const struct vtd_entry inv_int = {
 		.lo_word = VTD_REQ_INV_INT | VTD_INV_INT_INDEX |
 			((u64)index << VTD_INV_INT_IIDX_SHIFT),
 	};
+
+	vtd_submit_iq_request_all(&inv_int, 1);
+}
+
+/* Returns true if the entry was modified and needs to be invalidated. */
+static bool vtd_write_irte(unsigned int index, union vtd_irte content)
+{
 	union vtd_irte *irte = &int_remap_table[index];
-	void *inv_queue = unit_inv_queue;
-	void *reg_base = dmar_reg_base;
-	unsigned int n;
+
+	/*
+	 * Rewriting a present entry with identical content, e.g. when a
+	 * cell unmasks an MSI-X vector again, neither needs the write nor the
+	 * costly invalidation.
+	 */
+	if (content.field.p && irte->raw[0] == content.raw[0] &&
+	    irte->raw[1] == content.raw[1])
+		return false;
 
 	if (content.field.p) {
 		/*
@@ -584,11 +722,22 @@ static void vtd_update_irte(unsigned int index, union vtd_irte content)
 	}
 	arch_paging_flush_cpu_caches(irte, sizeof(*irte));
 
-	for (n = 0; n < dmar_units; n++) {
-		vtd_submit_iq_request(reg_base, inv_queue, &inv_int);
-		reg_base += DMAR_MMIO_SIZE;
-		inv_queue += PAGE_SIZE;
-	}
+	return true;
+}
+
+static void vtd_update_irte(unsigned int index, union vtd_irte content)
+{
+	if (vtd_write_irte(index, content))
+		vtd_invalidate_irte(index);
+}
+
+static void vtd_flush_irte_batch(struct vtd_irte_batch *batch)
+{
+	if (batch->dirty == 1)
+		vtd_invalidate_irte(batch->index);
+	else if (batch->dirty > 1)
+		vtd_submit_iq_request_all(&inv_global_int, 1);
+	batch->dirty = 0;
 }
 
 static int vtd_find_int_remap_region(u16 device_id)
@@ -723,10 +872,14 @@ static int vtd_cell_init(struct cell *cell)
 	if (cell->config->id >= dmar_num_did)
 		return trace_error(-ERANGE);
 
-	cell->arch.vtd.pg_structs.root_paging = vtd_paging;
-	cell->arch.vtd.pg_structs.root_table = page_alloc(&mem_pool, 1);
-	if (!cell->arch.vtd.pg_structs.root_table)
-		return -ENOMEM;
+	if (dmar_share_ept) {
+		cell->arch.vtd.pg_structs = *arch_paging_cell_structs(cell);
+	} else {
+		cell->arch.vtd.pg_structs.root_paging = vtd_paging;
+		cell->arch.vtd.pg_structs.root_table = page_alloc(&mem_pool, 1);
+		if (!cell->arch.vtd.pg_structs.root_table)
+			return -ENOMEM;
+	}
 
 	/* reserve regions for IRQ chips (if not done already) */
 	for (n = 0; n < cell->config->num_irqchips; n++, irqchip++) {
@@ -748,6 +901,15 @@ int iommu_map_memory_region(struct cell *cell,
 {
 	u32 flags = 0;
 
+	if (dmar_share_ept) {
+		if (mem->virt_start & BIT_MASK(63, 48))
+			return trace_error(-E2BIG);
+		/* vcpu_map_memory_region already did the actual work. */
+		if (cell == &root_cell)
+			vtd_root_inv_range_add(mem);
+		return 0;
+	}
+
 	if (!(mem->flags & JAILHOUSE_MEM_DMA))
 		return 0;
 
@@ -759,6 +921,9 @@ int iommu_map_memory_region(struct cell *cell,
 	if (mem->flags & JAILHOUSE_MEM_WRITE)
 		flags |= VTD_PAGE_WRITE;
 
+	if (cell == &root_cell)
+		vtd_root_inv_range_add(mem);
+
 	return paging_create(&cell->arch.vtd.pg_structs, mem->phys_start,
 			     mem->size, mem->virt_start, flags,
 			     PAGING_COHERENT);
@@ -767,9 +932,19 @@ int iommu_map_memory_region(struct cell *cell,
 int iommu_unmap_memory_region(struct cell *cell,
 			      const struct jailhouse_memory *mem)
 {
+	if (dmar_share_ept) {
+		/* vcpu_unmap_memory_region will do the actual work. */
+		if (cell == &root_cell)
+			vtd_root_inv_range_add(mem);
+		return 0;
+	}
+
 	if (!(mem->flags & JAILHOUSE_MEM_DMA))
 		return 0;
 
+	if (cell == &root_cell)
+		vtd_root_inv_range_add(mem);
+
 	return paging_destroy(&cell->arch.vtd.pg_structs, mem->virt_start,
 			      mem->size, PAGING_COHERENT);
 }
@@ -816,13 +991,28 @@ iommu_get_remapped_root_int(unsigned int iommu, u16 device_id,
 	return irq_msg;
 }
 
-int iommu_map_interrupt(struct cell *cell, u16 device_id, unsigned int vector,
-			struct apic_irq_message irq_msg)
+/*
+ * With a batch, the invalidation of a modified entry is left to
+ * vtd_flush_irte_batch, and the region lookup of the previous call is reused
+ * for the same device.
+ */
+static int vtd_map_interrupt(struct cell *cell, u16 device_id,
+			     unsigned int vector,
+			     struct apic_irq_message irq_msg,
+			     struct vtd_irte_batch *batch)
 {
 	union vtd_irte irte;
 	int base_index;
 
-	base_index = vtd_find_int_remap_region(device_id);
+	if (batch && batch->base_index >= 0 && batch->device_id == device_id) {
+		base_index = batch->base_index;
+	} else {
+		base_index = vtd_find_int_remap_region(device_id);
+		if (batch) {
+			batch->device_id = device_id;
+			batch->base_index = base_index;
+		}
+	}
 	if (base_index < 0)
 		return base_index;
 
@@ -870,14 +1060,48 @@ int iommu_map_interrupt(struct cell *cell, u16 device_id, unsigned int vector,
 	irte.field.svt = VTD_IRTE_SVT_VERIFY_SID_SQ;
 
 update_irte:
-	vtd_update_irte(base_index + vector, irte);
+	if (!batch) {
+		vtd_update_irte(base_index + vector, irte);
+	} else if (vtd_write_irte(base_index + vector, irte)) {
+		batch->index = base_index + vector;
+		batch->dirty++;
+	}
 
 	return base_index + vector;
 }
 
+int iommu_map_interrupt(struct cell *cell, u16 device_id, unsigned int vector,
+			struct apic_irq_message irq_msg)
+{
+	return vtd_map_interrupt(cell, device_id, vector, irq_msg, NULL);
+}
+
+union x86_msi_vector iommu_get_remapped_msi(unsigned int remap_index)
+{
+	union x86_msi_vector msi = {
+		.remap.int_index15 = remap_index >> 15,
+		.remap.shv = 1,
+		.remap.remapped = 1,
+		.remap.int_index = remap_index,
+		.remap.address = MSI_ADDRESS_VALUE,
+	};
+
+	return msi;
+}
+
+void iommu_remap_ioapic_entry(union ioapic_redir_entry *entry,
+			      unsigned int remap_index)
+{
+	entry->remap.zero = 0;
+	entry->remap.int_index15 = remap_index >> 15;
+	entry->remap.remapped = 1;
+	entry->remap.int_index = remap_index;
+}
+
 static void vtd_cell_exit(struct cell *cell)
 {
-	page_free(&mem_pool, cell->arch.vtd.pg_structs.root_table, 1);
+	if (!dmar_share_ept)
+		page_free(&mem_pool, cell->arch.vtd.pg_structs.root_table, 1);
 
 	/*
 	 * Note that reservation regions of IOAPICs won't be released because
@@ -896,15 +1120,23 @@ void iommu_config_commit(struct cell *cell_added_removed)
 
 	if (cell_added_removed == &root_cell) {
 		for (n = 0; n < dmar_units; n++) {
-			vtd_init_unit(reg_base, inv_queue);
+			vtd_init_unit(n, reg_base, inv_queue);
 			reg_base += DMAR_MMIO_SIZE;
 			inv_queue += PAGE_SIZE;
 		}
 		dmar_units_initialized = true;
-	} else {
-		if (cell_added_removed)
-			vtd_flush_domain_caches(cell_added_removed->config->id);
+	} else if (cell_added_removed) {
+		/*
+		 * Devices changed their owner, so context caches and all IOTLB
+		 * entries of both domains are affected.
+		 */
+		vtd_flush_domain_caches(cell_added_removed->config->id);
 		vtd_flush_domain_caches(root_cell.config->id);
+		root_inv_start = ~0UL;
+		root_inv_end = 0;
+	} else {
+		/* only root cell mappings were changed */
+		vtd_flush_root_iotlb_range();
 	}
 }
 
@@ -918,7 +1150,7 @@ static void vtd_restore_ir(unsigned int unit_no, void *reg_base)
 
 	mmio_write64(reg_base + VTD_IRTA_REG, unit->irta);
 	vtd_update_gcmd_reg(reg_base, VTD_GCMD_SIRTP, 1);
-	vtd_submit_iq_request(reg_base, inv_queue, &inv_global_int);
+	vtd_submit_iq_request(unit_no, inv_queue, &inv_global_int, 1);
 
 	vtd_update_gcmd_reg(reg_base, VTD_GCMD_QIE, 0);
 	mmio_write64(reg_base + VTD_IQT_REG, 0);
@@ -934,7 +1166,8 @@ static void vtd_restore_ir(unsigned int unit_no, void *reg_base)
 						PAGE_DEFAULT_FLAGS);
 	if (root_inv_queue)
 		while (mmio_read64(reg_base + VTD_IQH_REG) != iqh)
-			vtd_submit_iq_request(reg_base, root_inv_queue, NULL);
+			vtd_submit_iq_request(unit_no, root_inv_queue, NULL,
+					      0);
 	else
 		printk("WARNING: Failed to restore invalidation queue head\n");
 
@@ -960,7 +1193,7 @@ static int vtd_init_ir_emulation(unsigned int unit_no, void *reg_base)
 
 	base = system_config->platform_info.x86.iommu_units[unit_no].base;
 	mmio_region_register(&root_cell, base, PAGE_SIZE,
-			     vtd_unit_access_handler, unit);
+			     vtd_unit_access_handler, unit, "vtd");
 
 	unit->irta = mmio_read64(reg_base + VTD_IRTA_REG);
 	unit->irt_entries = 2 << (unit->irta & VTD_IRTA_SIZE_MASK);
@@ -986,10 +1219,12 @@ static int vtd_init_ir_emulation(unsigned int unit_no, void *reg_base)
 	return 0;
 }
 
-static int vtd_init(void)
+static int __init vtd_init(void)
 {
 	unsigned long version, caps, ecaps, ctrls, sllps_caps = ~0UL;
-	unsigned int units, pt_levels, num_did, n;
+	unsigned long share_caps = ~0UL, share_ecaps = ~0UL;
+	const struct paging *ept_paging;
+	unsigned int units, pt_levels, num_did, mamv, n;
 	struct jailhouse_iommu *unit;
 	void *reg_base;
 	int err;
@@ -1045,12 +1280,14 @@ static int vtd_init(void)
 		else
 			return trace_error(-EIO);
 		sllps_caps &= caps;
+		share_caps &= caps;
 
 		if (dmar_pt_levels > 0 && dmar_pt_levels != pt_levels)
 			return trace_error(-EIO);
 		dmar_pt_levels = pt_levels;
 
 		ecaps = mmio_read64(reg_base + VTD_ECAP_REG);
+		share_ecaps &= ecaps;
 		if (!(ecaps & VTD_ECAP_QI) || !(ecaps & VTD_ECAP_IR) ||
 		    (using_x2apic && !(ecaps & VTD_ECAP_EIM)))
 			return trace_error(-EIO);
@@ -1071,10 +1308,33 @@ static int vtd_init(void)
 		num_did = 1 << (4 + (caps & VTD_CAP_NUM_DID_MASK) * 2);
 		if (num_did < dmar_num_did)
 			dmar_num_did = num_did;
+
+		if (!(caps & VTD_CAP_PSI))
+			dmar_psi = false;
+		mamv = (caps & VTD_CAP_MAMV_MASK) >> 48;
+		if (mamv < dmar_psi_mamv)
+			dmar_psi_mamv = mamv;
 	}
 
 	dmar_units = units;
 
+	/*
+	 * Share the EPT hierarchy if all units can walk it: 4-level tables,
+	 * every superpage size EPT may use, coherent page walks (EPT updates
+	 * are not flushed to RAM) and snoop control (EPT leaves carry the
+	 * otherwise reserved SNP bit).
+	 */
+	ept_paging = arch_paging_cell_structs(&root_cell)->root_paging;
+	if ((share_caps & VTD_CAP_SAGAW48) &&
+	    (share_ecaps & (VTD_ECAP_C | VTD_ECAP_SC)) ==
+	     (VTD_ECAP_C | VTD_ECAP_SC) &&
+	    (!ept_paging[1].page_size || (sllps_caps & VTD_CAP_SLLPS1G)) &&
+	    (!ept_paging[2].page_size || (sllps_caps & VTD_CAP_SLLPS2M))) {
+		dmar_share_ept = true;
+		dmar_pt_levels = 4;
+		printk("Sharing EPT page tables with VT-d\n");
+	}
+
 	/*
 	 * Derive vdt_paging from very similar x86_64_paging,
 	 * replicating 0..3 for 4 levels and 1..3 for 3 levels.
@@ -1112,5 +1372,59 @@ bool iommu_cell_emulates_ir(struct cell *cell)
 	return cell->arch.vtd.ir_emulation;
 }
 
+/*
+ * Paravirtual alternative to the emulated invalidation queue: the root cell
+ * reports the entries it modified in its remapping table in one call. Like a
+ * queued invalidation request, all updates share a single flush.
+ */
+long iommu_update_root_irtes(unsigned long desc_addr, unsigned long count)
+{
+	struct vtd_irte_batch batch = {
+		.base_index = -ENOENT,
+	};
+	struct jailhouse_irte_update update;
+	unsigned long n;
+	unsigned int index;
+	void *desc_page;
+	int result = 0;
+
+	if (!root_cell.arch.vtd.ir_emulation)
+		return -ENOSYS;
+	/* entries must not cross page boundaries */
+	if (desc_addr % sizeof(update) != 0)
+		return trace_error(-EINVAL);
+
+	for (n = 0; n < count && result >= 0; n++) {
+		/*
+		 * The remapping emulation reuses the temporary mapping, so
+		 * fetch each descriptor before processing it.
+		 */
+		desc_page = paging_get_guest_pages(NULL, desc_addr, 1,
+						   PAGE_READONLY_FLAGS);
+		if (!desc_page) {
+			result = trace_error(-EINVAL);
+			break;
+		}
+		update = *(struct jailhouse_irte_update *)
+			(desc_page + (desc_addr & ~PAGE_MASK));
+		desc_addr += sizeof(update);
+
+		if (update.iommu >= dmar_units) {
+			result = trace_error(-EINVAL);
+			break;
+		}
+		for (index = update.index;
+		     index < update.index + update.count; index++) {
+			result = vtd_emulate_inv_int(update.iommu, index,
+						     &batch);
+			if (result < 0)
+				break;
+		}
+	}
+	vtd_flush_irte_batch(&batch);
+
+	return result < 0 ? result : 0;
+}
+
 DEFINE_UNIT_SHUTDOWN_STUB(vtd);
 DEFINE_UNIT(vtd, "VT-d");
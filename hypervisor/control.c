@@ -12,17 +12,26 @@
 
 #include <jailhouse/entry.h>
 #include <jailhouse/control.h>
+#include <jailhouse/gcov.h>
 #include <jailhouse/mmio.h>
 #include <jailhouse/printk.h>
 #include <jailhouse/paging.h>
+#include <jailhouse/pmu.h>
 #include <jailhouse/processor.h>
+#include <jailhouse/slab.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
+#include <jailhouse/uart.h>
 #include <jailhouse/unit.h>
 #include <jailhouse/utils.h>
 #include <asm/bitops.h>
 #include <asm/control.h>
+#include <asm/iommu.h>
 #include <asm/spinlock.h>
 
+/* Granularity of on-demand mappings, allows for huge pages on all archs. */
+#define LAZY_MAP_CHUNK_SIZE	(2 * 1024 * 1024UL)
+
 enum msg_type {MSG_REQUEST, MSG_INFORMATION};
 enum failure_mode {ABORT_ON_ERROR, WARN_ON_ERROR};
 enum management_task {CELL_START, CELL_SET_LOADABLE, CELL_DESTROY};
@@ -32,12 +41,25 @@ struct jailhouse_system *system_config;
 /** State structure of the root cell. @ingroup Control */
 struct cell root_cell;
 
+/** Cell list that is read-only accessible for the root cell. */
+struct jailhouse_status_page status_page __attribute__((aligned(PAGE_SIZE)));
+/** Timebase that is read-only accessible for cells with a timebase region. */
+union timebase_page timebase_page __attribute__((aligned(PAGE_SIZE)));
+
 static DEFINE_SPINLOCK(shutdown_lock);
+static DEFINE_SPINLOCK(status_lock);
+static DEFINE_SPINLOCK(timebase_lock);
+static DEFINE_SPINLOCK(watchdog_lock);
 static unsigned int num_cells = 1;
 
 volatile unsigned long panic_in_progress;
 unsigned long panic_cpu = -1;
 
+/* Root cell CPU that checks the cell watchdogs */
+static unsigned int watchdog_cpu;
+/* Time of the next watchdog check, 0 if no watchdog is enabled */
+static u64 watchdog_next;
+
 /**
  * CPU set iterator.
  * @param cpu		Previous CPU ID.
@@ -51,11 +73,26 @@ unsigned long panic_cpu = -1;
  */
 unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set, int exception)
 {
-	do
-		cpu++;
-	while (cpu <= cpu_set->max_cpu_id &&
-	       (cpu == exception || !test_bit(cpu, cpu_set->bitmap)));
-	return cpu;
+	unsigned int last_word = cpu_set->max_cpu_id / BITS_PER_LONG;
+	unsigned long word;
+	unsigned int n;
+
+	/* skip empty words at once, large sets are typically sparse */
+	do {
+		if (++cpu > cpu_set->max_cpu_id)
+			return cpu_set->max_cpu_id + 1;
+
+		n = cpu / BITS_PER_LONG;
+		word = cpu_set->bitmap[n] & (~0UL << (cpu % BITS_PER_LONG));
+		while (word == 0) {
+			if (++n > last_word)
+				return cpu_set->max_cpu_id + 1;
+			word = cpu_set->bitmap[n];
+		}
+		cpu = n * BITS_PER_LONG + ffsl(word);
+	} while (cpu == exception);
+
+	return cpu <= cpu_set->max_cpu_id ? cpu : cpu_set->max_cpu_id + 1;
 }
 
 /**
@@ -75,14 +112,16 @@ bool cpu_id_valid(unsigned long cpu_id)
 }
 
 /**
- * Suspend a remote CPU.
+ * Request the suspension of a remote CPU.
  * @param cpu_id	ID of the target CPU.
  *
  * Suspension means that the target CPU is no longer executing cell code or
  * arbitrary hypervisor code. It may actively busy-wait in the hypervisor
  * context, so the suspension time should be kept short.
  *
- * The function waits for the target CPU to enter suspended state.
+ * The function only signals the target CPU, use wait_for_cpu_suspension() to
+ * wait for it to enter suspended state. This allows to signal a whole set of
+ * CPUs before waiting for them, so that they can all react in parallel.
  *
  * This service can be used to synchronize with other CPUs before performing
  * management tasks.
@@ -93,7 +132,7 @@ bool cpu_id_valid(unsigned long cpu_id)
  * @see arch_reset_cpu
  * @see arch_park_cpu
  */
-static void suspend_cpu(unsigned int cpu_id)
+static void request_cpu_suspension(unsigned int cpu_id)
 {
 	struct public_per_cpu *target_data = public_per_cpu(cpu_id);
 	bool target_suspended;
@@ -105,18 +144,21 @@ static void suspend_cpu(unsigned int cpu_id)
 
 	spin_unlock(&target_data->control_lock);
 
-	if (!target_suspended) {
-		/*
-		 * Send a maintenance signal to the target CPU.
-		 * Then, wait for the target CPU to enter the suspended state.
-		 * The target CPU, in turn, will leave the guest and handle the
-		 * request in the event loop.
-		 */
-		arch_send_event(target_data);
+	/*
+	 * Queue a maintenance signal to the target CPU. The target CPU, in
+	 * turn, will leave the guest and handle the request in the event loop.
+	 * The caller sends the queued signals via arch_flush_events().
+	 */
+	if (!target_suspended)
+		arch_queue_event(target_data);
+}
 
-		while (!target_data->cpu_suspended)
-			cpu_relax();
-	}
+static void wait_for_cpu_suspension(unsigned int cpu_id)
+{
+	struct public_per_cpu *target_data = public_per_cpu(cpu_id);
+
+	while (!target_data->cpu_suspended)
+		cpu_relax();
 }
 
 void resume_cpu(unsigned int cpu_id)
@@ -131,16 +173,65 @@ void resume_cpu(unsigned int cpu_id)
 	spin_unlock(&target_data->control_lock);
 }
 
+/*
+ * Duration of the last and the longest root cell suspension for cell
+ * management, in read_timestamp() ticks.
+ */
+static u64 root_suspend_start, root_suspend_last, root_suspend_max;
+
+/*
+ * Memory transfers between non-root cells run without suspending the root
+ * cell. They exclude each other as well as cell management, which holds the
+ * exclusion while the root cell is suspended.
+ */
+static DEFINE_SPINLOCK(transfer_lock);
+static bool transfer_busy;
+
+static bool transfer_exclusion_get(bool wait)
+{
+	bool acquired;
+
+	spin_lock(&transfer_lock);
+	while (transfer_busy && wait) {
+		spin_unlock(&transfer_lock);
+		cpu_relax();
+		spin_lock(&transfer_lock);
+	}
+	acquired = !transfer_busy;
+	transfer_busy = true;
+	spin_unlock(&transfer_lock);
+
+	return acquired;
+}
+
+static void transfer_exclusion_put(void)
+{
+	spin_lock(&transfer_lock);
+	transfer_busy = false;
+	spin_unlock(&transfer_lock);
+}
+
 /*
  * Suspend all CPUs assigned to the cell except the one executing
  * the function (if it is in the cell's CPU set) to prevent races.
+ *
+ * All CPUs are signaled first and only then waited for, so the suspension of
+ * the set costs about one event round trip, independent of its size.
  */
 static void cell_suspend(struct cell *cell)
 {
 	unsigned int cpu;
 
+	if (cell == &root_cell) {
+		transfer_exclusion_get(true);
+		root_suspend_start = read_timestamp();
+	}
+
+	for_each_cpu_except(cpu, cell->cpu_set, this_cpu_id())
+		request_cpu_suspension(cpu);
+	arch_flush_events();
 	for_each_cpu_except(cpu, cell->cpu_set, this_cpu_id())
-		suspend_cpu(cpu);
+		wait_for_cpu_suspension(cpu);
 }
 
 static void cell_resume(struct cell *cell)
@@ -149,6 +240,68 @@ static void cell_resume(struct cell *cell)
 
 	for_each_cpu_except(cpu, cell->cpu_set, this_cpu_id())
 		resume_cpu(cpu);
+
+	if (cell == &root_cell) {
+		root_suspend_last = read_timestamp() - root_suspend_start;
+		if (root_suspend_last > root_suspend_max)
+			root_suspend_max = root_suspend_last;
+
+		transfer_exclusion_put();
+	}
+}
+
+enum msg_reply {MSG_REPLY_PENDING, MSG_REPLY_OK, MSG_REPLY_DENIED};
+
+static enum msg_reply cell_check_reply(struct cell *cell, enum msg_type type)
+{
+	u32 reply = cell->comm_page.comm_region.reply_from_cell;
+	u32 cell_state = cell->comm_page.comm_region.cell_state;
+
+	if (cell_state == JAILHOUSE_CELL_SHUT_DOWN ||
+	    cell_state == JAILHOUSE_CELL_FAILED)
+		return MSG_REPLY_OK;
+
+	if ((type == MSG_REQUEST &&
+	     reply == JAILHOUSE_MSG_REQUEST_APPROVED) ||
+	    (type == MSG_INFORMATION &&
+	     reply == JAILHOUSE_MSG_RECEIVED))
+		return MSG_REPLY_OK;
+
+	if (reply != JAILHOUSE_MSG_NONE)
+		return MSG_REPLY_DENIED;
+
+	return MSG_REPLY_PENDING;
+}
+
+/*
+ * Returns the initial value of the reply timeout for a new message, either a
+ * loop count or a deadline timestamp, or 0 if the cell has no timeout.
+ */
+static u64 cell_msg_timeout(struct cell *cell)
+{
+	u64 timeout = cell->config->msg_reply_timeout;
+
+	if (timeout > 0 &&
+	    cell->config->flags & JAILHOUSE_CELL_MSG_TIMEOUT_USEC)
+		timeout = read_timestamp() +
+			timeout * arch_timestamp_khz() / 1000;
+	return timeout;
+}
+
+static bool cell_msg_timeout_expired(struct cell *cell, u64 *timeout)
+{
+	if (*timeout == 0)
+		return false;
+	if (cell->config->flags & JAILHOUSE_CELL_MSG_TIMEOUT_USEC)
+		return read_timestamp() >= *timeout;
+	return --(*timeout) == 0;
+}
+
+static void cell_msg_timed_out(struct cell *cell)
+{
+	printk("Timeout expired while waiting for reply from target cell\n");
+	cell_suspend(cell);
+	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_FAILED;
 }
 
 /**
@@ -168,41 +321,24 @@ static void cell_resume(struct cell *cell)
 static bool cell_exchange_message(struct cell *cell, u32 message,
 				  enum msg_type type)
 {
-	u64 timeout = cell->config->msg_reply_timeout;
+	enum msg_reply reply;
+	u64 timeout;
 
 	if (cell->config->flags & JAILHOUSE_CELL_PASSIVE_COMMREG)
 		return true;
 
 	jailhouse_send_msg_to_cell(&cell->comm_page.comm_region, message);
+	timeout = cell_msg_timeout(cell);
 
-	while (1) {
-		u32 reply = cell->comm_page.comm_region.reply_from_cell;
-		u32 cell_state = cell->comm_page.comm_region.cell_state;
-
-		if (cell_state == JAILHOUSE_CELL_SHUT_DOWN ||
-		    cell_state == JAILHOUSE_CELL_FAILED)
-			return true;
-
-		if ((type == MSG_REQUEST &&
-		     reply == JAILHOUSE_MSG_REQUEST_APPROVED) ||
-		    (type == MSG_INFORMATION &&
-		     reply == JAILHOUSE_MSG_RECEIVED))
-			return true;
-
-		if (reply != JAILHOUSE_MSG_NONE)
-			return false;
-
-		if (cell->config->msg_reply_timeout > 0 && --timeout == 0) {
-			printk("Timeout expired while waiting for reply from "
-			       "target cell\n");
-			cell_suspend(cell);
-			cell->comm_page.comm_region.cell_state =
-				JAILHOUSE_CELL_FAILED;
+	while ((reply = cell_check_reply(cell, type)) == MSG_REPLY_PENDING) {
+		if (cell_msg_timeout_expired(cell, &timeout)) {
+			cell_msg_timed_out(cell);
 			return true;
 		}
-
 		cpu_relax();
 	}
+
+	return reply == MSG_REPLY_OK;
 }
 
 static bool cell_reconfig_ok(struct cell *excluded_cell)
@@ -226,6 +362,89 @@ static void cell_reconfig_completed(void)
 				      MSG_INFORMATION);
 }
 
+static unsigned int balloon_longs(struct cell *cell)
+{
+	return (cell->balloon_chunks + BITS_PER_LONG - 1) / BITS_PER_LONG;
+}
+
+static unsigned long balloon_size(struct cell *cell)
+{
+	return 2 * balloon_longs(cell) * sizeof(unsigned long);
+}
+
+static int balloon_cell_init(struct cell *cell)
+{
+	const unsigned long chunk_mask = JAILHOUSE_BALLOON_CHUNK_SIZE - 1;
+	const struct jailhouse_memory *mem;
+	unsigned int n;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!(mem->flags & JAILHOUSE_MEM_BALLOON))
+			continue;
+		/* the root cell already owns everything it could reclaim */
+		if (cell == &root_cell || mem->size == 0 ||
+		    (mem->phys_start | mem->virt_start | mem->size) &
+		    chunk_mask ||
+		    mem->flags & (JAILHOUSE_MEM_IO | JAILHOUSE_MEM_COMM_REGION |
+				  JAILHOUSE_MEM_ROOTSHARED |
+				  JAILHOUSE_MEM_COLORED))
+			return trace_error(-EINVAL);
+		cell->balloon_chunks += mem->size / JAILHOUSE_BALLOON_CHUNK_SIZE;
+	}
+	if (cell->balloon_chunks == 0)
+		return 0;
+
+	cell->balloon_requested = slab_alloc(balloon_size(cell));
+	if (!cell->balloon_requested)
+		return -ENOMEM;
+	cell->balloon_released = cell->balloon_requested + balloon_longs(cell);
+
+	return 0;
+}
+
+static unsigned long transfer_size(struct cell *cell)
+{
+	return (cell->transfer_chunks + BITS_PER_LONG - 1) / BITS_PER_LONG *
+		sizeof(unsigned long);
+}
+
+static int transfer_cell_init(struct cell *cell)
+{
+	const unsigned long chunk_mask = JAILHOUSE_TRANSFER_CHUNK_SIZE - 1;
+	const struct jailhouse_memory *mem;
+	unsigned int n;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!(mem->flags & JAILHOUSE_MEM_TRANSFER))
+			continue;
+		if (cell == &root_cell || mem->size == 0 ||
+		    (mem->phys_start | mem->virt_start | mem->size) &
+		    chunk_mask ||
+		    mem->flags & (JAILHOUSE_MEM_IO | JAILHOUSE_MEM_COMM_REGION |
+				  JAILHOUSE_MEM_LOADABLE |
+				  JAILHOUSE_MEM_ROOTSHARED |
+				  JAILHOUSE_MEM_COLORED |
+				  JAILHOUSE_MEM_BALLOON))
+			return trace_error(-EINVAL);
+		cell->transfer_chunks +=
+			mem->size / JAILHOUSE_TRANSFER_CHUNK_SIZE;
+	}
+	if (cell->transfer_chunks == 0)
+		return 0;
+
+	cell->transfer_owned = slab_alloc(transfer_size(cell));
+	if (!cell->transfer_owned)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* the embedded bitmap word leaves room for rounding up to whole longs */
+static unsigned long cpu_set_alloc_size(unsigned long capacity)
+{
+	return sizeof(struct cpu_set) + capacity;
+}
+
 /**
  * Initialize a new cell.
  * @param cell	Cell to be initialized.
@@ -239,26 +458,85 @@ int cell_init(struct cell *cell)
 	const unsigned long *config_cpu_set =
 		jailhouse_cell_cpu_set(cell->config);
 	unsigned long cpu_set_size = cell->config->cpu_set_size;
+	const struct jailhouse_memory *mem;
+	unsigned long capacity;
 	struct cpu_set *cpu_set;
+	unsigned int n;
 	int err;
 
-	if (cpu_set_size > PAGE_SIZE)
+	if (cpu_set_size > PAGE_SIZE ||
+	    CELL_FLAGS_IDLE_POLICY(cell->config->flags) >
+	    JAILHOUSE_CELL_IDLE_TRAPPED)
 		return trace_error(-EINVAL);
-	if (cpu_set_size > sizeof(cell->small_cpu_set.bitmap)) {
-		cpu_set = page_alloc(&mem_pool, 1);
+
+	for_each_mem_region(mem, cell->config, n)
+		if (mem->flags & JAILHOUSE_MEM_TIMEBASE &&
+		    ((mem->flags & (JAILHOUSE_MEM_COMM_REGION |
+				    JAILHOUSE_MEM_DMA)) !=
+		     JAILHOUSE_MEM_COMM_REGION ||
+		     mem->virt_start & ~PAGE_MASK || mem->size != PAGE_SIZE))
+			return trace_error(-EINVAL);
+
+	/* the communication page is shared with the hypervisor's WB mapping */
+	for_each_mem_region(mem, cell->config, n)
+		if (mem->flags & JAILHOUSE_MEM_COMM_REGION &&
+		    mem->flags & JAILHOUSE_MEM_TYPE_MASK)
+			return trace_error(-EINVAL);
+
+	for_each_mem_region(mem, cell->config, n)
+		if (mem->flags & JAILHOUSE_MEM_SHARED_IMAGE &&
+		    (cell == &root_cell || JAILHOUSE_MEMORY_IS_SUBPAGE(mem) ||
+		     (mem->flags & (JAILHOUSE_MEM_LOADABLE |
+				    JAILHOUSE_MEM_WRITE | JAILHOUSE_MEM_IO |
+				    JAILHOUSE_MEM_COMM_REGION |
+				    JAILHOUSE_MEM_ROOTSHARED |
+				    JAILHOUSE_MEM_COLORED |
+				    JAILHOUSE_MEM_BALLOON |
+				    JAILHOUSE_MEM_TRANSFER)) !=
+		     JAILHOUSE_MEM_LOADABLE))
+			return trace_error(-EINVAL);
+
+	/* elastic cells may receive any CPU of the system */
+	capacity = cpu_set_size;
+	if (cell->config->flags & JAILHOUSE_CELL_ELASTIC_CPUS &&
+	    capacity < system_config->root_cell.cpu_set_size)
+		capacity = system_config->root_cell.cpu_set_size;
+
+	if (capacity > sizeof(cell->small_cpu_set.bitmap)) {
+		cpu_set = slab_alloc(cpu_set_alloc_size(capacity));
 		if (!cpu_set)
 			return -ENOMEM;
 	} else {
 		cpu_set = &cell->small_cpu_set;
 	}
-	cpu_set->max_cpu_id = cpu_set_size * 8 - 1;
+	cpu_set->max_cpu_id = capacity * 8 - 1;
+	memset(cpu_set->bitmap, 0, capacity);
 	memcpy(cpu_set->bitmap, config_cpu_set, cpu_set_size);
 
 	cell->cpu_set = cpu_set;
 
+	err = balloon_cell_init(cell);
+	if (err)
+		goto err_free_cpu_set;
+
+	err = transfer_cell_init(cell);
+	if (err)
+		goto err_free_balloon;
+
 	err = mmio_cell_init(cell);
-	if (err && cell->cpu_set != &cell->small_cpu_set)
-		page_free(&mem_pool, cell->cpu_set, 1);
+	if (err)
+		goto err_free_transfer;
+
+	return 0;
+
+err_free_transfer:
+	slab_free(cell->transfer_owned, transfer_size(cell));
+err_free_balloon:
+	slab_free(cell->balloon_requested, balloon_size(cell));
+err_free_cpu_set:
+	if (cell->cpu_set != &cell->small_cpu_set)
+		slab_free(cell->cpu_set,
+			  cpu_set_alloc_size((cell->cpu_set->max_cpu_id + 1) / 8));
 
 	return err;
 }
@@ -267,8 +545,40 @@ static void cell_exit(struct cell *cell)
 {
 	mmio_cell_exit(cell);
 
+	slab_free(cell->balloon_requested, balloon_size(cell));
+	slab_free(cell->transfer_owned, transfer_size(cell));
+
 	if (cell->cpu_set != &cell->small_cpu_set)
-		page_free(&mem_pool, cell->cpu_set, 1);
+		slab_free(cell->cpu_set,
+			  cpu_set_alloc_size((cell->cpu_set->max_cpu_id + 1) / 8));
+}
+
+/*
+ * Guest-physical range of root cell mappings that were modified since the
+ * last config_commit(). Empty if root_flush_start >= root_flush_end.
+ */
+static unsigned long root_flush_start = ~0UL, root_flush_end;
+
+static void root_flush_range_add(unsigned long start, unsigned long size)
+{
+	unsigned long end = PAGE_ALIGN(start + size);
+
+	start &= PAGE_MASK;
+	if (start < root_flush_start)
+		root_flush_start = start;
+	if (end > root_flush_end)
+		root_flush_end = end;
+}
+
+/* Adds a range, rounded out to the largest hugepages of the root cell. */
+static void root_flush_hugepages_add(unsigned long start, unsigned long size)
+{
+	unsigned long granule =
+		paging_max_page_size(arch_paging_cell_structs(&root_cell));
+	unsigned long end = (start + size + granule - 1) & ~(granule - 1);
+
+	start &= ~(granule - 1);
+	root_flush_range_add(start, end - start);
 }
 
 /**
@@ -281,14 +591,128 @@ static void cell_exit(struct cell *cell)
  */
 void config_commit(struct cell *cell_added_removed)
 {
-	arch_flush_cell_vcpu_caches(&root_cell);
+	if (cell_added_removed == &root_cell)
+		arch_flush_cell_vcpu_caches(&root_cell, 0, FLUSH_ALL_SIZE);
+	else if (root_flush_start < root_flush_end)
+		arch_flush_cell_vcpu_caches(&root_cell, root_flush_start,
+					    root_flush_end - root_flush_start);
+	root_flush_start = ~0UL;
+	root_flush_end = 0;
+
 	if (cell_added_removed && cell_added_removed != &root_cell)
-		arch_flush_cell_vcpu_caches(cell_added_removed);
+		arch_flush_cell_vcpu_caches(cell_added_removed, 0,
+					    FLUSH_ALL_SIZE);
+
+	paging_guest_pt_cache_invalidate();
 
 	arch_config_commit(cell_added_removed);
 	pci_config_commit(cell_added_removed);
 }
 
+static void cell_status_fill(struct jailhouse_cell_status *status,
+			     struct cell *cell)
+{
+	unsigned long comm_page = paging_hvirt2phys(&cell->comm_page) -
+		system_config->hypervisor_memory.phys_start;
+	unsigned int cpu, n;
+
+	status->id = cell->config->id;
+	status->num_cpus = 0;
+	status->failed_cpus = 0;
+	for_each_cpu(cpu, cell->cpu_set) {
+		status->num_cpus++;
+		if (public_per_cpu(cpu)->failed)
+			status->failed_cpus++;
+	}
+	status->balloon_pending = 0;
+	for (n = 0; n < cell->balloon_chunks; n++)
+		if (!test_bit(n, cell->balloon_requested) !=
+		    !test_bit(n, cell->balloon_released))
+			status->balloon_pending++;
+	/* pages of donated pools are outside of the hypervisor memory */
+	if (cell != &root_cell &&
+	    comm_page < system_config->hypervisor_memory.size)
+		status->comm_page = comm_page;
+	else
+		status->comm_page = 0;
+}
+
+/**
+ * Rebuild the status page after cells were added or removed.
+ *
+ * Readers retry as long as the generation is odd or changed while they were
+ * reading.
+ */
+void status_page_update(void)
+{
+	struct cell *cell;
+	unsigned int n = 0;
+
+	spin_lock(&status_lock);
+
+	status_page.generation++;
+	memory_barrier();
+
+	for_each_cell(cell) {
+		if (n == JAILHOUSE_STATUS_MAX_CELLS)
+			break;
+		cell_status_fill(&status_page.cells[n++], cell);
+	}
+	status_page.num_cells = n;
+
+	memory_barrier();
+	status_page.generation++;
+
+	spin_unlock(&status_lock);
+}
+
+/* Refresh the entry of a cell without walking the cell list. */
+static void status_page_update_cell(struct cell *cell)
+{
+	unsigned int n;
+
+	spin_lock(&status_lock);
+
+	for (n = 0; n < status_page.num_cells; n++)
+		if (status_page.cells[n].id == cell->config->id) {
+			status_page.generation++;
+			memory_barrier();
+			cell_status_fill(&status_page.cells[n], cell);
+			memory_barrier();
+			status_page.generation++;
+			break;
+		}
+
+	spin_unlock(&status_lock);
+}
+
+/*
+ * Make the communication page of a non-root cell readable for the root cell
+ * or back it with the empty page again.
+ */
+static int root_map_comm_page(struct cell *cell, bool readable)
+{
+	struct jailhouse_memory page = {
+		.virt_start = paging_hvirt2phys(&cell->comm_page),
+		.size = PAGE_SIZE,
+		.flags = JAILHOUSE_MEM_READ,
+	};
+	int err;
+
+	if (page.virt_start - system_config->hypervisor_memory.phys_start >=
+	    system_config->hypervisor_memory.size)
+		return 0;
+
+	page.phys_start = readable ? page.virt_start :
+		paging_hvirt2phys(empty_page);
+
+	root_flush_range_add(page.virt_start, page.size);
+	err = arch_unmap_memory_region(&root_cell, &page);
+	if (err)
+		return err;
+	return arch_map_memory_region(&root_cell, &page);
+}
+
 static bool address_in_region(unsigned long addr,
 			      const struct jailhouse_memory *region)
 {
@@ -296,6 +720,126 @@ static bool address_in_region(unsigned long addr,
 	       addr < (region->phys_start + region->size);
 }
 
+static bool regions_overlap(unsigned long phys, unsigned long size,
+			    const struct jailhouse_memory *mem)
+{
+	return phys < mem->phys_start + mem->size &&
+		phys + size > mem->phys_start;
+}
+
+/*
+ * A shared image region is withheld from the root cell as long as any cell
+ * listing it is not loadable. Returns true if a cell other than except holds
+ * the region that way.
+ */
+static bool shared_image_held(const struct jailhouse_memory *mem,
+			      struct cell *except)
+{
+	const struct jailhouse_memory *other_mem;
+	struct cell *cell;
+	unsigned int n;
+
+	if (!(mem->flags & JAILHOUSE_MEM_SHARED_IMAGE))
+		return false;
+
+	for_each_non_root_cell(cell) {
+		if (cell == except || cell->loadable)
+			continue;
+		for_each_mem_region(other_mem, cell->config, n)
+			if (other_mem->flags & JAILHOUSE_MEM_SHARED_IMAGE &&
+			    other_mem->phys_start == mem->phys_start)
+				return true;
+	}
+	return false;
+}
+
+/* Cells sharing an image have to list exactly the same range. */
+static bool shared_image_conflict(const struct jailhouse_memory *mem)
+{
+	const struct jailhouse_memory *other_mem;
+	struct cell *cell;
+	unsigned int n;
+
+	for_each_non_root_cell(cell)
+		for_each_mem_region(other_mem, cell->config, n)
+			if (other_mem->flags & JAILHOUSE_MEM_SHARED_IMAGE &&
+			    regions_overlap(mem->phys_start, mem->size,
+					    other_mem) &&
+			    (other_mem->phys_start != mem->phys_start ||
+			     other_mem->size != mem->size))
+				return true;
+	return false;
+}
+
+/*
+ * Regions of JAILHOUSE_CELL_LAZY_MEMORY cells that are only mapped on first
+ * access. DMA targets stay mapped eagerly, IOMMUs cannot fault them in.
+ */
+static bool mem_region_is_lazy(struct cell *cell,
+			       const struct jailhouse_memory *mem)
+{
+	return cell->config->flags & JAILHOUSE_CELL_LAZY_MEMORY &&
+		!(mem->flags & (JAILHOUSE_MEM_DMA | JAILHOUSE_MEM_IO |
+				JAILHOUSE_MEM_COMM_REGION |
+				JAILHOUSE_MEM_ROOTSHARED |
+				JAILHOUSE_MEM_COLORED | JAILHOUSE_MEM_BALLOON |
+				JAILHOUSE_MEM_TRANSFER |
+				JAILHOUSE_MEM_SHARED_IMAGE)) &&
+		!JAILHOUSE_MEMORY_IS_SUBPAGE(mem);
+}
+
+bool cell_map_lazy(unsigned long gphys)
+{
+	struct cell *cell = this_cell();
+	const struct jailhouse_memory *mem;
+	struct jailhouse_memory chunk;
+	unsigned long start, end;
+	unsigned int n;
+	int err;
+
+	if (!(cell->config->flags & JAILHOUSE_CELL_LAZY_MEMORY))
+		return false;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (gphys < mem->virt_start ||
+		    gphys >= mem->virt_start + mem->size ||
+		    !mem_region_is_lazy(cell, mem))
+			continue;
+
+		start = gphys & ~(LAZY_MAP_CHUNK_SIZE - 1);
+		if (start < mem->virt_start)
+			start = mem->virt_start;
+		end = (gphys & ~(LAZY_MAP_CHUNK_SIZE - 1)) +
+			LAZY_MAP_CHUNK_SIZE;
+		if (end > mem->virt_start + mem->size)
+			end = mem->virt_start + mem->size;
+
+		chunk = *mem;
+		chunk.phys_start = mem->phys_start + (start - mem->virt_start);
+		chunk.virt_start = start;
+		chunk.size = end - start;
+
+		/*
+		 * Another CPU of the cell may have mapped the chunk in the
+		 * meantime. Mapping it again is harmless. The other CPUs keep
+		 * running, so the cell's paging structures are never merged
+		 * into hugepages (paging_structures::no_merge). No table they
+		 * may still walk through gets freed that way, and adding
+		 * entries does not require any TLB flush.
+		 */
+		spin_lock(&cell->lazy_map_lock);
+		err = arch_map_memory_region(cell, &chunk);
+		spin_unlock(&cell->lazy_map_lock);
+		if (err)
+			return false;
+
+		/* this exit is not dispatched via mmio_handle_access */
+		mmio_flush_posted_writes();
+		return true;
+	}
+	return false;
+}
+
 static int unmap_from_root_cell(const struct jailhouse_memory *mem)
 {
 	/*
@@ -312,6 +856,9 @@ static int unmap_from_root_cell(const struct jailhouse_memory *mem)
 		return 0;
 	}
 
+	root_flush_range_add(tmp.virt_start, tmp.size);
+	/* also covers error paths that resume without config_commit */
+	paging_guest_pt_cache_invalidate();
 	return arch_unmap_memory_region(&root_cell, &tmp);
 }
 
@@ -342,11 +889,25 @@ static int remap_to_root_cell(const struct jailhouse_memory *mem,
 		overlap.virt_start = root_mem->virt_start +
 			overlap.phys_start - root_mem->phys_start;
 		overlap.flags = root_mem->flags;
-
-		if (JAILHOUSE_MEMORY_IS_SUBPAGE(&overlap))
+		/* colored regions only hand back their own colors */
+		if (mem->flags & JAILHOUSE_MEM_COLORED)
+			overlap.flags = (overlap.flags &
+					 ~JAILHOUSE_MEM_COLORS(~0U)) |
+				(mem->flags & (JAILHOUSE_MEM_COLORED |
+					       JAILHOUSE_MEM_COLORS(~0U)));
+
+		if (JAILHOUSE_MEMORY_IS_SUBPAGE(&overlap)) {
 			err = mmio_subpage_register(&root_cell, &overlap);
-		else
+		} else {
+			/*
+			 * Mapping may replace page tables by hugepages, also
+			 * by merging with neighboring mappings, so the
+			 * surrounding hugepages need invalidation as well.
+			 */
+			root_flush_hugepages_add(overlap.virt_start,
+						 overlap.size);
 			err = arch_map_memory_region(&root_cell, &overlap);
+		}
 		if (err) {
 			if (mode == ABORT_ON_ERROR)
 				break;
@@ -357,23 +918,442 @@ static int remap_to_root_cell(const struct jailhouse_memory *mem,
 	return err;
 }
 
-static void cell_destroy_internal(struct cell *cell)
+/*
+ * Memory is scrubbed in chunks of the temporary mapping size. The CPUs that
+ * are suspended while the scrub is in progress - the cell's CPUs and those of
+ * the root cell during cell management - claim chunks from this job as well,
+ * see scrub_memory_assist.
+ */
+static DEFINE_SPINLOCK(scrub_lock);
+static struct {
+	const struct jailhouse_memory *regions;
+	unsigned int num_regions;
+	unsigned long flags;
+	/*
+	 * cell whose released balloon chunks and transfer chunks owned by
+	 * other cells are skipped, if any
+	 */
+	struct cell *cell;
+	unsigned int region;
+	unsigned long offset;
+	unsigned int balloon_index;
+	unsigned int transfer_index;
+	unsigned int helpers;
+} scrub_job;
+
+/* Must be called with scrub_lock held. */
+static bool scrub_claim_chunk(unsigned long *addr, unsigned long *size)
 {
+	const unsigned long chunk_mask = JAILHOUSE_BALLOON_CHUNK_SIZE - 1;
 	const struct jailhouse_memory *mem;
-	unsigned int cpu, n;
-	struct unit *unit;
+	unsigned long run_size;
 
-	for_each_cpu(cpu, cell->cpu_set) {
-		arch_park_cpu(cpu);
+	if (!scrub_job.regions)
+		return false;
 
-		set_bit(cpu, root_cell.cpu_set->bitmap);
-		public_per_cpu(cpu)->cell = &root_cell;
-		public_per_cpu(cpu)->failed = false;
-		memset(public_per_cpu(cpu)->stats, 0,
-		       sizeof(public_per_cpu(cpu)->stats));
+	while (scrub_job.region < scrub_job.num_regions) {
+		mem = &scrub_job.regions[scrub_job.region];
+
+		/*
+		 * Only scrub memory that the root cell will gain access to.
+		 * Shared images are read-only for the cells, they only hold
+		 * what the root cell loaded.
+		 */
+		if ((mem->flags & scrub_job.flags) == scrub_job.flags &&
+		    !(mem->flags & (JAILHOUSE_MEM_IO |
+				    JAILHOUSE_MEM_COMM_REGION |
+				    JAILHOUSE_MEM_ROOTSHARED |
+				    JAILHOUSE_MEM_SHARED_IMAGE)) &&
+		    !JAILHOUSE_MEMORY_IS_SUBPAGE(mem) &&
+		    scrub_job.offset < mem->size &&
+		    arch_mem_region_next_run(mem, &scrub_job.offset,
+					     &run_size)) {
+			if (mem->flags & JAILHOUSE_MEM_BALLOON &&
+			    scrub_job.cell &&
+			    test_bit(scrub_job.balloon_index + scrub_job.offset /
+				     JAILHOUSE_BALLOON_CHUNK_SIZE,
+				     scrub_job.cell->balloon_released)) {
+				/* the root cell already owns this chunk */
+				scrub_job.offset = (scrub_job.offset |
+						    chunk_mask) + 1;
+				continue;
+			}
+			if (mem->flags & JAILHOUSE_MEM_TRANSFER &&
+			    (!scrub_job.cell ||
+			     !test_bit(scrub_job.transfer_index +
+				       scrub_job.offset /
+				       JAILHOUSE_TRANSFER_CHUNK_SIZE,
+				       scrub_job.cell->transfer_owned))) {
+				/* another cell or the root cell owns it */
+				scrub_job.offset = (scrub_job.offset |
+					(JAILHOUSE_TRANSFER_CHUNK_SIZE - 1)) +
+					1;
+				continue;
+			}
+			*addr = mem->phys_start + scrub_job.offset;
+			*size = MIN(run_size, NUM_TEMPORARY_PAGES * PAGE_SIZE);
+			scrub_job.offset += *size;
+			return true;
+		}
+
+		if (mem->flags & JAILHOUSE_MEM_BALLOON)
+			scrub_job.balloon_index +=
+				mem->size / JAILHOUSE_BALLOON_CHUNK_SIZE;
+		if (mem->flags & JAILHOUSE_MEM_TRANSFER)
+			scrub_job.transfer_index +=
+				mem->size / JAILHOUSE_TRANSFER_CHUNK_SIZE;
+		scrub_job.region++;
+		scrub_job.offset = 0;
 	}
+	return false;
+}
 
-	for_each_mem_region(mem, cell->config, n) {
+static void scrub_chunks(void)
+{
+	unsigned long addr, size;
+
+	while (scrub_claim_chunk(&addr, &size)) {
+		spin_unlock(&scrub_lock);
+
+		/* cannot fail, mapping area is preallocated */
+		arch_scrub_memory(paging_map_temporary(addr, PAGES(size),
+						       PAGE_DEFAULT_FLAGS),
+				  size);
+
+		spin_lock(&scrub_lock);
+	}
+}
+
+/*
+ * Zero the given memory regions that carry all of the specified flags.
+ * Returns after all helpers completed their chunks.
+ */
+static void scrub_memory(const struct jailhouse_memory *regions,
+			 unsigned int num_regions, unsigned long flags,
+			 struct cell *cell)
+{
+	spin_lock(&scrub_lock);
+
+	scrub_job.num_regions = num_regions;
+	scrub_job.flags = flags;
+	scrub_job.cell = cell;
+	scrub_job.region = 0;
+	scrub_job.offset = 0;
+	scrub_job.balloon_index = 0;
+	scrub_job.transfer_index = 0;
+	scrub_job.regions = regions;
+
+	scrub_chunks();
+
+	/* no more chunks left, wait for the helpers to finish theirs */
+	scrub_job.regions = NULL;
+	spin_unlock(&scrub_lock);
+
+	while (scrub_job.helpers > 0)
+		cpu_relax();
+}
+
+/**
+ * Help with a pending memory scrub.
+ *
+ * Called by CPUs while they are waiting in suspended state.
+ */
+void scrub_memory_assist(void)
+{
+	if (!scrub_job.regions)
+		return;
+
+	spin_lock(&scrub_lock);
+	if (scrub_job.regions) {
+		scrub_job.helpers++;
+		scrub_chunks();
+		scrub_job.helpers--;
+	}
+	spin_unlock(&scrub_lock);
+}
+
+/*
+ * Scrub the memory of a cell that is about to be returned to the root cell,
+ * if the cell asks for it. The cell's CPUs must still be suspended, not
+ * parked, so that they can help.
+ */
+static void cell_scrub_memory(struct cell *cell, unsigned long flags)
+{
+	if (cell->config->flags & JAILHOUSE_CELL_SCRUB_MEMORY)
+		scrub_memory(jailhouse_cell_mem_regions(cell->config),
+			     cell->config->num_memory_regions, flags, cell);
+}
+
+static int balloon_release_chunk(struct cell *cell,
+				 const struct jailhouse_memory *chunk)
+{
+	int err;
+
+	err = arch_unmap_memory_region(cell, chunk);
+	if (err)
+		return err;
+
+	if (cell->config->flags & JAILHOUSE_CELL_SCRUB_MEMORY)
+		scrub_memory(chunk, 1, 0, NULL);
+
+	err = remap_to_root_cell(chunk, ABORT_ON_ERROR);
+	if (err) {
+		unmap_from_root_cell(chunk);
+		if (arch_map_memory_region(cell, chunk))
+			printk("WARNING: Failed to re-assign balloon chunk to "
+			       "cell\n");
+	}
+	return err;
+}
+
+static int balloon_reclaim_chunk(struct cell *cell,
+				 const struct jailhouse_memory *chunk)
+{
+	int err;
+
+	err = unmap_from_root_cell(chunk);
+	if (err)
+		return err;
+
+	err = arch_map_memory_region(cell, chunk);
+	if (err)
+		remap_to_root_cell(chunk, WARN_ON_ERROR);
+	return err;
+}
+
+/*
+ * Move the balloon chunks of a cell to the root cell or back as the cell
+ * requested. Both cells have to be suspended, the caller commits the changes.
+ * Returns the number of moved chunks or a negative error code.
+ */
+static int balloon_apply(struct cell *cell)
+{
+	const struct jailhouse_memory *mem;
+	struct jailhouse_memory chunk;
+	unsigned int n, index = 0;
+	unsigned long offs;
+	int err, moved = 0;
+	bool release;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!(mem->flags & JAILHOUSE_MEM_BALLOON))
+			continue;
+
+		for (offs = 0; offs < mem->size;
+		     offs += JAILHOUSE_BALLOON_CHUNK_SIZE, index++) {
+			release = test_bit(index, cell->balloon_requested);
+			if (release == !!test_bit(index,
+						  cell->balloon_released))
+				continue;
+
+			chunk = *mem;
+			chunk.phys_start += offs;
+			chunk.virt_start += offs;
+			chunk.size = JAILHOUSE_BALLOON_CHUNK_SIZE;
+
+			if (release) {
+				err = balloon_release_chunk(cell, &chunk);
+				if (err)
+					return err;
+				set_bit(index, cell->balloon_released);
+			} else {
+				err = balloon_reclaim_chunk(cell, &chunk);
+				if (err)
+					return err;
+				clear_bit(index, cell->balloon_released);
+			}
+			moved++;
+		}
+	}
+	return moved;
+}
+
+/* Find the balloon chunk of a cell that starts at the given guest address. */
+static bool balloon_chunk_find(struct cell *cell, unsigned long addr,
+			       unsigned int *index)
+{
+	const struct jailhouse_memory *mem;
+	unsigned int n, first = 0;
+
+	if (addr & (JAILHOUSE_BALLOON_CHUNK_SIZE - 1))
+		return false;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!(mem->flags & JAILHOUSE_MEM_BALLOON))
+			continue;
+		if (addr >= mem->virt_start &&
+		    addr - mem->virt_start < mem->size) {
+			*index = first + (addr - mem->virt_start) /
+				JAILHOUSE_BALLOON_CHUNK_SIZE;
+			return true;
+		}
+		first += mem->size / JAILHOUSE_BALLOON_CHUNK_SIZE;
+	}
+	return false;
+}
+
+/*
+ * Find the transfer chunk of a cell that starts at the given guest-physical
+ * address, or physical address if phys is set, and describe it as region.
+ */
+static bool transfer_chunk_find(struct cell *cell, unsigned long addr,
+				bool phys, unsigned int *index,
+				struct jailhouse_memory *chunk)
+{
+	const struct jailhouse_memory *mem;
+	unsigned int n, first = 0;
+	unsigned long start;
+
+	if (addr & (JAILHOUSE_TRANSFER_CHUNK_SIZE - 1))
+		return false;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!(mem->flags & JAILHOUSE_MEM_TRANSFER))
+			continue;
+		start = phys ? mem->phys_start : mem->virt_start;
+		if (addr >= start && addr - start < mem->size) {
+			*index = first + (addr - start) /
+				JAILHOUSE_TRANSFER_CHUNK_SIZE;
+			*chunk = *mem;
+			chunk->phys_start += addr - start;
+			chunk->virt_start += addr - start;
+			chunk->size = JAILHOUSE_TRANSFER_CHUNK_SIZE;
+			return true;
+		}
+		first += mem->size / JAILHOUSE_TRANSFER_CHUNK_SIZE;
+	}
+	return false;
+}
+
+/* Check if a non-root cell other than the given one owns a transfer chunk. */
+static bool transfer_chunk_owned_by_other(struct cell *cell,
+					  unsigned long phys)
+{
+	struct jailhouse_memory chunk;
+	unsigned int index;
+	struct cell *other;
+
+	for_each_non_root_cell(other)
+		if (other != cell &&
+		    transfer_chunk_find(other, phys, true, &index, &chunk) &&
+		    test_bit(index, other->transfer_owned))
+			return true;
+	return false;
+}
+
+/*
+ * Map the transfer chunks that no other cell owns into a new cell, i.e. all
+ * of them if it is the first cell of its pools.
+ */
+static int transfer_cell_claim(struct cell *cell)
+{
+	const struct jailhouse_memory *mem;
+	struct jailhouse_memory chunk;
+	unsigned int n, index = 0;
+	unsigned long offs;
+	int err;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!(mem->flags & JAILHOUSE_MEM_TRANSFER))
+			continue;
+
+		for (offs = 0; offs < mem->size;
+		     offs += JAILHOUSE_TRANSFER_CHUNK_SIZE, index++) {
+			if (transfer_chunk_owned_by_other(cell,
+							  mem->phys_start +
+							  offs))
+				continue;
+
+			chunk = *mem;
+			chunk.phys_start += offs;
+			chunk.virt_start += offs;
+			chunk.size = JAILHOUSE_TRANSFER_CHUNK_SIZE;
+
+			err = arch_map_memory_region(cell, &chunk);
+			if (err)
+				return err;
+			set_bit(index, cell->transfer_owned);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Hand the transfer chunks of a cell back to the root cell. They return to
+ * their pool when the next cell of it is created.
+ */
+static void transfer_cell_release(struct cell *cell)
+{
+	const struct jailhouse_memory *mem;
+	struct jailhouse_memory chunk;
+	unsigned int n, index = 0;
+	unsigned long offs;
+
+	for_each_mem_region(mem, cell->config, n) {
+		if (!(mem->flags & JAILHOUSE_MEM_TRANSFER))
+			continue;
+
+		for (offs = 0; offs < mem->size;
+		     offs += JAILHOUSE_TRANSFER_CHUNK_SIZE, index++) {
+			if (!test_bit(index, cell->transfer_owned))
+				continue;
+			clear_bit(index, cell->transfer_owned);
+
+			chunk = *mem;
+			chunk.phys_start += offs;
+			chunk.virt_start += offs;
+			chunk.size = JAILHOUSE_TRANSFER_CHUNK_SIZE;
+			remap_to_root_cell(&chunk, WARN_ON_ERROR);
+		}
+	}
+}
+
+void cpu_update_stack_usage(struct per_cpu *cpu_data)
+{
+	const unsigned long *word = (const unsigned long *)cpu_data->stack;
+	const unsigned long *end =
+		(const unsigned long *)(cpu_data->stack + STACK_SIZE);
+
+	while (word < end && *word == STACK_UNUSED_PATTERN)
+		word++;
+
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_STACK_MAX_USAGE] =
+		(end - word) * sizeof(unsigned long);
+}
+
+/*
+ * Parks the CPU and assigns it to the given cell. Its stats, exit latency
+ * histogram and MMIO region cache are cleared, only the stack high-water mark
+ * is kept. The caller updates the CPU sets of the involved cells.
+ */
+static void cpu_assign(unsigned int cpu, struct cell *cell)
+{
+	struct public_per_cpu *cpu_public = public_per_cpu(cpu);
+
+	arch_park_cpu(cpu);
+
+	cpu_public->cell = cell;
+	cpu_public->failed = false;
+	memset(cpu_public->stats, 0, sizeof(cpu_public->stats));
+	memset(cpu_public->exit_latency, 0, sizeof(cpu_public->exit_latency));
+	/* the stack pattern is not renewed, so keep reporting its mark */
+	cpu_update_stack_usage(per_cpu(cpu));
+	pmu_reset_stats(cpu_public);
+	mmio_region_cache_flush(&per_cpu(cpu)->mmio_cache);
+}
+
+static void cell_destroy_internal(struct cell *cell)
+{
+	const struct jailhouse_memory *mem;
+	unsigned int cpu, n;
+	struct unit *unit;
+
+	for_each_cpu(cpu, cell->cpu_set) {
+		set_bit(cpu, root_cell.cpu_set->bitmap);
+		cpu_assign(cpu, &root_cell);
+	}
+
+	for_each_mem_region(mem, cell->config, n) {
 		if (!JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
 			/*
 			 * This cannot fail. The region was mapped as a whole
@@ -383,9 +1363,16 @@ static void cell_destroy_internal(struct cell *cell)
 			arch_unmap_memory_region(cell, mem);
 
 		if (!(mem->flags & (JAILHOUSE_MEM_COMM_REGION |
-				    JAILHOUSE_MEM_ROOTSHARED)))
+				    JAILHOUSE_MEM_ROOTSHARED |
+				    JAILHOUSE_MEM_TRANSFER)) &&
+		    !shared_image_held(mem, cell))
 			remap_to_root_cell(mem, WARN_ON_ERROR);
 	}
+	transfer_cell_release(cell);
+
+	if (root_map_comm_page(cell, false))
+		printk("WARNING: Failed to unmap communication page of "
+		       "\"%s\"\n", cell->config->name);
 
 	for_each_unit_reverse(unit)
 		unit->cell_exit(cell);
@@ -396,78 +1383,163 @@ static void cell_destroy_internal(struct cell *cell)
 	cell_exit(cell);
 }
 
-static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
+/*
+ * Serializes the preparation phase of concurrent cell creations. All other
+ * management requests suspend the root cell first and are therefore already
+ * excluded.
+ */
+static DEFINE_SPINLOCK(cell_create_lock);
+
+/*
+ * Preparation phase of cell_create. Runs while the root cell continues to
+ * execute and must therefore only touch state that is private to the new cell.
+ */
+static int cell_prepare(unsigned long config_address, struct cell **cell_ptr)
 {
 	unsigned long cfg_page_offs = config_address & ~PAGE_MASK;
-	unsigned int cfg_pages, cell_pages, cpu, n;
-	const struct jailhouse_memory *mem;
+	unsigned int cfg_pages, cell_pages;
 	struct jailhouse_cell_desc *cfg;
 	unsigned long cfg_total_size;
-	struct cell *cell, *last;
-	struct unit *unit;
+	struct cell *cell;
 	void *cfg_mapping;
 	int err;
 
-	/* We do not support creation over non-root cells. */
-	if (cpu_data->public.cell != &root_cell)
-		return -EPERM;
-
-	cell_suspend(&root_cell);
-
-	if (!cell_reconfig_ok(NULL)) {
-		err = -EPERM;
-		goto err_resume;
-	}
-
 	cfg_pages = PAGES(cfg_page_offs + sizeof(struct jailhouse_cell_desc));
 	cfg_mapping = paging_get_guest_pages(NULL, config_address, cfg_pages,
 					     PAGE_READONLY_FLAGS);
-	if (!cfg_mapping) {
-		err = -ENOMEM;
-		goto err_resume;
-	}
+	if (!cfg_mapping)
+		return -ENOMEM;
 
 	cfg = (struct jailhouse_cell_desc *)(cfg_mapping + cfg_page_offs);
 
-	for_each_cell(cell)
-		/*
-		 * No bound checking needed, thus strcmp is safe here because
-		 * sizeof(cell->config->name) == sizeof(cfg->name) and
-		 * cell->config->name is guaranteed to be null-terminated.
-		 */
-		if (strcmp(cell->config->name, cfg->name) == 0 ||
-		    cell->config->id == cfg->id) {
-			err = -EEXIST;
-			goto err_resume;
-		}
-
 	cfg_total_size = jailhouse_cell_config_size(cfg);
 	cfg_pages = PAGES(cfg_page_offs + cfg_total_size);
-	if (cfg_pages > NUM_TEMPORARY_PAGES) {
-		err = trace_error(-E2BIG);
-		goto err_resume;
-	}
+	if (cfg_pages > NUM_TEMPORARY_PAGES)
+		return trace_error(-E2BIG);
 
 	if (!paging_get_guest_pages(NULL, config_address, cfg_pages,
-				    PAGE_READONLY_FLAGS)) {
-		err = -ENOMEM;
-		goto err_resume;
-	}
+				    PAGE_READONLY_FLAGS))
+		return -ENOMEM;
 
 	cell_pages = PAGES(sizeof(*cell) + cfg_total_size);
 	cell = page_alloc(&mem_pool, cell_pages);
-	if (!cell) {
-		err = -ENOMEM;
-		goto err_resume;
-	}
+	if (!cell)
+		return -ENOMEM;
 
 	cell->data_pages = cell_pages;
 	cell->config = ((void *)cell) + sizeof(*cell);
 	memcpy(cell->config, cfg, cfg_total_size);
 
+	if (cell->config->flags & JAILHOUSE_CELL_MSG_TIMEOUT_USEC &&
+	    arch_timestamp_khz() == 0) {
+		page_free(&mem_pool, cell, cell_pages);
+		return trace_error(-EINVAL);
+	}
+
 	err = cell_init(cell);
+	if (err) {
+		page_free(&mem_pool, cell, cell_pages);
+		return err;
+	}
+
+	*cell_ptr = cell;
+	return 0;
+}
+
+/*
+ * Reset the communication region, devices and CPUs of a suspended cell and let
+ * it run from its reset state.
+ */
+static void cell_reset_and_run(struct cell *cell)
+{
+	struct jailhouse_comm_region *comm_region;
+	unsigned int cpu;
+
+	/*
+	 * Present a consistent Communication Region state to the cell. Zero the
+	 * whole region as it might be dirty. This implies:
+	 *   - cell_state = JAILHOUSE_CELL_RUNNING (0)
+	 *   - msg_to_cell = JAILHOUSE_MSG_NONE (0)
+	 */
+	comm_region = &cell->comm_page.comm_region;
+	memset(&cell->comm_page, 0, sizeof(cell->comm_page));
+	cell->msg_pending = JAILHOUSE_MSG_NONE;
+
+	comm_region->revision = COMM_REGION_ABI_REVISION;
+	memcpy(comm_region->signature, COMM_REGION_MAGIC,
+	       sizeof(comm_region->signature));
+
+	cell->console_head = 0;
+	if (CELL_FLAGS_VIRTUAL_CONSOLE_PERMITTED(cell->config->flags)) {
+		comm_region->flags |= JAILHOUSE_COMM_FLAG_DBG_PUTC_PERMITTED;
+		/* a passive cell may not be able to write to the ring */
+		if (!(cell->config->flags & JAILHOUSE_CELL_PASSIVE_COMMREG))
+			comm_region->flags |= JAILHOUSE_COMM_FLAG_CONSOLE_RING;
+	}
+	if (CELL_FLAGS_VIRTUAL_CONSOLE_ACTIVE(cell->config->flags))
+		comm_region->flags |= JAILHOUSE_COMM_FLAG_DBG_PUTC_ACTIVE;
+	comm_region->console = cell->config->console;
+
+	pci_cell_reset(cell);
+	arch_cell_reset(cell);
+
+	for_each_cpu(cpu, cell->cpu_set) {
+		public_per_cpu(cpu)->failed = false;
+		arch_reset_cpu(cpu);
+	}
+
+	/* the counter was cleared along with the communication region */
+	spin_lock(&watchdog_lock);
+	cell->watchdog_count = 0;
+	cell->watchdog_kicked = read_timestamp();
+	spin_unlock(&watchdog_lock);
+
+	status_page_update_cell(cell);
+
+	printk("Started cell \"%s\"\n", cell->config->name);
+}
+
+static int cell_create(struct per_cpu *cpu_data, unsigned long config_address,
+		       bool start)
+{
+	const struct jailhouse_memory *mem;
+	struct cell *cell, *last, *other;
+	unsigned int cpu, n;
+	struct unit *unit;
+	int err;
+
+	/* We do not support creation over non-root cells. */
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
+
+	spin_lock(&cell_create_lock);
+	err = cell_prepare(config_address, &cell);
+	spin_unlock(&cell_create_lock);
 	if (err)
-		goto err_free_cell;
+		return err;
+
+	/*
+	 * Commit phase: everything from here on affects the root cell or
+	 * other cells and requires the root cell to be suspended.
+	 */
+	cell_suspend(&root_cell);
+
+	if (!cell_reconfig_ok(NULL)) {
+		err = -EPERM;
+		goto err_cell_exit;
+	}
+
+	for_each_cell(other)
+		/*
+		 * No bound checking needed, thus strcmp is safe here because
+		 * sizeof(other->config->name) == sizeof(cell->config->name)
+		 * and other->config->name is guaranteed to be null-terminated.
+		 */
+		if (strcmp(other->config->name, cell->config->name) == 0 ||
+		    other->config->id == cell->config->id) {
+			err = -EEXIST;
+			goto err_cell_exit;
+		}
 
 	/* don't assign the CPU we are currently running on */
 	if (cell_owns_cpu(cell, cpu_data->public.cpu_id)) {
@@ -482,12 +1554,27 @@ static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 			goto err_cell_exit;
 		}
 
-	err = arch_cell_create(cell);
-	if (err)
-		goto err_cell_exit;
-
-	for_each_unit(unit) {
-		err = unit->cell_init(cell);
+	/* memory donated to the hypervisor is not available for cells */
+	for_each_mem_region(mem, cell->config, n)
+		if (!(mem->flags & JAILHOUSE_MEM_COMM_REGION) &&
+		    mem_pool_donated(mem->phys_start, mem->size)) {
+			err = trace_error(-EBUSY);
+			goto err_cell_exit;
+		}
+
+	for_each_mem_region(mem, cell->config, n)
+		if (mem->flags & JAILHOUSE_MEM_SHARED_IMAGE &&
+		    shared_image_conflict(mem)) {
+			err = trace_error(-EINVAL);
+			goto err_cell_exit;
+		}
+
+	err = arch_cell_create(cell);
+	if (err)
+		goto err_cell_exit;
+
+	for_each_unit(unit) {
+		err = unit->cell_init(cell);
 		if (err) {
 			for_each_unit_before_reverse(unit, unit)
 				unit->cell_exit(cell);
@@ -496,219 +1583,722 @@ static int cell_create(struct per_cpu *cpu_data, unsigned long config_address)
 	}
 
 	/*
-	 * Shrinking: the new cell's CPUs are parked, then removed from the root
-	 * cell, assigned to the new cell and get their stats cleared.
+	 * Shrinking: the new cell's CPUs are removed from the root cell and
+	 * handed over to the new cell.
+	 */
+	for_each_cpu(cpu, cell->cpu_set) {
+		clear_bit(cpu, root_cell.cpu_set->bitmap);
+		cpu_assign(cpu, cell);
+	}
+	cell_console_reset(cell);
+
+	/* the watchdogs have to be checked by a CPU of the root cell */
+	if (!cell_owns_cpu(&root_cell, watchdog_cpu))
+		watchdog_cpu = this_cpu_id();
+
+	/*
+	 * Unmap the cell's memory regions from the root cell and map them to
+	 * the new cell instead.
+	 */
+	for_each_mem_region(mem, cell->config, n) {
+		/*
+		 * Unmap exceptions:
+		 *  - the communication region is not backed by root memory
+		 *  - regions that may be shared with the root cell
+		 *  - shared images that other cells already hold
+		 */
+		if (!(mem->flags & (JAILHOUSE_MEM_COMM_REGION |
+				    JAILHOUSE_MEM_ROOTSHARED)) &&
+		    !shared_image_held(mem, NULL)) {
+			err = unmap_from_root_cell(mem);
+			if (err)
+				goto err_destroy_cell;
+		}
+
+		/*
+		 * Transfer chunks are mapped individually, see below. Lazy
+		 * regions are mapped chunk-wise on first access.
+		 */
+		if (mem->flags & JAILHOUSE_MEM_TRANSFER ||
+		    mem_region_is_lazy(cell, mem))
+			continue;
+
+		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
+			err = mmio_subpage_register(cell, mem);
+		else
+			err = arch_map_memory_region(cell, mem);
+		if (err)
+			goto err_destroy_cell;
+	}
+
+	err = transfer_cell_claim(cell);
+	if (err)
+		goto err_destroy_cell;
+
+	err = root_map_comm_page(cell, true);
+	if (err)
+		goto err_destroy_cell;
+
+	config_commit(cell);
+
+	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_SHUT_DOWN;
+
+	last = &root_cell;
+	while (last->next)
+		last = last->next;
+	last->next = cell;
+	num_cells++;
+
+	status_page_update();
+
+	cell_reconfig_completed();
+
+	printk("Created cell \"%s\"\n", cell->config->name);
+
+	paging_dump_stats("after cell creation");
+
+	/* images were preloaded by the root cell before it lost access */
+	if (start) {
+		cell_suspend(cell);
+		cell_reset_and_run(cell);
+	}
+
+	cell_resume(&root_cell);
+
+	return 0;
+
+err_destroy_cell:
+	cell_destroy_internal(cell);
+	/* cell_destroy_internal already calls arch_cell_destroy & cell_exit */
+	goto err_free_cell;
+err_arch_destroy:
+	arch_cell_destroy(cell);
+err_cell_exit:
+	cell_exit(cell);
+err_free_cell:
+	page_free(&mem_pool, cell, cell->data_pages);
+	cell_resume(&root_cell);
+
+	return err;
+}
+
+/*
+ * Ask the cell for permission to perform the request given by message, e.g.
+ * JAILHOUSE_MSG_SHUTDOWN_REQUEST.
+ *
+ * Cells with JAILHOUSE_CELL_MSG_TIMEOUT_USEC are not waited for. As long as
+ * their reply is pending, -EAGAIN is returned so that the root cell can retry
+ * later and make use of the CPU in the meantime. The request is only sent
+ * once, retries just check for the reply. -EBUSY is returned while the reply
+ * to a different request is still pending.
+ */
+static int cell_request_ok(struct cell *cell, u32 message)
+{
+	enum msg_reply reply;
+
+	if (!(cell->config->flags & JAILHOUSE_CELL_MSG_TIMEOUT_USEC))
+		return cell_exchange_message(cell, message, MSG_REQUEST) ?
+			0 : -EPERM;
+
+	if (cell->config->flags & JAILHOUSE_CELL_PASSIVE_COMMREG)
+		return 0;
+
+	if (cell->msg_pending == JAILHOUSE_MSG_NONE) {
+		jailhouse_send_msg_to_cell(&cell->comm_page.comm_region,
+					   message);
+		cell->msg_deadline = cell_msg_timeout(cell);
+		cell->msg_pending = message;
+	} else if (cell->msg_pending != message) {
+		return -EBUSY;
+	}
+
+	reply = cell_check_reply(cell, MSG_REQUEST);
+	if (reply == MSG_REPLY_PENDING) {
+		if (!cell_msg_timeout_expired(cell, &cell->msg_deadline))
+			return -EAGAIN;
+		cell_msg_timed_out(cell);
+		reply = MSG_REPLY_OK;
+	}
+	cell->msg_pending = JAILHOUSE_MSG_NONE;
+
+	return reply == MSG_REPLY_OK ? 0 : -EPERM;
+}
+
+static int cell_management_prologue(enum management_task task,
+				    struct per_cpu *cpu_data, unsigned long id,
+				    struct cell **cell_ptr)
+{
+	int err;
+
+	/* We do not support management commands over non-root cells. */
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
+
+	cell_suspend(&root_cell);
+
+	for_each_cell(*cell_ptr)
+		if ((*cell_ptr)->config->id == id)
+			break;
+
+	if (!*cell_ptr) {
+		cell_resume(&root_cell);
+		return -ENOENT;
+	}
+
+	/* root cell cannot be managed */
+	if (*cell_ptr == &root_cell) {
+		cell_resume(&root_cell);
+		return -EINVAL;
+	}
+
+	if (task == CELL_DESTROY && !cell_reconfig_ok(*cell_ptr)) {
+		cell_resume(&root_cell);
+		return -EPERM;
+	}
+
+	err = cell_request_ok(*cell_ptr, JAILHOUSE_MSG_SHUTDOWN_REQUEST);
+	if (err) {
+		cell_resume(&root_cell);
+		return err;
+	}
+
+	cell_suspend(*cell_ptr);
+
+	return 0;
+}
+
+static int cell_start(struct per_cpu *cpu_data, unsigned long id)
+{
+	const struct jailhouse_memory *mem;
+	unsigned int n;
+	struct cell *cell;
+	int err;
+
+	err = cell_management_prologue(CELL_START, cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	/* the cell (re)starts with all of its balloon memory */
+	if (cell->balloon_chunks) {
+		memset(cell->balloon_requested, 0,
+		       balloon_longs(cell) * sizeof(unsigned long));
+		err = balloon_apply(cell);
+		if (err < 0)
+			goto out_resume;
+		if (err > 0)
+			config_commit(cell);
+		err = 0;
+	}
+
+	if (cell->loadable) {
+		/* unmap all loadable memory regions from the root cell */
+		for_each_mem_region(mem, cell->config, n)
+			if (mem->flags & JAILHOUSE_MEM_LOADABLE &&
+			    !shared_image_held(mem, cell)) {
+				err = unmap_from_root_cell(mem);
+				if (err)
+					goto out_resume;
+			}
+
+		config_commit(NULL);
+
+		cell->loadable = false;
+	}
+
+	cell_reset_and_run(cell);
+
+out_resume:
+	cell_resume(&root_cell);
+
+	return err;
+}
+
+static int cell_set_loadable(struct per_cpu *cpu_data, unsigned long id)
+{
+	const struct jailhouse_memory *mem;
+	unsigned int cpu, n;
+	struct cell *cell;
+	int err;
+
+	err = cell_management_prologue(CELL_SET_LOADABLE, cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	/* scrub while the cell's CPUs can still help */
+	if (!cell->loadable)
+		cell_scrub_memory(cell, JAILHOUSE_MEM_LOADABLE);
+
+	/*
+	 * Unconditionally park so that the target cell's CPUs don't stay in
+	 * suspension mode.
 	 */
 	for_each_cpu(cpu, cell->cpu_set) {
+		public_per_cpu(cpu)->failed = false;
 		arch_park_cpu(cpu);
+	}
 
-		clear_bit(cpu, root_cell.cpu_set->bitmap);
-		public_per_cpu(cpu)->cell = cell;
-		memset(public_per_cpu(cpu)->stats, 0,
-		       sizeof(public_per_cpu(cpu)->stats));
+	status_page_update_cell(cell);
+
+	if (cell->loadable)
+		goto out_resume;
+
+	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_SHUT_DOWN;
+	cell->loadable = true;
+
+	/*
+	 * Map all loadable memory regions into the root cell, except for
+	 * shared images that other cells still run.
+	 */
+	for_each_mem_region(mem, cell->config, n)
+		if (mem->flags & JAILHOUSE_MEM_LOADABLE &&
+		    !shared_image_held(mem, cell)) {
+			err = remap_to_root_cell(mem, ABORT_ON_ERROR);
+			if (err)
+				goto out_resume;
+		}
+
+	config_commit(NULL);
+
+	printk("Cell \"%s\" can be loaded\n", cell->config->name);
+
+out_resume:
+	cell_resume(&root_cell);
+
+	return err;
+}
+
+static int cell_destroy(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *cell, *previous;
+	int err;
+
+	err = cell_management_prologue(CELL_DESTROY, cpu_data, id, &cell);
+	if (err)
+		return err;
+
+	printk("Closing cell \"%s\"\n", cell->config->name);
+
+	cell_scrub_memory(cell, 0);
+	cell_destroy_internal(cell);
+
+	previous = &root_cell;
+	while (previous->next != cell)
+		previous = previous->next;
+	previous->next = cell->next;
+	num_cells--;
+
+	status_page_update();
+
+	page_free(&mem_pool, cell, cell->data_pages);
+	paging_dump_stats("after cell destruction");
+
+	cell_reconfig_completed();
+
+	cell_resume(&root_cell);
+
+	return 0;
+}
+
+static int cell_get_state(struct per_cpu *cpu_data, unsigned long id)
+{
+	struct cell *cell;
+
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
+
+	/*
+	 * We do not need explicit synchronization with cell_create/destroy
+	 * because their cell_suspend(root_cell) will not return before we left
+	 * this hypercall.
+	 */
+	for_each_cell(cell)
+		if (cell->config->id == id) {
+			u32 state = cell->comm_page.comm_region.cell_state;
+
+			switch (state) {
+			case JAILHOUSE_CELL_RUNNING:
+			case JAILHOUSE_CELL_RUNNING_LOCKED:
+			case JAILHOUSE_CELL_SHUT_DOWN:
+			case JAILHOUSE_CELL_FAILED:
+			case JAILHOUSE_CELL_FAILED_COMM_REV:
+				return state;
+			default:
+				return -EINVAL;
+			}
+		}
+	return -ENOENT;
+}
+
+/**
+ * Perform all CPU-unrelated hypervisor shutdown steps.
+ */
+void shutdown(void)
+{
+	struct unit *unit;
+
+	pci_prepare_handover();
+	arch_prepare_shutdown();
+
+	for_each_unit_reverse(unit)
+		unit->shutdown();
+
+	/* the UART is returned to Linux, no exits will drain it anymore */
+	uart_flush();
+}
+
+static int hypervisor_disable(struct per_cpu *cpu_data)
+{
+	static volatile unsigned int waiting_cpus;
+	static volatile bool common_shutdown_done;
+	static bool do_common_shutdown;
+	bool common_shutdown;
+	unsigned int cpu;
+	int state, ret;
+
+	/* We do not support shutdown over non-root cells. */
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
+
+	/*
+	 * This may race against another root cell CPU invoking a different
+	 * management hypercall (cell create, set loadable, start, destroy).
+	 * Those suspend the root cell to protect against concurrent requests.
+	 * We can't do this here because all root cell CPUs will invoke this
+	 * function, and cell_suspend doesn't support such a scenario. We are
+	 * safe nevertheless because we only need to see a consistent num_cells
+	 * that is not increasing anymore once the shutdown was started:
+	 *
+	 * If another CPU in a management hypercall already called cell_suspend,
+	 * it is now waiting for this CPU to react. In this case, we see
+	 * num_cells prior to any change, can start the shutdown if it is 1, and
+	 * will prevent the other CPU from changing it anymore. This is because
+	 * we are taking one CPU away from the hypervisor when leaving shutdown.
+	 * This will lock up the root cell (which is violating the hypercall
+	 * protocol), but only if it was the last cell.
+	 *
+	 * If the other CPU already returned from cell_suspend, we cannot be
+	 * running in parallel before that CPU releases the root cell again via
+	 * cell_resume. In that case, we will see the result of the change.
+	 *
+	 * shutdown_lock is here to protect shutdown_state, waiting_cpus and
+	 * do_common_shutdown. common_shutdown_done is only written by the CPU
+	 * that performs the common shutdown.
+	 */
+	spin_lock(&shutdown_lock);
+
+	if (cpu_data->public.shutdown_state == SHUTDOWN_NONE) {
+		state = num_cells == 1 ? SHUTDOWN_STARTED : -EBUSY;
+		for_each_cpu(cpu, root_cell.cpu_set)
+			public_per_cpu(cpu)->shutdown_state = state;
 	}
 
+	if (cpu_data->public.shutdown_state == SHUTDOWN_STARTED) {
+		do_common_shutdown = true;
+		waiting_cpus++;
+		ret = 0;
+	} else {
+		ret = cpu_data->public.shutdown_state;
+		cpu_data->public.shutdown_state = SHUTDOWN_NONE;
+	}
+
+	spin_unlock(&shutdown_lock);
+
+	if (ret < 0)
+		return ret;
+
 	/*
-	 * Unmap the cell's memory regions from the root cell and map them to
-	 * the new cell instead.
+	 * The shutdown will change hardware behavior, and we  have to avoid
+	 * that one CPU already turns it to native mode while another makes use
+	 * of it or runs into a hypervisor trap. This barrier prevents such
+	 * scenarios.
 	 */
-	for_each_mem_region(mem, cell->config, n) {
+	while (waiting_cpus < hypervisor_header.online_cpus)
+		cpu_relax();
+
+	spin_lock(&shutdown_lock);
+	common_shutdown = do_common_shutdown;
+	do_common_shutdown = false;
+	spin_unlock(&shutdown_lock);
+
+	if (common_shutdown) {
 		/*
-		 * Unmap exceptions:
-		 *  - the communication region is not backed by root memory
-		 *  - regions that may be shared with the root cell
+		 * The first CPU to get here changes common settings to native.
 		 */
-		if (!(mem->flags & (JAILHOUSE_MEM_COMM_REGION |
-				    JAILHOUSE_MEM_ROOTSHARED))) {
-			err = unmap_from_root_cell(mem);
-			if (err)
-				goto err_destroy_cell;
-		}
+		printk("Shutting down hypervisor, releasing %d CPUs\n",
+		       hypervisor_header.online_cpus);
+		shutdown();
 
-		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
-			err = mmio_subpage_register(cell, mem);
-		else
-			err = arch_map_memory_region(cell, mem);
-		if (err)
-			goto err_destroy_cell;
+		/* let all CPUs restore their Linux state in parallel */
+		memory_barrier();
+		common_shutdown_done = true;
+	} else {
+		while (!common_shutdown_done)
+			cpu_relax();
+		memory_barrier();
 	}
 
-	config_commit(cell);
+	return 0;
+}
 
-	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_SHUT_DOWN;
+/*
+ * Only RAM of the root cell that is not shared with other cells can be
+ * donated to the hypervisor.
+ */
+static bool root_cell_owns_ram(unsigned long phys, unsigned long size)
+{
+	const unsigned long ram_flags = JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE;
+	const struct jailhouse_memory *mem;
+	bool found = false;
+	struct cell *cell;
+	unsigned int n;
 
-	last = &root_cell;
-	while (last->next)
-		last = last->next;
-	last->next = cell;
-	num_cells++;
+	for_each_mem_region(mem, root_cell.config, n)
+		if (phys >= mem->phys_start &&
+		    phys + size <= mem->phys_start + mem->size &&
+		    (mem->flags & ram_flags) == ram_flags &&
+		    !(mem->flags & (JAILHOUSE_MEM_IO |
+				    JAILHOUSE_MEM_COMM_REGION |
+				    JAILHOUSE_MEM_COLORED)))
+			found = true;
+	if (!found)
+		return false;
 
-	cell_reconfig_completed();
+	for_each_non_root_cell(cell)
+		for_each_mem_region(mem, cell->config, n)
+			if (!(mem->flags & JAILHOUSE_MEM_COMM_REGION) &&
+			    regions_overlap(phys, size, mem))
+				return false;
+	return true;
+}
 
-	printk("Created cell \"%s\"\n", cell->config->name);
+static int mem_pool_grow(struct per_cpu *cpu_data, unsigned long phys,
+			 unsigned long size)
+{
+	struct jailhouse_memory mem = {
+		.phys_start = phys,
+		.virt_start = phys,
+		.size = size,
+		.flags = JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE,
+	};
+	int err;
 
-	paging_dump_stats("after cell creation");
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
 
-	cell_resume(&root_cell);
+	if ((phys | size) & ~PAGE_MASK || size == 0 || phys + size < phys ||
+	    !root_cell_owns_ram(phys, size))
+		return trace_error(-EINVAL);
 
-	return 0;
+	cell_suspend(&root_cell);
+
+	/*
+	 * Commit the unmapping before the hypervisor writes to the chunk so
+	 * that no stale root cell mapping or DMA translation is left.
+	 */
+	err = unmap_from_root_cell(&mem);
+	config_commit(NULL);
+	if (!err)
+		err = mem_pool_donate(phys, size);
+	if (err) {
+		remap_to_root_cell(&mem, WARN_ON_ERROR);
+		config_commit(NULL);
+	}
 
-err_destroy_cell:
-	cell_destroy_internal(cell);
-	/* cell_destroy_internal already calls arch_cell_destroy & cell_exit */
-	goto err_free_cell;
-err_arch_destroy:
-	arch_cell_destroy(cell);
-err_cell_exit:
-	cell_exit(cell);
-err_free_cell:
-	page_free(&mem_pool, cell, cell_pages);
-err_resume:
 	cell_resume(&root_cell);
 
+	if (!err)
+		paging_dump_stats("after pool growth");
 	return err;
 }
 
-static bool cell_shutdown_ok(struct cell *cell)
+static int mem_pool_shrink(struct per_cpu *cpu_data, unsigned long phys)
 {
-	return cell_exchange_message(cell, JAILHOUSE_MSG_SHUTDOWN_REQUEST,
-				     MSG_REQUEST);
-}
+	struct jailhouse_memory mem = {
+		.phys_start = phys,
+		.virt_start = phys,
+		.flags = JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE,
+	};
+	unsigned long size;
+	int err;
 
-static int cell_management_prologue(enum management_task task,
-				    struct per_cpu *cpu_data, unsigned long id,
-				    struct cell **cell_ptr)
-{
-	/* We do not support management commands over non-root cells. */
 	if (cpu_data->public.cell != &root_cell)
 		return -EPERM;
 
 	cell_suspend(&root_cell);
 
-	for_each_cell(*cell_ptr)
-		if ((*cell_ptr)->config->id == id)
-			break;
-
-	if (!*cell_ptr) {
-		cell_resume(&root_cell);
-		return -ENOENT;
+	err = mem_pool_reclaim(phys, &size);
+	if (!err) {
+		mem.size = size;
+		err = remap_to_root_cell(&mem, ABORT_ON_ERROR);
+		config_commit(NULL);
 	}
 
-	/* root cell cannot be managed */
-	if (*cell_ptr == &root_cell) {
-		cell_resume(&root_cell);
-		return -EINVAL;
-	}
+	cell_resume(&root_cell);
 
-	if ((task == CELL_DESTROY && !cell_reconfig_ok(*cell_ptr)) ||
-	    !cell_shutdown_ok(*cell_ptr)) {
-		cell_resume(&root_cell);
+	return err;
+}
+
+/*
+ * Only records the request of the cell: moving memory between the cells
+ * requires suspending the root cell, which a non-root cell must not do as it
+ * could deadlock with a concurrent management request. The root cell applies
+ * the requests via JAILHOUSE_HC_CELL_BALLOON_UPDATE.
+ */
+static long mem_balloon(struct per_cpu *cpu_data, unsigned long addr,
+			unsigned long op)
+{
+	struct cell *cell = cpu_data->public.cell;
+	unsigned int index;
+
+	if (cell == &root_cell)
 		return -EPERM;
-	}
 
-	cell_suspend(*cell_ptr);
+	if (!balloon_chunk_find(cell, addr, &index))
+		return trace_error(-EINVAL);
+
+	switch (op) {
+	case JAILHOUSE_BALLOON_RELEASE:
+		set_bit(index, cell->balloon_requested);
+		break;
+	case JAILHOUSE_BALLOON_RECLAIM:
+		clear_bit(index, cell->balloon_requested);
+		break;
+	case JAILHOUSE_BALLOON_QUERY:
+		return test_bit(index, cell->balloon_released) ? 1 : 0;
+	default:
+		return trace_error(-EINVAL);
+	}
 
+	status_page_update_cell(cell);
 	return 0;
 }
 
-static int cell_start(struct per_cpu *cpu_data, unsigned long id)
+static int cell_balloon_update(struct per_cpu *cpu_data, unsigned long id)
 {
-	struct jailhouse_comm_region *comm_region;
-	const struct jailhouse_memory *mem;
-	unsigned int cpu, n;
 	struct cell *cell;
 	int err;
 
-	err = cell_management_prologue(CELL_START, cpu_data, id, &cell);
-	if (err)
-		return err;
-
-	if (cell->loadable) {
-		/* unmap all loadable memory regions from the root cell */
-		for_each_mem_region(mem, cell->config, n)
-			if (mem->flags & JAILHOUSE_MEM_LOADABLE) {
-				err = unmap_from_root_cell(mem);
-				if (err)
-					goto out_resume;
-			}
-
-		config_commit(NULL);
-
-		cell->loadable = false;
-	}
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
 
-	/*
-	 * Present a consistent Communication Region state to the cell. Zero the
-	 * whole region as it might be dirty. This implies:
-	 *   - cell_state = JAILHOUSE_CELL_RUNNING (0)
-	 *   - msg_to_cell = JAILHOUSE_MSG_NONE (0)
-	 */
-	comm_region = &cell->comm_page.comm_region;
-	memset(&cell->comm_page, 0, sizeof(cell->comm_page));
+	cell_suspend(&root_cell);
 
-	comm_region->revision = COMM_REGION_ABI_REVISION;
-	memcpy(comm_region->signature, COMM_REGION_MAGIC,
-	       sizeof(comm_region->signature));
+	for_each_non_root_cell(cell)
+		if (cell->config->id == id)
+			break;
 
-	if (CELL_FLAGS_VIRTUAL_CONSOLE_PERMITTED(cell->config->flags))
-		comm_region->flags |= JAILHOUSE_COMM_FLAG_DBG_PUTC_PERMITTED;
-	if (CELL_FLAGS_VIRTUAL_CONSOLE_ACTIVE(cell->config->flags))
-		comm_region->flags |= JAILHOUSE_COMM_FLAG_DBG_PUTC_ACTIVE;
-	comm_region->console = cell->config->console;
+	if (!cell) {
+		err = -ENOENT;
+	} else if (cell->loadable) {
+		/* the root cell is loading the cell's memory */
+		err = -EBUSY;
+	} else {
+		cell_suspend(cell);
 
-	pci_cell_reset(cell);
-	arch_cell_reset(cell);
+		err = balloon_apply(cell);
+		/*
+		 * Flushes the TLBs and IOMMU domains of both cells. Device
+		 * and interrupt assignments are unchanged and just reapplied.
+		 */
+		config_commit(cell);
+		status_page_update_cell(cell);
 
-	for_each_cpu(cpu, cell->cpu_set) {
-		public_per_cpu(cpu)->failed = false;
-		arch_reset_cpu(cpu);
+		cell_resume(cell);
 	}
 
-	printk("Started cell \"%s\"\n", cell->config->name);
-
-out_resume:
 	cell_resume(&root_cell);
 
-	return err;
+	return err < 0 ? err : 0;
 }
 
-static int cell_set_loadable(struct per_cpu *cpu_data, unsigned long id)
+/*
+ * Moves a CPU from the root cell into a cell with JAILHOUSE_CELL_ELASTIC_CPUS
+ * or back. The CPU is parked, its new cell starts it via INIT/SIPI or PSCI
+ * CPU_ON like a hot-plugged one. Cells have to take the CPU offline and
+ * migrate its interrupts before, the hypervisor parks it regardless, just like
+ * on cell destruction. The first CPU of a cell cannot be moved, so its reset
+ * entry and interrupt routing defaults stay unchanged.
+ *
+ * Like other reconfigurations, moves are refused while any cell is in
+ * JAILHOUSE_CELL_RUNNING_LOCKED state, and removals need the cell's consent
+ * via JAILHOUSE_MSG_CPU_REMOVE_REQUEST.
+ */
+static int cell_cpu_move(struct per_cpu *cpu_data, unsigned long id,
+			 unsigned long cpu, bool add)
 {
-	const struct jailhouse_memory *mem;
-	unsigned int cpu, n;
-	struct cell *cell;
-	int err;
+	struct cell *cell, *from, *to;
+	int err = 0;
 
-	err = cell_management_prologue(CELL_SET_LOADABLE, cpu_data, id, &cell);
-	if (err)
-		return err;
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
 
-	/*
-	 * Unconditionally park so that the target cell's CPUs don't stay in
-	 * suspension mode.
-	 */
-	for_each_cpu(cpu, cell->cpu_set) {
-		public_per_cpu(cpu)->failed = false;
-		arch_park_cpu(cpu);
+	if (!cpu_id_valid(cpu))
+		return trace_error(-EINVAL);
+
+	cell_suspend(&root_cell);
+
+	for_each_non_root_cell(cell)
+		if (cell->config->id == id)
+			break;
+
+	if (!cell) {
+		err = -ENOENT;
+		goto out_resume;
 	}
 
-	if (cell->loadable)
+	if (!(cell->config->flags & JAILHOUSE_CELL_ELASTIC_CPUS) ||
+	    cpu <= first_cpu(cell->cpu_set)) {
+		err = trace_error(-EINVAL);
 		goto out_resume;
+	}
 
-	cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_SHUT_DOWN;
-	cell->loadable = true;
+	/* also covers the target cell itself */
+	if (!cell_reconfig_ok(NULL)) {
+		err = -EPERM;
+		goto out_resume;
+	}
 
-	/* map all loadable memory regions into the root cell */
-	for_each_mem_region(mem, cell->config, n)
-		if (mem->flags & JAILHOUSE_MEM_LOADABLE) {
-			err = remap_to_root_cell(mem, ABORT_ON_ERROR);
-			if (err)
-				goto out_resume;
+	if (add) {
+		/* don't assign the CPU we are currently running on */
+		if (!cell_owns_cpu(&root_cell, cpu) ||
+		    cpu == cpu_data->public.cpu_id) {
+			err = trace_error(-EBUSY);
+			goto out_resume;
+		}
+		from = &root_cell;
+		to = cell;
+	} else {
+		if (!cell_owns_cpu(cell, cpu)) {
+			err = trace_error(-EINVAL);
+			goto out_resume;
 		}
+		err = cell_request_ok(cell, JAILHOUSE_MSG_CPU_REMOVE_REQUEST);
+		if (err)
+			goto out_resume;
+		from = cell;
+		to = &root_cell;
+	}
 
-	config_commit(NULL);
+	cell_suspend(cell);
 
-	printk("Cell \"%s\" can be loaded\n", cell->config->name);
+	arch_cell_cpu_move(cpu, from, to);
+	clear_bit(cpu, from->cpu_set->bitmap);
+	set_bit(cpu, to->cpu_set->bitmap);
+	cpu_assign(cpu, to);
+
+	/* the watchdogs have to be checked by a CPU of the root cell */
+	if (!cell_owns_cpu(&root_cell, watchdog_cpu))
+		watchdog_cpu = this_cpu_id();
+
+	/* revalidates the interrupt routing of both cells */
+	config_commit(cell);
+
+	status_page_update();
+
+	printk("%s CPU %lu %s cell \"%s\"\n", add ? "Added" : "Removed", cpu,
+	       add ? "to" : "from", cell->config->name);
+
+	cell_resume(cell);
 
 out_resume:
 	cell_resume(&root_cell);
@@ -716,178 +2306,339 @@ out_resume:
 	return err;
 }
 
-static int cell_destroy(struct per_cpu *cpu_data, unsigned long id)
+static void transfer_notify(struct cell *cell, unsigned long address,
+			    unsigned int num_chunks, struct cell *donor)
+{
+	struct jailhouse_comm_transfer *transfer =
+		&cell->comm_page.comm_transfer;
+	struct jailhouse_comm_transfer_slot *slot =
+		&transfer->slots[transfer->head %
+				 JAILHOUSE_COMM_TRANSFER_SLOTS];
+
+	slot->address = address;
+	slot->num_chunks = num_chunks;
+	slot->donor_id = donor->config->id;
+
+	/* publish the slot before the head */
+	memory_barrier();
+	transfer->head++;
+}
+
+/*
+ * Move a transfer chunk from one cell to another. Unmapping cannot fail as
+ * chunks are always mapped as a whole. If mapping fails, the chunk is given
+ * back.
+ */
+static int transfer_chunk_move(struct cell *from,
+			       const struct jailhouse_memory *from_chunk,
+			       struct cell *to,
+			       const struct jailhouse_memory *to_chunk)
 {
-	struct cell *cell, *previous;
 	int err;
 
-	err = cell_management_prologue(CELL_DESTROY, cpu_data, id, &cell);
-	if (err)
-		return err;
+	arch_unmap_memory_region(from, from_chunk);
 
-	printk("Closing cell \"%s\"\n", cell->config->name);
+	err = arch_map_memory_region(to, to_chunk);
+	if (err && arch_map_memory_region(from, from_chunk))
+		printk("WARNING: Failed to re-assign transfer chunk\n");
+	return err;
+}
 
-	cell_destroy_internal(cell);
+/*
+ * Hand chunks of a transfer pool over to another cell of the pool, without
+ * copying. Unlike ballooning, only the two cells are suspended while their
+ * mappings change, the root cell keeps running. The receiving cell is
+ * notified via its communication page.
+ */
+static long mem_transfer(struct per_cpu *cpu_data, unsigned long arg,
+			 unsigned long op)
+{
+	struct jailhouse_memory chunk, peer_chunk;
+	struct cell *cell = cpu_data->public.cell;
+	unsigned long address, peer_address = 0;
+	struct jailhouse_mem_transfer *desc;
+	unsigned int index, peer_index, n;
+	char name[sizeof(desc->peer)];
+	unsigned int num_chunks;
+	struct cell *peer;
+	u32 state;
+	long err = 0;
+
+	if (cell == &root_cell)
+		return -EPERM;
 
-	previous = &root_cell;
-	while (previous->next != cell)
-		previous = previous->next;
-	previous->next = cell->next;
-	num_cells--;
+	if (op == JAILHOUSE_TRANSFER_QUERY) {
+		if (!transfer_chunk_find(cell, arg, false, &index, &chunk))
+			return trace_error(-EINVAL);
+		return test_bit(index, cell->transfer_owned) ? 1 : 0;
+	}
+	if (op != JAILHOUSE_TRANSFER_GIVE)
+		return trace_error(-EINVAL);
+
+	/* the argument must not cross a page boundary */
+	if (arg & 0x7 || (arg & ~PAGE_MASK) + sizeof(*desc) > PAGE_SIZE)
+		return trace_error(-EINVAL);
+
+	desc = paging_get_guest_pages(NULL, arg & PAGE_MASK, 1,
+				      PAGE_READONLY_FLAGS);
+	if (!desc)
+		return trace_error(-EINVAL);
+	desc = (void *)desc + (arg & ~PAGE_MASK);
+
+	address = desc->address;
+	num_chunks = desc->num_chunks;
+	memcpy(name, desc->peer, sizeof(name));
+	name[sizeof(name) - 1] = 0;
+
+	if (num_chunks == 0 || num_chunks > cell->transfer_chunks)
+		return trace_error(-EINVAL);
+
+	/* the cell list and the peer's state are stable from here on */
+	if (!transfer_exclusion_get(false))
+		return -EBUSY;
+
+	for_each_non_root_cell(peer)
+		if (strcmp(peer->config->name, name) == 0)
+			break;
 
-	page_free(&mem_pool, cell, cell->data_pages);
-	paging_dump_stats("after cell destruction");
+	if (!peer) {
+		err = -ENOENT;
+		goto out;
+	}
+	state = peer->comm_page.comm_region.cell_state;
+	if (peer == cell || peer->loadable ||
+	    (state != JAILHOUSE_CELL_RUNNING &&
+	     state != JAILHOUSE_CELL_RUNNING_LOCKED)) {
+		err = trace_error(-EINVAL);
+		goto out;
+	}
 
-	cell_reconfig_completed();
+	/*
+	 * All chunks have to be owned by the caller and have to be consecutive
+	 * in the address space of the peer as well.
+	 */
+	for (n = 0; n < num_chunks; n++) {
+		if (!transfer_chunk_find(cell,
+					 address +
+					 n * JAILHOUSE_TRANSFER_CHUNK_SIZE,
+					 false, &index, &chunk) ||
+		    !test_bit(index, cell->transfer_owned) ||
+		    !transfer_chunk_find(peer, chunk.phys_start, true,
+					 &peer_index, &peer_chunk)) {
+			err = trace_error(-EINVAL);
+			goto out;
+		}
+		if (n == 0)
+			peer_address = peer_chunk.virt_start;
+		else if (peer_chunk.virt_start !=
+			 peer_address + n * JAILHOUSE_TRANSFER_CHUNK_SIZE) {
+			err = trace_error(-EINVAL);
+			goto out;
+		}
+	}
 
-	cell_resume(&root_cell);
+	cell_suspend(cell);
+	cell_suspend(peer);
 
-	return 0;
-}
+	for (n = 0; n < num_chunks; n++) {
+		transfer_chunk_find(cell,
+				    address + n * JAILHOUSE_TRANSFER_CHUNK_SIZE,
+				    false, &index, &chunk);
+		transfer_chunk_find(peer, chunk.phys_start, true, &peer_index,
+				    &peer_chunk);
 
-static int cell_get_state(struct per_cpu *cpu_data, unsigned long id)
-{
-	struct cell *cell;
+		err = transfer_chunk_move(cell, &chunk, peer, &peer_chunk);
+		if (err)
+			break;
+		clear_bit(index, cell->transfer_owned);
+		set_bit(peer_index, peer->transfer_owned);
+	}
 
-	if (cpu_data->public.cell != &root_cell)
-		return -EPERM;
+	/* roll back on errors so that the transfer is all or nothing */
+	if (err) {
+		while (n-- > 0) {
+			transfer_chunk_find(peer, peer_address + n *
+					    JAILHOUSE_TRANSFER_CHUNK_SIZE,
+					    false, &peer_index, &peer_chunk);
+			transfer_chunk_find(cell, peer_chunk.phys_start, true,
+					    &index, &chunk);
+
+			if (transfer_chunk_move(peer, &peer_chunk, cell,
+						&chunk))
+				continue;
+			clear_bit(peer_index, peer->transfer_owned);
+			set_bit(index, cell->transfer_owned);
+		}
+	}
 
 	/*
-	 * We do not need explicit synchronization with cell_create/destroy
-	 * because their cell_suspend(root_cell) will not return before we left
-	 * this hypercall.
+	 * The donor's CPUs flush the range when resuming, this one right away.
+	 * The peer only gained mappings, but lost them again on rollback.
 	 */
-	for_each_cell(cell)
-		if (cell->config->id == id) {
-			u32 state = cell->comm_page.comm_region.cell_state;
+	arch_flush_cell_vcpu_caches(cell, address,
+				    num_chunks * JAILHOUSE_TRANSFER_CHUNK_SIZE);
+	arch_flush_cell_vcpu_caches(peer, peer_address,
+				    num_chunks * JAILHOUSE_TRANSFER_CHUNK_SIZE);
+	iommu_config_commit(cell);
+	iommu_config_commit(peer);
+	paging_guest_pt_cache_invalidate();
+
+	if (!err)
+		transfer_notify(peer, peer_address, num_chunks, cell);
+
+	cell_resume(peer);
+	cell_resume(cell);
+
+out:
+	transfer_exclusion_put();
+	return err;
+}
 
-			switch (state) {
-			case JAILHOUSE_CELL_RUNNING:
-			case JAILHOUSE_CELL_RUNNING_LOCKED:
-			case JAILHOUSE_CELL_SHUT_DOWN:
-			case JAILHOUSE_CELL_FAILED:
-			case JAILHOUSE_CELL_FAILED_COMM_REV:
-				return state;
-			default:
-				return -EINVAL;
-			}
-		}
-	return -ENOENT;
+/*
+ * Check the watchdog of a cell and suspend it if it failed to change the
+ * counter within the timeout. Cells that are not running are not monitored.
+ */
+static void watchdog_check_cell(struct cell *cell, u64 now)
+{
+	u32 state = cell->comm_page.comm_region.cell_state;
+	u32 count = cell->comm_page.comm_watchdog.count;
+
+	if (now < cell->watchdog_deadline)
+		return;
+
+	if (count != cell->watchdog_count || cell->loadable ||
+	    (state != JAILHOUSE_CELL_RUNNING &&
+	     state != JAILHOUSE_CELL_RUNNING_LOCKED)) {
+		cell->watchdog_count = count;
+		cell->watchdog_kicked = now;
+	} else if (now - cell->watchdog_kicked >= cell->watchdog_timeout &&
+		   transfer_exclusion_get(false)) {
+		/* a memory transfer would resume the cell, retry after it */
+		printk("Watchdog of cell \"%s\" expired\n", cell->config->name);
+		cell_suspend(cell);
+		cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_FAILED;
+		status_page_update_cell(cell);
+		transfer_exclusion_put();
+	}
+
+	/* check 4 times per timeout to detect expiry with little delay */
+	cell->watchdog_deadline = now + cell->watchdog_timeout / 4;
 }
 
 /**
- * Perform all CPU-unrelated hypervisor shutdown steps.
+ * Check the cell watchdogs.
+ *
+ * Called on VM exits of root cell CPUs. Only the CPU that enabled the last
+ * watchdog checks them, it programs a timer via arch_watchdog_timer_set() for
+ * the next check.
  */
-void shutdown(void)
+void watchdog_check(void)
 {
-	struct unit *unit;
+	struct cell *cell;
+	u64 now;
+
+	if (watchdog_next == 0 || this_cpu_id() != watchdog_cpu)
+		return;
+
+	now = read_timestamp();
+	if (now >= watchdog_next) {
+		spin_lock(&watchdog_lock);
+
+		watchdog_next = 0;
+		for_each_cell(cell) {
+			if (cell->watchdog_timeout == 0)
+				continue;
+			watchdog_check_cell(cell, now);
+			if (watchdog_next == 0 ||
+			    cell->watchdog_deadline < watchdog_next)
+				watchdog_next = cell->watchdog_deadline;
+		}
 
-	pci_prepare_handover();
-	arch_prepare_shutdown();
+		spin_unlock(&watchdog_lock);
+	}
 
-	for_each_unit_reverse(unit)
-		unit->shutdown();
+	arch_watchdog_timer_set(watchdog_next);
 }
 
-static int hypervisor_disable(struct per_cpu *cpu_data)
+static long cell_watchdog_set(struct per_cpu *cpu_data, unsigned long id,
+			      unsigned long timeout_us)
 {
-	static volatile unsigned int waiting_cpus;
-	static bool do_common_shutdown;
-	unsigned int this_cpu = cpu_data->public.cpu_id;
-	unsigned int cpu;
-	int state, ret;
+	unsigned long khz = arch_timestamp_khz();
+	struct cell *cell;
+	u64 now;
+	int err;
 
-	/* We do not support shutdown over non-root cells. */
 	if (cpu_data->public.cell != &root_cell)
 		return -EPERM;
 
-	/*
-	 * This may race against another root cell CPU invoking a different
-	 * management hypercall (cell create, set loadable, start, destroy).
-	 * Those suspend the root cell to protect against concurrent requests.
-	 * We can't do this here because all root cell CPUs will invoke this
-	 * function, and cell_suspend doesn't support such a scenario. We are
-	 * safe nevertheless because we only need to see a consistent num_cells
-	 * that is not increasing anymore once the shutdown was started:
-	 *
-	 * If another CPU in a management hypercall already called cell_suspend,
-	 * it is now waiting for this CPU to react. In this case, we see
-	 * num_cells prior to any change, can start the shutdown if it is 1, and
-	 * will prevent the other CPU from changing it anymore. This is because
-	 * we are taking one CPU away from the hypervisor when leaving shutdown.
-	 * This will lock up the root cell (which is violating the hypercall
-	 * protocol), but only if it was the last cell.
-	 *
-	 * If the other CPU already returned from cell_suspend, we cannot be
-	 * running in parallel before that CPU releases the root cell again via
-	 * cell_resume. In that case, we will see the result of the change.
-	 *
-	 * shutdown_lock is here to protect shutdown_state, waiting_cpus and
-	 * do_common_shutdown.
-	 */
-	spin_lock(&shutdown_lock);
-
-	if (cpu_data->public.shutdown_state == SHUTDOWN_NONE) {
-		state = num_cells == 1 ? SHUTDOWN_STARTED : -EBUSY;
-		for_each_cpu(cpu, root_cell.cpu_set)
-			public_per_cpu(cpu)->shutdown_state = state;
-	}
-
-	if (cpu_data->public.shutdown_state == SHUTDOWN_STARTED) {
-		do_common_shutdown = true;
-		waiting_cpus++;
-		ret = 0;
-	} else {
-		ret = cpu_data->public.shutdown_state;
-		cpu_data->public.shutdown_state = SHUTDOWN_NONE;
-	}
+	if (timeout_us != 0 &&
+	    (timeout_us < JAILHOUSE_WATCHDOG_MIN_TIMEOUT_US ||
+	     (u64)timeout_us > 0xffffffff))
+		return trace_error(-EINVAL);
 
-	spin_unlock(&shutdown_lock);
+	err = arch_watchdog_timer_set(0);
+	if (err)
+		return err;
+	if (khz == 0)
+		return -ENOSYS;
 
-	if (ret < 0)
-		return ret;
+	/* see cell_get_state */
+	for_each_cell(cell)
+		if (cell->config->id == id) {
+			if (cell == &root_cell)
+				return -EINVAL;
 
-	/*
-	 * The shutdown will change hardware behavior, and we  have to avoid
-	 * that one CPU already turns it to native mode while another makes use
-	 * of it or runs into a hypervisor trap. This barrier prevents such
-	 * scenarios.
-	 */
-	while (waiting_cpus < hypervisor_header.online_cpus)
-		cpu_relax();
+			spin_lock(&watchdog_lock);
 
-	spin_lock(&shutdown_lock);
+			now = read_timestamp();
+			cell->watchdog_timeout = (u64)timeout_us * khz / 1000;
+			cell->watchdog_count =
+				cell->comm_page.comm_watchdog.count;
+			cell->watchdog_kicked = now;
+			cell->watchdog_deadline = now;
 
-	if (do_common_shutdown) {
-		/*
-		 * The first CPU to get here changes common settings to native.
-		 */
-		printk("Shutting down hypervisor\n");
-		shutdown();
-		do_common_shutdown = false;
-	}
-	printk(" Releasing CPU %d\n", this_cpu);
+			/* the next exit of this CPU rebuilds the schedule */
+			watchdog_cpu = this_cpu_id();
+			watchdog_next = now;
 
-	spin_unlock(&shutdown_lock);
+			spin_unlock(&watchdog_lock);
 
-	return 0;
+			return 0;
+		}
+	return -ENOENT;
 }
 
 static long hypervisor_get_info(struct per_cpu *cpu_data, unsigned long type)
 {
+	unsigned long extents, largest, pages, used;
+
 	switch (type) {
 	case JAILHOUSE_INFO_MEM_POOL_SIZE:
-		return mem_pool.pages;
 	case JAILHOUSE_INFO_MEM_POOL_USED:
-		return mem_pool.used_pages;
+		mem_pool_get_usage(&pages, &used);
+		return type == JAILHOUSE_INFO_MEM_POOL_SIZE ? pages : used;
 	case JAILHOUSE_INFO_REMAP_POOL_SIZE:
 		return remap_pool.pages;
 	case JAILHOUSE_INFO_REMAP_POOL_USED:
 		return remap_pool.used_pages;
 	case JAILHOUSE_INFO_NUM_CELLS:
 		return num_cells;
+	case JAILHOUSE_INFO_MEM_POOL_FREE_EXTENTS:
+	case JAILHOUSE_INFO_MEM_POOL_LARGEST_FREE:
+		extents = page_pool_free_extents(&mem_pool, &largest);
+		return type == JAILHOUSE_INFO_MEM_POOL_FREE_EXTENTS ?
+			extents : largest;
+	case JAILHOUSE_INFO_REMAP_POOL_FREE_EXTENTS:
+	case JAILHOUSE_INFO_REMAP_POOL_LARGEST_FREE:
+		extents = page_pool_free_extents(&remap_pool, &largest);
+		return type == JAILHOUSE_INFO_REMAP_POOL_FREE_EXTENTS ?
+			extents : largest;
+	case JAILHOUSE_INFO_ROOT_SUSPEND_LAST:
+		return root_suspend_last & BIT_MASK(BITS_PER_LONG - 2, 0);
+	case JAILHOUSE_INFO_ROOT_SUSPEND_MAX:
+		return root_suspend_max & BIT_MASK(BITS_PER_LONG - 2, 0);
 	default:
-		return -EINVAL;
+		return setup_get_time(type);
 	}
 }
 
@@ -909,35 +2660,193 @@ static int cpu_get_info(struct per_cpu *cpu_data, unsigned long cpu_id,
 	if (type == JAILHOUSE_CPU_INFO_STATE) {
 		return public_per_cpu(cpu_id)->failed ? JAILHOUSE_CPU_FAILED :
 			JAILHOUSE_CPU_RUNNING;
+	} else if (type == JAILHOUSE_CPU_INFO_SETUP_TIME) {
+		return public_per_cpu(cpu_id)->setup_ticks &
+			BIT_MASK(BITS_PER_LONG - 2, 0);
 	} else if (type >= JAILHOUSE_CPU_INFO_STAT_BASE &&
 		type - JAILHOUSE_CPU_INFO_STAT_BASE < JAILHOUSE_NUM_CPU_STATS) {
 		type -= JAILHOUSE_CPU_INFO_STAT_BASE;
 		return public_per_cpu(cpu_id)->stats[type] & BIT_MASK(30, 0);
+	} else if (type >= JAILHOUSE_CPU_INFO_EXIT_LATENCY_BASE &&
+		type - JAILHOUSE_CPU_INFO_EXIT_LATENCY_BASE <
+		JAILHOUSE_NUM_CPU_STATS * JAILHOUSE_EXIT_LATENCY_BUCKETS) {
+		type -= JAILHOUSE_CPU_INFO_EXIT_LATENCY_BASE;
+		return public_per_cpu(cpu_id)->exit_latency
+			[type / JAILHOUSE_EXIT_LATENCY_BUCKETS]
+			[type % JAILHOUSE_EXIT_LATENCY_BUCKETS] & BIT_MASK(30, 0);
+	} else if (type >= JAILHOUSE_CPU_INFO_QOS_BASE &&
+		type - JAILHOUSE_CPU_INFO_QOS_BASE < JAILHOUSE_NUM_QOS_EVENTS) {
+		return arch_cell_get_qos_info(public_per_cpu(cpu_id)->cell,
+				type - JAILHOUSE_CPU_INFO_QOS_BASE);
+	} else if (type >= JAILHOUSE_CPU_INFO_PMU_BASE &&
+		type - JAILHOUSE_CPU_INFO_PMU_BASE < JAILHOUSE_NUM_PMU_COUNTERS) {
+		return pmu_get_info(public_per_cpu(cpu_id),
+				    type - JAILHOUSE_CPU_INFO_PMU_BASE);
 	} else
 		return -EINVAL;
 }
 
-/**
- * Handle hypercall invoked by a cell.
- * @param code		Hypercall code.
- * @param arg1		First hypercall argument.
- * @param arg2		Seconds hypercall argument.
- *
- * @return Value that shall be passed to the caller of the hypercall on return.
- *
- * @note If @c arg1 and @c arg2 are valid depends on the hypercall code.
+static long cpu_get_stats(struct per_cpu *cpu_data, unsigned long cpu_id,
+			  unsigned long gphys)
+{
+	struct jailhouse_cpu_stats *dst;
+
+	if (!cpu_id_valid(cpu_id))
+		return -EINVAL;
+
+	/* see cpu_get_info */
+	if (cpu_data->public.cell != &root_cell &&
+	    !cell_owns_cpu(cpu_data->public.cell, cpu_id))
+		return -EPERM;
+
+	/* the buffer must not cross a page boundary */
+	if (gphys & 0x7 || (gphys & ~PAGE_MASK) + sizeof(*dst) > PAGE_SIZE)
+		return trace_error(-EINVAL);
+
+	dst = paging_get_guest_pages(NULL, gphys & PAGE_MASK, 1,
+				     PAGE_DEFAULT_FLAGS);
+	if (!dst)
+		return trace_error(-EINVAL);
+	dst = (void *)dst + (gphys & ~PAGE_MASK);
+
+	/* the per-CPU statistics use the layout of struct jailhouse_cpu_stats */
+	memcpy(dst, &public_per_cpu(cpu_id)->stats_revision, sizeof(*dst));
+
+	return 0;
+}
+
+static long cell_get_mmio_stats(struct per_cpu *cpu_data, unsigned long id,
+				unsigned long gphys)
+{
+	struct jailhouse_mmio_stats *stats;
+	struct cell *cell;
+
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
+
+	if (gphys & ~PAGE_MASK)
+		return trace_error(-EINVAL);
+
+	/* see cell_get_state */
+	for_each_cell(cell)
+		if (cell->config->id == id) {
+			stats = paging_get_guest_pages(NULL, gphys, 1,
+						       PAGE_DEFAULT_FLAGS);
+			if (!stats)
+				return trace_error(-EINVAL);
+
+			return mmio_get_stats(cell, stats,
+				(PAGE_SIZE - sizeof(*stats)) /
+				sizeof(stats->regions[0]));
+		}
+	return -ENOENT;
+}
+
+/*
+ * Publish a new timebase of the root cell to all cells. The page is updated
+ * under a sequence counter so that cells can read it without a hypercall.
  */
-long hypercall(unsigned long code, unsigned long arg1, unsigned long arg2)
+static long timebase_update(struct per_cpu *cpu_data, unsigned long gphys)
 {
-	struct per_cpu *cpu_data = this_cpu_data();
+	struct jailhouse_timebase *src, *dst = &timebase_page.timebase;
 
-	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL]++;
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
+
+	/* the argument must not cross a page boundary */
+	if (gphys & 0x7 || (gphys & ~PAGE_MASK) + sizeof(*src) > PAGE_SIZE)
+		return trace_error(-EINVAL);
+
+	src = paging_get_guest_pages(NULL, gphys & PAGE_MASK, 1,
+				     PAGE_READONLY_FLAGS);
+	if (!src)
+		return trace_error(-EINVAL);
+	src = (void *)src + (gphys & ~PAGE_MASK);
+
+	if (src->shift >= 64)
+		return trace_error(-EINVAL);
+
+	spin_lock(&timebase_lock);
+
+	dst->seq++;
+	memory_barrier();
+
+	dst->mult = src->mult;
+	dst->shift = src->shift;
+	dst->cycle_last = src->cycle_last;
+	dst->base_ns = src->base_ns;
 
+	memory_barrier();
+	dst->seq++;
+
+	spin_unlock(&timebase_lock);
+
+	return 0;
+}
+
+static long hypercall_dispatch(struct per_cpu *cpu_data, unsigned long code,
+			       unsigned long arg1, unsigned long arg2);
+
+static struct jailhouse_multicall *multicall_map(unsigned long gphys)
+{
+	void *page = paging_get_guest_pages(NULL, gphys & PAGE_MASK, 1,
+					    PAGE_DEFAULT_FLAGS);
+
+	return page ? page + (gphys & ~PAGE_MASK) : NULL;
+}
+
+/*
+ * Process a batch of hypercalls with a single exit. The batch is mapped again
+ * after each operation because the operation may reuse the temporary mapping.
+ */
+static long multicall(struct per_cpu *cpu_data, unsigned long gphys,
+		      unsigned long num)
+{
+	unsigned long code, arg1, arg2;
+	struct jailhouse_multicall *calls;
+	unsigned int n;
+	long result;
+
+	/* the batch must not cross a page boundary */
+	if (gphys & 0x7 || num == 0 ||
+	    num > (PAGE_SIZE - (gphys & ~PAGE_MASK)) / sizeof(*calls))
+		return trace_error(-EINVAL);
+
+	calls = multicall_map(gphys);
+	if (!calls)
+		return trace_error(-EINVAL);
+
+	for (n = 0; n < num; n++) {
+		code = calls[n].code;
+		arg1 = calls[n].arg1;
+		arg2 = calls[n].arg2;
+
+		if (code == JAILHOUSE_HC_DISABLE ||
+		    code == JAILHOUSE_HC_MULTICALL)
+			result = trace_error(-EINVAL);
+		else
+			result = hypercall_dispatch(cpu_data, code, arg1, arg2);
+
+		/* the operation may also have unmapped the batch */
+		calls = multicall_map(gphys);
+		if (!calls)
+			return trace_error(-EINVAL);
+		calls[n].result = result;
+	}
+
+	return 0;
+}
+
+static long hypercall_dispatch(struct per_cpu *cpu_data, unsigned long code,
+			       unsigned long arg1, unsigned long arg2)
+{
 	switch (code) {
 	case JAILHOUSE_HC_DISABLE:
 		return hypervisor_disable(cpu_data);
 	case JAILHOUSE_HC_CELL_CREATE:
-		return cell_create(cpu_data, arg1);
+		return cell_create(cpu_data, arg1, false);
+	case JAILHOUSE_HC_CELL_CREATE_START:
+		return cell_create(cpu_data, arg1, true);
 	case JAILHOUSE_HC_CELL_START:
 		return cell_start(cpu_data, arg1);
 	case JAILHOUSE_HC_CELL_SET_LOADABLE:
@@ -950,17 +2859,103 @@ long hypercall(unsigned long code, unsigned long arg1, unsigned long arg2)
 		return cell_get_state(cpu_data, arg1);
 	case JAILHOUSE_HC_CPU_GET_INFO:
 		return cpu_get_info(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CPU_GET_STATS:
+		return cpu_get_stats(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_GET_MMIO_STATS:
+		return cell_get_mmio_stats(cpu_data, arg1, arg2);
 	case JAILHOUSE_HC_DEBUG_CONSOLE_PUTC:
 		if (!CELL_FLAGS_VIRTUAL_CONSOLE_PERMITTED(
 			cpu_data->public.cell->config->flags))
 			return trace_error(-EPERM);
-		printk("%c", (char)arg1);
+		cell_console_putc(cpu_data->public.cell, (char)arg1);
+		return 0;
+	case JAILHOUSE_HC_DEBUG_CONSOLE_FLUSH:
+		if (!CELL_FLAGS_VIRTUAL_CONSOLE_PERMITTED(
+			cpu_data->public.cell->config->flags))
+			return trace_error(-EPERM);
+		cell_console_flush(cpu_data->public.cell);
 		return 0;
+	case JAILHOUSE_HC_DEBUG_CONSOLE_PUTS:
+		if (!CELL_FLAGS_VIRTUAL_CONSOLE_PERMITTED(
+			cpu_data->public.cell->config->flags))
+			return trace_error(-EPERM);
+		return cell_console_puts(cpu_data->public.cell, arg1, arg2);
+	case JAILHOUSE_HC_MEM_POOL_DONATE:
+		return mem_pool_grow(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_MEM_POOL_RECLAIM:
+		return mem_pool_shrink(cpu_data, arg1);
+	case JAILHOUSE_HC_MEM_BALLOON:
+		return mem_balloon(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_BALLOON_UPDATE:
+		return cell_balloon_update(cpu_data, arg1);
+	case JAILHOUSE_HC_GCOV_READ:
+		return gcov_read(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_TIMEBASE_UPDATE:
+		return timebase_update(cpu_data, arg1);
+	case JAILHOUSE_HC_CELL_WATCHDOG_SET:
+		return cell_watchdog_set(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_MEM_TRANSFER:
+		return mem_transfer(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_MULTICALL:
+		return multicall(cpu_data, arg1, arg2);
+	case JAILHOUSE_HC_CELL_CPU_ADD:
+		return cell_cpu_move(cpu_data, arg1, arg2, true);
+	case JAILHOUSE_HC_CELL_CPU_REMOVE:
+		return cell_cpu_move(cpu_data, arg1, arg2, false);
+	case JAILHOUSE_HC_CONSOLE_NOTIFY:
+		if (cpu_data->public.cell != &root_cell)
+			return trace_error(-EPERM);
+		return console_notify_set(arg1, arg2);
+	case JAILHOUSE_HC_IOMMU_UPDATE_IRTES:
+		if (cpu_data->public.cell != &root_cell)
+			return trace_error(-EPERM);
+		return arch_iommu_update_irtes(arg1, arg2);
 	default:
 		return -ENOSYS;
 	}
 }
 
+/**
+ * Handle hypercall invoked by a cell.
+ * @param code		Hypercall code.
+ * @param arg1		First hypercall argument.
+ * @param arg2		Seconds hypercall argument.
+ *
+ * @return Value that shall be passed to the caller of the hypercall on return.
+ *
+ * @note If @c arg1 and @c arg2 are valid depends on the hypercall code.
+ */
+long hypercall(unsigned long code, unsigned long arg1, unsigned long arg2)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+	bool cell_mgmt;
+	long result;
+
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL]++;
+
+	switch (code) {
+	case JAILHOUSE_HC_CELL_CREATE:
+	case JAILHOUSE_HC_CELL_CREATE_START:
+	case JAILHOUSE_HC_CELL_START:
+	case JAILHOUSE_HC_CELL_SET_LOADABLE:
+	case JAILHOUSE_HC_CELL_DESTROY:
+	case JAILHOUSE_HC_CELL_CPU_ADD:
+	case JAILHOUSE_HC_CELL_CPU_REMOVE:
+		cell_mgmt = true;
+		break;
+	default:
+		cell_mgmt = false;
+	}
+
+	if (cell_mgmt)
+		trace_event(JAILHOUSE_TRACE_CELL_MGMT, code, arg1);
+	result = hypercall_dispatch(cpu_data, code, arg1, arg2);
+	if (cell_mgmt)
+		trace_event(JAILHOUSE_TRACE_CELL_MGMT_DONE, code, result);
+
+	return result;
+}
+
 /**
  * Stops the current CPU on panic and prevents any execution on it until the
  * system is rebooted.
@@ -1009,6 +3004,7 @@ void panic_park(void)
 		}
 	if (cell_failed)
 		cell->comm_page.comm_region.cell_state = JAILHOUSE_CELL_FAILED;
+	status_page_update_cell(cell);
 
 	arch_panic_park();
 
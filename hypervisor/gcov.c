@@ -9,8 +9,12 @@
  * This work is licensed under the terms of the GNU GPL, version 2.  See
  * the COPYING file in the top-level directory.
  */
+#include <jailhouse/control.h>
 #include <jailhouse/entry.h>
 #include <jailhouse/gcov.h>
+#include <jailhouse/paging.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/string.h>
 
 extern unsigned long __init_array_start[], __init_array_end[];
 
@@ -33,6 +37,33 @@ void gcov_init(void) {
 	}
 }
 
+/*
+ * Copy one page of the hypervisor core, including the gcov data, to the root
+ * cell while the hypervisor is running. The counters keep being updated by
+ * other CPUs, so the copy is only a snapshot.
+ */
+long gcov_read(struct per_cpu *cpu_data, unsigned long offset,
+	       unsigned long gphys)
+{
+	void *page;
+
+	if (cpu_data->public.cell != &root_cell)
+		return -EPERM;
+
+	if ((offset | gphys) & ~PAGE_MASK)
+		return trace_error(-EINVAL);
+	if (offset >= hypervisor_header.core_size)
+		return -ERANGE;
+
+	page = paging_get_guest_pages(NULL, gphys, 1, PAGE_DEFAULT_FLAGS);
+	if (!page)
+		return trace_error(-EINVAL);
+
+	memcpy(page, (void *)&hypervisor_header + offset, PAGE_SIZE);
+
+	return PAGE_SIZE;
+}
+
 void __gcov_init(struct gcov_min_info *info);
 void __gcov_merge_add(void *counters, unsigned int n_counters);
 
@@ -27,6 +27,21 @@ struct cell {
 	union {
 		/** Communication region. */
 		struct jailhouse_comm_region comm_region;
+		struct {
+			u8 __comm_region_space[JAILHOUSE_COMM_CONSOLE_OFFSET];
+			/** Console ring written by the cell. */
+			struct jailhouse_comm_console comm_console;
+		};
+		struct {
+			u8 __comm_watchdog_space[JAILHOUSE_COMM_WATCHDOG_OFFSET];
+			/** Watchdog counter incremented by the cell. */
+			struct jailhouse_comm_watchdog comm_watchdog;
+		};
+		struct {
+			u8 __comm_transfer_space[JAILHOUSE_COMM_TRANSFER_OFFSET];
+			/** Notifications about received transfer chunks. */
+			struct jailhouse_comm_transfer comm_transfer;
+		};
 		/** Padding to full page size. */
 		u8 padding[PAGE_SIZE];
 	} __attribute__((aligned(PAGE_SIZE))) comm_page;
@@ -49,11 +64,28 @@ struct cell {
 	/** True while the cell can be loaded by the root cell. */
 	bool loadable;
 
+	/** Request message to the cell that awaits its reply,
+	 *  JAILHOUSE_MSG_NONE if none. */
+	u32 msg_pending;
+	/** Timestamp at which the pending request times out, 0 if never. */
+	u64 msg_deadline;
+
+	/** Watchdog timeout in read_timestamp() ticks, 0 if disabled. */
+	u64 watchdog_timeout;
+	/** Timestamp of the next watchdog check. */
+	u64 watchdog_deadline;
+	/** Timestamp at which a change of the watchdog counter was seen. */
+	u64 watchdog_kicked;
+	/** Watchdog counter at the last check. */
+	u32 watchdog_count;
+
 	/** Pointer to next cell in the system. */
 	struct cell *next;
 
 	/** List of PCI devices assigned to this cell. */
 	struct pci_device *pci_devices;
+	/** Per-bus tables of pci_devices for BDF lookups, NULL if bus unused. */
+	struct pci_bus_devices **pci_buses;
 
 	/** Lock protecting changes to mmio_locations, mmio_handlers, and
 	 * num_mmio_regions. */
@@ -69,6 +101,40 @@ struct cell {
 	unsigned int num_mmio_regions;
 	/** Maximum number of MMIO regions. */
 	unsigned int max_mmio_regions;
+	/** Per-CPU access counters of the MMIO regions, one cache line
+	 * aligned row per CPU ID, indexed by mmio_region_handler::counter. */
+	u64 *mmio_counters;
+	/** Distance between the counter rows of two CPUs, in counters. */
+	unsigned int mmio_counters_stride;
+	/** Number of counter rows, i.e. highest CPU ID of the cell + 1. */
+	unsigned int mmio_counters_rows;
+	/** Page index of the MMIO regions, NULL if the cell has few regions
+	 * or the index could not be allocated. */
+	struct mmio_page_index *mmio_index;
+
+	/** Lock serializing on-demand mappings of lazily populated memory
+	 * regions. */
+	spinlock_t lazy_map_lock;
+
+	/** Lock protecting the cell console and console_head. */
+	spinlock_t console_lock;
+	/** Number of characters consumed from the console ring of the
+	 * communication page. */
+	unsigned int console_head;
+
+	/** Chunks of the JAILHOUSE_MEM_BALLOON regions the cell wants to hand
+	 * back to the root cell, one bit per chunk in configuration order. */
+	unsigned long *balloon_requested;
+	/** Chunks currently handed back to the root cell. */
+	unsigned long *balloon_released;
+	/** Number of chunks of all JAILHOUSE_MEM_BALLOON regions. */
+	unsigned int balloon_chunks;
+
+	/** Chunks of the JAILHOUSE_MEM_TRANSFER regions the cell currently
+	 * owns, one bit per chunk in configuration order. */
+	unsigned long *transfer_owned;
+	/** Number of chunks of all JAILHOUSE_MEM_TRANSFER regions. */
+	unsigned int transfer_chunks;
 };
 
 extern struct cell root_cell;
@@ -14,10 +14,14 @@
 #include <jailhouse/percpu.h>
 #include <jailhouse/cell.h>
 #include <jailhouse/cell-config.h>
+#include <jailhouse/processor.h>
 
 #define SHUTDOWN_NONE			0
 #define SHUTDOWN_STARTED		1
 
+/** VM exits between two refreshes of the stack high-water mark, power of 2. */
+#define STACK_USAGE_INTERVAL		1024
+
 extern volatile unsigned long panic_in_progress;
 extern unsigned long panic_cpu;
 
@@ -32,6 +36,13 @@ extern unsigned long panic_cpu;
  */
 
 extern struct jailhouse_system *system_config;
+extern struct jailhouse_status_page status_page;
+extern union timebase_page {
+	struct jailhouse_timebase timebase;
+	/** Padding to full page size, the page is mapped into cells. */
+	u8 padding[PAGE_SIZE];
+} timebase_page;
+extern const u8 empty_page[];
 
 unsigned int next_cpu(unsigned int cpu, struct cpu_set *cpu_set,
 		      int exception);
@@ -117,12 +128,85 @@ static inline bool cell_owns_cpu(struct cell *cell, unsigned int cpu_id)
 		test_bit(cpu_id, cell->cpu_set->bitmap));
 }
 
+/**
+ * Refresh JAILHOUSE_CPU_STAT_STACK_MAX_USAGE of a CPU.
+ * @param cpu_data	Per-CPU data of the CPU.
+ *
+ * The stack depth used so far is derived from the words at the bottom of the
+ * stack that still carry STACK_UNUSED_PATTERN.
+ */
+void cpu_update_stack_usage(struct per_cpu *cpu_data);
+
+/**
+ * Account the duration of a VM exit in the latency histograms of a CPU.
+ * @param cpu_public	Public per-CPU data of the CPU that handled the exit.
+ * @param stat		Statistic counter (JAILHOUSE_CPU_STAT_VMEXITS_*) of the
+ * 			exit reason or JAILHOUSE_CPU_STAT_VMEXITS_TOTAL if the
+ * 			reason has no dedicated counter.
+ * @param start		Timestamp taken via read_timestamp() on exit entry.
+ *
+ * The exit is always accounted in the histogram of
+ * JAILHOUSE_CPU_STAT_VMEXITS_TOTAL as well. The longest exit observed so far
+ * is recorded in JAILHOUSE_CPU_STAT_MAX_EXIT_TICKS. Every
+ * STACK_USAGE_INTERVAL exits, the stack high-water mark is refreshed.
+ */
+static inline void cpu_account_exit_latency(struct public_per_cpu *cpu_public,
+					    unsigned int stat, u64 start)
+{
+	u64 ticks = read_timestamp() - start;
+	unsigned int bucket = ticks ? 63 - __builtin_clzll(ticks) : 0;
+
+	if (bucket >= JAILHOUSE_EXIT_LATENCY_BUCKETS)
+		bucket = JAILHOUSE_EXIT_LATENCY_BUCKETS - 1;
+
+	cpu_public->exit_latency[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL][bucket]++;
+	if (stat != JAILHOUSE_CPU_STAT_VMEXITS_TOTAL)
+		cpu_public->exit_latency[stat][bucket]++;
+
+	if (ticks > cpu_public->stats[JAILHOUSE_CPU_STAT_MAX_EXIT_TICKS])
+		cpu_public->stats[JAILHOUSE_CPU_STAT_MAX_EXIT_TICKS] = ticks;
+
+	if ((cpu_public->stats[JAILHOUSE_CPU_STAT_VMEXITS_TOTAL] &
+	     (STACK_USAGE_INTERVAL - 1)) == 0)
+		cpu_update_stack_usage(this_cpu_data());
+}
+
+/**
+ * Record the start of a VM exit for the test device.
+ * @param cpu_public	Public per-CPU data of the CPU that handles the exit.
+ * @param start		Timestamp taken via read_timestamp() on exit entry.
+ */
+static inline void cpu_record_exit_start(struct public_per_cpu *cpu_public,
+					 u64 start)
+{
+#ifdef CONFIG_TEST_DEVICE
+	cpu_public->testdev_exit_start = start;
+#endif
+}
+
 bool cpu_id_valid(unsigned long cpu_id);
 
 int cell_init(struct cell *cell);
 
+/**
+ * Map the chunk of a lazily populated region on first access.
+ * @param gphys	Guest-physical address that caused the stage-2 fault.
+ *
+ * Only applies to cells with JAILHOUSE_CELL_LAZY_MEMORY. The caller has to
+ * restart the faulting instruction if the chunk was mapped.
+ *
+ * @return True if the address belongs to a lazy region and was mapped.
+ */
+bool cell_map_lazy(unsigned long gphys);
+
 void config_commit(struct cell *cell_added_removed);
 
+void status_page_update(void);
+
+void watchdog_check(void);
+
+void scrub_memory_assist(void);
+
 long hypercall(unsigned long code, unsigned long arg1, unsigned long arg2);
 
 void shutdown(void);
@@ -136,7 +220,7 @@ void panic_park(void);
  *
  * @note This function must not be invoked for the caller's CPU.
  *
- * @see suspend_cpu
+ * @see request_cpu_suspension
  */
 void resume_cpu(unsigned int cpu_id);
 
@@ -150,7 +234,7 @@ void resume_cpu(unsigned int cpu_id);
  * @note This function must not be invoked for the caller's CPU or if the
  * target CPU is not in suspend state.
  *
- * @see suspend_cpu
+ * @see request_cpu_suspension
  */
 void arch_reset_cpu(unsigned int cpu_id);
 
@@ -169,7 +253,7 @@ void arch_reset_cpu(unsigned int cpu_id);
  * @note This function must not be invoked for the caller's CPU or if the
  * target CPU is not in suspend state.
  *
- * @see suspend_cpu
+ * @see request_cpu_suspension
  */
 void arch_park_cpu(unsigned int cpu_id);
 
@@ -199,16 +283,51 @@ int arch_map_memory_region(struct cell *cell,
 int arch_unmap_memory_region(struct cell *cell,
 			     const struct jailhouse_memory *mem);
 
+/**
+ * Determine the next physically contiguous run of a memory region.
+ * @param mem		Memory region to walk.
+ * @param offset	Offset into the region from where to search. Updated
+ * 			to the start of the run.
+ * @param size		Set to the size of the run.
+ *
+ * @return True if a run was found, false if the region is exhausted.
+ *
+ * @note The run is only a subset of the remaining region if the
+ * architecture interleaves the region with memory of other cells, e.g. due
+ * to cache coloring.
+ */
+bool arch_mem_region_next_run(const struct jailhouse_memory *mem,
+			      unsigned long *offset, unsigned long *size);
+
+/**
+ * Overwrite memory with zeros before handing it over to another cell.
+ * @param addr		Hypervisor address of the memory.
+ * @param size		Size of the memory, multiple of the page size.
+ *
+ * The zeros have to reach the memory before the function returns, and the
+ * stores should bypass the caches where possible.
+ */
+void arch_scrub_memory(void *addr, unsigned long size);
+
+/** Size argument of arch_flush_cell_vcpu_caches() to flush all mappings. */
+#define FLUSH_ALL_SIZE		(~0UL)
+
 /**
  * Performs the architecture-specific steps for invalidating memory caches
  * after memory regions have been unmapped from a cell.
  * This function should be called after memory got unmapped or memory access
  * got restricted, and the cell should keep running.
  * @param cell		Cell for which the caches should get flushed
+ * @param start		Guest-physical start address of the modified range.
+ * @param size		Size of the modified range, @c FLUSH_ALL_SIZE to drop
+ * 			all translations of the cell.
+ *
+ * @note Architectures may invalidate more than the given range.
  *
  * @see public_per_cpu::flush_vcpu_caches
  */
-void arch_flush_cell_vcpu_caches(struct cell *cell);
+void arch_flush_cell_vcpu_caches(struct cell *cell, unsigned long start,
+				 unsigned long size);
 
 /**
  * Performs the architecture-specific steps for creating a new cell.
@@ -239,6 +358,20 @@ void arch_cell_destroy(struct cell *cell);
  */
 void arch_cell_reset(struct cell *cell);
 
+/**
+ * Performs the architecture-specific steps for moving a CPU between cells.
+ * @param cpu_id	ID of the CPU to be moved.
+ * @param from		Cell the CPU currently belongs to.
+ * @param to		Cell the CPU will belong to.
+ *
+ * @note Both cells are suspended. The CPU will be parked afterwards and is
+ * started by its new cell like a hot-plugged one.
+ *
+ * @see arch_park_cpu
+ */
+void arch_cell_cpu_move(unsigned int cpu_id, struct cell *from,
+			struct cell *to);
+
 /**
  * Performs the architecture-specific steps for applying configuration changes.
  * @param cell_added_removed	Cell that was added or removed to/from the
@@ -249,6 +382,52 @@ void arch_cell_reset(struct cell *cell);
  */
 void arch_config_commit(struct cell *cell_added_removed);
 
+/**
+ * Get the frequency of the counter returned by read_timestamp().
+ *
+ * @return Frequency in kHz, 0 if unknown.
+ */
+unsigned long arch_timestamp_khz(void);
+
+/**
+ * Inject an interrupt into the calling CPU on behalf of the test device.
+ * @param irq		Interrupt vector (x86) or ID (ARM).
+ *
+ * @return 0 on success, negative error code if the interrupt cannot be
+ * 	   delivered to the calling cell.
+ */
+int arch_testdev_inject_irq(unsigned int irq);
+
+/**
+ * Program a timer that interrupts the calling CPU at the given time so that
+ * watchdog_check() is called.
+ * @param deadline	Expiry time as read_timestamp() value, 0 to cancel.
+ *
+ * @return 0 on success, -ENOSYS if the watchdog cannot be supported.
+ *
+ * @note Only called on CPUs of the root cell, on VM exits.
+ */
+int arch_watchdog_timer_set(u64 deadline);
+
+/**
+ * Read a cache or memory bandwidth monitoring counter of a cell.
+ * @param cell		Cell to be monitored.
+ * @param event		Monitoring event (JAILHOUSE_QOS_*).
+ *
+ * @return Counter value, truncated to 31 bits, or negative error code.
+ */
+long arch_cell_get_qos_info(struct cell *cell, unsigned int event);
+
+/**
+ * Apply interrupt remapping table entries the root cell modified.
+ * @param desc_addr	Guest-physical address of an array of
+ * 			struct jailhouse_irte_update.
+ * @param count		Number of array elements.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+long arch_iommu_update_irtes(unsigned long desc_addr, unsigned long count);
+
 /**
  * Architecture-specific preparations before shutting down the hypervisor.
  */
@@ -22,6 +22,7 @@
 #define ENOENT		2
 #define EIO		5
 #define E2BIG		7
+#define EAGAIN		11
 #define ENOMEM		12
 #define EBUSY		16
 #define EEXIST		17
@@ -76,6 +77,15 @@ int arch_entry(unsigned int cpu_id);
  */
 int entry(unsigned int cpu_id, struct per_cpu *cpu_data);
 
+/**
+ * Retrieve the duration of a setup phase or unit initialization.
+ * @param type		JAILHOUSE_INFO_SETUP_TIME_BASE + phase or
+ * 			JAILHOUSE_INFO_UNIT_SETUP_TIME_BASE + unit index.
+ *
+ * @return Duration in timer ticks or -EINVAL if the type is unknown.
+ */
+long setup_get_time(unsigned long type);
+
 /**
  * Perform architecture-specific early setup steps.
  *
@@ -10,8 +10,20 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <jailhouse/entry.h>
+
+struct per_cpu;
+
 #ifdef CONFIG_JAILHOUSE_GCOV
 void gcov_init(void);
+long gcov_read(struct per_cpu *cpu_data, unsigned long offset,
+	       unsigned long gphys);
 #else
 static inline void gcov_init(void) {}
+
+static inline long gcov_read(struct per_cpu *cpu_data, unsigned long offset,
+			     unsigned long gphys)
+{
+	return -ENOSYS;
+}
 #endif
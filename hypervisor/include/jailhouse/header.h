@@ -10,6 +10,9 @@
  * the COPYING file in the top-level directory.
  */
 
+#ifndef _JAILHOUSE_HEADER_H
+#define _JAILHOUSE_HEADER_H
+
 #include <asm/jailhouse_header.h>
 
 #define JAILHOUSE_SIGNATURE	"JAILHOUS"
@@ -46,6 +49,84 @@ struct jailhouse_virt_console {
 	char content[2048];
 };
 
+/** Size of the per-cell console content, must be a power of two. */
+#define JAILHOUSE_CELL_CONSOLE_SIZE	4096
+
+/**
+ * Console of a single cell, written by the hypervisor and read-only accessible
+ * for the root cell. Follows the protocol of struct jailhouse_virt_console.
+ */
+struct jailhouse_cell_console {
+	unsigned int busy;
+	unsigned int tail;
+	char content[JAILHOUSE_CELL_CONSOLE_SIZE];
+};
+
+/** Number of records per trace buffer, must be a power of two. */
+#define JAILHOUSE_TRACE_RECORDS		512
+
+#define JAILHOUSE_TRACE_VMEXIT		1	/* arg1: arch exit reason */
+#define JAILHOUSE_TRACE_MMIO		2	/* arg1: address, arg2: is_write */
+#define JAILHOUSE_TRACE_IRQ_PENDING	3	/* arg1: target CPU, arg2: IRQ */
+#define JAILHOUSE_TRACE_IVSHMEM_IRQ	4	/* arg1: target cell ID,
+						   arg2: vector */
+#define JAILHOUSE_TRACE_SAMPLE		5	/* arg1: hypervisor PC */
+#define JAILHOUSE_TRACE_CELL_MGMT	6	/* arg1: hypercall code,
+						   arg2: argument */
+#define JAILHOUSE_TRACE_CELL_MGMT_DONE	7	/* arg1: hypercall code,
+						   arg2: result */
+
+struct jailhouse_trace_record {
+	unsigned long long timestamp;
+	unsigned int cpu;
+	unsigned int event;
+	unsigned long long arg1;
+	unsigned long long arg2;
+};
+
+/**
+ * Per-CPU trace buffer, written by the hypervisor without locking and
+ * read-only accessible for the root cell.
+ */
+struct jailhouse_trace_buffer {
+	/** Number of records written so far. Incremented after the record at
+	 *  records[tail % JAILHOUSE_TRACE_RECORDS] has been completed. */
+	unsigned int tail;
+	unsigned int padding[7];
+	struct jailhouse_trace_record records[JAILHOUSE_TRACE_RECORDS];
+};
+
+/** Maximum number of cells listed in the status page. */
+#define JAILHOUSE_STATUS_MAX_CELLS	170
+
+/** Status of a single cell, see struct jailhouse_status_page. */
+struct jailhouse_cell_status {
+	unsigned int id;
+	unsigned int num_cpus;
+	/** Number of CPUs of the cell that are parked after a failure. */
+	unsigned int failed_cpus;
+	/** Number of balloon chunks whose release or reclaim the cell
+	 *  requested but the root cell did not apply yet. */
+	unsigned int balloon_pending;
+	/** Offset of the cell's communication page inside the hypervisor
+	 *  memory, 0 if it is not readable for the root cell. */
+	unsigned long long comm_page;
+};
+
+/**
+ * Cell list maintained by the hypervisor and read-only accessible for the
+ * root cell. The state of a cell is read from its communication page.
+ */
+struct jailhouse_status_page {
+	/** Incremented before and after each update, odd while the page is
+	 *  being modified. */
+	unsigned int generation;
+	/** Number of valid entries in cells. */
+	unsigned int num_cells;
+	unsigned int padding[2];
+	struct jailhouse_cell_status cells[JAILHOUSE_STATUS_MAX_CELLS];
+};
+
 /**
  * Hypervisor description.
  * Located at the beginning of the hypervisor binary image and loaded by
@@ -73,6 +154,23 @@ struct jailhouse_header {
 	/** Pointer to the first struct gcov_info
 	 * @note Filled at build time */
 	void *gcov_info_head;
+	/** Offset of the trace buffer inside the per-CPU data structure, 0 if
+	 * the hypervisor was built without CONFIG_TRACE_EVENTS and
+	 * CONFIG_PROFILE_SAMPLING.
+	 * @note Filled at build time. */
+	unsigned long trace_buffer;
+	/** Offset of the cell console inside the per-CPU data structure. The
+	 * console of a cell is located at its first CPU.
+	 * @note Filled at build time. */
+	unsigned long cell_console;
+	/** Offset of the CPU statistics (struct jailhouse_cpu_stats) inside
+	 * the per-CPU data structure.
+	 * @note Filled at build time. */
+	unsigned long cpu_stats;
+	/** Offset of the status page (struct jailhouse_status_page) inside
+	 * the hypervisor memory.
+	 * @note Filled at build time. */
+	unsigned long status_page;
 
 	/** Configured maximum logical CPU ID + 1.
 	 * @note Filled by Linux loader driver before entry. */
@@ -94,3 +192,5 @@ struct jailhouse_header {
 };
 
 #endif /* !__ASSEMBLY__ */
+
+#endif /* !_JAILHOUSE_HEADER_H */
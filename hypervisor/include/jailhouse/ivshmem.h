@@ -15,11 +15,16 @@
 #define _JAILHOUSE_IVSHMEM_H
 
 #include <jailhouse/pci.h>
+
+#define IVSHMEM_MAX_PEERS		16
+#define IVSHMEM_MAX_MSIX_VECTORS	PCI_EMBEDDED_MSIX_VECTS
+
 #include <asm/ivshmem.h>
 #include <asm/spinlock.h>
 
 #define IVSHMEM_CFG_MSIX_CAP	0x50
-#define IVSHMEM_CFG_SIZE	(IVSHMEM_CFG_MSIX_CAP + 12)
+/* followed by the section registers, see ivshmem.c */
+#define IVSHMEM_CFG_SIZE	0x78
 
 #define IVSHMEM_INTX_ENABLE	0x1
 
@@ -28,6 +33,8 @@
  * @{
  */
 
+struct ivshmem_link;
+
 struct ivshmem_endpoint {
 	u32 cspace[IVSHMEM_CFG_SIZE / sizeof(u32)];
 	u32 ivpos;
@@ -36,10 +43,15 @@ struct ivshmem_endpoint {
 	u64 bar4_address;
 	struct pci_device *device;
 	const struct jailhouse_memory *shmem;
-	struct ivshmem_endpoint *remote;
-	spinlock_t remote_lock;
+	/** State table region of the cell's config, NULL without sections. */
+	const struct jailhouse_memory *sections;
+	struct ivshmem_link *link;
+	/** Serializes interrupt delivery to this endpoint with its removal. */
+	spinlock_t irq_lock;
 	struct arch_pci_ivshmem arch;
 	u32 intx_ctrl_reg;
+	/** Vector raised on state changes of other peers, see STATE_VEC. */
+	u32 state_vec_reg;
 };
 
 int ivshmem_init(struct cell *cell, struct pci_device *device);
@@ -51,21 +63,28 @@ enum pci_access ivshmem_pci_cfg_write(struct pci_device *device,
 enum pci_access ivshmem_pci_cfg_read(struct pci_device *device, u16 address,
 				     u32 *value);
 
-bool ivshmem_is_msix_masked(struct ivshmem_endpoint *ive);
+bool ivshmem_is_msix_masked(struct ivshmem_endpoint *ive,
+			    unsigned int vector);
 
 /**
  * Trigger interrupt on ivshmem endpoint.
  * @param ive		Ivshmem endpoint the interrupt should be raised at.
+ * @param vector	MSI-X vector to be raised. Only vector 0 exists if the
+ * 			endpoint uses INTx.
  */
-void arch_ivshmem_trigger_interrupt(struct ivshmem_endpoint *ive);
+void arch_ivshmem_trigger_interrupt(struct ivshmem_endpoint *ive,
+				    unsigned int vector);
 
 /**
- * Update cached MSI-X state (if any) of the given ivshmem device.
+ * Update cached MSI-X state of one vector of the given ivshmem device.
  * @param device	The device to be updated.
+ * @param vector	MSI-X vector whose route should be updated.
  *
  * @return 0 on success, negative error code otherwise.
+ *
+ * @see ivshmem_update_msix
  */
-int arch_ivshmem_update_msix(struct pci_device *device);
+int arch_ivshmem_update_msix(struct pci_device *device, unsigned int vector);
 
 /**
  * Update cached INTx state (if any) of the given ivshmem device.
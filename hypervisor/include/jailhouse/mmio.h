@@ -18,6 +18,7 @@
 #include <jailhouse/cell-config.h>
 
 struct cell;
+struct jailhouse_mmio_stats;
 
 /**
  * @defgroup IO I/O Access Subsystem
@@ -157,25 +158,81 @@ struct mmio_region_handler {
 	mmio_handler function;
 	/** Argument to pass to the function. */
 	void *arg;
+	/** Name of the handler, reported along with the access counts. */
+	const char *name;
+	/** Slot of the region's access counters in cell::mmio_counters. */
+	unsigned int counter;
+};
+
+/** Number of entries in the per-CPU MMIO region cache. */
+#define MMIO_REGION_CACHE_SIZE		4
+
+/** Cached result of a MMIO region lookup. */
+struct mmio_region_cache_entry {
+	/** Location of the cached region. A size of 0 marks an unused entry. */
+	struct mmio_region_location location;
+	/** Handler of the cached region. */
+	struct mmio_region_handler handler;
+};
+
+/** Per-CPU cache of recently resolved MMIO regions. */
+struct mmio_region_cache {
+	/** Cell the entries were resolved for. */
+	struct cell *cell;
+	/** Value of cell::mmio_generation the entries are valid for. */
+	unsigned long generation;
+	/** Index of the entry to be replaced next. */
+	unsigned int next;
+	/** Cached regions. */
+	struct mmio_region_cache_entry entries[MMIO_REGION_CACHE_SIZE];
+};
+
+/** Maximum number of writes a CPU buffers before committing them. */
+#define MMIO_POSTED_WRITES		8
+
+/**
+ * Per-CPU buffer of writes to a JAILHOUSE_MEM_IO_POSTED region that were
+ * acknowledged to the cell but not yet performed.
+ */
+struct mmio_posted_writes {
+	/** Hypervisor address of the region the writes target. */
+	void *base;
+	/** Region descriptor the writes were validated against. */
+	const void *region;
+	/** Number of buffered writes. */
+	unsigned int count;
+	/** Buffered writes, offsets are relative to @a base. */
+	struct mmio_access writes[MMIO_POSTED_WRITES];
 };
 
 int mmio_cell_init(struct cell *cell);
 
 void mmio_region_register(struct cell *cell, unsigned long start,
 			  unsigned long size, mmio_handler handler,
-			  void *handler_arg);
+			  void *handler_arg, const char *name);
 void mmio_region_unregister(struct cell *cell, unsigned long start);
 
 enum mmio_result mmio_handle_access(struct mmio_access *mmio);
 
+unsigned int mmio_get_stats(struct cell *cell,
+			    struct jailhouse_mmio_stats *stats,
+			    unsigned int max_regions);
+
+void mmio_region_cache_flush(struct mmio_region_cache *cache);
+
 void mmio_cell_exit(struct cell *cell);
 
 void mmio_perform_access(void *base, struct mmio_access *mmio);
 
+void mmio_flush_posted_writes(void);
+
 int mmio_subpage_register(struct cell *cell,
 			  const struct jailhouse_memory *mem);
 void mmio_subpage_unregister(struct cell *cell,
 			     const struct jailhouse_memory *mem);
+int mmio_subpage_restrict(struct cell *cell, unsigned long start,
+			  unsigned long offset, unsigned long size,
+			  unsigned long flags);
 
 /** @} */
 #endif /* !_JAILHOUSE_MMIO_H */
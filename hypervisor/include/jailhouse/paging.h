@@ -40,6 +40,16 @@
 #include <jailhouse/entry.h>
 #include <jailhouse/types.h>
 
+/** Current target of a temporary mapping slot of a CPU. */
+struct temporary_mapping {
+	/** Mapped physical address or INVALID_PHYS_ADDR if unused. */
+	unsigned long phys;
+	/** Access flags of the mapping, see @ref PAGE_FLAGS. */
+	unsigned long flags;
+	/** Value of the CPU's use counter on the last access. */
+	unsigned long last_use;
+};
+
 /** Page pool state. */
 struct page_pool {
 	/** Base address of the pool. */
@@ -50,7 +60,13 @@ struct page_pool {
 	unsigned long used_pages;
 	/** Bitmap of used pages. */
 	unsigned long *used_bitmap;
-	/** Set @c PAGE_SCRUB_ON_FREE to zero-out pages on release. */
+	/** Bitmap of completely used words in @c used_bitmap, allows to skip
+	 *  used ranges quickly. */
+	unsigned long *full_bitmap;
+	/** Bitmap of released pages that still need to be zeroed out before
+	 *  they are handed out again. */
+	unsigned long *scrub_bitmap;
+	/** Set @c PAGE_SCRUB_ON_FREE to zero-out released pages. */
 	unsigned long flags;
 };
 
@@ -162,6 +178,11 @@ struct paging_structures {
 	/** Reference to root-level page table, ignored if root_paging is NULL.
 	 */
 	page_table_t root_table;
+	/** Pool for page table pages, mem_pool if NULL. */
+	struct page_pool *pt_pool;
+	/** True if tables must not be merged into hugepages because mappings
+	 *  are added while CPUs use the structures, see paging_create. */
+	bool no_merge;
 };
 
 /**
@@ -176,6 +197,27 @@ struct guest_paging_structures {
 	unsigned long root_table_gphys;
 };
 
+/** Number of entries in the per-CPU guest page table location cache. */
+#define GUEST_PT_CACHE_SIZE		8
+
+/** Cached physical location of a guest page table. */
+struct guest_pt_cache_entry {
+	/** Guest-physical address or INVALID_PHYS_ADDR if unused. */
+	unsigned long gphys;
+	/** Physical address backing the page table. */
+	unsigned long phys;
+};
+
+/** Per-CPU cache of guest page table locations. */
+struct guest_pt_cache {
+	/** Guest mapping generation the entries are valid for. */
+	unsigned long generation;
+	/** Index of the entry to be replaced next. */
+	unsigned int next;
+	/** Cached page table locations. */
+	struct guest_pt_cache_entry entries[GUEST_PT_CACHE_SIZE];
+};
+
 #include <asm/paging_modes.h>
 
 extern unsigned long page_offset;
@@ -191,6 +233,18 @@ unsigned long paging_get_phys_invalid(pt_entry_t pte, unsigned long virt);
 void *page_alloc(struct page_pool *pool, unsigned int num);
 void *page_alloc_aligned(struct page_pool *pool, unsigned int num);
 void page_free(struct page_pool *pool, void *first_page, unsigned int num);
+unsigned long page_pool_free_extents(struct page_pool *pool,
+				     unsigned long *largest);
+
+int mem_pool_donate(unsigned long phys, unsigned long size);
+int mem_pool_reclaim(unsigned long phys, unsigned long *size);
+bool mem_pool_donated(unsigned long phys, unsigned long size);
+void mem_pool_get_usage(unsigned long *pages, unsigned long *used);
+
+struct cell;
+
+struct page_pool *numa_local_pool(unsigned int cpu);
+struct page_pool *numa_cell_pool(struct cell *cell);
 
 /**
  * Translate virtual hypervisor address to physical address.
@@ -240,23 +294,44 @@ unsigned long paging_virt2phys(const struct paging_structures *pg_structs,
  */
 unsigned long arch_paging_gphys2phys(unsigned long gphys, unsigned long flags);
 
+struct cell;
+
+/**
+ * Get the paging structures that translate guest-physical addresses of the
+ * given cell (second-stage translation: EPT, NPT or stage-2 tables).
+ * @param cell		Cell to look up.
+ *
+ * @return Reference to the cell's paging structures.
+ */
+const struct paging_structures *arch_paging_cell_structs(struct cell *cell);
+
 int paging_create(const struct paging_structures *pg_structs,
 		  unsigned long phys, unsigned long size, unsigned long virt,
 		  unsigned long flags, enum paging_coherent coherent);
 int paging_destroy(const struct paging_structures *pg_structs,
 		   unsigned long virt, unsigned long size,
 		   enum paging_coherent coherent);
+unsigned long paging_max_page_size(const struct paging_structures *pg_structs);
+void paging_count_entries(const struct paging_structures *pg_structs,
+			  unsigned long virt, unsigned long size,
+			  unsigned long entries[MAX_PAGE_TABLE_LEVELS]);
 
 void *paging_map_device(unsigned long phys, unsigned long size);
 void paging_unmap_device(unsigned long phys, void *virt, unsigned long size);
 
 int paging_create_hvpt_link(const struct paging_structures *pg_dest_structs,
 			    unsigned long virt);
+int paging_link_numa_pools(const struct paging_structures *pg_structs);
 
 void *paging_get_guest_pages(const struct guest_paging_structures *pg_structs,
 			     unsigned long gaddr, unsigned int num,
 			     unsigned long flags);
 
+void paging_reset_temporary(struct per_cpu *cpu_data);
+void paging_guest_pt_cache_invalidate(void);
+void *paging_map_temporary(unsigned long phys, unsigned int num,
+			   unsigned long flags);
+
 int paging_map_all_per_cpu(unsigned int cpu, bool enable);
 
 int paging_init(void);
@@ -24,12 +24,15 @@
 # define PCI_STS_CAPS		(1 << 4)
 #define PCI_CFG_BAR		0x10
 # define PCI_BAR_64BIT		0x4
+# define PCI_BAR_PREFETCH	0x8
 #define PCI_CFG_BAR_END		0x27
 #define PCI_CFG_ROMBAR		0x30
 #define PCI_CFG_CAPS		0x34
 #define PCI_CFG_INT		0x3c
 
 #define PCI_CONFIG_HEADER_SIZE	0x40
+/* End of the config space covered by pci_device::cap_lookup */
+#define PCI_CAP_LOOKUP_END	0x100
 
 #define PCI_NUM_BARS		6
 
@@ -61,6 +64,12 @@ struct ivshmem_endpoint;
 /** Extract PCI bus, device and function as parameter list from BDF form. */
 #define PCI_BDF_PARAMS(bdf)	(bdf) >> 8, ((bdf) >> 3) & 0x1f, (bdf) & 7
 
+/** Number of buses addressable via a BDF. */
+#define PCI_NUM_BUSES		256
+
+/** Capability lookup entry that requires a search. */
+#define PCI_CAP_LOOKUP_SEARCH	0xff
+
 /** MSI-X vectors supported per device without extra allocation. */
 #define PCI_EMBEDDED_MSIX_VECTS	16
 
@@ -129,6 +138,15 @@ struct pci_device {
 	struct cell *cell;
 	/** Shadow BAR */
 	u32 bar[PCI_NUM_BARS];
+	/** Shadow of the read-only header dwords, see pci_header_shadowed(). */
+	u32 header_shadow[PCI_CONFIG_HEADER_SIZE / 4];
+	/**
+	 * Capability lookup per dword from PCI_CONFIG_HEADER_SIZE to
+	 * PCI_CAP_LOOKUP_END: 0 if no capability is covering the dword,
+	 * PCI_CAP_LOOKUP_SEARCH if the dword is only partially covered,
+	 * otherwise the index of the capability plus one.
+	 */
+	u8 cap_lookup[(PCI_CAP_LOOKUP_END - PCI_CONFIG_HEADER_SIZE) / 4];
 
 	/** Shadow state of MSI config space registers. */
 	union pci_msi_registers msi_registers;
@@ -145,6 +163,14 @@ struct pci_device {
 	union pci_msix_vector msix_vector_array[PCI_EMBEDDED_MSIX_VECTS];
 };
 
+/**
+ * Devices of a cell on one PCI bus.
+ */
+struct pci_bus_devices {
+	/** Devices indexed by device/function, NULL if not configured. */
+	struct pci_device *devfn[256];
+};
+
 u32 pci_read_config(u16 bdf, u16 address, unsigned int size);
 void pci_write_config(u16 bdf, u16 address, u32 value, unsigned int size);
 
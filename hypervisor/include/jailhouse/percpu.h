@@ -20,6 +20,7 @@
  */
 
 #include <jailhouse/cell.h>
+#include <jailhouse/header.h>
 #include <asm/percpu.h>
 
 /**
@@ -27,39 +28,98 @@
  * @{
  */
 
-/** Per-CPU states accessible across all CPUs. */
+/**
+ * Size of the cache lines that separate the field groups of struct
+ * public_per_cpu.
+ */
+#define CACHE_LINE_SIZE		64
+
+/** Content of stack words the CPU has not used since its setup. */
+#define STACK_UNUSED_PATTERN	((unsigned long)0x5a5a5a5a5a5a5a5aULL)
+
+/**
+ * Per-CPU states accessible across all CPUs.
+ *
+ * Fields are grouped by the CPUs accessing them so that remote CPUs posting
+ * requests or polling the state do not keep stealing the cache line holding
+ * the fields the owning CPU uses on every VM exit, and vice versa.
+ */
 struct public_per_cpu {
 	/** Per-CPU root page table. Public because it has to be accessible for
 	 *  page walks at any time. */
 	u8 root_table_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
 
+	/* Mostly accessed by the owning CPU. */
+
 	/** Logical CPU ID (same as Linux). */
 	unsigned int cpu_id;
 	/** Owning cell. */
 	struct cell *cell;
 
-	/** Statistic counters. */
-	u32 stats[JAILHOUSE_NUM_CPU_STATS];
+	/** Duration of the CPU's setup in timer ticks. */
+	u64 setup_ticks;
+	/** True if CPU violated a cell boundary or cause some other failure in
+	 *  guest mode. */
+	bool failed;
+#ifdef CONFIG_PROFILE_SAMPLING
+	/** True while trace_event() is writing a record, samples taken in the
+	 *  meantime are dropped. */
+	volatile bool trace_busy;
+#endif
+#ifdef CONFIG_TEST_DEVICE
+	/** Timestamp at which the current VM exit was taken. */
+	u64 testdev_exit_start;
+	/** Exit timestamp latched by the last read of the test device's
+	 *  timestamp register. */
+	u64 testdev_exit_time;
+	/** Test device accumulator, cleared on read. */
+	u64 testdev_accumulator;
+	/** Ticks the test device waits before injecting an interrupt. */
+	u64 testdev_irq_delay;
+	/** Timestamp at which the test device injected its last interrupt. */
+	u64 testdev_irq_time;
+#endif
+
+	ARCH_PUBLIC_PERCPU_FIELDS;
 
+	/* Written by other CPUs to request actions from the owning one. */
+
+	/** Set to true for instructing the CPU to suspend. */
+	volatile bool suspend_cpu __attribute__((aligned(CACHE_LINE_SIZE)));
+	/** Set to true for a pending TLB flush for the paging layer that does
+	 *  host physical <-> guest physical memory mappings. */
+	bool flush_vcpu_caches;
 	/** State of the shutdown process. Possible values:
 	 * @li SHUTDOWN_NONE: no shutdown in progress
 	 * @li SHUTDOWN_STARTED: shutdown in progress
 	 * @li negative error code: shutdown failed
 	 */
 	int shutdown_state;
-	/** True if CPU violated a cell boundary or cause some other failure in
-	 *  guest mode. */
-	bool failed;
 
-	/** Set to true for instructing the CPU to suspend. */
-	volatile bool suspend_cpu;
+	ARCH_PUBLIC_PERCPU_CONTROL_FIELDS;
+
+	/* Written by the owning CPU, polled by others. */
+
 	/** True if CPU is suspended. */
-	volatile bool cpu_suspended;
-	/** Set to true for a pending TLB flush for the paging layer that does
-	 *  host physical <-> guest physical memory mappings. */
-	bool flush_vcpu_caches;
+	volatile bool cpu_suspended __attribute__((aligned(CACHE_LINE_SIZE)));
 
-	ARCH_PUBLIC_PERCPU_FIELDS;
+	ARCH_PUBLIC_PERCPU_STATE_FIELDS;
+
+	/** Statistics (struct jailhouse_cpu_stats), mapped read-only into the
+	 *  root cell. */
+	struct {
+		JAILHOUSE_CPU_STATS_FIELDS
+	} __attribute__((aligned(PAGE_SIZE)));
+
+	/** Console of the cell this CPU is the first one of, mapped read-only
+	 *  into the root cell. */
+	struct jailhouse_cell_console cell_console
+		__attribute__((aligned(PAGE_SIZE)));
+
+#if defined(CONFIG_TRACE_EVENTS) || defined(CONFIG_PROFILE_SAMPLING)
+	/** Event trace buffer, mapped read-only into the root cell. */
+	struct jailhouse_trace_buffer trace __attribute__((aligned(PAGE_SIZE)));
+#endif
 } __attribute__((aligned(PAGE_SIZE)));
 
 /** Per-CPU states. */
@@ -78,8 +138,25 @@ struct per_cpu {
 	/** Per-CPU paging structures. */
 	struct paging_structures pg_structs;
 
+	/** Recently resolved MMIO regions of the owning cell. */
+	struct mmio_region_cache mmio_cache;
+	/** Writes to posted MMIO regions that are still to be performed. */
+	struct mmio_posted_writes mmio_posted;
+
+	/** Current targets of the temporary mapping slots. */
+	struct temporary_mapping temp_mappings[NUM_TEMPORARY_PAGES];
+	/** Use counter for picking the least recently used temporary slot. */
+	unsigned long temp_mapping_clock;
+	/** Recently translated guest page table locations. */
+	struct guest_pt_cache guest_pt_cache;
+
 	ARCH_PERCPU_FIELDS;
 
+#ifdef CONFIG_PMU_STATS
+	/** Raw PMU counter values at the last sample. */
+	u64 pmu_last[JAILHOUSE_NUM_PMU_COUNTERS];
+#endif
+
 	/* Must be last field! */
 	struct public_per_cpu public;
 } __attribute__((aligned(PAGE_SIZE)));
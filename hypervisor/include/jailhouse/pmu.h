@@ -0,0 +1,86 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_PMU_H
+#define _JAILHOUSE_PMU_H
+
+#include <jailhouse/entry.h>
+#include <jailhouse/percpu.h>
+#include <jailhouse/string.h>
+#include <jailhouse/utils.h>
+
+/**
+ * Read the PMU counters reserved for the hypervisor on the calling CPU.
+ * @param values	Array of JAILHOUSE_NUM_PMU_COUNTERS raw counter values,
+ * 			indexed by JAILHOUSE_PMU_*.
+ *
+ * @return Mask of the valid counter bits, 0 if the counters are unavailable.
+ */
+u64 arch_pmu_read(u64 *values);
+
+/**
+ * Accumulate the PMU counters of the calling CPU into its statistics.
+ *
+ * Called on VM exits. As CPUs are not shared between cells, the counts belong
+ * to the CPU's cell.
+ *
+ * @note Compiles to nothing unless CONFIG_PMU_STATS is set.
+ */
+static inline void pmu_sample(void)
+{
+#ifdef CONFIG_PMU_STATS
+	struct per_cpu *cpu_data = this_cpu_data();
+	u64 values[JAILHOUSE_NUM_PMU_COUNTERS], mask;
+	unsigned int n;
+
+	mask = arch_pmu_read(values);
+	if (mask == 0)
+		return;
+
+	for (n = 0; n < JAILHOUSE_NUM_PMU_COUNTERS; n++) {
+		cpu_data->public.pmu_stats[n] +=
+			(values[n] - cpu_data->pmu_last[n]) & mask;
+		cpu_data->pmu_last[n] = values[n];
+	}
+#endif
+}
+
+/**
+ * Reset the PMU statistics of a CPU.
+ * @param cpu_public	Public per-CPU data of the CPU.
+ */
+static inline void pmu_reset_stats(struct public_per_cpu *cpu_public)
+{
+#ifdef CONFIG_PMU_STATS
+	memset(cpu_public->pmu_stats, 0, sizeof(cpu_public->pmu_stats));
+#endif
+}
+
+/**
+ * Get a PMU statistic of a CPU in the unit of the CPU_GET_INFO hypercall.
+ * @param cpu_public	Public per-CPU data of the CPU.
+ * @param counter	Counter (JAILHOUSE_PMU_*).
+ *
+ * @return Statistic value, truncated to 31 bits, or negative error code.
+ */
+static inline int pmu_get_info(struct public_per_cpu *cpu_public,
+			       unsigned int counter)
+{
+#ifdef CONFIG_PMU_STATS
+	u64 value = cpu_public->pmu_stats[counter];
+
+	if (counter != JAILHOUSE_PMU_LLC_MISSES)
+		value /= 1000;
+	return value & BIT_MASK(30, 0);
+#else
+	return -EINVAL;
+#endif
+}
+
+#endif /* !_JAILHOUSE_PMU_H */
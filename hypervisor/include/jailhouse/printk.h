@@ -28,5 +28,18 @@ void __attribute__((format(printf, 1, 2))) panic_printk(const char *fmt, ...);
 void arch_dbg_write_init(void);
 extern void (*arch_dbg_write)(const char *msg);
 
+bool arch_console_notify_valid(unsigned long irq);
+void arch_console_notify(unsigned int cpu_id, unsigned int irq);
+
 extern bool virtual_console;
 extern volatile struct jailhouse_virt_console console;
+
+struct cell;
+
+void cell_console_reset(struct cell *cell);
+void cell_console_putc(struct cell *cell, char c);
+void cell_console_flush(struct cell *cell);
+long cell_console_puts(struct cell *cell, unsigned long gphys,
+		       unsigned long len);
+
+long console_notify_set(unsigned long irq, unsigned long threshold);
@@ -0,0 +1,49 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_SLAB_H
+#define _JAILHOUSE_SLAB_H
+
+/**
+ * @defgroup Slab Slab Allocator
+ *
+ * Allocator for hypervisor objects smaller than a page, backed by
+ * mem_pool. Objects are served from per-size-class caches of pages, larger
+ * allocations are passed on to page_alloc().
+ *
+ * @{
+ */
+
+/** Largest object size served from a slab cache. */
+#define SLAB_MAX_SIZE		1024
+
+/**
+ * Allocate a zero-initialized object from mem_pool.
+ * @param size	Size of the object in bytes.
+ *
+ * Objects of up to SLAB_MAX_SIZE bytes are aligned to the next power of two
+ * of their size, larger ones to a page.
+ *
+ * @return Pointer to the object or NULL if allocation failed.
+ *
+ * @see slab_free
+ */
+void *slab_alloc(unsigned long size);
+
+/**
+ * Release an object allocated via slab_alloc().
+ * @param obj	Object to release, may be NULL.
+ * @param size	Size of the object as passed to slab_alloc().
+ *
+ * @see slab_alloc
+ */
+void slab_free(void *obj, unsigned long size);
+
+/** @} */
+#endif /* !_JAILHOUSE_SLAB_H */
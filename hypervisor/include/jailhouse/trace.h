@@ -0,0 +1,89 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#ifndef _JAILHOUSE_TRACE_H
+#define _JAILHOUSE_TRACE_H
+
+#include <jailhouse/percpu.h>
+#include <jailhouse/processor.h>
+
+#if defined(CONFIG_TRACE_EVENTS) || defined(CONFIG_PROFILE_SAMPLING)
+static inline void trace_record(struct public_per_cpu *cpu_public,
+				unsigned int event, unsigned long arg1,
+				unsigned long arg2)
+{
+	struct jailhouse_trace_buffer *trace = &cpu_public->trace;
+	unsigned int tail = trace->tail;
+	struct jailhouse_trace_record *record =
+		&trace->records[tail % JAILHOUSE_TRACE_RECORDS];
+
+	record->timestamp = read_timestamp();
+	record->cpu = cpu_public->cpu_id;
+	record->event = event;
+	record->arg1 = arg1;
+	record->arg2 = arg2;
+
+	/* ensure the record is complete before publishing it */
+	memory_barrier();
+	trace->tail = tail + 1;
+}
+#endif
+
+/**
+ * Record an event in the trace buffer of the calling CPU.
+ * @param event		Event ID (JAILHOUSE_TRACE_*).
+ * @param arg1		First event-specific argument.
+ * @param arg2		Second event-specific argument.
+ *
+ * The buffer is only written by its CPU, so no locking is required. Readers
+ * have to discard records that were overwritten while they were copying.
+ *
+ * @note Compiles to nothing unless CONFIG_TRACE_EVENTS is set.
+ */
+static inline void trace_event(unsigned int event, unsigned long arg1,
+			       unsigned long arg2)
+{
+#ifdef CONFIG_TRACE_EVENTS
+	struct public_per_cpu *cpu_public = this_cpu_public();
+
+#ifdef CONFIG_PROFILE_SAMPLING
+	/* samples are recorded from NMI context, keep them out of this one */
+	cpu_public->trace_busy = true;
+	memory_barrier();
+#endif
+	trace_record(cpu_public, event, arg1, arg2);
+#ifdef CONFIG_PROFILE_SAMPLING
+	cpu_public->trace_busy = false;
+#endif
+#endif
+}
+
+/**
+ * Record a profiling sample in the trace buffer of the calling CPU.
+ * @param pc		Interrupted hypervisor program counter.
+ *
+ * Called from NMI context. Samples that hit an ongoing trace_event() on the
+ * same CPU are dropped.
+ *
+ * @note Compiles to nothing unless CONFIG_PROFILE_SAMPLING is set.
+ */
+static inline void trace_sample(unsigned long pc)
+{
+#ifdef CONFIG_PROFILE_SAMPLING
+	struct public_per_cpu *cpu_public = this_cpu_public();
+
+	if (!cpu_public->trace_busy)
+		trace_record(cpu_public, JAILHOUSE_TRACE_SAMPLE, pc, 0);
+#endif
+}
+
+#endif /* !_JAILHOUSE_TRACE_H */
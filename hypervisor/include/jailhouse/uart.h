@@ -28,6 +28,8 @@ struct uart_chip {
 };
 
 void uart_write(const char *msg);
+void uart_drain(void);
+void uart_flush(void);
 
 extern struct uart_chip *uart;
 extern struct uart_chip uart_8250_ops;
@@ -28,5 +28,10 @@
 #define GET_FIELD(value, last, first) \
 	(((value) & BIT_MASK((last), (first))) >> (first))
 
+/* Function on the VM exit or interrupt path, see hypervisor.lds.S. */
+#define __hot			__attribute__((section(".text.hot")))
+/* Function only called while enabling the hypervisor. */
+#define __init			__attribute__((section(".text.init")))
+
 #define MAX(a, b)		((a) >= (b) ? (a) : (b))
 #define MIN(a, b)		((a) <= (b) ? (a) : (b))
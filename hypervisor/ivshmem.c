@@ -16,15 +16,25 @@
  * shared memory and interrupts based on MSI-X.
  *
  * The implementation in Jailhouse provides a shared memory device between
- * exactly 2 cells. The link between the two PCI devices is established by
- * choosing the same BDF, memory location, and memory size.
+ * 2 cells by default, or up to IVSHMEM_MAX_PEERS cells if configured via
+ * shmem_peers. The link between the PCI devices is established by choosing
+ * the same BDF, memory location, and memory size. Each peer gets the lowest
+ * free ID on connection.
+ *
+ * With JAILHOUSE_SHMEM_FLAG_SECTIONS, the shared memory is split into a state
+ * table, which the hypervisor keeps up to date with the LSTATE values of all
+ * peers, a common read/write section and one output section per peer. Peers
+ * can poll remote state and data without any VM exit this way. The ID of a
+ * peer is then given by the output section that is writable in its config.
  */
 
 #include <jailhouse/ivshmem.h>
 #include <jailhouse/mmio.h>
 #include <jailhouse/pci.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/slab.h>
 #include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <jailhouse/utils.h>
 #include <jailhouse/processor.h>
 #include <jailhouse/percpu.h>
@@ -37,29 +47,68 @@
  * device drivers that they are dealing with a special ivshmem device */
 #define IVSHMEM_CFG_SHMEM_PTR	0x40
 #define IVSHMEM_CFG_SHMEM_SZ	0x48
+/* section layout, all zero if not configured */
+#define IVSHMEM_CFG_STATE_TAB	0x60
+#define IVSHMEM_CFG_OUTPUT_PTR	0x68	/* output section of peer 0 */
+#define IVSHMEM_CFG_OUTPUT_SZ	0x70	/* size of each output section */
 
-#define IVSHMEM_MSIX_VECTORS	1
+#define IVSHMEM_SECTION_STATE	0
+#define IVSHMEM_SECTION_RW	1
+#define IVSHMEM_SECTION_OUTPUT	2
 
 #define IVSHMEM_REG_INTX_CTRL	0
+#define IVSHMEM_REG_MAX_PEERS	4
 #define IVSHMEM_REG_IVPOS	8
 #define IVSHMEM_REG_DBELL	12
 #define IVSHMEM_REG_LSTATE	16
 #define IVSHMEM_REG_RSTATE	20
+#define IVSHMEM_REG_STATE_VEC	24
+#define IVSHMEM_REG_PEER_STATE	0x40	/* 4 bytes per peer ID */
+
+/*
+ * Doorbell encoding: bits 0..15 select the vector, bits 16..31 the target
+ * peer ID or IVSHMEM_DBELL_BROADCAST on multi-peer links. Two-peer links
+ * ignore the peer bits and always signal the remote side.
+ */
+#define IVSHMEM_DBELL_VECTOR(v)		((v) & 0xffff)
+#define IVSHMEM_DBELL_PEER(v)		((v) >> 16)
+#define IVSHMEM_DBELL_BROADCAST		0xffff
 
-#define IVSHMEM_BAR0_SIZE	256
 /*
- * Make the region two times as large as the MSI-X table to guarantee a
- * power-of-2 size (encoding constraint of a BAR).
+ * STATE_VEC selects the vector that state changes of other peers raise in
+ * this peer. Bit 31 suppresses these interrupts for peers that poll.
  */
-#define IVSHMEM_BAR4_SIZE	(0x10 * IVSHMEM_MSIX_VECTORS * 2)
+#define IVSHMEM_STATE_VEC_VECTOR(v)	((v) & 0xffff)
+#define IVSHMEM_STATE_VEC_DISABLE	0x80000000
 
-struct ivshmem_data {
-	struct ivshmem_endpoint eps[2];
+/*
+ * Shared memory regions of this size or larger have to be mappable with
+ * hugepages only, in all peers.
+ */
+#define IVSHMEM_HUGEPAGE_2M	0x200000ULL
+#define IVSHMEM_HUGEPAGE_1G	0x40000000ULL
+
+#define IVSHMEM_BAR0_SIZE	256
+/*
+ * Make the region two times as large as the largest MSI-X table to guarantee
+ * a power-of-2 size (encoding constraint of a BAR). The PBA follows the table.
+ */
+#define IVSHMEM_MSIX_PBA	(0x10 * IVSHMEM_MAX_MSIX_VECTORS)
+#define IVSHMEM_BAR4_SIZE	(IVSHMEM_MSIX_PBA * 2)
+
+struct ivshmem_link {
+	struct ivshmem_endpoint eps[IVSHMEM_MAX_PEERS];
+	unsigned int max_peers;
+	bool multi_peer;
+	/* hypervisor mapping of the state table, NULL without sections */
+	volatile u32 *state_table;
+	unsigned long state_table_phys;
+	unsigned long state_table_size;
 	u16 bdf;
-	struct ivshmem_data *next;
+	struct ivshmem_link *next;
 };
 
-static struct ivshmem_data *ivshmem_list;
+static struct ivshmem_link *ivshmem_list;
 
 static const u32 default_cspace[IVSHMEM_CFG_SIZE / sizeof(u32)] = {
 	[0x00/4] = (IVSHMEM_DEVICE_ID << 16) | VIRTIO_VENDOR_ID,
@@ -68,28 +117,103 @@ static const u32 default_cspace[IVSHMEM_CFG_SIZE / sizeof(u32)] = {
 	[0x2c/4] = (IVSHMEM_DEVICE_ID << 16) | VIRTIO_VENDOR_ID,
 	[0x34/4] = IVSHMEM_CFG_MSIX_CAP,
 	/* MSI-X capability */
-	[IVSHMEM_CFG_MSIX_CAP/4] = (IVSHMEM_MSIX_VECTORS - 1) << 16
-				   | (0x00 << 8) | PCI_CAP_MSIX,
+	/* MSI-X table size is filled in by ivshmem_reset */
+	[IVSHMEM_CFG_MSIX_CAP/4] = (0x00 << 8) | PCI_CAP_MSIX,
 	[(IVSHMEM_CFG_MSIX_CAP + 0x4)/4] = 4,
-	[(IVSHMEM_CFG_MSIX_CAP + 0x8)/4] = 0x10 * IVSHMEM_MSIX_VECTORS | 4,
+	[(IVSHMEM_CFG_MSIX_CAP + 0x8)/4] = IVSHMEM_MSIX_PBA | 4,
 };
 
-static void ivshmem_remote_interrupt(struct ivshmem_endpoint *ive)
+static unsigned int ivshmem_num_vectors(struct ivshmem_endpoint *ive)
+{
+	return ive->device->info->num_msix_vectors;
+}
+
+static void ivshmem_peer_interrupt(struct ivshmem_endpoint *peer,
+				   unsigned int vector)
 {
 	/*
-	 * Hold the remote lock while sending the interrupt so that
+	 * Hold the peer's lock while sending the interrupt so that
 	 * ivshmem_exit can synchronize on the completion of the delivery.
 	 */
-	spin_lock(&ive->remote_lock);
-	if (ive->remote)
-		arch_ivshmem_trigger_interrupt(ive->remote);
-	spin_unlock(&ive->remote_lock);
+	spin_lock(&peer->irq_lock);
+	if (peer->device &&
+	    (vector == 0 || vector < ivshmem_num_vectors(peer))) {
+		trace_event(JAILHOUSE_TRACE_IVSHMEM_IRQ,
+			    peer->device->cell->config->id, vector);
+		arch_ivshmem_trigger_interrupt(peer, vector);
+	}
+	spin_unlock(&peer->irq_lock);
+}
+
+static void ivshmem_broadcast_interrupt(struct ivshmem_endpoint *ive,
+					unsigned int vector)
+{
+	struct ivshmem_link *link = ive->link;
+	unsigned int id;
+
+	for (id = 0; id < link->max_peers; id++)
+		if (id != ive->ivpos)
+			ivshmem_peer_interrupt(&link->eps[id], vector);
+}
+
+static void ivshmem_set_state(struct ivshmem_endpoint *ive, u32 state)
+{
+	struct ivshmem_link *link = ive->link;
+
+	ive->state = state;
+	if (link->state_table) {
+		link->state_table[ive->ivpos] = state;
+		/* make the new state visible before signaling the peers */
+		memory_barrier();
+	}
+}
+
+static void ivshmem_notify_state(struct ivshmem_endpoint *ive)
+{
+	struct ivshmem_link *link = ive->link;
+	struct ivshmem_endpoint *peer;
+	u32 state_vec;
+	unsigned int id;
+
+	for (id = 0; id < link->max_peers; id++) {
+		peer = &link->eps[id];
+		state_vec = peer->state_vec_reg;
+		if (id == ive->ivpos || state_vec & IVSHMEM_STATE_VEC_DISABLE)
+			continue;
+		ivshmem_peer_interrupt(peer,
+				       IVSHMEM_STATE_VEC_VECTOR(state_vec));
+	}
+}
+
+static void ivshmem_ring_doorbell(struct ivshmem_endpoint *ive, u32 value)
+{
+	struct ivshmem_link *link = ive->link;
+	unsigned int vector = IVSHMEM_DBELL_VECTOR(value);
+	unsigned int peer = IVSHMEM_DBELL_PEER(value);
+
+	if (!link->multi_peer)
+		ivshmem_peer_interrupt(&link->eps[ive->ivpos ^ 1], vector);
+	else if (peer == IVSHMEM_DBELL_BROADCAST)
+		ivshmem_broadcast_interrupt(ive, vector);
+	else if (peer < link->max_peers && peer != ive->ivpos)
+		ivshmem_peer_interrupt(&link->eps[peer], vector);
 }
 
 static enum mmio_result ivshmem_register_mmio(void *arg,
 					      struct mmio_access *mmio)
 {
 	struct ivshmem_endpoint *ive = arg;
+	struct ivshmem_link *link = ive->link;
+	unsigned int id;
+
+	/* The doorbell is by far the most frequently accessed register. */
+	if (mmio->address == IVSHMEM_REG_DBELL) {
+		if (mmio->is_write)
+			ivshmem_ring_doorbell(ive, mmio->value);
+		else
+			mmio->value = 0;
+		return MMIO_HANDLED;
+	}
 
 	if (mmio->address == IVSHMEM_REG_INTX_CTRL) {
 		if (mmio->is_write) {
@@ -101,34 +225,51 @@ static enum mmio_result ivshmem_register_mmio(void *arg,
 		return MMIO_HANDLED;
 	}
 
-	/* read-only IVPosition */
-	if (mmio->address == IVSHMEM_REG_IVPOS && !mmio->is_write) {
-		mmio->value = ive->ivpos;
+	/* read-only MaxPeers */
+	if (mmio->address == IVSHMEM_REG_MAX_PEERS && !mmio->is_write) {
+		mmio->value = link->max_peers;
 		return MMIO_HANDLED;
 	}
 
-	if (mmio->address == IVSHMEM_REG_DBELL) {
-		if (mmio->is_write)
-			ivshmem_remote_interrupt(ive);
-		else
-			mmio->value = 0;
+	/* read-only IVPosition */
+	if (mmio->address == IVSHMEM_REG_IVPOS && !mmio->is_write) {
+		mmio->value = ive->ivpos;
 		return MMIO_HANDLED;
 	}
 
 	if (mmio->address == IVSHMEM_REG_LSTATE) {
 		if (mmio->is_write) {
-			ive->state = mmio->value;
-			ivshmem_remote_interrupt(ive);
+			ivshmem_set_state(ive, mmio->value);
+			ivshmem_notify_state(ive);
 		} else {
 			mmio->value = ive->state;
 		}
 		return MMIO_HANDLED;
 	}
 
+	if (mmio->address == IVSHMEM_REG_STATE_VEC) {
+		if (mmio->is_write)
+			ive->state_vec_reg = mmio->value &
+				(IVSHMEM_STATE_VEC_DISABLE | 0xffff);
+		else
+			mmio->value = ive->state_vec_reg;
+		return MMIO_HANDLED;
+	}
+
+	/*
+	 * States of disconnected peers are reset to 0 by ivshmem_exit, so they
+	 * can be read without taking any lock.
+	 */
 	if (mmio->address == IVSHMEM_REG_RSTATE && !mmio->is_write) {
-		spin_lock(&ive->remote_lock);
-		mmio->value = ive->remote ? ive->remote->state : 0;
-		spin_unlock(&ive->remote_lock);
+		mmio->value = link->eps[ive->ivpos ^ 1].state;
+		return MMIO_HANDLED;
+	}
+
+	if (mmio->address >= IVSHMEM_REG_PEER_STATE &&
+	    mmio->address < IVSHMEM_REG_PEER_STATE + 4 * link->max_peers &&
+	    mmio->address % 4 == 0 && !mmio->is_write) {
+		id = (mmio->address - IVSHMEM_REG_PEER_STATE) / 4;
+		mmio->value = link->eps[id].state;
 		return MMIO_HANDLED;
 	}
 
@@ -140,10 +281,12 @@ static enum mmio_result ivshmem_register_mmio(void *arg,
 /**
  * Check if MSI-X doorbell interrupt is masked.
  * @param ive		Ivshmem endpoint the mask should be checked for.
+ * @param vector	MSI-X vector to check.
  *
  * @return True if MSI-X interrupt is masked.
  */
-bool ivshmem_is_msix_masked(struct ivshmem_endpoint *ive)
+bool ivshmem_is_msix_masked(struct ivshmem_endpoint *ive,
+			    unsigned int vector)
 {
 	union pci_msix_registers c;
 
@@ -153,7 +296,7 @@ bool ivshmem_is_msix_masked(struct ivshmem_endpoint *ive)
 		return true;
 
 	/* local mask */
-	if (ive->device->msix_vectors[0].masked)
+	if (ive->device->msix_vectors[vector].masked)
 		return true;
 
 	/* PCI Bus Master */
@@ -163,6 +306,25 @@ bool ivshmem_is_msix_masked(struct ivshmem_endpoint *ive)
 	return false;
 }
 
+/**
+ * Update the cached MSI-X routes of all vectors of an ivshmem device.
+ * @param device	The device to be updated.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+int ivshmem_update_msix(struct pci_device *device)
+{
+	unsigned int vector;
+	int err;
+
+	for (vector = 0; vector < device->info->num_msix_vectors; vector++) {
+		err = arch_ivshmem_update_msix(device, vector);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
 static enum mmio_result ivshmem_msix_mmio(void *arg, struct mmio_access *mmio)
 {
 	struct ivshmem_endpoint *ive = arg;
@@ -172,7 +334,7 @@ static enum mmio_result ivshmem_msix_mmio(void *arg, struct mmio_access *mmio)
 		goto fail;
 
 	/* MSI-X PBA */
-	if (mmio->address >= 0x10 * IVSHMEM_MSIX_VECTORS) {
+	if (mmio->address >= IVSHMEM_MSIX_PBA) {
 		if (mmio->is_write) {
 			goto fail;
 		} else {
@@ -180,10 +342,12 @@ static enum mmio_result ivshmem_msix_mmio(void *arg, struct mmio_access *mmio)
 			return MMIO_HANDLED;
 		}
 	/* MSI-X Table */
-	} else {
+	} else if (mmio->address < 0x10 * ivshmem_num_vectors(ive)) {
 		if (mmio->is_write) {
 			msix_table[mmio->address / 4] = mmio->value;
-			if (arch_ivshmem_update_msix(ive->device))
+			/* only the route of the written vector changes */
+			if (arch_ivshmem_update_msix(ive->device,
+						     mmio->address / 0x10))
 				return MMIO_ERROR;
 		} else {
 			mmio->value = msix_table[mmio->address / 4];
@@ -205,11 +369,12 @@ static int ivshmem_write_command(struct ivshmem_endpoint *ive, u16 val)
 {
 	u16 *cmd = (u16 *)&ive->cspace[PCI_CFG_COMMAND/4];
 	struct pci_device *device = ive->device;
+	u64 bar2;
 	int err;
 
 	if ((val & PCI_CMD_MASTER) != (*cmd & PCI_CMD_MASTER)) {
 		*cmd = (*cmd & ~PCI_CMD_MASTER) | (val & PCI_CMD_MASTER);
-		err = arch_ivshmem_update_msix(device);
+		err = ivshmem_update_msix(device);
 		if (err)
 			return err;
 	}
@@ -220,15 +385,24 @@ static int ivshmem_write_command(struct ivshmem_endpoint *ive, u16 val)
 			mmio_region_unregister(device->cell, ive->bar4_address);
 		}
 		if (val & PCI_CMD_MEM) {
+			/* the shared memory cannot be moved */
+			bar2 = (*(u64 *)&device->bar[2]) & ~0xfULL;
+			if (device->info->shmem_flags &
+			    JAILHOUSE_SHMEM_FLAG_BAR2 &&
+			    bar2 != ive->shmem->virt_start)
+				return trace_error(-EINVAL);
+
 			ive->bar0_address = (*(u64 *)&device->bar[0]) & ~0xfL;
 			mmio_region_register(device->cell, ive->bar0_address,
 					     IVSHMEM_BAR0_SIZE,
-					     ivshmem_register_mmio, ive);
+					     ivshmem_register_mmio, ive,
+					     "ivshmem");
 
 			ive->bar4_address = (*(u64 *)&device->bar[4]) & ~0xfL;
 			mmio_region_register(device->cell, ive->bar4_address,
 					     IVSHMEM_BAR4_SIZE,
-					     ivshmem_msix_mmio, ive);
+					     ivshmem_msix_mmio, ive,
+					     "ivshmem-msix");
 		}
 		*cmd = (*cmd & ~PCI_CMD_MEM) | (val & PCI_CMD_MEM);
 	}
@@ -247,7 +421,7 @@ static int ivshmem_write_msix_control(struct ivshmem_endpoint *ive, u32 val)
 	newval.fmask = p->fmask;
 	if (ive->cspace[IVSHMEM_CFG_MSIX_CAP/4] != newval.raw) {
 		ive->cspace[IVSHMEM_CFG_MSIX_CAP/4] = newval.raw;
-		return arch_ivshmem_update_msix(ive->device);
+		return ivshmem_update_msix(ive->device);
 	}
 	return 0;
 }
@@ -307,6 +481,108 @@ enum pci_access ivshmem_pci_cfg_read(struct pci_device *device, u16 address,
 	return PCI_ACCESS_DONE;
 }
 
+static volatile u32 *ivshmem_map_state_table(unsigned long phys,
+					     unsigned long size)
+{
+	void *virt;
+
+	virt = page_alloc(&remap_pool, PAGES(size));
+	if (!virt)
+		return NULL;
+
+	/* Use a cached mapping, just like the peers do. */
+	if (paging_create(&hv_paging_structs, phys, size, (unsigned long)virt,
+			  PAGE_DEFAULT_FLAGS, PAGING_NON_COHERENT) != 0) {
+		page_free(&remap_pool, virt, PAGES(size));
+		return NULL;
+	}
+
+	return virt;
+}
+
+static bool ivshmem_is_virtio(u16 proto)
+{
+	proto &= 0xff00;
+	return proto == JAILHOUSE_SHMEM_PROTO_VIRTIO_FRONT ||
+		proto == JAILHOUSE_SHMEM_PROTO_VIRTIO_BACK;
+}
+
+/*
+ * Peers have to use the same protocol, except for virtio where a frontend is
+ * paired with a backend of the same device type.
+ */
+static bool ivshmem_protocols_match(u16 proto, u16 peer_proto)
+{
+	if (!ivshmem_is_virtio(proto))
+		return proto == peer_proto;
+
+	return ivshmem_is_virtio(peer_proto) &&
+		(proto ^ peer_proto) == (JAILHOUSE_SHMEM_PROTO_VIRTIO_FRONT ^
+					 JAILHOUSE_SHMEM_PROTO_VIRTIO_BACK);
+}
+
+/*
+ * Validate the section layout of a peer and derive its ID from the writable
+ * output section. Returns the ID or a negative error code.
+ */
+static int ivshmem_check_sections(const struct jailhouse_memory *mem,
+				  unsigned int max_peers)
+{
+	const struct jailhouse_memory *state = &mem[IVSHMEM_SECTION_STATE];
+	const struct jailhouse_memory *output = &mem[IVSHMEM_SECTION_OUTPUT];
+	int id = -EINVAL;
+	unsigned int n;
+
+	if (state->flags & JAILHOUSE_MEM_WRITE ||
+	    state->size < max_peers * sizeof(u32))
+		return -EINVAL;
+
+	for (n = 0; n < max_peers; n++) {
+		if (output[n].size != output[0].size ||
+		    output[n].virt_start !=
+		    output[0].virt_start + n * output[0].size)
+			return -EINVAL;
+		if (output[n].flags & JAILHOUSE_MEM_WRITE) {
+			if (id >= 0)
+				return -EINVAL;
+			id = n;
+		}
+	}
+
+	return id;
+}
+
+/*
+ * Regions from 2 MB on have to be aligned to 2 MB, regions from 1 GB on have
+ * to share the offset into 1 GB pages between physical and guest address.
+ * Otherwise, the aligned middle of the region would still be mapped with
+ * smaller pages.
+ */
+static bool ivshmem_region_aligned(const struct jailhouse_memory *mem)
+{
+	if (mem->size >= IVSHMEM_HUGEPAGE_2M &&
+	    ((mem->phys_start | mem->virt_start | mem->size) &
+	     (IVSHMEM_HUGEPAGE_2M - 1)) != 0)
+		return false;
+	if (mem->size >= IVSHMEM_HUGEPAGE_1G &&
+	    ((mem->phys_start ^ mem->virt_start) &
+	     (IVSHMEM_HUGEPAGE_1G - 1)) != 0)
+		return false;
+	return true;
+}
+
+/* The BAR has to be naturally aligned and sized like the region. */
+static bool ivshmem_bar2_valid(const struct jailhouse_pci_device *dev_info,
+			       const struct jailhouse_memory *shmem)
+{
+	u64 bar_mask = ((u64)dev_info->bar_mask[3] << 32) |
+		dev_info->bar_mask[2];
+
+	return shmem->size != 0 && (shmem->size & (shmem->size - 1)) == 0 &&
+		(shmem->virt_start & (shmem->size - 1)) == 0 &&
+		bar_mask == ~(shmem->size - 1);
+}
+
 /**
  * Register a new ivshmem device.
  * @param cell		The cell the device should be attached to.
@@ -318,62 +594,131 @@ int ivshmem_init(struct cell *cell, struct pci_device *device)
 {
 	const struct jailhouse_pci_device *dev_info = device->info;
 	const struct jailhouse_memory *mem, *peer_mem;
-	struct ivshmem_endpoint *ive, *remote;
+	unsigned int max_peers = dev_info->shmem_peers;
+	unsigned int n, num_regions = 1;
+	struct ivshmem_endpoint *ive;
 	struct pci_device *peer_dev;
-	struct ivshmem_data *iv;
-	unsigned int id = 0;
+	struct ivshmem_link *link;
+	bool sections;
+	int id = -1;
+
+	/* classic two-peer link */
+	if (max_peers == 0)
+		max_peers = 2;
+
+	sections = dev_info->shmem_flags & JAILHOUSE_SHMEM_FLAG_SECTIONS;
+	if (sections)
+		num_regions = IVSHMEM_SECTION_OUTPUT + max_peers;
 
 	printk("Adding virtual PCI device %02x:%02x.%x to cell \"%s\"\n",
 	       PCI_BDF_PARAMS(dev_info->bdf), cell->config->name);
 
-	if (dev_info->shmem_region >= cell->config->num_memory_regions)
+	/* virtio transports connect exactly one frontend and one backend */
+	if (ivshmem_is_virtio(dev_info->shmem_protocol) &&
+	    dev_info->shmem_peers != 0)
+		return trace_error(-EINVAL);
+
+	if (max_peers < 2 || max_peers > IVSHMEM_MAX_PEERS ||
+	    dev_info->shmem_region + num_regions >
+	    cell->config->num_memory_regions ||
+	    dev_info->num_msix_vectors > IVSHMEM_MAX_MSIX_VECTORS)
 		return trace_error(-EINVAL);
 
 	mem = jailhouse_cell_mem_regions(cell->config) + dev_info->shmem_region;
 
-	for (iv = ivshmem_list; iv; iv = iv->next)
-		if (iv->bdf == dev_info->bdf)
-			break;
+	if (sections) {
+		id = ivshmem_check_sections(mem, max_peers);
+		if (id < 0)
+			return trace_error(id);
+	}
 
-	if (iv) {
-		id = iv->eps[0].device ? 1 : 0;
-		if (iv->eps[id].device)
-			return trace_error(-EBUSY);
+	for (n = 0; n < num_regions; n++)
+		if (!ivshmem_region_aligned(&mem[n]))
+			return trace_error(-EINVAL);
+
+	if (dev_info->shmem_flags & JAILHOUSE_SHMEM_FLAG_BAR2 &&
+	    !ivshmem_bar2_valid(dev_info,
+				&mem[sections ? IVSHMEM_SECTION_RW : 0]))
+		return trace_error(-EINVAL);
 
-		peer_dev = iv->eps[id ^ 1].device;
+	for (link = ivshmem_list; link; link = link->next)
+		if (link->bdf == dev_info->bdf)
+			break;
+
+	if (link) {
+		peer_dev = NULL;
+		for (n = 0; n < link->max_peers; n++)
+			if (link->eps[n].device) {
+				peer_dev = link->eps[n].device;
+				break;
+			}
 		peer_mem = jailhouse_cell_mem_regions(peer_dev->cell->config) +
 			peer_dev->info->shmem_region;
 
-		/* check that the regions and protocols of both peers match */
-		if (peer_mem->phys_start != mem->phys_start ||
-		    peer_mem->size != mem->size ||
-		    peer_dev->info->shmem_protocol != dev_info->shmem_protocol)
+		/* check that the regions and protocols of all peers match */
+		if (!ivshmem_protocols_match(dev_info->shmem_protocol,
+					     peer_dev->info->shmem_protocol) ||
+		    peer_dev->info->shmem_peers != dev_info->shmem_peers ||
+		    peer_dev->info->shmem_flags != dev_info->shmem_flags)
 			return trace_error(-EINVAL);
+		for (n = 0; n < num_regions; n++)
+			if (peer_mem[n].phys_start != mem[n].phys_start ||
+			    peer_mem[n].size != mem[n].size)
+				return trace_error(-EINVAL);
+
+		if (id < 0)
+			for (id = 0; id < link->max_peers; id++)
+				if (!link->eps[id].device)
+					break;
+		if (id == link->max_peers || link->eps[id].device)
+			return trace_error(-EBUSY);
 
 		printk("Shared memory connection established: "
-		       "\"%s\" <--> \"%s\"\n",
-		       cell->config->name, peer_dev->cell->config->name);
+		       "\"%s\" <--> \"%s\" (peer %d)\n",
+		       cell->config->name, peer_dev->cell->config->name, id);
 	} else {
-		iv = page_alloc(&mem_pool, 1);
-		if (!iv)
+		link = slab_alloc(sizeof(*link));
+		if (!link)
 			return -ENOMEM;
 
-		iv->bdf = dev_info->bdf;
-		iv->next = ivshmem_list;
-		ivshmem_list = iv;
+		if (sections) {
+			link->state_table_phys =
+				mem[IVSHMEM_SECTION_STATE].phys_start;
+			link->state_table_size =
+				mem[IVSHMEM_SECTION_STATE].size;
+			link->state_table =
+				ivshmem_map_state_table(link->state_table_phys,
+							link->state_table_size);
+			if (!link->state_table) {
+				slab_free(link, sizeof(*link));
+				return -ENOMEM;
+			}
+			memset((void *)link->state_table, 0,
+			       max_peers * sizeof(u32));
+		}
+
+		link->bdf = dev_info->bdf;
+		link->max_peers = max_peers;
+		link->multi_peer = dev_info->shmem_peers != 0;
+		link->next = ivshmem_list;
+		ivshmem_list = link;
+		if (id < 0)
+			id = 0;
 	}
 
-	ive = &iv->eps[id];
-	remote = &iv->eps[id ^ 1];
+	ive = &link->eps[id];
 
 	ive->device = device;
-	ive->shmem = mem;
+	if (sections) {
+		ive->sections = mem;
+		ive->shmem = &mem[IVSHMEM_SECTION_RW];
+	} else {
+		ive->sections = NULL;
+		ive->shmem = mem;
+	}
 	ive->ivpos = id;
+	ive->link = link;
 	device->ivshmem_endpoint = ive;
-	if (remote->device) {
-		ive->remote = remote;
-		remote->remote = ive;
-	}
 
 	device->cell = cell;
 	pci_reset_device(device);
@@ -384,6 +729,7 @@ int ivshmem_init(struct cell *cell, struct pci_device *device)
 void ivshmem_reset(struct pci_device *device)
 {
 	struct ivshmem_endpoint *ive = device->ivshmem_endpoint;
+	const struct jailhouse_memory *mem;
 
 	if (ive->cspace[PCI_CFG_COMMAND/4] & PCI_CMD_MEM) {
 		mmio_region_unregister(device->cell, ive->bar0_address);
@@ -407,6 +753,8 @@ void ivshmem_reset(struct pci_device *device)
 		ive->cspace[PCI_CFG_CAPS/4] = 0;
 	} else {
 		device->bar[4] = PCI_BAR_64BIT;
+		ive->cspace[IVSHMEM_CFG_MSIX_CAP/4] |=
+			(device->info->num_msix_vectors - 1) << 16;
 	}
 
 	ive->cspace[IVSHMEM_CFG_SHMEM_PTR/4] = (u32)ive->shmem->virt_start;
@@ -415,7 +763,29 @@ void ivshmem_reset(struct pci_device *device)
 	ive->cspace[IVSHMEM_CFG_SHMEM_SZ/4] = (u32)ive->shmem->size;
 	ive->cspace[IVSHMEM_CFG_SHMEM_SZ/4 + 1] = (u32)(ive->shmem->size >> 32);
 
-	ive->state = 0;
+	if (device->info->shmem_flags & JAILHOUSE_SHMEM_FLAG_BAR2) {
+		device->bar[2] = (u32)ive->shmem->virt_start | PCI_BAR_64BIT |
+			PCI_BAR_PREFETCH;
+		device->bar[3] = (u32)(ive->shmem->virt_start >> 32);
+	}
+
+	if (ive->sections) {
+		mem = &ive->sections[IVSHMEM_SECTION_STATE];
+		ive->cspace[IVSHMEM_CFG_STATE_TAB/4] = (u32)mem->virt_start;
+		ive->cspace[IVSHMEM_CFG_STATE_TAB/4 + 1] =
+			(u32)(mem->virt_start >> 32);
+
+		mem = &ive->sections[IVSHMEM_SECTION_OUTPUT];
+		ive->cspace[IVSHMEM_CFG_OUTPUT_PTR/4] = (u32)mem->virt_start;
+		ive->cspace[IVSHMEM_CFG_OUTPUT_PTR/4 + 1] =
+			(u32)(mem->virt_start >> 32);
+		ive->cspace[IVSHMEM_CFG_OUTPUT_SZ/4] = (u32)mem->size;
+		ive->cspace[IVSHMEM_CFG_OUTPUT_SZ/4 + 1] =
+			(u32)(mem->size >> 32);
+	}
+
+	ive->state_vec_reg = 0;
+	ivshmem_set_state(ive, 0);
 }
 
 /**
@@ -426,30 +796,42 @@ void ivshmem_reset(struct pci_device *device)
 void ivshmem_exit(struct pci_device *device)
 {
 	struct ivshmem_endpoint *ive = device->ivshmem_endpoint;
-	struct ivshmem_endpoint *remote = ive->remote;
-	struct ivshmem_data **ivp, *iv;
-
-	if (remote) {
-		/*
-		 * The spinlock synchronizes the disconnection of the remote
-		 * device with any in-flight interrupts targeting the device
-		 * to be destroyed.
-		 */
-		spin_lock(&remote->remote_lock);
-		remote->remote = NULL;
-		spin_unlock(&remote->remote_lock);
-
-		ivshmem_remote_interrupt(ive);
-
-		ive->device = NULL;
-	} else {
-		for (ivp = &ivshmem_list; *ivp; ivp = &(*ivp)->next) {
-			iv = *ivp;
-			if (&iv->eps[ive->ivpos] == ive) {
-				*ivp = iv->next;
-				page_free(&mem_pool, iv, 1);
-				break;
-			}
-		}
+	struct ivshmem_link **linkp, *link = ive->link;
+	unsigned int id;
+
+	/*
+	 * The spinlock synchronizes the disconnection of the device with any
+	 * in-flight interrupts targeting the device to be destroyed.
+	 */
+	spin_lock(&ive->irq_lock);
+	ive->device = NULL;
+	spin_unlock(&ive->irq_lock);
+
+	ivshmem_set_state(ive, 0);
+
+	for (id = 0; id < link->max_peers; id++)
+		if (link->eps[id].device)
+			break;
+
+	if (id < link->max_peers) {
+		/* let the remaining peers know about the state change */
+		ivshmem_notify_state(ive);
+		return;
 	}
+
+	/*
+	 * The cached state table mapping is destroyed just like a device
+	 * mapping.
+	 */
+	if (link->state_table)
+		paging_unmap_device(link->state_table_phys,
+				    (void *)link->state_table,
+				    link->state_table_size);
+
+	for (linkp = &ivshmem_list; *linkp; linkp = &(*linkp)->next)
+		if (*linkp == link) {
+			*linkp = link->next;
+			slab_free(link, sizeof(*link));
+			break;
+		}
 }
@@ -13,10 +13,20 @@
 #include <jailhouse/string.h>
 #include <jailhouse/types.h>
 
+/* Word-wise where possible, all accesses are naturally aligned. */
+#define LONG_ALIGNED(x)	(((unsigned long)(x) % sizeof(long)) == 0)
+
 void *memset(void *s, int c, unsigned long n)
 {
+	unsigned long pattern = (u8)c * (~0UL / 0xff);
 	u8 *p = s;
 
+	for (; !LONG_ALIGNED(p) && n > 0; n--)
+		*p++ = c;
+	for (; n >= sizeof(long); n -= sizeof(long)) {
+		*(unsigned long *)p = pattern;
+		p += sizeof(long);
+	}
 	while (n-- > 0)
 		*p++ = c;
 	return s;
@@ -38,6 +48,15 @@ void *memcpy(void *dest, const void *src, unsigned long n)
 	const u8 *s = src;
 	u8 *d = dest;
 
+	if (LONG_ALIGNED((unsigned long)d ^ (unsigned long)s)) {
+		for (; !LONG_ALIGNED(d) && n > 0; n--)
+			*d++ = *s++;
+		for (; n >= sizeof(long); n -= sizeof(long)) {
+			*(unsigned long *)d = *(const unsigned long *)s;
+			d += sizeof(long);
+			s += sizeof(long);
+		}
+	}
 	while (n-- > 0)
 		*d++ = *s++;
 	return dest;
@@ -15,9 +15,113 @@
 #include <jailhouse/mmio.h>
 #include <jailhouse/paging.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/slab.h>
+#include <jailhouse/string.h>
+#include <jailhouse/trace.h>
 #include <jailhouse/unit.h>
 #include <jailhouse/percpu.h>
 
+/* Counter rows are cache line aligned to avoid false sharing between CPUs. */
+#define COUNTER_ROW_ALIGN	64
+#define counter_row_align(size)	\
+	(((size) + COUNTER_ROW_ALIGN - 1) & ~(COUNTER_ROW_ALIGN - 1))
+
+/*
+ * With CONFIG_BOUNDED_EXIT_LATENCY, a lookup that raced with this many region
+ * table updates stops retrying and waits for the ongoing update in the FIFO
+ * order of the region lock instead.
+ */
+#define MMIO_LOOKUP_RETRIES	4
+
+/*
+ * Cells with at least this many MMIO regions get a page index that resolves
+ * most accesses without searching the sorted region table.
+ */
+#define MMIO_INDEX_MIN_REGIONS	8
+
+/* The index covers guest-physical blocks of 2M, i.e. 512 pages. */
+#define MMIO_INDEX_BLOCK_ORDER	9
+#define MMIO_INDEX_BLOCK_PAGES	(1 << MMIO_INDEX_BLOCK_ORDER)
+
+/* Slot value of pages covered by more than one region. */
+#define MMIO_INDEX_OVERLAP	0xffff
+
+struct mmio_index_block {
+	/** Block number + 1, 0 if the entry is unused. */
+	unsigned long key;
+	/** Slot table of the block. */
+	unsigned int table;
+};
+
+/**
+ * Page index of the MMIO regions of a cell.
+ *
+ * Blocks touched by regions are hashed into @c blocks. Each refers to a table
+ * with one slot per page that holds the region table index + 1, 0 if no
+ * region is indexed for the page, or MMIO_INDEX_OVERLAP. Regions spanning
+ * more than a block are not indexed, so at most two tables per region are
+ * needed. Lookups fall back to the binary search whenever the index does not
+ * name a single region.
+ *
+ * The index is rebuilt along with the region table under
+ * cell::mmio_generation. Readers may therefore observe it half-built and
+ * only have to stay within its bounds.
+ */
+struct mmio_page_index {
+	/** Number of hash entries, a power of 2. */
+	unsigned int num_blocks;
+	/** Number of slot tables. */
+	unsigned int num_tables;
+	/** Slot tables assigned to blocks. */
+	unsigned int used_tables;
+	/** Hash of the indexed blocks. */
+	struct mmio_index_block *blocks;
+	/** Slot tables, MMIO_INDEX_BLOCK_PAGES slots each. */
+	u16 *tables;
+};
+
+static unsigned long mmio_counters_offset(struct cell *cell)
+{
+	return counter_row_align(cell->max_mmio_regions *
+				 (sizeof(struct mmio_region_location) +
+				  sizeof(struct mmio_region_handler)));
+}
+
+static unsigned long mmio_cell_size(struct cell *cell)
+{
+	return mmio_counters_offset(cell) + cell->mmio_counters_rows *
+		cell->mmio_counters_stride * sizeof(u64);
+}
+
+static unsigned long index_size(const struct mmio_page_index *index)
+{
+	return sizeof(struct mmio_page_index) +
+		index->num_blocks * sizeof(struct mmio_index_block) +
+		index->num_tables * MMIO_INDEX_BLOCK_PAGES * sizeof(u16);
+}
+
+/* The index is optional, the cell simply goes without it if memory is low. */
+static void index_init(struct cell *cell)
+{
+	struct mmio_page_index *index, dims;
+
+	dims.num_tables = 2 * cell->max_mmio_regions;
+	/* keep the hash at most half full so that probing terminates early */
+	for (dims.num_blocks = 1; dims.num_blocks < 2 * dims.num_tables;
+	     dims.num_blocks *= 2)
+		; /* empty loop */
+
+	index = slab_alloc(index_size(&dims));
+	if (!index)
+		return;
+
+	*index = dims;
+	index->blocks = (void *)(index + 1);
+	index->tables = (void *)(index->blocks + index->num_blocks);
+
+	cell->mmio_index = index;
+}
+
 /**
  * Perform MMIO-specific initialization for a new cell.
  * @param cell		Cell to be initialized.
@@ -30,7 +134,7 @@ int mmio_cell_init(struct cell *cell)
 {
 	const struct jailhouse_memory *mem;
 	const struct unit *unit;
-	unsigned int n;
+	unsigned int n, cpu;
 	void *pages;
 
 	/* cell is zero-initialized */;
@@ -41,26 +145,146 @@ int mmio_cell_init(struct cell *cell)
 		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
 			cell->max_mmio_regions++;
 
-	pages = page_alloc(&mem_pool,
-			   PAGES(cell->max_mmio_regions *
-				 (sizeof(struct mmio_region_location) +
-				  sizeof(struct mmio_region_handler))));
+	/* CPUs only leave a cell, so its initial set bounds the rows. */
+	for_each_cpu(cpu, cell->cpu_set)
+		cell->mmio_counters_rows = cpu + 1;
+	cell->mmio_counters_stride =
+		counter_row_align(cell->max_mmio_regions * sizeof(u64)) /
+		sizeof(u64);
+
+	/* the slab class alignment keeps the counter rows cache-line aligned */
+	pages = slab_alloc(mmio_cell_size(cell));
 	if (!pages)
 		return -ENOMEM;
 
 	cell->mmio_locations = pages;
 	cell->mmio_handlers = pages +
 		cell->max_mmio_regions * sizeof(struct mmio_region_location);
+	cell->mmio_counters = pages + mmio_counters_offset(cell);
+
+	if (cell->max_mmio_regions >= MMIO_INDEX_MIN_REGIONS &&
+	    cell->max_mmio_regions < MMIO_INDEX_OVERLAP)
+		index_init(cell);
 
 	return 0;
 }
 
+/* Returns the counter slot of a new region and resets its counts. */
+static unsigned int alloc_counter(struct cell *cell)
+{
+	unsigned int counter, n, row;
+
+	for (counter = 0; ; counter++) {
+		for (n = 0; n < cell->num_mmio_regions; n++)
+			if (cell->mmio_handlers[n].counter == counter)
+				break;
+		if (n == cell->num_mmio_regions)
+			break;
+	}
+
+	for (row = 0; row < cell->mmio_counters_rows; row++)
+		cell->mmio_counters[row * cell->mmio_counters_stride +
+				    counter] = 0;
+
+	return counter;
+}
+
 static void copy_region(struct cell *cell, unsigned int src, unsigned dst)
 {
 	cell->mmio_locations[dst] = cell->mmio_locations[src];
 	cell->mmio_handlers[dst] = cell->mmio_handlers[src];
 }
 
+static struct mmio_index_block *
+index_find_block(const struct mmio_page_index *index, unsigned long page)
+{
+	unsigned long key = (page >> MMIO_INDEX_BLOCK_ORDER) + 1;
+	struct mmio_index_block *entry;
+	unsigned int n;
+
+	for (n = 0; n < index->num_blocks; n++) {
+		entry = &index->blocks[(key + n) & (index->num_blocks - 1)];
+		if (entry->key == key || entry->key == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+/* Called with the generation odd, i.e. while readers retry. */
+static void index_rebuild(struct cell *cell)
+{
+	struct mmio_page_index *index = cell->mmio_index;
+	const struct mmio_region_location *region;
+	struct mmio_index_block *entry;
+	unsigned long page, last;
+	unsigned int n;
+	u16 *slot;
+
+	if (!index)
+		return;
+
+	memset(index->blocks, 0,
+	       index->num_blocks * sizeof(struct mmio_index_block));
+	memset(index->tables, 0,
+	       index->used_tables * MMIO_INDEX_BLOCK_PAGES * sizeof(u16));
+	index->used_tables = 0;
+
+	for (n = 0; n < cell->num_mmio_regions; n++) {
+		region = &cell->mmio_locations[n];
+		if (region->size == 0)
+			continue;
+		page = region->start >> PAGE_SHIFT;
+		last = (region->start + region->size - 1) >> PAGE_SHIFT;
+		if (last - page >= MMIO_INDEX_BLOCK_PAGES)
+			continue;
+
+		for (/* empty */; page <= last; page++) {
+			entry = index_find_block(index, page);
+			if (entry->key == 0) {
+				if (index->used_tables == index->num_tables)
+					break;
+				entry->table = index->used_tables++;
+				entry->key =
+					(page >> MMIO_INDEX_BLOCK_ORDER) + 1;
+			}
+			slot = &index->tables[entry->table *
+					      MMIO_INDEX_BLOCK_PAGES +
+					      (page & (MMIO_INDEX_BLOCK_PAGES -
+						       1))];
+			*slot = *slot ? MMIO_INDEX_OVERLAP : n + 1;
+		}
+	}
+}
+
+/*
+ * Returns the region table index + 1 the page index names for an address, 0
+ * if the binary search has to be used. May race with index_rebuild(), so the
+ * result is only valid if the generation did not change meanwhile.
+ */
+static unsigned int index_lookup(struct cell *cell, unsigned long address)
+{
+	const struct mmio_page_index *index = cell->mmio_index;
+	unsigned long page = address >> PAGE_SHIFT;
+	const struct mmio_index_block *entry;
+	unsigned int table, slot;
+
+	if (!index)
+		return 0;
+
+	entry = index_find_block(index, page);
+	if (!entry || entry->key == 0)
+		return 0;
+	table = entry->table;
+	if (table >= index->num_tables)
+		return 0;
+
+	slot = index->tables[table * MMIO_INDEX_BLOCK_PAGES +
+			     (page & (MMIO_INDEX_BLOCK_PAGES - 1))];
+	if (slot > cell->max_mmio_regions)
+		return 0;
+	return slot;
+}
+
 /**
  * Register a MMIO region access handler for a cell.
  * @param cell		Cell than can access the region.
@@ -68,14 +292,15 @@ static void copy_region(struct cell *cell, unsigned int src, unsigned dst)
  * @param size		Region size.
  * @param handler	Access handler.
  * @param handler_arg	Opaque argument to pass to handler.
+ * @param name		Name of the handler, reported with the access counts.
  *
  * @see mmio_region_unregister
  */
 void mmio_region_register(struct cell *cell, unsigned long start,
 			  unsigned long size, mmio_handler handler,
-			  void *handler_arg)
+			  void *handler_arg, const char *name)
 {
-	unsigned int index, n;
+	unsigned int index, n, counter;
 
 	spin_lock(&cell->mmio_region_lock);
 
@@ -90,6 +315,8 @@ void mmio_region_register(struct cell *cell, unsigned long start,
 		if (cell->mmio_locations[index].start > start)
 			break;
 
+	counter = alloc_counter(cell);
+
 	/*
 	 * Advance the generation to odd value, indicating that modifications
 	 * are ongoing. Commit this change via a barrier so that other CPUs
@@ -105,9 +332,13 @@ void mmio_region_register(struct cell *cell, unsigned long start,
 	cell->mmio_locations[index].size = size;
 	cell->mmio_handlers[index].function = handler;
 	cell->mmio_handlers[index].arg = handler_arg;
+	cell->mmio_handlers[index].name = name;
+	cell->mmio_handlers[index].counter = counter;
 
 	cell->num_mmio_regions++;
 
+	index_rebuild(cell);
+
 	/* Ensure all fields are committed before advancing the generation. */
 	memory_barrier();
 	cell->mmio_generation++;
@@ -116,14 +347,32 @@ void mmio_region_register(struct cell *cell, unsigned long start,
 }
 
 static int find_region(struct cell *cell, unsigned long address,
-		       unsigned int size, unsigned long *region_base,
-		       struct mmio_region_handler *handler)
+		       unsigned int size,
+		       struct mmio_region_location *location,
+		       struct mmio_region_handler *handler,
+		       unsigned long *valid_generation)
 {
-	unsigned int range_start, range_size, index;
+	unsigned int range_start, range_size, index, slot;
 	struct mmio_region_location region;
 	unsigned long generation;
+	int result = -1;
+#ifdef CONFIG_BOUNDED_EXIT_LATENCY
+	unsigned int attempts = 0;
+	bool locked = false;
+#endif
 
 restart:
+#ifdef CONFIG_BOUNDED_EXIT_LATENCY
+	/*
+	 * Writers hold the lock while the generation is odd, so the table is
+	 * stable once we own it. Callers that already hold the lock never
+	 * reach the limit as they cannot race with any update.
+	 */
+	if (attempts++ == MMIO_LOOKUP_RETRIES) {
+		spin_lock(&cell->mmio_region_lock);
+		locked = true;
+	}
+#endif
 	generation = cell->mmio_generation;
 
 	/*
@@ -138,6 +387,25 @@ restart:
 		goto restart;
 	}
 
+	slot = index_lookup(cell, address);
+	if (slot > 0) {
+		index = slot - 1;
+		region = cell->mmio_locations[index];
+
+		/*
+		 * Ensure the region location was read prior to checking the
+		 * generation again.
+		 */
+		memory_load_barrier();
+
+		if (cell->mmio_generation != generation)
+			goto restart;
+
+		if (address >= region.start &&
+		    address + size <= region.start + region.size)
+			goto found;
+	}
+
 	range_start = 0;
 	range_size = cell->num_mmio_regions;
 
@@ -164,25 +432,38 @@ restart:
 			range_size -= index + 1 - range_start;
 			range_start = index + 1;
 		} else {
-			if (region_base != NULL) {
-				*region_base = region.start;
-				*handler = cell->mmio_handlers[index];
-			}
+			goto found;
+		}
+	}
+	goto out;
 
-			/*
-			 * Ensure everything was read prior to checking the
-			 * generation for the last time.
-			 */
-			memory_load_barrier();
+found:
+	if (location != NULL) {
+		*location = region;
+		*handler = cell->mmio_handlers[index];
+	}
 
-			/* final check of consistency */
-			if (cell->mmio_generation != generation)
-				goto restart;
+	/*
+	 * Ensure everything was read prior to checking the generation for the
+	 * last time.
+	 */
+	memory_load_barrier();
 
-			return index;
-		}
-	}
-	return -1;
+	/* final check of consistency */
+	if (cell->mmio_generation != generation)
+		goto restart;
+
+	if (valid_generation != NULL)
+		*valid_generation = generation;
+
+	result = index;
+
+out:
+#ifdef CONFIG_BOUNDED_EXIT_LATENCY
+	if (locked)
+		spin_unlock(&cell->mmio_region_lock);
+#endif
+	return result;
 }
 
 /**
@@ -199,7 +480,7 @@ void mmio_region_unregister(struct cell *cell, unsigned long start)
 
 	spin_lock(&cell->mmio_region_lock);
 
-	index = find_region(cell, start, 1, NULL, NULL);
+	index = find_region(cell, start, 1, NULL, NULL, NULL);
 	if (index >= 0) {
 		/*
 		 * Advance the generation to odd value, indicating that
@@ -214,6 +495,8 @@ void mmio_region_unregister(struct cell *cell, unsigned long start)
 
 		cell->num_mmio_regions--;
 
+		index_rebuild(cell);
+
 		/*
 		 * Ensure all regions and their number are committed before
 		 * advancing the generation.
@@ -224,12 +507,106 @@ void mmio_region_unregister(struct cell *cell, unsigned long start)
 	spin_unlock(&cell->mmio_region_lock);
 }
 
+/**
+ * Invalidate all entries of a per-CPU MMIO region cache.
+ * @param cache		Cache to be flushed.
+ *
+ * Must be called whenever the CPU owning the cache is assigned to a different
+ * cell. The target CPU must not be running in parallel, i.e. it has to be
+ * parked or suspended, or it has to be the caller.
+ */
+void mmio_region_cache_flush(struct mmio_region_cache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+}
+
+static const struct mmio_region_cache_entry *
+cache_lookup(struct mmio_region_cache *cache, struct cell *cell,
+	     unsigned long address, unsigned int size)
+{
+	const struct mmio_region_cache_entry *entry;
+	unsigned long generation = cell->mmio_generation;
+	unsigned int n;
+
+	/*
+	 * Ensure that the generation value was read prior to using any cached
+	 * region. The entries were validated against the generation they are
+	 * tagged with, so they are consistent as long as it did not change.
+	 */
+	memory_load_barrier();
+
+	if (cache->cell != cell || cache->generation != generation)
+		return NULL;
+
+	for (n = 0; n < MMIO_REGION_CACHE_SIZE; n++) {
+		entry = &cache->entries[n];
+		if (address >= entry->location.start &&
+		    address + size <= entry->location.start +
+				      entry->location.size)
+			return entry;
+	}
+	return NULL;
+}
+
+static void cache_insert(struct mmio_region_cache *cache, struct cell *cell,
+			 unsigned long generation,
+			 const struct mmio_region_location *location,
+			 const struct mmio_region_handler *handler)
+{
+	struct mmio_region_cache_entry *entry;
+
+	/* The cell's region table changed or we moved to a new cell. */
+	if (cache->cell != cell || cache->generation != generation) {
+		mmio_region_cache_flush(cache);
+		cache->cell = cell;
+		cache->generation = generation;
+	}
+
+	entry = &cache->entries[cache->next];
+	entry->location = *location;
+	entry->handler = *handler;
+
+	cache->next = (cache->next + 1) % MMIO_REGION_CACHE_SIZE;
+}
+
+static inline void count_access(struct cell *cell, unsigned int counter)
+{
+	cell->mmio_counters[this_cpu_id() * cell->mmio_counters_stride +
+			    counter]++;
+}
+
+/**
+ * Perform all writes the current CPU buffered for posted MMIO regions.
+ *
+ * Must be called on every VM exit that is not dispatched via
+ * mmio_handle_access, so that buffered writes are committed before the
+ * hypervisor acts on behalf of the cell in any other way.
+ */
+void mmio_flush_posted_writes(void)
+{
+	struct mmio_posted_writes *posted = &this_cpu_data()->mmio_posted;
+	unsigned int n;
+
+	if (!posted->count)
+		return;
+
+	for (n = 0; n < posted->count; n++)
+		mmio_perform_access(posted->base, &posted->writes[n]);
+	posted->count = 0;
+}
+
 /**
  * Dispatch MMIO access of a cell CPU.
  * @param mmio		MMIO access description. @a mmio->value will receive the
  * 			result of a successful read access. All @a mmio fields
  * 			may have been modified on return.
  *
+ * The most recently resolved regions are kept in a per-CPU cache which is
+ * consulted before searching the cell's region table.
+ *
+ * Writes buffered for a posted region are committed before any access that
+ * is not a write to that very region.
+ *
  * @return MMIO_HANDLED on success, MMIO_UNHANDLED if no region is registered
  * for the access address and size, or MMIO_ERROR if an access error was
  * detected.
@@ -237,19 +614,185 @@ void mmio_region_unregister(struct cell *cell, unsigned long start)
  * @see mmio_region_register
  * @see mmio_region_unregister
  */
-enum mmio_result mmio_handle_access(struct mmio_access *mmio)
+enum mmio_result __hot mmio_handle_access(struct mmio_access *mmio)
 {
+	struct per_cpu *cpu_data = this_cpu_data();
+	struct mmio_region_cache *cache = &cpu_data->mmio_cache;
+	const struct mmio_region_cache_entry *entry;
+	struct cell *cell = cpu_data->public.cell;
+	struct mmio_region_location location;
 	struct mmio_region_handler handler;
-	unsigned long region_base;
+	unsigned long generation;
+
+	trace_event(JAILHOUSE_TRACE_MMIO, mmio->address, mmio->is_write);
+
+	entry = cache_lookup(cache, cell, mmio->address, mmio->size);
+	if (entry) {
+		cpu_data->public.stats[JAILHOUSE_CPU_STAT_MMIO_CACHE_HITS]++;
+		if (!mmio->is_write ||
+		    entry->handler.arg != cpu_data->mmio_posted.region)
+			mmio_flush_posted_writes();
+		count_access(cell, entry->handler.counter);
+		mmio->address -= entry->location.start;
+		return entry->handler.function(entry->handler.arg, mmio);
+	}
 
-	if (find_region(this_cell(), mmio->address, mmio->size, &region_base,
-			&handler) < 0)
+	cpu_data->public.stats[JAILHOUSE_CPU_STAT_MMIO_CACHE_MISSES]++;
+
+	if (find_region(cell, mmio->address, mmio->size, &location, &handler,
+			&generation) < 0) {
+		mmio_flush_posted_writes();
 		return MMIO_UNHANDLED;
+	}
+
+	if (!mmio->is_write || handler.arg != cpu_data->mmio_posted.region)
+		mmio_flush_posted_writes();
+
+	cache_insert(cache, cell, generation, &location, &handler);
+	count_access(cell, handler.counter);
 
-	mmio->address -= region_base;
+	mmio->address -= location.start;
 	return handler.function(handler.arg, mmio);
 }
 
+/**
+ * Report the MMIO regions of a cell along with their access counts.
+ * @param cell		Cell to report about.
+ * @param stats		Statistics buffer, @a stats->first selects the first
+ * 			region to report.
+ * @param max_regions	Number of regions that fit into @a stats->regions.
+ *
+ * @return Total number of MMIO regions registered for the cell.
+ */
+unsigned int mmio_get_stats(struct cell *cell,
+			    struct jailhouse_mmio_stats *stats,
+			    unsigned int max_regions)
+{
+	struct jailhouse_mmio_region_stats *region;
+	const struct mmio_region_handler *handler;
+	unsigned int first = stats->first;
+	unsigned int n, row, len, total;
+
+	spin_lock(&cell->mmio_region_lock);
+
+	for (n = 0; n < max_regions && first + n < cell->num_mmio_regions;
+	     n++) {
+		region = &stats->regions[n];
+		handler = &cell->mmio_handlers[first + n];
+
+		region->start = cell->mmio_locations[first + n].start;
+		region->size = cell->mmio_locations[first + n].size;
+		region->accesses = 0;
+		for (row = 0; row < cell->mmio_counters_rows; row++)
+			region->accesses += cell->mmio_counters
+				[row * cell->mmio_counters_stride +
+				 handler->counter];
+
+		memset(region->name, 0, sizeof(region->name));
+		for (len = 0; len < sizeof(region->name) - 1 &&
+		     handler->name[len]; len++)
+			region->name[len] = handler->name[len];
+	}
+	stats->num_regions = n;
+	total = cell->num_mmio_regions;
+
+	spin_unlock(&cell->mmio_region_lock);
+
+	return total;
+}
+
+/* Granularity of the per-register access bitmaps of sub-page regions. */
+#define SUBPAGE_REG_SHIFT	2
+
+/**
+ * Sub-page region along with its persistent hypervisor mapping and its access
+ * rules, compiled from the region flags so that checks are cheap.
+ */
+struct mmio_subpage {
+	/** Copy of the region, callers may pass temporary descriptors. */
+	struct jailhouse_memory mem;
+	/** Hypervisor address of the region start. */
+	void *base;
+	/** Permitted access sizes in bytes as bitmask, for reads and writes. */
+	unsigned long sizes[2];
+	/** Masks the misalignment of an access unless it is permitted. */
+	unsigned long align_mask;
+	/** Accessible registers, for reads and writes. */
+	unsigned long *regs[2];
+	/** Storage of the register bitmaps. */
+	unsigned long bitmaps[];
+};
+
+static unsigned long subpage_map_size(const struct jailhouse_memory *mem)
+{
+	return PAGE_ALIGN((mem->phys_start & ~PAGE_MASK) + mem->size);
+}
+
+static unsigned int subpage_bitmap_longs(const struct jailhouse_memory *mem)
+{
+	unsigned long regs = (mem->size + (1 << SUBPAGE_REG_SHIFT) - 1) >>
+		SUBPAGE_REG_SHIFT;
+
+	return (regs + BITS_PER_LONG - 1) / BITS_PER_LONG;
+}
+
+static unsigned long subpage_size(const struct jailhouse_memory *mem)
+{
+	return sizeof(struct mmio_subpage) +
+		2 * subpage_bitmap_longs(mem) * sizeof(unsigned long);
+}
+
+/*
+ * Buffer a validated write to a posted region. Callers ensured that pending
+ * writes target the same region, so only the buffer bound has to be enforced.
+ */
+static void post_write(const struct mmio_subpage *subpage,
+		       const struct mmio_access *mmio)
+{
+	struct mmio_posted_writes *posted = &this_cpu_data()->mmio_posted;
+
+	if (posted->count == MMIO_POSTED_WRITES)
+		mmio_flush_posted_writes();
+
+	posted->base = subpage->base;
+	posted->region = subpage;
+	posted->writes[posted->count++] = *mmio;
+}
+
+static enum mmio_result mmio_handle_subpage(void *arg, struct mmio_access *mmio)
+{
+	const struct mmio_subpage *subpage = arg;
+	unsigned long *regs = subpage->regs[mmio->is_write];
+
+	if (!(subpage->sizes[mmio->is_write] & mmio->size) ||
+	    (mmio->address & (mmio->size - 1) & subpage->align_mask) ||
+	    !test_bit(mmio->address >> SUBPAGE_REG_SHIFT, regs) ||
+	    !test_bit((mmio->address + mmio->size - 1) >> SUBPAGE_REG_SHIFT,
+		      regs))
+		goto invalid_access;
+
+	if (mmio->is_write && subpage->mem.flags & JAILHOUSE_MEM_IO_POSTED)
+		post_write(subpage, mmio);
+	else
+		mmio_perform_access(subpage->base, mmio);
+	return MMIO_HANDLED;
+
+invalid_access:
+	panic_printk("FATAL: Invalid MMIO %s, address: %lx, size: %x\n",
+		     mmio->is_write ? "write" : "read",
+		     (unsigned long)subpage->mem.phys_start + mmio->address,
+		     mmio->size);
+	return MMIO_ERROR;
+}
+
+static void subpage_release(struct mmio_subpage *subpage)
+{
+	paging_unmap_device(subpage->mem.phys_start & PAGE_MASK,
+			    (void *)((unsigned long)subpage->base & PAGE_MASK),
+			    subpage_map_size(&subpage->mem));
+	slab_free(subpage, subpage_size(&subpage->mem));
+}
+
 /**
  * Perform MMIO-specific cleanup for a cell under destruction.
  * @param cell		Cell to be destructed.
@@ -258,10 +801,15 @@ enum mmio_result mmio_handle_access(struct mmio_access *mmio)
  */
 void mmio_cell_exit(struct cell *cell)
 {
-	page_free(&mem_pool, cell->mmio_locations,
-		  PAGES(cell->max_mmio_regions *
-			(sizeof(struct mmio_region_location) +
-			 sizeof(struct mmio_region_handler))));
+	unsigned int n;
+
+	for (n = 0; n < cell->num_mmio_regions; n++)
+		if (cell->mmio_handlers[n].function == mmio_handle_subpage)
+			subpage_release(cell->mmio_handlers[n].arg);
+
+	slab_free(cell->mmio_locations, mmio_cell_size(cell));
+	if (cell->mmio_index)
+		slab_free(cell->mmio_index, index_size(cell->mmio_index));
 }
 
 void mmio_perform_access(void *base, struct mmio_access *mmio)
@@ -304,66 +852,119 @@ void mmio_perform_access(void *base, struct mmio_access *mmio)
 		}
 }
 
-static enum mmio_result mmio_handle_subpage(void *arg, struct mmio_access *mmio)
+/**
+ * Register a sub-page memory region of a cell for access emulation.
+ * @param cell		Cell owning the region.
+ * @param mem		Region descriptor. It is copied, thus may be
+ * 			temporary.
+ *
+ * The device pages behind the region are mapped into the hypervisor once,
+ * so that accesses only need to be checked and performed.
+ *
+ * @return 0 on success, negative error code otherwise.
+ *
+ * @see mmio_subpage_unregister
+ */
+int mmio_subpage_register(struct cell *cell, const struct jailhouse_memory *mem)
 {
-	const struct jailhouse_memory *mem = arg;
-	u64 perm = mmio->is_write ? JAILHOUSE_MEM_WRITE : JAILHOUSE_MEM_READ;
-	unsigned long page_phys =
-		((unsigned long)mem->phys_start + mmio->address) & PAGE_MASK;
-	unsigned long virt_base;
-	int err;
-
-	/* check read/write access permissions */
-	if (!(mem->flags & perm))
-		goto invalid_access;
+	unsigned int longs = subpage_bitmap_longs(mem);
+	/* width flags are bits 1, 2, 4 and 8 when shifted down, like sizes */
+	unsigned long widths =
+		(mem->flags >> JAILHOUSE_MEM_IO_WIDTH_SHIFT) & 0xf;
+	struct mmio_subpage *subpage;
+	void *pages;
 
-	/* width bit according to access size needs to be set */
-	if (!((mmio->size << JAILHOUSE_MEM_IO_WIDTH_SHIFT) & mem->flags))
-		goto invalid_access;
+	subpage = slab_alloc(subpage_size(mem));
+	if (!subpage)
+		return -ENOMEM;
 
-	/* naturally unaligned access needs to be allowed explicitly */
-	if (mmio->address & (mmio->size - 1) &&
-	    !(mem->flags & JAILHOUSE_MEM_IO_UNALIGNED))
-		goto invalid_access;
+	pages = paging_map_device(mem->phys_start & PAGE_MASK,
+				  subpage_map_size(mem));
+	if (!pages) {
+		slab_free(subpage, subpage_size(mem));
+		return -ENOMEM;
+	}
 
-	err = paging_create(&this_cpu_data()->pg_structs, page_phys, PAGE_SIZE,
-			    TEMPORARY_MAPPING_BASE,
-			    PAGE_DEFAULT_FLAGS | PAGE_FLAG_DEVICE,
-			    PAGING_NON_COHERENT);
-	if (err)
-		goto invalid_access;
+	subpage->mem = *mem;
+	subpage->base = pages + (mem->phys_start & ~PAGE_MASK);
 
-	/*
-	 * This virt_base gives the following effective virtual address in
-	 * mmio_perform_access:
-	 *
-	 *     TEMPORARY_MAPPING_BASE + (mem->phys_start & ~PAGE_MASK) +
-	 *         (mmio->address & ~PAGE_MASK)
-	 *
-	 * Reason: mmio_perform_access does addr = base + mmio->address.
-	 */
-	virt_base = TEMPORARY_MAPPING_BASE + (mem->phys_start & ~PAGE_MASK) -
-		(mmio->address & PAGE_MASK);
-	mmio_perform_access((void *)virt_base, mmio);
-	return MMIO_HANDLED;
+	subpage->sizes[0] = (mem->flags & JAILHOUSE_MEM_READ) ? widths : 0;
+	subpage->sizes[1] = (mem->flags & JAILHOUSE_MEM_WRITE) ? widths : 0;
+	subpage->align_mask =
+		(mem->flags & JAILHOUSE_MEM_IO_UNALIGNED) ? 0 : ~0UL;
 
-invalid_access:
-	panic_printk("FATAL: Invalid MMIO %s, address: %lx, size: %x\n",
-		     mmio->is_write ? "write" : "read",
-		     (unsigned long)mem->phys_start + mmio->address,
-		     mmio->size);
-	return MMIO_ERROR;
-}
+	/* all registers are accessible until restricted */
+	subpage->regs[0] = subpage->bitmaps;
+	subpage->regs[1] = subpage->bitmaps + longs;
+	memset(subpage->bitmaps, 0xff, 2 * longs * sizeof(unsigned long));
 
-int mmio_subpage_register(struct cell *cell, const struct jailhouse_memory *mem)
-{
 	mmio_region_register(cell, mem->virt_start, mem->size,
-			     mmio_handle_subpage, (void *)mem);
+			     mmio_handle_subpage, subpage, "subpage");
 	return 0;
 }
 
+/**
+ * Unregister a sub-page memory region and release its mapping.
+ * @param cell		Cell owning the region.
+ * @param mem		Region descriptor.
+ *
+ * @see mmio_subpage_register
+ */
 void mmio_subpage_unregister(struct cell *cell,
 			     const struct jailhouse_memory *mem)
 {
+	struct mmio_region_location location;
+	struct mmio_region_handler handler;
+
+	if (find_region(cell, mem->virt_start, 1, &location, &handler,
+			NULL) < 0 ||
+	    handler.function != mmio_handle_subpage)
+		return;
+
 	mmio_region_unregister(cell, mem->virt_start);
+	subpage_release(handler.arg);
+}
+
+/**
+ * Restrict the access to some registers of a sub-page region, e.g. when
+ * sharing a device between cells at register granularity.
+ * @param cell		Cell owning the region.
+ * @param start		Start of the region in cell address space.
+ * @param offset	Offset of the first register to restrict.
+ * @param size		Size of the register range.
+ * @param flags		Accesses that remain permitted within the range,
+ * 			JAILHOUSE_MEM_READ and/or JAILHOUSE_MEM_WRITE.
+ *
+ * The granularity of the rules is 4 bytes. The region must be registered via
+ * mmio_subpage_register before, and its cell must not run while the rules are
+ * changed.
+ *
+ * @return 0 on success, -EINVAL if there is no such region or the range
+ * exceeds it.
+ */
+int mmio_subpage_restrict(struct cell *cell, unsigned long start,
+			  unsigned long offset, unsigned long size,
+			  unsigned long flags)
+{
+	struct mmio_region_location location;
+	struct mmio_region_handler handler;
+	struct mmio_subpage *subpage;
+	unsigned long reg;
+
+	if (find_region(cell, start, 1, &location, &handler, NULL) < 0 ||
+	    handler.function != mmio_handle_subpage ||
+	    location.start != start || size == 0 ||
+	    offset + size > location.size)
+		return -EINVAL;
+
+	subpage = handler.arg;
+	for (reg = offset >> SUBPAGE_REG_SHIFT;
+	     reg <= (offset + size - 1) >> SUBPAGE_REG_SHIFT; reg++) {
+		if (!(flags & JAILHOUSE_MEM_READ))
+			clear_bit(reg, subpage->regs[0]);
+		if (!(flags & JAILHOUSE_MEM_WRITE))
+			clear_bit(reg, subpage->regs[1]);
+	}
+
+	return 0;
 }
@@ -15,6 +15,7 @@
 #include <jailhouse/string.h>
 #include <jailhouse/control.h>
 #include <asm/bitops.h>
+#include <asm/spinlock.h>
 
 #define BITS_PER_PAGE		(PAGE_SIZE * 8)
 
@@ -22,6 +23,8 @@
 
 #define PAGE_SCRUB_ON_FREE	0x1
 
+#define MAX_MEM_POOL_DONATIONS	16
+
 extern u8 __page_pool[];
 
 /**
@@ -41,6 +44,26 @@ struct page_pool remap_pool = {
 	.pages = BITS_PER_PAGE * NUM_REMAP_BITMAP_PAGES,
 };
 
+/*
+ * Chunks of root cell memory that extend mem_pool, unused slots have no pages.
+ * They are mapped at their physical address plus page_offset so that
+ * paging_hvirt2phys and paging_phys2hvirt remain valid for them.
+ */
+static struct page_pool donated_pools[MAX_MEM_POOL_DONATIONS];
+
+/*
+ * Chunks of reserved memory local to the NUMA nodes of the system
+ * configuration. They are mapped like donated chunks but keep their bitmaps
+ * in mem_pool. Allocations overflow into mem_pool.
+ */
+static struct page_pool numa_pools[JAILHOUSE_MAX_NUMA_NODES];
+
+/*
+ * Protects all pools. Allocations are mostly done by serialized management
+ * operations, but CPUs set up their paging structures concurrently.
+ */
+static DEFINE_SPINLOCK(pool_lock);
+
 /** Descriptor of the hypervisor paging structures. */
 struct paging_structures hv_paging_structs;
 
@@ -61,6 +84,120 @@ unsigned long paging_get_phys_invalid(pt_entry_t pte, unsigned long virt)
 	return INVALID_PHYS_ADDR;
 }
 
+/**
+ * Number of bitmap words required to describe the given number of pages.
+ */
+static unsigned long bitmap_words(unsigned long pages)
+{
+	return (pages + BITS_PER_LONG - 1) / BITS_PER_LONG;
+}
+
+/**
+ * Number of pages required to hold the used, full and scrub bitmaps of a pool.
+ */
+static unsigned long pool_bitmap_pages(unsigned long pages)
+{
+	unsigned long words = bitmap_words(pages);
+
+	return PAGES((2 * words + bitmap_words(words)) *
+		     sizeof(unsigned long));
+}
+
+static void init_pool_bitmaps(struct page_pool *pool, unsigned long *bitmap)
+{
+	pool->used_bitmap = bitmap;
+	pool->scrub_bitmap = bitmap + bitmap_words(pool->pages);
+	pool->full_bitmap = bitmap + 2 * bitmap_words(pool->pages);
+}
+
+/*
+ * Set or clear a range of bits, updating whole bitmap words at once. If
+ * full_bitmap is provided, it is kept in sync with the words that became
+ * completely set.
+ */
+static void update_bitmap(unsigned long *bitmap, unsigned long *full_bitmap,
+			  unsigned long start, unsigned long num, bool set)
+{
+	unsigned long bmp_pos, bits, mask;
+
+	while (num > 0) {
+		bmp_pos = start / BITS_PER_LONG;
+		bits = MIN(num, BITS_PER_LONG - start % BITS_PER_LONG);
+		mask = bits == BITS_PER_LONG ? ~0UL :
+			((1UL << bits) - 1) << (start % BITS_PER_LONG);
+
+		if (set)
+			bitmap[bmp_pos] |= mask;
+		else
+			bitmap[bmp_pos] &= ~mask;
+
+		if (full_bitmap) {
+			if (bitmap[bmp_pos] == ~0UL)
+				set_bit(bmp_pos, full_bitmap);
+			else
+				clear_bit(bmp_pos, full_bitmap);
+		}
+
+		start += bits;
+		num -= bits;
+	}
+}
+
+/*
+ * Return the first bit in the range [start, end) that has the given value or
+ * end if there is none.
+ */
+static unsigned long find_next_bit_value(const unsigned long *bitmap,
+					 unsigned long start, unsigned long end,
+					 bool set)
+{
+	unsigned long bmp_pos, bmp_val, nr;
+	unsigned long start_mask = ~0UL << (start % BITS_PER_LONG);
+
+	for (bmp_pos = start / BITS_PER_LONG; bmp_pos * BITS_PER_LONG < end;
+	     bmp_pos++) {
+		bmp_val = (set ? bitmap[bmp_pos] : ~bitmap[bmp_pos]) &
+			start_mask;
+		start_mask = ~0UL;
+		if (bmp_val != 0) {
+			nr = ffsl(bmp_val) + bmp_pos * BITS_PER_LONG;
+			return MIN(nr, end);
+		}
+	}
+
+	return end;
+}
+
+static void mark_pages(struct page_pool *pool, unsigned long start,
+		       unsigned long num, bool used)
+{
+	update_bitmap(pool->used_bitmap, pool->full_bitmap, start, num, used);
+}
+
+/*
+ * Zero out those pages of the range that were released since their last
+ * scrubbing, batching consecutive ones.
+ */
+static void scrub_pages(struct page_pool *pool, unsigned long start,
+			unsigned long num)
+{
+	unsigned long end = start + num, dirty_end;
+
+	while (1) {
+		start = find_next_bit_value(pool->scrub_bitmap, start, end,
+					    true);
+		if (start == end)
+			break;
+		dirty_end = find_next_bit_value(pool->scrub_bitmap, start,
+						end, false);
+		memset(pool->base_address + start * PAGE_SIZE, 0,
+		       (dirty_end - start) * PAGE_SIZE);
+		update_bitmap(pool->scrub_bitmap, NULL, start,
+			      dirty_end - start, false);
+		start = dirty_end;
+	}
+}
+
 static unsigned long find_next_free_page(struct page_pool *pool,
 					 unsigned long start)
 {
@@ -78,7 +215,14 @@ static unsigned long find_next_free_page(struct page_pool *pool,
 		start_mask = ~0UL >> (BITS_PER_LONG - (start % BITS_PER_LONG));
 
 	for (bmp_pos = start / BITS_PER_LONG;
-	     bmp_pos < pool->pages / BITS_PER_LONG; bmp_pos++) {
+	     bmp_pos < bitmap_words(pool->pages); bmp_pos++) {
+		/* Skip groups of completely used bitmap words at once. */
+		if (pool->full_bitmap[bmp_pos / BITS_PER_LONG] == ~0UL) {
+			bmp_pos |= BITS_PER_LONG - 1;
+			start_mask = 0;
+			continue;
+		}
+
 		bmp_val = pool->used_bitmap[bmp_pos] | start_mask;
 		start_mask = 0;
 		if (bmp_val != ~0UL) {
@@ -92,25 +236,25 @@ static unsigned long find_next_free_page(struct page_pool *pool,
 	return INVALID_PAGE_NR;
 }
 
-/**
- * Allocate consecutive pages from the specified pool.
- * @param pool		Page pool to allocate from.
- * @param num		Number of pages.
- * @param align_mask	Choose start so that start_page_no & align_mask == 0.
- *
- * @return Pointer to first page or NULL if allocation failed.
- *
- * @see page_free
+/*
+ * Return the first used page in the range [start, end) or end if there is
+ * none.
  */
-static void *page_alloc_internal(struct page_pool *pool, unsigned int num,
+static unsigned long find_next_used_page(struct page_pool *pool,
+					 unsigned long start,
+					 unsigned long end)
+{
+	return find_next_bit_value(pool->used_bitmap, start, end, true);
+}
+
+static void *page_alloc_unlocked(struct page_pool *pool, unsigned int num,
 				 unsigned long align_mask)
 {
 	/* The pool itself might not be aligned as required. */
 	unsigned long aligned_start =
 		((unsigned long)pool->base_address >> PAGE_SHIFT) & align_mask;
 	unsigned long next = aligned_start;
-	unsigned long start, last;
-	unsigned int allocated;
+	unsigned long start, used;
 
 restart:
 	/* Forward the search start to the next aligned page. */
@@ -125,23 +269,63 @@ restart:
 	if ((start - aligned_start) & align_mask)
 		goto restart;
 
-	for (allocated = 1, last = start; allocated < num;
-	     allocated++, last = next) {
-		next = find_next_free_page(pool, last + 1);
-		if (next == INVALID_PAGE_NR)
-			return NULL;
-		if (next != last + 1)
-			goto restart;	/* not consecutive */
-	}
+	if (start + num > pool->pages)
+		return NULL;
 
-	for (allocated = 0; allocated < num; allocated++)
-		set_bit(start + allocated, pool->used_bitmap);
+	/* Not consecutive? Continue behind the page that is in the way. */
+	used = find_next_used_page(pool, start, start + num);
+	if (used < start + num) {
+		next = used + 1;
+		goto restart;
+	}
 
+	mark_pages(pool, start, num, true);
 	pool->used_pages += num;
 
+	if (pool->flags & PAGE_SCRUB_ON_FREE)
+		scrub_pages(pool, start, num);
+
 	return pool->base_address + start * PAGE_SIZE;
 }
 
+/**
+ * Allocate consecutive pages from the specified pool.
+ * @param pool		Page pool to allocate from.
+ * @param num		Number of pages.
+ * @param align_mask	Choose start so that start_page_no & align_mask == 0.
+ *
+ * @return Pointer to first page or NULL if allocation failed.
+ *
+ * @see page_free
+ */
+static bool is_numa_pool(const struct page_pool *pool)
+{
+	return pool >= numa_pools &&
+		pool < numa_pools + JAILHOUSE_MAX_NUMA_NODES;
+}
+
+static void *page_alloc_internal(struct page_pool *pool, unsigned int num,
+				 unsigned long align_mask)
+{
+	void *pages;
+	unsigned int n;
+
+	spin_lock(&pool_lock);
+	pages = page_alloc_unlocked(pool, num, align_mask);
+	if (!pages && is_numa_pool(pool)) {
+		pool = &mem_pool;
+		pages = page_alloc_unlocked(pool, num, align_mask);
+	}
+	/* fall back to memory donated by the root cell */
+	for (n = 0; !pages && pool == &mem_pool &&
+	     n < MAX_MEM_POOL_DONATIONS; n++)
+		pages = page_alloc_unlocked(&donated_pools[n], num,
+					    align_mask);
+	spin_unlock(&pool_lock);
+
+	return pages;
+}
+
 /**
  * Allocate consecutive pages from the specified pool.
  * @param pool	Page pool to allocate from.
@@ -170,6 +354,12 @@ void *page_alloc_aligned(struct page_pool *pool, unsigned int num)
 	return page_alloc_internal(pool, num, num - 1);
 }
 
+static bool pool_contains(const struct page_pool *pool, const void *page)
+{
+	return page >= pool->base_address &&
+		page < pool->base_address + pool->pages * PAGE_SIZE;
+}
+
 /**
  * Release pages to the specified pool.
  * @param pool	Page pool to release to.
@@ -181,18 +371,59 @@ void *page_alloc_aligned(struct page_pool *pool, unsigned int num)
 void page_free(struct page_pool *pool, void *page, unsigned int num)
 {
 	unsigned long page_nr;
+	unsigned int n;
 
 	if (!page)
 		return;
 
-	while (num-- > 0) {
-		if (pool->flags & PAGE_SCRUB_ON_FREE)
-			memset(page, 0, PAGE_SIZE);
-		page_nr = (page - pool->base_address) / PAGE_SIZE;
-		clear_bit(page_nr, pool->used_bitmap);
-		pool->used_pages--;
-		page += PAGE_SIZE;
+	spin_lock(&pool_lock);
+
+	/* pages of a node-local pool may have overflowed into mem_pool */
+	if (is_numa_pool(pool) && !pool_contains(pool, page))
+		pool = &mem_pool;
+	for (n = 0; pool == &mem_pool && n < MAX_MEM_POOL_DONATIONS; n++)
+		if (pool_contains(&donated_pools[n], page)) {
+			pool = &donated_pools[n];
+			break;
+		}
+	for (n = 0; pool == &mem_pool && n < JAILHOUSE_MAX_NUMA_NODES; n++)
+		if (pool_contains(&numa_pools[n], page)) {
+			pool = &numa_pools[n];
+			break;
+		}
+
+	page_nr = (page - pool->base_address) / PAGE_SIZE;
+
+	mark_pages(pool, page_nr, num, false);
+	pool->used_pages -= num;
+
+	/* Scrubbing is deferred until the pages are allocated again. */
+	if (pool->flags & PAGE_SCRUB_ON_FREE)
+		update_bitmap(pool->scrub_bitmap, NULL, page_nr, num, true);
+	spin_unlock(&pool_lock);
+}
+
+/**
+ * Analyze the fragmentation of the specified pool.
+ * @param pool		Page pool to analyze.
+ * @param largest	Set to the size of the largest free extent in pages.
+ *
+ * @return Number of free extents, i.e. runs of consecutive free pages.
+ */
+unsigned long page_pool_free_extents(struct page_pool *pool,
+				     unsigned long *largest)
+{
+	unsigned long extents = 0, start, end;
+
+	*largest = 0;
+	for (start = find_next_free_page(pool, 0); start != INVALID_PAGE_NR;
+	     start = find_next_free_page(pool, end)) {
+		end = find_next_used_page(pool, start, pool->pages);
+		*largest = MAX(*largest, end - start);
+		extents++;
 	}
+
+	return extents;
 }
 
 /**
@@ -236,9 +467,14 @@ static void flush_pt_entry(pt_entry_t pte, enum paging_coherent coherent)
 		arch_paging_flush_cpu_caches(pte, sizeof(*pte));
 }
 
-static int split_hugepage(bool hv_paging, const struct paging *paging,
-			  pt_entry_t pte, unsigned long virt,
-			  enum paging_coherent coherent)
+static struct page_pool *pt_pool(const struct paging_structures *pg_structs)
+{
+	return pg_structs->pt_pool ? pg_structs->pt_pool : &mem_pool;
+}
+
+static int split_hugepage(const struct paging_structures *pg_structs,
+			  const struct paging *paging, pt_entry_t pte,
+			  unsigned long virt, enum paging_coherent coherent)
 {
 	unsigned long phys = paging->get_phys(pte, virt);
 	struct paging_structures sub_structs;
@@ -253,9 +489,11 @@ static int split_hugepage(bool hv_paging, const struct paging *paging,
 
 	flags = paging->get_flags(pte);
 
-	sub_structs.hv_paging = hv_paging;
+	sub_structs.hv_paging = pg_structs->hv_paging;
 	sub_structs.root_paging = paging + 1;
-	sub_structs.root_table = page_alloc(&mem_pool, 1);
+	sub_structs.pt_pool = pg_structs->pt_pool;
+	sub_structs.no_merge = pg_structs->no_merge;
+	sub_structs.root_table = page_alloc(pt_pool(pg_structs), 1);
 	if (!sub_structs.root_table)
 		return -ENOMEM;
 	paging->set_next_pt(pte, paging_hvirt2phys(sub_structs.root_table));
@@ -265,6 +503,71 @@ static int split_hugepage(bool hv_paging, const struct paging *paging,
 			     flags, coherent);
 }
 
+static bool table_mergeable(const struct paging *paging, page_table_t pt,
+			    unsigned long virt, unsigned long size,
+			    unsigned long *phys, unsigned long *flags)
+{
+	unsigned long offs, entry_phys;
+	pt_entry_t pte;
+
+	for (offs = 0; offs < size; offs += paging->page_size) {
+		pte = paging->get_entry(pt, virt + offs);
+		if (!paging->entry_valid(pte, PAGE_PRESENT_FLAGS))
+			return false;
+		entry_phys = paging->get_phys(pte, virt + offs);
+		if (offs == 0) {
+			if (entry_phys == INVALID_PHYS_ADDR ||
+			    (entry_phys & (size - 1)) != 0)
+				return false;
+			*phys = entry_phys;
+			*flags = paging->get_flags(pte);
+		} else if (entry_phys != *phys + offs ||
+			   paging->get_flags(pte) != *flags) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Replace the tables on the path to a just written terminal entry by hugepage
+ * entries of their parents as long as they map a physically contiguous,
+ * aligned range with identical flags. This restores hugepages that were split
+ * when parts of them were handed to a cell. Tables are only checked once their
+ * last entry or the last one of the requested range was written.
+ */
+static void merge_tables(const struct paging_structures *pg_structs,
+			 const struct paging *paging, unsigned int level,
+			 page_table_t *pts, pt_entry_t *ptes,
+			 unsigned long virt, bool last,
+			 enum paging_coherent coherent)
+{
+	unsigned long phys, flags, size;
+	const struct paging *parent;
+
+	if (level == 0 || (paging - 1)->page_size == 0)
+		return;
+	if (!last && ((virt + paging->page_size) &
+		      ((paging - 1)->page_size - 1)) != 0)
+		return;
+
+	while (level > 0) {
+		parent = paging - 1;
+		size = parent->page_size;
+		if (size == 0 ||
+		    !table_mergeable(paging, pts[level], virt & ~(size - 1),
+				     size, &phys, &flags))
+			return;
+
+		parent->set_terminal(ptes[level - 1], phys, flags);
+		flush_pt_entry(ptes[level - 1], coherent);
+		page_free(pt_pool(pg_structs), pts[level], 1);
+
+		paging = parent;
+		level--;
+	}
+}
+
 /**
  * Create or modify a page map.
  * @param pg_structs	Descriptor of paging structures to be used.
@@ -278,7 +581,15 @@ static int split_hugepage(bool hv_paging, const struct paging *paging,
  * @return 0 on success, negative error code otherwise.
  *
  * @note The function aims at using the largest possible page size for the
- * mapping but does not consolidate with neighboring mappings.
+ * mapping. The page size is chosen per step, so unaligned heads and tails of a
+ * region are mapped with smaller pages while its aligned middle still gets
+ * hugepages, provided physical and virtual addresses share the same offset
+ * into them. Except for hypervisor paging structures, page tables that end up
+ * mapping a contiguous range with identical flags are merged into a hugepage
+ * of their parent, also with neighboring mappings. Callers have to flush TLBs
+ * of the surrounding hugepages then, see paging_max_page_size(). Structures
+ * with paging_structures::no_merge set are never merged, mappings can then be
+ * added while other CPUs walk them.
  *
  * @see paging_destroy
  * @see paging_get_guest_pages
@@ -294,12 +605,17 @@ int paging_create(const struct paging_structures *pg_structs,
 	while (size > 0) {
 		const struct paging *paging = pg_structs->root_paging;
 		page_table_t pt = pg_structs->root_table;
+		page_table_t pts[MAX_PAGE_TABLE_LEVELS];
+		pt_entry_t ptes[MAX_PAGE_TABLE_LEVELS];
 		struct paging_structures sub_structs;
+		unsigned int level = 0;
 		pt_entry_t pte;
 		int err;
 
 		while (1) {
 			pte = paging->get_entry(pt, virt);
+			pts[level] = pt;
+			ptes[level] = pte;
 			if (paging->page_size > 0 &&
 			    paging->page_size <= size &&
 			    ((phys | virt) & (paging->page_size - 1)) == 0) {
@@ -314,6 +630,10 @@ int paging_create(const struct paging_structures *pg_structs,
 					sub_structs.root_table = pt;
 					sub_structs.hv_paging =
 						pg_structs->hv_paging;
+					sub_structs.pt_pool =
+						pg_structs->pt_pool;
+					sub_structs.no_merge =
+						pg_structs->no_merge;
 					paging_destroy(&sub_structs, virt,
 						       paging->page_size,
 						       coherent);
@@ -323,15 +643,14 @@ int paging_create(const struct paging_structures *pg_structs,
 				break;
 			}
 			if (paging->entry_valid(pte, PAGE_PRESENT_FLAGS)) {
-				err = split_hugepage(pg_structs->hv_paging,
-						     paging, pte, virt,
-						     coherent);
+				err = split_hugepage(pg_structs, paging, pte,
+						     virt, coherent);
 				if (err)
 					return err;
 				pt = paging_phys2hvirt(
 						paging->get_next_pt(pte));
 			} else {
-				pt = page_alloc(&mem_pool, 1);
+				pt = page_alloc(pt_pool(pg_structs), 1);
 				if (!pt)
 					return -ENOMEM;
 				paging->set_next_pt(pte,
@@ -339,9 +658,13 @@ int paging_create(const struct paging_structures *pg_structs,
 				flush_pt_entry(pte, coherent);
 			}
 			paging++;
+			level++;
 		}
 		if (pg_structs->hv_paging)
 			arch_paging_flush_page_tlbs(virt);
+		else if (!pg_structs->no_merge)
+			merge_tables(pg_structs, paging, level, pts, ptes, virt,
+				     size == paging->page_size, coherent);
 
 		phys += paging->page_size;
 		virt += paging->page_size;
@@ -390,9 +713,8 @@ int paging_destroy(const struct paging_structures *pg_structs,
 				if (paging->page_size <= size)
 					break;
 
-				err = split_hugepage(pg_structs->hv_paging,
-						     paging, pte, virt,
-						     coherent);
+				err = split_hugepage(pg_structs, paging, pte,
+						     virt, coherent);
 				if (err)
 					return err;
 			}
@@ -408,7 +730,7 @@ int paging_destroy(const struct paging_structures *pg_structs,
 			flush_pt_entry(pte, coherent);
 			if (n == 0 || !paging->page_table_empty(pt[n]))
 				break;
-			page_free(&mem_pool, pt[n], 1);
+			page_free(pt_pool(pg_structs), pt[n], 1);
 			paging--;
 			pte = paging->get_entry(pt[--n], virt);
 		}
@@ -423,31 +745,189 @@ int paging_destroy(const struct paging_structures *pg_structs,
 	return 0;
 }
 
+/**
+ * Get the largest page size supported by paging structures.
+ * @param pg_structs	Descriptor of paging structures to be used.
+ *
+ * @return Page size in bytes.
+ *
+ * @see paging_create
+ */
+unsigned long paging_max_page_size(const struct paging_structures *pg_structs)
+{
+	const struct paging *paging = pg_structs->root_paging;
+
+	while (paging->page_size == 0)
+		paging++;
+	return paging->page_size;
+}
+
+/**
+ * Count the terminal entries that map a region, grouped by page table level.
+ * @param pg_structs	Descriptor of paging structures to be used.
+ * @param virt		Virtual start address of the region.
+ * @param size		Size of the region.
+ * @param entries	Array receiving the counters, indexed by page table
+ * 			level. Counters are incremented, not reset.
+ *
+ * @note A hugepage that extends beyond the region is counted once per call
+ * it is touched by.
+ */
+void paging_count_entries(const struct paging_structures *pg_structs,
+			  unsigned long virt, unsigned long size,
+			  unsigned long entries[MAX_PAGE_TABLE_LEVELS])
+{
+	unsigned long end = PAGE_ALIGN(virt + size);
+	unsigned long page_size, next;
+
+	virt &= PAGE_MASK;
+
+	while (virt < end) {
+		const struct paging *paging = pg_structs->root_paging;
+		page_table_t pt = pg_structs->root_table;
+		unsigned int n = 0;
+		pt_entry_t pte;
+
+		while (1) {
+			pte = paging->get_entry(pt, virt);
+			if (!paging->entry_valid(pte, PAGE_PRESENT_FLAGS))
+				break;
+			if (paging->get_phys(pte, virt) != INVALID_PHYS_ADDR) {
+				entries[n]++;
+				break;
+			}
+			pt = paging_phys2hvirt(paging->get_next_pt(pte));
+			paging++;
+			n++;
+		}
+		page_size = paging->page_size ? paging->page_size : PAGE_SIZE;
+
+		/* continue at the start of the next entry, stop on wrap-around */
+		next = (virt & ~(page_size - 1)) + page_size;
+		if (next < virt)
+			break;
+		virt = next;
+	}
+}
+
+/*
+ * Bumped whenever the guest-physical memory layout of any cell may have
+ * changed. Starts at 1 so that the zero-initialized per-CPU caches are
+ * considered stale.
+ */
+static unsigned long guest_pt_generation = 1;
+
+/**
+ * Invalidate the guest page table location caches of all CPUs.
+ *
+ * Must be called after changing the guest-physical memory layout of a cell.
+ * The CPUs of affected cells must not be running in parallel, i.e. they
+ * have to be parked or suspended.
+ */
+void paging_guest_pt_cache_invalidate(void)
+{
+	guest_pt_generation++;
+}
+
+/*
+ * Translate the guest-physical address of a guest page table. Only the
+ * location is cached, the entries are always read from the guest's tables
+ * so that guest updates take effect without any invalidation.
+ */
+static unsigned long guest_pt_gphys2phys(unsigned long gphys)
+{
+	struct guest_pt_cache *cache = &this_cpu_data()->guest_pt_cache;
+	unsigned long phys;
+	unsigned int n;
+
+	if (cache->generation != guest_pt_generation) {
+		for (n = 0; n < GUEST_PT_CACHE_SIZE; n++)
+			cache->entries[n].gphys = INVALID_PHYS_ADDR;
+		cache->generation = guest_pt_generation;
+	}
+
+	for (n = 0; n < GUEST_PT_CACHE_SIZE; n++)
+		if (cache->entries[n].gphys == gphys)
+			return cache->entries[n].phys;
+
+	phys = arch_paging_gphys2phys(gphys, PAGE_READONLY_FLAGS);
+	if (phys != INVALID_PHYS_ADDR) {
+		cache->entries[cache->next].gphys = gphys;
+		cache->entries[cache->next].phys = phys;
+		cache->next = (cache->next + 1) % GUEST_PT_CACHE_SIZE;
+	}
+	return phys;
+}
+
+/* Pick a slot already mapping phys with flags or the least recently used. */
+static unsigned int temporary_slot_lookup(unsigned long phys,
+					  unsigned long flags)
+{
+	struct temporary_mapping *mappings = this_cpu_data()->temp_mappings;
+	unsigned int n, lru = 0;
+
+	for (n = 0; n < NUM_TEMPORARY_PAGES; n++) {
+		if (mappings[n].phys == phys && mappings[n].flags == flags)
+			return n;
+		if (mappings[n].last_use < mappings[lru].last_use)
+			lru = n;
+	}
+	return lru;
+}
+
+/*
+ * Map a page into the given temporary slot of the calling CPU. Page table
+ * update and TLB flush are skipped if the slot already provides the mapping.
+ */
+static void *temporary_slot_map(unsigned int slot, unsigned long phys,
+				unsigned long flags)
+{
+	struct per_cpu *cpu_data = this_cpu_data();
+	struct temporary_mapping *mapping = &cpu_data->temp_mappings[slot];
+	unsigned long virt = TEMPORARY_MAPPING_BASE + slot * PAGE_SIZE;
+
+	if (mapping->phys != phys || mapping->flags != flags) {
+		if (paging_create(&cpu_data->pg_structs, phys, PAGE_SIZE, virt,
+				  flags, PAGING_NON_COHERENT) != 0) {
+			mapping->phys = INVALID_PHYS_ADDR;
+			return NULL;
+		}
+		mapping->phys = phys;
+		mapping->flags = flags;
+	}
+	mapping->last_use = ++cpu_data->temp_mapping_clock;
+
+	return (void *)virt;
+}
+
+/*
+ * Page tables are mapped via the given slot or, if slot is negative, via any
+ * slot that is already mapping them or was least recently used.
+ */
 static unsigned long
 paging_gvirt2gphys(const struct guest_paging_structures *pg_structs,
-		   unsigned long gvirt, unsigned long tmp_page,
-		   unsigned long flags)
+		   unsigned long gvirt, int slot, unsigned long flags)
 {
 	unsigned long page_table_gphys = pg_structs->root_table_gphys;
 	const struct paging *paging = pg_structs->root_paging;
 	unsigned long gphys, phys;
+	page_table_t page_table;
 	pt_entry_t pte;
-	int err;
 
 	while (1) {
 		/* map guest page table */
-		phys = arch_paging_gphys2phys(page_table_gphys,
-					      PAGE_READONLY_FLAGS);
+		phys = guest_pt_gphys2phys(page_table_gphys);
 		if (phys == INVALID_PHYS_ADDR)
 			return INVALID_PHYS_ADDR;
-		err = paging_create(&this_cpu_data()->pg_structs, phys,
-				    PAGE_SIZE, tmp_page, PAGE_READONLY_FLAGS,
-				    PAGING_NON_COHERENT);
-		if (err)
+		page_table = temporary_slot_map(slot >= 0 ? slot :
+				temporary_slot_lookup(phys,
+						      PAGE_READONLY_FLAGS),
+				phys, PAGE_READONLY_FLAGS);
+		if (!page_table)
 			return INVALID_PHYS_ADDR;
 
 		/* evaluate page table entry */
-		pte = paging->get_entry((page_table_t)tmp_page, gvirt);
+		pte = paging->get_entry(page_table, gvirt);
 		if (!paging->entry_valid(pte, flags))
 			return INVALID_PHYS_ADDR;
 		gphys = paging->get_phys(pte, gvirt);
@@ -535,6 +1015,50 @@ int paging_create_hvpt_link(const struct paging_structures *pg_dest_structs,
 	return 0;
 }
 
+/**
+ * Forget the targets of the temporary mapping slots of a CPU.
+ * @param cpu_data	Data structure of the CPU.
+ *
+ * Must be called when the CPU's temporary mapping region is set up.
+ */
+void paging_reset_temporary(struct per_cpu *cpu_data)
+{
+	unsigned int n;
+
+	for (n = 0; n < NUM_TEMPORARY_PAGES; n++)
+		cpu_data->temp_mappings[n].phys = INVALID_PHYS_ADDR;
+}
+
+/**
+ * Map physical pages temporarily into the hypervisor address space.
+ * @param phys		Physical address of the first page to be mapped.
+ * @param num		Number of pages to be mapped.
+ * @param flags		Access flags for the mapping, see
+ * 			@ref PAGE_FLAGS.
+ *
+ * @return Pointer to first mapped page or @c NULL on error.
+ *
+ * @note The same restrictions as for paging_get_guest_pages() apply. Single
+ * pages are mapped via a slot that holds them already or via the least
+ * recently used one, multiple pages always from the start of the region.
+ */
+void *paging_map_temporary(unsigned long phys, unsigned int num,
+			   unsigned long flags)
+{
+	unsigned int slot;
+
+	if (num > NUM_TEMPORARY_PAGES)
+		return NULL;
+	if (num == 1)
+		return temporary_slot_map(temporary_slot_lookup(phys, flags),
+					  phys, flags);
+
+	for (slot = 0; slot < num; slot++, phys += PAGE_SIZE)
+		if (!temporary_slot_map(slot, phys, flags))
+			return NULL;
+	return (void *)TEMPORARY_MAPPING_BASE;
+}
+
 /**
  * Map guest (cell) pages into the hypervisor address space.
  * @param pg_structs	Descriptor of the guest paging structures if @c gaddr
@@ -558,15 +1082,20 @@ void *paging_get_guest_pages(const struct guest_paging_structures *pg_structs,
 			     unsigned long gaddr, unsigned int num,
 			     unsigned long flags)
 {
-	unsigned long phys, gphys, page_virt = TEMPORARY_MAPPING_BASE;
-	int err;
+	unsigned long phys, gphys;
+	unsigned int slot;
 
 	if (num > NUM_TEMPORARY_PAGES)
 		return NULL;
-	while (num-- > 0) {
+	for (slot = 0; slot < num; slot++, gaddr += PAGE_SIZE) {
+		/*
+		 * Single pages may walk the guest page tables via any slot,
+		 * multiple pages reuse the slot of the page being resolved.
+		 */
 		if (pg_structs && pg_structs->root_paging)
 			gphys = paging_gvirt2gphys(pg_structs, gaddr,
-						   page_virt, flags);
+						   num == 1 ? -1 : (int)slot,
+						   flags);
 		else
 			gphys = gaddr;
 
@@ -574,13 +1103,10 @@ void *paging_get_guest_pages(const struct guest_paging_structures *pg_structs,
 		if (phys == INVALID_PHYS_ADDR)
 			return NULL;
 		/* map guest page */
-		err = paging_create(&this_cpu_data()->pg_structs, phys,
-				    PAGE_SIZE, page_virt, flags,
-				    PAGING_NON_COHERENT);
-		if (err)
+		if (num == 1)
+			return paging_map_temporary(phys, 1, flags);
+		if (!temporary_slot_map(slot, phys, flags))
 			return NULL;
-		gaddr += PAGE_SIZE;
-		page_virt += PAGE_SIZE;
 	}
 	return (void *)TEMPORARY_MAPPING_BASE;
 }
@@ -600,15 +1126,178 @@ int paging_map_all_per_cpu(unsigned int cpu, bool enable)
 			PAGING_NON_COHERENT);
 }
 
+/*
+ * Map a chunk of RAM at its physical address plus page_offset into the
+ * hypervisor address space.
+ */
+static int map_pool_chunk(unsigned long phys, unsigned long size)
+{
+	unsigned long virt = (unsigned long)paging_phys2hvirt(phys);
+	unsigned long offset;
+	int err;
+
+	if (virt < REMAP_BASE + remap_pool.pages * PAGE_SIZE &&
+	    virt + size > REMAP_BASE)
+		return trace_error(-ERANGE);
+	for (offset = 0; offset < size; offset += PAGE_SIZE)
+		if (paging_virt2phys(&hv_paging_structs, virt + offset,
+				     PAGE_PRESENT_FLAGS) != INVALID_PHYS_ADDR)
+			return trace_error(-EBUSY);
+
+	err = paging_create(&hv_paging_structs, phys, size, virt,
+			    PAGE_DEFAULT_FLAGS, PAGING_NON_COHERENT);
+	if (err)
+		paging_destroy(&hv_paging_structs, virt, size,
+			       PAGING_NON_COHERENT);
+	return err;
+}
+
+/*
+ * Set up the node-local pools. Until the CPUs switched to the hypervisor page
+ * tables, the chunks are not accessible, so nothing may be written to them
+ * here.
+ */
+static int numa_pools_init(void)
+{
+	const struct paging *paging = hv_paging_structs.root_paging;
+	page_table_t hv_root = hv_paging_structs.root_table;
+	const struct jailhouse_numa_node *node;
+	const struct jailhouse_memory *mem;
+	struct page_pool *pool;
+	unsigned long virt, pages, *bitmap;
+	pt_entry_t top_entry;
+	unsigned int n, m;
+	int err;
+
+	for (n = 0; n < JAILHOUSE_MAX_NUMA_NODES; n++) {
+		node = &system_config->numa_nodes[n];
+		if (node->size == 0)
+			continue;
+		if ((node->phys_start | node->size) & ~PAGE_MASK)
+			return trace_error(-EINVAL);
+
+		for_each_mem_region(mem, &system_config->root_cell, m)
+			if (node->phys_start < mem->phys_start + mem->size &&
+			    node->phys_start + node->size > mem->phys_start)
+				return trace_error(-EINVAL);
+
+		/*
+		 * The chunk is linked into the per-CPU page tables via a
+		 * single top-level entry that must not host CPU-local
+		 * mappings.
+		 */
+		virt = (unsigned long)paging_phys2hvirt(node->phys_start);
+		top_entry = paging->get_entry(hv_root, virt);
+		if (virt + node->size - 1 < virt ||
+		    paging->get_entry(hv_root, virt + node->size - 1) !=
+		    top_entry ||
+		    paging->get_entry(hv_root, TEMPORARY_MAPPING_BASE) ==
+		    top_entry ||
+		    paging->get_entry(hv_root, LOCAL_CPU_BASE) == top_entry)
+			return trace_error(-ERANGE);
+
+		pages = node->size / PAGE_SIZE;
+		bitmap = page_alloc(&mem_pool, pool_bitmap_pages(pages));
+		if (!bitmap)
+			return -ENOMEM;
+
+		err = map_pool_chunk(node->phys_start, node->size);
+		if (err)
+			return err;
+
+		pool = &numa_pools[n];
+		pool->base_address = (void *)virt;
+		pool->pages = pages;
+		init_pool_bitmaps(pool, bitmap);
+		/* the chunk holds stale data, scrub it on allocation */
+		update_bitmap(pool->scrub_bitmap, NULL, 0, pool->pages, true);
+		pool->flags = PAGE_SCRUB_ON_FREE;
+	}
+
+	return 0;
+}
+
+/**
+ * Link the node-local pools into the paging structures of a CPU.
+ * @param pg_structs	Per-CPU paging structures.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+int paging_link_numa_pools(const struct paging_structures *pg_structs)
+{
+	unsigned int n;
+	int err;
+
+	for (n = 0; n < JAILHOUSE_MAX_NUMA_NODES; n++) {
+		if (numa_pools[n].pages == 0)
+			continue;
+		err = paging_create_hvpt_link(pg_structs, (unsigned long)
+					      numa_pools[n].base_address);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/**
+ * Return the pool to allocate structures from that only a specific CPU uses.
+ * @param cpu	ID of the CPU.
+ *
+ * @return Pool local to the NUMA node of the CPU or mem_pool if there is none.
+ *
+ * @note Memory of the pool is only accessible after the CPU switched to the
+ * hypervisor page tables.
+ */
+struct page_pool *numa_local_pool(unsigned int cpu)
+{
+	const struct jailhouse_numa_node *node;
+	unsigned int n;
+
+	if (cpu >= JAILHOUSE_NUMA_MAX_CPUS)
+		return &mem_pool;
+
+	for (n = 0; n < JAILHOUSE_MAX_NUMA_NODES; n++) {
+		node = &system_config->numa_nodes[n];
+		if (numa_pools[n].pages > 0 &&
+		    (node->cpu_set[cpu / 64] >> (cpu % 64)) & 1)
+			return &numa_pools[n];
+	}
+	return &mem_pool;
+}
+
+/**
+ * Return the pool to allocate the paging structures of a cell from.
+ * @param cell	Cell to allocate for.
+ *
+ * @return Pool local to the NUMA node of all CPUs of the cell or mem_pool if
+ * the cell spans multiple nodes.
+ */
+struct page_pool *numa_cell_pool(struct cell *cell)
+{
+	struct page_pool *pool = NULL;
+	unsigned int cpu;
+
+	/* parts of the root cell are mapped before node memory is reachable */
+	if (cell == &root_cell)
+		return &mem_pool;
+
+	for_each_cpu(cpu, cell->cpu_set)
+		if (!pool)
+			pool = numa_local_pool(cpu);
+		else if (numa_local_pool(cpu) != pool)
+			return &mem_pool;
+	return pool ? pool : &mem_pool;
+}
+
 /**
  * Initialize the page mapping subsystem.
  *
  * @return 0 on success, negative error code otherwise.
  */
-int paging_init(void)
+int __init paging_init(void)
 {
 	unsigned long n, per_cpu_pages, config_pages, bitmap_pages;
-	unsigned long vaddr, flags;
+	unsigned long vaddr, flags, *bitmap;
 	int err;
 
 	per_cpu_pages = hypervisor_header.max_cpus *
@@ -621,21 +1310,41 @@ int paging_init(void)
 
 	mem_pool.pages = (system_config->hypervisor_memory.size -
 		(__page_pool - (u8 *)&hypervisor_header)) / PAGE_SIZE;
-	bitmap_pages = (mem_pool.pages + BITS_PER_PAGE - 1) / BITS_PER_PAGE;
+	bitmap_pages = pool_bitmap_pages(mem_pool.pages);
 
 	if (mem_pool.pages <= per_cpu_pages + config_pages + bitmap_pages)
 		return -ENOMEM;
 
 	mem_pool.base_address = __page_pool;
-	mem_pool.used_bitmap =
+	init_pool_bitmaps(&mem_pool,
 		(unsigned long *)(__page_pool + per_cpu_pages * PAGE_SIZE +
-				  config_pages * PAGE_SIZE);
+				  config_pages * PAGE_SIZE));
+	/* the driver only cleared the memory up to the per-CPU areas */
+	memset(mem_pool.used_bitmap, 0, bitmap_pages * PAGE_SIZE);
 	mem_pool.used_pages = per_cpu_pages + config_pages + bitmap_pages;
-	for (n = 0; n < mem_pool.used_pages; n++)
-		set_bit(n, mem_pool.used_bitmap);
+	mark_pages(&mem_pool, 0, mem_pool.used_pages, true);
+	/* the remaining pages hold stale data, scrub them on allocation */
+	update_bitmap(mem_pool.scrub_bitmap, NULL, mem_pool.used_pages,
+		      mem_pool.pages - mem_pool.used_pages, true);
 	mem_pool.flags = PAGE_SCRUB_ON_FREE;
 
-	remap_pool.used_bitmap = page_alloc(&mem_pool, NUM_REMAP_BITMAP_PAGES);
+	/*
+	 * The per-CPU areas of IDs missing in a sparse CPU set are never used,
+	 * return them to the pool. CPU 0 always stays as its area hosts the
+	 * hypervisor root page table.
+	 */
+	per_cpu_pages = sizeof(struct per_cpu) / PAGE_SIZE;
+	for (n = 1; n < hypervisor_header.max_cpus; n++)
+		if (!cpu_id_valid(n)) {
+			mark_pages(&mem_pool, n * per_cpu_pages, per_cpu_pages,
+				   false);
+			mem_pool.used_pages -= per_cpu_pages;
+		}
+
+	bitmap = page_alloc(&mem_pool, pool_bitmap_pages(remap_pool.pages));
+	if (!bitmap)
+		return -ENOMEM;
+	init_pool_bitmaps(&remap_pool, bitmap);
 
 	hv_paging_structs.hv_paging = true;
 	hv_paging_structs.root_table =
@@ -662,6 +1371,8 @@ int paging_init(void)
 	 * performed without allocations of page table pages.
 	 */
 	for (n = 0; n < hypervisor_header.max_cpus; n++) {
+		if (!cpu_id_valid(n))
+			continue;
 		err = paging_map_all_per_cpu(n, true);
 		if (err)
 			return err;
@@ -686,16 +1397,225 @@ int paging_init(void)
 			return err;
 	}
 
+	return numa_pools_init();
+}
+
+/**
+ * Extend the memory pool by a chunk of root cell memory.
+ * @param phys	Page-aligned physical start address of the chunk.
+ * @param size	Size of the chunk, a multiple of PAGE_SIZE.
+ *
+ * @return 0 on success, negative error code otherwise.
+ *
+ * @note The caller has to revoke the root cell's access to the chunk first.
+ *
+ * @see mem_pool_reclaim
+ */
+int mem_pool_donate(unsigned long phys, unsigned long size)
+{
+	const struct paging *paging = hv_paging_structs.root_paging;
+	page_table_t hv_root = hv_paging_structs.root_table;
+	unsigned long virt = (unsigned long)paging_phys2hvirt(phys);
+	unsigned long pages = size / PAGE_SIZE;
+	struct page_pool *pool = NULL;
+	unsigned long bitmap_pages;
+	unsigned int n;
+	int err;
+
+	if ((phys | size) & ~PAGE_MASK || pages == 0)
+		return trace_error(-EINVAL);
+	bitmap_pages = pool_bitmap_pages(pages);
+	if (pages <= bitmap_pages)
+		return trace_error(-EINVAL);
+
+	/*
+	 * The chunk has to be reachable via the top-level page table entry
+	 * that all CPUs link to.
+	 */
+	if (virt + size - 1 < virt ||
+	    paging->get_entry(hv_root, virt) !=
+	    paging->get_entry(hv_root, JAILHOUSE_BASE) ||
+	    paging->get_entry(hv_root, virt + size - 1) !=
+	    paging->get_entry(hv_root, JAILHOUSE_BASE))
+		return trace_error(-ERANGE);
+
+	/* Donations and reclaims are serialized by the root cell. */
+	for (n = 0; n < MAX_MEM_POOL_DONATIONS; n++)
+		if (donated_pools[n].pages == 0) {
+			pool = &donated_pools[n];
+			break;
+		}
+	if (!pool)
+		return trace_error(-E2BIG);
+
+	err = map_pool_chunk(phys, size);
+	if (err)
+		return err;
+
+	/*
+	 * The bitmaps are kept at the beginning of the chunk. All other pages
+	 * still hold root cell data and are scrubbed when allocated.
+	 */
+	memset((void *)virt, 0, bitmap_pages * PAGE_SIZE);
+
+	spin_lock(&pool_lock);
+	pool->base_address = (void *)virt;
+	pool->pages = pages;
+	init_pool_bitmaps(pool, (unsigned long *)virt);
+	mark_pages(pool, 0, bitmap_pages, true);
+	update_bitmap(pool->scrub_bitmap, NULL, bitmap_pages,
+		      pages - bitmap_pages, true);
+	pool->used_pages = bitmap_pages;
+	pool->flags = PAGE_SCRUB_ON_FREE;
+	spin_unlock(&pool_lock);
+
 	return 0;
 }
 
 /**
- * Dump usage statistic of the page pools.
+ * Remove an unused donated chunk from the memory pool.
+ * @param phys	Physical start address of the chunk.
+ * @param size	Set to the size of the chunk on success.
+ *
+ * @return 0 on success, negative error code otherwise.
+ *
+ * @note The chunk is cleared from hypervisor data and unmapped, the caller
+ * has to hand it back to the root cell afterwards.
+ *
+ * @see mem_pool_donate
+ */
+int mem_pool_reclaim(unsigned long phys, unsigned long *size)
+{
+	void *virt = paging_phys2hvirt(phys);
+	struct page_pool *pool = NULL;
+	unsigned long pages, bitmap_pages;
+	unsigned int n;
+
+	for (n = 0; n < MAX_MEM_POOL_DONATIONS; n++)
+		if (donated_pools[n].pages > 0 &&
+		    donated_pools[n].base_address == virt) {
+			pool = &donated_pools[n];
+			break;
+		}
+	if (!pool)
+		return -ENOENT;
+
+	spin_lock(&pool_lock);
+	pages = pool->pages;
+	bitmap_pages = pool_bitmap_pages(pages);
+	if (pool->used_pages > bitmap_pages) {
+		spin_unlock(&pool_lock);
+		return -EBUSY;
+	}
+	pool->pages = 0;
+	spin_unlock(&pool_lock);
+
+	scrub_pages(pool, bitmap_pages, pages - bitmap_pages);
+	memset(virt, 0, bitmap_pages * PAGE_SIZE);
+
+	*size = pages * PAGE_SIZE;
+	return paging_destroy(&hv_paging_structs, (unsigned long)virt, *size,
+			      PAGING_NON_COHERENT);
+}
+
+static bool chunk_overlaps(const struct page_pool *pool, unsigned long phys,
+			   unsigned long size)
+{
+	unsigned long start;
+
+	if (pool->pages == 0)
+		return false;
+	start = paging_hvirt2phys(pool->base_address);
+	return phys < start + pool->pages * PAGE_SIZE && phys + size > start;
+}
+
+/**
+ * Check if a physical address range overlaps with donated chunks or
+ * node-local pools.
+ * @param phys	Physical start address of the range.
+ * @param size	Size of the range.
+ *
+ * @return True if the range overlaps with memory of the pool.
+ */
+bool mem_pool_donated(unsigned long phys, unsigned long size)
+{
+	unsigned int n;
+
+	for (n = 0; n < MAX_MEM_POOL_DONATIONS; n++)
+		if (chunk_overlaps(&donated_pools[n], phys, size))
+			return true;
+	for (n = 0; n < JAILHOUSE_MAX_NUMA_NODES; n++)
+		if (chunk_overlaps(&numa_pools[n], phys, size))
+			return true;
+	return false;
+}
+
+/**
+ * Report size and usage of the memory pool, including donated chunks and
+ * node-local pools.
+ * @param pages	Set to the number of managed pages.
+ * @param used	Set to the number of used pages.
+ */
+void mem_pool_get_usage(unsigned long *pages, unsigned long *used)
+{
+	unsigned int n;
+
+	spin_lock(&pool_lock);
+	*pages = mem_pool.pages;
+	*used = mem_pool.used_pages;
+	for (n = 0; n < MAX_MEM_POOL_DONATIONS; n++) {
+		*pages += donated_pools[n].pages;
+		if (donated_pools[n].pages > 0)
+			*used += donated_pools[n].used_pages;
+	}
+	for (n = 0; n < JAILHOUSE_MAX_NUMA_NODES; n++) {
+		*pages += numa_pools[n].pages;
+		*used += numa_pools[n].used_pages;
+	}
+	spin_unlock(&pool_lock);
+}
+
+/**
+ * Dump usage statistic of the page pools and, for each cell, the number of
+ * guest-physical mappings per page size.
  * @param when String that characterizes the associated event.
  */
 void paging_dump_stats(const char *when)
 {
+	unsigned long entries[MAX_PAGE_TABLE_LEVELS];
+	const struct paging_structures *pg_structs;
+	const struct jailhouse_memory *mem;
+	unsigned long mem_pages, mem_used;
+	const struct paging *paging;
+	unsigned int n, level;
+	struct cell *cell;
+
+	mem_pool_get_usage(&mem_pages, &mem_used);
 	printk("Page pool usage %s: mem %ld/%ld, remap %ld/%ld\n", when,
-	       mem_pool.used_pages, mem_pool.pages,
-	       remap_pool.used_pages, remap_pool.pages);
+	       mem_used, mem_pages, remap_pool.used_pages, remap_pool.pages);
+
+	for_each_cell(cell) {
+		pg_structs = arch_paging_cell_structs(cell);
+		memset(entries, 0, sizeof(entries));
+		for_each_mem_region(mem, cell->config, n)
+			paging_count_entries(pg_structs, mem->virt_start,
+					     mem->size, entries);
+
+		printk("Cell \"%s\" mappings:", cell->config->name);
+		for (paging = pg_structs->root_paging, level = 0;
+		     level < MAX_PAGE_TABLE_LEVELS; paging++, level++) {
+			if (paging->page_size >= 1024 * 1024 * 1024)
+				printk(" %uG", paging->page_size >> 30);
+			else if (paging->page_size >= 1024 * 1024)
+				printk(" %uM", paging->page_size >> 20);
+			else if (paging->page_size > 0)
+				printk(" %uK", paging->page_size >> 10);
+			else
+				continue;
+			printk(" %ld", entries[level]);
+			if (paging->page_size == PAGE_SIZE)
+				break;
+		}
+		printk("\n");
+	}
 }
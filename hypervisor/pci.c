@@ -16,6 +16,7 @@
 #include <jailhouse/mmio.h>
 #include <jailhouse/pci.h>
 #include <jailhouse/printk.h>
+#include <jailhouse/slab.h>
 #include <jailhouse/string.h>
 #include <jailhouse/unit.h>
 #include <jailhouse/utils.h>
@@ -66,6 +67,16 @@ static const struct pci_cfg_control bridge_write[PCI_CONFIG_HEADER_SIZE] = {
 	[0x3c/4] = {PCI_CONFIG_ALLOW,  0xffff00ff}, /* Int Line, Bridge Ctrl */
 };
 
+/*
+ * Read-only header dwords that are served from pci_device::header_shadow:
+ * vendor/device ID, class code/revision, subsystem IDs (endpoints only) and
+ * the capability pointer. Writes to them are rejected.
+ */
+#define ENDPOINT_SHADOWED_DWORDS	((1 << (0x00/4)) | (1 << (0x08/4)) | \
+					 (1 << (0x2c/4)) | (1 << (0x34/4)))
+#define BRIDGE_SHADOWED_DWORDS		((1 << (0x00/4)) | (1 << (0x08/4)) | \
+					 (1 << (0x34/4)))
+
 static void *pci_space;
 static u64 mmcfg_start, mmcfg_size;
 static u8 end_bus;
@@ -142,6 +153,58 @@ void pci_write_config(u16 bdf, u16 address, u32 value, unsigned int size)
 		mmio_write32(mmcfg_addr, value);
 }
 
+static unsigned int pci_devlist_pages(struct cell *cell)
+{
+	return PAGES(cell->config->num_pci_devices * sizeof(struct pci_device));
+}
+
+/*
+ * Build the per-bus device tables of a cell. Only buses that carry configured
+ * devices get a table. Of devices with identical BDFs (different domains),
+ * the first configured one is entered, like a linear search would find it.
+ */
+static int pci_build_bus_tables(struct cell *cell)
+{
+	const struct jailhouse_pci_device *dev_infos =
+		jailhouse_cell_pci_devices(cell->config);
+	struct pci_bus_devices *bus;
+	unsigned int n;
+	u16 bdf;
+
+	cell->pci_buses = slab_alloc(PCI_NUM_BUSES * sizeof(*cell->pci_buses));
+	if (!cell->pci_buses)
+		return -ENOMEM;
+
+	for (n = 0; n < cell->config->num_pci_devices; n++) {
+		bdf = dev_infos[n].bdf;
+		bus = cell->pci_buses[PCI_BUS(bdf)];
+		if (!bus) {
+			bus = slab_alloc(sizeof(*bus));
+			if (!bus)
+				return -ENOMEM;
+			cell->pci_buses[PCI_BUS(bdf)] = bus;
+		}
+		if (!bus->devfn[PCI_DEVFN(bdf)])
+			bus->devfn[PCI_DEVFN(bdf)] = &cell->pci_devices[n];
+	}
+
+	return 0;
+}
+
+static void pci_free_bus_tables(struct cell *cell)
+{
+	unsigned int n;
+
+	if (!cell->pci_buses)
+		return;
+
+	for (n = 0; n < PCI_NUM_BUSES; n++)
+		if (cell->pci_buses[n])
+			slab_free(cell->pci_buses[n],
+				  sizeof(struct pci_bus_devices));
+	slab_free(cell->pci_buses, PCI_NUM_BUSES * sizeof(*cell->pci_buses));
+}
+
 /**
  * Look up device owned by a cell.
  * @param[in] cell	Owning cell.
@@ -151,18 +214,54 @@ void pci_write_config(u16 bdf, u16 address, u32 value, unsigned int size)
  */
 struct pci_device *pci_get_assigned_device(const struct cell *cell, u16 bdf)
 {
-	const struct jailhouse_pci_device *dev_info =
-		jailhouse_cell_pci_devices(cell->config);
-	u32 n;
+	const struct pci_bus_devices *bus;
+	struct pci_device *device;
 
-	/* We iterate over the static device information to increase cache
-	 * locality. */
-	for (n = 0; n < cell->config->num_pci_devices; n++)
-		if (dev_info[n].bdf == bdf)
-			return cell->pci_devices[n].cell ?
-				&cell->pci_devices[n] : NULL;
+	if (!cell->pci_buses)
+		return NULL;
 
-	return NULL;
+	bus = cell->pci_buses[PCI_BUS(bdf)];
+	if (!bus)
+		return NULL;
+
+	/* The cell pointer encodes active ownership, tracking hand-overs. */
+	device = bus->devfn[PCI_DEVFN(bdf)];
+	return device && device->cell ? device : NULL;
+}
+
+static bool pci_header_shadowed(struct pci_device *device, u16 address)
+{
+	u16 dwords = device->info->type == JAILHOUSE_PCI_TYPE_BRIDGE ?
+		BRIDGE_SHADOWED_DWORDS : ENDPOINT_SHADOWED_DWORDS;
+
+	return dwords & (1 << (address / 4));
+}
+
+static void pci_init_cap_lookup(struct cell *cell, struct pci_device *device)
+{
+	const struct jailhouse_pci_capability *cap =
+		jailhouse_cell_pci_caps(cell->config) +
+		device->info->caps_start;
+	unsigned int n, start, end, addr;
+	u8 *entry;
+
+	memset(device->cap_lookup, 0, sizeof(device->cap_lookup));
+
+	for (n = 0; n < device->info->num_caps; n++, cap++) {
+		start = MAX(cap->start, PCI_CONFIG_HEADER_SIZE);
+		end = MIN(cap->start + cap->len, PCI_CAP_LOOKUP_END);
+
+		for (addr = start & ~0x3; addr < end; addr += 4) {
+			entry = &device->cap_lookup[addr / 4 -
+						    PCI_CONFIG_HEADER_SIZE / 4];
+			if (*entry == 0 && addr >= cap->start &&
+			    addr + 4 <= cap->start + cap->len &&
+			    n + 1 < PCI_CAP_LOOKUP_SEARCH)
+				*entry = n + 1;
+			else
+				*entry = PCI_CAP_LOOKUP_SEARCH;
+		}
+	}
 }
 
 /**
@@ -180,8 +279,17 @@ pci_find_capability(struct pci_device *device, u16 address)
 	const struct jailhouse_pci_capability *cap =
 		jailhouse_cell_pci_caps(device->cell->config) +
 		device->info->caps_start;
+	unsigned int entry;
 	u32 n;
 
+	if (address >= PCI_CONFIG_HEADER_SIZE &&
+	    address < PCI_CAP_LOOKUP_END) {
+		entry = device->cap_lookup[address / 4 -
+					   PCI_CONFIG_HEADER_SIZE / 4];
+		if (entry != PCI_CAP_LOOKUP_SEARCH)
+			return entry ? cap + entry - 1 : NULL;
+	}
+
 	for (n = 0; n < device->info->num_caps; n++, cap++)
 		if (cap->start <= address && cap->start + cap->len > address)
 			return cap;
@@ -232,8 +340,13 @@ enum pci_access pci_cfg_read_moderate(struct pci_device *device, u16 address,
 	if (device->info->type == JAILHOUSE_PCI_TYPE_IVSHMEM)
 		return ivshmem_pci_cfg_read(device, address, value);
 
-	if (address < PCI_CONFIG_HEADER_SIZE)
-		return PCI_ACCESS_PERFORM;
+	if (address < PCI_CONFIG_HEADER_SIZE) {
+		if (!pci_header_shadowed(device, address))
+			return PCI_ACCESS_PERFORM;
+		*value = device->header_shadow[address / 4] >>
+			((address % 4) * 8);
+		return PCI_ACCESS_DONE;
+	}
 
 	cap = pci_find_capability(device, address);
 	if (!cap)
@@ -247,6 +360,15 @@ enum pci_access pci_cfg_read_moderate(struct pci_device *device, u16 address,
 		return PCI_ACCESS_DONE;
 	}
 
+	/*
+	 * The MSI-X control word only consists of read-only fields and of
+	 * the mask and enable bits that are written through the shadow.
+	 */
+	if (cap->id == PCI_CAP_MSIX && cap_offs < 4) {
+		*value = device->msix_registers.raw >> (cap_offs * 8);
+		return PCI_ACCESS_DONE;
+	}
+
 	return PCI_ACCESS_PERFORM;
 }
 
@@ -285,6 +407,7 @@ enum pci_access pci_cfg_write_moderate(struct pci_device *device, u16 address,
 	u32 mask = BYTE_MASK(size) << bias_shift;
 	struct pci_cfg_control cfg_control;
 	unsigned int bar_no, cap_offs;
+	bool msix_was_active;
 
 	if (!device)
 		return PCI_ACCESS_REJECT;
@@ -346,10 +469,16 @@ enum pci_access pci_cfg_write_moderate(struct pci_device *device, u16 address,
 		if (cap_offs >= 4)
 			return PCI_ACCESS_DONE;
 	} else if (cap->id == PCI_CAP_MSIX && cap_offs < 4) {
+		msix_was_active = device->msix_registers.enable &&
+			!device->msix_registers.fmask;
+
 		device->msix_registers.raw &= ~mask;
 		device->msix_registers.raw |= value;
 
-		if (pci_update_msix(device, cap) < 0)
+		/* Vectors only need updates when the function gets active. */
+		if (!msix_was_active && device->msix_registers.enable &&
+		    !device->msix_registers.fmask &&
+		    pci_update_msix(device, cap) < 0)
 			return PCI_ACCESS_REJECT;
 	}
 
@@ -362,7 +491,9 @@ static enum mmio_result pci_msix_access_handler(void *arg,
 	unsigned int dword =
 		(mmio->address % sizeof(union pci_msix_vector)) >> 2;
 	struct pci_device *device = arg;
+	union pci_msix_vector *vector;
 	unsigned int index;
+	bool update;
 
 	/* access must be DWORD-aligned */
 	if (mmio->address & 0x3)
@@ -378,8 +509,19 @@ static enum mmio_result pci_msix_access_handler(void *arg,
 		if (index >= device->info->num_msix_vectors)
 			goto invalid_access;
 
-		device->msix_vectors[index].raw[dword] = mmio->value;
-		if (arch_pci_update_msix_vector(device, index) < 0)
+		/*
+		 * The remapped vector only needs an update if address or data
+		 * change or if the vector gets unmasked. Masking it or
+		 * rewriting the same value is just passed on.
+		 */
+		vector = &device->msix_vectors[index];
+		if (dword == MSIX_VECTOR_CTRL_DWORD)
+			update = vector->masked && !(mmio->value & 1);
+		else
+			update = vector->raw[dword] != mmio->value;
+		vector->raw[dword] = mmio->value;
+
+		if (update && arch_pci_update_msix_vector(device, index) < 0)
 			goto invalid_access;
 
 		if (dword == MSIX_VECTOR_CTRL_DWORD)
@@ -540,6 +682,8 @@ void pci_reset_device(struct pci_device *device)
 	unsigned int n;
 
 	memset(&device->msi_registers, 0, sizeof(device->msi_registers));
+	device->msix_registers.enable = 0;
+	device->msix_registers.fmask = 0;
 	for (n = 0; n < device->info->num_msix_vectors; n++) {
 		device->msix_vectors[n].address = 0;
 		device->msix_vectors[n].data = 0;
@@ -575,7 +719,7 @@ void pci_reset_device(struct pci_device *device)
 
 static int pci_add_physical_device(struct cell *cell, struct pci_device *device)
 {
-	unsigned int n, pages, size = device->info->msix_region_size;
+	unsigned int n, size = device->info->msix_region_size;
 	int err;
 
 	printk("Adding PCI device %02x:%02x.%x to cell \"%s\"\n",
@@ -585,6 +729,12 @@ static int pci_add_physical_device(struct cell *cell, struct pci_device *device)
 		device->bar[n] = pci_read_config(device->info->bdf,
 						 PCI_CFG_BAR + n * 4, 4);
 
+	for (n = 0; n < PCI_CONFIG_HEADER_SIZE; n += 4)
+		if (pci_header_shadowed(device, n))
+			device->header_shadow[n / 4] =
+				pci_read_config(device->info->bdf, n, 4);
+	pci_init_cap_lookup(cell, device);
+
 	err = arch_pci_add_physical_device(cell, device);
 	if (err)
 		return err;
@@ -598,9 +748,9 @@ static int pci_add_physical_device(struct cell *cell, struct pci_device *device)
 		}
 
 		if (device->info->num_msix_vectors > PCI_EMBEDDED_MSIX_VECTS) {
-			pages = PAGES(sizeof(union pci_msix_vector) *
-				      device->info->num_msix_vectors);
-			device->msix_vectors = page_alloc(&mem_pool, pages);
+			device->msix_vectors =
+				slab_alloc(sizeof(union pci_msix_vector) *
+					   device->info->num_msix_vectors);
 			if (!device->msix_vectors) {
 				err = -ENOMEM;
 				goto error_unmap_table;
@@ -608,7 +758,8 @@ static int pci_add_physical_device(struct cell *cell, struct pci_device *device)
 		}
 
 		mmio_region_register(cell, device->info->msix_address, size,
-				     pci_msix_access_handler, device);
+				     pci_msix_access_handler, device,
+				     "pci-msix");
 	}
 
 	device->cell = cell;
@@ -644,9 +795,9 @@ static void pci_remove_physical_device(struct pci_device *device)
 			    device->info->msix_region_size);
 
 	if (device->msix_vectors != device->msix_vector_array)
-		page_free(&mem_pool, device->msix_vectors,
-			  PAGES(sizeof(union pci_msix_vector) *
-				device->info->num_msix_vectors));
+		slab_free(device->msix_vectors,
+			  sizeof(union pci_msix_vector) *
+			  device->info->num_msix_vectors);
 
 	mmio_region_unregister(cell, device->info->msix_address);
 }
@@ -663,8 +814,6 @@ static void pci_cell_exit(struct cell *cell);
  */
 static int pci_cell_init(struct cell *cell)
 {
-	unsigned int devlist_pages = PAGES(cell->config->num_pci_devices *
-					   sizeof(struct pci_device));
 	const struct jailhouse_pci_device *dev_infos =
 		jailhouse_cell_pci_devices(cell->config);
 	const struct jailhouse_pci_capability *cap;
@@ -672,17 +821,29 @@ static int pci_cell_init(struct cell *cell)
 	unsigned int ndev, ncap;
 	int err;
 
+	/*
+	 * MMCONFIG stays trapped even for devices a cell owns exclusively.
+	 * The 4K page of a function contains its BARs. BAR writes must not
+	 * reach the device, and BAR reads, including sizing, are answered
+	 * from the shadow. Neither a writable nor a read-only mapping of the
+	 * page would preserve that.
+	 */
 	if (mmcfg_start != 0)
 		mmio_region_register(cell, mmcfg_start, mmcfg_size,
-				     pci_mmconfig_access_handler, NULL);
+				     pci_mmconfig_access_handler, NULL,
+				     "pci-mmconfig");
 
 	if (cell->config->num_pci_devices == 0)
 		return 0;
 
-	cell->pci_devices = page_alloc(&mem_pool, devlist_pages);
+	cell->pci_devices = page_alloc(&mem_pool, pci_devlist_pages(cell));
 	if (!cell->pci_devices)
 		return -ENOMEM;
 
+	err = pci_build_bus_tables(cell);
+	if (err)
+		goto error;
+
 	/*
 	 * We order device states in the same way as the static information
 	 * so that we can use the index of the latter to find the former. For
@@ -736,19 +897,33 @@ void pci_cell_reset(struct cell *cell)
 			pci_reset_device(device);
 }
 
-static void pci_return_device_to_root_cell(struct pci_device *device)
+static struct pci_device *pci_find_root_device(struct pci_device *device)
 {
+	const struct pci_bus_devices *bus =
+		root_cell.pci_buses[PCI_BUS(device->info->bdf)];
 	struct pci_device *root_device;
 
+	if (!bus)
+		return NULL;
+
+	root_device = bus->devfn[PCI_DEVFN(device->info->bdf)];
+	if (!root_device || root_device->info->domain == device->info->domain)
+		return root_device;
+
+	/* The bus table only holds the first of several equal BDFs. */
 	for_each_configured_pci_device(root_device, &root_cell)
 		if (root_device->info->domain == device->info->domain &&
-		    root_device->info->bdf == device->info->bdf) {
-			if (pci_add_physical_device(&root_cell,
-						    root_device) < 0)
-				printk("WARNING: Failed to re-assign PCI "
-				       "device to root cell\n");
-			break;
-		}
+		    root_device->info->bdf == device->info->bdf)
+			return root_device;
+	return NULL;
+}
+
+static void pci_return_device_to_root_cell(struct pci_device *device)
+{
+	struct pci_device *root_device = pci_find_root_device(device);
+
+	if (root_device && pci_add_physical_device(&root_cell, root_device) < 0)
+		printk("WARNING: Failed to re-assign PCI device to root cell\n");
 }
 
 /**
@@ -759,8 +934,6 @@ static void pci_return_device_to_root_cell(struct pci_device *device)
  */
 static void pci_cell_exit(struct cell *cell)
 {
-	unsigned int devlist_pages = PAGES(cell->config->num_pci_devices *
-					   sizeof(struct pci_device));
 	struct pci_device *device;
 
 	/*
@@ -780,7 +953,8 @@ static void pci_cell_exit(struct cell *cell)
 			}
 		}
 
-	page_free(&mem_pool, cell->pci_devices, devlist_pages);
+	pci_free_bus_tables(cell);
+	page_free(&mem_pool, cell->pci_devices, pci_devlist_pages(cell));
 }
 
 /**
@@ -800,8 +974,14 @@ void pci_config_commit(struct cell *cell_added_removed)
 	if (!cell_added_removed)
 		return;
 
+	/*
+	 * Only the devices of the root cell, whose CPU set changed, and of the
+	 * added or removed cell are affected. Devices of the latter have
+	 * already been returned to the root cell on removal.
+	 */
 	for_each_configured_pci_device(device, &root_cell)
-		if (device->cell) {
+		if (device->cell == &root_cell ||
+		    device->cell == cell_added_removed) {
 			for_each_pci_cap(cap, device, n) {
 				if (cap->id == PCI_CAP_MSI) {
 					err = arch_pci_update_msi(device, cap);
@@ -813,7 +993,7 @@ void pci_config_commit(struct cell *cell_added_removed)
 					goto error;
 			}
 			if (device->info->type == JAILHOUSE_PCI_TYPE_IVSHMEM) {
-				err = arch_ivshmem_update_msix(device);
+				err = ivshmem_update_msix(device);
 				if (err) {
 					cap = NULL;
 					goto error;
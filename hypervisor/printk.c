@@ -24,8 +24,34 @@ volatile struct jailhouse_virt_console console
 
 static DEFINE_SPINLOCK(printk_lock);
 
+/* Interrupt that informs the root cell about new console content */
+static struct {
+	unsigned int irq;
+	unsigned int cpu_id;
+	unsigned int threshold;
+	/* console tail at the last notification */
+	unsigned int tail;
+} console_notify;
+
+static void console_notify_check(bool end_of_line)
+{
+	if (!console_notify.irq || panic_in_progress)
+		return;
+	/* the CPU may have been handed over to a non-root cell meanwhile */
+	if (public_per_cpu(console_notify.cpu_id)->cell != &root_cell)
+		return;
+
+	if (end_of_line ||
+	    console.tail - console_notify.tail >= console_notify.threshold) {
+		console_notify.tail = console.tail;
+		arch_console_notify(console_notify.cpu_id, console_notify.irq);
+	}
+}
+
 static void console_write(const char *msg)
 {
+	char last = 0;
+
 	arch_dbg_write(msg);
 
 	if (!virtual_console)
@@ -38,17 +64,185 @@ static void console_write(const char *msg)
 		if (panic_in_progress && panic_cpu != phys_processor_id())
 			break;
 
-		console.content[console.tail % sizeof(console.content)] =
-			*msg++;
+		last = *msg++;
+		console.content[console.tail % sizeof(console.content)] = last;
 		console.tail++;
 	}
 	/* ensure that all updates are committed before clearing busy */
 	memory_barrier();
 	console.busy = false;
+
+	console_notify_check(last == '\n');
 }
 
 #include "printk-core.c"
 
+/* Number of characters passed to printk at once when flushing a cell */
+#define CELL_CONSOLE_CHUNK	64
+
+static struct jailhouse_cell_console *cell_console(struct cell *cell)
+{
+	return &public_per_cpu(first_cpu(cell->cpu_set))->cell_console;
+}
+
+/* Must be called with cell->console_lock held. */
+static void cell_console_write(struct cell *cell, const char *msg)
+{
+	struct jailhouse_cell_console *con = cell_console(cell);
+	const char *pos;
+
+	con->busy = true;
+	/* ensure the busy flag is visible prior to updates of the content */
+	memory_barrier();
+	for (pos = msg; *pos; pos++) {
+		con->content[con->tail % sizeof(con->content)] = *pos;
+		con->tail++;
+	}
+	/* ensure that all updates are committed before clearing busy */
+	memory_barrier();
+	con->busy = false;
+
+	printk("%s", msg);
+}
+
+/**
+ * Clear the console of a cell.
+ * @param cell		Cell whose console shall be cleared.
+ *
+ * Must be called before the CPUs of a new cell start to run.
+ */
+void cell_console_reset(struct cell *cell)
+{
+	struct jailhouse_cell_console *con = cell_console(cell);
+
+	con->busy = false;
+	con->tail = 0;
+	cell->console_head = 0;
+}
+
+/**
+ * Write a character to the console of a cell and to the hypervisor console.
+ * @param cell		Cell that issued the output.
+ * @param c		Character to write.
+ */
+void cell_console_putc(struct cell *cell, char c)
+{
+	char msg[2] = { c, 0 };
+
+	spin_lock(&cell->console_lock);
+	cell_console_write(cell, msg);
+	spin_unlock(&cell->console_lock);
+}
+
+/**
+ * Pass the pending content of the console ring in the communication page of
+ * a cell to its console and to the hypervisor console.
+ * @param cell		Cell that issued the flush.
+ */
+void cell_console_flush(struct cell *cell)
+{
+	struct jailhouse_comm_console *ring = &cell->comm_page.comm_console;
+	char chunk[CELL_CONSOLE_CHUNK + 1];
+	unsigned int tail, len;
+
+	spin_lock(&cell->console_lock);
+
+	tail = ring->tail;
+	/* read the tail before the content it covers */
+	memory_load_barrier();
+
+	/* the cell may have overrun its ring since the last flush */
+	if (tail - cell->console_head > JAILHOUSE_COMM_CONSOLE_SIZE)
+		cell->console_head = tail - JAILHOUSE_COMM_CONSOLE_SIZE;
+
+	while (cell->console_head != tail) {
+		for (len = 0; len < CELL_CONSOLE_CHUNK &&
+		     cell->console_head != tail; len++, cell->console_head++)
+			chunk[len] = ring->content[cell->console_head %
+						   JAILHOUSE_COMM_CONSOLE_SIZE];
+		chunk[len] = 0;
+		cell_console_write(cell, chunk);
+	}
+
+	spin_unlock(&cell->console_lock);
+}
+
+/**
+ * Write a string from guest memory to the console of a cell and to the
+ * hypervisor console.
+ * @param cell		Cell that issued the output.
+ * @param gphys		Guest-physical address of the string.
+ * @param len		Length of the string.
+ *
+ * @return Number of characters written, which is limited to
+ * JAILHOUSE_CELL_CONSOLE_SIZE, or negative error code.
+ */
+long cell_console_puts(struct cell *cell, unsigned long gphys,
+		       unsigned long len)
+{
+	char chunk[CELL_CONSOLE_CHUNK + 1];
+	unsigned long written = 0;
+	const char *page;
+	unsigned int n;
+
+	/* bound the time spent per call, the cell has to ask for the rest */
+	if (len > JAILHOUSE_CELL_CONSOLE_SIZE)
+		len = JAILHOUSE_CELL_CONSOLE_SIZE;
+
+	spin_lock(&cell->console_lock);
+	while (written < len) {
+		page = paging_get_guest_pages(NULL, gphys & PAGE_MASK, 1,
+					      PAGE_READONLY_FLAGS);
+		if (!page)
+			break;
+		for (n = 0; n < CELL_CONSOLE_CHUNK && written < len; n++) {
+			chunk[n] = page[gphys & ~PAGE_MASK];
+			written++;
+			/* continue with the next page after the last byte */
+			if ((++gphys & ~PAGE_MASK) == 0) {
+				n++;
+				break;
+			}
+		}
+		chunk[n] = 0;
+		cell_console_write(cell, chunk);
+	}
+	spin_unlock(&cell->console_lock);
+
+	if (written == 0 && len > 0)
+		return trace_error(-EINVAL);
+	return written;
+}
+
+/**
+ * Configure the notification of the root cell about new content of the
+ * hypervisor console.
+ * @param irq		Interrupt to send to the calling CPU (arch-specific), 0
+ * 			to disable notifications.
+ * @param threshold	Number of new characters that trigger a notification if
+ * 			no line was completed before.
+ *
+ * @return 0 on success, negative error code otherwise.
+ */
+long console_notify_set(unsigned long irq, unsigned long threshold)
+{
+	if (!virtual_console)
+		return -ENODEV;
+	if (irq != 0 &&
+	    (threshold == 0 || threshold > sizeof(console.content) ||
+	     !arch_console_notify_valid(irq)))
+		return trace_error(-EINVAL);
+
+	spin_lock(&printk_lock);
+	console_notify.irq = irq;
+	console_notify.cpu_id = this_cpu_id();
+	console_notify.threshold = threshold;
+	console_notify.tail = console.tail;
+	spin_unlock(&printk_lock);
+
+	return 0;
+}
+
 static void dbg_write_stub(const char *msg)
 {
 }
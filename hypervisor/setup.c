@@ -19,25 +19,67 @@
 #include <jailhouse/control.h>
 #include <jailhouse/string.h>
 #include <jailhouse/unit.h>
+#include <jailhouse/utils.h>
 #include <generated/version.h>
 #include <asm/spinlock.h>
 
-extern u8 __text_start[], __page_pool[];
+extern u8 __text_start[], __text_hot_end[], __text_init_start[];
+extern u8 __text_end[], __page_pool[];
 
-static const __attribute__((aligned(PAGE_SIZE))) u8 empty_page[PAGE_SIZE];
+const __attribute__((aligned(PAGE_SIZE))) u8 empty_page[PAGE_SIZE];
+
+/* units beyond this limit are initialized but not timed */
+#define MAX_TIMED_UNITS		16
+
+static const char *const setup_phase_names[JAILHOUSE_NUM_SETUP_PHASES] = {
+	[JAILHOUSE_SETUP_EARLY] = "early",
+	[JAILHOUSE_SETUP_CPUS] = "CPUs",
+	[JAILHOUSE_SETUP_UNITS] = "units",
+	[JAILHOUSE_SETUP_MEMORY] = "memory",
+	[JAILHOUSE_SETUP_COMMIT] = "commit",
+};
 
 static DEFINE_SPINLOCK(init_lock);
 static unsigned int master_cpu_id = -1;
 static volatile unsigned int entered_cpus, initialized_cpus;
 static volatile int error;
+/* start of each setup phase, the last entry marks the end of the setup */
+static u64 setup_timestamps[JAILHOUSE_NUM_SETUP_PHASES + 1];
+static u64 unit_setup_ticks[MAX_TIMED_UNITS];
+static unsigned int timed_units;
+
+/* Per-CPU pages holding a cell console or a trace buffer */
+static bool is_shared_percpu_page(unsigned long phys)
+{
+	unsigned long offset = phys - paging_hvirt2phys(per_cpu(0));
+
+	if (phys < paging_hvirt2phys(per_cpu(0)) ||
+	    offset >= sizeof(struct per_cpu) * hypervisor_header.max_cpus ||
+	    !cpu_id_valid(offset / sizeof(struct per_cpu)))
+		return false;
+
+	offset %= sizeof(struct per_cpu);
+	if (offset - hypervisor_header.cell_console <
+	    sizeof(struct jailhouse_cell_console) ||
+	    offset - hypervisor_header.cpu_stats <
+	    sizeof(struct jailhouse_cpu_stats))
+		return true;
+#if defined(CONFIG_TRACE_EVENTS) || defined(CONFIG_PROFILE_SAMPLING)
+	return offset - hypervisor_header.trace_buffer <
+		sizeof(struct jailhouse_trace_buffer);
+#else
+	return false;
+#endif
+}
 
-static void init_early(unsigned int cpu_id)
+static void __init init_early(unsigned int cpu_id)
 {
 	unsigned long core_and_percpu_size = hypervisor_header.core_size +
 		sizeof(struct per_cpu) * hypervisor_header.max_cpus;
 	u64 hyp_phys_start, hyp_phys_end;
 	struct jailhouse_memory hv_page;
 
+	setup_timestamps[JAILHOUSE_SETUP_EARLY] = read_timestamp();
 	master_cpu_id = cpu_id;
 
 	system_config = (struct jailhouse_system *)
@@ -49,7 +91,10 @@ static void init_early(unsigned int cpu_id)
 
 	printk("\nInitializing Jailhouse hypervisor %s on CPU %d\n",
 	       JAILHOUSE_VERSION, cpu_id);
-	printk("Code location: %p\n", __text_start);
+	printk("Code location: %p, size %ld (hot %ld, init %ld)\n",
+	       __text_start, (long)(__text_end - __text_start),
+	       (long)(__text_hot_end - __text_start),
+	       (long)(__text_end - __text_init_start));
 
 	gcov_init();
 
@@ -73,7 +118,9 @@ static void init_early(unsigned int cpu_id)
 	 * Linux' page table before shutdown without triggering violations.
 	 *
 	 * Allow read access to the console page, if the hypervisor has the
-	 * debug console flag JAILHOUSE_CON2_TYPE_ROOTPAGE set.
+	 * debug console flag JAILHOUSE_CON2_TYPE_ROOTPAGE set, to the cell
+	 * consoles, to the per-CPU statistics and trace buffers and to the
+	 * status page.
 	 */
 	hyp_phys_start = system_config->hypervisor_memory.phys_start;
 	hyp_phys_end = hyp_phys_start + system_config->hypervisor_memory.size;
@@ -85,6 +132,9 @@ static void init_early(unsigned int cpu_id)
 		if (virtual_console &&
 		    hv_page.virt_start == paging_hvirt2phys(&console))
 			hv_page.phys_start = paging_hvirt2phys(&console);
+		else if (is_shared_percpu_page(hv_page.virt_start) ||
+			 hv_page.virt_start == paging_hvirt2phys(&status_page))
+			hv_page.phys_start = hv_page.virt_start;
 		else
 			hv_page.phys_start = paging_hvirt2phys(empty_page);
 		error = arch_map_memory_region(&root_cell, &hv_page);
@@ -92,21 +142,42 @@ static void init_early(unsigned int cpu_id)
 			return;
 		hv_page.virt_start += PAGE_SIZE;
 	}
+	status_page_update();
 
 	paging_dump_stats("after early setup");
 	printk("Initializing processors:\n");
 }
 
-static void cpu_init(struct per_cpu *cpu_data)
+/*
+ * Marks the stack below the current frame as unused, see
+ * cpu_update_stack_usage. The margin covers the frames of callees.
+ */
+static void __init stack_mark_unused(struct per_cpu *cpu_data)
 {
-	int err = -EINVAL;
+	unsigned long *word = (unsigned long *)cpu_data->stack;
+	unsigned long *end = __builtin_frame_address(0) - 256;
 
-	printk(" CPU %d... ", cpu_data->public.cpu_id);
+	while (word < end)
+		*word++ = STACK_UNUSED_PATTERN;
+}
+
+/*
+ * Runs concurrently on all CPUs. Only arch_cpu_init is serialized as it
+ * manipulates shared state, e.g. descriptor tables.
+ */
+static void __init cpu_init(struct per_cpu *cpu_data)
+{
+	u64 start = read_timestamp();
+	int err = -EINVAL;
 
 	if (!cpu_id_valid(cpu_data->public.cpu_id))
 		goto failed;
 
 	cpu_data->public.cell = &root_cell;
+	cpu_data->public.stats_revision = JAILHOUSE_CPU_STATS_REVISION;
+	cpu_data->public.num_stats = JAILHOUSE_NUM_CPU_STATS;
+
+	stack_mark_unused(cpu_data);
 
 	/* set up per-CPU page table */
 	cpu_data->pg_structs.hv_paging = true;
@@ -125,6 +196,10 @@ static void cpu_init(struct per_cpu *cpu_data)
 			goto failed;
 	}
 
+	err = paging_link_numa_pools(&cpu_data->pg_structs);
+	if (err)
+		goto failed;
+
 	/* set up private mapping of per-CPU data structure */
 	err = paging_create(&cpu_data->pg_structs, paging_hvirt2phys(cpu_data),
 			    sizeof(*cpu_data), LOCAL_CPU_BASE,
@@ -132,10 +207,6 @@ static void cpu_init(struct per_cpu *cpu_data)
 	if (err)
 		goto failed;
 
-	err = arch_cpu_init(cpu_data);
-	if (err)
-		goto failed;
-
 	/* Make sure any remappings to the temporary regions can be performed
 	 * without allocations of page table pages. */
 	err = paging_create(&cpu_data->pg_structs, 0,
@@ -144,28 +215,73 @@ static void cpu_init(struct per_cpu *cpu_data)
 			    PAGING_NON_COHERENT);
 	if (err)
 		goto failed;
+	paging_reset_temporary(cpu_data);
 
-	printk("OK\n");
+	/* do not account the wait for init_lock */
+	cpu_data->public.setup_ticks = read_timestamp() - start;
 
-	/*
-	 * If this CPU is last, make sure everything was committed before we
-	 * signal the other CPUs spinning on initialized_cpus that they can
-	 * continue.
-	 */
-	memory_barrier();
-	initialized_cpus++;
+	spin_lock(&init_lock);
+
+	printk(" CPU %d... ", cpu_data->public.cpu_id);
+	start = read_timestamp();
+	err = arch_cpu_init(cpu_data);
+	cpu_data->public.setup_ticks += read_timestamp() - start;
+	if (err) {
+		printk("FAILED\n");
+		error = err;
+	} else {
+		printk("OK\n");
+		/*
+		 * If this CPU is last, make sure everything was committed
+		 * before we signal the other CPUs spinning on
+		 * initialized_cpus that they can continue.
+		 */
+		memory_barrier();
+		initialized_cpus++;
+	}
+
+	spin_unlock(&init_lock);
 	return;
 
 failed:
-	printk("FAILED\n");
+	printk(" CPU %d... FAILED\n", cpu_data->public.cpu_id);
 	error = err;
 }
 
-static void init_late(void)
+static void print_setup_times(void)
+{
+	unsigned int phase;
+
+	/* raw ticks, 64-bit divisions are not available on all archs */
+	printk("Setup times in ticks at %lu kHz:", arch_timestamp_khz());
+	for (phase = 0; phase < JAILHOUSE_NUM_SETUP_PHASES; phase++)
+		printk(" %s %llu", setup_phase_names[phase],
+		       setup_timestamps[phase + 1] - setup_timestamps[phase]);
+	printk("\n");
+}
+
+long setup_get_time(unsigned long type)
+{
+	unsigned long phase = type - JAILHOUSE_INFO_SETUP_TIME_BASE;
+	unsigned long unit = type - JAILHOUSE_INFO_UNIT_SETUP_TIME_BASE;
+	u64 ticks;
+
+	if (phase < JAILHOUSE_NUM_SETUP_PHASES)
+		ticks = setup_timestamps[phase + 1] - setup_timestamps[phase];
+	else if (unit < timed_units)
+		ticks = unit_setup_ticks[unit];
+	else
+		return -EINVAL;
+
+	return ticks & BIT_MASK(BITS_PER_LONG - 2, 0);
+}
+
+static void __init init_late(void)
 {
 	unsigned int n, cpu, expected_cpus = 0;
 	const struct jailhouse_memory *mem;
 	struct unit *unit;
+	u64 start;
 
 	for_each_cpu(cpu, root_cell.cpu_set)
 		expected_cpus++;
@@ -174,13 +290,19 @@ static void init_late(void)
 		return;
 	}
 
+	setup_timestamps[JAILHOUSE_SETUP_UNITS] = read_timestamp();
 	for_each_unit(unit) {
 		printk("Initializing unit: %s\n", unit->name);
+		start = read_timestamp();
 		error = unit->init();
 		if (error)
 			return;
+		if (timed_units < MAX_TIMED_UNITS)
+			unit_setup_ticks[timed_units++] =
+				read_timestamp() - start;
 	}
 
+	setup_timestamps[JAILHOUSE_SETUP_MEMORY] = read_timestamp();
 	for_each_mem_region(mem, root_cell.config, n) {
 		if (JAILHOUSE_MEMORY_IS_SUBPAGE(mem))
 			error = mmio_subpage_register(&root_cell, mem);
@@ -190,16 +312,19 @@ static void init_late(void)
 			return;
 	}
 
+	setup_timestamps[JAILHOUSE_SETUP_COMMIT] = read_timestamp();
 	config_commit(&root_cell);
+	setup_timestamps[JAILHOUSE_NUM_SETUP_PHASES] = read_timestamp();
 
 	paging_dump_stats("after late setup");
+	print_setup_times();
 }
 
 /*
  * This is the architecture independent C entry point, which is called by
  * arch_entry. This routine is called on each CPU when initializing Jailhouse.
  */
-int entry(unsigned int cpu_id, struct per_cpu *cpu_data)
+int __init entry(unsigned int cpu_id, struct per_cpu *cpu_data)
 {
 	static volatile bool activate;
 	bool master = false;
@@ -228,13 +353,14 @@ int entry(unsigned int cpu_id, struct per_cpu *cpu_data)
 		 * function, performs system-wide initializations. */
 		master = true;
 		init_early(cpu_id);
+		setup_timestamps[JAILHOUSE_SETUP_CPUS] = read_timestamp();
 	}
 
+	spin_unlock(&init_lock);
+
 	if (!error)
 		cpu_init(cpu_data);
 
-	spin_unlock(&init_lock);
-
 	while (!error && initialized_cpus < hypervisor_header.online_cpus)
 		cpu_relax();
 
@@ -275,4 +401,11 @@ hypervisor_header = {
 	.percpu_size = sizeof(struct per_cpu),
 	.entry = arch_entry - JAILHOUSE_BASE,
 	.console_page = (unsigned long)&console - JAILHOUSE_BASE,
+	.cell_console = __builtin_offsetof(struct per_cpu, public.cell_console),
+	.cpu_stats =
+		__builtin_offsetof(struct per_cpu, public.stats_revision),
+	.status_page = (unsigned long)&status_page - JAILHOUSE_BASE,
+#if defined(CONFIG_TRACE_EVENTS) || defined(CONFIG_PROFILE_SAMPLING)
+	.trace_buffer = __builtin_offsetof(struct per_cpu, public.trace),
+#endif
 };
@@ -0,0 +1,147 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Objects are grouped into power-of-two size classes from 32 to
+ * SLAB_MAX_SIZE bytes. Each class is served from pages that only hold
+ * objects of that class, the first slot of a page carries its header. A page
+ * goes back to mem_pool as soon as its last object is released, so that the
+ * pool statistics keep reflecting the actual usage.
+ */
+
+#include <jailhouse/paging.h>
+#include <jailhouse/slab.h>
+#include <jailhouse/string.h>
+#include <asm/spinlock.h>
+
+#define SLAB_MIN_SHIFT		5
+#define SLAB_MAX_SHIFT		10
+#define SLAB_NUM_CLASSES	(SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+struct slab {
+	/** Next slab of the same class with free objects. */
+	struct slab *next;
+	/** First free object, the free objects are chained via their first
+	 *  word. */
+	void *free_list;
+	/** Number of allocated objects. */
+	unsigned int used;
+};
+
+/* Slabs with at least one free object, per size class. */
+static struct slab *partial_slabs[SLAB_NUM_CLASSES];
+static DEFINE_SPINLOCK(slab_lock);
+
+static unsigned int size_class(unsigned long size)
+{
+	unsigned int shift = SLAB_MIN_SHIFT;
+
+	while ((1UL << shift) < size)
+		shift++;
+	return shift - SLAB_MIN_SHIFT;
+}
+
+static struct slab *slab_create(unsigned long obj_size)
+{
+	struct slab *slab = page_alloc(&mem_pool, 1);
+	unsigned int n;
+	void *obj;
+
+	if (!slab)
+		return NULL;
+
+	slab->next = NULL;
+	slab->free_list = NULL;
+	slab->used = 0;
+
+	/* slot 0 holds the header */
+	for (n = PAGE_SIZE / obj_size - 1; n > 0; n--) {
+		obj = (void *)slab + n * obj_size;
+		*(void **)obj = slab->free_list;
+		slab->free_list = obj;
+	}
+
+	return slab;
+}
+
+void *slab_alloc(unsigned long size)
+{
+	unsigned int class;
+	struct slab *slab;
+	void *obj;
+
+	if (size > SLAB_MAX_SIZE) {
+		obj = page_alloc(&mem_pool, PAGES(size));
+		if (obj)
+			memset(obj, 0, size);
+		return obj;
+	}
+
+	class = size_class(size);
+
+	spin_lock(&slab_lock);
+
+	slab = partial_slabs[class];
+	if (!slab) {
+		slab = slab_create(1UL << (class + SLAB_MIN_SHIFT));
+		if (!slab) {
+			spin_unlock(&slab_lock);
+			return NULL;
+		}
+		partial_slabs[class] = slab;
+	}
+
+	obj = slab->free_list;
+	slab->free_list = *(void **)obj;
+	slab->used++;
+	if (!slab->free_list)
+		partial_slabs[class] = slab->next;
+
+	spin_unlock(&slab_lock);
+
+	memset(obj, 0, size);
+
+	return obj;
+}
+
+void slab_free(void *obj, unsigned long size)
+{
+	struct slab *slab, **slabp;
+	unsigned int class;
+
+	if (!obj)
+		return;
+
+	if (size > SLAB_MAX_SIZE) {
+		page_free(&mem_pool, obj, PAGES(size));
+		return;
+	}
+
+	class = size_class(size);
+	slab = (struct slab *)((unsigned long)obj & PAGE_MASK);
+
+	spin_lock(&slab_lock);
+
+	/* a full slab becomes partial again */
+	if (!slab->free_list) {
+		slab->next = partial_slabs[class];
+		partial_slabs[class] = slab;
+	}
+
+	*(void **)obj = slab->free_list;
+	slab->free_list = obj;
+
+	if (--slab->used == 0) {
+		for (slabp = &partial_slabs[class]; *slabp != slab;
+		     slabp = &(*slabp)->next)
+			; /* empty loop */
+		*slabp = slab->next;
+		page_free(&mem_pool, slab, 1);
+	}
+
+	spin_unlock(&slab_lock);
+}
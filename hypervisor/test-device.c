@@ -0,0 +1,217 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018-2020
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * MMIO test and benchmark device, occupying the page after the cell's
+ * communication region. The last 8 bytes of the page mirror the end of the
+ * communication page, i.e. echo what was written, for all access sizes. The
+ * benchmark registers at the start of the page are per CPU and take 4 or
+ * 8-byte accesses:
+ *
+ * TESTDEV_ACCUMULATE:	writes add to the accumulator, reads return and clear
+ * 			it
+ * TESTDEV_TIMESTAMP:	read_timestamp() on entry of the device handler; the
+ * 			read also latches the timestamp of its VM exit entry
+ * 			into TESTDEV_EXIT_TIME
+ * TESTDEV_EXIT_TIME:	VM exit entry timestamp of the last TESTDEV_TIMESTAMP
+ * 			read
+ * TESTDEV_IRQ_DELAY:	ticks to spend in the handler before injecting the
+ * 			interrupt requested via TESTDEV_IRQ_TRIGGER, capped at
+ * 			one millisecond
+ * TESTDEV_IRQ_TRIGGER:	writes inject the given interrupt into the calling CPU
+ * TESTDEV_IRQ_TIME:	read_timestamp() right before the last injection
+ *
+ * Together with counter reads of the cell, this splits the cost of an exit
+ * into the entry, dispatch, handler and injection phases.
+ */
+
+#include <jailhouse/control.h>
+#include <jailhouse/mmio.h>
+#include <jailhouse/printk.h>
+#include <jailhouse/unit.h>
+
+#define TESTDEV_ACCUMULATE	0x00
+#define TESTDEV_TIMESTAMP	0x08
+#define TESTDEV_EXIT_TIME	0x10
+#define TESTDEV_IRQ_DELAY	0x18
+#define TESTDEV_IRQ_TRIGGER	0x20
+#define TESTDEV_IRQ_TIME	0x28
+#define TESTDEV_BENCH_END	0x30
+
+#define TESTDEV_ECHO		0xff8
+
+static unsigned int testdev_mmio_count_regions(struct cell *cell)
+{
+	return cell->config->flags & JAILHOUSE_CELL_TEST_DEVICE ? 1 : 0;
+}
+
+static enum mmio_result testdev_handle_echo(struct mmio_access *mmio)
+{
+	void *test_reg = &this_cell()->comm_page.padding[mmio->address];
+
+	switch (mmio->size) {
+	case 1:
+		if (mmio->is_write)
+			*(u8 *)test_reg = mmio->value;
+		else
+			mmio->value = *(u8 *)test_reg;
+		break;
+	case 2:
+		if (mmio->is_write)
+			*(u16 *)test_reg = mmio->value;
+		else
+			mmio->value = *(u16 *)test_reg;
+		break;
+	case 4:
+		if (mmio->is_write)
+			*(u32 *)test_reg = mmio->value;
+		else
+			mmio->value = *(u32 *)test_reg;
+		break;
+	case 8:
+		if (mmio->is_write)
+			*(u64 *)test_reg = mmio->value;
+		else
+			mmio->value = *(u64 *)test_reg;
+		break;
+	}
+	return MMIO_HANDLED;
+}
+
+static bool testdev_trigger_irq(struct public_per_cpu *cpu_public,
+				unsigned int irq)
+{
+	u64 deadline = read_timestamp() + cpu_public->testdev_irq_delay;
+
+	while (read_timestamp() < deadline)
+		cpu_relax();
+
+	cpu_public->testdev_irq_time = read_timestamp();
+	return arch_testdev_inject_irq(irq) == 0;
+}
+
+static enum mmio_result testdev_handle_mmio_access(void *arg,
+						   struct mmio_access *mmio)
+{
+	struct public_per_cpu *cpu_public = this_cpu_public();
+	u64 now = read_timestamp();
+	unsigned long value = 0;
+	u64 max_delay;
+
+	if (mmio->address >= TESTDEV_ECHO &&
+	    mmio->address <= 0x1000 - mmio->size)
+		return testdev_handle_echo(mmio);
+
+	if (mmio->address >= TESTDEV_BENCH_END || mmio->address & 0x7 ||
+	    (mmio->size != 4 && mmio->size != 8))
+		goto invalid_access;
+
+	if (mmio->is_write) {
+		switch (mmio->address) {
+		case TESTDEV_ACCUMULATE:
+			cpu_public->testdev_accumulator += mmio->value;
+			break;
+		case TESTDEV_IRQ_DELAY:
+			max_delay = arch_timestamp_khz();
+			cpu_public->testdev_irq_delay = mmio->value < max_delay ?
+				mmio->value : max_delay;
+			break;
+		case TESTDEV_IRQ_TRIGGER:
+			if (!testdev_trigger_irq(cpu_public, mmio->value))
+				goto invalid_access;
+			break;
+		default:
+			goto invalid_access;
+		}
+		return MMIO_HANDLED;
+	}
+
+	switch (mmio->address) {
+	case TESTDEV_ACCUMULATE:
+		value = cpu_public->testdev_accumulator;
+		cpu_public->testdev_accumulator = 0;
+		break;
+	case TESTDEV_TIMESTAMP:
+		cpu_public->testdev_exit_time = cpu_public->testdev_exit_start;
+		value = now;
+		break;
+	case TESTDEV_EXIT_TIME:
+		value = cpu_public->testdev_exit_time;
+		break;
+	case TESTDEV_IRQ_DELAY:
+		value = cpu_public->testdev_irq_delay;
+		break;
+	case TESTDEV_IRQ_TIME:
+		value = cpu_public->testdev_irq_time;
+		break;
+	default:
+		goto invalid_access;
+	}
+	mmio->value = mmio->size == 4 ? (u32)value : value;
+	return MMIO_HANDLED;
+
+invalid_access:
+	printk("testdev: invalid %s, register %lx, size %d\n",
+	       mmio->is_write ? "write" : "read", mmio->address, mmio->size);
+	return MMIO_ERROR;
+}
+
+static unsigned long testdev_get_mmio_base(struct cell *cell)
+{
+	const struct jailhouse_memory *mem;
+	unsigned int n;
+
+	for_each_mem_region(mem, cell->config, n)
+		if ((mem->flags & (JAILHOUSE_MEM_COMM_REGION |
+				   JAILHOUSE_MEM_TIMEBASE)) ==
+		    JAILHOUSE_MEM_COMM_REGION)
+			return mem->virt_start + PAGE_SIZE;
+
+	return INVALID_PHYS_ADDR;
+}
+
+static int testdev_cell_init(struct cell *cell)
+{
+	struct public_per_cpu *cpu_public;
+	unsigned long comm_base;
+	unsigned int cpu;
+
+	if (cell->config->flags & JAILHOUSE_CELL_TEST_DEVICE) {
+		comm_base = testdev_get_mmio_base(cell);
+		if (comm_base == INVALID_PHYS_ADDR)
+			return trace_error(-EINVAL);
+
+		for_each_cpu(cpu, cell->cpu_set) {
+			cpu_public = public_per_cpu(cpu);
+			cpu_public->testdev_accumulator = 0;
+			cpu_public->testdev_irq_delay = 0;
+			cpu_public->testdev_irq_time = 0;
+		}
+
+		mmio_region_register(cell, comm_base, PAGE_SIZE,
+				     testdev_handle_mmio_access, NULL,
+				     "test-device");
+	}
+	return 0;
+}
+
+static void testdev_cell_exit(struct cell *cell)
+{
+	if (cell->config->flags & JAILHOUSE_CELL_TEST_DEVICE)
+		mmio_region_unregister(cell, testdev_get_mmio_base(cell));
+}
+
+static int testdev_init(void)
+{
+	return 0;
+}
+
+DEFINE_UNIT_SHUTDOWN_STUB(testdev);
+DEFINE_UNIT(testdev, "Test device");
@@ -8,16 +8,32 @@
  *
  * This work is licensed under the terms of the GNU GPL, version 2.  See
  * the COPYING file in the top-level directory.
+ *
+ * Output is queued in a TX ring so that printk callers only copy into memory.
+ * The ring is drained without waiting on the UART whenever output is queued
+ * and on VM exits of root cell CPUs. Only a full ring, a flush request or a
+ * panic make the caller wait for the UART.
  */
 
 #include <jailhouse/types.h>
 #include <jailhouse/uart.h>
 #include <jailhouse/control.h>
 #include <jailhouse/processor.h>
+#include <asm/bitops.h>
+
+#define UART_TX_RING_SIZE	4096
 
 struct uart_chip *uart = NULL;
 
-void uart_write(const char *msg)
+/* Filled under printk_lock, consumed by the owner of tx_drain_busy */
+static struct {
+	char content[UART_TX_RING_SIZE];
+	volatile unsigned int head, tail;
+} tx_ring;
+
+static unsigned long tx_drain_busy;
+
+static void uart_write_sync(const char *msg)
 {
 	char c = 0;
 
@@ -36,3 +52,91 @@ void uart_write(const char *msg)
 		uart->write_char(uart, c);
 	}
 }
+
+static bool tx_ring_empty(void)
+{
+	return tx_ring.head == tx_ring.tail;
+}
+
+static void tx_ring_drain(bool wait)
+{
+	if (test_and_set_bit(0, &tx_drain_busy))
+		return;
+
+	while (!tx_ring_empty()) {
+		if (panic_in_progress && panic_cpu != phys_processor_id())
+			break;
+		if (uart->is_busy(uart)) {
+			if (!wait)
+				break;
+			cpu_relax();
+			continue;
+		}
+		/* read the content only after seeing the new tail */
+		memory_load_barrier();
+		uart->write_char(uart, tx_ring.content[tx_ring.head %
+						       UART_TX_RING_SIZE]);
+		/* the slot may only be reused after it was consumed */
+		memory_barrier();
+		tx_ring.head++;
+	}
+
+	clear_bit(0, &tx_drain_busy);
+}
+
+static void tx_ring_put(char c)
+{
+	while (tx_ring.tail - tx_ring.head >= UART_TX_RING_SIZE) {
+		if (panic_in_progress)
+			return;
+		tx_ring_drain(false);
+		cpu_relax();
+	}
+	tx_ring.content[tx_ring.tail % UART_TX_RING_SIZE] = c;
+	/* publish the content before the tail that covers it */
+	memory_barrier();
+	tx_ring.tail++;
+}
+
+/**
+ * Queue a message for output on the debug UART.
+ * @param msg		Null-terminated message.
+ *
+ * Must be called with printk_lock held. During a panic, the queued output and
+ * the message are written synchronously.
+ */
+void uart_write(const char *msg)
+{
+	if (panic_in_progress) {
+		if (panic_cpu == phys_processor_id())
+			tx_ring_drain(true);
+		uart_write_sync(msg);
+		return;
+	}
+
+	for (; *msg; msg++) {
+		if (*msg == '\n')
+			tx_ring_put('\r');
+		tx_ring_put(*msg);
+	}
+	tx_ring_drain(false);
+}
+
+/**
+ * Pass queued output to the debug UART as far as it accepts it without
+ * waiting.
+ */
+void uart_drain(void)
+{
+	if (uart && !tx_ring_empty())
+		tx_ring_drain(false);
+}
+
+/**
+ * Write all queued output to the debug UART, waiting for it if necessary.
+ */
+void uart_flush(void)
+{
+	if (uart)
+		tx_ring_drain(true);
+}
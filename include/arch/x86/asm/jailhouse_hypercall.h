@@ -110,6 +110,9 @@ struct jailhouse_comm_region {
 	/** Calibrated APIC timer frequency in kHz or 0 if TSC deadline timer
 	 * is available (x86-specific). */
 	__u32 apic_khz;
+	/** Last bus covered by PCI memory mapped config (x86-specific). */
+	__u8 pci_mmconfig_end_bus;
+	__u8 padding[3];
 };
 
 /**
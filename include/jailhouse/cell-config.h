@@ -45,12 +45,73 @@
  * Incremented on any layout or semantic change of system or cell config.
  * Also update HEADER_REVISION in tools.
  */
-#define JAILHOUSE_CONFIG_REVISION	10
+#define JAILHOUSE_CONFIG_REVISION	15
 
 #define JAILHOUSE_CELL_NAME_MAXLEN	31
 
 #define JAILHOUSE_CELL_PASSIVE_COMMREG	0x00000001
 #define JAILHOUSE_CELL_TEST_DEVICE	0x00000002
+/*
+ * Cache decoded MMIO instructions (x86 only). Modifications of code that has
+ * previously performed trapped MMIO accesses are not detected, so this must
+ * only be set for cells that do not reuse such code addresses.
+ */
+#define JAILHOUSE_CELL_MMIO_DECODE_CACHE	0x00000004
+/*
+ * msg_reply_timeout is given in microseconds instead of idle loops. The
+ * management CPU is then not held in the hypervisor while waiting for a
+ * shutdown reply but returns to the root cell, which retries the request.
+ */
+#define JAILHOUSE_CELL_MSG_TIMEOUT_USEC		0x00000008
+
+/*
+ * Idle behavior of the cell's CPUs, including parked ones, on HLT and MWAIT
+ * (x86) or WFI (ARM):
+ *  PASSTHROUGH - executed natively without a VM exit (default)
+ *  POLL        - trapped and skipped, the CPU never idles but wakes up fastest
+ *  TRAPPED     - trapped, the hypervisor idles the CPU until an interrupt
+ *                arrives, on x86 in no deeper C-state than selected by
+ *                JAILHOUSE_CELL_IDLE_MAX_CSTATE (an MWAIT hint, 0x00 for C1)
+ */
+#define JAILHOUSE_CELL_IDLE_SHIFT		4 /* uses bits 4..5 */
+#define JAILHOUSE_CELL_IDLE_MASK		(3 << JAILHOUSE_CELL_IDLE_SHIFT)
+#define JAILHOUSE_CELL_IDLE_PASSTHROUGH		(0 << JAILHOUSE_CELL_IDLE_SHIFT)
+#define JAILHOUSE_CELL_IDLE_POLL		(1 << JAILHOUSE_CELL_IDLE_SHIFT)
+#define JAILHOUSE_CELL_IDLE_TRAPPED		(2 << JAILHOUSE_CELL_IDLE_SHIFT)
+#define JAILHOUSE_CELL_IDLE_MAX_CSTATE_SHIFT	8 /* uses bits 8..15 */
+#define JAILHOUSE_CELL_IDLE_MAX_CSTATE(hint)	\
+	((hint) << JAILHOUSE_CELL_IDLE_MAX_CSTATE_SHIFT)
+
+/*
+ * Run the cell's CPUs at a fixed frequency, without turbo (Intel x86 only):
+ * the maximum non-turbo P-state or, with HWP, the guaranteed performance
+ * level. P-state requests of the cell are ignored. Without this flag, cells
+ * control the P-states of their CPUs themselves.
+ */
+#define JAILHOUSE_CELL_FIXED_FREQUENCY		0x00000040
+
+/*
+ * Zero the cell's RAM before it is handed back to the root cell, i.e. on
+ * cell destruction, when the cell is made loadable again and for released
+ * balloon chunks. This prevents leaking cell data to the root cell at the
+ * price of a longer management operation.
+ */
+#define JAILHOUSE_CELL_SCRUB_MEMORY		0x00000080
+
+/*
+ * Let the root cell move CPUs into and out of the cell at runtime via
+ * JAILHOUSE_HC_CELL_CPU_ADD/REMOVE. Only CPUs with higher IDs than the first
+ * CPU of the cell's CPU set can be moved, the first one stays with the cell.
+ */
+#define JAILHOUSE_CELL_ELASTIC_CPUS		0x00010000
+
+/*
+ * Map plain RAM regions of the cell only on first access, in chunks of 2 MiB,
+ * so that creating cells with huge memory does not depend on their size.
+ * Regions with JAILHOUSE_MEM_DMA are still mapped eagerly. The first access
+ * to each chunk costs an exit into the hypervisor.
+ */
+#define JAILHOUSE_CELL_LAZY_MEMORY		0x00020000
 
 /*
  * The flag JAILHOUSE_CELL_VIRTUAL_CONSOLE_PERMITTED allows inmates to invoke
@@ -66,6 +127,10 @@
 	!!((flags) & JAILHOUSE_CELL_VIRTUAL_CONSOLE_ACTIVE)
 #define CELL_FLAGS_VIRTUAL_CONSOLE_PERMITTED(flags) \
 	!!((flags) & JAILHOUSE_CELL_VIRTUAL_CONSOLE_PERMITTED)
+#define CELL_FLAGS_IDLE_POLICY(flags) \
+	((flags) & JAILHOUSE_CELL_IDLE_MASK)
+#define CELL_FLAGS_IDLE_MAX_CSTATE(flags) \
+	(((flags) >> JAILHOUSE_CELL_IDLE_MAX_CSTATE_SHIFT) & 0xff)
 
 #define JAILHOUSE_CELL_DESC_SIGNATURE	"JHCELL"
 
@@ -90,6 +155,10 @@ struct jailhouse_cell_desc {
 	__u32 pio_bitmap_size;
 	__u32 num_pci_devices;
 	__u32 num_pci_caps;
+	__u32 num_stream_ids;
+	__u32 num_msr_ranges;
+	__u32 num_cpuid_leaves;
+	__u32 num_smc_ranges;
 
 	__u32 vpci_irq_base;
 
@@ -108,11 +177,66 @@ struct jailhouse_cell_desc {
 #define JAILHOUSE_MEM_LOADABLE		0x0040
 #define JAILHOUSE_MEM_ROOTSHARED	0x0080
 #define JAILHOUSE_MEM_IO_UNALIGNED	0x0100
+#define JAILHOUSE_MEM_COLORED		0x0200
+#define JAILHOUSE_MEM_IO_POSTED		0x0400
+/*
+ * RAM of a non-root cell that the cell may hand back to the root cell at
+ * runtime in chunks of JAILHOUSE_BALLOON_CHUNK_SIZE and reclaim later. The
+ * cell keeps at least its other regions. Start addresses and size have to be
+ * aligned to the chunk size.
+ */
+#define JAILHOUSE_MEM_BALLOON		0x0800
+/*
+ * Combined with JAILHOUSE_MEM_COMM_REGION: the page is backed by the timebase
+ * page of the hypervisor instead of the communication region and mapped
+ * read-only. phys_start is ignored, size has to be one page.
+ */
+#define JAILHOUSE_MEM_TIMEBASE		0x1000
+/*
+ * RAM of a non-root cell that is part of a transfer pool: each chunk of
+ * JAILHOUSE_TRANSFER_CHUNK_SIZE is mapped into exactly one of the cells that
+ * list the same physical range, and the owner can hand it over to another of
+ * them via JAILHOUSE_HC_MEM_TRANSFER. The first of these cells to be created
+ * owns all chunks. Start addresses and size have to be aligned to the chunk
+ * size.
+ */
+#define JAILHOUSE_MEM_TRANSFER		0x2000
+/*
+ * Loadable RAM of a non-root cell holding an image that identical cells
+ * share: all cells listing the same physical range map the same copy and may
+ * only read and execute it. The root cell can access the range only while all
+ * of these cells are loadable, so the image is loaded once for all of them.
+ * Requires JAILHOUSE_MEM_LOADABLE and rules out JAILHOUSE_MEM_WRITE.
+ */
+#define JAILHOUSE_MEM_SHARED_IMAGE	0x4000
 #define JAILHOUSE_MEM_IO_WIDTH_SHIFT	16 /* uses bits 16..19 */
 #define JAILHOUSE_MEM_IO_8		(1 << JAILHOUSE_MEM_IO_WIDTH_SHIFT)
 #define JAILHOUSE_MEM_IO_16		(2 << JAILHOUSE_MEM_IO_WIDTH_SHIFT)
 #define JAILHOUSE_MEM_IO_32		(4 << JAILHOUSE_MEM_IO_WIDTH_SHIFT)
 #define JAILHOUSE_MEM_IO_64		(8 << JAILHOUSE_MEM_IO_WIDTH_SHIFT)
+/*
+ * Memory type enforced by the second-stage translation. The default leaves
+ * RAM cacheable and IO uncached as far as the cell's own attributes permit.
+ * WB overrides the guest PAT on Intel so that all peers of shared memory agree.
+ * Not applicable to communication regions.
+ */
+#define JAILHOUSE_MEM_TYPE_SHIFT	20 /* uses bits 20..21 */
+#define JAILHOUSE_MEM_TYPE_MASK		(3 << JAILHOUSE_MEM_TYPE_SHIFT)
+#define JAILHOUSE_MEM_TYPE_DEFAULT	(0 << JAILHOUSE_MEM_TYPE_SHIFT)
+#define JAILHOUSE_MEM_TYPE_WB		(1 << JAILHOUSE_MEM_TYPE_SHIFT)
+#define JAILHOUSE_MEM_TYPE_WC		(2 << JAILHOUSE_MEM_TYPE_SHIFT)
+#define JAILHOUSE_MEM_TYPE_UC		(3 << JAILHOUSE_MEM_TYPE_SHIFT)
+/*
+ * Last-level cache colors of a JAILHOUSE_MEM_COLORED region (ARM only), bit n
+ * selects color n.
+ */
+#define JAILHOUSE_MEM_COLORS_SHIFT	32 /* uses bits 32..63 */
+#define JAILHOUSE_MEM_COLORS(mask)	\
+	((__u64)(mask) << JAILHOUSE_MEM_COLORS_SHIFT)
+#define JAILHOUSE_MAX_COLORS		32
+
+#define JAILHOUSE_BALLOON_CHUNK_SIZE	0x200000
+#define JAILHOUSE_TRANSFER_CHUNK_SIZE	0x200000
 
 struct jailhouse_memory {
 	__u64 phys_start;
@@ -128,6 +252,12 @@ struct jailhouse_memory {
 #define JAILHOUSE_CACHE_L3_DATA		0x02
 #define JAILHOUSE_CACHE_L3		(JAILHOUSE_CACHE_L3_CODE | \
 					 JAILHOUSE_CACHE_L3_DATA)
+#define JAILHOUSE_CACHE_L2		0x04
+/*
+ * Memory bandwidth budget (Intel MBA) instead of a cache partition: size is
+ * the bandwidth share in percent, start must be 0.
+ */
+#define JAILHOUSE_CACHE_MEM_BW		0x08
 
 #define JAILHOUSE_CACHE_ROOTSHARED	0x0001
 
@@ -152,8 +282,26 @@ struct jailhouse_irqchip {
 
 #define JAILHOUSE_SHMEM_PROTO_UNDEFINED	0x0000
 #define JAILHOUSE_SHMEM_PROTO_VETH	0x0100
+/* 0x02xx / 0x03xx, xx: virtio device ID, see virtio-over-ivshmem.txt */
+#define JAILHOUSE_SHMEM_PROTO_VIRTIO_FRONT	0x0200
+#define JAILHOUSE_SHMEM_PROTO_VIRTIO_BACK	0x0300
+/* copy service of a root-cell agent, see dma-copy.h */
+#define JAILHOUSE_SHMEM_PROTO_DMA_COPY	0x0400
 #define JAILHOUSE_SHMEM_PROTO_CUSTOM	0x8000	/* 0x80xx..0xffxx */
 
+/*
+ * Memory regions starting at shmem_region are, in this order, a read-only
+ * state table, a read/write section and one output section per peer, only
+ * writable in the config of the owning peer.
+ */
+#define JAILHOUSE_SHMEM_FLAG_SECTIONS	0x01
+/*
+ * Expose the read/write region also via a 64-bit prefetchable BAR 2/3 at its
+ * fixed guest address. The region size has to be a power of 2, its guest
+ * address aligned to it, and bar_mask[2..3] has to encode the size.
+ */
+#define JAILHOUSE_SHMEM_FLAG_BAR2	0x02
+
 struct jailhouse_pci_device {
 	__u8 type;
 	__u8 iommu;
@@ -171,7 +319,13 @@ struct jailhouse_pci_device {
 	__u32 shmem_region;
 	/** PCI subclass and interface ID of virtual shared memory device. */
 	__u16 shmem_protocol;
-	__u8 padding[2];
+	/**
+	 * Maximum number of peers of virtual shared memory device, 0 for a
+	 * classic two-peer link. Must match on all peers.
+	 */
+	__u8 shmem_peers;
+	/** Flags of virtual shared memory device (JAILHOUSE_SHMEM_FLAG_*). */
+	__u8 shmem_flags;
 } __attribute__((packed));
 
 #define JAILHOUSE_PCI_EXT_CAP		0x8000
@@ -185,13 +339,66 @@ struct jailhouse_pci_capability {
 	__u16 flags;
 } __attribute__((packed));
 
+#define JAILHOUSE_MSR_READ		0x0001
+#define JAILHOUSE_MSR_WRITE		0x0002
+
+/*
+ * MSRs a cell may access without VM exit (x86 only). If a cell lists no
+ * ranges, the hypervisor's default interception applies. Otherwise, all other
+ * accesses trap and stop the cell unless the hypervisor emulates the MSR.
+ * MSRs the hypervisor has to control remain intercepted, whitelisted or not.
+ * TSC deadline and, with x2APIC, EOI and self-IPI are always accessible.
+ */
+struct jailhouse_msr_range {
+	__u32 start;
+	__u32 size;
+	__u32 flags;
+} __attribute__((packed));
+
+#define JAILHOUSE_CPUID_INDEXED		0x0001
+#define JAILHOUSE_CPUID_CLEAR		0x0002
+
+/*
+ * CPUID results a cell sees instead of the hardware ones (x86 only). The
+ * index (ECX) is only matched with JAILHOUSE_CPUID_INDEXED. By default, the
+ * register values replace the result; with JAILHOUSE_CPUID_CLEAR, they are
+ * masks of bits to clear from it. An all-zero replacement hides a leaf.
+ */
+struct jailhouse_cpuid_leaf {
+	__u32 function;
+	__u32 index;
+	__u32 flags;
+	__u32 eax;
+	__u32 ebx;
+	__u32 ecx;
+	__u32 edx;
+} __attribute__((packed));
+
+/*
+ * SMC function IDs the hypervisor forwards to the firmware on behalf of the
+ * cell (ARM only), e.g. for SCMI, OP-TEE or SDEI. A range must stay within
+ * the IDs of one service (bits 16..31 identical) and must not cover the Arm
+ * architecture calls or PSCI, which remain emulated. Arguments are passed
+ * unmodified, so addresses in them have to refer to memory that is mapped 1:1
+ * into the cell. Other SMCs are emulated or rejected as before.
+ */
+struct jailhouse_smc_range {
+	__u32 start;
+	__u32 length;
+} __attribute__((packed));
+
 #define JAILHOUSE_APIC_MODE_AUTO	0
 #define JAILHOUSE_APIC_MODE_XAPIC	1
 #define JAILHOUSE_APIC_MODE_X2APIC	2
 
 #define JAILHOUSE_MAX_IOMMU_UNITS	8
 
+#define JAILHOUSE_IOMMU_AMD		1
+#define JAILHOUSE_IOMMU_INTEL		2
+#define JAILHOUSE_IOMMU_SMMUV3		3
+
 struct jailhouse_iommu {
+	__u32 type;
 	__u64 base;
 	__u32 size;
 	__u16 amd_bdf;
@@ -200,6 +407,20 @@ struct jailhouse_iommu {
 	__u32 amd_features;
 } __attribute__((packed));
 
+#define JAILHOUSE_MAX_NUMA_NODES	4
+#define JAILHOUSE_NUMA_MAX_CPUS		256
+
+/**
+ * Hypervisor memory local to a NUMA node. The per-CPU VMX structures and page
+ * tables of the listed CPUs are allocated from it. Like hypervisor_memory, the
+ * region has to be reserved, i.e. must not be part of the root cell.
+ */
+struct jailhouse_numa_node {
+	__u64 phys_start;
+	__u64 size;
+	__u64 cpu_set[JAILHOUSE_NUMA_MAX_CPUS / 64];
+} __attribute__((packed));
+
 #define JAILHOUSE_SYSTEM_SIGNATURE	"JHSYST"
 
 /*
@@ -246,9 +467,16 @@ struct jailhouse_system {
 				u64 gich_base;
 				u64 gicv_base;
 				u64 gicr_base;
+				/** ITS, only usable by the root cell,
+				 *  0 if there is none. */
+				u64 gits_base;
+				struct jailhouse_iommu
+					iommu_units[JAILHOUSE_MAX_IOMMU_UNITS];
 			} __attribute__((packed)) arm;
 		} __attribute__((packed));
 	} __attribute__((packed)) platform_info;
+	/** Node-local hypervisor memory, unused entries have a size of 0. */
+	struct jailhouse_numa_node numa_nodes[JAILHOUSE_MAX_NUMA_NODES];
 	struct jailhouse_cell_desc root_cell;
 } __attribute__((packed));
 
@@ -262,7 +490,11 @@ jailhouse_cell_config_size(struct jailhouse_cell_desc *cell)
 		cell->num_irqchips * sizeof(struct jailhouse_irqchip) +
 		cell->pio_bitmap_size +
 		cell->num_pci_devices * sizeof(struct jailhouse_pci_device) +
-		cell->num_pci_caps * sizeof(struct jailhouse_pci_capability);
+		cell->num_pci_caps * sizeof(struct jailhouse_pci_capability) +
+		cell->num_stream_ids * sizeof(__u32) +
+		cell->num_msr_ranges * sizeof(struct jailhouse_msr_range) +
+		cell->num_cpuid_leaves * sizeof(struct jailhouse_cpuid_leaf) +
+		cell->num_smc_ranges * sizeof(struct jailhouse_smc_range);
 }
 
 static inline __u32
@@ -325,4 +557,35 @@ jailhouse_cell_pci_caps(const struct jailhouse_cell_desc *cell)
 		 cell->num_pci_devices * sizeof(struct jailhouse_pci_device));
 }
 
+static inline const __u32 *
+jailhouse_cell_stream_ids(const struct jailhouse_cell_desc *cell)
+{
+	return (const __u32 *)((void *)jailhouse_cell_pci_caps(cell) +
+		cell->num_pci_caps * sizeof(struct jailhouse_pci_capability));
+}
+
+static inline const struct jailhouse_msr_range *
+jailhouse_cell_msr_ranges(const struct jailhouse_cell_desc *cell)
+{
+	return (const struct jailhouse_msr_range *)
+		((void *)jailhouse_cell_stream_ids(cell) +
+		 cell->num_stream_ids * sizeof(__u32));
+}
+
+static inline const struct jailhouse_cpuid_leaf *
+jailhouse_cell_cpuid_leaves(const struct jailhouse_cell_desc *cell)
+{
+	return (const struct jailhouse_cpuid_leaf *)
+		((void *)jailhouse_cell_msr_ranges(cell) +
+		 cell->num_msr_ranges * sizeof(struct jailhouse_msr_range));
+}
+
+static inline const struct jailhouse_smc_range *
+jailhouse_cell_smc_ranges(const struct jailhouse_cell_desc *cell)
+{
+	return (const struct jailhouse_smc_range *)
+		((void *)jailhouse_cell_cpuid_leaves(cell) +
+		 cell->num_cpuid_leaves * sizeof(struct jailhouse_cpuid_leaf));
+}
+
 #endif /* !_JAILHOUSE_CELL_CONFIG_H */
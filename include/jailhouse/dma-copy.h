@@ -0,0 +1,79 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _JAILHOUSE_DMA_COPY_H
+#define _JAILHOUSE_DMA_COPY_H
+
+/*
+ * Copy service of a root-cell agent, offered via an ivshmem link with
+ * protocol JAILHOUSE_SHMEM_PROTO_DMA_COPY. The read/write region of the link
+ * starts with the ring below. The client cell fills descriptors and advances
+ * submit, the agent executes them with a DMA engine, stores their results,
+ * advances complete and rings the doorbell. Indexes are free-running, the
+ * descriptor of index i is descs[i % num_descs].
+ *
+ * Source and destination are guest-physical addresses of the client. Both
+ * ranges have to lie within a single memory region of the client that is
+ * shared with the root cell (JAILHOUSE_MEM_ROOTSHARED) and that the client
+ * may read respectively write.
+ */
+
+#define JAILHOUSE_DMA_COPY_MAX_DESCS	1024
+
+/* LSTATE values of the agent */
+#define JAILHOUSE_DMA_COPY_STATE_RESET	0
+#define JAILHOUSE_DMA_COPY_STATE_READY	1
+
+struct jailhouse_dma_copy_desc {
+	__u64 src;
+	__u64 dst;
+	__u64 len;
+	/** 0 or negative error code, written by the agent. */
+	__s32 result;
+	__u32 padding;
+};
+
+struct jailhouse_dma_copy_ring {
+	/** Number of descriptors, a power of 2, set by the client. */
+	__u32 num_descs;
+	/** Written by the client only. */
+	volatile __u32 submit;
+	/** Written by the agent only. */
+	volatile __u32 complete;
+	__u32 padding;
+	struct jailhouse_dma_copy_desc descs[];
+};
+
+#endif /* !_JAILHOUSE_DMA_COPY_H */
@@ -50,6 +50,33 @@
 #define JAILHOUSE_HC_CELL_GET_STATE		6
 #define JAILHOUSE_HC_CPU_GET_INFO		7
 #define JAILHOUSE_HC_DEBUG_CONSOLE_PUTC		8
+#define JAILHOUSE_HC_IOMMU_UPDATE_IRTES		9
+#define JAILHOUSE_HC_MEM_POOL_DONATE		10
+#define JAILHOUSE_HC_MEM_POOL_RECLAIM		11
+#define JAILHOUSE_HC_DEBUG_CONSOLE_FLUSH	12
+#define JAILHOUSE_HC_DEBUG_CONSOLE_PUTS		13
+#define JAILHOUSE_HC_CONSOLE_NOTIFY		14
+#define JAILHOUSE_HC_CPU_GET_STATS		15
+#define JAILHOUSE_HC_CELL_GET_MMIO_STATS	16
+#define JAILHOUSE_HC_CELL_CREATE_START		17
+#define JAILHOUSE_HC_MEM_BALLOON		18
+#define JAILHOUSE_HC_CELL_BALLOON_UPDATE	19
+#define JAILHOUSE_HC_GCOV_READ			20
+#define JAILHOUSE_HC_TIMEBASE_UPDATE		21
+#define JAILHOUSE_HC_CELL_WATCHDOG_SET		22
+#define JAILHOUSE_HC_MEM_TRANSFER		23
+#define JAILHOUSE_HC_MULTICALL			24
+#define JAILHOUSE_HC_CELL_CPU_ADD		25
+#define JAILHOUSE_HC_CELL_CPU_REMOVE		26
+
+/* Operations of JAILHOUSE_HC_MEM_BALLOON */
+#define JAILHOUSE_BALLOON_RELEASE		0
+#define JAILHOUSE_BALLOON_RECLAIM		1
+#define JAILHOUSE_BALLOON_QUERY			2
+
+/* Operations of JAILHOUSE_HC_MEM_TRANSFER */
+#define JAILHOUSE_TRANSFER_GIVE			0
+#define JAILHOUSE_TRANSFER_QUERY		1
 
 /* Hypervisor information type */
 #define JAILHOUSE_INFO_MEM_POOL_SIZE		0
@@ -57,10 +84,50 @@
 #define JAILHOUSE_INFO_REMAP_POOL_SIZE		2
 #define JAILHOUSE_INFO_REMAP_POOL_USED		3
 #define JAILHOUSE_INFO_NUM_CELLS		4
+#define JAILHOUSE_INFO_MEM_POOL_FREE_EXTENTS	5
+#define JAILHOUSE_INFO_MEM_POOL_LARGEST_FREE	6
+/* root cell suspension by cell management, in read_timestamp() ticks */
+#define JAILHOUSE_INFO_ROOT_SUSPEND_LAST	7
+#define JAILHOUSE_INFO_ROOT_SUSPEND_MAX		8
+#define JAILHOUSE_INFO_REMAP_POOL_FREE_EXTENTS	9
+#define JAILHOUSE_INFO_REMAP_POOL_LARGEST_FREE	10
+/*
+ * Durations of the hypervisor setup, in read_timestamp() ticks. Phases are
+ * indexed by JAILHOUSE_SETUP_*, units by their initialization order.
+ */
+#define JAILHOUSE_INFO_SETUP_TIME_BASE		100
+#define JAILHOUSE_INFO_UNIT_SETUP_TIME_BASE	200
 
 /* Hypervisor information type */
 #define JAILHOUSE_CPU_INFO_STATE		0
+/* duration of the CPU's setup, in read_timestamp() ticks */
+#define JAILHOUSE_CPU_INFO_SETUP_TIME		1
 #define JAILHOUSE_CPU_INFO_STAT_BASE		1000
+/*
+ * VM exit latency histogram, type = BASE + stat * BUCKETS + bucket.
+ * Bucket n counts exits that took [2^n, 2^(n+1)) timer ticks, the last bucket
+ * also collects all longer ones.
+ */
+#define JAILHOUSE_CPU_INFO_EXIT_LATENCY_BASE	2000
+#define JAILHOUSE_EXIT_LATENCY_BUCKETS		32
+/*
+ * Cache and memory bandwidth monitoring of the cell owning the CPU, type =
+ * BASE + event. Measured in the cache domain of the calling CPU.
+ */
+#define JAILHOUSE_CPU_INFO_QOS_BASE		3000
+/*
+ * Samples of the PMU counters reserved for the hypervisor, type = BASE +
+ * counter. Updated on VM exits, only available with CONFIG_PMU_STATS.
+ */
+#define JAILHOUSE_CPU_INFO_PMU_BASE		4000
+
+/* Setup phases */
+#define JAILHOUSE_SETUP_EARLY			0
+#define JAILHOUSE_SETUP_CPUS			1
+#define JAILHOUSE_SETUP_UNITS			2
+#define JAILHOUSE_SETUP_MEMORY			3
+#define JAILHOUSE_SETUP_COMMIT			4
+#define JAILHOUSE_NUM_SETUP_PHASES		5
 
 /* CPU state */
 #define JAILHOUSE_CPU_RUNNING			0
@@ -71,13 +138,34 @@
 #define JAILHOUSE_CPU_STAT_VMEXITS_MMIO		1
 #define JAILHOUSE_CPU_STAT_VMEXITS_MANAGEMENT	2
 #define JAILHOUSE_CPU_STAT_VMEXITS_HYPERCALL	3
-#define JAILHOUSE_GENERIC_CPU_STATS		4
+#define JAILHOUSE_CPU_STAT_MMIO_CACHE_HITS	4
+#define JAILHOUSE_CPU_STAT_MMIO_CACHE_MISSES	5
+#define JAILHOUSE_CPU_STAT_IRQS_INJECTED	6
+#define JAILHOUSE_CPU_STAT_IPIS_SENT		7
+#define JAILHOUSE_CPU_STAT_IPIS_RECEIVED	8
+#define JAILHOUSE_CPU_STAT_PENDING_OVERFLOWS	9
+#define JAILHOUSE_CPU_STAT_MAX_EXIT_TICKS	10 /* maximum, not a counter */
+#define JAILHOUSE_CPU_STAT_STACK_MAX_USAGE	11 /* in bytes, not a counter */
+#define JAILHOUSE_GENERIC_CPU_STATS		12
+
+/* QoS monitoring events */
+#define JAILHOUSE_QOS_L3_OCCUPANCY		0 /* in KiB */
+#define JAILHOUSE_QOS_MEM_BW_TOTAL		1 /* in KiB, wraps around */
+#define JAILHOUSE_QOS_MEM_BW_LOCAL		2 /* in KiB, wraps around */
+#define JAILHOUSE_NUM_QOS_EVENTS		3
+
+/* PMU counters */
+#define JAILHOUSE_PMU_KCYCLES			0 /* in 1000 CPU cycles */
+#define JAILHOUSE_PMU_KINSTRUCTIONS		1 /* in 1000 instructions */
+#define JAILHOUSE_PMU_LLC_MISSES		2
+#define JAILHOUSE_NUM_PMU_COUNTERS		3
 
 #define JAILHOUSE_MSG_NONE			0
 
 /* messages to cell */
 #define JAILHOUSE_MSG_SHUTDOWN_REQUEST		1
 #define JAILHOUSE_MSG_RECONFIG_COMPLETED	2
+#define JAILHOUSE_MSG_CPU_REMOVE_REQUEST	3
 
 /* replies from cell */
 #define JAILHOUSE_MSG_UNKNOWN			1
@@ -85,6 +173,105 @@
 #define JAILHOUSE_MSG_REQUEST_APPROVED		3
 #define JAILHOUSE_MSG_RECEIVED			4
 
+/**
+ * Range of interrupt remapping table entries the root cell modified, argument
+ * of JAILHOUSE_HC_IOMMU_UPDATE_IRTES.
+ */
+struct jailhouse_irte_update {
+	/** Index of the IOMMU unit in the system configuration. */
+	__u16 iommu;
+	/** Number of modified entries. */
+	__u16 count;
+	/** Index of the first modified entry. */
+	__u32 index;
+} __attribute__((packed));
+
+/**
+ * Operation of a JAILHOUSE_HC_MULTICALL batch. The batch is an array of these
+ * entries that must not cross a page boundary.
+ */
+struct jailhouse_multicall {
+	/** Hypercall code, any except JAILHOUSE_HC_DISABLE and
+	 *  JAILHOUSE_HC_MULTICALL. */
+	__u32 code;
+	__u32 padding;
+	/** First hypercall argument. */
+	__u64 arg1;
+	/** Second hypercall argument. */
+	__u64 arg2;
+	/** Return code of the hypercall, set by the hypervisor. */
+	__s64 result;
+};
+
+/** Size of an MMIO region handler name, including the terminating null. */
+#define JAILHOUSE_MMIO_NAME_SIZE		16
+
+/** Access statistics of an MMIO region emulated by the hypervisor. */
+struct jailhouse_mmio_region_stats {
+	/** Start address of the region in cell address space. */
+	__u64 start;
+	/** Size of the region. */
+	__u64 size;
+	/** Accesses dispatched to the region, summed up over all CPUs. */
+	__u64 accesses;
+	/** Name of the region handler, null-terminated. */
+	char name[JAILHOUSE_MMIO_NAME_SIZE];
+};
+
+/**
+ * MMIO region statistics of a cell, argument of
+ * JAILHOUSE_HC_CELL_GET_MMIO_STATS. Occupies one page.
+ */
+struct jailhouse_mmio_stats {
+	/** Index of the first region to report, set by the caller. */
+	__u32 first;
+	/** Number of reported regions, set by the hypervisor. */
+	__u32 num_regions;
+	/** Reported regions, in ascending address order. */
+	struct jailhouse_mmio_region_stats regions[];
+};
+
+/**
+ * Timebase shared by the hypervisor with all cells that have a
+ * JAILHOUSE_MEM_TIMEBASE region, published by the root cell via
+ * JAILHOUSE_HC_TIMEBASE_UPDATE. It converts the CPU counter (TSC on x86,
+ * virtual counter on ARM) into nanoseconds since the epoch of the root cell's
+ * wall clock:
+ *
+ *   ns = base_ns + (((counter - cycle_last) * mult) >> shift)
+ */
+struct jailhouse_timebase {
+	/** Incremented before and after each update, odd while the timebase
+	 *  is being modified, 0 if none was published yet. Ignored in the
+	 *  argument of JAILHOUSE_HC_TIMEBASE_UPDATE. */
+	volatile __u32 seq;
+	/** Multiplier for counter deltas. */
+	__u32 mult;
+	/** Shift applied after the multiplication, less than 64. */
+	__u32 shift;
+	__u32 padding;
+	/** Counter value at base_ns. */
+	__u64 cycle_last;
+	/** Nanoseconds since the epoch at cycle_last. */
+	__u64 base_ns;
+};
+
+/**
+ * Chunks of a JAILHOUSE_MEM_TRANSFER region to hand over to another cell,
+ * argument of JAILHOUSE_HC_MEM_TRANSFER. Must not cross a page boundary.
+ */
+struct jailhouse_mem_transfer {
+	/** Guest-physical start address of the chunks in the calling cell,
+	 *  aligned to JAILHOUSE_TRANSFER_CHUNK_SIZE. */
+	__u64 address;
+	/** Number of consecutive chunks. */
+	__u32 num_chunks;
+	__u32 padding;
+	/** Name of the receiving cell, null-terminated, sized like
+	 *  jailhouse_cell_desc::name. */
+	char peer[32];
+};
+
 /* cell state, initialized by hypervisor, updated by cell */
 #define JAILHOUSE_CELL_RUNNING			0
 #define JAILHOUSE_CELL_RUNNING_LOCKED		1
@@ -97,10 +284,81 @@
 /* indicates if the dbg putc is automatically used as output channel */
 #define JAILHOUSE_COMM_FLAG_DBG_PUTC_ACTIVE	0x0002
 
+/* indicates if the console ring in the communication page can be flushed */
+#define JAILHOUSE_COMM_FLAG_CONSOLE_RING	0x0004
+
+/* indicates that INIT IPIs complete synchronously, no delays needed (x86) */
+#define JAILHOUSE_COMM_FLAG_SYNC_INIT		0x0008
+
 #define JAILHOUSE_COMM_HAS_DBG_PUTC_PERMITTED(flags) \
 	!!((flags) & JAILHOUSE_COMM_FLAG_DBG_PUTC_PERMITTED)
 #define JAILHOUSE_COMM_HAS_DBG_PUTC_ACTIVE(flags) \
 	!!((flags) & JAILHOUSE_COMM_FLAG_DBG_PUTC_ACTIVE)
+#define JAILHOUSE_COMM_HAS_CONSOLE_RING(flags) \
+	!!((flags) & JAILHOUSE_COMM_FLAG_CONSOLE_RING)
+#define JAILHOUSE_COMM_HAS_SYNC_INIT(flags) \
+	!!((flags) & JAILHOUSE_COMM_FLAG_SYNC_INIT)
+
+/** Offset of the console ring inside the communication page. */
+#define JAILHOUSE_COMM_CONSOLE_OFFSET		0x800
+/** Size of the console ring content, must be a power of two. */
+#define JAILHOUSE_COMM_CONSOLE_SIZE		1024
+
+/**
+ * Console output of a cell, written by the cell without VM exits and passed
+ * on to the hypervisor via JAILHOUSE_HC_DEBUG_CONSOLE_FLUSH.
+ */
+struct jailhouse_comm_console {
+	/** Number of characters written so far. Incremented after the
+	 *  character at content[tail % JAILHOUSE_COMM_CONSOLE_SIZE] has been
+	 *  stored. */
+	volatile __u32 tail;
+	__u32 padding;
+	char content[JAILHOUSE_COMM_CONSOLE_SIZE];
+};
+
+/** Offset of the watchdog counter inside the communication page. */
+#define JAILHOUSE_COMM_WATCHDOG_OFFSET		0xc80
+
+/** Minimum watchdog timeout accepted by JAILHOUSE_HC_CELL_WATCHDOG_SET. */
+#define JAILHOUSE_WATCHDOG_MIN_TIMEOUT_US	100
+
+/**
+ * Watchdog counter of a cell. If the root cell set a timeout via
+ * JAILHOUSE_HC_CELL_WATCHDOG_SET, the cell has to change count at least once
+ * per timeout, otherwise the hypervisor suspends it and marks it failed.
+ */
+struct jailhouse_comm_watchdog {
+	volatile __u32 count;
+};
+
+/** Offset of the transfer notifications inside the communication page. */
+#define JAILHOUSE_COMM_TRANSFER_OFFSET		0xd00
+/** Number of transfer notification slots, must be a power of two. */
+#define JAILHOUSE_COMM_TRANSFER_SLOTS		8
+
+/** Chunks a cell received via JAILHOUSE_HC_MEM_TRANSFER. */
+struct jailhouse_comm_transfer_slot {
+	/** Guest-physical start address of the chunks in the receiving
+	 *  cell. */
+	__u64 address;
+	/** Number of consecutive chunks. */
+	__u32 num_chunks;
+	/** ID of the donating cell. */
+	__u32 donor_id;
+};
+
+/**
+ * Transfer notifications of a cell, written by the hypervisor. Older slots
+ * are overwritten if the cell does not keep up.
+ */
+struct jailhouse_comm_transfer {
+	/** Number of transfers received so far. Incremented after the slot
+	 *  at slots[head % JAILHOUSE_COMM_TRANSFER_SLOTS] has been filled. */
+	volatile __u32 head;
+	__u32 padding;
+	struct jailhouse_comm_transfer_slot slots[JAILHOUSE_COMM_TRANSFER_SLOTS];
+};
 
 #define COMM_REGION_ABI_REVISION		1
 #define COMM_REGION_MAGIC			"JHCOMM"
@@ -123,4 +381,37 @@
 
 #include <asm/jailhouse_hypercall.h>
 
+/*
+ * Revision of struct jailhouse_cpu_stats. Incremented on any layout change.
+ * 1: 32-bit statistic counters, no header (implicit)
+ * 2: header with revision and number of counters, 64-bit counters
+ */
+#define JAILHOUSE_CPU_STATS_REVISION		2
+
+#define JAILHOUSE_CPU_STATS_FIELDS					\
+	/** Layout revision, JAILHOUSE_CPU_STATS_REVISION. */		\
+	__u32 stats_revision;						\
+	/** Number of statistic counters, JAILHOUSE_NUM_CPU_STATS. */	\
+	__u32 num_stats;						\
+	/** Events counted by the hypervisor's PMU counters, indexed by	\
+	 *  JAILHOUSE_PMU_*. Raw event counts, 0 if not sampled. */	\
+	__u64 pmu_stats[JAILHOUSE_NUM_PMU_COUNTERS];			\
+	/** Statistic counters, indexed by JAILHOUSE_CPU_STAT_*. */	\
+	__u64 stats[JAILHOUSE_NUM_CPU_STATS];				\
+	/** VM exit latency histograms, indexed by statistic counter of	\
+	 *  the exit reason and log2 of the exit duration in timer	\
+	 *  ticks. Kept at 32 bits to fit into a page, they may wrap	\
+	 *  around. */							\
+	__u32 exit_latency[JAILHOUSE_NUM_CPU_STATS]			\
+			  [JAILHOUSE_EXIT_LATENCY_BUCKETS];
+
+/**
+ * Statistics of a CPU. The hypervisor maintains them in a page that is
+ * read-only accessible for the root cell, JAILHOUSE_HC_CPU_GET_STATS copies
+ * them into a buffer of the caller.
+ */
+struct jailhouse_cpu_stats {
+	JAILHOUSE_CPU_STATS_FIELDS
+};
+
 #endif /* !_JAILHOUSE_HYPERCALL_H */
@@ -0,0 +1,142 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Measures how much load of other cells disturbs this one. Two histograms are
+ * sampled: the duration of a fixed compute loop that does not touch memory,
+ * and the latency of dependent loads chasing through a working set of the
+ * given size in random order. Running the benchmark with and without
+ * jailhouse-stress in the root cell yields the degradation.
+ *
+ * By default, the working set is taken from the heap, which is small in the
+ * demo cells. "buffer" selects the address of a dedicated RAM region of the
+ * cell instead. Pointing it to a colored and to a non-colored region shows
+ * the effect of cache coloring.
+ */
+
+#include <inmate.h>
+
+#define CACHE_LINE_SIZE		64
+
+struct chase_line {
+	struct chase_line *next;
+	u8 pad[CACHE_LINE_SIZE - sizeof(void *)];
+};
+
+static struct bench_stats stats;
+static volatile unsigned long sink;
+
+static u32 random_next(u32 *state)
+{
+	/* xorshift32, good enough to defeat the prefetchers */
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static struct chase_line *chase_init(struct chase_line *lines,
+				     unsigned long num_lines)
+{
+	struct chase_line *tmp;
+	unsigned long n, k;
+	u32 state = 0x4a48;
+
+	/*
+	 * Sattolo's shuffle of the identity yields a random cyclic
+	 * permutation, i.e. following the links visits every line once.
+	 */
+	for (n = 0; n < num_lines; n++)
+		lines[n].next = &lines[n];
+	for (n = num_lines - 1; n > 0; n--) {
+		k = random_next(&state) % n;
+		tmp = lines[n].next;
+		lines[n].next = lines[k].next;
+		lines[k].next = tmp;
+	}
+
+	return &lines[0];
+}
+
+static void measure_loop(unsigned long samples, unsigned long work)
+{
+	unsigned long n, i, acc;
+	u64 start;
+
+	bench_stats_init(&stats);
+	for (n = 0; n < samples; n++) {
+		acc = n;
+		start = arch_latency_now();
+		for (i = 0; i < work; i++)
+			asm volatile("" : "+r" (acc));
+		bench_stats_add(&stats,
+				arch_latency_to_ns(arch_latency_now() - start));
+		sink = acc;
+	}
+	bench_stats_print("loop-latency", "ns", &stats);
+}
+
+static void measure_memory(struct chase_line *line, unsigned long samples,
+			   unsigned long accesses)
+{
+	unsigned long n, i;
+	u64 start;
+
+	/* warm up, one full round through the working set */
+	for (i = 0; i < accesses; i++)
+		line = line->next;
+
+	bench_stats_init(&stats);
+	for (n = 0; n < samples; n++) {
+		start = arch_latency_now();
+		for (i = 0; i < accesses; i++)
+			line = line->next;
+		bench_stats_add(&stats,
+				div_u64(arch_latency_to_ns(arch_latency_now() -
+							   start), accesses));
+	}
+	sink = (unsigned long)line;
+	bench_stats_print("mem-latency", "ns", &stats);
+}
+
+void inmate_main(void)
+{
+	unsigned long samples = cmdline_parse_int("samples", 10000);
+	unsigned long work = cmdline_parse_int("work", 1000);
+	unsigned long wss = cmdline_parse_int("wss", 16) * 1024;
+	void *buffer = (void *)(unsigned long)cmdline_parse_int("buffer", 0);
+	unsigned long num_lines = wss / CACHE_LINE_SIZE;
+	struct chase_line *first;
+
+	if (samples == 0)
+		samples = 1;
+
+	if (num_lines < 2) {
+		printk("bench=mem-latency error=\"working set too small\"\n");
+		printk("Benchmarks done.\n");
+		halt();
+	}
+
+	if (buffer)
+		map_range(buffer, wss, MAP_CACHED);
+	else
+		buffer = alloc(wss, CACHE_LINE_SIZE);
+
+	arch_latency_init();
+
+	printk("Sampling %lu loops of %lu iterations, working set %lu KiB "
+	       "at %p\n", samples, work, wss / 1024, buffer);
+
+	measure_loop(samples, work);
+
+	first = chase_init(buffer, num_lines);
+	measure_memory(first, samples, num_lines);
+
+	printk("Benchmarks done.\n");
+
+	halt();
+}
@@ -0,0 +1,48 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Samples the latency of a periodic timer interrupt into a histogram and
+ * prints a summary line once the requested number of samples is reached.
+ */
+
+#include <inmate.h>
+#include <gic.h>
+
+static void handle_IRQ(unsigned int irqn)
+{
+	if (irqn == TIMER_IRQ)
+		latency_timer_expired();
+}
+
+void inmate_main(void)
+{
+	unsigned long period_us = cmdline_parse_int("period-us", 1000);
+	unsigned long samples = cmdline_parse_int("samples", 1000000);
+	const struct bench_stats *stats;
+
+	if (period_us == 0)
+		period_us = 1;
+
+	gic_setup(handle_IRQ);
+	gic_enable_irq(TIMER_IRQ);
+
+	printk("Sampling %lu timer interrupts, period %lu us\n", samples,
+	       period_us);
+
+	latency_start(period_us * NS_PER_USEC);
+	stats = latency_get_stats();
+
+	while (stats->samples < samples)
+		asm volatile("wfi" : : : "memory");
+
+	arch_disable_irqs();
+	bench_stats_print("timer-latency", "ns", stats);
+	printk("Benchmarks done.\n");
+
+	halt();
+}
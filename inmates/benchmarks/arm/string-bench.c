@@ -0,0 +1,125 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Compares memcpy, memset and memcmp of the inmate library (LDP/STP based on
+ * ARM64, word-wide on ARM) with plain byte-wise loops. Each operation runs on
+ * aligned buffers of several sizes, memcpy and memcmp also with a source that
+ * is off by one byte. Results are given in timer ticks, one machine-readable
+ * line per benchmark.
+ */
+
+#include <inmate.h>
+
+#define MAX_SIZE		8192
+
+static struct bench_stats stats;
+static u8 src_buf[MAX_SIZE + 8] __attribute__((aligned(64)));
+static u8 dst_buf[MAX_SIZE + 8] __attribute__((aligned(64)));
+static volatile int cmp_result;
+
+/* the references must not be turned into library calls by the compiler */
+#define REFERENCE \
+	__attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+
+static void REFERENCE byte_memcpy(unsigned long size, unsigned int offset)
+{
+	const u8 *s = src_buf + offset;
+	u8 *d = dst_buf;
+
+	while (size-- > 0)
+		*d++ = *s++;
+}
+
+static void REFERENCE byte_memset(unsigned long size, unsigned int offset)
+{
+	u8 *p = dst_buf;
+
+	while (size-- > 0)
+		*p++ = offset;
+}
+
+static void REFERENCE byte_memcmp(unsigned long size, unsigned int offset)
+{
+	const u8 *s1 = dst_buf, *s2 = src_buf + offset;
+	int result = 0;
+
+	while (size-- > 0)
+		if (*s1++ != *s2++) {
+			result = s1[-1] < s2[-1] ? -1 : 1;
+			break;
+		}
+	cmp_result = result;
+}
+
+static void lib_memcpy(unsigned long size, unsigned int offset)
+{
+	memcpy(dst_buf, src_buf + offset, size);
+}
+
+static void lib_memset(unsigned long size, unsigned int offset)
+{
+	memset(dst_buf, offset, size);
+}
+
+static void lib_memcmp(unsigned long size, unsigned int offset)
+{
+	cmp_result = memcmp(dst_buf, src_buf + offset, size);
+}
+
+static void benchmark(const char *name,
+		      void (*func)(unsigned long size, unsigned int offset),
+		      unsigned long size, unsigned int offset,
+		      unsigned long loops)
+{
+	unsigned long n;
+	u64 start;
+
+	/* memcmp has to compare all bytes */
+	memset(src_buf, 0, sizeof(src_buf));
+	memset(dst_buf, 0, sizeof(dst_buf));
+
+	bench_stats_init(&stats);
+	for (n = 0; n < loops; n++) {
+		start = timer_get_ticks();
+		func(size, offset);
+		bench_stats_add(&stats, timer_get_ticks() - start);
+	}
+	printk("size=%lu offset=%u ", size, offset);
+	bench_stats_print(name, "ticks", &stats);
+}
+
+void inmate_main(void)
+{
+	static const unsigned long sizes[] = { 64, 512, 4096, MAX_SIZE };
+	unsigned long loops = cmdline_parse_int("loops", 1000);
+	unsigned int n, offset;
+
+	if (loops == 0)
+		loops = 1;
+
+	printk("\nString functions, %lu loops, %lu ticks/s:\n", loops,
+	       timer_get_frequency());
+
+	for (n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+		for (offset = 0; offset < 2; offset++) {
+			benchmark("memcpy-byte", byte_memcpy, sizes[n], offset,
+				  loops);
+			benchmark("memcpy-lib", lib_memcpy, sizes[n], offset,
+				  loops);
+			benchmark("memcmp-byte", byte_memcmp, sizes[n], offset,
+				  loops);
+			benchmark("memcmp-lib", lib_memcmp, sizes[n], offset,
+				  loops);
+		}
+		benchmark("memset-byte", byte_memset, sizes[n], 0, loops);
+		benchmark("memset-lib", lib_memset, sizes[n], 0, loops);
+	}
+
+	printk("Benchmarks done.\n");
+	halt();
+}
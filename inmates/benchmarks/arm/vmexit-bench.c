@@ -0,0 +1,180 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Measures the round-trip cost of VM exits: the hypercall path, MMIO exits
+ * dispatched by mmio_handle_access (GIC distributor) and a self-SGI, injected
+ * via the emulated GICD_SGIR on GICv2 and via a trapped ICC_SGI1R write on
+ * GICv3. Results are given in ticks of the physical counter, one
+ * machine-readable line per benchmark.
+ *
+ * With "testdev" on the command line, the MMIO round trip to the hypervisor's
+ * test device is split into its phases: entry until the hypervisor took the
+ * exit, dispatch until the device handler ran and the return to the cell.
+ * "testdev-inject" is the time from injecting the SGI via the device until
+ * its handler in the cell runs. The device registers are read as 32-bit
+ * values, which is sufficient for the deltas.
+ */
+
+#include <inmate.h>
+#include <gic.h>
+
+#define GICD_CTLR		0x0000
+#define GICD_SGIR		0x0f00
+#define  GICD_SGIR_TO_SELF	(2 << 24)
+
+#define ICC_SGIR_AFF1_SHIFT	16
+#define ICC_SGIR_IRQN_SHIFT	24
+#define ICC_SGIR_AFF2_SHIFT	32
+
+#define BENCH_SGI		1
+
+#define TESTDEV_BASE		(COMM_REGION_BASE + PAGE_SIZE)
+#define TESTDEV_TIMESTAMP	0x08
+#define TESTDEV_EXIT_TIME	0x10
+#define TESTDEV_IRQ_TRIGGER	0x20
+#define TESTDEV_IRQ_TIME	0x28
+
+static struct bench_stats stats;
+static void *gicd_base;
+static struct bench_stats phase_stats[4];
+static volatile unsigned int sgi_count;
+static volatile u32 sgi_ticks;
+static unsigned long long self_sgir;
+
+static void handle_IRQ(unsigned int irqn)
+{
+	if (irqn == BENCH_SGI) {
+		sgi_ticks = timer_get_ticks();
+		sgi_count++;
+	}
+}
+
+static void exit_hypercall(void)
+{
+	jailhouse_call_arg1(JAILHOUSE_HC_HYPERVISOR_GET_INFO,
+			    JAILHOUSE_INFO_MEM_POOL_SIZE);
+}
+
+static void exit_mmio_read(void)
+{
+	mmio_read32(gicd_base + GICD_CTLR);
+}
+
+static void exit_self_sgi(void)
+{
+	unsigned int count = sgi_count;
+
+	mmio_write32(gicd_base + GICD_SGIR, GICD_SGIR_TO_SELF | BENCH_SGI);
+	while (sgi_count == count)
+		cpu_relax();
+}
+
+static void exit_gicv3_self_sgi(void)
+{
+	unsigned int count = sgi_count;
+
+	arm_write_sysreg(ICC_SGI1R_EL1, self_sgir);
+	while (sgi_count == count)
+		cpu_relax();
+}
+
+static unsigned long long sgir_to_self(void)
+{
+	unsigned long mpidr;
+
+	arm_read_sysreg(MPIDR, mpidr);
+	return (1ULL << (MPIDR_AFFINITY_LEVEL(mpidr, 0) & 0xf)) |
+		((unsigned long long)MPIDR_AFFINITY_LEVEL(mpidr, 1) <<
+		 ICC_SGIR_AFF1_SHIFT) |
+		((unsigned long long)MPIDR_AFFINITY_LEVEL(mpidr, 2) <<
+		 ICC_SGIR_AFF2_SHIFT) |
+		((unsigned long long)BENCH_SGI << ICC_SGIR_IRQN_SHIFT);
+}
+
+static void benchmark_testdev(unsigned long loops)
+{
+	void *testdev = (void *)TESTDEV_BASE;
+	u32 start, exit, handler, end;
+	unsigned int count, n;
+	unsigned long loop;
+
+	map_range(testdev, PAGE_SIZE, MAP_UNCACHED);
+
+	for (n = 0; n < 4; n++)
+		bench_stats_init(&phase_stats[n]);
+
+	for (loop = 0; loop < loops; loop++) {
+		start = timer_get_ticks();
+		handler = mmio_read32(testdev + TESTDEV_TIMESTAMP);
+		end = timer_get_ticks();
+		exit = mmio_read32(testdev + TESTDEV_EXIT_TIME);
+
+		bench_stats_add(&phase_stats[0], exit - start);
+		bench_stats_add(&phase_stats[1], handler - exit);
+		bench_stats_add(&phase_stats[2], end - handler);
+
+		count = sgi_count;
+		mmio_write32(testdev + TESTDEV_IRQ_TRIGGER, BENCH_SGI);
+		while (sgi_count == count)
+			cpu_relax();
+		bench_stats_add(&phase_stats[3], sgi_ticks -
+				mmio_read32(testdev + TESTDEV_IRQ_TIME));
+	}
+
+	bench_stats_print("testdev-entry", "ticks", &phase_stats[0]);
+	bench_stats_print("testdev-dispatch", "ticks", &phase_stats[1]);
+	bench_stats_print("testdev-return", "ticks", &phase_stats[2]);
+	bench_stats_print("testdev-inject", "ticks", &phase_stats[3]);
+}
+
+static void benchmark(const char *name, void (*exit_func)(void),
+		      unsigned long loops)
+{
+	unsigned long n;
+	u64 start;
+
+	bench_stats_init(&stats);
+	for (n = 0; n < loops; n++) {
+		start = timer_get_ticks();
+		exit_func();
+		bench_stats_add(&stats, timer_get_ticks() - start);
+	}
+	bench_stats_print(name, "ticks", &stats);
+}
+
+void inmate_main(void)
+{
+	unsigned long loops = cmdline_parse_int("loops", 100000);
+	bool testdev = cmdline_parse_bool("testdev", false);
+
+	if (loops == 0)
+		loops = 1;
+
+	gicd_base = (void *)(unsigned long)comm_region->gicd_base;
+	gic_setup(handle_IRQ);
+	gic_enable_irq(BENCH_SGI);
+
+	printk("\nVM exit round trips, %lu loops, %lu ticks/s:\n", loops,
+	       timer_get_frequency());
+
+	benchmark("hypercall", exit_hypercall, loops);
+	benchmark("mmio-read", exit_mmio_read, loops);
+
+	if (comm_region->gic_version == 2) {
+		benchmark("gicv2-self-sgi", exit_self_sgi, loops);
+	} else {
+		self_sgir = sgir_to_self();
+		benchmark("gicv3-self-sgi", exit_gicv3_self_sgi, loops);
+	}
+
+	if (testdev)
+		benchmark_testdev(loops);
+
+	printk("Benchmarks done.\n");
+	halt();
+}
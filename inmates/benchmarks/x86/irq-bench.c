@@ -0,0 +1,156 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Compares the generic interrupt dispatch of int_set_handler with handlers
+ * installed directly into the IDT via int_set_fast_handler. Software
+ * interrupts measure the bare entry and exit path, x2APIC self-IPIs add the
+ * delivery via the APIC. The deferred variant only queues the handler work
+ * and runs it from the main loop. Entry latency and round trip are given in
+ * TSC cycles, one machine-readable line per benchmark.
+ */
+
+#include <inmate.h>
+
+#define GENERIC_VECTOR		40
+#define FAST_VECTOR		41
+#define DEFERRED_VECTOR		42
+
+static struct bench_stats entry_stats, round_trip_stats;
+static struct defer_queue defer_queue;
+static volatile unsigned int irq_count;
+static volatile u64 entry_tsc;
+
+static inline u64 rdtsc(void)
+{
+	u32 lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (u64)lo | (((u64)hi) << 32);
+}
+
+static void generic_handler(void)
+{
+	entry_tsc = rdtsc();
+	irq_count++;
+}
+
+static DEFINE_FAST_INT_HANDLER(fast_handler)
+{
+	entry_tsc = rdtsc();
+	irq_count++;
+	int_eoi();
+}
+
+static void count_irq(void *arg)
+{
+	irq_count++;
+}
+
+static DEFINE_FAST_INT_HANDLER(deferred_handler)
+{
+	entry_tsc = rdtsc();
+	defer_work(&defer_queue, count_irq, NULL);
+	int_eoi();
+}
+
+static void soft_int_generic(void)
+{
+	asm volatile("int %0" : : "i" (GENERIC_VECTOR) : "memory");
+}
+
+static void soft_int_fast(void)
+{
+	asm volatile("int %0" : : "i" (FAST_VECTOR) : "memory");
+}
+
+static void soft_int_deferred(void)
+{
+	asm volatile("int %0" : : "i" (DEFERRED_VECTOR) : "memory");
+	defer_queue_run(&defer_queue, 1);
+}
+
+static void wait_for_irq(unsigned int count)
+{
+	while (irq_count == count)
+		defer_queue_run(&defer_queue, 1);
+}
+
+static void ipi_generic(void)
+{
+	unsigned int count = irq_count;
+
+	int_send_ipi(cpu_id(), GENERIC_VECTOR);
+	wait_for_irq(count);
+}
+
+static void ipi_fast(void)
+{
+	unsigned int count = irq_count;
+
+	int_send_ipi(cpu_id(), FAST_VECTOR);
+	wait_for_irq(count);
+}
+
+static void ipi_deferred(void)
+{
+	unsigned int count = irq_count;
+
+	int_send_ipi(cpu_id(), DEFERRED_VECTOR);
+	wait_for_irq(count);
+}
+
+static void benchmark(const char *name, void (*trigger)(void),
+		      unsigned long loops)
+{
+	char entry_name[32];
+	unsigned long n;
+	u64 start, end;
+
+	bench_stats_init(&entry_stats);
+	bench_stats_init(&round_trip_stats);
+	for (n = 0; n < loops; n++) {
+		start = rdtsc();
+		trigger();
+		end = rdtsc();
+		bench_stats_add(&entry_stats, entry_tsc - start);
+		bench_stats_add(&round_trip_stats, end - start);
+	}
+
+	memcpy(entry_name, name, strlen(name));
+	memcpy(entry_name + strlen(name), "-entry", sizeof("-entry"));
+	bench_stats_print(entry_name, "cycles", &entry_stats);
+	bench_stats_print(name, "cycles", &round_trip_stats);
+}
+
+void inmate_main(void)
+{
+	unsigned long loops = cmdline_parse_int("loops", 100000);
+
+	if (loops == 0)
+		loops = 1;
+
+	int_init();
+	int_set_handler(GENERIC_VECTOR, generic_handler);
+	int_set_fast_handler(FAST_VECTOR, fast_handler);
+	int_set_fast_handler(DEFERRED_VECTOR, deferred_handler);
+	defer_queue_init(&defer_queue);
+
+	asm volatile("sti");
+
+	printk("\nInterrupt dispatch, %lu loops, TSC cycles:\n", loops);
+
+	benchmark("soft-int-generic", soft_int_generic, loops);
+	benchmark("soft-int-fast", soft_int_fast, loops);
+	benchmark("soft-int-deferred", soft_int_deferred, loops);
+	benchmark("self-ipi-generic", ipi_generic, loops);
+	benchmark("self-ipi-fast", ipi_fast, loops);
+	benchmark("self-ipi-deferred", ipi_deferred, loops);
+
+	printk("Benchmarks done.\n");
+	halt();
+}
@@ -0,0 +1,104 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Samples the latency of a periodic APIC timer interrupt into a histogram.
+ * Nothing is printed per sample. Instead, the histogram is exported to the
+ * shared memory of the first ivshmem device, if available, in the layout of
+ * struct bench_export, so that the root cell can pick it up at any time. A
+ * summary line is printed when the requested number of samples is reached.
+ */
+
+#include <inmate.h>
+
+#define VENDORID		0x1af4
+#define DEVICEID		0x1110
+
+#define IVSHMEM_CFG_SHMEM_PTR	0x40
+#define IVSHMEM_CFG_SHMEM_SZ	0x48
+
+#define APIC_TIMER_VECTOR	32
+
+static struct bench_export *export;
+
+static u64 pci_cfg_read64(u16 bdf, unsigned int addr)
+{
+	return ((u64)pci_read_config(bdf, addr + 4, 4) << 32) |
+		pci_read_config(bdf, addr, 4);
+}
+
+static struct bench_export *map_export_region(void)
+{
+	void *shmem;
+	u64 shmem_sz;
+	int bdf;
+
+	bdf = pci_find_device(VENDORID, DEVICEID, 0);
+	if (bdf < 0)
+		return NULL;
+
+	shmem_sz = pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_SZ);
+	shmem = (void *)pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_PTR);
+	if (shmem_sz < sizeof(struct bench_export)) {
+		printk("IVSHMEM: region too small for export\n");
+		return NULL;
+	}
+
+	map_range(shmem, sizeof(struct bench_export), MAP_UNCACHED);
+	memset(shmem, 0, sizeof(struct bench_export));
+
+	return shmem;
+}
+
+void inmate_main(void)
+{
+	unsigned long period_us = cmdline_parse_int("period-us", 1000);
+	unsigned long samples = cmdline_parse_int("samples", 1000000);
+	unsigned long interval = cmdline_parse_int("export-interval", 10000);
+	const struct bench_stats *stats;
+	unsigned long exported = 0;
+
+	if (period_us == 0)
+		period_us = 1;
+	if (interval == 0)
+		interval = 1;
+
+	export = map_export_region();
+	if (export)
+		printk("Exporting histogram via ivshmem at %p\n", export);
+
+	int_init();
+	int_set_handler(APIC_TIMER_VECTOR, latency_timer_expired);
+	apic_timer_init(APIC_TIMER_VECTOR);
+
+	printk("Sampling %lu timer interrupts, period %lu us\n", samples,
+	       period_us);
+
+	latency_start(period_us * NS_PER_USEC);
+	stats = latency_get_stats();
+
+	asm volatile("sti");
+	while (stats->samples < samples) {
+		asm volatile("hlt" : : : "memory");
+
+		if (export && stats->samples - exported >= interval) {
+			asm volatile("cli");
+			bench_stats_export(export, "timer-latency", "ns",
+					   stats);
+			exported = stats->samples;
+			asm volatile("sti");
+		}
+	}
+	asm volatile("cli");
+
+	if (export)
+		bench_stats_export(export, "timer-latency", "ns", stats);
+	bench_stats_print("timer-latency", "ns", stats);
+	printk("Benchmarks done.\n");
+
+	halt();
+}
@@ -0,0 +1,280 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Measures the round-trip cost of VM exits and cross-cell signaling: the
+ * hypercall path, PIO exits handled via fast paths (PCI config space) and via
+ * the generic path (CPUID), MMIO exits dispatched by mmio_handle_access, an
+ * x2APIC self-IPI and, if an ivshmem device is available, a doorbell round
+ * trip to a peer cell. Results are given in TSC cycles, one machine-readable
+ * line per benchmark.
+ *
+ * The difference between "cpuid-page-touch" and "cpuid" plus "page-touch"
+ * is the cost of refilling TLB entries lost on an exit, i.e. when VPIDs are
+ * not used.
+ *
+ * The peer cell runs the same inmate with "echo" on its command line. It
+ * rings the doorbell back for every interrupt it receives.
+ *
+ * With "testdev" on the command line, the MMIO round trip to the hypervisor's
+ * test device is split into its phases: entry until the hypervisor took the
+ * exit, dispatch until the device handler ran and the return to the cell.
+ * "testdev-inject" is the time from injecting an interrupt via the device
+ * until its handler in the cell runs.
+ */
+
+#include <inmate.h>
+
+#define PCI_REG_ADDR_PORT	0xcf8
+
+#define IPI_VECTOR		40
+#define IVSHMEM_VECTOR		41
+#define TESTDEV_VECTOR		42
+
+#define TESTDEV_BASE		(COMM_REGION_BASE + PAGE_SIZE)
+#define TESTDEV_TIMESTAMP	0x08
+#define TESTDEV_EXIT_TIME	0x10
+#define TESTDEV_IRQ_TRIGGER	0x20
+#define TESTDEV_IRQ_TIME	0x28
+
+#define DOORBELL_TIMEOUT	100000000ULL
+
+#define TOUCH_PAGES		32
+
+static struct bench_stats stats;
+static struct ivshmem_device ivshmem;
+static struct bench_stats phase_stats[4];
+static volatile unsigned int ipi_count, doorbell_count, testdev_irq_count;
+static volatile u64 testdev_irq_tsc;
+static volatile u8 touch_area[TOUCH_PAGES * PAGE_SIZE]
+	__attribute__((aligned(PAGE_SIZE)));
+
+static inline u64 rdtsc(void)
+{
+	u32 lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (u64)lo | (((u64)hi) << 32);
+}
+
+static void doorbell_handler(void)
+{
+	doorbell_count++;
+}
+
+static void echo_handler(void)
+{
+	mmio_write32(ivshmem.registers + IVSHMEM_REG_DBELL, 1);
+}
+
+static bool ivshmem_setup(void)
+{
+	if (ivshmem_pci_init(&ivshmem, 0, IVSHMEM_VECTOR) < 0)
+		return false;
+
+	int_set_handler(IVSHMEM_VECTOR, doorbell_handler);
+	return true;
+}
+
+static void exit_hypercall(void)
+{
+	jailhouse_call_arg1(JAILHOUSE_HC_HYPERVISOR_GET_INFO,
+			    JAILHOUSE_INFO_MEM_POOL_SIZE);
+}
+
+static void exit_cpuid(void)
+{
+	unsigned int eax = 0, ebx, ecx = 0, edx;
+
+	asm volatile("cpuid"
+		: "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx)
+		: : "memory");
+}
+
+static void touch_pages(void)
+{
+	unsigned int n;
+
+	for (n = 0; n < TOUCH_PAGES; n++)
+		touch_area[n * PAGE_SIZE]++;
+}
+
+static void exit_cpuid_touch_pages(void)
+{
+	exit_cpuid();
+	touch_pages();
+}
+
+static void exit_pio_read(void)
+{
+	inl(PCI_REG_ADDR_PORT);
+}
+
+static void exit_pio_write(void)
+{
+	outl(0, PCI_REG_ADDR_PORT);
+}
+
+static void exit_mmio_read(void)
+{
+	mmio_read32(ivshmem.registers + IVSHMEM_REG_IVPOS);
+}
+
+static void ipi_handler(void)
+{
+	ipi_count++;
+}
+
+static void exit_self_ipi(void)
+{
+	unsigned int count = ipi_count;
+
+	int_send_ipi(cpu_id(), IPI_VECTOR);
+	while (ipi_count == count)
+		cpu_relax();
+}
+
+static bool doorbell_round_trip(void)
+{
+	unsigned int count = doorbell_count;
+	u64 deadline = rdtsc() + DOORBELL_TIMEOUT;
+
+	mmio_write32(ivshmem.registers + IVSHMEM_REG_DBELL, 1);
+	while (doorbell_count == count)
+		if (rdtsc() > deadline)
+			return false;
+	return true;
+}
+
+static void testdev_irq_handler(void)
+{
+	testdev_irq_tsc = rdtsc();
+	testdev_irq_count++;
+}
+
+static void benchmark_testdev(unsigned long loops)
+{
+	void *testdev = (void *)TESTDEV_BASE;
+	u64 start, exit, handler, end;
+	unsigned int count, n;
+	unsigned long loop;
+
+	for (n = 0; n < 4; n++)
+		bench_stats_init(&phase_stats[n]);
+
+	for (loop = 0; loop < loops; loop++) {
+		start = rdtsc();
+		handler = mmio_read64(testdev + TESTDEV_TIMESTAMP);
+		end = rdtsc();
+		exit = mmio_read64(testdev + TESTDEV_EXIT_TIME);
+
+		bench_stats_add(&phase_stats[0], exit - start);
+		bench_stats_add(&phase_stats[1], handler - exit);
+		bench_stats_add(&phase_stats[2], end - handler);
+
+		count = testdev_irq_count;
+		mmio_write64(testdev + TESTDEV_IRQ_TRIGGER, TESTDEV_VECTOR);
+		while (testdev_irq_count == count)
+			cpu_relax();
+		bench_stats_add(&phase_stats[3], testdev_irq_tsc -
+				mmio_read64(testdev + TESTDEV_IRQ_TIME));
+	}
+
+	bench_stats_print("testdev-entry", "cycles", &phase_stats[0]);
+	bench_stats_print("testdev-dispatch", "cycles", &phase_stats[1]);
+	bench_stats_print("testdev-return", "cycles", &phase_stats[2]);
+	bench_stats_print("testdev-inject", "cycles", &phase_stats[3]);
+}
+
+static void benchmark(const char *name, void (*exit_func)(void),
+		      unsigned long loops)
+{
+	unsigned long n;
+	u64 start;
+
+	bench_stats_init(&stats);
+	for (n = 0; n < loops; n++) {
+		start = rdtsc();
+		exit_func();
+		bench_stats_add(&stats, rdtsc() - start);
+	}
+	bench_stats_print(name, "cycles", &stats);
+}
+
+static void benchmark_doorbell(unsigned long loops)
+{
+	unsigned long n;
+	u64 start;
+
+	bench_stats_init(&stats);
+	for (n = 0; n < loops; n++) {
+		start = rdtsc();
+		if (!doorbell_round_trip()) {
+			printk("bench=ivshmem-doorbell error=\"no reply from "
+			       "peer\"\n");
+			return;
+		}
+		bench_stats_add(&stats, rdtsc() - start);
+	}
+	bench_stats_print("ivshmem-doorbell", "cycles", &stats);
+}
+
+void inmate_main(void)
+{
+	unsigned long loops = cmdline_parse_int("loops", 100000);
+	bool echo = cmdline_parse_bool("echo", false);
+	bool testdev = cmdline_parse_bool("testdev", false);
+	bool has_ivshmem;
+
+	if (loops == 0)
+		loops = 1;
+
+	int_init();
+	hypercall_init();
+	int_set_handler(IPI_VECTOR, ipi_handler);
+	int_set_handler(TESTDEV_VECTOR, testdev_irq_handler);
+
+	has_ivshmem = ivshmem_setup();
+
+	if (echo) {
+		if (!has_ivshmem) {
+			printk("No ivshmem device found, nothing to echo.\n");
+			halt();
+		}
+		int_set_handler(IVSHMEM_VECTOR, echo_handler);
+		printk("Echoing ivshmem doorbells.\n");
+		asm volatile("sti");
+		while (1)
+			asm volatile("hlt");
+	}
+
+	asm volatile("sti");
+
+	printk("\nVM exit round trips, %lu loops, TSC cycles:\n", loops);
+
+	benchmark("hypercall", exit_hypercall, loops);
+	benchmark("cpuid", exit_cpuid, loops);
+	benchmark("page-touch", touch_pages, loops);
+	benchmark("cpuid-page-touch", exit_cpuid_touch_pages, loops);
+	benchmark("pio-read", exit_pio_read, loops);
+	benchmark("pio-write", exit_pio_write, loops);
+	benchmark("x2apic-self-ipi", exit_self_ipi, loops);
+
+	if (has_ivshmem) {
+		benchmark("mmio-read", exit_mmio_read, loops);
+		benchmark_doorbell(loops);
+	} else {
+		printk("No ivshmem device found, skipping MMIO and doorbell "
+		       "benchmarks.\n");
+	}
+
+	if (testdev)
+		benchmark_testdev(loops);
+
+	printk("Benchmarks done.\n");
+	halt();
+}
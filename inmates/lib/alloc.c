@@ -38,12 +38,196 @@
 
 #include <inmate.h>
 
+/*
+ * Besides the bump allocator alloc(), which is meant for memory that is never
+ * returned (e.g. page tables), a heap with malloc()/free() is provided. It
+ * uses segregated free lists with one list per power-of-two size class, so
+ * both operations run in constant time. Blocks are carved from the bump
+ * allocator on demand and are never merged or returned to it.
+ *
+ * On SMP inmates, each CPU keeps a small cache of free blocks per class that
+ * is accessed without locking. Only cache misses and overflows take the
+ * global heap lock. The heap must not be used from interrupt handlers.
+ */
+
+#define HEAP_MIN_ORDER		4
+#define HEAP_MAX_ORDER		20
+#define HEAP_ORDERS		(HEAP_MAX_ORDER - HEAP_MIN_ORDER + 1)
+#define HEAP_CACHE_DEPTH	8
+
+#define POOL_END		((unsigned int)-1)
+
+struct heap_block {
+	struct heap_block *next;
+	unsigned long order;
+} __attribute__((aligned(16)));
+
+struct heap_list {
+	struct heap_block *first;
+	unsigned int count;
+};
+
+#ifdef SMP_MAX_CPUS
+#define HEAP_CPUS		SMP_MAX_CPUS
+#define heap_cpu()		smp_processor_id()
+
+/*
+ * Secondary CPUs only run inmate code once started by the primary, so
+ * locking is not needed before that. This also keeps atomics away from the
+ * early setup where the MMU may still be off.
+ */
+static inline void lock(u8 *lock)
+{
+	if (smp_num_cpus < 2)
+		return;
+	while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE))
+		cpu_relax();
+}
+
+static inline void unlock(u8 *lock)
+{
+	__atomic_clear(lock, __ATOMIC_RELEASE);
+}
+#else
+/* Only a single CPU, and atomics may not work before the MMU is on. */
+#define HEAP_CPUS		1
+#define heap_cpu()		0
+
+static inline void lock(u8 *lock) {}
+static inline void unlock(u8 *lock) {}
+#endif
+
 static unsigned long heap_pos = (unsigned long)stack_top;
+static u8 heap_lock;
+static struct heap_list heap_free[HEAP_ORDERS];
+static struct heap_list heap_cache[HEAP_CPUS][HEAP_ORDERS];
 
-void *alloc(unsigned long size, unsigned long align)
+static void *__alloc(unsigned long size, unsigned long align)
 {
 	unsigned long base = (heap_pos + align - 1) & ~(align - 1);
 
 	heap_pos = base + size;
 	return (void *)base;
 }
+
+void *alloc(unsigned long size, unsigned long align)
+{
+	void *ptr;
+
+	lock(&heap_lock);
+	ptr = __alloc(size, align);
+	unlock(&heap_lock);
+
+	return ptr;
+}
+
+static inline struct heap_block *list_pop(struct heap_list *list)
+{
+	struct heap_block *block = list->first;
+
+	if (block) {
+		list->first = block->next;
+		list->count--;
+	}
+	return block;
+}
+
+static inline void list_push(struct heap_list *list, struct heap_block *block)
+{
+	block->next = list->first;
+	list->first = block;
+	list->count++;
+}
+
+static struct heap_list *cpu_cache(void)
+{
+	unsigned int cpu = heap_cpu();
+
+	/* CPUs beyond the array just skip the cache */
+	return cpu < HEAP_CPUS ? heap_cache[cpu] : NULL;
+}
+
+void *malloc(unsigned long size)
+{
+	struct heap_list *cache = cpu_cache();
+	struct heap_block *block = NULL;
+	unsigned long order = HEAP_MIN_ORDER;
+
+	while ((1UL << order) - sizeof(struct heap_block) < size) {
+		if (++order > HEAP_MAX_ORDER)
+			return NULL;
+	}
+
+	if (cache)
+		block = list_pop(&cache[order - HEAP_MIN_ORDER]);
+	if (!block) {
+		lock(&heap_lock);
+		block = list_pop(&heap_free[order - HEAP_MIN_ORDER]);
+		if (!block) {
+			block = __alloc(1UL << order, sizeof(struct heap_block));
+			block->order = order;
+		}
+		unlock(&heap_lock);
+	}
+
+	return block + 1;
+}
+
+void free(void *ptr)
+{
+	struct heap_list *cache = cpu_cache();
+	struct heap_block *block = (struct heap_block *)ptr - 1;
+	unsigned int index;
+
+	if (!ptr)
+		return;
+
+	index = block->order - HEAP_MIN_ORDER;
+	if (cache && cache[index].count < HEAP_CACHE_DEPTH) {
+		list_push(&cache[index], block);
+	} else {
+		lock(&heap_lock);
+		list_push(&heap_free[index], block);
+		unlock(&heap_lock);
+	}
+}
+
+void pool_init(struct pool *pool, void *base, unsigned long obj_size,
+	       unsigned int num_objs)
+{
+	unsigned int n;
+
+	pool->base = base;
+	pool->obj_size = obj_size;
+	pool->num_objs = num_objs;
+	pool->lock = 0;
+	pool->next_free = alloc(num_objs * sizeof(unsigned int),
+				sizeof(unsigned int));
+
+	for (n = 0; n < num_objs; n++)
+		pool->next_free[n] = n + 1 < num_objs ? n + 1 : POOL_END;
+	pool->first_free = num_objs > 0 ? 0 : POOL_END;
+}
+
+void *pool_get(struct pool *pool)
+{
+	unsigned int index;
+
+	lock(&pool->lock);
+	index = pool->first_free;
+	if (index != POOL_END)
+		pool->first_free = pool->next_free[index];
+	unlock(&pool->lock);
+
+	return index != POOL_END ? pool_object(pool, index) : NULL;
+}
+
+void pool_put(struct pool *pool, void *obj)
+{
+	unsigned int index = pool_index(pool, obj);
+
+	lock(&pool->lock);
+	pool->next_free[index] = pool->first_free;
+	pool->first_free = index;
+	unlock(&pool->lock);
+}
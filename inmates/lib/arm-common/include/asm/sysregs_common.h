@@ -38,6 +38,8 @@
 
 #define HUGE_PAGE_SIZE		(2 * 1024 * 1024ULL)
 #define HUGE_PAGE_MASK		(~(HUGE_PAGE_SIZE - 1))
+#define GIGA_PAGE_SIZE		(1024 * 1024 * 1024ULL)
+#define GIGA_PAGE_MASK		(~(GIGA_PAGE_SIZE - 1))
 
 #define ICC_IAR1_EL1		SYSREG_32(0, c12, c12, 0)
 #define ICC_EOIR1_EL1		SYSREG_32(0, c12, c12, 1)
@@ -51,11 +53,14 @@
 #define MAIR_ATTR(__n, __attr)	((__attr) << MAIR_ATTR_SHIFT(__n))
 #define MAIR_ATTR_WBRWA		0xff
 #define MAIR_ATTR_DEVICE	0x00    /* nGnRnE */
+#define MAIR_ATTR_NC		0x44    /* normal, non-cacheable */
 
 /* Common definitions for page table structure in long descriptor format */
 #define LONG_DESC_BLOCK 0x1
 #define LONG_DESC_TABLE 0x3
 
+#define LATTR_XN		(1ULL << 54)
+#define LATTR_PXN		(1ULL << 53)
 #define LATTR_CONT		(1 << 12)
 #define LATTR_AF		(1 << 10)
 #define LATTR_INNER_SHAREABLE	(3 << 8)
@@ -102,9 +102,11 @@ void gic_enable_irq(unsigned int irq);
 unsigned long timer_get_frequency(void);
 u64 timer_get_ticks(void);
 u64 timer_ticks_to_ns(u64 ticks);
+u64 timer_ns_to_ticks(u64 ns);
 void timer_start(u64 timeout);
 
 void arch_mmu_enable(void);
+void arch_mmu_cpu_enable(void);
 
 #include <asm/processor.h>
 #include <arch/inmate.h>
@@ -39,45 +39,73 @@
 #include <inmate.h>
 #include <asm/sysregs.h>
 
-static u64 __attribute__((aligned(4096))) page_directory[4];
+/* ARMv7 only uses the first 4 entries, ARMv8 up to 512 (39-bit VA) */
+static u64 __attribute__((aligned(4096))) page_directory[PAGE_SIZE / 8];
 
-void map_range(void *start, unsigned long size, enum map_type map_type)
+static u64 *get_pmd(unsigned int pgd_index)
 {
-	u64 vaddr, pmd_entry;
-	unsigned pgd_index;
+	u64 pgd_entry = page_directory[pgd_index];
+	unsigned int n;
 	u64 *pmd;
 
-	vaddr = (unsigned long)start;
+	if ((pgd_entry & LONG_DESC_TABLE) == LONG_DESC_TABLE)
+		return (u64 *)(unsigned long)(pgd_entry & ~LONG_DESC_TABLE);
+
+	pmd = alloc(PAGE_SIZE, PAGE_SIZE);
+	if (pgd_entry & LONG_DESC_BLOCK) {
+		/* split a 1G block up into 2M blocks with the same attributes */
+		for (n = 0; n < PAGE_SIZE / sizeof(*pmd); n++)
+			pmd[n] = pgd_entry + n * HUGE_PAGE_SIZE;
+
+		/* break-before-make */
+		page_directory[pgd_index] = 0;
+		synchronization_barrier();
+		tlb_flush_all();
+		synchronization_barrier();
+		instruction_barrier();
+	} else {
+		memset(pmd, 0, PAGE_SIZE);
+	}
+	/* ensure the page table walker will see the entries */
+	synchronization_barrier();
+
+	page_directory[pgd_index] = (unsigned long)pmd | LONG_DESC_TABLE;
+
+	return pmd;
+}
+
+void map_range(void *start, unsigned long size, enum map_type map_type)
+{
+	u64 vaddr = (unsigned long)start & HUGE_PAGE_MASK;
+	u64 end = (unsigned long)start + (u64)size;
+	u64 attrs, pgd_entry;
+	unsigned int pgd_index;
+	u64 *pmd;
 
-	size += (vaddr & ~HUGE_PAGE_MASK) + HUGE_PAGE_SIZE - 1;
-	size &= HUGE_PAGE_MASK;
+	attrs = LATTR_AF | LATTR_INNER_SHAREABLE | LATTR_AP_RW_EL1 |
+		LONG_DESC_BLOCK;
+	if (map_type == MAP_CACHED)
+		attrs |= LATTR_MAIR(0);
+	else if (map_type == MAP_UNCACHED)
+		attrs |= LATTR_MAIR(1) | LATTR_XN | LATTR_PXN;
+	else
+		attrs |= LATTR_MAIR(2) | LATTR_XN | LATTR_PXN;
 
-	while (size) {
+	while (vaddr < end) {
 		pgd_index = PGD_INDEX(vaddr);
-		if (!(page_directory[pgd_index] & LONG_DESC_TABLE)) {
-			pmd = alloc(PAGE_SIZE, PAGE_SIZE);
-			memset(pmd, 0, PAGE_SIZE);
-			/* ensure the page table walker will see the zeroes */
-			synchronization_barrier();
-
-			page_directory[pgd_index] =
-				(unsigned long)pmd | LONG_DESC_TABLE;
-		} else {
-			pmd = (u64*)(unsigned long)
-				(page_directory[pgd_index] & ~LONG_DESC_TABLE);
+		pgd_entry = page_directory[pgd_index];
+
+		if ((vaddr & ~GIGA_PAGE_MASK) == 0 &&
+		    end - vaddr >= GIGA_PAGE_SIZE &&
+		    (pgd_entry & LONG_DESC_TABLE) != LONG_DESC_TABLE) {
+			page_directory[pgd_index] = vaddr | attrs;
+			vaddr += GIGA_PAGE_SIZE;
+			continue;
 		}
 
-		pmd_entry = vaddr & HUGE_PAGE_MASK;
-		pmd_entry |= LATTR_AF | LATTR_INNER_SHAREABLE | \
-			     LATTR_AP_RW_EL1 | LONG_DESC_BLOCK;
-		if (map_type == MAP_CACHED)
-			pmd_entry |= LATTR_MAIR(0);
-		else
-			pmd_entry |= LATTR_MAIR(1);
-
-		pmd[PMD_INDEX(vaddr)] = pmd_entry;
+		pmd = get_pmd(pgd_index);
+		pmd[PMD_INDEX(vaddr)] = vaddr | attrs;
 
-		size -= HUGE_PAGE_SIZE;
 		vaddr += HUGE_PAGE_SIZE;
 	}
 
@@ -91,11 +119,17 @@ void map_range(void *start, unsigned long size, enum map_type map_type)
 
 void arch_mmu_enable(void)
 {
-	unsigned long mair, sctlr;
-
 	map_range((void*)CONFIG_INMATE_BASE, 0x10000, MAP_CACHED);
 	map_range((void*)COMM_REGION_BASE, PAGE_SIZE, MAP_CACHED);
 
+	arch_mmu_cpu_enable();
+}
+
+/* Enables the MMU on the calling CPU, using the shared page tables. */
+void arch_mmu_cpu_enable(void)
+{
+	unsigned long mair, sctlr;
+
 	/*
 	 * ARMv7: Use attributes 0 and 1 in MAIR0
 	 * ARMv8: Use attributes 0 and 1 in MAIR
@@ -103,8 +137,10 @@ void arch_mmu_enable(void)
 	 * Attributes 0: inner/outer: normal memory, outer write-back
 	 *		 non-transient
 	 * Attributes 1: device memory
+	 * Attributes 2: normal memory, non-cacheable (write-combining)
 	 */
-	mair = MAIR_ATTR(1, MAIR_ATTR_DEVICE) | MAIR_ATTR(0, MAIR_ATTR_WBRWA);
+	mair = MAIR_ATTR(2, MAIR_ATTR_NC) | MAIR_ATTR(1, MAIR_ATTR_DEVICE) |
+		MAIR_ATTR(0, MAIR_ATTR_WBRWA);
 	arm_write_sysreg(MAIR, mair);
 
 	arm_write_sysreg(TRANSL_CONT_REG, TRANSL_CONT_REG_SETTINGS);
@@ -41,12 +41,20 @@
 #include <asm/sysregs.h>
 #include <inmate.h>
 
+static unsigned long timer_freq;
+static struct clock_scale ticks_to_ns, ns_to_ticks;
+
 unsigned long timer_get_frequency(void)
 {
 	unsigned long freq;
 
-	arm_read_sysreg(CNTFRQ_EL0, freq);
-	return freq;
+	if (!timer_freq) {
+		arm_read_sysreg(CNTFRQ_EL0, freq);
+		clock_scale_init(&ticks_to_ns, freq, NS_PER_SEC);
+		clock_scale_init(&ns_to_ticks, NS_PER_SEC, freq);
+		timer_freq = freq;
+	}
+	return timer_freq;
 }
 
 u64 timer_get_ticks(void)
@@ -57,21 +65,18 @@ u64 timer_get_ticks(void)
 	return pct64;
 }
 
-static unsigned long emul_division(u64 val, u64 div)
+u64 timer_ticks_to_ns(u64 ticks)
 {
-	unsigned long cnt = 0;
-
-	while (val > div) {
-		val -= div;
-		cnt++;
-	}
-	return cnt;
+	if (!timer_freq)
+		timer_get_frequency();
+	return clock_scale(&ticks_to_ns, ticks);
 }
 
-u64 timer_ticks_to_ns(u64 ticks)
+u64 timer_ns_to_ticks(u64 ns)
 {
-	return emul_division(ticks * 1000,
-			     timer_get_frequency() / 1000 / 1000);
+	if (!timer_freq)
+		timer_get_frequency();
+	return clock_scale(&ns_to_ticks, ns);
 }
 
 void timer_start(u64 timeout)
@@ -79,3 +84,33 @@ void timer_start(u64 timeout)
 	arm_write_sysreg(CNTV_TVAL_EL0, timeout);
 	arm_write_sysreg(CNTV_CTL_EL0, 1);
 }
+
+void arch_latency_init(void)
+{
+	timer_get_frequency();
+}
+
+u64 arch_latency_now(void)
+{
+	return timer_get_ticks();
+}
+
+u64 arch_timebase_counter(void)
+{
+	return timer_get_ticks();
+}
+
+void arch_latency_set_timer(u64 timeout)
+{
+	timer_start(timeout);
+}
+
+u64 arch_latency_to_ns(u64 delta)
+{
+	return clock_scale(&ticks_to_ns, delta);
+}
+
+u64 arch_latency_from_ns(u64 ns)
+{
+	return clock_scale(&ns_to_ticks, ns);
+}
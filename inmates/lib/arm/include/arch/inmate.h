@@ -42,3 +42,8 @@ static inline void arch_disable_irqs(void)
 {
 	asm volatile("cpsid if"); /* disable IRQs and FIQs */
 }
+
+static inline void arch_enable_irqs(void)
+{
+	asm volatile("cpsie if"); /* enable IRQs and FIQs */
+}
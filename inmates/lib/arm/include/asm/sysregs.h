@@ -77,6 +77,12 @@
 
 #define MPIDR		SYSREG_32(0, c0, c0, 5)
 
+#define ICC_SGI1R_EL1	SYSREG_64(0, c12)
+
+#define TLBIALLIS	SYSREG_32(0, c8, c3, 0)
+
+#define tlb_flush_all()	arm_write_sysreg(TLBIALLIS, 0)
+
 #define MPIDR_LEVEL_BITS		8
 #define MPIDR_LEVEL_MASK		((1 << MPIDR_LEVEL_BITS) - 1)
 #define MPIDR_LEVEL_SHIFT(level)	(MPIDR_LEVEL_BITS * (level))
@@ -108,6 +114,9 @@ asm(".arch_extension virt\n");
 #define arm_read_sysreg_64(op1, crm, val) \
 	asm volatile ("mrrc	p15, "#op1", %Q0, %R0, "#crm"\n" \
 			: "=r"((u64)(val)))
+#define arm_write_sysreg_64(op1, crm, val) \
+	asm volatile ("mcrr	p15, "#op1", %Q0, %R0, "#crm"\n" \
+			: : "r"((u64)(val)))
 
 #else /* __ASSEMBLY__ */
 
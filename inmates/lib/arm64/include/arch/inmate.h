@@ -36,9 +36,26 @@
  * THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+/* see string.c */
+#define ARCH_HAS_MEMCPY
+#define ARCH_HAS_MEMSET
+
+#define SMP_MAX_CPUS		16
+
+extern volatile u32 smp_num_cpus;
+extern unsigned long smp_cpu_ids[SMP_MAX_CPUS];
+void smp_wait_for_all_cpus(void);
+void smp_start_cpu(unsigned long mpidr, void (*entry)(void));
+void smp_start_all_cpus(void (*entry)(void));
+
 void __attribute__((used)) vector_irq(void);
 
 static inline void arch_disable_irqs(void)
 {
 	asm volatile("msr daifset, #3"); /* disable IRQs and FIQs */
 }
+
+static inline void arch_enable_irqs(void)
+{
+	asm volatile("msr daifclr, #3"); /* enable IRQs and FIQs */
+}
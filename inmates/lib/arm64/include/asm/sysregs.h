@@ -73,6 +73,10 @@
 
 #define MPIDR	MPIDR_EL1
 
+#define ICC_SGI1R_EL1	SYSREG_32(0, c12, c11, 5)
+
+#define tlb_flush_all()	asm volatile("tlbi vmalle1is" : : : "memory")
+
 #define MPIDR_LEVEL_BITS_SHIFT	3
 #define MPIDR_LEVEL_BITS	(1 << MPIDR_LEVEL_BITS_SHIFT)
 #define MPIDR_LEVEL_MASK	((1 << MPIDR_LEVEL_BITS) - 1)
@@ -0,0 +1,173 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#include <inmate.h>
+#include <asm/sysregs.h>
+
+#define PSCI_CPU_OFF			0x84000002
+#define PSCI_CPU_ON_64			0xc4000003
+#define PSCI_AFFINITY_INFO_64		0xc4000004
+
+#define MPIDR_CPUID_MASK		0xff00ffffffUL
+
+/* probed affinities around the own MPIDR */
+#define PROBE_CLUSTERS			4
+#define PROBE_CORES			16
+
+void __secondary_entry(void);
+
+void (* volatile ap_entry)(void);
+void * volatile ap_stack;
+
+volatile u32 smp_num_cpus = 1;
+unsigned long smp_cpu_ids[SMP_MAX_CPUS];
+
+static long psci_call(unsigned long function, unsigned long arg0,
+		      unsigned long arg1, unsigned long arg2)
+{
+	register unsigned long x0 asm("x0") = function;
+	register unsigned long x1 asm("x1") = arg0;
+	register unsigned long x2 asm("x2") = arg1;
+	register unsigned long x3 asm("x3") = arg2;
+
+	asm volatile("smc #0"
+		: "+r" (x0)
+		: "r" (x1), "r" (x2), "r" (x3)
+		: "memory");
+	return x0;
+}
+
+/*
+ * The hypervisor denies PSCI requests for CPUs outside of the cell. This is
+ * used to discover the cell's CPUs among the neighbours of the own MPIDR.
+ */
+void smp_wait_for_all_cpus(void)
+{
+	unsigned long own, mpidr, cluster, core;
+
+	if (smp_num_cpus > 1)
+		return;
+
+	arm_read_sysreg(MPIDR, own);
+	own &= MPIDR_CPUID_MASK;
+	smp_cpu_ids[0] = own;
+
+	for (cluster = 0; cluster < PROBE_CLUSTERS; cluster++)
+		for (core = 0; core < PROBE_CORES; core++) {
+			mpidr = (own & ~0xffffUL) | (cluster << 8) | core;
+			if (mpidr == own || smp_num_cpus >= SMP_MAX_CPUS)
+				continue;
+			if (psci_call(PSCI_AFFINITY_INFO_64, mpidr, 0, 0) >= 0)
+				smp_cpu_ids[smp_num_cpus++] = mpidr;
+		}
+}
+
+unsigned int smp_processor_id(void)
+{
+	unsigned long index;
+
+	arm_read_sysreg(TPIDR_EL1, index);
+	return index;
+}
+
+void smp_start_cpu(unsigned long mpidr, void (*entry)(void))
+{
+	static void *ap_stacks[SMP_MAX_CPUS];
+	unsigned int index;
+
+	for (index = 1; index < smp_num_cpus; index++)
+		if (smp_cpu_ids[index] == mpidr)
+			break;
+	if (index >= smp_num_cpus)
+		return;
+
+	if (!ap_stacks[index]) {
+		ap_stacks[index] = (u8 *)alloc(PAGE_SIZE, PAGE_SIZE) +
+			PAGE_SIZE;
+		/* only the image is mapped initially, cover the heap as well */
+		map_range((void *)stack_top,
+			  (unsigned long)alloc(0, 1) - (unsigned long)stack_top,
+			  MAP_CACHED);
+	}
+	ap_stack = ap_stacks[index];
+	ap_entry = entry;
+
+	/* the new CPU reads ap_stack with caches off */
+	asm volatile("dc civac, %0" : : "r" (&ap_stack) : "memory");
+	asm volatile("dsb sy" : : : "memory");
+
+	if (psci_call(PSCI_CPU_ON_64, mpidr, (unsigned long)__secondary_entry,
+		      0) != 0)
+		return;
+
+	while (ap_entry != NULL)
+		cpu_relax();
+}
+
+/* PSCI starts CPUs without delays, so one after the other is fine. */
+void smp_start_all_cpus(void (*entry)(void))
+{
+	unsigned long own;
+	unsigned int n;
+
+	arm_read_sysreg(MPIDR, own);
+	for (n = 0; n < smp_num_cpus; n++)
+		if (smp_cpu_ids[n] != (own & MPIDR_CPUID_MASK))
+			smp_start_cpu(smp_cpu_ids[n], entry);
+}
+
+void __attribute__((noreturn, used)) secondary_c_entry(void)
+{
+	unsigned long mpidr;
+	void (*entry)(void);
+	unsigned int index;
+
+	arch_mmu_cpu_enable();
+
+	arm_read_sysreg(MPIDR, mpidr);
+	for (index = 0; index < smp_num_cpus; index++)
+		if (smp_cpu_ids[index] == (mpidr & MPIDR_CPUID_MASK))
+			break;
+	arm_write_sysreg(TPIDR_EL1, index);
+
+	entry = ap_entry;
+	ap_entry = NULL;
+	entry();
+
+	psci_call(PSCI_CPU_OFF, 0, 0, 0);
+	halt();
+}
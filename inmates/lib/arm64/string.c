@@ -0,0 +1,105 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#include <inmate.h>
+
+/*
+ * Source and destination have to be mutually 8-byte aligned for the paired
+ * accesses. Besides performance, this keeps all accesses naturally aligned,
+ * as required while the MMU is off and all memory is of device type.
+ */
+#define U64_ALIGNED(x)		(((unsigned long)(x) & 7) == 0)
+
+void *memcpy(void *dest, const void *src, unsigned long n)
+{
+	u64 t0, t1, t2, t3, t4, t5, t6, t7;
+	const u8 *s = src;
+	u8 *d = dest;
+
+	if (U64_ALIGNED((unsigned long)d ^ (unsigned long)s)) {
+		for (; !U64_ALIGNED(d) && n > 0; n--)
+			*d++ = *s++;
+		for (; n >= 64; n -= 64) {
+			asm volatile("ldp %0, %1, [%8]\n\t"
+				     "ldp %2, %3, [%8, #16]\n\t"
+				     "ldp %4, %5, [%8, #32]\n\t"
+				     "ldp %6, %7, [%8, #48]\n\t"
+				     "stp %0, %1, [%9]\n\t"
+				     "stp %2, %3, [%9, #16]\n\t"
+				     "stp %4, %5, [%9, #32]\n\t"
+				     "stp %6, %7, [%9, #48]"
+				: "=&r" (t0), "=&r" (t1), "=&r" (t2), "=&r" (t3),
+				  "=&r" (t4), "=&r" (t5), "=&r" (t6), "=&r" (t7)
+				: "r" (s), "r" (d)
+				: "memory");
+			s += 64;
+			d += 64;
+		}
+		for (; n >= 8; n -= 8) {
+			*(u64 *)d = *(const u64 *)s;
+			d += 8;
+			s += 8;
+		}
+	}
+	while (n-- > 0)
+		*d++ = *s++;
+	return dest;
+}
+
+void *memset(void *s, int c, unsigned long n)
+{
+	u64 pattern = (u8)c * 0x0101010101010101UL;
+	u8 *p = s;
+
+	for (; !U64_ALIGNED(p) && n > 0; n--)
+		*p++ = c;
+	for (; n >= 64; n -= 64) {
+		asm volatile("stp %1, %1, [%0]\n\t"
+			     "stp %1, %1, [%0, #16]\n\t"
+			     "stp %1, %1, [%0, #32]\n\t"
+			     "stp %1, %1, [%0, #48]"
+			: : "r" (p), "r" (pattern) : "memory");
+		p += 64;
+	}
+	for (; n >= 8; n -= 8) {
+		*(u64 *)p = pattern;
+		p += 8;
+	}
+	while (n-- > 0)
+		*p++ = c;
+	return s;
+}
@@ -0,0 +1,194 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+/*
+ * Histogram layout: values below BENCH_SUB_BUCKETS get a bucket each. Larger
+ * values are grouped by their most significant bit, and each power-of-two
+ * range is split into BENCH_SUB_BUCKETS linear sub-buckets. This keeps the
+ * relative error of percentiles below 1/BENCH_SUB_BUCKETS.
+ */
+#define SUB_BUCKET_BITS		4
+
+static unsigned int fls64(u64 value)
+{
+	u32 hi = value >> 32;
+
+	if (hi)
+		return 64 - __builtin_clz(hi);
+	if ((u32)value)
+		return 32 - __builtin_clz((u32)value);
+	return 0;
+}
+
+/* Avoid libgcc dependencies of 64-bit divisions on 32-bit targets. */
+u64 div_u64(u64 dividend, u64 divisor)
+{
+	u64 quotient = 0, remainder = 0;
+	int bit;
+
+	for (bit = 63; bit >= 0; bit--) {
+		remainder = (remainder << 1) | ((dividend >> bit) & 1);
+		if (remainder >= divisor) {
+			remainder -= divisor;
+			quotient |= 1ULL << bit;
+		}
+	}
+	return quotient;
+}
+
+void clock_scale_init(struct clock_scale *scale, u64 from_hz, u64 to_hz)
+{
+	u64 mult = 0;
+	u32 shift = 32;
+
+	/* largest shift that keeps both to_hz << shift and mult in range */
+	while (shift > 0 && (to_hz >> (64 - shift)) != 0)
+		shift--;
+	for (; shift > 0; shift--) {
+		mult = div_u64((to_hz << shift) + from_hz / 2, from_hz);
+		if (mult <= 0xffffffffULL)
+			break;
+	}
+	if (shift == 0)
+		mult = div_u64(to_hz + from_hz / 2, from_hz);
+
+	scale->mult = mult;
+	scale->shift = shift;
+}
+
+static unsigned int bucket_index(u64 value)
+{
+	unsigned int msb;
+
+	if (value < BENCH_SUB_BUCKETS)
+		return value;
+
+	msb = fls64(value) - 1;
+	return (msb - SUB_BUCKET_BITS + 1) * BENCH_SUB_BUCKETS +
+		((value >> (msb - SUB_BUCKET_BITS)) & (BENCH_SUB_BUCKETS - 1));
+}
+
+static u64 bucket_upper_bound(unsigned int index)
+{
+	unsigned int shift;
+	u64 lower;
+
+	if (index < BENCH_SUB_BUCKETS)
+		return index;
+
+	shift = index / BENCH_SUB_BUCKETS - 1;
+	lower = (u64)(BENCH_SUB_BUCKETS + index % BENCH_SUB_BUCKETS) << shift;
+	return lower + (1ULL << shift) - 1;
+}
+
+void bench_stats_init(struct bench_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->min = ~0ULL;
+}
+
+void bench_stats_add(struct bench_stats *stats, u64 value)
+{
+	if (value < stats->min)
+		stats->min = value;
+	if (value > stats->max)
+		stats->max = value;
+	stats->sum += value;
+	stats->samples++;
+	stats->histogram[bucket_index(value)]++;
+}
+
+u64 bench_stats_percentile(const struct bench_stats *stats,
+			   unsigned int percent)
+{
+	u64 target, count = 0;
+	unsigned int n;
+
+	if (stats->samples == 0)
+		return 0;
+
+	target = div_u64((u64)stats->samples * percent + 99, 100);
+	for (n = 0; n < BENCH_BUCKETS; n++) {
+		count += stats->histogram[n];
+		if (count >= target)
+			break;
+	}
+	if (n == BENCH_BUCKETS || bucket_upper_bound(n) > stats->max)
+		return stats->max;
+	return bucket_upper_bound(n);
+}
+
+void bench_stats_print(const char *name, const char *unit,
+		       const struct bench_stats *stats)
+{
+	if (stats->samples == 0) {
+		printk("bench=%s samples=0\n", name);
+		return;
+	}
+
+	printk("bench=%s unit=%s samples=%lu min=%llu avg=%llu p99=%llu "
+	       "max=%llu\n", name, unit, stats->samples, stats->min,
+	       div_u64(stats->sum, stats->samples),
+	       bench_stats_percentile(stats, 99), stats->max);
+}
+
+void bench_stats_export(struct bench_export *export, const char *name,
+			const char *unit, const struct bench_stats *stats)
+{
+	unsigned long len;
+
+	export->sequence++;
+	memory_barrier();
+
+	export->magic = BENCH_EXPORT_MAGIC;
+	len = strlen(name);
+	if (len >= sizeof(export->name))
+		len = sizeof(export->name) - 1;
+	memset(export->name, 0, sizeof(export->name));
+	memcpy(export->name, name, len);
+	len = strlen(unit);
+	if (len >= sizeof(export->unit))
+		len = sizeof(export->unit) - 1;
+	memset(export->unit, 0, sizeof(export->unit));
+	memcpy(export->unit, unit, len);
+	export->sub_buckets = BENCH_SUB_BUCKETS;
+	export->buckets = BENCH_BUCKETS;
+	memcpy(&export->stats, stats, sizeof(export->stats));
+
+	memory_barrier();
+	export->sequence++;
+}
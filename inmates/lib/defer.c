@@ -0,0 +1,99 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#include <inmate.h>
+
+/**
+ * Initialize a deferred work queue.
+ * @param queue		Queue to initialize.
+ */
+void defer_queue_init(struct defer_queue *queue)
+{
+	queue->head = 0;
+	queue->tail = 0;
+}
+
+/**
+ * Queue work for later execution, typically from an interrupt handler.
+ * @param queue		Queue to add the work to.
+ * @param func		Function to run.
+ * @param arg		Argument passed to @c func.
+ *
+ * @return True if queued, false if the queue is full.
+ */
+bool defer_work(struct defer_queue *queue, defer_func_t func, void *arg)
+{
+	unsigned int head = queue->head;
+
+	if (head - queue->tail >= DEFER_QUEUE_SIZE)
+		return false;
+
+	queue->entries[head % DEFER_QUEUE_SIZE].func = func;
+	queue->entries[head % DEFER_QUEUE_SIZE].arg = arg;
+	/* publish the entry before the new head */
+	memory_barrier();
+	queue->head = head + 1;
+
+	return true;
+}
+
+/**
+ * Run queued work.
+ * @param queue		Queue to process.
+ * @param budget	Maximum number of entries to run.
+ *
+ * @return Number of entries run.
+ */
+unsigned int defer_queue_run(struct defer_queue *queue, unsigned int budget)
+{
+	unsigned int tail = queue->tail, count = 0;
+	defer_func_t func;
+	void *arg;
+
+	while (count < budget && tail != queue->head) {
+		/* read the entry only after the head */
+		memory_barrier();
+		func = queue->entries[tail % DEFER_QUEUE_SIZE].func;
+		arg = queue->entries[tail % DEFER_QUEUE_SIZE].arg;
+		/* release the slot before running, func may queue again */
+		queue->tail = ++tail;
+		func(arg);
+		count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,144 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+#include <jailhouse/dma-copy.h>
+
+/*
+ * Client side of the DMA copy service, see include/jailhouse/dma-copy.h. The
+ * ring occupies the start of the shared memory, the rest of it can be used
+ * for copy buffers.
+ */
+
+/**
+ * Set up the ring of the copy service.
+ * @param dc		Client descriptor to initialize.
+ * @param dev		Ivshmem device linked to the root-cell agent.
+ * @param num_descs	Number of descriptors, a power of 2.
+ *
+ * @return 0 on success, -1 if the parameters are invalid or the shared memory
+ * is too small.
+ */
+int dma_copy_init(struct dma_copy *dc, struct ivshmem_device *dev,
+		  unsigned int num_descs)
+{
+	struct jailhouse_dma_copy_ring *ring = dev->shmem;
+
+	if (num_descs == 0 || num_descs > JAILHOUSE_DMA_COPY_MAX_DESCS ||
+	    (num_descs & (num_descs - 1)) != 0 ||
+	    sizeof(*ring) + num_descs * sizeof(ring->descs[0]) >
+	    dev->shmem_size)
+		return -1;
+
+	dc->ring = ring;
+	dc->registers = dev->registers;
+
+	/* the agent owns the completion index, continue from there */
+	ring->num_descs = num_descs;
+	dc->submit = ring->complete;
+	ring->submit = dc->submit;
+	memory_barrier();
+
+	return 0;
+}
+
+/**
+ * Check if the agent in the root cell is ready to process copies.
+ * @param dc		Client descriptor.
+ *
+ * @return True if the agent is ready.
+ */
+bool dma_copy_agent_ready(struct dma_copy *dc)
+{
+	return mmio_read32(dc->registers + IVSHMEM_REG_RSTATE) ==
+		JAILHOUSE_DMA_COPY_STATE_READY;
+}
+
+/**
+ * Submit a copy and notify the agent.
+ * @param dc		Client descriptor.
+ * @param dst		Guest-physical destination address.
+ * @param src		Guest-physical source address.
+ * @param len		Number of bytes to copy.
+ * @param index		Receives the index to query the completion with.
+ *
+ * @return True if the copy was submitted, false if the ring is full.
+ *
+ * @see dma_copy_completed
+ */
+bool dma_copy_submit(struct dma_copy *dc, u64 dst, u64 src, u64 len,
+		     u32 *index)
+{
+	struct jailhouse_dma_copy_ring *ring = dc->ring;
+	struct jailhouse_dma_copy_desc *desc;
+
+	if (dc->submit - ring->complete >= ring->num_descs)
+		return false;
+
+	desc = &ring->descs[dc->submit & (ring->num_descs - 1)];
+	desc->src = src;
+	desc->dst = dst;
+	desc->len = len;
+	desc->result = 0;
+	*index = dc->submit++;
+
+	/* make the descriptor visible before the new index */
+	memory_barrier();
+	ring->submit = dc->submit;
+	mmio_write32(dc->registers + IVSHMEM_REG_DBELL, 0);
+
+	return true;
+}
+
+/**
+ * Query the completion of a copy.
+ * @param dc		Client descriptor.
+ * @param index		Index returned by dma_copy_submit.
+ * @param result	Receives 0 or the negative error code of the agent.
+ *
+ * @return True if the copy is completed.
+ */
+bool dma_copy_completed(struct dma_copy *dc, u32 index, int *result)
+{
+	struct jailhouse_dma_copy_ring *ring = dc->ring;
+
+	if ((s32)(ring->complete - index) <= 0)
+		return false;
+
+	/* read the result only after the index */
+	memory_barrier();
+	*result = ring->descs[index & (ring->num_descs - 1)].result;
+	return true;
+}
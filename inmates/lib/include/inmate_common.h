@@ -64,6 +64,16 @@ typedef enum { true = 1, false = 0 } bool;
 #include <jailhouse/hypercall.h>
 
 #define comm_region	((struct jailhouse_comm_region *)COMM_REGION_BASE)
+#define comm_watchdog	((struct jailhouse_comm_watchdog *)		\
+			 (COMM_REGION_BASE + JAILHOUSE_COMM_WATCHDOG_OFFSET))
+#define comm_transfer	((struct jailhouse_comm_transfer *)		\
+			 (COMM_REGION_BASE + JAILHOUSE_COMM_TRANSFER_OFFSET))
+
+/* Signal liveness to the hypervisor if the root cell enabled a watchdog. */
+static inline void watchdog_kick(void)
+{
+	comm_watchdog->count++;
+}
 
 static inline void __attribute__((noreturn)) stop(void)
 {
@@ -76,6 +86,39 @@ void arch_init_early(void);
 void __attribute__((format(printf, 1, 2))) printk(const char *fmt, ...);
 
 void *alloc(unsigned long size, unsigned long align);
+void *malloc(unsigned long size);
+void free(void *ptr);
+
+/**
+ * Pool of fixed-size objects, e.g. message buffers in an ivshmem region.
+ * The free list is kept in private memory, so a pool over shared memory
+ * cannot be corrupted by the peer. Objects can be exchanged with the peer
+ * by index, see pool_index() and pool_object().
+ */
+struct pool {
+	u8 *base;
+	unsigned long obj_size;
+	unsigned int num_objs;
+	unsigned int first_free;
+	unsigned int *next_free;
+	u8 lock;
+};
+
+void pool_init(struct pool *pool, void *base, unsigned long obj_size,
+	       unsigned int num_objs);
+void *pool_get(struct pool *pool);
+void pool_put(struct pool *pool, void *obj);
+
+static inline unsigned int pool_index(const struct pool *pool,
+				      const void *obj)
+{
+	return ((const u8 *)obj - pool->base) / pool->obj_size;
+}
+
+static inline void *pool_object(const struct pool *pool, unsigned int index)
+{
+	return pool->base + (unsigned long)index * pool->obj_size;
+}
 
 void *memset(void *s, int c, unsigned long n);
 void *memcpy(void *d, const void *s, unsigned long n);
@@ -91,7 +134,190 @@ const char *cmdline_parse_str(const char *param, char *value_buffer,
 long long cmdline_parse_int(const char *param, long long default_value);
 bool cmdline_parse_bool(const char *param, bool default_value);
 
-enum map_type { MAP_CACHED, MAP_UNCACHED };
+#define BENCH_SUB_BUCKETS	16
+#define BENCH_BUCKETS		((64 - 4 + 1) * BENCH_SUB_BUCKETS)
+
+/** Statistics of a benchmark, including a histogram for percentiles. */
+struct bench_stats {
+	u64 min, max, sum;
+	unsigned long samples;
+	u32 histogram[BENCH_BUCKETS];
+};
+
+void bench_stats_init(struct bench_stats *stats);
+void bench_stats_add(struct bench_stats *stats, u64 value);
+u64 bench_stats_percentile(const struct bench_stats *stats,
+			   unsigned int percent);
+void bench_stats_print(const char *name, const char *unit,
+		       const struct bench_stats *stats);
+
+#define BENCH_EXPORT_MAGIC	0x48434e42	/* "BNCH" */
+
+/**
+ * Benchmark results as exported to a shared memory region. The sequence
+ * counter is odd while an update is in progress, so readers in other cells
+ * can retry until they got a consistent snapshot.
+ */
+struct bench_export {
+	u32 magic;
+	volatile u32 sequence;
+	char name[24];
+	char unit[8];
+	u32 sub_buckets;
+	u32 buckets;
+	struct bench_stats stats;
+};
+
+void bench_stats_export(struct bench_export *export, const char *name,
+			const char *unit, const struct bench_stats *stats);
+
+u64 div_u64(u64 dividend, u64 divisor);
+
+/**
+ * Multiply-shift factors converting values between two clock rates without
+ * divisions, comparable to Linux' clocksource mult/shift pair.
+ */
+struct clock_scale {
+	u32 mult;
+	u32 shift;
+};
+
+void clock_scale_init(struct clock_scale *scale, u64 from_hz, u64 to_hz);
+
+static inline u64 clock_scale(const struct clock_scale *scale, u64 value)
+{
+	u32 hi = value >> 32, lo = value;
+	u64 result = ((u64)lo * scale->mult) >> scale->shift;
+
+	/* split multiplication, keeping the full 96-bit product */
+	if (hi)
+		result += ((u64)hi * scale->mult) << (32 - scale->shift);
+	return result;
+}
+
+void latency_start(unsigned long period_ns);
+void latency_timer_expired(void);
+const struct bench_stats *latency_get_stats(void);
+
+void arch_latency_init(void);
+u64 arch_latency_now(void);
+void arch_latency_set_timer(u64 timeout);
+u64 arch_latency_to_ns(u64 delta);
+u64 arch_latency_from_ns(u64 ns);
+
+u64 arch_timebase_counter(void);
+u64 timebase_read_ns(const struct jailhouse_timebase *timebase);
+
+struct sw_timer;
+
+typedef void (*sw_timer_func_t)(struct sw_timer *timer);
+
+/** Software timer, multiplexed onto the hardware one-shot timer. */
+struct sw_timer {
+	u64 expiry;
+	u64 period;
+	sw_timer_func_t func;
+	unsigned int index;
+};
+
+void sw_timers_init(void);
+void sw_timer_start(struct sw_timer *timer, sw_timer_func_t func,
+		    unsigned long delay_ns, unsigned long period_ns);
+void sw_timer_cancel(struct sw_timer *timer);
+void sw_timers_expired(void);
+
+#define IVSHMEM_VENDOR_ID	0x1af4
+#define IVSHMEM_DEVICE_ID	0x1110
+
+#define IVSHMEM_REG_IVPOS	8
+#define IVSHMEM_REG_DBELL	12
+#define IVSHMEM_REG_LSTATE	16
+#define IVSHMEM_REG_RSTATE	20
+#define IVSHMEM_REG_STATE_VEC	24
+
+struct ivshmem_device {
+	u16 bdf;
+	void *registers;
+	void *shmem;
+	u64 shmem_size;
+	u32 id;
+};
+
+#define IVSHMEM_RING_CACHELINE	64
+
+/** Ring indexes in shared memory, each written by one side only. */
+struct ivshmem_ring_shared {
+	volatile u32 head;
+	u8 padding0[IVSHMEM_RING_CACHELINE - 4];
+	volatile u32 tail;
+	volatile u32 consumer_waiting;
+	u8 padding1[IVSHMEM_RING_CACHELINE - 8];
+};
+
+struct ivshmem_ring {
+	struct ivshmem_ring_shared *shared;
+	unsigned int num_slots;
+	unsigned int slot_size;
+	u32 head, tail;
+	u32 flushed_head;
+	void *doorbell;
+	u32 doorbell_value;
+};
+
+int ivshmem_ring_init(struct ivshmem_ring *ring, void *mem,
+		      unsigned long size, unsigned int max_msg_size,
+		      bool reset);
+void ivshmem_ring_set_doorbell(struct ivshmem_ring *ring, void *doorbell,
+			       u32 value);
+bool ivshmem_ring_send(struct ivshmem_ring *ring, const void *data,
+		       unsigned int len);
+void ivshmem_ring_flush(struct ivshmem_ring *ring);
+unsigned int ivshmem_ring_poll(struct ivshmem_ring *ring,
+			       void (*handler)(void *arg, const void *data,
+					       unsigned int len),
+			       void *arg, unsigned int budget);
+bool ivshmem_ring_arm(struct ivshmem_ring *ring);
+void ivshmem_ring_disarm(struct ivshmem_ring *ring);
+
+struct jailhouse_dma_copy_ring;
+
+/** Client of the DMA copy service of a root-cell agent. */
+struct dma_copy {
+	struct jailhouse_dma_copy_ring *ring;
+	void *registers;
+	u32 submit;
+};
+
+int dma_copy_init(struct dma_copy *dc, struct ivshmem_device *dev,
+		  unsigned int num_descs);
+bool dma_copy_agent_ready(struct dma_copy *dc);
+bool dma_copy_submit(struct dma_copy *dc, u64 dst, u64 src, u64 len,
+		     u32 *index);
+bool dma_copy_completed(struct dma_copy *dc, u32 index, int *result);
+
+typedef void (*defer_func_t)(void *arg);
+
+#define DEFER_QUEUE_SIZE	64
+
+/**
+ * Lock-free queue to hand work from an interrupt handler to task context.
+ * There must be only one producer and one consumer at a time, typically the
+ * handler and the main loop of the same CPU.
+ */
+struct defer_queue {
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	struct {
+		defer_func_t func;
+		void *arg;
+	} entries[DEFER_QUEUE_SIZE];
+};
+
+void defer_queue_init(struct defer_queue *queue);
+bool defer_work(struct defer_queue *queue, defer_func_t func, void *arg);
+unsigned int defer_queue_run(struct defer_queue *queue, unsigned int budget);
+
+enum map_type { MAP_CACHED, MAP_UNCACHED, MAP_WRITE_COMBINE };
 
 void map_range(void *start, unsigned long size, enum map_type map_type);
 
@@ -101,6 +327,60 @@ void map_range(void *start, unsigned long size, enum map_type map_type);
 extern const char cmdline[];
 extern const char stack_top[];
 
+#ifdef SMP_MAX_CPUS
+#define SMP_CACHE_LINE		64
+
+/** Ticket lock, granting the lock in FIFO order of the requesters. */
+struct spinlock {
+	unsigned int next;
+	unsigned int owner;
+};
+
+static inline void spin_lock(struct spinlock *lock)
+{
+	unsigned int ticket = __atomic_fetch_add(&lock->next, 1,
+						 __ATOMIC_RELAXED);
+
+	while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
+		cpu_relax();
+}
+
+static inline void spin_unlock(struct spinlock *lock)
+{
+	__atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+/** Barrier that releases the CPUs once num_cpus of them arrived. */
+struct smp_barrier {
+	unsigned int num_cpus;
+	unsigned int arrived;
+	unsigned int generation;
+};
+
+void smp_barrier_init(struct smp_barrier *barrier, unsigned int num_cpus);
+void smp_barrier_wait(struct smp_barrier *barrier);
+
+/*
+ * Per-CPU variables, indexed by the logical CPU number. Each instance is
+ * placed in its own cache line.
+ */
+#define DEFINE_PER_CPU(type, name)					\
+	struct {							\
+		type val;						\
+	} __attribute__((aligned(SMP_CACHE_LINE))) name[SMP_MAX_CPUS]
+
+#define per_cpu(name, cpu)	((name)[cpu].val)
+#define this_cpu(name)		per_cpu(name, smp_processor_id())
+
+unsigned int smp_processor_id(void);
+
+typedef void (*work_func_t)(void *arg);
+
+void smp_start_workers(void);
+bool smp_queue_work(unsigned int cpu, work_func_t func, void *arg);
+void smp_process_work(void);
+#endif
+
 void inmate_main(void);
 
 #endif /* !__ASSEMBLY__ */
@@ -0,0 +1,141 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#define NET_BUF_DATA_SIZE	2048
+
+/**
+ * Packet buffer. Drivers let the device transfer frames directly from and to
+ * the data area, so buffers are passed along instead of being copied.
+ */
+struct net_buf {
+	struct pool *pool;
+	unsigned int len;
+	u8 data[] __attribute__((aligned(64)));
+};
+
+#define NET_BUF_OBJ_SIZE	(sizeof(struct net_buf) + NET_BUF_DATA_SIZE)
+
+struct eth_header {
+	u8	dst[6];
+	u8	src[6];
+	u16	type;
+	u8	data[];
+} __attribute__((packed));
+
+struct net_device;
+
+struct net_ops {
+	unsigned int (*rx_burst)(struct net_device *dev, struct net_buf **bufs,
+				 unsigned int max);
+	unsigned int (*tx_burst)(struct net_device *dev, struct net_buf **bufs,
+				 unsigned int num);
+	bool (*irq_enable)(struct net_device *dev);
+	void (*irq_disable)(struct net_device *dev);
+};
+
+struct net_device {
+	const struct net_ops *ops;
+	struct pool *bufs;
+	u8 mac[6];
+	unsigned int speed;
+};
+
+void net_bufs_init(struct pool *pool, void *mem, unsigned long size);
+struct net_buf *net_buf_alloc(struct pool *pool);
+void net_buf_free(struct net_buf *buf);
+
+/**
+ * Receive a batch of frames.
+ * @param dev		Network device.
+ * @param bufs		Array to store the received buffers in. The caller
+ * 			owns them afterwards and releases them via
+ * 			net_buf_free() or passes them on to net_tx_burst().
+ * @param max		Maximum number of frames to receive.
+ *
+ * @return Number of received frames.
+ */
+static inline unsigned int net_rx_burst(struct net_device *dev,
+					struct net_buf **bufs,
+					unsigned int max)
+{
+	return dev->ops->rx_burst(dev, bufs, max);
+}
+
+/**
+ * Send a batch of frames, notifying the device only once.
+ * @param dev		Network device.
+ * @param bufs		Buffers to send. Ownership of the sent ones passes to
+ * 			the driver.
+ * @param num		Number of buffers.
+ *
+ * @return Number of queued frames. The remaining buffers stay with the
+ * caller, e.g. to retry them later.
+ */
+static inline unsigned int net_tx_burst(struct net_device *dev,
+					struct net_buf **bufs,
+					unsigned int num)
+{
+	return dev->ops->tx_burst(dev, bufs, num);
+}
+
+/**
+ * Switch from polling to interrupt mode before waiting for new frames.
+ * @param dev		Network device.
+ *
+ * @return True if the caller can wait for the interrupt, false if frames
+ * arrived in the meantime and polling has to be continued.
+ */
+static inline bool net_irq_enable(struct net_device *dev)
+{
+	return dev->ops->irq_enable(dev);
+}
+
+/**
+ * Switch back to polling mode, typically from the interrupt handler.
+ * @param dev		Network device.
+ */
+static inline void net_irq_disable(struct net_device *dev)
+{
+	dev->ops->irq_disable(dev);
+}
+
+struct net_device *net_e1000_init(u16 bdf, struct pool *bufs,
+				  unsigned int vector);
+
+struct net_device *net_ivshmem_init(struct ivshmem_ring *tx,
+				    struct ivshmem_ring *rx,
+				    struct pool *bufs);
@@ -0,0 +1,238 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+/*
+ * Single-producer, single-consumer message ring in shared memory. The
+ * producer only writes head, the consumer only tail and consumer_waiting, so
+ * no atomic operations are needed. Doorbells are only rung when the consumer
+ * announced that it is about to wait for one, and at most once per flush.
+ * A busy consumer thus polls without any interrupt, and an idle one is woken
+ * up with a single doorbell for a whole batch of messages.
+ */
+
+#define RING_HEADER_SIZE	(2 * IVSHMEM_RING_CACHELINE)
+
+struct ivshmem_ring_slot {
+	u32 len;
+	u8 data[];
+};
+
+static struct ivshmem_ring_slot *ring_slot(struct ivshmem_ring *ring,
+					   u32 index)
+{
+	return (void *)ring->shared + RING_HEADER_SIZE +
+		(index & (ring->num_slots - 1)) * ring->slot_size;
+}
+
+/**
+ * Set up the local view on a ring in shared memory.
+ * @param ring		Ring descriptor to initialize.
+ * @param mem		Start of the shared memory to hold the ring.
+ * @param size		Size of that memory.
+ * @param max_msg_size	Maximum size of a single message.
+ * @param reset		Reset the ring indexes, to be done by one side only
+ * 			before the other one starts to use the ring.
+ *
+ * @return 0 on success, -1 if the memory is too small.
+ */
+int ivshmem_ring_init(struct ivshmem_ring *ring, void *mem,
+		      unsigned long size, unsigned int max_msg_size,
+		      bool reset)
+{
+	unsigned long slots;
+
+	memset(ring, 0, sizeof(*ring));
+
+	ring->slot_size = (sizeof(struct ivshmem_ring_slot) + max_msg_size +
+			   sizeof(u32) - 1) & ~(sizeof(u32) - 1);
+	if (size <= RING_HEADER_SIZE)
+		return -1;
+	slots = (size - RING_HEADER_SIZE) / ring->slot_size;
+	if (slots == 0)
+		return -1;
+
+	/* round down to a power of two for cheap index wrapping */
+	ring->num_slots = 1;
+	while (ring->num_slots * 2 <= slots)
+		ring->num_slots *= 2;
+
+	ring->shared = mem;
+	if (reset) {
+		ring->shared->head = 0;
+		ring->shared->tail = 0;
+		ring->shared->consumer_waiting = 0;
+		memory_barrier();
+	}
+	ring->head = ring->flushed_head = ring->shared->head;
+	ring->tail = ring->shared->tail;
+
+	return 0;
+}
+
+/**
+ * Define how the consumer of a ring is signaled.
+ * @param ring		Ring descriptor, producer side.
+ * @param doorbell	Doorbell register of the ivshmem device.
+ * @param value		Value to write, selecting target peer and vector.
+ */
+void ivshmem_ring_set_doorbell(struct ivshmem_ring *ring, void *doorbell,
+			       u32 value)
+{
+	ring->doorbell = doorbell;
+	ring->doorbell_value = value;
+}
+
+/**
+ * Queue a message without publishing it yet.
+ * @param ring		Ring descriptor, producer side.
+ * @param data		Message to send.
+ * @param len		Length of the message.
+ *
+ * @return True if the message was queued, false if the ring is full or the
+ * message too large.
+ *
+ * @see ivshmem_ring_flush
+ */
+bool ivshmem_ring_send(struct ivshmem_ring *ring, const void *data,
+		       unsigned int len)
+{
+	struct ivshmem_ring_slot *slot;
+
+	if (sizeof(*slot) + len > ring->slot_size)
+		return false;
+
+	if (ring->head - ring->tail >= ring->num_slots) {
+		ring->tail = ring->shared->tail;
+		if (ring->head - ring->tail >= ring->num_slots)
+			return false;
+	}
+
+	slot = ring_slot(ring, ring->head);
+	slot->len = len;
+	memcpy(slot->data, data, len);
+	ring->head++;
+
+	return true;
+}
+
+/**
+ * Publish all queued messages and ring the doorbell if the consumer waits
+ * for it.
+ * @param ring		Ring descriptor, producer side.
+ */
+void ivshmem_ring_flush(struct ivshmem_ring *ring)
+{
+	if (ring->head == ring->flushed_head)
+		return;
+
+	/* make the messages visible before the new head */
+	memory_barrier();
+	ring->shared->head = ring->head;
+	ring->flushed_head = ring->head;
+
+	/* order the head update against reading the consumer's flag */
+	memory_barrier();
+	if (ring->shared->consumer_waiting && ring->doorbell)
+		mmio_write32(ring->doorbell, ring->doorbell_value);
+}
+
+/**
+ * Process received messages in place.
+ * @param ring		Ring descriptor, consumer side.
+ * @param handler	Callback invoked for each message.
+ * @param arg		Argument passed to @c handler.
+ * @param budget	Maximum number of messages to process.
+ *
+ * @return Number of processed messages. If it is below @c budget, the ring
+ * was drained and the consumer may call ivshmem_ring_arm before waiting.
+ */
+unsigned int ivshmem_ring_poll(struct ivshmem_ring *ring,
+			       void (*handler)(void *arg, const void *data,
+					       unsigned int len),
+			       void *arg, unsigned int budget)
+{
+	struct ivshmem_ring_slot *slot;
+	unsigned int count = 0;
+	u32 head;
+
+	head = ring->shared->head;
+	/* read the messages only after the head */
+	memory_barrier();
+
+	while (count < budget && ring->tail != head) {
+		slot = ring_slot(ring, ring->tail);
+		handler(arg, slot->data, slot->len);
+		ring->tail++;
+		count++;
+	}
+
+	if (count > 0) {
+		/* release the slots only after they were processed */
+		memory_barrier();
+		ring->shared->tail = ring->tail;
+	}
+
+	return count;
+}
+
+/**
+ * Announce that the consumer is about to wait for a doorbell.
+ * @param ring		Ring descriptor, consumer side.
+ *
+ * @return True if the consumer can wait for the doorbell, false if new
+ * messages arrived in the meantime and polling has to be continued.
+ */
+bool ivshmem_ring_arm(struct ivshmem_ring *ring)
+{
+	ring->shared->consumer_waiting = 1;
+	/* order the flag update against re-reading the head */
+	memory_barrier();
+	if (ring->shared->head != ring->tail) {
+		ring->shared->consumer_waiting = 0;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Stop doorbell delivery, typically when woken up by one.
+ * @param ring		Ring descriptor, consumer side.
+ */
+void ivshmem_ring_disarm(struct ivshmem_ring *ring)
+{
+	ring->shared->consumer_waiting = 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+static struct bench_stats stats;
+static u64 period, next_expiry;
+
+/**
+ * Start sampling the timer interrupt latency.
+ * @param period_ns	Interval between two timer expiries.
+ *
+ * The timer interrupt has to be set up by the caller, and its handler has to
+ * invoke latency_timer_expired().
+ */
+void latency_start(unsigned long period_ns)
+{
+	arch_latency_init();
+	bench_stats_init(&stats);
+
+	period = arch_latency_from_ns(period_ns);
+	if (period == 0)
+		period = 1;
+	next_expiry = arch_latency_now() + period;
+	arch_latency_set_timer(period);
+}
+
+/**
+ * Record the latency of the current timer expiry and program the next one.
+ *
+ * Only a histogram update is done per sample, so this can run for millions
+ * of periods without disturbing the measurement. Expiries that were missed
+ * completely are skipped rather than accounted as a burst of samples.
+ */
+void latency_timer_expired(void)
+{
+	u64 now = arch_latency_now();
+
+	if (now > next_expiry)
+		bench_stats_add(&stats, arch_latency_to_ns(now - next_expiry));
+	else
+		bench_stats_add(&stats, 0);
+
+	do
+		next_expiry += period;
+	while ((s64)(next_expiry - now) <= 0);
+
+	arch_latency_set_timer(next_expiry - now);
+}
+
+const struct bench_stats *latency_get_stats(void)
+{
+	return &stats;
+}
@@ -0,0 +1,442 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#include <inmate.h>
+#include <net.h>
+
+/*
+ * Driver for Intel e1000-family NICs, using the legacy descriptor format and
+ * the first queue only. Newer members like the 82575/82576 (igb) still
+ * provide both, including the register aliases of queue 0.
+ *
+ * Receive buffers are handed to the caller as they are and replaced by fresh
+ * ones from the pool, transmitted buffers are returned to their pool once the
+ * device reports completion. Ring tails are written once per burst.
+ */
+
+#define E1000_REG_CTRL		0x0000
+# define E1000_CTRL_LRST	(1 << 3)
+# define E1000_CTRL_SLU		(1 << 6)
+# define E1000_CTRL_FRCSPD	(1 << 11)
+# define E1000_CTRL_RST		(1 << 26)
+#define E1000_REG_STATUS	0x0008
+# define E1000_STATUS_LU	(1 << 1)
+# define E1000_STATUS_SPEEDSHFT	6
+# define E1000_STATUS_SPEED	(3 << E1000_STATUS_SPEEDSHFT)
+#define E1000_REG_EERD		0x0014
+# define E1000_EERD_START	(1 << 0)
+# define E1000_EERD_DONE	(1 << 4)
+# define E1000_EERD_ADDR_SHIFT	8
+# define E1000_EERD_DATA_SHIFT	16
+#define E1000_REG_MDIC		0x0020
+# define E1000_MDIC_REGADD_SHFT	16
+# define E1000_MDIC_PHYADD	(0x1 << 21)
+# define E1000_MDIC_OP_WRITE	(0x1 << 26)
+# define E1000_MDIC_OP_READ	(0x2 << 26)
+# define E1000_MDIC_READY	(0x1 << 28)
+#define E1000_REG_ICR		0x00c0
+#define E1000_REG_IMS		0x00d0
+#define E1000_REG_IMC		0x00d8
+# define E1000_INT_TXDW		(1 << 0)
+# define E1000_INT_RXT0		(1 << 7)
+# define E1000_INT_ALL		0xffffffff
+#define E1000_REG_RCTL		0x0100
+# define E1000_RCTL_EN		(1 << 1)
+# define E1000_RCTL_BAM		(1 << 15)
+# define E1000_RCTL_BSIZE_2048	(0 << 16)
+# define E1000_RCTL_SECRC	(1 << 26)
+#define E1000_REG_TCTL		0x0400
+# define E1000_TCTL_EN		(1 << 1)
+# define E1000_TCTL_PSP		(1 << 3)
+# define E1000_TCTL_CT_DEF	(0xf << 4)
+# define E1000_TCTL_COLD_DEF	(0x40 << 12)
+#define E1000_REG_TIPG		0x0410
+# define E1000_TIPG_IPGT_DEF	(10 << 0)
+# define E1000_TIPG_IPGR1_DEF	(10 << 10)
+# define E1000_TIPG_IPGR2_DEF	(10 << 20)
+#define E1000_REG_RDBAL		0x2800
+#define E1000_REG_RDBAH		0x2804
+#define E1000_REG_RDLEN		0x2808
+#define E1000_REG_RDH		0x2810
+#define E1000_REG_RDT		0x2818
+#define E1000_REG_RXDCTL	0x2828
+# define E1000_RXDCTL_ENABLE	(1 << 25)
+#define E1000_REG_TDBAL		0x3800
+#define E1000_REG_TDBAH		0x3804
+#define E1000_REG_TDLEN		0x3808
+#define E1000_REG_TDH		0x3810
+#define E1000_REG_TDT		0x3818
+#define E1000_REG_TXDCTL	0x3828
+# define E1000_TXDCTL_ENABLE	(1 << 25)
+#define E1000_REG_RAL		0x5400
+#define E1000_REG_RAH		0x5404
+# define E1000_RAH_AV		(1 << 31)
+
+#define E1000_PHY_CTRL		0
+# define E1000_PHYC_POWER_DOWN	(1 << 11)
+
+#define E1000_RX_DESCRIPTORS	64
+#define E1000_TX_DESCRIPTORS	64
+
+struct e1000_rxd {
+	u64	addr;
+	u16	len;
+	u16	crc;
+	u8	status;
+	u8	errors;
+	u16	vlan_tag;
+} __attribute__((packed));
+
+#define E1000_RXD_STAT_DD	(1 << 0)
+#define E1000_RXD_STAT_EOP	(1 << 1)
+
+struct e1000_txd {
+	u64	addr;
+	u16	len;
+	u8	cso;
+	u8	cmd;
+	u8	status;
+	u8	css;
+	u16	special;
+} __attribute__((packed));
+
+#define E1000_TXD_CMD_EOP	(1 << 0)
+#define E1000_TXD_CMD_IFCS	(1 << 1)
+#define E1000_TXD_CMD_RS	(1 << 3)
+#define E1000_TXD_STAT_DD	(1 << 0)
+
+static const unsigned int speed_info[] = { 10, 100, 1000, 1000 };
+
+struct e1000_device {
+	struct net_device net;
+	void *mmio;
+	struct e1000_rxd *rx_ring;
+	struct e1000_txd *tx_ring;
+	struct net_buf *rx_bufs[E1000_RX_DESCRIPTORS];
+	struct net_buf *tx_bufs[E1000_TX_DESCRIPTORS];
+	unsigned int rx_next;
+	unsigned int tx_next, tx_clean;
+};
+
+static u16 phy_read(struct e1000_device *dev, unsigned int reg)
+{
+	u32 val;
+
+	mmio_write32(dev->mmio + E1000_REG_MDIC,
+		     (reg << E1000_MDIC_REGADD_SHFT) |
+		     E1000_MDIC_PHYADD | E1000_MDIC_OP_READ);
+	do {
+		val = mmio_read32(dev->mmio + E1000_REG_MDIC);
+		cpu_relax();
+	} while (!(val & E1000_MDIC_READY));
+
+	return (u16)val;
+}
+
+static void phy_write(struct e1000_device *dev, unsigned int reg, u16 val)
+{
+	mmio_write32(dev->mmio + E1000_REG_MDIC,
+		     val | (reg << E1000_MDIC_REGADD_SHFT) |
+		     E1000_MDIC_PHYADD | E1000_MDIC_OP_WRITE);
+	while (!(mmio_read32(dev->mmio + E1000_REG_MDIC) & E1000_MDIC_READY))
+		cpu_relax();
+}
+
+static void read_mac(struct e1000_device *dev)
+{
+	u8 *mac = dev->net.mac;
+	unsigned int n;
+	u32 eerd;
+
+	if (mmio_read32(dev->mmio + E1000_REG_RAH) & E1000_RAH_AV) {
+		*(u32 *)mac = mmio_read32(dev->mmio + E1000_REG_RAL);
+		*(u16 *)&mac[4] = mmio_read32(dev->mmio + E1000_REG_RAH);
+	} else {
+		for (n = 0; n < 3; n++) {
+			mmio_write32(dev->mmio + E1000_REG_EERD,
+				     E1000_EERD_START |
+				     (n << E1000_EERD_ADDR_SHIFT));
+			do {
+				eerd = mmio_read32(dev->mmio + E1000_REG_EERD);
+				cpu_relax();
+			} while (!(eerd & E1000_EERD_DONE));
+			mac[n * 2] = (u8)(eerd >> E1000_EERD_DATA_SHIFT);
+			mac[n * 2 + 1] =
+				(u8)(eerd >> (E1000_EERD_DATA_SHIFT + 8));
+		}
+	}
+
+	mmio_write32(dev->mmio + E1000_REG_RAL, *(u32 *)mac);
+	mmio_write32(dev->mmio + E1000_REG_RAH,
+		     *(u16 *)&mac[4] | E1000_RAH_AV);
+}
+
+static unsigned int e1000_rx_burst(struct net_device *net,
+				   struct net_buf **bufs, unsigned int max)
+{
+	struct e1000_device *dev = (struct e1000_device *)net;
+	unsigned int count = 0, idx = dev->rx_next;
+	struct e1000_rxd *rxd;
+	struct net_buf *buf;
+
+	while (count < max) {
+		rxd = &dev->rx_ring[idx];
+		if (!(rxd->status & E1000_RXD_STAT_DD))
+			break;
+		/* read the descriptor content only after its status */
+		memory_barrier();
+
+		/* no spare buffer or broken frame: recycle the current one */
+		buf = NULL;
+		if ((rxd->status & E1000_RXD_STAT_EOP) && !rxd->errors)
+			buf = net_buf_alloc(net->bufs);
+		if (buf) {
+			dev->rx_bufs[idx]->len = rxd->len;
+			bufs[count++] = dev->rx_bufs[idx];
+			dev->rx_bufs[idx] = buf;
+			rxd->addr = (unsigned long)buf->data;
+		}
+		rxd->status = 0;
+
+		idx = (idx + 1) % E1000_RX_DESCRIPTORS;
+	}
+
+	if (idx != dev->rx_next) {
+		dev->rx_next = idx;
+		/* make the refilled descriptors visible before the tail */
+		memory_barrier();
+		mmio_write32(dev->mmio + E1000_REG_RDT,
+			     (idx + E1000_RX_DESCRIPTORS - 1) %
+			     E1000_RX_DESCRIPTORS);
+	}
+
+	return count;
+}
+
+static void e1000_tx_clean(struct e1000_device *dev)
+{
+	unsigned int idx = dev->tx_clean;
+
+	while (idx != dev->tx_next &&
+	       (dev->tx_ring[idx].status & E1000_TXD_STAT_DD)) {
+		net_buf_free(dev->tx_bufs[idx]);
+		idx = (idx + 1) % E1000_TX_DESCRIPTORS;
+	}
+	dev->tx_clean = idx;
+}
+
+static unsigned int e1000_tx_burst(struct net_device *net,
+				   struct net_buf **bufs, unsigned int num)
+{
+	struct e1000_device *dev = (struct e1000_device *)net;
+	unsigned int count, idx = dev->tx_next;
+	struct e1000_txd *txd;
+
+	e1000_tx_clean(dev);
+
+	for (count = 0; count < num; count++) {
+		if ((idx + 1) % E1000_TX_DESCRIPTORS == dev->tx_clean)
+			break;
+
+		txd = &dev->tx_ring[idx];
+		txd->addr = (unsigned long)bufs[count]->data;
+		txd->len = bufs[count]->len;
+		txd->cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS |
+			E1000_TXD_CMD_RS;
+		txd->status = 0;
+		dev->tx_bufs[idx] = bufs[count];
+
+		idx = (idx + 1) % E1000_TX_DESCRIPTORS;
+	}
+
+	if (count > 0) {
+		dev->tx_next = idx;
+		/* make the descriptors visible before the tail */
+		memory_barrier();
+		mmio_write32(dev->mmio + E1000_REG_TDT, idx);
+	}
+
+	return count;
+}
+
+static bool e1000_irq_enable(struct net_device *net)
+{
+	struct e1000_device *dev = (struct e1000_device *)net;
+
+	mmio_write32(dev->mmio + E1000_REG_IMS,
+		     E1000_INT_RXT0 | E1000_INT_TXDW);
+
+	/* frames that arrived before unmasking may not raise an interrupt */
+	return !(dev->rx_ring[dev->rx_next].status & E1000_RXD_STAT_DD);
+}
+
+static void e1000_irq_disable(struct net_device *net)
+{
+	struct e1000_device *dev = (struct e1000_device *)net;
+
+	mmio_write32(dev->mmio + E1000_REG_IMC, E1000_INT_ALL);
+	/* acknowledge pending causes */
+	mmio_read32(dev->mmio + E1000_REG_ICR);
+}
+
+static const struct net_ops e1000_ops = {
+	.rx_burst = e1000_rx_burst,
+	.tx_burst = e1000_tx_burst,
+	.irq_enable = e1000_irq_enable,
+	.irq_disable = e1000_irq_disable,
+};
+
+/**
+ * Bring up an e1000-family NIC and wait for its link.
+ * @param bdf		BDF of the device.
+ * @param bufs		Pool to allocate receive buffers from. It has to hold
+ * 			more than 64 buffers, the size of the receive ring.
+ * @param vector	Interrupt vector to deliver receive and transmit
+ * 			completion events to, via MSI or MSI-X vector 0, or 0
+ * 			for polling only. The device starts in polling mode
+ * 			regardless, see net_irq_enable().
+ *
+ * @return Network device, NULL if the receive ring could not be filled.
+ */
+struct net_device *net_e1000_init(u16 bdf, struct pool *bufs,
+				  unsigned int vector)
+{
+	struct e1000_device *dev;
+	struct net_buf *buf;
+	unsigned int n;
+	u64 bar;
+	u32 val;
+
+	dev = alloc(sizeof(*dev), sizeof(long));
+	memset(dev, 0, sizeof(*dev));
+	dev->net.ops = &e1000_ops;
+	dev->net.bufs = bufs;
+
+	/* ring sizes must be multiples of 128 bytes */
+	dev->rx_ring = alloc(E1000_RX_DESCRIPTORS * sizeof(struct e1000_rxd),
+			     128);
+	dev->tx_ring = alloc(E1000_TX_DESCRIPTORS * sizeof(struct e1000_txd),
+			     128);
+	memset(dev->tx_ring, 0,
+	       E1000_TX_DESCRIPTORS * sizeof(struct e1000_txd));
+
+	for (n = 0; n < E1000_RX_DESCRIPTORS; n++) {
+		buf = net_buf_alloc(bufs);
+		if (!buf)
+			return NULL;
+		dev->rx_bufs[n] = buf;
+		memset(&dev->rx_ring[n], 0, sizeof(struct e1000_rxd));
+		dev->rx_ring[n].addr = (unsigned long)buf->data;
+	}
+
+	bar = pci_read_config(bdf, PCI_CFG_BAR, 4);
+	if ((bar & 0x6) == 0x4)
+		bar |= (u64)pci_read_config(bdf, PCI_CFG_BAR + 4, 4) << 32;
+	dev->mmio = (void *)(bar & ~0xfUL);
+	map_range(dev->mmio, 128 * 1024, MAP_UNCACHED);
+
+	pci_write_config(bdf, PCI_CFG_COMMAND,
+			 PCI_CMD_MEM | PCI_CMD_MASTER, 2);
+
+	mmio_write32(dev->mmio + E1000_REG_CTRL, E1000_CTRL_RST);
+	delay_us(20000);
+
+	mmio_write32(dev->mmio + E1000_REG_IMC, E1000_INT_ALL);
+	mmio_read32(dev->mmio + E1000_REG_ICR);
+	if (vector != 0) {
+		if (pci_find_cap(bdf, PCI_CAP_MSI) >= 0)
+			pci_msi_set_vector(bdf, vector);
+		else if (pci_find_cap(bdf, PCI_CAP_MSIX) >= 0)
+			pci_msix_set_vector(bdf, vector, 0);
+	}
+
+	val = mmio_read32(dev->mmio + E1000_REG_CTRL);
+	val &= ~(E1000_CTRL_LRST | E1000_CTRL_FRCSPD);
+	val |= E1000_CTRL_SLU;
+	mmio_write32(dev->mmio + E1000_REG_CTRL, val);
+
+	/* power up again in case the previous user turned it off */
+	phy_write(dev, E1000_PHY_CTRL,
+		  phy_read(dev, E1000_PHY_CTRL) & ~E1000_PHYC_POWER_DOWN);
+
+	while (!(mmio_read32(dev->mmio + E1000_REG_STATUS) & E1000_STATUS_LU))
+		cpu_relax();
+
+	val = mmio_read32(dev->mmio + E1000_REG_STATUS) & E1000_STATUS_SPEED;
+	dev->net.speed = speed_info[val >> E1000_STATUS_SPEEDSHFT];
+
+	read_mac(dev);
+
+	mmio_write32(dev->mmio + E1000_REG_RDBAL, (unsigned long)dev->rx_ring);
+	mmio_write32(dev->mmio + E1000_REG_RDBAH,
+		     (u64)(unsigned long)dev->rx_ring >> 32);
+	mmio_write32(dev->mmio + E1000_REG_RDLEN,
+		     E1000_RX_DESCRIPTORS * sizeof(struct e1000_rxd));
+	mmio_write32(dev->mmio + E1000_REG_RDH, 0);
+	mmio_write32(dev->mmio + E1000_REG_RDT, 0);
+	mmio_write32(dev->mmio + E1000_REG_RXDCTL,
+		mmio_read32(dev->mmio + E1000_REG_RXDCTL) |
+		E1000_RXDCTL_ENABLE);
+
+	val = mmio_read32(dev->mmio + E1000_REG_RCTL);
+	val |= E1000_RCTL_EN | E1000_RCTL_BAM | E1000_RCTL_BSIZE_2048 |
+		E1000_RCTL_SECRC;
+	mmio_write32(dev->mmio + E1000_REG_RCTL, val);
+
+	mmio_write32(dev->mmio + E1000_REG_RDT, E1000_RX_DESCRIPTORS - 1);
+
+	mmio_write32(dev->mmio + E1000_REG_TDBAL, (unsigned long)dev->tx_ring);
+	mmio_write32(dev->mmio + E1000_REG_TDBAH,
+		     (u64)(unsigned long)dev->tx_ring >> 32);
+	mmio_write32(dev->mmio + E1000_REG_TDLEN,
+		     E1000_TX_DESCRIPTORS * sizeof(struct e1000_txd));
+	mmio_write32(dev->mmio + E1000_REG_TDH, 0);
+	mmio_write32(dev->mmio + E1000_REG_TDT, 0);
+	mmio_write32(dev->mmio + E1000_REG_TXDCTL,
+		mmio_read32(dev->mmio + E1000_REG_TXDCTL) |
+		E1000_TXDCTL_ENABLE);
+
+	val = mmio_read32(dev->mmio + E1000_REG_TCTL);
+	val |= E1000_TCTL_EN | E1000_TCTL_PSP | E1000_TCTL_CT_DEF |
+		E1000_TCTL_COLD_DEF;
+	mmio_write32(dev->mmio + E1000_REG_TCTL, val);
+	mmio_write32(dev->mmio + E1000_REG_TIPG,
+		     E1000_TIPG_IPGT_DEF | E1000_TIPG_IPGR1_DEF |
+		     E1000_TIPG_IPGR2_DEF);
+
+	return &dev->net;
+}
@@ -0,0 +1,144 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#include <inmate.h>
+#include <net.h>
+
+/*
+ * Network device on top of a pair of ivshmem rings. Only the shared memory
+ * is visible to both cells, so frames are copied into and out of the ring
+ * slots. Sending a batch rings the doorbell at most once.
+ */
+
+struct ivshmem_net {
+	struct net_device net;
+	struct ivshmem_ring *tx, *rx;
+	struct net_buf **rx_bufs;
+	unsigned int rx_count;
+};
+
+static void ivshmem_net_receive(void *arg, const void *data,
+				unsigned int len)
+{
+	struct ivshmem_net *dev = arg;
+	struct net_buf *buf;
+
+	if (len > NET_BUF_DATA_SIZE)
+		return;
+
+	buf = net_buf_alloc(dev->net.bufs);
+	if (!buf)
+		return;
+
+	memcpy(buf->data, data, len);
+	buf->len = len;
+	dev->rx_bufs[dev->rx_count++] = buf;
+}
+
+static unsigned int ivshmem_net_rx_burst(struct net_device *net,
+					 struct net_buf **bufs,
+					 unsigned int max)
+{
+	struct ivshmem_net *dev = (struct ivshmem_net *)net;
+
+	dev->rx_bufs = bufs;
+	dev->rx_count = 0;
+	ivshmem_ring_poll(dev->rx, ivshmem_net_receive, dev, max);
+
+	return dev->rx_count;
+}
+
+static unsigned int ivshmem_net_tx_burst(struct net_device *net,
+					 struct net_buf **bufs,
+					 unsigned int num)
+{
+	struct ivshmem_net *dev = (struct ivshmem_net *)net;
+	unsigned int n;
+
+	for (n = 0; n < num; n++) {
+		if (!ivshmem_ring_send(dev->tx, bufs[n]->data, bufs[n]->len))
+			break;
+		net_buf_free(bufs[n]);
+	}
+	ivshmem_ring_flush(dev->tx);
+
+	return n;
+}
+
+static bool ivshmem_net_irq_enable(struct net_device *net)
+{
+	return ivshmem_ring_arm(((struct ivshmem_net *)net)->rx);
+}
+
+static void ivshmem_net_irq_disable(struct net_device *net)
+{
+	ivshmem_ring_disarm(((struct ivshmem_net *)net)->rx);
+}
+
+static const struct net_ops ivshmem_net_ops = {
+	.rx_burst = ivshmem_net_rx_burst,
+	.tx_burst = ivshmem_net_tx_burst,
+	.irq_enable = ivshmem_net_irq_enable,
+	.irq_disable = ivshmem_net_irq_disable,
+};
+
+/**
+ * Create a network device on top of two ivshmem rings.
+ * @param tx		Ring to send frames to the peer, with a doorbell set
+ * 			up via ivshmem_ring_set_doorbell().
+ * @param rx		Ring to receive frames from the peer.
+ * @param bufs		Pool to allocate receive buffers from.
+ *
+ * The rings should accept messages of NET_BUF_DATA_SIZE bytes. The MAC
+ * address is left zero, the peer is the only station on this link.
+ *
+ * @return Network device.
+ */
+struct net_device *net_ivshmem_init(struct ivshmem_ring *tx,
+				    struct ivshmem_ring *rx,
+				    struct pool *bufs)
+{
+	struct ivshmem_net *dev = alloc(sizeof(*dev), sizeof(long));
+
+	memset(dev, 0, sizeof(*dev));
+	dev->net.ops = &ivshmem_net_ops;
+	dev->net.bufs = bufs;
+	dev->tx = tx;
+	dev->rx = rx;
+
+	return &dev->net;
+}
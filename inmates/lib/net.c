@@ -0,0 +1,76 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#include <inmate.h>
+#include <net.h>
+
+/**
+ * Set up a pool of packet buffers.
+ * @param pool		Pool descriptor to initialize.
+ * @param mem		Memory to carve the buffers from, 64-byte aligned.
+ * @param size		Size of that memory.
+ */
+void net_bufs_init(struct pool *pool, void *mem, unsigned long size)
+{
+	pool_init(pool, mem, NET_BUF_OBJ_SIZE, size / NET_BUF_OBJ_SIZE);
+}
+
+/**
+ * Allocate an empty packet buffer.
+ * @param pool		Pool to allocate from.
+ *
+ * @return Buffer, NULL if the pool is exhausted.
+ */
+struct net_buf *net_buf_alloc(struct pool *pool)
+{
+	struct net_buf *buf = pool_get(pool);
+
+	if (buf) {
+		buf->pool = pool;
+		buf->len = 0;
+	}
+	return buf;
+}
+
+/**
+ * Return a packet buffer to its pool.
+ * @param buf		Buffer to release.
+ */
+void net_buf_free(struct net_buf *buf)
+{
+	pool_put(buf->pool, buf);
+}
@@ -38,12 +38,90 @@
 
 #include <inmate.h>
 
+#define PCI_MAX_CACHED_DEVICES	32
+#define PCI_MAX_CACHED_CAPS	8
+
+/*
+ * Devices found so far. The devices of a cell do not change while it is
+ * running, so every BDF only needs to be probed once.
+ */
+static struct {
+	u16 bdf;
+	u16 vendor;
+	u16 device;
+	/* -1 until the capability list was walked */
+	int num_caps;
+	bool caps_truncated;
+	u8 cap_id[PCI_MAX_CACHED_CAPS];
+	u8 cap_pos[PCI_MAX_CACHED_CAPS];
+} pci_devices[PCI_MAX_CACHED_DEVICES];
+static unsigned int pci_num_devices;
+/* next BDF to probe */
+static unsigned int pci_scan_pos;
+
+/*
+ * Probe for the next device and add it to the cache. Returns its index or -1
+ * if the bus space is exhausted or the cache is full.
+ *
+ * Bridges are not necessarily visible to a cell, and a cell may own a
+ * function of a multi-function device without function 0. Therefore, all
+ * buses and, if function 0 is absent, all functions have to be probed. Only
+ * the other functions of present single-function devices can be skipped.
+ */
+static int pci_probe_next(void)
+{
+	unsigned int bdf, n;
+	u32 id;
+
+	while (pci_scan_pos < 0x10000 &&
+	       pci_num_devices < PCI_MAX_CACHED_DEVICES) {
+		bdf = pci_scan_pos++;
+
+		/* vendor and device ID in one access */
+		id = pci_read_config(bdf, PCI_CFG_VENDOR_ID, 4);
+		if ((id & 0xffff) == PCI_ID_ANY)
+			continue;
+
+		if ((bdf & 0x7) == 0 &&
+		    !(pci_read_config(bdf, PCI_CFG_HEADER_TYPE, 1) &
+		      PCI_HDR_MULTI_FUNC))
+			pci_scan_pos = bdf + 8;
+
+		n = pci_num_devices++;
+		pci_devices[n].bdf = bdf;
+		pci_devices[n].vendor = id & 0xffff;
+		pci_devices[n].device = id >> 16;
+		pci_devices[n].num_caps = -1;
+		return n;
+	}
+	return -1;
+}
+
+static bool pci_device_matches(unsigned int n, u16 vendor, u16 device,
+			       u16 start_bdf)
+{
+	return pci_devices[n].bdf >= start_bdf &&
+		(vendor == PCI_ID_ANY || vendor == pci_devices[n].vendor) &&
+		(device == PCI_ID_ANY || device == pci_devices[n].device);
+}
+
 int pci_find_device(u16 vendor, u16 device, u16 start_bdf)
 {
 	unsigned int bdf;
+	int n;
 	u16 id;
 
-	for (bdf = start_bdf; bdf < 0x10000; bdf++) {
+	for (n = 0; n < pci_num_devices; n++)
+		if (pci_device_matches(n, vendor, device, start_bdf))
+			return pci_devices[n].bdf;
+
+	while ((n = pci_probe_next()) >= 0)
+		if (pci_device_matches(n, vendor, device, start_bdf))
+			return pci_devices[n].bdf;
+
+	/* the cache is full, continue without it */
+	bdf = start_bdf > pci_scan_pos ? start_bdf : pci_scan_pos;
+	for (; bdf < 0x10000; bdf++) {
 		id = pci_read_config(bdf, PCI_CFG_VENDOR_ID, 2);
 		if (id == PCI_ID_ANY || (vendor != PCI_ID_ANY && vendor != id))
 			continue;
@@ -54,7 +132,7 @@ int pci_find_device(u16 vendor, u16 device, u16 start_bdf)
 	return -1;
 }
 
-int pci_find_cap(u16 bdf, u16 cap)
+static int pci_walk_caps(u16 bdf, u16 cap)
 {
 	u8 pos = PCI_CFG_CAP_PTR - 1;
 
@@ -69,3 +147,48 @@ int pci_find_cap(u16 bdf, u16 cap)
 			return pos;
 	}
 }
+
+static void pci_cache_caps(unsigned int n)
+{
+	u16 bdf = pci_devices[n].bdf;
+	u8 pos = PCI_CFG_CAP_PTR - 1;
+	unsigned int c;
+
+	pci_devices[n].num_caps = 0;
+	if (!(pci_read_config(bdf, PCI_CFG_STATUS, 2) & PCI_STS_CAPS))
+		return;
+
+	while (1) {
+		pos = pci_read_config(bdf, pos + 1, 1);
+		if (pos == 0)
+			return;
+		if (pci_devices[n].num_caps == PCI_MAX_CACHED_CAPS) {
+			pci_devices[n].caps_truncated = true;
+			return;
+		}
+		c = pci_devices[n].num_caps++;
+		pci_devices[n].cap_pos[c] = pos;
+		pci_devices[n].cap_id[c] = pci_read_config(bdf, pos, 1);
+	}
+}
+
+int pci_find_cap(u16 bdf, u16 cap)
+{
+	unsigned int n;
+	int c;
+
+	for (n = 0; n < pci_num_devices; n++)
+		if (pci_devices[n].bdf == bdf)
+			break;
+	if (n == pci_num_devices)
+		return pci_walk_caps(bdf, cap);
+
+	if (pci_devices[n].num_caps < 0)
+		pci_cache_caps(n);
+
+	for (c = 0; c < pci_devices[n].num_caps; c++)
+		if (pci_devices[n].cap_id[c] == cap)
+			return pci_devices[n].cap_pos[c];
+
+	return pci_devices[n].caps_truncated ? pci_walk_caps(bdf, cap) : -1;
+}
@@ -46,9 +46,38 @@
 
 static struct uart_chip *chip;
 static bool virtual_console;
+static struct jailhouse_comm_console *console_ring;
+
+static void console_ring_putc(char c)
+{
+	console_ring->content[console_ring->tail %
+			      JAILHOUSE_COMM_CONSOLE_SIZE] = c;
+	/* make the character visible before the tail covers it */
+	memory_barrier();
+	console_ring->tail++;
+}
+
+/* Inmates run with identity mapping, so msg is also guest-physical. */
+static void console_puts(const char *msg)
+{
+	unsigned long len = strlen(msg);
+	int written;
+
+	while (len > 0) {
+		written = (int)jailhouse_call_arg2(
+				JAILHOUSE_HC_DEBUG_CONSOLE_PUTS,
+				(unsigned long)msg, len);
+		if (written <= 0)
+			break;
+		msg += written;
+		len -= written;
+	}
+}
 
 static void console_write(const char *msg)
 {
+	const char *start = msg;
+	unsigned int pending = 0;
 	char c = 0;
 
 	if (!chip && !virtual_console)
@@ -68,9 +97,19 @@ static void console_write(const char *msg)
 			chip->write(chip, c);
 		}
 
-		if (virtual_console)
-			jailhouse_call_arg1(JAILHOUSE_HC_DEBUG_CONSOLE_PUTC, c);
+		if (console_ring) {
+			console_ring_putc(c);
+			if (++pending == JAILHOUSE_COMM_CONSOLE_SIZE) {
+				jailhouse_call(JAILHOUSE_HC_DEBUG_CONSOLE_FLUSH);
+				pending = 0;
+			}
+		}
 	}
+
+	if (pending)
+		jailhouse_call(JAILHOUSE_HC_DEBUG_CONSOLE_FLUSH);
+	else if (virtual_console && !console_ring)
+		console_puts(start);
 }
 
 static void console_init(void)
@@ -84,6 +123,10 @@ static void console_init(void)
 	if (JAILHOUSE_COMM_HAS_DBG_PUTC_PERMITTED(comm_region->flags))
 		virtual_console = cmdline_parse_bool("con-virtual",
 			JAILHOUSE_COMM_HAS_DBG_PUTC_ACTIVE(comm_region->flags));
+	if (virtual_console &&
+	    JAILHOUSE_COMM_HAS_CONSOLE_RING(comm_region->flags))
+		console_ring = (void *)comm_region +
+			JAILHOUSE_COMM_CONSOLE_OFFSET;
 
 	type = cmdline_parse_str("con-type", buf, sizeof(buf), "");
 	for (c = uart_array; *c; c++)
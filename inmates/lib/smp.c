@@ -0,0 +1,186 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <inmate.h>
+
+/*
+ * Work distribution among the CPUs of an SMP inmate: Each CPU owns a queue
+ * of work items. The owner takes the most recently queued item, idle CPUs
+ * steal the oldest one from the queues of others. Work items may queue
+ * further work. A global counter tracks items that are queued or running so
+ * that all CPUs know when everything is done.
+ */
+
+#define WORK_QUEUE_SIZE		256
+
+struct work {
+	work_func_t func;
+	void *arg;
+};
+
+struct work_queue {
+	struct spinlock lock;
+	unsigned int head, tail;
+	struct work items[WORK_QUEUE_SIZE];
+} __attribute__((aligned(SMP_CACHE_LINE)));
+
+static struct work_queue *work_queues;
+static unsigned int work_pending;
+
+void smp_barrier_init(struct smp_barrier *barrier, unsigned int num_cpus)
+{
+	barrier->num_cpus = num_cpus;
+	barrier->arrived = 0;
+	barrier->generation = 0;
+}
+
+void smp_barrier_wait(struct smp_barrier *barrier)
+{
+	unsigned int generation =
+		__atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE);
+
+	if (__atomic_add_fetch(&barrier->arrived, 1, __ATOMIC_ACQ_REL) ==
+	    barrier->num_cpus) {
+		barrier->arrived = 0;
+		__atomic_store_n(&barrier->generation, generation + 1,
+				 __ATOMIC_RELEASE);
+	} else {
+		while (__atomic_load_n(&barrier->generation,
+				       __ATOMIC_ACQUIRE) == generation)
+			cpu_relax();
+	}
+}
+
+static bool dequeue_work(struct work_queue *queue, bool steal,
+			 struct work *work)
+{
+	bool found = false;
+
+	/* avoid bouncing the lock of empty queues */
+	if (__atomic_load_n(&queue->head, __ATOMIC_RELAXED) ==
+	    __atomic_load_n(&queue->tail, __ATOMIC_RELAXED))
+		return false;
+
+	spin_lock(&queue->lock);
+	if (queue->head != queue->tail) {
+		if (steal)
+			*work = queue->items[queue->head++ % WORK_QUEUE_SIZE];
+		else
+			*work = queue->items[--queue->tail % WORK_QUEUE_SIZE];
+		found = true;
+	}
+	spin_unlock(&queue->lock);
+
+	return found;
+}
+
+static bool find_work(unsigned int cpu, struct work *work)
+{
+	unsigned int n;
+
+	if (dequeue_work(&work_queues[cpu], false, work))
+		return true;
+
+	for (n = 1; n < smp_num_cpus; n++)
+		if (dequeue_work(&work_queues[(cpu + n) % smp_num_cpus], true,
+				 work))
+			return true;
+
+	return false;
+}
+
+/**
+ * Queue a work item on the given CPU. Returns false if the queue is full.
+ */
+bool smp_queue_work(unsigned int cpu, work_func_t func, void *arg)
+{
+	struct work_queue *queue = &work_queues[cpu];
+	bool queued = false;
+
+	spin_lock(&queue->lock);
+	if (queue->tail - queue->head < WORK_QUEUE_SIZE) {
+		queue->items[queue->tail % WORK_QUEUE_SIZE].func = func;
+		queue->items[queue->tail % WORK_QUEUE_SIZE].arg = arg;
+		queue->tail++;
+		__atomic_add_fetch(&work_pending, 1, __ATOMIC_RELAXED);
+		queued = true;
+	}
+	spin_unlock(&queue->lock);
+
+	return queued;
+}
+
+/**
+ * Run work items, stealing from other CPUs if the own queue is empty, until
+ * no work is left in the system.
+ */
+void smp_process_work(void)
+{
+	unsigned int cpu = smp_processor_id();
+	struct work work;
+
+	while (__atomic_load_n(&work_pending, __ATOMIC_ACQUIRE) > 0) {
+		if (!find_work(cpu, &work)) {
+			cpu_relax();
+			continue;
+		}
+		work.func(work.arg);
+		__atomic_sub_fetch(&work_pending, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void worker_main(void)
+{
+	while (1) {
+		while (__atomic_load_n(&work_pending, __ATOMIC_ACQUIRE) == 0)
+			cpu_relax();
+		smp_process_work();
+	}
+}
+
+/**
+ * Set up the work queues and let all secondary CPUs process work. Requires
+ * smp_wait_for_all_cpus() to be called first. The calling CPU contributes
+ * via smp_process_work().
+ */
+void smp_start_workers(void)
+{
+	work_queues = alloc(smp_num_cpus * sizeof(struct work_queue),
+			    SMP_CACHE_LINE);
+	memset(work_queues, 0, smp_num_cpus * sizeof(struct work_queue));
+
+	smp_start_all_cpus(worker_main);
+}
@@ -43,29 +43,70 @@ static inline int tolower(int c)
    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
 }
 
+/*
+ * Generic versions, working on longs where source and destination allow it.
+ * Architectures may provide optimized ones, see ARCH_HAS_MEMCPY and
+ * ARCH_HAS_MEMSET. All accesses are naturally aligned, so this is also usable
+ * before the MMU is enabled.
+ */
+#define LONG_ALIGNED(x)	(((unsigned long)(x) % sizeof(long)) == 0)
+
+#ifndef ARCH_HAS_MEMCPY
 void *memcpy(void *dest, const void *src, unsigned long n)
 {
 	const u8 *s = src;
 	u8 *d = dest;
 
+	if (LONG_ALIGNED((unsigned long)d ^ (unsigned long)s)) {
+		for (; !LONG_ALIGNED(d) && n > 0; n--)
+			*d++ = *s++;
+		for (; n >= sizeof(long); n -= sizeof(long)) {
+			*(unsigned long *)d = *(const unsigned long *)s;
+			d += sizeof(long);
+			s += sizeof(long);
+		}
+	}
 	while (n-- > 0)
 		*d++ = *s++;
 	return dest;
 }
+#endif
 
+#ifndef ARCH_HAS_MEMSET
 void *memset(void *s, int c, unsigned long n)
 {
+	unsigned long pattern = (u8)c * (~0UL / 0xff);
 	u8 *p = s;
 
+	for (; !LONG_ALIGNED(p) && n > 0; n--)
+		*p++ = c;
+	for (; n >= sizeof(long); n -= sizeof(long)) {
+		*(unsigned long *)p = pattern;
+		p += sizeof(long);
+	}
 	while (n-- > 0)
 		*p++ = c;
 	return s;
 }
+#endif
 
 int memcmp(const void *s1, const void *s2, unsigned long n)
 {
 	const unsigned char *_s1 = s1, *_s2 = s2;
 
+	/* skip equal longs, the bytes of the first different one decide */
+	if (LONG_ALIGNED((unsigned long)_s1 ^ (unsigned long)_s2)) {
+		for (; !LONG_ALIGNED(_s1) && n > 0; n--, _s1++, _s2++)
+			if (*_s1 != *_s2)
+				return *_s1 < *_s2 ? -1 : 1;
+		for (; n >= sizeof(long); n -= sizeof(long)) {
+			if (*(const unsigned long *)_s1 !=
+			    *(const unsigned long *)_s2)
+				break;
+			_s1 += sizeof(long);
+			_s2 += sizeof(long);
+		}
+	}
 	while (n-- > 0)
 		if (*_s1++ != *_s2++)
 			return _s1[-1] < _s2[-1] ? -1 : 1;
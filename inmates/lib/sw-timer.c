@@ -0,0 +1,221 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#include <inmate.h>
+
+/*
+ * Software timers, kept in a binary min-heap ordered by expiry. Only the
+ * earliest expiry is programmed into the hardware one-shot timer (TSC
+ * deadline or APIC timer on x86, generic timer on ARM), so there is no
+ * periodic tick. Starting and cancelling a timer costs O(log n).
+ *
+ * The timer interrupt has to be set up by the caller, and its handler has to
+ * invoke sw_timers_expired(). Timers may be started and cancelled from the
+ * main context, with interrupts enabled, or from timer callbacks.
+ */
+
+#define SW_TIMERS_MAX		64
+#define NOT_QUEUED		((unsigned int)-1)
+
+static struct sw_timer *heap[SW_TIMERS_MAX];
+static unsigned int num_timers;
+static bool in_expiry;
+
+static inline bool before(struct sw_timer *a, struct sw_timer *b)
+{
+	return (s64)(a->expiry - b->expiry) < 0;
+}
+
+static void heap_set(unsigned int index, struct sw_timer *timer)
+{
+	heap[index] = timer;
+	timer->index = index;
+}
+
+static void sift_up(unsigned int index)
+{
+	struct sw_timer *timer = heap[index];
+	unsigned int parent;
+
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (!before(timer, heap[parent]))
+			break;
+		heap_set(index, heap[parent]);
+		index = parent;
+	}
+	heap_set(index, timer);
+}
+
+static void sift_down(unsigned int index)
+{
+	struct sw_timer *timer = heap[index];
+	unsigned int child;
+
+	while ((child = 2 * index + 1) < num_timers) {
+		if (child + 1 < num_timers &&
+		    before(heap[child + 1], heap[child]))
+			child++;
+		if (!before(heap[child], timer))
+			break;
+		heap_set(index, heap[child]);
+		index = child;
+	}
+	heap_set(index, timer);
+}
+
+static void heap_remove(struct sw_timer *timer)
+{
+	unsigned int index = timer->index;
+
+	timer->index = NOT_QUEUED;
+	if (--num_timers == index)
+		return;
+
+	heap_set(index, heap[num_timers]);
+	if (index > 0 && before(heap[index], heap[(index - 1) / 2]))
+		sift_up(index);
+	else
+		sift_down(index);
+}
+
+static void program_next(void)
+{
+	u64 now = arch_latency_now();
+
+	if (num_timers == 0)
+		return;
+	if ((s64)(heap[0]->expiry - now) <= 0)
+		arch_latency_set_timer(1);
+	else
+		arch_latency_set_timer(heap[0]->expiry - now);
+}
+
+static void lock_timers(void)
+{
+	if (!in_expiry)
+		arch_disable_irqs();
+}
+
+static void unlock_timers(void)
+{
+	if (!in_expiry)
+		arch_enable_irqs();
+}
+
+void sw_timers_init(void)
+{
+	arch_latency_init();
+	num_timers = 0;
+}
+
+/**
+ * Start or restart a timer.
+ * @param timer		Timer to start.
+ * @param func		Callback, invoked from the timer interrupt.
+ * @param delay_ns	Delay until the first expiry.
+ * @param period_ns	Interval of the following expiries, 0 for a one-shot.
+ *
+ * Silently ignores the request if SW_TIMERS_MAX timers are already active.
+ */
+void sw_timer_start(struct sw_timer *timer, sw_timer_func_t func,
+		    unsigned long delay_ns, unsigned long period_ns)
+{
+	lock_timers();
+
+	if (timer->index < num_timers && heap[timer->index] == timer)
+		heap_remove(timer);
+
+	if (num_timers < SW_TIMERS_MAX) {
+		timer->func = func;
+		timer->period = arch_latency_from_ns(period_ns);
+		timer->expiry = arch_latency_now() +
+			arch_latency_from_ns(delay_ns);
+
+		heap_set(num_timers++, timer);
+		sift_up(timer->index);
+
+		/* no need to reprogram while callbacks are running */
+		if (!in_expiry && heap[0] == timer)
+			program_next();
+	}
+
+	unlock_timers();
+}
+
+void sw_timer_cancel(struct sw_timer *timer)
+{
+	lock_timers();
+	if (timer->index < num_timers && heap[timer->index] == timer)
+		heap_remove(timer);
+	unlock_timers();
+}
+
+/**
+ * Run the callbacks of all expired timers and program the next expiry.
+ *
+ * Periodic timers are re-armed relative to their previous expiry, so they do
+ * not drift. Periods that were missed completely are skipped.
+ */
+void sw_timers_expired(void)
+{
+	struct sw_timer *timer;
+	u64 now = arch_latency_now();
+
+	in_expiry = true;
+
+	while (num_timers > 0 && (s64)(heap[0]->expiry - now) <= 0) {
+		timer = heap[0];
+		heap_remove(timer);
+
+		if (timer->period > 0) {
+			do
+				timer->expiry += timer->period;
+			while ((s64)(timer->expiry - now) <= 0);
+
+			heap_set(num_timers++, timer);
+			sift_up(timer->index);
+		}
+
+		timer->func(timer);
+		now = arch_latency_now();
+	}
+
+	in_expiry = false;
+
+	program_next();
+}
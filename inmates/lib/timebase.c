@@ -0,0 +1,72 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+/**
+ * Read the time shared by the root cell via a timebase region.
+ * @param timebase	Address of the JAILHOUSE_MEM_TIMEBASE region.
+ *
+ * @return Nanoseconds since the epoch of the root cell's wall clock, 0 if no
+ * timebase was published yet.
+ */
+u64 timebase_read_ns(const struct jailhouse_timebase *timebase)
+{
+	const volatile struct jailhouse_timebase *tb = timebase;
+	u64 cycle_last, base_ns, delta;
+	u32 seq, mult, shift;
+
+	do {
+		while ((seq = tb->seq) & 1)
+			cpu_relax();
+		if (seq == 0)
+			return 0;
+		memory_barrier();
+
+		mult = tb->mult;
+		shift = tb->shift;
+		cycle_last = tb->cycle_last;
+		base_ns = tb->base_ns;
+		delta = arch_timebase_counter() - cycle_last;
+
+		memory_barrier();
+	} while (tb->seq != seq);
+
+	/* counter values from before the update are not extrapolated back */
+	if ((s64)delta < 0)
+		delta = 0;
+
+	return base_ns + ((delta * mult) >> shift);
+}
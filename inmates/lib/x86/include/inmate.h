@@ -57,6 +57,8 @@
 #define HUGE_PAGE_MASK		(~(HUGE_PAGE_SIZE - 1))
 
 #define X2APIC_ID		0x802
+#define X2APIC_EOI		0x80b
+# define APIC_EOI_ACK		0
 #define X2APIC_ICR		0x830
 
 #define APIC_LVL_ASSERT		(1 << 14)
@@ -71,6 +73,8 @@
 #define PCI_CFG_STATUS		0x006
 # define PCI_STS_INT		(1 << 3)
 # define PCI_STS_CAPS		(1 << 4)
+#define PCI_CFG_HEADER_TYPE	0x00e
+# define PCI_HDR_MULTI_FUNC	0x80
 #define PCI_CFG_BAR		0x010
 # define PCI_BAR_64BIT		0x4
 #define PCI_CFG_CAP_PTR		0x034
@@ -87,6 +91,10 @@
 
 #define SMP_MAX_CPUS		255
 
+/* see string.c */
+#define ARCH_HAS_MEMCPY
+#define ARCH_HAS_MEMSET
+
 #ifndef __ASSEMBLY__
 typedef signed char s8;
 typedef unsigned char u8;
@@ -105,11 +113,21 @@ static inline void arch_disable_irqs(void)
 	asm volatile("cli");
 }
 
+static inline void arch_enable_irqs(void)
+{
+	asm volatile("sti");
+}
+
 static inline void cpu_relax(void)
 {
 	asm volatile("rep; nop" : : : "memory");
 }
 
+static inline void memory_barrier(void)
+{
+	asm volatile("mfence" : : : "memory");
+}
+
 static inline void __attribute__((noreturn)) halt(void)
 {
 	while (1)
@@ -220,8 +238,27 @@ static inline unsigned int cpu_id(void)
 
 typedef void(*int_handler_t)(void);
 
+struct int_frame;
+typedef void(*int_fast_handler_t)(struct int_frame *frame);
+
+/*
+ * Handler to be installed via int_set_fast_handler. It is entered directly
+ * from the IDT, saves only the registers it uses and has to acknowledge the
+ * interrupt via int_eoi itself. As SSE registers are not saved, the compiler
+ * is restricted to general purpose registers inside the handler.
+ */
+#define DEFINE_FAST_INT_HANDLER(name)					\
+	void __attribute__((interrupt, target("general-regs-only")))	\
+	name(struct int_frame *frame)
+
+static inline void int_eoi(void)
+{
+	write_msr(X2APIC_EOI, APIC_EOI_ACK);
+}
+
 void int_init(void);
 void int_set_handler(unsigned int vector, int_handler_t handler);
+void int_set_fast_handler(unsigned int vector, int_fast_handler_t handler);
 void int_send_ipi(unsigned int cpu_id, unsigned int vector);
 
 enum ioapic_trigger_mode {
@@ -239,6 +276,8 @@ void hypercall_init(void);
 
 unsigned long pm_timer_read(void);
 
+u64 tsc_read(void);
+u64 tsc_ticks_to_ns(u64 ticks);
 unsigned long tsc_read_ns(void);
 unsigned long tsc_init(void);
 
@@ -255,10 +294,15 @@ int pci_find_cap(u16 bdf, u16 cap);
 void pci_msi_set_vector(u16 bdf, unsigned int vector);
 void pci_msix_set_vector(u16 bdf, unsigned int vector, u32 index);
 
+struct ivshmem_device;
+int ivshmem_pci_init(struct ivshmem_device *dev, u16 start_bdf,
+		     unsigned int vector);
+
 extern volatile u32 smp_num_cpus;
 extern u8 smp_cpu_ids[SMP_MAX_CPUS];
 void smp_wait_for_all_cpus(void);
 void smp_start_cpu(unsigned int cpu_id, void (*entry)(void));
+void smp_start_all_cpus(void (*entry)(void));
 #endif
 
 #include <inmate_common.h>
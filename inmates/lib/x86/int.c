@@ -40,11 +40,8 @@
 
 #define NUM_IDT_DESC		64
 
-#define X2APIC_EOI		0x80b
 #define X2APIC_SPIV		0x80f
 
-#define APIC_EOI_ACK		0
-
 struct desc_table_reg {
 	u16 limit;
 	u64 base;
@@ -74,20 +71,31 @@ void int_init(void)
 static void __attribute__((used)) handle_interrupt(unsigned int vector)
 {
 	int_handler[vector]();
-	write_msr(X2APIC_EOI, APIC_EOI_ACK);
+	int_eoi();
 }
 
-void int_set_handler(unsigned int vector, int_handler_t handler)
+static void set_idt_entry(unsigned int vector, unsigned long entry)
 {
-	unsigned long entry = (unsigned long)irq_entry + vector * 16;
-
-	int_handler[vector] = handler;
-
 	idt[vector * 4] = (entry & 0xffff) | (INMATE_CS64 << 16);
 	idt[vector * 4 + 1] = 0x8e00 | (entry & 0xffff0000);
 	idt[vector * 4 + 2] = entry >> 32;
 }
 
+void int_set_handler(unsigned int vector, int_handler_t handler)
+{
+	int_handler[vector] = handler;
+	set_idt_entry(vector, (unsigned long)irq_entry + vector * 16);
+}
+
+/*
+ * Bypass the common entry path: no vector lookup, no indirect call and no
+ * saving of registers the handler does not touch.
+ */
+void int_set_fast_handler(unsigned int vector, int_fast_handler_t handler)
+{
+	set_idt_entry(vector, (unsigned long)handler);
+}
+
 #ifdef __x86_64__
 asm(
 ".macro irq_prologue vector\n\t"
@@ -0,0 +1,96 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#define IVSHMEM_CFG_SHMEM_PTR	0x40
+#define IVSHMEM_CFG_SHMEM_SZ	0x48
+
+static u64 pci_cfg_read64(u16 bdf, unsigned int addr)
+{
+	return ((u64)pci_read_config(bdf, addr + 4, 4) << 32) |
+		pci_read_config(bdf, addr, 4);
+}
+
+static void pci_cfg_write64(u16 bdf, unsigned int addr, u64 val)
+{
+	pci_write_config(bdf, addr + 4, (u32)(val >> 32), 4);
+	pci_write_config(bdf, addr, (u32)val, 4);
+}
+
+/**
+ * Find and set up an ivshmem device.
+ * @param dev		Device descriptor to fill.
+ * @param start_bdf	BDF to start the search at.
+ * @param vector	Interrupt vector to deliver doorbells to, via MSI-X
+ * 			vector 0 of the device.
+ *
+ * The register and MSI-X BARs are placed right after the shared memory.
+ *
+ * @return BDF of the device, -1 if none was found.
+ */
+int ivshmem_pci_init(struct ivshmem_device *dev, u16 start_bdf,
+		     unsigned int vector)
+{
+	void *msix_table;
+	int bdf;
+
+	bdf = pci_find_device(IVSHMEM_VENDOR_ID, IVSHMEM_DEVICE_ID, start_bdf);
+	if (bdf < 0)
+		return -1;
+
+	dev->bdf = bdf;
+	dev->shmem_size = pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_SZ);
+	dev->shmem = (void *)pci_cfg_read64(bdf, IVSHMEM_CFG_SHMEM_PTR);
+
+	dev->registers = (void *)(((unsigned long)dev->shmem +
+				   dev->shmem_size + PAGE_SIZE - 1) &
+				  PAGE_MASK);
+	pci_cfg_write64(bdf, PCI_CFG_BAR, (unsigned long)dev->registers);
+	msix_table = dev->registers + PAGE_SIZE;
+	pci_cfg_write64(bdf, PCI_CFG_BAR + 16, (unsigned long)msix_table);
+
+	pci_write_config(bdf, PCI_CFG_COMMAND, PCI_CMD_MEM | PCI_CMD_MASTER,
+			 2);
+	map_range(dev->shmem, dev->shmem_size, MAP_UNCACHED);
+	map_range(dev->registers, 2 * PAGE_SIZE, MAP_UNCACHED);
+
+	dev->id = mmio_read32(dev->registers + IVSHMEM_REG_IVPOS);
+
+	if (pci_find_cap(bdf, PCI_CAP_MSIX) >= 0)
+		pci_msix_set_vector(bdf, vector, 0);
+
+	return bdf;
+}
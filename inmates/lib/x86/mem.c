@@ -40,47 +40,99 @@
 
 #define PG_PRESENT	0x01
 #define PG_RW		0x02
-#define PG_PS		0x80
+#define PG_PWT		0x08
 #define PG_PCD		0x10
+#define PG_PS		0x80
+#define PG_NX		(1UL << 63)
+
+/* PWT selects PAT entry 1 which header.S programs to write-combining */
+#define PG_WC		PG_PWT
+
+#define GIGA_PAGE_SIZE	(1UL << 30)
+#define GIGA_PAGE_MASK	(~(GIGA_PAGE_SIZE - 1))
+
+#define MSR_EFER	0xc0000080
+#define EFER_NXE	0x00000800
+
+#define X86_FEATURE_GBPAGES	(1 << 26)
+
+#ifdef __x86_64__
+static int gbpages = -1;
+
+static bool has_gbpages(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (gbpages < 0) {
+		asm volatile("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+			: "a" (0x80000001), "c" (0));
+		gbpages = !!(edx & X86_FEATURE_GBPAGES);
+	}
+	return gbpages;
+}
+
+static unsigned long *get_table(unsigned long *pt_entry)
+{
+	unsigned long *pt, n;
+
+	if ((*pt_entry & (PG_PRESENT | PG_PS)) == PG_PRESENT)
+		return (unsigned long *)(*pt_entry & PAGE_MASK & ~PG_NX);
+
+	pt = alloc(PAGE_SIZE, PAGE_SIZE);
+	if (*pt_entry & PG_PRESENT) {
+		/* split a 1G page up into 2M pages with the same attributes */
+		for (n = 0; n < PAGE_SIZE / sizeof(*pt); n++)
+			pt[n] = *pt_entry + n * HUGE_PAGE_SIZE;
+	} else {
+		memset(pt, 0, PAGE_SIZE);
+	}
+	*pt_entry = (unsigned long)pt | PG_RW | PG_PRESENT;
+
+	return pt;
+}
+#endif
 
 void map_range(void *start, unsigned long size, enum map_type map_type)
 {
-	unsigned long pt_addr, *pt_entry, *pt;
-	unsigned long vaddr = (unsigned long)start;
+	unsigned long vaddr = (unsigned long)start & HUGE_PAGE_MASK;
+	unsigned long end = (unsigned long)start + size;
+	unsigned long pt_addr, *pt_entry, *pt, flags;
 
 	asm volatile("mov %%cr3,%0" : "=r" (pt_addr));
 
-	size += (vaddr & ~HUGE_PAGE_MASK) + HUGE_PAGE_SIZE - 1;
-	size &= HUGE_PAGE_MASK;
-	while (size > 0) {
+	flags = PG_RW | PG_PRESENT;
+	if (map_type == MAP_UNCACHED)
+		flags |= PG_PCD;
+	else if (map_type == MAP_WRITE_COMBINE)
+		flags |= PG_WC;
+	/* device and buffer mappings never contain code */
+	if (map_type != MAP_CACHED && (read_msr(MSR_EFER) & EFER_NXE))
+		flags |= PG_NX;
+
+	while (vaddr < end) {
 #ifdef __x86_64__
-		pt_addr &= PAGE_MASK;
-		pt = (unsigned long *)pt_addr;
-
-		pt_entry = &pt[(vaddr >> 39) & 0x1ff];
-		if (*pt_entry & PG_PRESENT) {
-			pt = (unsigned long *)(*pt_entry & PAGE_MASK);
-		} else {
-			pt = alloc(PAGE_SIZE, PAGE_SIZE);
-			*pt_entry = (unsigned long)pt | PG_RW | PG_PRESENT;
-		}
+		pt = (unsigned long *)(pt_addr & PAGE_MASK);
+		pt = get_table(&pt[(vaddr >> 39) & 0x1ff]);
 
 		pt_entry = &pt[(vaddr >> 30) & 0x1ff];
-		if (*pt_entry & PG_PRESENT) {
-			pt = (unsigned long *)(*pt_entry & PAGE_MASK);
-		} else {
-			pt = alloc(PAGE_SIZE, PAGE_SIZE);
-			*pt_entry = (unsigned long)pt | PG_RW | PG_PRESENT;
+		if (has_gbpages() && (vaddr & ~GIGA_PAGE_MASK) == 0 &&
+		    end - vaddr >= GIGA_PAGE_SIZE &&
+		    (*pt_entry & (PG_PRESENT | PG_PS)) != PG_PRESENT) {
+			*pt_entry = vaddr | flags | PG_PS;
+			vaddr += GIGA_PAGE_SIZE;
+			continue;
 		}
+		pt = get_table(pt_entry);
 
 		pt_entry = &pt[(vaddr >> 21) & 0x1ff];
-		*pt_entry = (vaddr & HUGE_PAGE_MASK) |
-			(map_type == MAP_UNCACHED ? PG_PCD : 0) |
-			PG_PS | PG_RW | PG_PRESENT;
+		*pt_entry = (vaddr & HUGE_PAGE_MASK) | flags | PG_PS;
 #else
 #error not yet implemented
 #endif
-		size -= HUGE_PAGE_SIZE;
 		vaddr += HUGE_PAGE_SIZE;
 	}
+
+	/* flush stale translations in case existing entries were changed */
+	asm volatile("mov %0,%%cr3" : : "r" (pt_addr) : "memory");
 }
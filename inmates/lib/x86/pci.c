@@ -43,8 +43,53 @@
 
 #define PCI_CONE		(1 << 31)
 
+#define PCI_MMCFG_BUS_SIZE	0x100000UL
+
+static void *mmcfg_base;
+static unsigned int mmcfg_end_bus;
+static bool mmcfg_checked;
+
+/*
+ * Return the MMCONFIG address of a config space register or NULL if the
+ * register has to be accessed via the config ports. MMCONFIG accesses take a
+ * single trap, the ports two. The first call must not race with others.
+ */
+static void *pci_mmcfg_address(u16 bdf, unsigned int addr)
+{
+	if (!mmcfg_checked) {
+		mmcfg_checked = true;
+		if (comm_region->pci_mmconfig_base) {
+			mmcfg_base = (void *)(unsigned long)
+				comm_region->pci_mmconfig_base;
+			mmcfg_end_bus = comm_region->pci_mmconfig_end_bus;
+			map_range(mmcfg_base,
+				  (mmcfg_end_bus + 1) * PCI_MMCFG_BUS_SIZE,
+				  MAP_UNCACHED);
+		}
+	}
+
+	if (!mmcfg_base || (bdf >> 8) > mmcfg_end_bus)
+		return NULL;
+	return mmcfg_base + ((unsigned long)bdf << 12) + addr;
+}
+
 u32 pci_read_config(u16 bdf, unsigned int addr, unsigned int size)
 {
+	void *mmcfg_addr = pci_mmcfg_address(bdf, addr);
+
+	if (mmcfg_addr) {
+		switch (size) {
+		case 1:
+			return mmio_read8(mmcfg_addr);
+		case 2:
+			return mmio_read16(mmcfg_addr);
+		case 4:
+			return mmio_read32(mmcfg_addr);
+		default:
+			return -1;
+		}
+	}
+
 	outl(PCI_CONE | ((u32)bdf << 8) | (addr & 0xfc), PCI_REG_ADDR_PORT);
 	switch (size) {
 	case 1:
@@ -60,6 +105,23 @@ u32 pci_read_config(u16 bdf, unsigned int addr, unsigned int size)
 
 void pci_write_config(u16 bdf, unsigned int addr, u32 value, unsigned int size)
 {
+	void *mmcfg_addr = pci_mmcfg_address(bdf, addr);
+
+	if (mmcfg_addr) {
+		switch (size) {
+		case 1:
+			mmio_write8(mmcfg_addr, value);
+			break;
+		case 2:
+			mmio_write16(mmcfg_addr, value);
+			break;
+		case 4:
+			mmio_write32(mmcfg_addr, value);
+			break;
+		}
+		return;
+	}
+
 	outl(PCI_CONE | ((u32)bdf << 8) | (addr & 0xfc), PCI_REG_ADDR_PORT);
 	switch (size) {
 	case 1:
@@ -38,29 +38,81 @@
 
 #include <inmate.h>
 
-#define APIC_DM_INIT	(5 << 8)
-#define APIC_DM_SIPI	(6 << 8)
+#define APIC_DM_INIT		(5 << 8)
+#define APIC_DM_SIPI		(6 << 8)
+#define APIC_SH_ALL_BUT_SELF	(3 << 18)
 
 extern void (* volatile ap_entry)(void);
+extern volatile u32 ap_started;
+
+/* logical CPU number by APIC ID */
+static u8 cpu_index[256];
+/* stack of each started CPU by APIC ID, the boot stack is in use */
+void *ap_stacks[256];
 
 void smp_wait_for_all_cpus(void)
 {
+	unsigned int n;
+
 	while (smp_num_cpus < comm_region->num_cpus)
 		cpu_relax();
+
+	for (n = 0; n < smp_num_cpus; n++)
+		cpu_index[smp_cpu_ids[n]] = n;
 }
 
-void smp_start_cpu(unsigned int cpu_id, void (*entry)(void))
+unsigned int smp_processor_id(void)
+{
+	return cpu_index[cpu_id() & 0xff];
+}
+
+static void prepare_stack(unsigned int cpu_id)
+{
+	if (!ap_stacks[cpu_id])
+		ap_stacks[cpu_id] = (u8 *)alloc(PAGE_SIZE, PAGE_SIZE) +
+			PAGE_SIZE;
+}
+
+static void start_cpus(u64 icr, void (*entry)(void), unsigned int num)
 {
-	u64 base_val = ((u64)cpu_id << 32) | APIC_LVL_ASSERT;
+	u32 started = ap_started;
 
 	ap_entry = entry;
 
-	write_msr(X2APIC_ICR, base_val | APIC_DM_INIT);
-	delay_us(10000);
-	write_msr(X2APIC_ICR, base_val | APIC_DM_SIPI);
-	delay_us(200);
-	write_msr(X2APIC_ICR, base_val | APIC_DM_SIPI);
+	write_msr(X2APIC_ICR, icr | APIC_DM_INIT);
+	if (JAILHOUSE_COMM_HAS_SYNC_INIT(comm_region->flags)) {
+		/* the hypervisor returns when the targets await the SIPI */
+		write_msr(X2APIC_ICR, icr | APIC_DM_SIPI);
+	} else {
+		delay_us(10000);
+		write_msr(X2APIC_ICR, icr | APIC_DM_SIPI);
+		delay_us(200);
+		write_msr(X2APIC_ICR, icr | APIC_DM_SIPI);
+	}
 
-	while (ap_entry != NULL)
+	while (ap_started - started < num)
 		cpu_relax();
+	ap_entry = NULL;
+}
+
+void smp_start_cpu(unsigned int cpu_id, void (*entry)(void))
+{
+	prepare_stack(cpu_id & 0xff);
+	start_cpus(((u64)cpu_id << 32) | APIC_LVL_ASSERT, entry, 1);
+}
+
+/**
+ * Start all CPUs except the caller in parallel, using a broadcast IPI.
+ * Requires smp_wait_for_all_cpus() to be called first.
+ */
+void smp_start_all_cpus(void (*entry)(void))
+{
+	unsigned int n;
+
+	for (n = 0; n < smp_num_cpus; n++)
+		if (smp_cpu_ids[n] != (cpu_id() & 0xff))
+			prepare_stack(smp_cpu_ids[n]);
+
+	start_cpus(APIC_SH_ALL_BUT_SELF | APIC_LVL_ASSERT, entry,
+		   smp_num_cpus - 1);
 }
@@ -0,0 +1,115 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2018
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Alternatively, you can use or redistribute this file under the following
+ * BSD license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inmate.h>
+
+#include <inmate.h>
+
+#define X86_FEATURE_ERMS	(1 << 9)	/* CPUID.(EAX=7,ECX=0):EBX */
+
+#ifdef __x86_64__
+#define REP_MOVS_LONG		"rep movsq"
+#define REP_STOS_LONG		"rep stosq"
+#else
+#define REP_MOVS_LONG		"rep movsl"
+#define REP_STOS_LONG		"rep stosl"
+#endif
+
+/* -1: not yet probed, racing probes on other CPUs yield the same result */
+static int erms = -1;
+
+/*
+ * With Enhanced REP MOVSB/STOSB, the byte variants are the fastest option
+ * for all sizes. Otherwise, move longs first and the remaining bytes after
+ * that.
+ */
+static bool has_erms(void)
+{
+	u32 eax, ebx, ecx, edx;
+
+	if (erms < 0) {
+		asm volatile("cpuid"
+			: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+			: "a" (0));
+		if (eax >= 7)
+			asm volatile("cpuid"
+				: "=a" (eax), "=b" (ebx), "=c" (ecx),
+				  "=d" (edx)
+				: "a" (7), "c" (0));
+		else
+			ebx = 0;
+		erms = !!(ebx & X86_FEATURE_ERMS);
+	}
+	return erms;
+}
+
+void *memcpy(void *dest, const void *src, unsigned long n)
+{
+	unsigned long longs = n / sizeof(long);
+	void *d = dest;
+
+	if (has_erms()) {
+		asm volatile("rep movsb"
+			: "+D" (d), "+S" (src), "+c" (n) : : "memory");
+		return dest;
+	}
+
+	n %= sizeof(long);
+	asm volatile(REP_MOVS_LONG
+		: "+D" (d), "+S" (src), "+c" (longs) : : "memory");
+	asm volatile("rep movsb"
+		: "+D" (d), "+S" (src), "+c" (n) : : "memory");
+	return dest;
+}
+
+void *memset(void *s, int c, unsigned long n)
+{
+	unsigned long pattern = (u8)c * (~0UL / 0xff);
+	unsigned long longs = n / sizeof(long);
+	void *p = s;
+
+	if (has_erms()) {
+		asm volatile("rep stosb"
+			: "+D" (p), "+c" (n) : "a" (c) : "memory");
+		return s;
+	}
+
+	n %= sizeof(long);
+	asm volatile(REP_STOS_LONG
+		: "+D" (p), "+c" (longs) : "a" (pattern) : "memory");
+	asm volatile("rep stosb"
+		: "+D" (p), "+c" (n) : "a" (c) : "memory");
+	return s;
+}
@@ -40,6 +40,8 @@
 
 #define PM_TIMER_HZ		3579545
 #define PM_TIMER_OVERFLOW      ((0x1000000 * NS_PER_SEC) / PM_TIMER_HZ)
+/* 40.24 fixed-point, the product with the 24-bit counter fits in 64 bits */
+#define PM_TIMER_NS_MULT	((NS_PER_SEC << 24) / PM_TIMER_HZ)
 
 #define IA32_TSC_DEADLINE	0x6e0
 
@@ -49,12 +51,11 @@
 #define X2APIC_TMCCT		0x839
 #define X2APIC_TDCR		0x83e
 
-static unsigned long apic_tick_freq;
+static struct clock_scale ns_to_apic_ticks;
 static unsigned long pm_timer_last[SMP_MAX_CPUS];
 static unsigned long pm_timer_overflows[SMP_MAX_CPUS];
-static unsigned long tsc_freq, tsc_overflow;
-static unsigned long tsc_last[SMP_MAX_CPUS];
-static unsigned long tsc_overflows[SMP_MAX_CPUS];
+static unsigned long tsc_freq;
+static struct clock_scale tsc_to_ns;
 static bool tsc_deadline;
 
 static u64 rdtsc(void)
@@ -72,22 +73,25 @@ static u64 rdtsc(void)
 #endif
 }
 
-unsigned long tsc_read_ns(void)
+u64 tsc_read(void)
 {
-	unsigned int cpu = cpu_id();
-	unsigned long tmr;
+	return rdtsc();
+}
 
-	tmr = ((rdtsc() & 0xffffffffLL) * NS_PER_SEC) / tsc_freq;
-	if (tmr < tsc_last[cpu])
-		tsc_overflows[cpu] += tsc_overflow;
-	tsc_last[cpu] = tmr;
-	return tmr + tsc_overflows[cpu];
+u64 tsc_ticks_to_ns(u64 ticks)
+{
+	return clock_scale(&tsc_to_ns, ticks);
+}
+
+unsigned long tsc_read_ns(void)
+{
+	return clock_scale(&tsc_to_ns, rdtsc());
 }
 
 unsigned long tsc_init(void)
 {
 	tsc_freq = comm_region->tsc_khz * 1000L;
-	tsc_overflow = (0x100000000L * NS_PER_SEC) / tsc_freq;
+	clock_scale_init(&tsc_to_ns, tsc_freq, NS_PER_SEC);
 
 	return tsc_freq;
 }
@@ -97,8 +101,8 @@ unsigned long pm_timer_read(void)
 	unsigned int cpu = cpu_id();
 	unsigned long tmr;
 
-	tmr = ((inl(comm_region->pm_timer_address) & 0x00ffffff) * NS_PER_SEC)
-		/ PM_TIMER_HZ;
+	tmr = ((inl(comm_region->pm_timer_address) & 0x00ffffff) *
+	       PM_TIMER_NS_MULT) >> 24;
 	if (tmr < pm_timer_last[cpu])
 		pm_timer_overflows[cpu] += PM_TIMER_OVERFLOW;
 	pm_timer_last[cpu] = tmr;
@@ -115,7 +119,7 @@ void delay_us(unsigned long microsecs)
 
 unsigned long apic_timer_init(unsigned int vector)
 {
-	unsigned long apic_freq;
+	unsigned long apic_freq, apic_tick_freq;
 	unsigned long ecx;
 
 	asm volatile("cpuid" : "=c" (ecx) : "a" (1)
@@ -131,6 +135,8 @@ unsigned long apic_timer_init(unsigned int vector)
 		apic_freq = comm_region->apic_khz;
 	}
 
+	clock_scale_init(&ns_to_apic_ticks, NS_PER_SEC, apic_tick_freq);
+
 	write_msr(X2APIC_LVTT, vector);
 
 	/* Required when using TSC deadline mode. */
@@ -141,10 +147,40 @@ unsigned long apic_timer_init(unsigned int vector)
 
 void apic_timer_set(unsigned long timeout_ns)
 {
-	unsigned long long ticks =
-		(unsigned long long)timeout_ns * apic_tick_freq / NS_PER_SEC;
+	u64 ticks = clock_scale(&ns_to_apic_ticks, timeout_ns);
+
 	if (tsc_deadline)
 		write_msr(IA32_TSC_DEADLINE, rdtsc() + ticks);
 	else
 		write_msr(X2APIC_TMICT, ticks);
 }
+
+void arch_latency_init(void)
+{
+	tsc_init();
+}
+
+u64 arch_latency_now(void)
+{
+	return tsc_read_ns();
+}
+
+u64 arch_timebase_counter(void)
+{
+	return rdtsc();
+}
+
+void arch_latency_set_timer(u64 timeout)
+{
+	apic_timer_set(timeout);
+}
+
+u64 arch_latency_to_ns(u64 delta)
+{
+	return delta;
+}
+
+u64 arch_latency_from_ns(u64 ns)
+{
+	return ns;
+}
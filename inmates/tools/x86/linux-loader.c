@@ -13,7 +13,9 @@
 #include <inmate.h>
 
 struct boot_params {
-	u8	padding1[0x230];
+	u8	padding0[0x214];
+	u32	code32_start;
+	u8	padding1[0x230 - 0x214 - 4];
 	u32	kernel_alignment;
 	u8	padding2[0x250 - 0x230 - 4];
 	u64	setup_data;
@@ -62,6 +64,10 @@ void inmate_main(void)
 	smp_wait_for_all_cpus();
 	memcpy(setup_data->cpu_ids, smp_cpu_ids, SMP_MAX_CPUS);
 
-	entry = kernel + 0x200;
+	/*
+	 * jailhouse-cell-linux stores the 64-bit entry point here: offset 0x200
+	 * of a bzImage or the entry of an uncompressed vmlinux.
+	 */
+	entry = (void *)(unsigned long)boot.params.code32_start;
 	entry(0, &boot.params);
 }
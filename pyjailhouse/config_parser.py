@@ -0,0 +1,271 @@
+#
+# Jailhouse, a Linux-based partitioning hypervisor
+#
+# Copyright (c) Siemens AG, 2015-2020
+#
+# Authors:
+#  Jan Kiszka <jan.kiszka@siemens.com>
+#
+# This work is licensed under the terms of the GNU GPL, version 2.  See
+# the COPYING file in the top-level directory.
+#
+# Parser for binary system and cell configurations, see
+# include/jailhouse/cell-config.h for the layout. Sections that are not
+# interpreted are kept as raw data so that a parsed configuration can be
+# written back after modifying its memory regions.
+
+import struct
+
+CONFIG_REVISION = 15
+
+
+class ConfigError(Exception):
+    pass
+
+
+class MemRegion(object):
+    JAILHOUSE_MEM_READ = 0x0001
+    JAILHOUSE_MEM_WRITE = 0x0002
+    JAILHOUSE_MEM_EXECUTE = 0x0004
+    JAILHOUSE_MEM_DMA = 0x0008
+    JAILHOUSE_MEM_IO = 0x0010
+    JAILHOUSE_MEM_COMM_REGION = 0x0020
+    JAILHOUSE_MEM_LOADABLE = 0x0040
+    JAILHOUSE_MEM_ROOTSHARED = 0x0080
+    JAILHOUSE_MEM_IO_UNALIGNED = 0x0100
+    JAILHOUSE_MEM_COLORED = 0x0200
+    JAILHOUSE_MEM_IO_POSTED = 0x0400
+    JAILHOUSE_MEM_BALLOON = 0x0800
+    JAILHOUSE_MEM_TIMEBASE = 0x1000
+    JAILHOUSE_MEM_TRANSFER = 0x2000
+    JAILHOUSE_MEM_SHARED_IMAGE = 0x4000
+
+    BALLOON_CHUNK_SIZE = 0x200000
+
+    PAGE_SIZE = 0x1000
+
+    _FORMAT = '<QQQQ'
+    SIZE = struct.calcsize(_FORMAT)
+
+    def __init__(self, phys_start, virt_start, size, flags):
+        self.phys_start = phys_start
+        self.virt_start = virt_start
+        self.size = size
+        self.flags = flags
+
+    @staticmethod
+    def parse(data, offs):
+        return MemRegion(*struct.unpack_from(MemRegion._FORMAT, data, offs))
+
+    def pack(self):
+        return struct.pack(MemRegion._FORMAT, self.phys_start,
+                           self.virt_start, self.size, self.flags)
+
+    def phys_end(self):
+        return self.phys_start + self.size
+
+    def virt_end(self):
+        return self.virt_start + self.size
+
+    def is_subpage(self):
+        # same as JAILHOUSE_MEMORY_IS_SUBPAGE
+        return ((self.virt_start | self.size) & (MemRegion.PAGE_SIZE - 1)) \
+            != 0
+
+    def is_comm_region(self):
+        return (self.flags & MemRegion.JAILHOUSE_MEM_COMM_REGION) != 0
+
+    def __str__(self):
+        return 'phys 0x%x, virt 0x%x, size 0x%x, flags 0x%x' % \
+            (self.phys_start, self.virt_start, self.size, self.flags)
+
+
+class Irqchip(object):
+    _FORMAT = '<QII4I'
+    SIZE = struct.calcsize(_FORMAT)
+
+    def __init__(self, data, offs):
+        values = struct.unpack_from(Irqchip._FORMAT, data, offs)
+        self.address = values[0]
+        self.id = values[1]
+        self.pin_base = values[2]
+        self.pin_bitmap = values[3:]
+
+    def pins(self):
+        pins = set()
+        for word, bits in enumerate(self.pin_bitmap):
+            for bit in range(32):
+                if bits & (1 << bit):
+                    pins.add(self.pin_base + word * 32 + bit)
+        return pins
+
+
+class PCIDevice(object):
+    JAILHOUSE_PCI_TYPE_DEVICE = 0x01
+    JAILHOUSE_PCI_TYPE_BRIDGE = 0x02
+    JAILHOUSE_PCI_TYPE_IVSHMEM = 0x03
+
+    JAILHOUSE_SHMEM_FLAG_SECTIONS = 0x01
+    JAILHOUSE_SHMEM_FLAG_BAR2 = 0x02
+
+    _FORMAT = '<BBHH6IHHBBHHQIHBB'
+    SIZE = struct.calcsize(_FORMAT)
+    _SHMEM_REGION_OFFS = 48
+
+    def __init__(self, data, offs):
+        self.raw = bytearray(data[offs:offs + PCIDevice.SIZE])
+        values = struct.unpack_from(PCIDevice._FORMAT, data, offs)
+        self.type = values[0]
+        self.domain = values[2]
+        self.bdf = values[3]
+        self.caps_start = values[10]
+        self.num_caps = values[11]
+        self.shmem_region = values[17]
+        self.shmem_peers = values[19]
+        self.shmem_flags = values[20]
+
+    def is_ivshmem(self):
+        return self.type == PCIDevice.JAILHOUSE_PCI_TYPE_IVSHMEM
+
+    def num_shmem_regions(self):
+        # mirrors ivshmem_init()
+        if not self.shmem_flags & PCIDevice.JAILHOUSE_SHMEM_FLAG_SECTIONS:
+            return 1
+        return 2 + (self.shmem_peers or 2)
+
+    def pack(self):
+        struct.pack_into('<I', self.raw, PCIDevice._SHMEM_REGION_OFFS,
+                         self.shmem_region)
+        return bytes(self.raw)
+
+    def bdf_str(self):
+        return '%04x:%02x:%02x.%x' % (self.domain, self.bdf >> 8,
+                                      (self.bdf >> 3) & 0x1f, self.bdf & 7)
+
+
+class CellConfig(object):
+    SIGNATURE = b'JHCELL'
+
+    _HEADER_FORMAT = '<6sH32s4xIIIIIIIIIIIII'
+    _HEADER_SIZE = 144
+    _NUM_MEMORY_REGIONS_OFFS = 52
+    _CACHE_SIZE = 12
+    _PCI_CAP_SIZE = 8
+    _STREAM_ID_SIZE = 4
+    _MSR_RANGE_SIZE = 12
+    _CPUID_LEAF_SIZE = 28
+    _SMC_RANGE_SIZE = 8
+
+    def __init__(self, data, offs=0, root_cell=False):
+        if len(data) < offs + CellConfig._HEADER_SIZE:
+            raise ConfigError('truncated cell descriptor')
+
+        (signature,
+         self.revision,
+         name,
+         self.flags,
+         self.cpu_set_size,
+         num_memory_regions,
+         num_cache_regions,
+         num_irqchips,
+         pio_bitmap_size,
+         num_pci_devices,
+         self.num_pci_caps,
+         num_stream_ids,
+         num_msr_ranges,
+         num_cpuid_leaves,
+         num_smc_ranges,
+         self.vpci_irq_base) = \
+            struct.unpack_from(CellConfig._HEADER_FORMAT, data, offs)
+        # the root cell descriptor is versioned via the system configuration
+        if not root_cell:
+            if signature != CellConfig.SIGNATURE:
+                raise ConfigError('not a cell descriptor')
+            if self.revision != CONFIG_REVISION:
+                raise ConfigError('configuration revision mismatch')
+        self.name = name.split(b'\0')[0].decode()
+
+        self.header = bytearray(data[offs:offs + CellConfig._HEADER_SIZE])
+        offs += CellConfig._HEADER_SIZE
+
+        self.cpu_set = data[offs:offs + self.cpu_set_size]
+        offs += self.cpu_set_size
+
+        self.memory_regions = []
+        for n in range(num_memory_regions):
+            self.memory_regions.append(MemRegion.parse(data, offs))
+            offs += MemRegion.SIZE
+
+        size = num_cache_regions * CellConfig._CACHE_SIZE
+        self.cache_regions = data[offs:offs + size]
+        offs += size
+
+        self.irqchip_data = data[offs:offs + num_irqchips * Irqchip.SIZE]
+        self.irqchips = []
+        for n in range(num_irqchips):
+            self.irqchips.append(Irqchip(data, offs))
+            offs += Irqchip.SIZE
+
+        self.pio_bitmap = data[offs:offs + pio_bitmap_size]
+        offs += pio_bitmap_size
+
+        self.pci_devices = []
+        for n in range(num_pci_devices):
+            self.pci_devices.append(PCIDevice(data, offs))
+            offs += PCIDevice.SIZE
+
+        size = self.num_pci_caps * CellConfig._PCI_CAP_SIZE + \
+            num_stream_ids * CellConfig._STREAM_ID_SIZE + \
+            num_msr_ranges * CellConfig._MSR_RANGE_SIZE + \
+            num_cpuid_leaves * CellConfig._CPUID_LEAF_SIZE + \
+            num_smc_ranges * CellConfig._SMC_RANGE_SIZE
+        self.trailer = data[offs:offs + size]
+        offs += size
+
+        if len(data) < offs:
+            raise ConfigError('truncated configuration')
+        self.end = offs
+
+    def to_bytes(self):
+        struct.pack_into('<I', self.header,
+                         CellConfig._NUM_MEMORY_REGIONS_OFFS,
+                         len(self.memory_regions))
+        return bytes(self.header) + self.cpu_set + \
+            b''.join(mem.pack() for mem in self.memory_regions) + \
+            self.cache_regions + self.irqchip_data + self.pio_bitmap + \
+            b''.join(dev.pack() for dev in self.pci_devices) + self.trailer
+
+
+class SystemConfig(object):
+    SIGNATURE = b'JHSYST'
+
+    # offset of root_cell in struct jailhouse_system
+    _ROOT_CELL_OFFS = 514
+
+    def __init__(self, data):
+        (signature, self.revision) = struct.unpack_from('<6sH', data)
+        if signature != SystemConfig.SIGNATURE:
+            raise ConfigError('not a system configuration')
+        if self.revision != CONFIG_REVISION:
+            raise ConfigError('configuration revision mismatch')
+        self.header = data[:SystemConfig._ROOT_CELL_OFFS]
+        self.root_cell = CellConfig(data, SystemConfig._ROOT_CELL_OFFS,
+                                    root_cell=True)
+        self.end = self.root_cell.end
+
+    def to_bytes(self):
+        return self.header + self.root_cell.to_bytes()
+
+
+def parse(data):
+    """Parse a binary system or cell configuration.
+
+    Returns a tuple of the parsed configuration and its cell descriptor,
+    the root cell in case of a system configuration.
+    """
+    data = bytes(data)
+    if data[:6] == SystemConfig.SIGNATURE:
+        config = SystemConfig(data)
+        return (config, config.root_cell)
+    config = CellConfig(data)
+    return (config, config)
@@ -0,0 +1,234 @@
+#
+# Jailhouse, a Linux-based partitioning hypervisor
+#
+# Copyright (c) Siemens AG, 2020
+#
+# Authors:
+#  Jan Kiszka <jan.kiszka@siemens.com>
+#
+# This work is licensed under the terms of the GNU GPL, version 2.  See
+# the COPYING file in the top-level directory.
+#
+# Binding of libjailhouse, see tools/libjailhouse.h. Errors reported by the
+# library are raised as OSError.
+
+import ctypes
+import os
+
+JAILHOUSE_CELL_RUNNING = 0
+JAILHOUSE_CELL_RUNNING_LOCKED = 1
+JAILHOUSE_CELL_SHUT_DOWN = 2
+JAILHOUSE_CELL_FAILED = 3
+JAILHOUSE_CELL_FAILED_COMM_REV = 4
+
+JAILHOUSE_CELL_ID_UNUSED = -1
+JAILHOUSE_CELL_ID_NAMELEN = 31
+
+JAILHOUSE_CELL_ASYNC = 0x8000
+JAILHOUSE_CELL_LOAD_SNAPSHOT = 0x0001
+
+
+class CellId(ctypes.Structure):
+    _fields_ = [('id', ctypes.c_int32),
+                ('flags', ctypes.c_uint32),
+                ('name', ctypes.c_char * (JAILHOUSE_CELL_ID_NAMELEN + 1))]
+
+
+class PreloadImage(ctypes.Structure):
+    _fields_ = [('source_address', ctypes.c_uint64),
+                ('size', ctypes.c_uint64),
+                ('target_address', ctypes.c_uint64),
+                ('padding', ctypes.c_uint64)]
+
+
+class TraceRead(ctypes.Structure):
+    _fields_ = [('cpu', ctypes.c_uint32),
+                ('head', ctypes.c_uint32),
+                ('num_records', ctypes.c_uint32),
+                ('missed', ctypes.c_uint32),
+                ('records_address', ctypes.c_uint64)]
+
+
+def _load_library():
+    # prefer the library next to an uninstalled tools/ directory
+    local = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                         '..', 'tools', 'libjailhouse.so')
+    return ctypes.CDLL(local if os.path.exists(local) else 'libjailhouse.so',
+                       use_errno=True)
+
+
+_lib = _load_library()
+
+_lib.jailhouse_cell_stats_read.restype = ctypes.c_ssize_t
+_lib.jailhouse_console_read.restype = ctypes.c_ssize_t
+_lib.jailhouse_cpu_stats_map.restype = ctypes.c_void_p
+_lib.jailhouse_cpu_stats_unmap.argtypes = [ctypes.c_void_p]
+_lib.jailhouse_mem_pool_grow.argtypes = [ctypes.c_int, ctypes.c_uint64]
+
+
+def _check(ret):
+    if ret < 0:
+        raise OSError(-ret, os.strerror(-ret))
+    return ret
+
+
+def cell_id(cell):
+    """Return a CellId for a numeric ID or a cell name."""
+    if isinstance(cell, int):
+        return CellId(cell, 0, b'')
+    return CellId(JAILHOUSE_CELL_ID_UNUSED, 0,
+                  cell.encode()[:JAILHOUSE_CELL_ID_NAMELEN])
+
+
+def preload_images(images):
+    """Build the image array from (data, target_address) tuples.
+
+    Returns the array and the buffers it references which have to be kept
+    alive until the request completed.
+    """
+    buffers = [ctypes.create_string_buffer(bytes(data), len(data))
+               for (data, address) in images]
+    array = (PreloadImage * len(images))()
+    for n, (buf, (data, address)) in enumerate(zip(buffers, images)):
+        array[n] = PreloadImage(ctypes.addressof(buf), len(data), address, 0)
+    return (array, buffers)
+
+
+def op_wait(op_fd):
+    """Wait for an asynchronous request and return its result."""
+    return _check(_lib.jailhouse_op_wait(op_fd))
+
+
+def cell_state(id):
+    return _check(_lib.jailhouse_cell_state(id))
+
+
+def cell_balloon_pending(id):
+    return _check(_lib.jailhouse_cell_balloon_pending(id))
+
+
+def cell_stats_read(id, size=0x10000):
+    buf = ctypes.create_string_buffer(size)
+    ret = _check(_lib.jailhouse_cell_stats_read(id, buf, size))
+    return buf.raw[:ret]
+
+
+class CPUStats:
+    """Read-only view on the statistics page of a cell CPU."""
+
+    PAGE_SIZE = 0x1000
+
+    def __init__(self, id, cpu):
+        self.address = _lib.jailhouse_cpu_stats_map(id, cpu)
+        if not self.address:
+            err = ctypes.get_errno()
+            raise OSError(err, os.strerror(err))
+
+    def read(self, offset=0, size=PAGE_SIZE):
+        return ctypes.string_at(self.address + offset, size)
+
+    def close(self):
+        if self.address:
+            _lib.jailhouse_cpu_stats_unmap(self.address)
+            self.address = None
+
+    def __del__(self):
+        self.close()
+
+
+class Jailhouse:
+    """Handle on /dev/jailhouse."""
+
+    def __init__(self):
+        self.fd = _check(_lib.jailhouse_open())
+        # image buffers of asynchronous loads, by request descriptor
+        self.pending = {}
+
+    def close(self):
+        if self.fd >= 0:
+            os.close(self.fd)
+            self.fd = -1
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def enable(self, system_config):
+        _check(_lib.jailhouse_enable(self.fd, bytes(system_config)))
+
+    def disable(self):
+        _check(_lib.jailhouse_disable(self.fd))
+
+    def cell_create(self, config, flags=0):
+        config = bytes(config)
+        ret = _lib.jailhouse_cell_create(self.fd, config, len(config), flags)
+        return self._submitted(ret, [config], flags)
+
+    def _submitted(self, ret, buffers, flags):
+        _check(ret)
+        if flags & JAILHOUSE_CELL_ASYNC:
+            self.pending[ret] = buffers
+        return ret
+
+    def op_wait(self, op_fd):
+        """Wait for an asynchronous request and return its result."""
+        try:
+            return op_wait(op_fd)
+        finally:
+            self.pending.pop(op_fd, None)
+
+    def cell_load(self, cell, images, flags=0):
+        (array, buffers) = preload_images(images)
+        ret = _lib.jailhouse_cell_load(self.fd, ctypes.byref(cell_id(cell)),
+                                       array, len(images), flags)
+        return self._submitted(ret, buffers, flags)
+
+    def cell_start(self, cell, flags=0):
+        return _check(_lib.jailhouse_cell_start(self.fd,
+                                                ctypes.byref(cell_id(cell)),
+                                                flags))
+
+    def cell_reset(self, cell, flags=0):
+        return _check(_lib.jailhouse_cell_reset(self.fd,
+                                                ctypes.byref(cell_id(cell)),
+                                                flags))
+
+    def cell_destroy(self, cell, flags=0):
+        return _check(_lib.jailhouse_cell_destroy(self.fd,
+                                                  ctypes.byref(cell_id(cell)),
+                                                  flags))
+
+    def cell_balloon_update(self, cell, flags=0):
+        return _check(_lib.jailhouse_cell_balloon_update(
+            self.fd, ctypes.byref(cell_id(cell)), flags))
+
+    def cell_cpu_add(self, cell, cpu, flags=0):
+        return _check(_lib.jailhouse_cell_cpu_add(
+            self.fd, ctypes.byref(cell_id(cell)), cpu, flags))
+
+    def cell_cpu_remove(self, cell, cpu, flags=0):
+        return _check(_lib.jailhouse_cell_cpu_remove(
+            self.fd, ctypes.byref(cell_id(cell)), cpu, flags))
+
+    def cell_create_start(self, config, images, flags=0):
+        config = bytes(config)
+        (array, buffers) = preload_images(images)
+        ret = _lib.jailhouse_cell_create_start(self.fd, config, len(config),
+                                               array, len(images), flags)
+        return self._submitted(ret, buffers + [config], flags)
+
+    def console_read(self, size=4096):
+        buf = ctypes.create_string_buffer(size)
+        ret = _check(_lib.jailhouse_console_read(self.fd, buf, size))
+        return buf.raw[:ret]
+
+    def trace_read(self, trace):
+        _check(_lib.jailhouse_trace_read(self.fd, ctypes.byref(trace)))
+
+    def mem_pool_grow(self, size):
+        _check(_lib.jailhouse_mem_pool_grow(self.fd, size))
+
+    def mem_pool_shrink(self):
+        _check(_lib.jailhouse_mem_pool_shrink(self.fd))
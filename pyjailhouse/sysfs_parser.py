@@ -21,6 +21,7 @@
 import struct
 import os
 import fnmatch
+import re
 
 root_dir = "/"
 
@@ -49,6 +50,9 @@ inputs['files_opt'].add('/sys/class/tty/*/iomem_reg_shift')
 inputs['files_opt'].add('/sys/class/tty/*/io_type')
 inputs['files_opt'].add('/sys/class/tty/*/port')
 inputs['files_opt'].add('/sys/devices/jailhouse/enabled')
+inputs['files_opt'].add('/sys/devices/system/node/node*/cpulist')
+inputs['files_opt'].add('/sys/devices/system/node/node*/memory*/phys_index')
+inputs['files_opt'].add('/sys/devices/system/memory/block_size_bytes')
 # platform specific files
 inputs['files_intel'].add('/sys/firmware/acpi/tables/DMAR')
 inputs['files_amd'].add('/sys/firmware/acpi/tables/IVRS')
@@ -81,9 +85,9 @@ def input_open(name, mode='r', optional=False):
     return f
 
 
-def input_listdir(dir, wildcards):
+def input_listdir(dir, wildcards, optional=False):
     for w in wildcards:
-        check_input_listed(os.path.join(dir, w))
+        check_input_listed(os.path.join(dir, w), optional)
     dirs = os.listdir(os.path.join(root_dir, dir))
     dirs.sort()
     return dirs
@@ -437,7 +441,7 @@ def parse_ivrs(pcidevices, ioapics):
                     if variety == 0x01:  # IOAPIC
                         for chip in ioapics:
                             if chip.id == handle:
-                                chip.bdf = device_id
+                                chip.bdf = device_id_b
                                 chip.iommu = len(units) - 1
                 else:
                     # Reserved or ignored entries
@@ -496,6 +500,60 @@ def parse_ivrs(pcidevices, ioapics):
         return units, regions
 
 
+def parse_cpulist(cpulist):
+    cpus = set()
+    for entry in cpulist.strip().split(','):
+        if entry == '':
+            continue
+        bounds = entry.split('-')
+        cpus.update(range(int(bounds[0]), int(bounds[-1]) + 1))
+    return cpus
+
+
+def parse_numa_nodes():
+    """
+    Returns the NUMA nodes along with their CPUs and memory ranges, sorted by
+    node ID, or an empty list if the topology is unknown.
+    """
+    nodedir = '/sys/devices/system/node'
+    if not os.path.isdir(os.path.join(root_dir, nodedir)):
+        return []
+
+    f = input_open('/sys/devices/system/memory/block_size_bytes',
+                   optional=True)
+    block_size = int(f.read().strip() or '0', 16)
+    f.close()
+
+    nodes = []
+    for node in input_listdir(nodedir, ['node*/cpulist'], True):
+        m = re.match(r'node([0-9]+)$', node)
+        if m is None:
+            continue
+        path = os.path.join(nodedir, node)
+
+        f = input_open(os.path.join(path, 'cpulist'), optional=True)
+        cpus = parse_cpulist(f.read())
+        f.close()
+
+        blocks = []
+        if block_size:
+            for entry in input_listdir(path, ['memory*/phys_index'],
+                                       True):
+                if not re.match(r'memory[0-9]+$', entry):
+                    continue
+                f = input_open(os.path.join(path, entry, 'phys_index'),
+                               optional=True)
+                index = f.read().strip()
+                f.close()
+                if index:
+                    blocks.append(int(index, 16))
+
+        nodes.append(NUMANode(int(m.group(1)), cpus, blocks, block_size))
+
+    nodes.sort(key=lambda node: node.id)
+    return nodes
+
+
 def get_cpu_vendor():
     with open('/proc/cpuinfo') as f:
         for line in f:
@@ -754,6 +812,41 @@ class MemRegion:
         return 'JAILHOUSE_MEM_READ | JAILHOUSE_MEM_WRITE'
 
 
+class NUMANode:
+    def __init__(self, id, cpus, blocks, block_size):
+        self.id = id
+        self.cpus = cpus
+        # merge the memory blocks into (start, stop) ranges
+        self.ranges = []
+        for block in sorted(blocks):
+            start = block * block_size
+            if self.ranges and self.ranges[-1][1] + 1 == start:
+                self.ranges[-1] = (self.ranges[-1][0], start + block_size - 1)
+            else:
+                self.ranges.append((start, start + block_size - 1))
+
+    def cpus_str(self):
+        ranges = []
+        for cpu in sorted(self.cpus):
+            if ranges and ranges[-1][1] + 1 == cpu:
+                ranges[-1][1] = cpu
+            else:
+                ranges.append([cpu, cpu])
+        return ','.join(str(r[0]) if r[0] == r[1] else '%d-%d' % tuple(r)
+                        for r in ranges)
+
+    def ranges_str(self):
+        return ', '.join('0x%x-0x%x' % r for r in self.ranges)
+
+    def restrict(self, start, stop):
+        """
+        Returns the parts of the range from start to stop, both inclusive,
+        that are local to this node.
+        """
+        return [(max(start, r[0]), min(stop, r[1])) for r in self.ranges
+                if r[0] <= stop and r[1] >= start]
+
+
 class IOAPIC:
     def __init__(self, id, address, gsi_base, iommu=0, bdf=0):
         self.id = id
@@ -830,9 +923,9 @@ class IOMemRegionTree:
         return level, MemRegion(int(region[0], 16), int(region[1], 16), a[1])
 
     @staticmethod
-    def parse_iomem_file():
+    def parse_iomem_file(filename='/proc/iomem'):
         root = IOMemRegionTree(None, 0)
-        f = input_open('/proc/iomem')
+        f = input_open(filename)
         lastlevel = 0
         lastnode = root
         for line in f:
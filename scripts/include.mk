@@ -23,6 +23,8 @@ prefix		?= /usr/local
 exec_prefix	?= $(prefix)
 sbindir		?= $(exec_prefix)/sbin
 libexecdir	?= $(exec_prefix)/libexec
+libdir		?= $(exec_prefix)/lib
+includedir	?= $(prefix)/include
 datarootdir	?= $(prefix)/share
 datadir		?= $(datarootdir)
 man8dir		?= $(datarootdir)/man/man8
@@ -32,6 +34,8 @@ firmwaredir ?= /lib/firmware
 # all directories listed here will be created using a generic rule below
 INSTALL_DIRECTORIES := $(sbindir)		\
 		       $(libexecdir)		\
+		       $(libdir)		\
+		       $(includedir)		\
 		       $(datadir)		\
 		       $(man8dir)		\
 		       $(completionsdir)	\
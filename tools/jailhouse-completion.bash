@@ -185,7 +185,7 @@ function _jailhouse_cell() {
 			# did we already start to type string switch?
 			if [[ "${COMP_CWORD}" -eq 4 && "$cur" == -* ]]; then
 				COMPREPLY=( $( compgen \
-					-W "-s --string" -- \
+					-W "--snapshot -s --string" -- \
 					"${cur}") )
 			fi
 
@@ -222,6 +222,10 @@ function _jailhouse_cell() {
 		# takes only one argument (id/name)
 		_jailhouse_get_id "${cur}" "${prev}" no_root || return 1
 		;;
+	reset)
+		# takes only one argument (id/name)
+		_jailhouse_get_id "${cur}" "${prev}" no_root || return 1
+		;;
 	shutdown)
 		# takes only one argument (id/name)
 		_jailhouse_get_id "${cur}" "${prev}" no_root || return 1
@@ -242,7 +246,13 @@ function _jailhouse_cell() {
 		COMPREPLY=( $( compgen -W "-h --help" -- "${cur}") )
 		return 0;;
 	stats)
-		# takes only one argument (id/name)
+		# an id/name, followed by the output options
+		if [ "${COMP_CWORD}" -gt 3 ] && [ "${prev}" != "--name" ]; then
+			COMPREPLY=( $( compgen -W "--json --csv -i --interval \
+				--per-cpu" -- "${cur}") )
+			return 0
+		fi
+
 		_jailhouse_get_id "${cur}" "${prev}" with_root || return 1
 
 		if [ "${COMP_CWORD}" -eq 3 ]; then
@@ -257,6 +267,22 @@ function _jailhouse_cell() {
 	return 0
 }
 
+function _jailhouse_config_compile() {
+	local cur
+
+	cur="${COMP_WORDS[COMP_CWORD]}"
+
+	options="-h --help -n --check-only -p --peer"
+
+	if [[ "$cur" == -* ]]; then
+		COMPREPLY=( $( compgen -W "${options}" -- "${cur}") )
+	else
+		_filedir
+	fi
+
+	return 0
+}
+
 function _jailhouse_config_create() {
 	local cur prev
 
@@ -264,7 +290,7 @@ function _jailhouse_config_create() {
 	prev="${COMP_WORDS[COMP_CWORD-1]}"
 
 	options="-h --help -g --generate-collector -r --root -t --template-dir \
-		--mem-inmates --mem-hv"
+		--mem-inmates --mem-hv -n --numa-node"
 
 	# if we already have begun to write an option
 	if [[ "$cur" == -* ]]; then
@@ -277,7 +303,7 @@ function _jailhouse_config_create() {
 			_filedir -d
 			return $?
 			;;
-		--mem-inmates|--mem-hv)
+		--mem-inmates|--mem-hv|-n|--numa-node)
 			# we can't really predict this
 			return 0
 			;;
@@ -300,11 +326,12 @@ function _jailhouse() {
 	local command command_cell command_config cur prev subcommand
 
 	# first level
-	command="enable disable console cell config hardware --help"
+	command="enable disable console trace profile mem-pool cell config hardware \
+		--help"
 
 	# second level
-	command_cell="create load start shutdown destroy linux list stats"
-	command_config="create collect"
+	command_cell="create load start reset shutdown destroy linux list stats"
+	command_config="create collect compile"
 
 	# ${COMP_WORDS} array containing the words on the current command line
 	# ${COMP_CWORD} index into COMP_WORDS, pointing at the current position
@@ -331,12 +358,16 @@ function _jailhouse() {
 			# a root-cell configuration
 			_filedir "cell"
 			;;
-		console)
+		console|trace)
 			if [[ "$cur" == -* ]]; then
 				COMPREPLY=( $( compgen -W "-f --follow" -- \
 					"${cur}") )
 			fi
 			;;
+		profile)
+			# the hypervisor ELF object
+			_filedir "o"
+			;;
 		cell)
 			# one of the following subcommands
 			COMPREPLY=( $( compgen -W "${command_cell}" -- \
@@ -350,6 +381,9 @@ function _jailhouse() {
 		hardware)
 			COMPREPLY="check"
 			;;
+		mem-pool)
+			COMPREPLY=( $( compgen -W "grow shrink" -- "${cur}") )
+			;;
 		--help|disable)
 			# these first level commands have no further subcommand
 			# or option OR we don't even know it
@@ -373,6 +407,9 @@ function _jailhouse() {
 			create)
 				_jailhouse_config_create || return 1
 				;;
+			compile)
+				_jailhouse_config_compile || return 1
+				;;
 			collect)
 				# config-collect writes to a new file
 
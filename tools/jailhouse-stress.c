@@ -0,0 +1,236 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Load generator for the root cell, the noisy neighbour of the interference
+ * benchmark. "bandwidth" streams over a large buffer to saturate the memory
+ * bus, "llc" dirties cache lines of a buffer twice the size of the last-level
+ * cache in a scattered order to evict the lines of other cells.
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE		64
+#define DEFAULT_LLC_SIZE	(8UL << 20)
+#define DEFAULT_BW_SIZE		(64UL << 20)
+
+struct worker {
+	pthread_t thread;
+	unsigned char *buffer;
+	size_t size;
+	unsigned long long bytes;
+};
+
+static volatile sig_atomic_t stop;
+static void (*pattern_func)(struct worker *worker);
+
+static void __attribute__((noreturn))
+help(const char *prog, int exit_status)
+{
+	printf("Usage: %s [-p bandwidth|llc] [-s SIZE[K|M]] [-t THREADS] "
+	       "[-d SECONDS]\n"
+	       "\n"
+	       "Runs until interrupted or for the given duration, then reports "
+	       "the achieved\nthroughput. SIZE is the buffer size per thread "
+	       "(bandwidth: %lu MiB, llc: twice\nthe last-level cache), "
+	       "THREADS defaults to the number of online CPUs.\n",
+	       prog, DEFAULT_BW_SIZE >> 20);
+	exit(exit_status);
+}
+
+static void stream_pattern(struct worker *worker)
+{
+	unsigned long *pos = (unsigned long *)worker->buffer;
+	unsigned long *end = pos + worker->size / sizeof(*pos);
+
+	/* read-modify-write, all lines in order */
+	while (pos < end)
+		*pos++ += 1;
+	worker->bytes += worker->size * 2;
+}
+
+static size_t gcd(size_t a, size_t b)
+{
+	size_t tmp;
+
+	while (b) {
+		tmp = a % b;
+		a = b;
+		b = tmp;
+	}
+	return a;
+}
+
+static void thrash_pattern(struct worker *worker)
+{
+	size_t lines = worker->size / CACHE_LINE_SIZE;
+	/* a coprime stride visits all lines, a large one defeats prefetching */
+	size_t stride = lines / 3 + 1;
+	size_t n, line = 0;
+
+	while (gcd(stride, lines) != 1)
+		stride++;
+
+	for (n = 0; n < lines; n++) {
+		worker->buffer[line * CACHE_LINE_SIZE]++;
+		line += stride;
+		if (line >= lines)
+			line -= lines;
+	}
+	worker->bytes += lines * CACHE_LINE_SIZE;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *worker = arg;
+
+	while (!stop)
+		pattern_func(worker);
+	return NULL;
+}
+
+static void stop_handler(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static size_t parse_size(const char *arg)
+{
+	unsigned long long size;
+	char *end;
+
+	errno = 0;
+	size = strtoull(arg, &end, 0);
+	if (*end == 'K' || *end == 'k')
+		size <<= 10, end++;
+	else if (*end == 'M' || *end == 'm')
+		size <<= 20, end++;
+	if (errno || *end || size < CACHE_LINE_SIZE)
+		error(1, 0, "invalid size \"%s\"", arg);
+	return size & ~(CACHE_LINE_SIZE - 1ULL);
+}
+
+static size_t llc_size(void)
+{
+	long size = -1;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (size <= 0)
+		size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+	return size > 0 ? (size_t)size : DEFAULT_LLC_SIZE;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *pattern = "bandwidth";
+	struct timespec start, end;
+	unsigned long long total = 0;
+	struct worker *workers;
+	unsigned int duration = 0;
+	long threads = 0;
+	size_t size = 0;
+	double seconds;
+	long n;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:s:t:d:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			pattern = optarg;
+			break;
+		case 's':
+			size = parse_size(optarg);
+			break;
+		case 't':
+			threads = strtol(optarg, NULL, 0);
+			if (threads <= 0)
+				error(1, 0, "invalid thread count");
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			help(argv[0], 0);
+		default:
+			help(argv[0], 1);
+		}
+	}
+	if (optind != argc)
+		help(argv[0], 1);
+
+	if (strcmp(pattern, "bandwidth") == 0) {
+		pattern_func = stream_pattern;
+		if (!size)
+			size = DEFAULT_BW_SIZE;
+	} else if (strcmp(pattern, "llc") == 0) {
+		pattern_func = thrash_pattern;
+		if (!size)
+			size = llc_size() * 2;
+	} else {
+		error(1, 0, "unknown pattern \"%s\"", pattern);
+	}
+
+	if (!threads)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers)
+		error(1, errno, "calloc");
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	if (duration) {
+		signal(SIGALRM, stop_handler);
+		alarm(duration);
+	}
+
+	for (n = 0; n < threads; n++) {
+		workers[n].size = size;
+		workers[n].buffer = aligned_alloc(CACHE_LINE_SIZE, size);
+		if (!workers[n].buffer)
+			error(1, errno, "aligned_alloc");
+		/* fault in the buffer before the clock starts */
+		memset(workers[n].buffer, 0, size);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (n = 0; n < threads; n++) {
+		errno = pthread_create(&workers[n].thread, NULL, worker_fn,
+				       &workers[n]);
+		if (errno)
+			error(1, errno, "pthread_create");
+	}
+
+	for (n = 0; n < threads; n++) {
+		pthread_join(workers[n].thread, NULL);
+		total += workers[n].bytes;
+		free(workers[n].buffer);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(workers);
+
+	seconds = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("pattern=%s threads=%ld size=%zu mib_per_s=%.0f\n", pattern,
+	       threads, size, seconds > 0 ? total / seconds / (1 << 20) : 0);
+
+	return 0;
+}
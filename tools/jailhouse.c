@@ -20,11 +20,15 @@
 #include <errno.h>
 #include <limits.h>
 #include <libgen.h>
+#include <time.h>
+#include <elf.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <jailhouse.h>
+#include <jailhouse/header.h>
 
 #define JAILHOUSE_EXEC_DIR	LIBEXECDIR "/jailhouse"
 #define JAILHOUSE_DEVICE	"/dev/jailhouse"
@@ -47,11 +51,13 @@ static const struct extension extensions[] = {
 	{ "cell", "linux", "CELLCONFIG KERNEL [-i | --initrd FILE]\n"
 	  "              [-c | --cmdline \"STRING\"] "
 					"[-w | --write-params FILE]" },
-	{ "cell", "stats", "{ ID | [--name] NAME }" },
+	{ "cell", "stats", "{ ID | [--name] NAME } [--json | --csv]\n"
+	  "              [-i | --interval SECONDS] [--per-cpu]" },
 	{ "config", "create", "[-h] [-g] [-r ROOT] "
 	  "[--mem-inmates MEM_INMATES]\n"
-	  "                 [--mem-hv MEM_HV] FILE" },
+	  "                 [--mem-hv MEM_HV] [-n NODE] FILE" },
 	{ "config", "collect", "FILE.TAR" },
+	{ "config", "compile", "[-n] [-p CELLCONFIG]... CONFIG [OUTPUT]" },
 	{ "hardware", "check", "" },
 	{ NULL }
 };
@@ -65,14 +71,20 @@ static void __attribute__((noreturn)) help(char *prog, int exit_status)
 	       "   enable SYSCONFIG\n"
 	       "   disable\n"
 	       "   console [-f | --follow]\n"
+	       "   trace [-f | --follow]\n"
+	       "   profile HYPERVISOR_OBJECT [-d | --duration SECONDS]\n"
+	       "   mem-pool grow SIZE[K|M|G]\n"
+	       "   mem-pool shrink\n"
 	       "   cell create CELLCONFIG\n"
 	       "   cell list\n"
-	       "   cell load { ID | [--name] NAME } "
+	       "   cell load { ID | [--name] NAME } [--snapshot] "
 				"{ IMAGE | { -s | --string } \"STRING\" }\n"
 	       "             [-a | --address ADDRESS] ...\n"
 	       "   cell start { ID | [--name] NAME }\n"
+	       "   cell reset { ID | [--name] NAME }\n"
 	       "   cell shutdown { ID | [--name] NAME }\n"
-	       "   cell destroy { ID | [--name] NAME }\n",
+	       "   cell destroy { ID | [--name] NAME }\n"
+	       "   cell cpu { add | remove } { ID | [--name] NAME } CPU\n",
 	       basename(prog));
 	for (ext = extensions; ext->cmd; ext++)
 		printf("   %s %s %s\n", ext->cmd, ext->subcmd, ext->help);
@@ -173,6 +185,45 @@ static void *read_file(const char *name, size_t *size)
 	return buffer;
 }
 
+/*
+ * Map an image file instead of reading it into an intermediate buffer. The
+ * driver then copies straight from the page cache into the cell memory.
+ */
+static void *map_file(const char *name, size_t *size)
+{
+	struct stat stat;
+	void *buffer;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "opening %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	if (fstat(fd, &stat) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+
+	*size = stat.st_size;
+	if (*size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	buffer = mmap(NULL, *size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd,
+		      0);
+	if (buffer == MAP_FAILED) {
+		fprintf(stderr, "mapping %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+
+	close(fd);
+
+	return buffer;
+}
+
 static char *read_sysfs_cell_string(const unsigned int id, const char *entry)
 {
 	char *ret, buffer[128];
@@ -381,16 +432,24 @@ static int cell_shutdown_load(int argc, char *argv[],
 	struct jailhouse_preload_image *image;
 	struct jailhouse_cell_load *cell_load;
 	struct jailhouse_cell_id cell_id;
-	int err, fd, id_args, arg_num;
+	int err, fd, id_args, arg_num, first_image;
 	unsigned int images, n;
+	__u32 flags = 0;
+	bool *mapped;
 	size_t size;
 	char *endp;
 
 	id_args = parse_cell_id(&cell_id, argc - 3, &argv[3]);
 	arg_num = 3 + id_args;
+	if (mode == LOAD && arg_num < argc &&
+	    strcmp(argv[arg_num], "--snapshot") == 0) {
+		flags = JAILHOUSE_CELL_LOAD_SNAPSHOT;
+		arg_num++;
+	}
 	if (id_args == 0 || (mode == SHUTDOWN && arg_num != argc) ||
 	    (mode == LOAD && arg_num == argc))
 		help(argv[0], 1);
+	first_image = arg_num;
 
 	images = 0;
 	while (arg_num < argc) {
@@ -412,14 +471,16 @@ static int cell_shutdown_load(int argc, char *argv[],
 	}
 
 	cell_load = malloc(sizeof(*cell_load) + sizeof(*image) * images);
-	if (!cell_load) {
+	mapped = calloc(images ? images : 1, sizeof(*mapped));
+	if (!cell_load || !mapped) {
 		fprintf(stderr, "insufficient memory\n");
 		exit(1);
 	}
 	cell_load->cell_id = cell_id;
 	cell_load->num_preload_images = images;
+	cell_load->flags = flags;
 
-	arg_num = 3 + id_args;
+	arg_num = first_image;
 
 	for (n = 0, image = cell_load->image; n < images; n++, image++) {
 		if (match_opt(argv[arg_num], "-s", "--string")) {
@@ -429,8 +490,9 @@ static int cell_shutdown_load(int argc, char *argv[],
 							   &size);
 		} else {
 			image->source_address =
-				(unsigned long)read_file(argv[arg_num++],
-							 &size);
+				(unsigned long)map_file(argv[arg_num++],
+							&size);
+			mapped[n] = true;
 		}
 		image->size = size;
 		image->target_address = 0;
@@ -454,7 +516,12 @@ static int cell_shutdown_load(int argc, char *argv[],
 
 	close(fd);
 	for (n = 0, image = cell_load->image; n < images; n++, image++)
-		free((void *)(unsigned long)image->source_address);
+		if (!mapped[n])
+			free((void *)(unsigned long)image->source_address);
+		else if (image->size > 0)
+			munmap((void *)(unsigned long)image->source_address,
+			       image->size);
+	free(mapped);
 	free(cell_load);
 
 	return err;
@@ -477,6 +544,8 @@ static int cell_simple_cmd(int argc, char *argv[], unsigned int command)
 		       "JAILHOUSE_CELL_START" :
 		       command == JAILHOUSE_CELL_DESTROY ?
 		       "JAILHOUSE_CELL_DESTROY" :
+		       command == JAILHOUSE_CELL_RESET ?
+		       "JAILHOUSE_CELL_RESET" :
 		       "<unknown command>");
 
 	close(fd);
@@ -484,6 +553,45 @@ static int cell_simple_cmd(int argc, char *argv[], unsigned int command)
 	return err;
 }
 
+static int cell_cpu(int argc, char *argv[])
+{
+	struct jailhouse_cell_cpu cell_cpu;
+	unsigned int command;
+	int id_args, err, fd;
+	char *endp;
+
+	if (argc < 4)
+		help(argv[0], 1);
+
+	if (strcmp(argv[3], "add") == 0)
+		command = JAILHOUSE_CELL_CPU_ADD;
+	else if (strcmp(argv[3], "remove") == 0)
+		command = JAILHOUSE_CELL_CPU_REMOVE;
+	else
+		help(argv[0], 1);
+
+	memset(&cell_cpu, 0, sizeof(cell_cpu));
+	id_args = parse_cell_id(&cell_cpu.cell_id, argc - 4, &argv[4]);
+	if (id_args == 0 || 5 + id_args != argc)
+		help(argv[0], 1);
+
+	errno = 0;
+	cell_cpu.cpu = strtoul(argv[4 + id_args], &endp, 0);
+	if (errno != 0 || *endp != 0 || endp == argv[4 + id_args])
+		help(argv[0], 1);
+
+	fd = open_dev();
+
+	err = ioctl(fd, command, &cell_cpu);
+	if (err)
+		perror(command == JAILHOUSE_CELL_CPU_ADD ?
+		       "JAILHOUSE_CELL_CPU_ADD" : "JAILHOUSE_CELL_CPU_REMOVE");
+
+	close(fd);
+
+	return err;
+}
+
 static int cell_management(int argc, char *argv[])
 {
 	int err;
@@ -499,10 +607,14 @@ static int cell_management(int argc, char *argv[])
 		err = cell_shutdown_load(argc, argv, LOAD);
 	} else if (strcmp(argv[2], "start") == 0) {
 		err = cell_simple_cmd(argc, argv, JAILHOUSE_CELL_START);
+	} else if (strcmp(argv[2], "reset") == 0) {
+		err = cell_simple_cmd(argc, argv, JAILHOUSE_CELL_RESET);
 	} else if (strcmp(argv[2], "shutdown") == 0) {
 		err = cell_shutdown_load(argc, argv, SHUTDOWN);
 	} else if (strcmp(argv[2], "destroy") == 0) {
 		err = cell_simple_cmd(argc, argv, JAILHOUSE_CELL_DESTROY);
+	} else if (strcmp(argv[2], "cpu") == 0) {
+		err = cell_cpu(argc, argv);
 	} else {
 		call_extension_script("cell", argc, argv);
 		help(argv[0], 1);
@@ -550,6 +662,375 @@ out:
 	return ret;
 }
 
+static const char *trace_event_name(unsigned int event)
+{
+	switch (event) {
+	case JAILHOUSE_TRACE_VMEXIT:
+		return "vmexit";
+	case JAILHOUSE_TRACE_MMIO:
+		return "mmio";
+	case JAILHOUSE_TRACE_IRQ_PENDING:
+		return "irq_pending";
+	case JAILHOUSE_TRACE_IVSHMEM_IRQ:
+		return "ivshmem_irq";
+	case JAILHOUSE_TRACE_SAMPLE:
+		return "sample";
+	case JAILHOUSE_TRACE_CELL_MGMT:
+		return "cell_mgmt";
+	case JAILHOUSE_TRACE_CELL_MGMT_DONE:
+		return "cell_mgmt_done";
+	default:
+		return "unknown";
+	}
+}
+
+static int trace(int argc, char *argv[])
+{
+	struct jailhouse_trace_record records[64];
+	struct jailhouse_trace_read trace_read;
+	unsigned int cpu, n, *heads;
+	bool follow = false;
+	bool got_records;
+	long num_cpus;
+	int err = 0;
+	int fd;
+
+	if (argc == 3) {
+		if (match_opt(argv[2], "-f", "--follow"))
+			follow = true;
+		else
+			help(argv[0], 1);
+	}
+
+	num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (num_cpus < 1)
+		num_cpus = 1;
+
+	heads = calloc(num_cpus, sizeof(*heads));
+	if (!heads) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	do {
+		got_records = false;
+		for (cpu = 0; cpu < num_cpus; cpu++) {
+			trace_read.cpu = cpu;
+			trace_read.head = heads[cpu];
+			trace_read.num_records =
+				sizeof(records) / sizeof(records[0]);
+			trace_read.missed = 0;
+			trace_read.records_address = (unsigned long)records;
+
+			err = ioctl(fd, JAILHOUSE_TRACE_READ, &trace_read);
+			if (err) {
+				/* no more CPUs managed by the hypervisor */
+				if (errno == ENODEV) {
+					err = 0;
+					break;
+				}
+				perror("JAILHOUSE_TRACE_READ");
+				goto out;
+			}
+
+			if (trace_read.missed)
+				printf("<missed %u records on CPU %u>\n",
+				       trace_read.missed, cpu);
+			for (n = 0; n < trace_read.num_records; n++)
+				printf("%20llu %3u %-12s 0x%016llx "
+				       "0x%016llx\n", records[n].timestamp,
+				       records[n].cpu,
+				       trace_event_name(records[n].event),
+				       records[n].arg1, records[n].arg2);
+
+			if (trace_read.num_records)
+				got_records = true;
+			heads[cpu] = trace_read.head;
+		}
+
+		if (follow && !got_records) {
+			fflush(stdout);
+			usleep(100000);
+		}
+	} while (follow || got_records);
+
+out:
+	close(fd);
+	free(heads);
+
+	return err;
+}
+
+struct profile_symbol {
+	unsigned long long start;
+	unsigned long long size;
+	const char *name;
+	unsigned long hits;
+};
+
+static int profile_cmp_start(const void *a, const void *b)
+{
+	const struct profile_symbol *sym_a = a, *sym_b = b;
+
+	if (sym_a->start == sym_b->start)
+		return 0;
+	return sym_a->start < sym_b->start ? -1 : 1;
+}
+
+static int profile_cmp_hits(const void *a, const void *b)
+{
+	const struct profile_symbol *sym_a = a, *sym_b = b;
+
+	if (sym_a->hits == sym_b->hits)
+		return 0;
+	return sym_a->hits > sym_b->hits ? -1 : 1;
+}
+
+/*
+ * Load the function symbols of the hypervisor ELF object. It is linked
+ * against its final virtual address, so symbol values can be compared with
+ * the sampled program counters directly.
+ */
+static struct profile_symbol *read_symbols(const char *name,
+					   unsigned int *num_symbols)
+{
+	const Elf64_Shdr *shdr, *symtab = NULL;
+	struct profile_symbol *symbols;
+	const Elf64_Ehdr *ehdr;
+	const Elf64_Sym *sym;
+	const char *strtab;
+	unsigned int n, num;
+	size_t size;
+
+	ehdr = read_file(name, &size);
+	if (size < sizeof(*ehdr) ||
+	    memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    ehdr->e_shoff + ehdr->e_shnum * sizeof(*shdr) > size) {
+		fprintf(stderr, "%s: not a 64-bit ELF object\n", name);
+		exit(1);
+	}
+
+	shdr = (const void *)ehdr + ehdr->e_shoff;
+	for (n = 0; n < ehdr->e_shnum; n++)
+		if (shdr[n].sh_type == SHT_SYMTAB &&
+		    shdr[n].sh_link < ehdr->e_shnum)
+			symtab = &shdr[n];
+	if (!symtab) {
+		fprintf(stderr, "%s: no symbol table\n", name);
+		exit(1);
+	}
+
+	sym = (const void *)ehdr + symtab->sh_offset;
+	strtab = (const void *)ehdr + shdr[symtab->sh_link].sh_offset;
+	num = symtab->sh_size / sizeof(*sym);
+
+	symbols = calloc(num, sizeof(*symbols));
+	if (!symbols) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	*num_symbols = 0;
+	for (n = 0; n < num; n++, sym++) {
+		if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC)
+			continue;
+		symbols[*num_symbols].start = sym->st_value;
+		symbols[*num_symbols].size = sym->st_size;
+		symbols[*num_symbols].name = strtab + sym->st_name;
+		(*num_symbols)++;
+	}
+
+	qsort(symbols, *num_symbols, sizeof(*symbols), profile_cmp_start);
+
+	return symbols;
+}
+
+static struct profile_symbol *find_symbol(struct profile_symbol *symbols,
+					  unsigned int num_symbols,
+					  unsigned long long pc)
+{
+	unsigned int lower = 0, upper = num_symbols;
+	struct profile_symbol *sym;
+
+	/* find the last symbol starting at or below pc */
+	while (upper - lower > 1) {
+		if (symbols[(lower + upper) / 2].start <= pc)
+			lower = (lower + upper) / 2;
+		else
+			upper = (lower + upper) / 2;
+	}
+
+	sym = &symbols[lower];
+	if (num_symbols == 0 || pc < sym->start ||
+	    (sym->size && pc >= sym->start + sym->size))
+		return NULL;
+	return sym;
+}
+
+static int profile(int argc, char *argv[])
+{
+	struct jailhouse_trace_record records[64];
+	struct jailhouse_trace_read trace_read;
+	unsigned long total = 0, unknown = 0;
+	unsigned int cpu, n, *heads, num_symbols;
+	struct profile_symbol *symbols, *sym;
+	unsigned long missed = 0;
+	unsigned long duration = 10;
+	bool collecting = false;
+	time_t end = 0;
+	bool pending;
+	long num_cpus;
+	char *endp;
+	int err = 0;
+	int fd;
+
+	if (argc == 5 && match_opt(argv[3], "-d", "--duration")) {
+		errno = 0;
+		duration = strtoul(argv[4], &endp, 0);
+		if (errno != 0 || endp == argv[4] || *endp != 0)
+			help(argv[0], 1);
+	} else if (argc != 3) {
+		help(argv[0], 1);
+	}
+
+	symbols = read_symbols(argv[2], &num_symbols);
+
+	num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (num_cpus < 1)
+		num_cpus = 1;
+
+	heads = calloc(num_cpus, sizeof(*heads));
+	if (!heads) {
+		fprintf(stderr, "insufficient memory\n");
+		exit(1);
+	}
+
+	fd = open_dev();
+
+	/* skip what was recorded before, then collect for the duration */
+	do {
+		pending = false;
+		for (cpu = 0; cpu < num_cpus; cpu++) {
+			trace_read.cpu = cpu;
+			trace_read.head = heads[cpu];
+			trace_read.num_records =
+				sizeof(records) / sizeof(records[0]);
+			trace_read.missed = 0;
+			trace_read.records_address = (unsigned long)records;
+
+			err = ioctl(fd, JAILHOUSE_TRACE_READ, &trace_read);
+			if (err) {
+				/* no more CPUs managed by the hypervisor */
+				if (errno == ENODEV) {
+					err = 0;
+					break;
+				}
+				perror("JAILHOUSE_TRACE_READ");
+				goto out;
+			}
+			heads[cpu] = trace_read.head;
+
+			if (trace_read.num_records ==
+			    sizeof(records) / sizeof(records[0]))
+				pending = true;
+			if (!collecting)
+				continue;
+
+			missed += trace_read.missed;
+			for (n = 0; n < trace_read.num_records; n++) {
+				if (records[n].event != JAILHOUSE_TRACE_SAMPLE)
+					continue;
+				sym = find_symbol(symbols, num_symbols,
+						  records[n].arg1);
+				if (sym)
+					sym->hits++;
+				else
+					unknown++;
+				total++;
+			}
+		}
+
+		if (!collecting && !pending) {
+			collecting = true;
+			end = time(NULL) + duration;
+		}
+		if (collecting && !pending)
+			usleep(100000);
+	} while (!collecting || time(NULL) < end);
+
+	if (total == 0) {
+		printf("No samples recorded. Was the hypervisor built with "
+		       "CONFIG_PROFILE_SAMPLING?\n");
+		goto out;
+	}
+
+	printf("%lu samples", total);
+	if (missed)
+		printf(", %lu trace records missed", missed);
+	printf("\n\n%8s %10s  %s\n", "%", "samples", "function");
+
+	qsort(symbols, num_symbols, sizeof(*symbols), profile_cmp_hits);
+	for (n = 0; n < num_symbols && symbols[n].hits; n++)
+		printf("%7.2f%% %10lu  %s\n", symbols[n].hits * 100.0 / total,
+		       symbols[n].hits, symbols[n].name);
+	if (unknown)
+		printf("%7.2f%% %10lu  [unknown]\n", unknown * 100.0 / total,
+		       unknown);
+
+out:
+	close(fd);
+	free(heads);
+	free(symbols);
+
+	return err;
+}
+
+static int mem_pool(int argc, char *argv[])
+{
+	struct jailhouse_mem_pool_grow grow;
+	char *endp;
+	int err, fd;
+
+	if (argc == 4 && strcmp(argv[2], "grow") == 0) {
+		errno = 0;
+		grow.size = strtoull(argv[3], &endp, 0);
+		if (errno != 0 || endp == argv[3])
+			help(argv[0], 1);
+		switch (*endp) {
+		case 'G':
+			grow.size <<= 10;
+			/* fall through */
+		case 'M':
+			grow.size <<= 10;
+			/* fall through */
+		case 'K':
+			grow.size <<= 10;
+			endp++;
+			break;
+		}
+		if (*endp != 0)
+			help(argv[0], 1);
+
+		fd = open_dev();
+		err = ioctl(fd, JAILHOUSE_MEM_POOL_GROW, &grow);
+		if (err)
+			perror("JAILHOUSE_MEM_POOL_GROW");
+	} else if (argc == 3 && strcmp(argv[2], "shrink") == 0) {
+		fd = open_dev();
+		err = ioctl(fd, JAILHOUSE_MEM_POOL_SHRINK);
+		if (err)
+			perror("JAILHOUSE_MEM_POOL_SHRINK");
+	} else {
+		help(argv[0], 1);
+	}
+
+	close(fd);
+	return err;
+}
+
 int main(int argc, char *argv[])
 {
 	int fd;
@@ -570,6 +1051,12 @@ int main(int argc, char *argv[])
 		err = cell_management(argc, argv);
 	} else if (strcmp(argv[1], "console") == 0) {
 		err = console(argc, argv);
+	} else if (strcmp(argv[1], "trace") == 0) {
+		err = trace(argc, argv);
+	} else if (strcmp(argv[1], "profile") == 0) {
+		err = profile(argc, argv);
+	} else if (strcmp(argv[1], "mem-pool") == 0) {
+		err = mem_pool(argc, argv);
 	} else if (strcmp(argv[1], "config") == 0 ||
 		   strcmp(argv[1], "hardware") == 0) {
 		call_extension_script(argv[1], argc, argv);
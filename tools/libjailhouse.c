@@ -0,0 +1,324 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/types.h>
+
+#include <jailhouse/hypercall.h>
+
+#include "libjailhouse.h"
+
+#define JAILHOUSE_DEVICE	"/dev/jailhouse"
+#define JAILHOUSE_CELLS		"/sys/devices/jailhouse/cells/"
+
+#define PAGE_SIZE		4096
+
+static const struct {
+	const char *name;
+	int state;
+} cell_states[] = {
+	{ "running\n", JAILHOUSE_CELL_RUNNING },
+	{ "running/locked\n", JAILHOUSE_CELL_RUNNING_LOCKED },
+	{ "shut down\n", JAILHOUSE_CELL_SHUT_DOWN },
+	{ "failed\n", JAILHOUSE_CELL_FAILED },
+	{ "Comm ABI mismatch\n", JAILHOUSE_CELL_FAILED_COMM_REV },
+};
+
+static int ioctl_result(int ret)
+{
+	return ret < 0 ? -errno : ret;
+}
+
+static ssize_t read_cell_entry(int id, const char *entry, void *buf,
+			       size_t size)
+{
+	char path[64];
+	ssize_t ret;
+	int fd;
+
+	snprintf(path, sizeof(path), JAILHOUSE_CELLS "%d/%s", id, entry);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	ret = read(fd, buf, size);
+	if (ret < 0)
+		ret = -errno;
+	close(fd);
+
+	return ret;
+}
+
+int jailhouse_open(void)
+{
+	int fd = open(JAILHOUSE_DEVICE, O_RDWR | O_CLOEXEC);
+
+	return fd < 0 ? -errno : fd;
+}
+
+int jailhouse_enable(int fd, const void *system_config)
+{
+	return ioctl_result(ioctl(fd, JAILHOUSE_ENABLE, system_config));
+}
+
+int jailhouse_disable(int fd)
+{
+	return ioctl_result(ioctl(fd, JAILHOUSE_DISABLE));
+}
+
+void jailhouse_cell_id_set(struct jailhouse_cell_id *cell_id, int id,
+			   const char *name)
+{
+	memset(cell_id, 0, sizeof(*cell_id));
+	cell_id->id = id;
+	if (name)
+		strncpy(cell_id->name, name, JAILHOUSE_CELL_ID_NAMELEN);
+}
+
+int jailhouse_cell_create(int fd, const void *config, size_t size,
+			  unsigned int flags)
+{
+	struct jailhouse_cell_create cell_create = {
+		.config_address = (unsigned long)config,
+		.config_size = size,
+		.flags = flags,
+	};
+
+	return ioctl_result(ioctl(fd, JAILHOUSE_CELL_CREATE, &cell_create));
+}
+
+int jailhouse_cell_load(int fd, const struct jailhouse_cell_id *cell_id,
+			const struct jailhouse_preload_image *images,
+			unsigned int num_images, unsigned int flags)
+{
+	struct jailhouse_cell_load *cell_load;
+	int ret;
+
+	cell_load = calloc(1, sizeof(*cell_load) +
+			   num_images * sizeof(*images));
+	if (!cell_load)
+		return -ENOMEM;
+
+	cell_load->cell_id = *cell_id;
+	cell_load->num_preload_images = num_images;
+	cell_load->flags = flags;
+	memcpy(cell_load->image, images, num_images * sizeof(*images));
+
+	ret = ioctl_result(ioctl(fd, JAILHOUSE_CELL_LOAD, cell_load));
+	free(cell_load);
+
+	return ret;
+}
+
+static int cell_id_request(int fd, unsigned long request,
+			   const struct jailhouse_cell_id *cell_id,
+			   unsigned int flags)
+{
+	struct jailhouse_cell_id id = *cell_id;
+
+	id.flags = flags;
+	return ioctl_result(ioctl(fd, request, &id));
+}
+
+int jailhouse_cell_start(int fd, const struct jailhouse_cell_id *cell_id,
+			 unsigned int flags)
+{
+	return cell_id_request(fd, JAILHOUSE_CELL_START, cell_id, flags);
+}
+
+int jailhouse_cell_reset(int fd, const struct jailhouse_cell_id *cell_id,
+			 unsigned int flags)
+{
+	return cell_id_request(fd, JAILHOUSE_CELL_RESET, cell_id, flags);
+}
+
+int jailhouse_cell_destroy(int fd, const struct jailhouse_cell_id *cell_id,
+			   unsigned int flags)
+{
+	return cell_id_request(fd, JAILHOUSE_CELL_DESTROY, cell_id, flags);
+}
+
+int jailhouse_cell_balloon_update(int fd,
+				  const struct jailhouse_cell_id *cell_id,
+				  unsigned int flags)
+{
+	return cell_id_request(fd, JAILHOUSE_CELL_BALLOON_UPDATE, cell_id,
+			       flags);
+}
+
+static int cell_cpu_request(int fd, unsigned long request,
+			    const struct jailhouse_cell_id *cell_id,
+			    unsigned int cpu, unsigned int flags)
+{
+	struct jailhouse_cell_cpu cell_cpu;
+
+	memset(&cell_cpu, 0, sizeof(cell_cpu));
+	cell_cpu.cell_id = *cell_id;
+	cell_cpu.cell_id.flags = flags;
+	cell_cpu.cpu = cpu;
+	return ioctl_result(ioctl(fd, request, &cell_cpu));
+}
+
+int jailhouse_cell_cpu_add(int fd, const struct jailhouse_cell_id *cell_id,
+			   unsigned int cpu, unsigned int flags)
+{
+	return cell_cpu_request(fd, JAILHOUSE_CELL_CPU_ADD, cell_id, cpu,
+				flags);
+}
+
+int jailhouse_cell_cpu_remove(int fd, const struct jailhouse_cell_id *cell_id,
+			      unsigned int cpu, unsigned int flags)
+{
+	return cell_cpu_request(fd, JAILHOUSE_CELL_CPU_REMOVE, cell_id, cpu,
+				flags);
+}
+
+int jailhouse_cell_create_start(int fd, const void *config, size_t size,
+				const struct jailhouse_preload_image *images,
+				unsigned int num_images, unsigned int flags)
+{
+	struct jailhouse_cell_create_start *create_start;
+	int ret;
+
+	create_start = calloc(1, sizeof(*create_start) +
+			      num_images * sizeof(*images));
+	if (!create_start)
+		return -ENOMEM;
+
+	create_start->create.config_address = (unsigned long)config;
+	create_start->create.config_size = size;
+	create_start->create.flags = flags;
+	create_start->num_preload_images = num_images;
+	memcpy(create_start->image, images, num_images * sizeof(*images));
+
+	ret = ioctl_result(ioctl(fd, JAILHOUSE_CELL_CREATE_START,
+				 create_start));
+	free(create_start);
+
+	return ret;
+}
+
+int jailhouse_op_wait(int op_fd)
+{
+	struct pollfd pfd = { .fd = op_fd, .events = POLLIN };
+	__s32 result;
+	ssize_t ret;
+
+	do {
+		ret = poll(&pfd, 1, -1);
+	} while (ret < 0 && errno == EINTR);
+	if (ret >= 0)
+		ret = read(op_fd, &result, sizeof(result));
+
+	if (ret < 0)
+		ret = -errno;
+	else if (ret != sizeof(result))
+		ret = -EIO;
+	else
+		ret = result;
+	close(op_fd);
+
+	return ret;
+}
+
+int jailhouse_cell_state(int id)
+{
+	char buf[32];
+	unsigned int n;
+	ssize_t ret;
+
+	ret = read_cell_entry(id, "state", buf, sizeof(buf) - 1);
+	if (ret < 0)
+		return ret;
+	buf[ret] = 0;
+
+	for (n = 0; n < sizeof(cell_states) / sizeof(cell_states[0]); n++)
+		if (strcmp(buf, cell_states[n].name) == 0)
+			return cell_states[n].state;
+
+	return -EINVAL;
+}
+
+int jailhouse_cell_balloon_pending(int id)
+{
+	char buf[16];
+	ssize_t ret;
+
+	ret = read_cell_entry(id, "balloon_pending", buf, sizeof(buf) - 1);
+	if (ret < 0)
+		return ret;
+	buf[ret] = 0;
+
+	return atoi(buf);
+}
+
+ssize_t jailhouse_cell_stats_read(int id, void *buf, size_t size)
+{
+	return read_cell_entry(id, "statistics/raw", buf, size);
+}
+
+const void *jailhouse_cpu_stats_map(int id, unsigned int cpu)
+{
+	char path[80];
+	void *stats;
+	int fd;
+
+	snprintf(path, sizeof(path), JAILHOUSE_CELLS "%d/statistics/cpu%u/raw",
+		 id, cpu);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	stats = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	/* the mapping stays valid after closing */
+	close(fd);
+
+	return stats == MAP_FAILED ? NULL : stats;
+}
+
+void jailhouse_cpu_stats_unmap(const void *stats)
+{
+	munmap((void *)stats, PAGE_SIZE);
+}
+
+ssize_t jailhouse_console_read(int fd, char *buf, size_t size)
+{
+	ssize_t ret = read(fd, buf, size);
+
+	return ret < 0 ? -errno : ret;
+}
+
+int jailhouse_trace_read(int fd, struct jailhouse_trace_read *trace)
+{
+	return ioctl_result(ioctl(fd, JAILHOUSE_TRACE_READ, trace));
+}
+
+int jailhouse_mem_pool_grow(int fd, uint64_t size)
+{
+	struct jailhouse_mem_pool_grow grow = { .size = size };
+
+	return ioctl_result(ioctl(fd, JAILHOUSE_MEM_POOL_GROW, &grow));
+}
+
+int jailhouse_mem_pool_shrink(int fd)
+{
+	return ioctl_result(ioctl(fd, JAILHOUSE_MEM_POOL_SHRINK));
+}
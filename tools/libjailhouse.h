@@ -0,0 +1,99 @@
+/*
+ * Jailhouse, a Linux-based partitioning hypervisor
+ *
+ * Copyright (c) Siemens AG, 2020
+ *
+ * Authors:
+ *  Jan Kiszka <jan.kiszka@siemens.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * C interface to the Jailhouse driver for management applications. All
+ * functions return 0 or a non-negative value on success and a negative error
+ * code (-errno) on failure. Functions taking a device descriptor expect one
+ * returned by jailhouse_open().
+ */
+
+#ifndef _LIBJAILHOUSE_H
+#define _LIBJAILHOUSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <jailhouse.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int jailhouse_open(void);
+
+int jailhouse_enable(int fd, const void *system_config);
+int jailhouse_disable(int fd);
+
+void jailhouse_cell_id_set(struct jailhouse_cell_id *cell_id, int id,
+			   const char *name);
+
+/*
+ * With JAILHOUSE_CELL_ASYNC in flags, the request functions return the
+ * descriptor reporting its completion, see jailhouse_op_wait().
+ */
+int jailhouse_cell_create(int fd, const void *config, size_t size,
+			  unsigned int flags);
+int jailhouse_cell_load(int fd, const struct jailhouse_cell_id *cell_id,
+			const struct jailhouse_preload_image *images,
+			unsigned int num_images, unsigned int flags);
+int jailhouse_cell_start(int fd, const struct jailhouse_cell_id *cell_id,
+			 unsigned int flags);
+int jailhouse_cell_reset(int fd, const struct jailhouse_cell_id *cell_id,
+			 unsigned int flags);
+int jailhouse_cell_destroy(int fd, const struct jailhouse_cell_id *cell_id,
+			   unsigned int flags);
+int jailhouse_cell_create_start(int fd, const void *config, size_t size,
+				const struct jailhouse_preload_image *images,
+				unsigned int num_images, unsigned int flags);
+/* Applies the pending balloon requests, see jailhouse_cell_balloon_pending. */
+int jailhouse_cell_balloon_update(int fd,
+				  const struct jailhouse_cell_id *cell_id,
+				  unsigned int flags);
+
+/* Moves a CPU between the root cell and a cell with elastic CPUs. */
+int jailhouse_cell_cpu_add(int fd, const struct jailhouse_cell_id *cell_id,
+			   unsigned int cpu, unsigned int flags);
+int jailhouse_cell_cpu_remove(int fd, const struct jailhouse_cell_id *cell_id,
+			      unsigned int cpu, unsigned int flags);
+
+/* Waits for an asynchronous request, closes op_fd and returns the result. */
+int jailhouse_op_wait(int op_fd);
+
+/* Returns the JAILHOUSE_CELL_* state of the cell with the given ID. */
+int jailhouse_cell_state(int id);
+/* Returns the number of memory chunks the cell wants to release or reclaim. */
+int jailhouse_cell_balloon_pending(int id);
+
+/*
+ * Reads the struct jailhouse_cpu_stats of all CPUs of a cell, in ascending
+ * CPU order. Returns the number of bytes read.
+ */
+ssize_t jailhouse_cell_stats_read(int id, void *buf, size_t size);
+/*
+ * Maps the struct jailhouse_cpu_stats that the hypervisor updates for a CPU
+ * of a cell. Returns NULL and sets errno on failure.
+ */
+const void *jailhouse_cpu_stats_map(int id, unsigned int cpu);
+void jailhouse_cpu_stats_unmap(const void *stats);
+
+/* Reads from the hypervisor console, fd may be opened with O_NONBLOCK. */
+ssize_t jailhouse_console_read(int fd, char *buf, size_t size);
+int jailhouse_trace_read(int fd, struct jailhouse_trace_read *trace);
+
+int jailhouse_mem_pool_grow(int fd, uint64_t size);
+int jailhouse_mem_pool_shrink(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_LIBJAILHOUSE_H */